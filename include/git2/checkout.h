@@ -303,6 +303,14 @@ typedef struct git_checkout_options {
 	/** Optional callback to notify the consumer of performance data. */
 	git_checkout_perfdata_cb perfdata_cb;
 	void *perfdata_payload;
+
+	/**
+	 * The number of threads to read and write the files with.  The
+	 * default of 0, like 1, writes them on the calling thread.  With
+	 * more threads, any custom filters must be safe to run on several
+	 * threads at once.
+	 */
+	unsigned int threads;
 } git_checkout_options;
 
 #define GIT_CHECKOUT_OPTIONS_VERSION 1
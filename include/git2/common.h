@@ -203,7 +203,16 @@ typedef enum {
 	GIT_OPT_ENABLE_UNSAVED_INDEX_SAFETY,
 	GIT_OPT_GET_PACK_MAX_OBJECTS,
 	GIT_OPT_SET_PACK_MAX_OBJECTS,
-	GIT_OPT_DISABLE_PACK_KEEP_FILE_CHECKS
+	GIT_OPT_DISABLE_PACK_KEEP_FILE_CHECKS,
+	GIT_OPT_SET_CACHE_TYPE_MAX_SIZE,
+	GIT_OPT_GET_CACHED_TYPE_MEMORY,
+	GIT_OPT_GET_CACHE_STATS,
+	GIT_OPT_RESET_CACHE_STATS,
+	GIT_OPT_ENABLE_PACKED_REFS_MMAP,
+	GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE,
+	GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY,
+	GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+	GIT_OPT_RESET_DELTA_BASE_CACHE_STATS
 } git_libgit2_opt_t;
 
 /**
@@ -397,6 +406,66 @@ typedef enum {
  *		> This will cause .keep file existence checks to be skipped when
  *		> accessing packfiles, which can help performance with remote filesystems.
  *
+ *	* opts(GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, git_object_t type, ssize_t max_storage_bytes)
+ *
+ *		> Set the maximum total data size that objects of the given type
+ *		> may use in the cache across all repositories.  Objects of that
+ *		> type are evicted first when the limit is reached, so that one
+ *		> type of object cannot push the others out of the cache.  Setting
+ *		> it to zero means that the type is only limited by the maximum
+ *		> cache size.  Defaults to 64MB for GIT_OBJECT_BLOB and to zero for
+ *		> the other types.
+ *
+ *	* opts(GIT_OPT_GET_CACHED_TYPE_MEMORY, git_object_t type, ssize_t *current, ssize_t *allowed)
+ *
+ *		> Get the current bytes in cache for objects of the given type and
+ *		> the maximum that would be allowed for them (zero if they are
+ *		> only limited by the maximum cache size).
+ *
+ *	* opts(GIT_OPT_GET_CACHE_STATS, size_t *hits, size_t *misses, size_t *evictions)
+ *
+ *		> Get the number of lookups that were served from the cache, the
+ *		> number of lookups that were not, and the number of objects that
+ *		> were evicted to make room for others, across all repositories.
+ *
+ *	* opts(GIT_OPT_RESET_CACHE_STATS)
+ *
+ *		> Reset the counters returned by `GIT_OPT_GET_CACHE_STATS` to zero.
+ *
+ *	* opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, int enabled)
+ *
+ *		> Read the `packed-refs` file of repositories that are opened
+ *		> afterwards in place, by mapping it into memory, instead of
+ *		> parsing all of it whenever it changes.  References are looked
+ *		> up with a binary search, which relies on the file declaring
+ *		> that it is `sorted`, as git and libgit2 write it; other files
+ *		> are parsed as before.  This defaults to disabled.
+ *
+ *	* opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, size_t max_storage_bytes)
+ *
+ *		> Set the maximum data size that the delta base cache may use,
+ *		> across all the packfiles of all repositories.  The cache keeps
+ *		> the objects that deltas were applied to, so that reading other
+ *		> objects against the same bases does not inflate them again; the
+ *		> least recently used bases are evicted first.  Setting it to
+ *		> zero disables the cache.  This defaults to 96MB.
+ *
+ *	* opts(GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY, size_t *current, size_t *allowed)
+ *
+ *		> Get the current bytes in the delta base cache and the maximum
+ *		> that would be allowed.
+ *
+ *	* opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS, size_t *hits, size_t *misses, size_t *saved_bytes)
+ *
+ *		> Get the number of delta bases that were found in the delta base
+ *		> cache, the number that were not, and the total inflated size of
+ *		> the bases that were found, which did not have to be read again.
+ *
+ *	* opts(GIT_OPT_RESET_DELTA_BASE_CACHE_STATS)
+ *
+ *		> Reset the counters returned by
+ *		> `GIT_OPT_GET_DELTA_BASE_CACHE_STATS` to zero.
+ *
  * @param option Option key
  * @param ... value to set the option
  * @return 0 on success, <0 on failure
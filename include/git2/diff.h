@@ -430,6 +430,15 @@ typedef struct {
 	 * Defaults to "b".
 	 */
 	const char *new_prefix;
+
+	/**
+	 * The number of threads that `git_diff_foreach`, and the printing
+	 * built on it, load the files and compute the differences of several
+	 * deltas with at once.  The default of 0, like 1, does it on the
+	 * calling thread.  The callbacks are still called on the calling
+	 * thread, in the order of the deltas.
+	 */
+	unsigned int threads;
 } git_diff_options;
 
 /* The current version of the diff options structure */
@@ -754,7 +763,8 @@ typedef struct {
 	 *
 	 * This is a little different from the `-l` option from Git because we
 	 * will still process up to this many matches before abandoning the search.
-	 * Defaults to 200.
+	 * With the default metric, these are the files that have the most in
+	 * common with the file, rather than the first ones.  Defaults to 200.
 	 */
 	size_t rename_limit;
 
@@ -769,6 +779,13 @@ typedef struct {
 	 * pretty fast with a fixed memory overhead.
 	 */
 	git_diff_similarity_metric *metric;
+
+	/**
+	 * The number of threads to compute the signatures of the default
+	 * metric on, when libgit2 is built with thread support; by default it
+	 * uses one.
+	 */
+	unsigned int threads;
 } git_diff_find_options;
 
 #define GIT_DIFF_FIND_OPTIONS_VERSION 1
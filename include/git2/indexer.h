@@ -66,9 +66,17 @@ typedef struct git_indexer_options {
 
 	/** Do connectivity checks for the received pack */
 	unsigned char verify;
+
+	/**
+	 * Number of threads used to resolve the deltas of the pack when
+	 * it is committed.  By default (0 or 1), they are resolved on the
+	 * thread that calls `git_indexer_commit`.  The progress callback
+	 * is always invoked from that thread.
+	 */
+	unsigned int threads;
 } git_indexer_options;
 
-#define GIT_INDEXER_OPTIONS_VERSION 1
+#define GIT_INDEXER_OPTIONS_VERSION 2
 #define GIT_INDEXER_OPTIONS_INIT { GIT_INDEXER_OPTIONS_VERSION }
 
 /**
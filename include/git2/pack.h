@@ -120,6 +120,10 @@ GIT_EXTERN(int) git_packbuilder_insert_commit(git_packbuilder *pb, const git_oid
  * Those commits and all objects they reference will be inserted into
  * the packbuilder.
  *
+ * When the repository has reachability bitmaps (`pack-*.bitmap`), they
+ * are used to find the objects instead of walking the trees, unless the
+ * `pack.useBitmaps` configuration option is set to false.
+ *
  * @param pb the packbuilder
  * @param walk the revwalk to use to fill the packbuilder
  *
@@ -150,6 +154,33 @@ GIT_EXTERN(int) git_packbuilder_insert_recur(git_packbuilder *pb, const git_oid
  */
 GIT_EXTERN(int) git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb);
 
+/**
+ * Set whether reachability bitmaps are written along with the pack
+ *
+ * When enabled, `git_packbuilder_write` also writes a `.bitmap` file
+ * for the new pack, as long as every object reachable from the commits
+ * in the pack is part of it (e.g. when repacking everything). Bitmaps
+ * are not written by default.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to write bitmaps
+ */
+GIT_EXTERN(void) git_packbuilder_set_write_bitmap(git_packbuilder *pb, int enabled);
+
+/**
+ * Set whether objects are copied from the packs they are already in
+ *
+ * When enabled, objects that are already packed are written to the new
+ * pack without being inflated and compressed again.  Objects that are
+ * packed as deltas against other objects of the new pack keep these
+ * deltas, instead of being searched for new ones.  This is enabled by
+ * default.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to reuse packed objects
+ */
+GIT_EXTERN(void) git_packbuilder_set_reuse(git_packbuilder *pb, int enabled);
+
 /**
  * Write the new pack and corresponding index file to path.
  *
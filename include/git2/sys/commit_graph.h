@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_commit_graph_h__
+#define INCLUDE_sys_git_commit_graph_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+
+/**
+ * @file git2/sys/commit_graph.h
+ * @brief Git commit-graph file routines
+ * @defgroup git_commit_graph Git commit-graph file routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * A writer for `commit-graph` files.
+ *
+ * The commit-graph file stores the parents, commit time, root tree and
+ * generation number of every commit it contains, so that history
+ * traversals (revwalks, merge-base computation, ahead/behind counts)
+ * can avoid inflating and parsing the commit objects themselves.
+ */
+typedef struct git_commit_graph_writer git_commit_graph_writer;
+
+/**
+ * Create a new writer for `commit-graph` files.
+ *
+ * @param out Location to store the writer pointer.
+ * @param objects_info_dir The `objects/info` directory.
+ * The `commit-graph` file will be written in this directory.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_new(
+		git_commit_graph_writer **out,
+		const char *objects_info_dir);
+
+/**
+ * Free the commit-graph writer and its resources.
+ *
+ * @param w The writer to free. If NULL no action is taken.
+ */
+GIT_EXTERN(void) git_commit_graph_writer_free(git_commit_graph_writer *w);
+
+/**
+ * Add all the commits produced by a revwalk to the writer.
+ *
+ * The revwalk is drained. Any parent of an added commit that the revwalk
+ * did not produce (e.g. because it was hidden) is added as well, since a
+ * commit-graph must contain the full history of every commit in it.
+ *
+ * @param w The writer.
+ * @param walk The git_revwalk.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_add_revwalk(
+		git_commit_graph_writer *w,
+		git_revwalk *walk);
+
+/**
+ * Add every commit reachable from the references (and `HEAD`) of a
+ * repository to the writer.
+ *
+ * This is the equivalent of `git commit-graph write --reachable`.
+ *
+ * @param w The writer.
+ * @param repo The repository whose references will be walked.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_add_all_refs(
+		git_commit_graph_writer *w,
+		git_repository *repo);
+
+/**
+ * Write a `commit-graph` file to `objects_info_dir/commit-graph`.
+ *
+ * @param w The writer.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_commit(
+		git_commit_graph_writer *w);
+
+/**
+ * Dump the contents of the `commit-graph` to the in-memory buffer.
+ *
+ * @param buffer Buffer where to store the contents of the `commit-graph`.
+ * @param w The writer.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_dump(
+		git_buf *buffer,
+		git_commit_graph_writer *w);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -156,7 +156,9 @@ struct git_refdb_backend {
 	int GIT_CALLBACK(reflog_delete)(git_refdb_backend *backend, const char *name);
 
 	/**
-	 * Lock a reference. The opaque parameter will be passed to the unlock function
+	 * Lock a reference. The opaque parameter will be passed to the unlock function.
+	 * When the transaction already holds other locks, it comes in set to the
+	 * opaque parameter of one of them; backends are free to ignore it.
 	 */
 	int GIT_CALLBACK(lock)(void **payload_out, git_refdb_backend *backend, const char *refname);
 
@@ -199,6 +201,29 @@ GIT_EXTERN(int) git_refdb_backend_fs(
 	git_refdb_backend **backend_out,
 	git_repository *repo);
 
+/**
+ * Constructor for a refdb backend that keeps the references and the
+ * reflogs of the repository in a stack of reftables, in the `reftable`
+ * directory of the repository.
+ *
+ * The first time that it is created for a repository, the backend
+ * imports the references and the reflogs that the repository has.  It
+ * is not used unless it is set with `git_refdb_set_backend`, and it
+ * does not support namespaces.
+ *
+ * The `reftable.blockSize`, `reftable.restartInterval` and
+ * `reftable.indexObjects` configuration values tune the tables that it
+ * writes, and `reftable.geometricFactor` tunes how eagerly it compacts
+ * them.
+ *
+ * @param backend_out Output pointer to the git_refdb_backend object
+ * @param repo Git repository to access
+ * @return 0 on success, <0 error code on failure
+ */
+GIT_EXTERN(int) git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repo);
+
 /**
  * Sets the custom backend to an existing reference DB
  *
@@ -9,6 +9,7 @@
 
 #include "git2/common.h"
 #include "git2/types.h"
+#include "git2/buffer.h"
 
 /**
  * @file git2/sys/repository.h
@@ -164,6 +165,81 @@ GIT_EXTERN(int) git_repository_submodule_cache_all(
 GIT_EXTERN(int) git_repository_submodule_cache_clear(
 	git_repository *repo);
 
+/**
+ * Callback used to ask a filesystem monitor what changed in the working
+ * directory.
+ *
+ * The answer is written to `out` the way git's `fsmonitor` hooks give
+ * it: a new token, then the paths (relative to the working directory)
+ * that changed since `token`, each followed by a NUL.  A directory stands
+ * for everything in it, and a path of "/" stands for everything.  The
+ * next query will be made with the new token.
+ *
+ * `token` is either a token that the monitor returned before or, when the
+ * monitor was not asked before, the time in nanoseconds since the epoch.
+ *
+ * @param out The buffer to write the new token and changed paths to
+ * @param token The token of the previous query
+ * @param payload The payload given to `git_repository_set_fsmonitor`
+ * @return 0 on success, GIT_PASSTHROUGH if the monitor cannot tell what
+ *         changed (so that everything is examined), or an error code
+ */
+typedef int GIT_CALLBACK(git_fsmonitor_cb)(
+	git_buf *out, const char *token, void *payload);
+
+/**
+ * Set the filesystem monitor of a repository.
+ *
+ * When the index is compared to the working directory (as by
+ * `git_status_list_new` and `git_diff_index_to_workdir`), the monitor is
+ * asked which paths changed.  The files that were found unmodified
+ * before, and that the monitor does not report, are not examined again.
+ * The monitor's token is stored in the index when it is written.
+ *
+ * Without a callback, the hook named by the `core.fsmonitor`
+ * configuration is run, if there is one.
+ *
+ * @param repo A repository object
+ * @param cb The monitor, or NULL to use the `core.fsmonitor` hook
+ * @param payload Payload passed to the callback
+ */
+GIT_EXTERN(void) git_repository_set_fsmonitor(
+	git_repository *repo, git_fsmonitor_cb cb, void *payload);
+
+/**
+ * Keep the similarity signatures of blobs in a cache of the repository.
+ *
+ * Finding renames and copies with the default metric, in
+ * `git_diff_find_similar` and in merges, computes a signature of the
+ * contents of each file that it compares.  The signatures of blobs are
+ * kept in the cache, by the id of the blob and the whitespace options of
+ * the signature, so that finding renames again does not read the blobs
+ * again.  The cache holds up to `max_size` bytes of signatures, and
+ * forgets the ones that were used the longest ago first.
+ *
+ * With a `path`, the signatures that were written to that file before are
+ * read back, and `git_repository_sigcache_write` writes the cache there.
+ *
+ * The cache must not be set while the repository is used on other
+ * threads.
+ *
+ * @param repo A repository object
+ * @param max_size The bytes of signatures to keep, or 0 to stop keeping them
+ * @param path The file to keep the signatures in, or NULL
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repository_set_sigcache(
+	git_repository *repo, size_t max_size, const char *path);
+
+/**
+ * Write the similarity signature cache of a repository to the file that
+ * was given to `git_repository_set_sigcache`.
+ *
+ * @param repo A repository object
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repository_sigcache_write(git_repository *repo);
+
 /** @} */
 GIT_END_DECL
 #endif
@@ -19,7 +19,20 @@ bool git_cache__enabled = true;
 ssize_t git_cache__max_storage = (256 * 1024 * 1024);
 git_atomic_ssize git_cache__current_storage = {0};
 
-static size_t git_cache__max_object_size[8] = {
+/*
+ * The statistics are kept per shard, so that threads looking up
+ * different objects do not contend on the same counters.
+ */
+typedef struct {
+	git_atomic_ssize hits;
+	git_atomic_ssize misses;
+	git_atomic_ssize evictions;
+	char padding[64 - 3 * sizeof(git_atomic_ssize)];
+} git_cache_stats;
+
+static git_cache_stats git_cache__stats[GIT_CACHE_SHARDS];
+
+static size_t git_cache__max_object_size[GIT_CACHE_TYPES] = {
 	0,     /* GIT_OBJECT__EXT1 */
 	4096,  /* GIT_OBJECT_COMMIT */
 	4096,  /* GIT_OBJECT_TREE */
@@ -30,151 +43,401 @@ static size_t git_cache__max_object_size[8] = {
 	0      /* GIT_OBJECT_REF_DELTA */
 };
 
-int git_cache_set_max_object_size(git_object_t type, size_t size)
+/*
+ * The maximum memory that the objects of each type may use across all
+ * caches; zero means that they are only bound by `git_cache__max_storage`.
+ * Blobs are limited so that, when their caching is enabled, they cannot
+ * push the (usually much hotter) commits and trees out of the cache.
+ */
+static ssize_t git_cache__max_type_storage[GIT_CACHE_TYPES] = {
+	0,                  /* GIT_OBJECT__EXT1 */
+	0,                  /* GIT_OBJECT_COMMIT */
+	0,                  /* GIT_OBJECT_TREE */
+	(64 * 1024 * 1024), /* GIT_OBJECT_BLOB */
+	0,                  /* GIT_OBJECT_TAG */
+	0,                  /* GIT_OBJECT__EXT2 */
+	0,                  /* GIT_OBJECT_OFS_DELTA */
+	0                   /* GIT_OBJECT_REF_DELTA */
+};
+
+static git_atomic_ssize git_cache__current_type_storage[GIT_CACHE_TYPES];
+
+static int check_type(git_object_t type)
 {
-	if (type < 0 || (size_t)type >= ARRAY_SIZE(git_cache__max_object_size)) {
+	if (type < 0 || (size_t)type >= GIT_CACHE_TYPES) {
 		git_error_set(GIT_ERROR_INVALID, "type out of range");
 		return -1;
 	}
 
+	return 0;
+}
+
+int git_cache_set_max_object_size(git_object_t type, size_t size)
+{
+	if (check_type(type) < 0)
+		return -1;
+
 	git_cache__max_object_size[type] = size;
 	return 0;
 }
 
+int git_cache_set_max_type_storage(git_object_t type, ssize_t size)
+{
+	if (check_type(type) < 0)
+		return -1;
+
+	git_cache__max_type_storage[type] = size;
+	return 0;
+}
+
+int git_cache_get_type_storage(ssize_t *current, ssize_t *allowed, git_object_t type)
+{
+	if (check_type(type) < 0)
+		return -1;
+
+	*current = git_cache__current_type_storage[type].val;
+	*allowed = git_cache__max_type_storage[type];
+	return 0;
+}
+
+static void add_storage(git_cache_shard *shard, git_cached_obj *obj, ssize_t size)
+{
+	shard->used_memory += size;
+	shard->clocks[obj->type].used_memory += size;
+	git_atomic_ssize_add(&git_cache__current_storage, size);
+	git_atomic_ssize_add(&git_cache__current_type_storage[obj->type], size);
+}
+
+/* Called with lock */
+static void clock_insert(git_cache_shard *shard, git_cached_obj *obj)
+{
+	git_cache_clock *clock = &shard->clocks[obj->type];
+
+	/*
+	 * New objects go right behind the hand, so they are the last ones
+	 * to be considered for eviction. They start out unreferenced: an
+	 * object that is never looked up again is evicted on the next pass.
+	 */
+	git_atomic_set(&obj->referenced, 0);
+
+	if (clock->hand == NULL) {
+		obj->clock_prev = obj->clock_next = obj;
+		clock->hand = obj;
+	} else {
+		obj->clock_next = clock->hand;
+		obj->clock_prev = clock->hand->clock_prev;
+		obj->clock_prev->clock_next = obj;
+		clock->hand->clock_prev = obj;
+	}
+
+	add_storage(shard, obj, (ssize_t)obj->size);
+}
+
+/* Called with lock */
+static void clock_remove(git_cache_shard *shard, git_cached_obj *obj)
+{
+	git_cache_clock *clock = &shard->clocks[obj->type];
+
+	if (obj->clock_next == obj) {
+		clock->hand = NULL;
+	} else {
+		obj->clock_prev->clock_next = obj->clock_next;
+		obj->clock_next->clock_prev = obj->clock_prev;
+
+		if (clock->hand == obj)
+			clock->hand = obj->clock_next;
+	}
+
+	obj->clock_prev = obj->clock_next = NULL;
+	add_storage(shard, obj, -(ssize_t)obj->size);
+}
+
+static ssize_t cache_used_memory(git_cache *cache)
+{
+	ssize_t used_memory = 0;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		used_memory += cache->shards[i].used_memory;
+
+	return used_memory;
+}
+
 void git_cache_dump_stats(git_cache *cache)
 {
 	git_cached_obj *object;
+	size_t i;
 
 	if (git_cache_size(cache) == 0)
 		return;
 
 	printf("Cache %p: %"PRIuZ" items cached, %"PRIdZ" bytes\n",
-		cache, git_cache_size(cache), cache->used_memory);
-
-	git_oidmap_foreach_value(cache->map, object, {
-		char oid_str[9];
-		printf(" %s%c %s (%"PRIuZ")\n",
-			git_object_type2string(object->type),
-			object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
-			git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
-			object->size
-		);
-	});
+		cache, git_cache_size(cache), cache_used_memory(cache));
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_oidmap_foreach_value(cache->shards[i].map, object, {
+			char oid_str[9];
+			printf(" %s%c %s (%"PRIuZ")\n",
+				git_object_type2string(object->type),
+				object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
+				git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
+				object->size
+			);
+		});
+	}
 }
 
 int git_cache_init(git_cache *cache)
 {
+	git_cache_shard *shard;
+	size_t i;
+
 	memset(cache, 0, sizeof(*cache));
 
-	if ((git_oidmap_new(&cache->map)) < 0)
-		return -1;
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+		shard->index = i;
 
-	if (git_rwlock_init(&cache->lock)) {
-		git_error_set(GIT_ERROR_OS, "failed to initialize cache rwlock");
-		return -1;
+		if ((git_oidmap_new(&shard->map)) < 0)
+			return -1;
+
+		if (git_rwlock_init(&shard->lock)) {
+			git_error_set(GIT_ERROR_OS, "failed to initialize cache rwlock");
+			return -1;
+		}
 	}
 
 	return 0;
 }
 
 /* called with lock */
-static void clear_cache(git_cache *cache)
+static void clear_shard(git_cache_shard *shard)
 {
 	git_cached_obj *evict = NULL;
+	size_t i;
 
-	if (git_cache_size(cache) == 0)
+	if (git_oidmap_size(shard->map) == 0)
 		return;
 
-	git_oidmap_foreach_value(cache->map, evict, {
+	git_oidmap_foreach_value(shard->map, evict, {
 		git_cached_obj_decref(evict);
 	});
 
-	git_oidmap_clear(cache->map);
-	git_atomic_ssize_add(&git_cache__current_storage, -cache->used_memory);
-	cache->used_memory = 0;
+	git_oidmap_clear(shard->map);
+	git_atomic_ssize_add(&git_cache__current_storage, -shard->used_memory);
+	shard->used_memory = 0;
+
+	for (i = 0; i < GIT_CACHE_TYPES; i++) {
+		git_atomic_ssize_add(&git_cache__current_type_storage[i],
+			-shard->clocks[i].used_memory);
+		shard->clocks[i].used_memory = 0;
+		shard->clocks[i].hand = NULL;
+	}
 }
 
 void git_cache_clear(git_cache *cache)
 {
-	if (git_rwlock_wrlock(&cache->lock) < 0)
-		return;
+	git_cache_shard *shard;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+
+		if (git_rwlock_wrlock(&shard->lock) < 0)
+			continue;
 
-	clear_cache(cache);
+		clear_shard(shard);
 
-	git_rwlock_wrunlock(&cache->lock);
+		git_rwlock_wrunlock(&shard->lock);
+	}
 }
 
 void git_cache_dispose(git_cache *cache)
 {
+	size_t i;
+
 	git_cache_clear(cache);
-	git_oidmap_free(cache->map);
-	git_rwlock_free(&cache->lock);
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_oidmap_free(cache->shards[i].map);
+		git_rwlock_free(&cache->shards[i].lock);
+	}
+
 	git__memzero(cache, sizeof(*cache));
 }
 
 /* Called with lock */
-static void cache_evict_entries(git_cache *cache)
+static void cache_evict_one(git_cache_shard *shard, git_object_t type)
 {
-	size_t evict_count = 8, i;
-	ssize_t evicted_memory = 0;
+	git_cache_clock *clock = &shard->clocks[type];
+	git_cached_obj *evict;
+
+	/*
+	 * Give every referenced object a second chance; this terminates
+	 * after at most one full turn, since the references are cleared as
+	 * the hand passes over them.
+	 */
+	while (git_atomic_get(&clock->hand->referenced)) {
+		git_atomic_set(&clock->hand->referenced, 0);
+		clock->hand = clock->hand->clock_next;
+	}
 
-	/* do not infinite loop if there's not enough entries to evict  */
-	if (evict_count > git_cache_size(cache)) {
-		clear_cache(cache);
-		return;
+	evict = clock->hand;
+
+	git_oidmap_delete(shard->map, &evict->oid);
+	clock_remove(shard, evict);
+	git_cached_obj_decref(evict);
+
+	git_atomic_ssize_add(&git_cache__stats[shard->index].evictions, 1);
+}
+
+/*
+ * Pick the type to evict from when the cache as a whole is over budget:
+ * the one that uses the largest share of its own budget in this shard.
+ */
+static git_object_t cache_eviction_type(git_cache_shard *shard)
+{
+	git_object_t type = GIT_OBJECT_INVALID;
+	double max_share = -1.0, share;
+	ssize_t budget;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_TYPES; i++) {
+		if (shard->clocks[i].hand == NULL)
+			continue;
+
+		budget = git_cache__max_type_storage[i] > 0 ?
+			git_cache__max_type_storage[i] : git_cache__max_storage;
+		share = (double)shard->clocks[i].used_memory / (double)max(budget, 1);
+
+		if (share > max_share) {
+			max_share = share;
+			type = (git_object_t)i;
+		}
 	}
 
-	i = 0;
-	while (evict_count > 0) {
-		git_cached_obj *evict;
-		const git_oid *key;
+	return type;
+}
+
+GIT_INLINE(bool) type_over_budget(git_object_t type, size_t size)
+{
+	ssize_t max_type_storage = git_cache__max_type_storage[type];
+
+	return max_type_storage > 0 &&
+		git_cache__current_type_storage[type].val + (ssize_t)size > max_type_storage;
+}
+
+GIT_INLINE(bool) cache_over_budget(size_t size)
+{
+	return git_cache__current_storage.val + (ssize_t)size > git_cache__max_storage;
+}
+
+/* Called with lock */
+static void shard_evict_entries(git_cache_shard *shard, git_object_t type, size_t size)
+{
+	git_object_t evict_type;
 
-		if (git_oidmap_iterate((void **) &evict, cache->map, &i, &key) == GIT_ITEROVER)
+	while (shard->clocks[type].hand != NULL && type_over_budget(type, size))
+		cache_evict_one(shard, type);
+
+	while (cache_over_budget(size) &&
+	       (evict_type = cache_eviction_type(shard)) != GIT_OBJECT_INVALID)
+		cache_evict_one(shard, evict_type);
+}
+
+/*
+ * Make room for a new object of the given type, starting with the shard
+ * it goes to. Only one shard is locked at a time. Other caches may hold
+ * most of the memory; only what this cache holds is evicted, since the
+ * limit is a soft one.
+ */
+static void cache_evict_entries(
+	git_cache *cache,
+	git_cache_shard *first,
+	git_object_t type,
+	size_t size)
+{
+	git_cache_shard *shard;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		if (!type_over_budget(type, size) && !cache_over_budget(size))
 			break;
 
-		evict_count--;
-		evicted_memory += evict->size;
-		git_oidmap_delete(cache->map, key);
-		git_cached_obj_decref(evict);
-	}
+		shard = &cache->shards[(first->index + i) % GIT_CACHE_SHARDS];
+
+		if (git_rwlock_wrlock(&shard->lock) < 0)
+			continue;
 
-	cache->used_memory -= evicted_memory;
-	git_atomic_ssize_add(&git_cache__current_storage, -evicted_memory);
+		shard_evict_entries(shard, type, size);
+
+		git_rwlock_wrunlock(&shard->lock);
+	}
 }
 
 static bool cache_should_store(git_object_t object_type, size_t object_size)
 {
 	size_t max_size = git_cache__max_object_size[object_type];
-	return git_cache__enabled && object_size < max_size;
+	ssize_t max_type_storage = git_cache__max_type_storage[object_type];
+
+	return git_cache__enabled && object_size < max_size &&
+		(max_type_storage <= 0 || (ssize_t)object_size <= max_type_storage);
+}
+
+/*
+ * The shard is picked from the last byte of the id: the first bytes are
+ * the hash of the oidmaps, which would then only use a fraction of their
+ * buckets.
+ */
+GIT_INLINE(git_cache_shard *) cache_shard(git_cache *cache, const git_oid *oid)
+{
+	return &cache->shards[oid->id[GIT_OID_RAWSZ - 1] % GIT_CACHE_SHARDS];
 }
 
 static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 {
+	git_cache_shard *shard = cache_shard(cache, oid);
+	git_cache_stats *stats = &git_cache__stats[shard->index];
 	git_cached_obj *entry;
 
-	if (!git_cache__enabled || git_rwlock_rdlock(&cache->lock) < 0)
+	if (!git_cache__enabled || git_rwlock_rdlock(&shard->lock) < 0)
 		return NULL;
 
-	if ((entry = git_oidmap_get(cache->map, oid)) != NULL) {
+	if ((entry = git_oidmap_get(shard->map, oid)) != NULL) {
 		if (flags && entry->flags != flags) {
 			entry = NULL;
 		} else {
 			git_cached_obj_incref(entry);
+
+			/* avoid dirtying the cache line if it is already set */
+			if (!git_atomic_get(&entry->referenced))
+				git_atomic_set(&entry->referenced, 1);
 		}
 	}
 
-	git_rwlock_rdunlock(&cache->lock);
+	git_rwlock_rdunlock(&shard->lock);
+
+	git_atomic_ssize_add(entry ? &stats->hits : &stats->misses, 1);
 
 	return entry;
 }
 
+/* A parsed object takes the place of the raw one with the same id */
+GIT_INLINE(bool) cache_store_replaces(
+	git_cached_obj *stored_entry, git_cached_obj *entry)
+{
+	return stored_entry->flags == GIT_CACHE_STORE_RAW &&
+		entry->flags == GIT_CACHE_STORE_PARSED;
+}
+
 static void *cache_store(git_cache *cache, git_cached_obj *entry)
 {
+	git_cache_shard *shard = cache_shard(cache, &entry->oid);
 	git_cached_obj *stored_entry;
 
 	git_cached_obj_incref(entry);
 
-	if (!git_cache__enabled && cache->used_memory > 0) {
+	if (!git_cache__enabled && cache_used_memory(cache) > 0) {
 		git_cache_clear(cache);
 		return entry;
 	}
@@ -182,19 +445,38 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 	if (!cache_should_store(entry->type, entry->size))
 		return entry;
 
-	if (git_rwlock_wrlock(&cache->lock) < 0)
+	/*
+	 * Storing an object that is already cached leaves the cache as it
+	 * is, so it must not evict anything to make room.
+	 */
+	if (git_rwlock_rdlock(&shard->lock) < 0)
+		return entry;
+
+	if ((stored_entry = git_oidmap_get(shard->map, &entry->oid)) != NULL &&
+	    !cache_store_replaces(stored_entry, entry)) {
+		if (stored_entry->flags == entry->flags) {
+			git_cached_obj_decref(entry);
+			git_cached_obj_incref(stored_entry);
+			entry = stored_entry;
+		}
+
+		git_rwlock_rdunlock(&shard->lock);
 		return entry;
+	}
 
-	/* soften the load on the cache */
-	if (git_cache__current_storage.val > git_cache__max_storage)
-		cache_evict_entries(cache);
+	git_rwlock_rdunlock(&shard->lock);
+
+	/* make room for the new entry */
+	cache_evict_entries(cache, shard, entry->type, entry->size);
+
+	if (git_rwlock_wrlock(&shard->lock) < 0)
+		return entry;
 
 	/* not found */
-	if ((stored_entry = git_oidmap_get(cache->map, &entry->oid)) == NULL) {
-		if (git_oidmap_set(cache->map, &entry->oid, entry) == 0) {
+	if ((stored_entry = git_oidmap_get(shard->map, &entry->oid)) == NULL) {
+		if (git_oidmap_set(shard->map, &entry->oid, entry) == 0) {
 			git_cached_obj_incref(entry);
-			cache->used_memory += entry->size;
-			git_atomic_ssize_add(&git_cache__current_storage, (ssize_t)entry->size);
+			clock_insert(shard, entry);
 		}
 	}
 	/* found */
@@ -203,18 +485,20 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 			git_cached_obj_decref(entry);
 			git_cached_obj_incref(stored_entry);
 			entry = stored_entry;
-		} else if (stored_entry->flags == GIT_CACHE_STORE_RAW &&
-			   entry->flags == GIT_CACHE_STORE_PARSED) {
-			git_cached_obj_decref(stored_entry);
-			git_cached_obj_incref(entry);
-
-			git_oidmap_set(cache->map, &entry->oid, entry);
+		} else if (cache_store_replaces(stored_entry, entry)) {
+			if (git_oidmap_set(shard->map, &entry->oid, entry) == 0) {
+				clock_remove(shard, stored_entry);
+				git_cached_obj_decref(stored_entry);
+
+				git_cached_obj_incref(entry);
+				clock_insert(shard, entry);
+			}
 		} else {
 			/* NO OP */
 		}
 	}
 
-	git_rwlock_wrunlock(&cache->lock);
+	git_rwlock_wrunlock(&shard->lock);
 	return entry;
 }
 
@@ -245,6 +529,24 @@ void *git_cache_get_any(git_cache *cache, const git_oid *oid)
 	return cache_get(cache, oid, GIT_CACHE_STORE_ANY);
 }
 
+void git_cache_get_stats(size_t *hits, size_t *misses, size_t *evictions)
+{
+	size_t i;
+
+	*hits = *misses = *evictions = 0;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		*hits += (size_t)git_cache__stats[i].hits.val;
+		*misses += (size_t)git_cache__stats[i].misses.val;
+		*evictions += (size_t)git_cache__stats[i].evictions.val;
+	}
+}
+
+void git_cache_reset_stats(void)
+{
+	memset(git_cache__stats, 0, sizeof(git_cache__stats));
+}
+
 void git_cached_obj_decref(void *_obj)
 {
 	git_cached_obj *obj = _obj;
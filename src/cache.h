@@ -22,18 +22,48 @@ enum {
 	GIT_CACHE_STORE_PARSED = 2
 };
 
-typedef struct {
+/* Number of per-type slots, indexed by git_object_t value */
+#define GIT_CACHE_TYPES 8
+
+typedef struct git_cached_obj {
 	git_oid    oid;
 	int16_t    type;  /* git_object_t value */
 	uint16_t   flags; /* GIT_CACHE_STORE value */
 	size_t     size;
 	git_atomic refcount;
+
+	/* set when the object is looked up, cleared by the eviction clock */
+	git_atomic referenced;
+	struct git_cached_obj *clock_prev, *clock_next;
 } git_cached_obj;
 
+/*
+ * The objects of one type in a cache, in a circular list. Eviction
+ * (CLOCK) advances `hand` and evicts the first object that has not been
+ * looked up since the hand last passed over it.
+ */
+typedef struct {
+	git_cached_obj *hand;
+	ssize_t used_memory;
+} git_cache_clock;
+
+/*
+ * A part of the cache with its own lock; objects are spread over the
+ * shards by id, so that threads looking up different objects rarely
+ * wait for each other.
+ */
 typedef struct {
 	git_oidmap *map;
 	git_rwlock  lock;
 	ssize_t     used_memory;
+	size_t      index;
+	git_cache_clock clocks[GIT_CACHE_TYPES];
+} git_cache_shard;
+
+#define GIT_CACHE_SHARDS 16
+
+typedef struct {
+	git_cache_shard shards[GIT_CACHE_SHARDS];
 } git_cache;
 
 extern bool git_cache__enabled;
@@ -41,6 +71,11 @@ extern ssize_t git_cache__max_storage;
 extern git_atomic_ssize git_cache__current_storage;
 
 int git_cache_set_max_object_size(git_object_t type, size_t size);
+int git_cache_set_max_type_storage(git_object_t type, ssize_t size);
+int git_cache_get_type_storage(ssize_t *current, ssize_t *allowed, git_object_t type);
+
+void git_cache_get_stats(size_t *hits, size_t *misses, size_t *evictions);
+void git_cache_reset_stats(void);
 
 int git_cache_init(git_cache *cache);
 void git_cache_dispose(git_cache *cache);
@@ -55,7 +90,12 @@ void *git_cache_get_any(git_cache *cache, const git_oid *oid);
 
 GIT_INLINE(size_t) git_cache_size(git_cache *cache)
 {
-	return (size_t)git_oidmap_size(cache->map);
+	size_t i, size = 0;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		size += git_oidmap_size(cache->shards[i].map);
+
+	return size;
 }
 
 GIT_INLINE(void) git_cached_obj_incref(void *_obj)
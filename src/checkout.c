@@ -1463,19 +1463,42 @@ static int mkpath2file(
 	return error;
 }
 
+/*
+ * The file is only opened once there is something to write to it, or
+ * when the stream is closed, so that a blob that cannot be read at all
+ * leaves no file behind.
+ */
 struct checkout_stream {
 	git_writestream base;
 	const char *path;
+	int flags;
+	mode_t mode;
 	int fd;
 	int open;
 };
 
+static int checkout_stream_open_file(struct checkout_stream *stream)
+{
+	if (stream->fd >= 0)
+		return 0;
+
+	if ((stream->fd = p_open(stream->path, stream->flags, stream->mode)) < 0) {
+		git_error_set(GIT_ERROR_OS, "could not open '%s' for writing", stream->path);
+		return stream->fd;
+	}
+
+	return 0;
+}
+
 static int checkout_stream_write(
 	git_writestream *s, const char *buffer, size_t len)
 {
 	struct checkout_stream *stream = (struct checkout_stream *)s;
 	int ret;
 
+	if ((ret = checkout_stream_open_file(stream)) < 0)
+		return ret;
+
 	if ((ret = p_write(stream->fd, buffer, len)) < 0)
 		git_error_set(GIT_ERROR_OS, "could not write to '%s'", stream->path);
 
@@ -1485,9 +1508,15 @@ static int checkout_stream_write(
 static int checkout_stream_close(git_writestream *s)
 {
 	struct checkout_stream *stream = (struct checkout_stream *)s;
+	int error;
+
 	assert(stream && stream->open);
 
 	stream->open = 0;
+
+	if ((error = checkout_stream_open_file(stream)) < 0)
+		return error;
+
 	return p_close(stream->fd);
 }
 
@@ -1496,71 +1525,89 @@ static void checkout_stream_free(git_writestream *s)
 	GIT_UNUSED(s);
 }
 
-static int blob_content_to_file(
+/*
+ * The filters stream into `temp_buf`, if given; a list that is used on
+ * another thread must not share the buffer.
+ */
+static int checkout_load_filters(
+	git_filter_list **out,
+	checkout_data *data,
+	const git_oid *blob_id,
+	const char *hint_path,
+	git_buf *temp_buf)
+{
+	git_filter_options filter_opts = GIT_FILTER_OPTIONS_INIT;
+
+	*out = NULL;
+
+	if (data->opts.disable_filters)
+		return 0;
+
+	filter_opts.attr_session = &data->attr_session;
+	filter_opts.temp_buf = temp_buf;
+	filter_opts.blob_id = blob_id;
+
+	return git_filter_list__load_ext(
+		out, data->repo, NULL, hint_path,
+		GIT_FILTER_TO_WORKTREE, &filter_opts);
+}
+
+/*
+ * Write the blob through the filters to the file at `path`, whose parent
+ * directory exists.  This only reads `data`, so that files can be written
+ * by several threads at once, each with its own `perfdata`.
+ */
+static int checkout_write_file(
 	checkout_data *data,
+	git_checkout_perfdata *perfdata,
 	struct stat *st,
-	git_blob *blob,
+	const git_oid *blob_id,
+	git_filter_list *fl,
 	const char *path,
-	const char *hint_path,
 	mode_t entry_filemode)
 {
 	int flags = data->opts.file_open_flags;
 	mode_t file_mode = data->opts.file_mode ?
 		data->opts.file_mode : entry_filemode;
-	git_filter_options filter_opts = GIT_FILTER_OPTIONS_INIT;
 	struct checkout_stream writer;
 	mode_t mode;
-	git_filter_list *fl = NULL;
-	int fd;
 	int error = 0;
 
-	if (hint_path == NULL)
-		hint_path = path;
-
-	if ((error = mkpath2file(data, path, data->opts.dir_mode)) < 0)
-		return error;
-
 	if (flags <= 0)
 		flags = O_CREAT | O_TRUNC | O_WRONLY;
 	if (!(mode = file_mode))
 		mode = GIT_FILEMODE_BLOB;
 
-	if ((fd = p_open(path, flags, mode)) < 0) {
-		git_error_set(GIT_ERROR_OS, "could not open '%s' for writing", path);
-		return fd;
-	}
-
-	filter_opts.attr_session = &data->attr_session;
-	filter_opts.temp_buf = &data->tmp;
-
-	if (!data->opts.disable_filters &&
-		(error = git_filter_list__load_ext(
-			&fl, data->repo, blob, hint_path,
-			GIT_FILTER_TO_WORKTREE, &filter_opts))) {
-		p_close(fd);
-		return error;
-	}
-
 	/* setup the writer */
 	memset(&writer, 0, sizeof(struct checkout_stream));
 	writer.base.write = checkout_stream_write;
 	writer.base.close = checkout_stream_close;
 	writer.base.free = checkout_stream_free;
 	writer.path = path;
-	writer.fd = fd;
+	writer.flags = flags;
+	writer.mode = mode;
+	writer.fd = -1;
 	writer.open = 1;
 
-	error = git_filter_list_stream_blob(fl, blob, &writer.base);
+	error = git_filter_list__stream_blob_id(fl, data->repo, blob_id, &writer.base);
 
-	assert(writer.open == 0);
+	/* the blob could not be read, and nothing was written */
+	if (writer.open && writer.fd >= 0)
+		p_close(writer.fd);
 
-	git_filter_list_free(fl);
+	/*
+	 * A streamed blob is only found to be corrupt once it was written;
+	 * don't leave what was read of it in the working directory.
+	 */
+	if (error < 0) {
+		if (writer.fd >= 0)
+			p_unlink(path);
 
-	if (error < 0)
 		return error;
+	}
 
 	if (st) {
-		data->perfdata.stat_calls++;
+		perfdata->stat_calls++;
 
 		if ((error = p_stat(path, st)) < 0) {
 			git_error_set(GIT_ERROR_OS, "failed to stat '%s'", path);
@@ -1573,8 +1620,35 @@ static int blob_content_to_file(
 	return 0;
 }
 
-static int blob_content_to_link(
+static int blob_content_to_file(
+	checkout_data *data,
+	struct stat *st,
+	const git_oid *blob_id,
+	const char *path,
+	const char *hint_path,
+	mode_t entry_filemode)
+{
+	git_filter_list *fl = NULL;
+	int error = 0;
+
+	if (hint_path == NULL)
+		hint_path = path;
+
+	if ((error = mkpath2file(data, path, data->opts.dir_mode)) < 0 ||
+	    (error = checkout_load_filters(&fl, data, blob_id, hint_path, &data->tmp)) < 0)
+		return error;
+
+	error = checkout_write_file(
+		data, &data->perfdata, st, blob_id, fl, path, entry_filemode);
+
+	git_filter_list_free(fl);
+	return error;
+}
+
+/* Like `checkout_write_file`, for a symbolic link */
+static int checkout_write_link(
 	checkout_data *data,
+	git_checkout_perfdata *perfdata,
 	struct stat *st,
 	git_blob *blob,
 	const char *path)
@@ -1582,9 +1656,6 @@ static int blob_content_to_link(
 	git_buf linktarget = GIT_BUF_INIT;
 	int error;
 
-	if ((error = mkpath2file(data, path, data->opts.dir_mode)) < 0)
-		return error;
-
 	if ((error = git_blob__getbuf(&linktarget, blob)) < 0)
 		return error;
 
@@ -1596,7 +1667,7 @@ static int blob_content_to_link(
 	}
 
 	if (!error) {
-		data->perfdata.stat_calls++;
+		perfdata->stat_calls++;
 
 		if ((error = p_lstat(path, st)) < 0)
 			git_error_set(GIT_ERROR_CHECKOUT, "could not stat symlink %s", path);
@@ -1609,6 +1680,20 @@ static int blob_content_to_link(
 	return error;
 }
 
+static int blob_content_to_link(
+	checkout_data *data,
+	struct stat *st,
+	git_blob *blob,
+	const char *path)
+{
+	int error;
+
+	if ((error = mkpath2file(data, path, data->opts.dir_mode)) < 0)
+		return error;
+
+	return checkout_write_link(data, &data->perfdata, st, blob, path);
+}
+
 static int checkout_update_index(
 	checkout_data *data,
 	const git_diff_file *file,
@@ -1728,6 +1813,22 @@ static int checkout_safe_for_update_only(
 	return 0;
 }
 
+/* if we try to create the blob and an existing directory blocks it from
+ * being written, then there must have been a typechange conflict in a
+ * parent directory - suppress the error and try to continue.
+ */
+static int checkout_allow_conflict(checkout_data *data, int error)
+{
+	if ((data->strategy & GIT_CHECKOUT_ALLOW_CONFLICTS) != 0 &&
+		(error == GIT_ENOTFOUND || error == GIT_EEXISTS))
+	{
+		git_error_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
 static int checkout_write_content(
 	checkout_data *data,
 	const git_oid *oid,
@@ -1739,28 +1840,20 @@ static int checkout_write_content(
 	int error = 0;
 	git_blob *blob;
 
+	/* files are streamed through their filters, when they are large */
+	if (!S_ISLNK(mode)) {
+		error = blob_content_to_file(data, st, oid, full_path, hint_path, mode);
+		return checkout_allow_conflict(data, error);
+	}
+
 	if ((error = git_blob_lookup(&blob, data->repo, oid)) < 0)
 		return error;
 
-	if (S_ISLNK(mode))
-		error = blob_content_to_link(data, st, blob, full_path);
-	else
-		error = blob_content_to_file(data, st, blob, full_path, hint_path, mode);
+	error = blob_content_to_link(data, st, blob, full_path);
 
 	git_blob_free(blob);
 
-	/* if we try to create the blob and an existing directory blocks it from
-	 * being written, then there must have been a typechange conflict in a
-	 * parent directory - suppress the error and try to continue.
-	 */
-	if ((data->strategy & GIT_CHECKOUT_ALLOW_CONFLICTS) != 0 &&
-		(error == GIT_ENOTFOUND || error == GIT_EEXISTS))
-	{
-		git_error_clear();
-		error = 0;
-	}
-
-	return error;
+	return checkout_allow_conflict(data, error);
 }
 
 static int checkout_blob(
@@ -1875,6 +1968,294 @@ static int checkout_deferred_remove(git_repository *repo, const char *path)
 #endif
 }
 
+#ifdef GIT_THREADS
+
+/*
+ * With more than one thread, the blobs are read and written to the
+ * working directory by a pool of workers.  The calling thread creates the
+ * directories and loads the filters for each file in order, ahead of the
+ * workers, then updates the index and reports progress in the same order.
+ */
+typedef struct {
+	const git_diff_file *file;
+	char *path;
+	git_filter_list *filters;
+	struct stat st;
+	git_error_state error;
+	unsigned int skip : 1, /* not safe to update; leave it alone */
+		write : 1,
+		done : 1;
+} checkout_job;
+
+typedef struct {
+	checkout_data *data;
+	checkout_job *jobs;
+	size_t prepared; /* jobs that the workers can take */
+	size_t next;
+	bool all_prepared;
+	bool stop;
+	git_mutex lock;
+	git_cond cond;
+} checkout_pool;
+
+typedef struct {
+	checkout_pool *pool;
+	git_thread thread;
+	git_checkout_perfdata perfdata;
+} checkout_worker;
+
+static int checkout_job_prepare(
+	checkout_data *data,
+	checkout_job *job,
+	const git_diff_file *file)
+{
+	git_buf *fullpath;
+	int error;
+
+	job->file = file;
+
+	if (checkout_target_fullpath(&fullpath, data, file->path) < 0)
+		return -1;
+
+	if ((data->strategy & GIT_CHECKOUT_UPDATE_ONLY) != 0) {
+		int rval = checkout_safe_for_update_only(
+			data, fullpath->ptr, file->mode);
+
+		if (rval <= 0) {
+			job->skip = 1;
+			return rval;
+		}
+	}
+
+	job->path = git__strdup(fullpath->ptr);
+	GIT_ERROR_CHECK_ALLOC(job->path);
+
+	if ((error = mkpath2file(data, job->path, data->opts.dir_mode)) == 0 &&
+	    !S_ISLNK(file->mode))
+		error = checkout_load_filters(
+			&job->filters, data, &file->id, job->path, NULL);
+
+	if (error == 0)
+		job->write = 1;
+
+	return checkout_allow_conflict(data, error);
+}
+
+static int checkout_job_run(
+	checkout_data *data,
+	git_checkout_perfdata *perfdata,
+	checkout_job *job)
+{
+	git_blob *blob;
+	int error;
+
+	if (!job->write)
+		return 0;
+
+	if (!S_ISLNK(job->file->mode)) {
+		error = checkout_write_file(data, perfdata, &job->st, &job->file->id,
+			job->filters, job->path, job->file->mode);
+		return checkout_allow_conflict(data, error);
+	}
+
+	if ((error = git_blob_lookup(&blob, data->repo, &job->file->id)) < 0)
+		return checkout_allow_conflict(data, error);
+
+	error = checkout_write_link(data, perfdata, &job->st, blob, job->path);
+
+	git_blob_free(blob);
+
+	return checkout_allow_conflict(data, error);
+}
+
+static void *checkout_worker_run(void *arg)
+{
+	checkout_worker *worker = arg;
+	checkout_pool *pool = worker->pool;
+	checkout_job *job;
+	int error;
+
+	git_mutex_lock(&pool->lock);
+
+	while (!pool->stop) {
+		if (pool->next == pool->prepared) {
+			if (pool->all_prepared)
+				break;
+
+			git_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+
+		job = &pool->jobs[pool->next++];
+		git_mutex_unlock(&pool->lock);
+
+		if ((error = checkout_job_run(pool->data, &worker->perfdata, job)) < 0)
+			git_error_state_capture(&job->error, error);
+
+		git_mutex_lock(&pool->lock);
+		job->done = 1;
+		git_cond_broadcast(&pool->cond);
+	}
+
+	git_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static void checkout_pool_stop(
+	checkout_pool *pool, checkout_worker *workers, size_t nr_workers)
+{
+	checkout_data *data = pool->data;
+	size_t i;
+
+	git_mutex_lock(&pool->lock);
+	pool->stop = true;
+	git_cond_broadcast(&pool->cond);
+	git_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < nr_workers; i++) {
+		git_thread_join(&workers[i].thread, NULL);
+
+		data->perfdata.stat_calls += workers[i].perfdata.stat_calls;
+	}
+}
+
+/*
+ * Finish the job at `idx` on the calling thread, once the worker is done
+ * with it: update the index and report the progress.
+ */
+static int checkout_job_finish(checkout_pool *pool, size_t idx)
+{
+	checkout_data *data = pool->data;
+	checkout_job *job = &pool->jobs[idx];
+	int error = 0;
+
+	git_mutex_lock(&pool->lock);
+	while (!job->done)
+		git_cond_wait(&pool->cond, &pool->lock);
+	git_mutex_unlock(&pool->lock);
+
+	if (job->error.error_code < 0)
+		return git_error_state_restore(&job->error);
+
+	if (!job->skip) {
+		if ((data->strategy & GIT_CHECKOUT_DONT_UPDATE_INDEX) == 0 &&
+		    (error = checkout_update_index(data, job->file, &job->st)) < 0)
+			return error;
+
+		/* update the submodule data if this was a new .gitmodules file */
+		if (strcmp(job->file->path, ".gitmodules") == 0)
+			data->reload_submodules = true;
+	}
+
+	data->completed_steps++;
+	report_progress(data, job->file->path);
+
+	return 0;
+}
+
+static int checkout_create_the_new_threaded(
+	unsigned int *actions,
+	checkout_data *data)
+{
+	checkout_pool pool = {0};
+	checkout_worker *workers = NULL;
+	git_error_state prepare_error = {0};
+	git_diff_delta *delta;
+	size_t nr_jobs = 0, nr_workers = 0, i;
+	int error = 0;
+
+	git_vector_foreach(&data->diff->deltas, i, delta) {
+		if (actions[i] & CHECKOUT_ACTION__UPDATE_BLOB)
+			nr_jobs++;
+	}
+
+	if (!nr_jobs)
+		return 0;
+
+	pool.data = data;
+
+	if (git_mutex_init(&pool.lock) < 0 || git_cond_init(&pool.cond) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize checkout threads");
+		return -1;
+	}
+
+	pool.jobs = git__calloc(nr_jobs, sizeof(checkout_job));
+	workers = git__calloc(data->opts.threads, sizeof(checkout_worker));
+
+	if (!pool.jobs || !workers) {
+		error = -1;
+		goto done;
+	}
+
+	for (; nr_workers < data->opts.threads && nr_workers < nr_jobs; nr_workers++) {
+		workers[nr_workers].pool = &pool;
+
+		if ((error = git_thread_create(&workers[nr_workers].thread,
+				checkout_worker_run, &workers[nr_workers])) < 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+			goto done;
+		}
+	}
+
+	git_vector_foreach(&data->diff->deltas, i, delta) {
+		if (actions[i] & CHECKOUT_ACTION__DEFER_REMOVE) {
+			/* this had a blocker directory that should only be removed iff
+			 * all of the contents of the directory were safely removed
+			 */
+			if ((error = checkout_deferred_remove(
+					data->repo, delta->old_file.path)) < 0)
+				break;
+		}
+
+		if (actions[i] & CHECKOUT_ACTION__UPDATE_BLOB) {
+			if ((error = checkout_job_prepare(data,
+					&pool.jobs[pool.prepared], &delta->new_file)) < 0)
+				break;
+
+			git_mutex_lock(&pool.lock);
+			pool.prepared++;
+			git_cond_signal(&pool.cond);
+			git_mutex_unlock(&pool.lock);
+		}
+	}
+
+	/* the files before the one that failed are still written */
+	if (error < 0)
+		git_error_state_capture(&prepare_error, error);
+
+	git_mutex_lock(&pool.lock);
+	pool.all_prepared = true;
+	git_cond_broadcast(&pool.cond);
+	git_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < pool.prepared; i++) {
+		if ((error = checkout_job_finish(&pool, i)) < 0)
+			break;
+	}
+
+	if (!error && prepare_error.error_code < 0)
+		error = git_error_state_restore(&prepare_error);
+
+done:
+	checkout_pool_stop(&pool, workers, nr_workers);
+
+	for (i = 0; pool.jobs && i < nr_jobs; i++) {
+		git__free(pool.jobs[i].path);
+		git_filter_list_free(pool.jobs[i].filters);
+		git_error_state_free(&pool.jobs[i].error);
+	}
+
+	git_error_state_free(&prepare_error);
+	git_cond_free(&pool.cond);
+	git_mutex_free(&pool.lock);
+	git__free(pool.jobs);
+	git__free(workers);
+
+	return error;
+}
+
+#endif
+
 static int checkout_create_the_new(
 	unsigned int *actions,
 	checkout_data *data)
@@ -1883,6 +2264,15 @@ static int checkout_create_the_new(
 	git_diff_delta *delta;
 	size_t i;
 
+#ifdef GIT_THREADS
+	/*
+	 * On a case insensitive filesystem, a file may be in the way of a
+	 * directory that is created later on; only write these in order.
+	 */
+	if (data->opts.threads > 1 && !git_iterator_ignore_case(data->target))
+		return checkout_create_the_new_threaded(actions, data);
+#endif
+
 	git_vector_foreach(&data->diff->deltas, i, delta) {
 		if (actions[i] & CHECKOUT_ACTION__DEFER_REMOVE) {
 			/* this had a blocker directory that should only be removed iff
@@ -0,0 +1,1308 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "commit_graph.h"
+
+#include "git2/commit.h"
+#include "git2/refs.h"
+#include "git2/revwalk.h"
+
+#include "array.h"
+#include "filebuf.h"
+#include "hash.h"
+#include "odb.h"
+#include "oidarray.h"
+#include "oidmap.h"
+#include "repository.h"
+#include "sha1_lookup.h"
+
+#define COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_OBJECT_ID_VERSION 1
+struct git_commit_graph_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_graph_files;
+};
+
+#define COMMIT_GRAPH_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define COMMIT_GRAPH_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define COMMIT_GRAPH_COMMIT_DATA_ID 0x43444154 /* "CDAT" */
+#define COMMIT_GRAPH_EXTRA_EDGE_LIST_ID 0x45444745 /* "EDGE" */
+#define COMMIT_GRAPH_BASE_GRAPHS_LIST_ID 0x42415345 /* "BASE" */
+
+#define COMMIT_GRAPH_CHUNK_TABLE_ENTRY_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+#define COMMIT_GRAPH_COMMIT_DATA_ENTRY_SIZE (GIT_OID_RAWSZ + 4 * sizeof(uint32_t))
+
+#define COMMIT_GRAPH_EXTRA_EDGES_NEEDED 0x80000000
+#define COMMIT_GRAPH_LAST_EDGE 0x80000000
+
+struct git_commit_graph_chunk {
+	git_off_t offset;
+	size_t length;
+};
+
+GIT_INLINE(uint32_t) commit_graph_get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+GIT_INLINE(void) commit_graph_put_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static int commit_graph_error(const char *message)
+{
+	git_error_set(GIT_ERROR_ODB, "invalid commit-graph file - %s", message);
+	return -1;
+}
+
+static int commit_graph_parse_oid_fanout(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_fanout)
+{
+	uint32_t i, nr;
+
+	if (chunk_oid_fanout->offset == 0)
+		return commit_graph_error("missing OID Fanout chunk");
+	if (chunk_oid_fanout->length == 0)
+		return commit_graph_error("empty OID Fanout chunk");
+	if (chunk_oid_fanout->length != 256 * 4)
+		return commit_graph_error("OID Fanout chunk has wrong length");
+
+	file->oid_fanout = (const uint32_t *)(data + chunk_oid_fanout->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(file->oid_fanout[i]);
+		if (n < nr)
+			return commit_graph_error("index is non-monotonic");
+		nr = n;
+	}
+	file->num_commits = nr;
+	return 0;
+}
+
+static int commit_graph_parse_oid_lookup(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_lookup)
+{
+	uint32_t i;
+	git_oid *oid, *prev_oid, zero_oid = {{0}};
+
+	if (chunk_oid_lookup->offset == 0)
+		return commit_graph_error("missing OID Lookup chunk");
+	if (chunk_oid_lookup->length == 0)
+		return commit_graph_error("empty OID Lookup chunk");
+	if (chunk_oid_lookup->length != file->num_commits * GIT_OID_RAWSZ)
+		return commit_graph_error("OID Lookup chunk has wrong length");
+
+	file->oid_lookup = oid = (git_oid *)(data + chunk_oid_lookup->offset);
+	prev_oid = &zero_oid;
+	for (i = 0; i < file->num_commits; ++i, ++oid) {
+		if (git_oid_cmp(prev_oid, oid) >= 0)
+			return commit_graph_error("OID Lookup index is non-monotonic");
+		prev_oid = oid;
+	}
+
+	return 0;
+}
+
+static int commit_graph_parse_commit_data(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_commit_data)
+{
+	if (chunk_commit_data->offset == 0)
+		return commit_graph_error("missing Commit Data chunk");
+	if (chunk_commit_data->length == 0)
+		return commit_graph_error("empty Commit Data chunk");
+	if (chunk_commit_data->length !=
+			file->num_commits * COMMIT_GRAPH_COMMIT_DATA_ENTRY_SIZE)
+		return commit_graph_error("Commit Data chunk has wrong length");
+
+	file->commit_data = data + chunk_commit_data->offset;
+
+	return 0;
+}
+
+static int commit_graph_parse_extra_edge_list(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_extra_edge_list)
+{
+	if (chunk_extra_edge_list->length == 0)
+		return 0;
+	if (chunk_extra_edge_list->length % 4 != 0)
+		return commit_graph_error("malformed Extra Edge List chunk");
+
+	file->extra_edge_list = (const uint32_t *)(data + chunk_extra_edge_list->offset);
+	file->num_extra_edge_list = chunk_extra_edge_list->length / 4;
+
+	return 0;
+}
+
+int git_commit_graph_file_parse(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		size_t size)
+{
+	struct git_commit_graph_header *hdr;
+	const unsigned char *chunk_hdr;
+	struct git_commit_graph_chunk *last_chunk;
+	uint32_t i;
+	git_off_t last_chunk_offset, chunk_offset, trailer_offset;
+	struct git_commit_graph_chunk chunk_oid_fanout = {0}, chunk_oid_lookup = {0},
+				      chunk_commit_data = {0}, chunk_extra_edge_list = {0},
+				      chunk_base_graphs = {0}, chunk_unsupported = {0};
+
+	assert(file);
+
+	if (size < sizeof(struct git_commit_graph_header) + GIT_OID_RAWSZ)
+		return commit_graph_error("commit-graph is too short");
+
+	hdr = ((struct git_commit_graph_header *)data);
+
+	if (hdr->signature != htonl(COMMIT_GRAPH_SIGNATURE) ||
+	    hdr->version != COMMIT_GRAPH_VERSION ||
+	    hdr->object_id_version != COMMIT_GRAPH_OBJECT_ID_VERSION) {
+		return commit_graph_error("unsupported commit-graph version");
+	}
+	if (hdr->chunks == 0)
+		return commit_graph_error("no chunks in commit-graph");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset = sizeof(struct git_commit_graph_header) +
+		(1 + hdr->chunks) * COMMIT_GRAPH_CHUNK_TABLE_ENTRY_SIZE;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return commit_graph_error("wrong commit-graph size");
+	git_oid_cpy(&file->checksum, (git_oid *)(data + trailer_offset));
+
+	chunk_hdr = data + sizeof(struct git_commit_graph_header);
+	last_chunk = NULL;
+	for (i = 0; i <= hdr->chunks; ++i, chunk_hdr += COMMIT_GRAPH_CHUNK_TABLE_ENTRY_SIZE) {
+		chunk_offset = ((git_off_t)commit_graph_get_be32(chunk_hdr + 4)) << 32 |
+			((git_off_t)commit_graph_get_be32(chunk_hdr + 8));
+		if (chunk_offset < last_chunk_offset)
+			return commit_graph_error("chunks are non-monotonic");
+		if (chunk_offset > trailer_offset)
+			return commit_graph_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		/* The last entry of the table only marks the end of the last chunk. */
+		if (i == hdr->chunks)
+			break;
+
+		switch (commit_graph_get_be32(chunk_hdr)) {
+		case COMMIT_GRAPH_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case COMMIT_GRAPH_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case COMMIT_GRAPH_COMMIT_DATA_ID:
+			chunk_commit_data.offset = last_chunk_offset;
+			last_chunk = &chunk_commit_data;
+			break;
+
+		case COMMIT_GRAPH_EXTRA_EDGE_LIST_ID:
+			chunk_extra_edge_list.offset = last_chunk_offset;
+			last_chunk = &chunk_extra_edge_list;
+			break;
+
+		case COMMIT_GRAPH_BASE_GRAPHS_LIST_ID:
+			chunk_base_graphs.offset = last_chunk_offset;
+			last_chunk = &chunk_base_graphs;
+			break;
+
+		default:
+			chunk_unsupported.offset = last_chunk_offset;
+			last_chunk = &chunk_unsupported;
+		}
+	}
+
+	if (chunk_base_graphs.length != (size_t)hdr->base_graph_files * GIT_OID_RAWSZ)
+		return commit_graph_error("Base Graphs List chunk has wrong length");
+
+	if (commit_graph_parse_oid_fanout(file, data, &chunk_oid_fanout) < 0 ||
+	    commit_graph_parse_oid_lookup(file, data, &chunk_oid_lookup) < 0 ||
+	    commit_graph_parse_commit_data(file, data, &chunk_commit_data) < 0 ||
+	    commit_graph_parse_extra_edge_list(file, data, &chunk_extra_edge_list) < 0)
+		return -1;
+
+	return 0;
+}
+
+int git_commit_graph_file_open(git_commit_graph_file **file_out, const char *path)
+{
+	git_commit_graph_file *file;
+	git_file fd = -1;
+	size_t cgraph_size;
+	struct stat st;
+	int error;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		git_error_set(GIT_ERROR_ODB, "commit-graph file not found - '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		git_error_set(GIT_ERROR_ODB, "invalid commit-graph file '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+	cgraph_size = (size_t)st.st_size;
+
+	file = git__calloc(1, sizeof(git_commit_graph_file));
+	GIT_ERROR_CHECK_ALLOC(file);
+
+	error = git_futils_mmap_ro(&file->graph_map, fd, 0, cgraph_size);
+	p_close(fd);
+	if (error < 0) {
+		git_commit_graph_file_free(file);
+		return error;
+	}
+
+	if ((error = git_commit_graph_file_parse(file, file->graph_map.data, cgraph_size)) < 0) {
+		git_commit_graph_file_free(file);
+		return error;
+	}
+
+	*file_out = file;
+	return 0;
+}
+
+int git_commit_graph_chain_open(
+		git_commit_graph_file **file_out,
+		const char *chain_dir)
+{
+	git_buf chain_path = GIT_BUF_INIT, chain = GIT_BUF_INIT,
+		graph_path = GIT_BUF_INIT;
+	git_commit_graph_file *top = NULL, *layer;
+	char *buffer, *line;
+	uint32_t num_layers = 0;
+	git_oid checksum;
+	int error;
+
+	if ((error = git_buf_joinpath(&chain_path, chain_dir, GIT_COMMIT_GRAPH_CHAIN_FILE)) < 0 ||
+	    (error = git_futils_readbuffer(&chain, chain_path.ptr)) < 0)
+		goto done;
+
+	/* The chain lists the base layer first; every line names one layer. */
+	buffer = chain.ptr;
+	while ((line = git__strsep(&buffer, "\n")) != NULL) {
+		if (*line == '\0')
+			continue;
+
+		if (strlen(line) != GIT_OID_HEXSZ ||
+		    git_oid_fromstr(&checksum, line) < 0) {
+			error = commit_graph_error("malformed commit-graph chain");
+			goto done;
+		}
+
+		git_buf_clear(&graph_path);
+		if ((error = git_buf_printf(&graph_path, "%s/graph-%s.graph", chain_dir, line)) < 0 ||
+		    (error = git_commit_graph_file_open(&layer, graph_path.ptr)) < 0)
+			goto done;
+
+		layer->base = top;
+		if (top)
+			layer->num_base_commits = top->num_base_commits + top->num_commits;
+		top = layer;
+
+		if (git_oid_cmp(&layer->checksum, &checksum) != 0 ||
+		    ((const struct git_commit_graph_header *)layer->graph_map.data)->base_graph_files != num_layers) {
+			error = commit_graph_error("commit-graph chain does not match its layers");
+			goto done;
+		}
+
+		num_layers++;
+	}
+
+	if (!top) {
+		git_error_set(GIT_ERROR_ODB, "commit-graph chain is empty");
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+
+	*file_out = top;
+	top = NULL;
+
+done:
+	git_commit_graph_file_free(top);
+	git_buf_dispose(&chain_path);
+	git_buf_dispose(&chain);
+	git_buf_dispose(&graph_path);
+	return error;
+}
+
+static int commit_graph_load(git_commit_graph_file **out, git_commit_graph *cgraph)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_buf_joinpath(&path, cgraph->objects_info_dir.ptr, GIT_COMMIT_GRAPH_FILE)) < 0)
+		return error;
+
+	/* Like git, a standalone commit-graph file takes precedence over a chain. */
+	error = git_commit_graph_file_open(out, path.ptr);
+
+	if (error == GIT_ENOTFOUND) {
+		git_buf_clear(&path);
+		if ((error = git_buf_joinpath(&path, cgraph->objects_info_dir.ptr, GIT_COMMIT_GRAPH_CHAIN_DIR)) < 0)
+			goto done;
+
+		error = git_commit_graph_chain_open(out, path.ptr);
+	}
+
+done:
+	git_buf_dispose(&path);
+	return error;
+}
+
+static bool commit_graph_stamp_changed(
+		git_commit_graph *cgraph,
+		git_futils_filestamp *stamp,
+		const char *filename)
+{
+	git_buf path = GIT_BUF_INIT;
+	bool existed;
+	int error;
+
+	if (git_buf_joinpath(&path, cgraph->objects_info_dir.ptr, filename) < 0)
+		return true;
+
+	error = git_futils_filestamp_check(stamp, path.ptr);
+	git_buf_dispose(&path);
+
+	if (error == GIT_ENOTFOUND) {
+		existed = (stamp->mtime.tv_sec || stamp->size || stamp->ino);
+		git_futils_filestamp_set(stamp, NULL);
+		return existed;
+	}
+
+	return (error != 0);
+}
+
+int git_commit_graph_new(
+		git_commit_graph **cgraph_out,
+		const char *objects_dir,
+		bool open_file)
+{
+	git_commit_graph *cgraph = NULL;
+	git_commit_graph_file *file;
+	int error = 0;
+
+	assert(cgraph_out && objects_dir);
+
+	cgraph = git__calloc(1, sizeof(git_commit_graph));
+	GIT_ERROR_CHECK_ALLOC(cgraph);
+
+	if ((error = git_buf_joinpath(&cgraph->objects_info_dir, objects_dir, "info")) < 0)
+		goto error;
+
+	if (open_file) {
+		if ((error = git_commit_graph_get_file(&file, cgraph)) < 0)
+			goto error;
+
+		git_commit_graph_file_release(file);
+	}
+
+	*cgraph_out = cgraph;
+	return 0;
+
+error:
+	git_commit_graph_free(cgraph);
+	return error;
+}
+
+int git_commit_graph_get_file(
+		git_commit_graph_file **file_out,
+		git_commit_graph *cgraph)
+{
+	int error;
+
+	if (!cgraph->checked) {
+		cgraph->checked = 1;
+
+		commit_graph_stamp_changed(cgraph, &cgraph->graph_stamp, GIT_COMMIT_GRAPH_FILE);
+		commit_graph_stamp_changed(cgraph, &cgraph->chain_stamp,
+			GIT_COMMIT_GRAPH_CHAIN_DIR "/" GIT_COMMIT_GRAPH_CHAIN_FILE);
+
+		/*
+		 * A missing or unusable commit-graph only means that callers
+		 * have to parse commits from the object database; it is not
+		 * an error for the repository.
+		 */
+		if ((error = commit_graph_load(&cgraph->file, cgraph)) < 0) {
+			cgraph->file = NULL;
+
+			if (error != GIT_ENOTFOUND)
+				return error;
+		} else {
+			GIT_REFCOUNT_INC(cgraph->file);
+		}
+	}
+
+	if (!cgraph->file)
+		return GIT_ENOTFOUND;
+
+	GIT_REFCOUNT_INC(cgraph->file);
+	*file_out = cgraph->file;
+	return 0;
+}
+
+void git_commit_graph_refresh(git_commit_graph *cgraph)
+{
+	bool changed;
+
+	if (!cgraph || !cgraph->checked)
+		return;
+
+	changed = commit_graph_stamp_changed(cgraph, &cgraph->graph_stamp,
+		GIT_COMMIT_GRAPH_FILE);
+	changed |= commit_graph_stamp_changed(cgraph, &cgraph->chain_stamp,
+		GIT_COMMIT_GRAPH_CHAIN_DIR "/" GIT_COMMIT_GRAPH_CHAIN_FILE);
+
+	if (!changed)
+		return;
+
+	/* Callers that still hold the old file keep it alive until they are done. */
+	git_commit_graph_file_release(cgraph->file);
+	cgraph->file = NULL;
+	cgraph->checked = 0;
+}
+
+static const git_commit_graph_file *commit_graph_layer_for(
+		const git_commit_graph_file *file,
+		size_t pos)
+{
+	while (file && pos < file->num_base_commits)
+		file = file->base;
+
+	if (!file || pos >= (size_t)file->num_base_commits + file->num_commits) {
+		git_error_set(GIT_ERROR_INVALID, "commit index %" PRIuZ " does not exist", pos);
+		return NULL;
+	}
+
+	return file;
+}
+
+static int commit_graph_entry_get_byindex(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		size_t pos)
+{
+	const git_commit_graph_file *layer;
+	const unsigned char *commit_data;
+	uint32_t packed_date;
+	size_t local_pos;
+
+	assert(e && file);
+
+	if ((layer = commit_graph_layer_for(file, pos)) == NULL)
+		return GIT_ENOTFOUND;
+
+	local_pos = pos - layer->num_base_commits;
+	commit_data = layer->commit_data + local_pos * COMMIT_GRAPH_COMMIT_DATA_ENTRY_SIZE;
+
+	git_oid_cpy(&e->tree_oid, (const git_oid *)commit_data);
+	e->parent_indices[0] = commit_graph_get_be32(commit_data + GIT_OID_RAWSZ);
+	e->parent_indices[1] = commit_graph_get_be32(commit_data + GIT_OID_RAWSZ + sizeof(uint32_t));
+	e->parent_count = (e->parent_indices[0] != GIT_COMMIT_GRAPH_MISSING_PARENT)
+			+ (e->parent_indices[1] != GIT_COMMIT_GRAPH_MISSING_PARENT);
+
+	packed_date = commit_graph_get_be32(commit_data + GIT_OID_RAWSZ + 2 * sizeof(uint32_t));
+	e->generation = packed_date >> 2;
+	e->commit_time = ((uint64_t)(packed_date & 0x3)) << 32 |
+		commit_graph_get_be32(commit_data + GIT_OID_RAWSZ + 3 * sizeof(uint32_t));
+
+	e->extra_parents_index = 0;
+	if (e->parent_indices[1] & COMMIT_GRAPH_EXTRA_EDGES_NEEDED) {
+		/*
+		 * If the second parent has the most-significant bit set, the
+		 * second and later parents are in the Extra Edge List chunk.
+		 */
+		size_t extra_edge_list_pos = e->parent_indices[1] & ~COMMIT_GRAPH_EXTRA_EDGES_NEEDED;
+
+		/* Make sure we're not being sent out of bounds */
+		if (extra_edge_list_pos >= layer->num_extra_edge_list) {
+			git_error_set(GIT_ERROR_INVALID,
+				"commit %u does not exist",
+				(unsigned)extra_edge_list_pos);
+			return GIT_ENOTFOUND;
+		}
+
+		e->extra_parents_index = extra_edge_list_pos;
+		e->parent_count = 1;
+		while (extra_edge_list_pos < layer->num_extra_edge_list) {
+			e->parent_count++;
+			if (ntohl(layer->extra_edge_list[extra_edge_list_pos]) & COMMIT_GRAPH_LAST_EDGE)
+				break;
+			extra_edge_list_pos++;
+		}
+	}
+
+	git_oid_cpy(&e->sha1, &layer->oid_lookup[local_pos]);
+	return 0;
+}
+
+/* Find a commit in a single layer, without looking at the layers below it. */
+static int commit_graph_layer_position(
+		const git_commit_graph_file *layer,
+		const git_oid *oid)
+{
+	uint32_t hi, lo;
+
+	hi = ntohl(layer->oid_fanout[(int)oid->id[0]]);
+	lo = ((oid->id[0] == 0x0) ? 0 : ntohl(layer->oid_fanout[(int)oid->id[0] - 1]));
+
+	return sha1_position(layer->oid_lookup, GIT_OID_RAWSZ, lo, hi, oid->id);
+}
+
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *oid)
+{
+	const git_commit_graph_file *layer;
+	int pos;
+
+	assert(e && file && oid);
+
+	for (layer = file; layer; layer = layer->base) {
+		if ((pos = commit_graph_layer_position(layer, oid)) >= 0)
+			return commit_graph_entry_get_byindex(
+				e, file, layer->num_base_commits + (size_t)pos);
+	}
+
+	return git_odb__error_notfound(
+		"failed to find offset for commit-graph index entry", oid, GIT_OID_HEXSZ);
+}
+
+int git_commit_graph_entry_parent(
+		git_commit_graph_entry *parent,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		size_t n)
+{
+	const git_commit_graph_file *layer;
+	size_t pos;
+
+	assert(parent && file);
+
+	if (n >= entry->parent_count) {
+		git_error_set(GIT_ERROR_INVALID, "parent index %" PRIuZ " does not exist", n);
+		return GIT_ENOTFOUND;
+	}
+
+	if (n == 0 || (n == 1 && entry->parent_count == 2))
+		return commit_graph_entry_get_byindex(parent, file, entry->parent_indices[n]);
+
+	/* The extra edges live in the layer that contains the commit itself. */
+	for (layer = file; layer; layer = layer->base) {
+		if (commit_graph_layer_position(layer, &entry->sha1) >= 0)
+			break;
+	}
+
+	pos = entry->extra_parents_index + n - 1;
+	if (!layer || pos >= layer->num_extra_edge_list) {
+		git_error_set(GIT_ERROR_INVALID, "parent index %" PRIuZ " does not exist", n);
+		return GIT_ENOTFOUND;
+	}
+
+	return commit_graph_entry_get_byindex(
+			parent, file,
+			ntohl(layer->extra_edge_list[pos]) & ~COMMIT_GRAPH_LAST_EDGE);
+}
+
+void git_commit_graph_file_free(git_commit_graph_file *file)
+{
+	git_commit_graph_file *base;
+
+	while (file) {
+		base = file->base;
+
+		if (file->graph_map.data)
+			git_futils_mmap_free(&file->graph_map);
+		git__free(file);
+
+		file = base;
+	}
+}
+
+void git_commit_graph_file_release(git_commit_graph_file *file)
+{
+	if (file)
+		GIT_REFCOUNT_DEC(file, git_commit_graph_file_free);
+}
+
+void git_commit_graph_free(git_commit_graph *cgraph)
+{
+	if (!cgraph)
+		return;
+
+	git_buf_dispose(&cgraph->objects_info_dir);
+	git_commit_graph_file_release(cgraph->file);
+	git__free(cgraph);
+}
+
+/*
+ * Writer
+ */
+
+struct packed_commit {
+	size_t index;
+	git_oid sha1;
+	git_oid tree_oid;
+	uint64_t commit_time;
+	uint32_t generation;
+	git_array_oid_t parents;
+	git_array_t(size_t) parent_indices;
+};
+
+struct git_commit_graph_writer {
+	git_buf objects_info_dir;
+	git_vector commits;
+};
+
+static void packed_commit_free(struct packed_commit *p)
+{
+	if (!p)
+		return;
+
+	git_array_clear(p->parents);
+	git_array_clear(p->parent_indices);
+	git__free(p);
+}
+
+static void packed_commit_free_cb(void *p)
+{
+	packed_commit_free((struct packed_commit *)p);
+}
+
+static int packed_commit_new(
+		struct packed_commit **out,
+		git_repository *repo,
+		const git_oid *commit_id)
+{
+	struct packed_commit *p;
+	git_commit *commit;
+	unsigned int i, parentcount;
+	int error;
+
+	if ((error = git_commit_lookup(&commit, repo, commit_id)) < 0)
+		return error;
+
+	p = git__calloc(1, sizeof(struct packed_commit));
+	GIT_ERROR_CHECK_ALLOC(p);
+
+	git_oid_cpy(&p->sha1, commit_id);
+	git_oid_cpy(&p->tree_oid, git_commit_tree_id(commit));
+	p->commit_time = (uint64_t)git_commit_time(commit);
+
+	parentcount = git_commit_parentcount(commit);
+	git_array_init_to_size(p->parents, parentcount);
+	if (parentcount && !p->parents.ptr)
+		goto oom;
+
+	for (i = 0; i < parentcount; ++i) {
+		git_oid *parent_id = git_array_alloc(p->parents);
+		if (!parent_id)
+			goto oom;
+
+		git_oid_cpy(parent_id, git_commit_parent_id(commit, i));
+	}
+
+	git_commit_free(commit);
+	*out = p;
+	return 0;
+
+oom:
+	git_commit_free(commit);
+	packed_commit_free(p);
+	git_error_set_oom();
+	return -1;
+}
+
+static int packed_commit__cmp(const void *a_, const void *b_)
+{
+	const struct packed_commit *a = a_;
+	const struct packed_commit *b = b_;
+	return git_oid_cmp(&a->sha1, &b->sha1);
+}
+
+static int packed_commit__cmp_oid(const void *key, const void *entry)
+{
+	const struct packed_commit *b = entry;
+	return git_oid_cmp((const git_oid *)key, &b->sha1);
+}
+
+int git_commit_graph_writer_new(
+		git_commit_graph_writer **out,
+		const char *objects_info_dir)
+{
+	git_commit_graph_writer *w;
+
+	assert(out && objects_info_dir);
+
+	w = git__calloc(1, sizeof(git_commit_graph_writer));
+	GIT_ERROR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->objects_info_dir, objects_info_dir) < 0) {
+		git__free(w);
+		return -1;
+	}
+
+	if (git_vector_init(&w->commits, 0, packed_commit__cmp) < 0) {
+		git_buf_dispose(&w->objects_info_dir);
+		git__free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_commit_graph_writer_free(git_commit_graph_writer *w)
+{
+	struct packed_commit *packed_commit;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach(&w->commits, i, packed_commit)
+		packed_commit_free(packed_commit);
+	git_vector_free(&w->commits);
+	git_buf_dispose(&w->objects_info_dir);
+	git__free(w);
+}
+
+/*
+ * A commit-graph has to contain every parent of the commits in it. Add the
+ * parents that are not yet part of the writer, along with their history.
+ */
+static int commit_graph_writer_close_parents(
+		git_commit_graph_writer *w,
+		git_repository *repo)
+{
+	git_oidmap *seen = NULL;
+	struct packed_commit *packed_commit, *parent_commit;
+	git_oid *parent_id;
+	size_t i, j;
+	int error;
+
+	if ((error = git_oidmap_new(&seen)) < 0)
+		return error;
+
+	git_vector_foreach(&w->commits, i, packed_commit) {
+		if ((error = git_oidmap_set(seen, &packed_commit->sha1, packed_commit)) < 0)
+			goto done;
+	}
+
+	/* `w->commits` grows while we iterate, so newly added parents are visited too. */
+	for (i = 0; i < w->commits.length; ++i) {
+		packed_commit = git_vector_get(&w->commits, i);
+
+		git_array_foreach(packed_commit->parents, j, parent_id) {
+			if (git_oidmap_exists(seen, parent_id))
+				continue;
+
+			if ((error = packed_commit_new(&parent_commit, repo, parent_id)) < 0)
+				goto done;
+
+			if ((error = git_vector_insert(&w->commits, parent_commit)) < 0) {
+				packed_commit_free(parent_commit);
+				goto done;
+			}
+
+			if ((error = git_oidmap_set(seen, &parent_commit->sha1, parent_commit)) < 0)
+				goto done;
+		}
+	}
+
+done:
+	git_oidmap_free(seen);
+	return error;
+}
+
+int git_commit_graph_writer_add_revwalk(
+		git_commit_graph_writer *w,
+		git_revwalk *walk)
+{
+	git_repository *repo;
+	git_oid id;
+	struct packed_commit *packed_commit;
+	int error;
+
+	assert(w && walk);
+
+	repo = git_revwalk_repository(walk);
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if ((error = packed_commit_new(&packed_commit, repo, &id)) < 0)
+			return error;
+
+		if ((error = git_vector_insert(&w->commits, packed_commit)) < 0) {
+			packed_commit_free(packed_commit);
+			return error;
+		}
+	}
+
+	if (error != GIT_ITEROVER)
+		return error;
+
+	return commit_graph_writer_close_parents(w, repo);
+}
+
+int git_commit_graph_writer_add_all_refs(
+		git_commit_graph_writer *w,
+		git_repository *repo)
+{
+	git_revwalk *walk;
+	int error;
+
+	assert(w && repo);
+
+	if ((error = git_revwalk_new(&walk, repo)) < 0)
+		return error;
+
+	if ((error = git_revwalk_push_glob(walk, GIT_REFS_DIR "*")) < 0)
+		goto done;
+
+	/* A detached HEAD is not reachable from any reference. */
+	if ((error = git_revwalk_push_head(walk)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			goto done;
+
+		git_error_clear();
+	}
+
+	error = git_commit_graph_writer_add_revwalk(w, walk);
+
+done:
+	git_revwalk_free(walk);
+	return error;
+}
+
+typedef int (*commit_graph_write_cb)(const char *buf, size_t size, void *cb_data);
+
+struct commit_graph_write_hash_context {
+	commit_graph_write_cb write_cb;
+	void *cb_data;
+	git_hash_ctx *ctx;
+};
+
+static int commit_graph_write_hash(const char *buf, size_t size, void *data)
+{
+	struct commit_graph_write_hash_context *ctx = data;
+	int error;
+
+	if ((error = git_hash_update(ctx->ctx, buf, size)) < 0)
+		return error;
+
+	return ctx->write_cb(buf, size, ctx->cb_data);
+}
+
+static int commit_graph_write_be32(
+		commit_graph_write_cb write_cb,
+		void *cb_data,
+		uint32_t value)
+{
+	unsigned char buf[4];
+
+	commit_graph_put_be32(buf, value);
+	return write_cb((const char *)buf, sizeof(buf), cb_data);
+}
+
+static int commit_graph_write_chunk_header(
+		commit_graph_write_cb write_cb,
+		void *cb_data,
+		uint32_t chunk_id,
+		uint64_t offset)
+{
+	int error;
+
+	if ((error = commit_graph_write_be32(write_cb, cb_data, chunk_id)) < 0 ||
+	    (error = commit_graph_write_be32(write_cb, cb_data, (uint32_t)(offset >> 32))) < 0 ||
+	    (error = commit_graph_write_be32(write_cb, cb_data, (uint32_t)offset)) < 0)
+		return error;
+
+	return 0;
+}
+
+/*
+ * Compute the topological level of every commit: one more than the
+ * highest level among its parents, with root commits at level 1. The
+ * history is walked with an explicit stack, so that deep histories do
+ * not exhaust the C stack.
+ */
+static int commit_graph_compute_generations(git_commit_graph_writer *w)
+{
+	git_array_t(size_t) stack = GIT_ARRAY_INIT;
+	struct packed_commit *packed_commit, *parent;
+	size_t i, j, *parent_index, *top;
+	uint32_t max_generation;
+	bool parents_done;
+	int error = 0;
+
+	git_vector_foreach(&w->commits, i, packed_commit) {
+		if (packed_commit->generation)
+			continue;
+
+		if ((top = git_array_alloc(stack)) == NULL)
+			goto oom;
+		*top = i;
+
+		while ((top = git_array_last(stack)) != NULL) {
+			packed_commit = git_vector_get(&w->commits, *top);
+
+			if (packed_commit->generation) {
+				stack.size--;
+				continue;
+			}
+
+			max_generation = 0;
+			parents_done = true;
+
+			git_array_foreach(packed_commit->parent_indices, j, parent_index) {
+				parent = git_vector_get(&w->commits, *parent_index);
+
+				if (!parent->generation) {
+					size_t *pushed = git_array_alloc(stack);
+					if (!pushed)
+						goto oom;
+
+					*pushed = *parent_index;
+					parents_done = false;
+				} else if (parent->generation > max_generation) {
+					max_generation = parent->generation;
+				}
+			}
+
+			if (!parents_done)
+				continue;
+
+			if (max_generation >= GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX)
+				packed_commit->generation = GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX;
+			else
+				packed_commit->generation = max_generation + 1;
+
+			stack.size--;
+		}
+	}
+
+	git_array_clear(stack);
+	return error;
+
+oom:
+	git_array_clear(stack);
+	git_error_set_oom();
+	return -1;
+}
+
+static int commit_graph_write(
+		git_commit_graph_writer *w,
+		commit_graph_write_cb write_cb,
+		void *cb_data)
+{
+	int error = 0;
+	size_t i, j;
+	struct packed_commit *packed_commit;
+	struct git_commit_graph_header hdr = {0};
+	uint32_t oid_fanout_count;
+	uint32_t extra_edge_list_count;
+	uint32_t oid_fanout[256];
+	uint64_t offset;
+	git_buf oid_lookup = GIT_BUF_INIT, commit_data = GIT_BUF_INIT,
+		extra_edge_list = GIT_BUF_INIT;
+	git_oid cgraph_checksum = {{0}};
+	git_hash_ctx ctx;
+	struct commit_graph_write_hash_context hash_cb_data = {0};
+
+	hdr.signature = htonl(COMMIT_GRAPH_SIGNATURE);
+	hdr.version = COMMIT_GRAPH_VERSION;
+	hdr.object_id_version = COMMIT_GRAPH_OBJECT_ID_VERSION;
+	hdr.chunks = 0;
+	hdr.base_graph_files = 0;
+	hash_cb_data.write_cb = write_cb;
+	hash_cb_data.cb_data = cb_data;
+	hash_cb_data.ctx = &ctx;
+
+	if ((error = git_hash_ctx_init(&ctx)) < 0)
+		return error;
+	cb_data = &hash_cb_data;
+	write_cb = commit_graph_write_hash;
+
+	/* Sort the commits. */
+	git_vector_sort(&w->commits);
+	git_vector_uniq(&w->commits, packed_commit_free_cb);
+	git_vector_foreach(&w->commits, i, packed_commit)
+		packed_commit->index = i;
+
+	if (w->commits.length > UINT32_MAX - 1) {
+		git_error_set(GIT_ERROR_INVALID, "too many commits for a commit-graph");
+		error = -1;
+		goto cleanup;
+	}
+
+	/* Resolve the parents into positions in the graph. */
+	git_vector_foreach(&w->commits, i, packed_commit) {
+		git_oid *parent_id;
+
+		git_array_clear(packed_commit->parent_indices);
+		git_array_foreach(packed_commit->parents, j, parent_id) {
+			size_t parent_pos, *parent_index;
+
+			if (git_vector_bsearch2(&parent_pos, &w->commits, packed_commit__cmp_oid, parent_id) < 0) {
+				git_error_set(GIT_ERROR_ODB,
+					"commit-graph is missing a parent of the commits it contains");
+				error = -1;
+				goto cleanup;
+			}
+
+			if ((parent_index = git_array_alloc(packed_commit->parent_indices)) == NULL) {
+				git_error_set_oom();
+				error = -1;
+				goto cleanup;
+			}
+			*parent_index = parent_pos;
+		}
+
+		packed_commit->generation = GIT_COMMIT_GRAPH_GENERATION_NUMBER_ZERO;
+	}
+
+	if ((error = commit_graph_compute_generations(w)) < 0)
+		goto cleanup;
+
+	/* Fill the OID Fanout table. */
+	oid_fanout_count = 0;
+	for (i = 0; i < 256; i++) {
+		while (oid_fanout_count < git_vector_length(&w->commits) &&
+		       (packed_commit = (struct packed_commit *)git_vector_get(&w->commits, oid_fanout_count)) &&
+		       packed_commit->sha1.id[0] <= i)
+			++oid_fanout_count;
+		oid_fanout[i] = htonl(oid_fanout_count);
+	}
+
+	/* Fill the OID Lookup table. */
+	git_vector_foreach(&w->commits, i, packed_commit) {
+		error = git_buf_put(&oid_lookup,
+			(const char *)&packed_commit->sha1, sizeof(git_oid));
+		if (error < 0)
+			goto cleanup;
+	}
+
+	/* Fill the Commit Data and Extra Edge List tables. */
+	extra_edge_list_count = 0;
+	git_vector_foreach(&w->commits, i, packed_commit) {
+		uint64_t commit_time;
+		uint32_t word;
+		size_t *packed_index;
+		unsigned int parentcount = (unsigned int)git_array_size(packed_commit->parents);
+
+		error = git_buf_put(&commit_data,
+			(const char *)&packed_commit->tree_oid,
+			sizeof(git_oid));
+		if (error < 0)
+			goto cleanup;
+
+		if (parentcount == 0) {
+			word = htonl(GIT_COMMIT_GRAPH_MISSING_PARENT);
+		} else {
+			packed_index = git_array_get(packed_commit->parent_indices, 0);
+			word = htonl((uint32_t)*packed_index);
+		}
+		error = git_buf_put(&commit_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+
+		if (parentcount < 2) {
+			word = htonl(GIT_COMMIT_GRAPH_MISSING_PARENT);
+		} else if (parentcount == 2) {
+			packed_index = git_array_get(packed_commit->parent_indices, 1);
+			word = htonl((uint32_t)*packed_index);
+		} else {
+			word = htonl(COMMIT_GRAPH_EXTRA_EDGES_NEEDED | extra_edge_list_count);
+		}
+		error = git_buf_put(&commit_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+
+		if (parentcount > 2) {
+			unsigned int parent_i;
+			for (parent_i = 1; parent_i < parentcount; ++parent_i) {
+				packed_index = git_array_get(
+					packed_commit->parent_indices, parent_i);
+				word = htonl((uint32_t)(*packed_index | (parent_i + 1 == parentcount ? COMMIT_GRAPH_LAST_EDGE : 0)));
+
+				error = git_buf_put(&extra_edge_list,
+					(const char *)&word,
+					sizeof(word));
+				if (error < 0)
+					goto cleanup;
+			}
+			extra_edge_list_count += parentcount - 1;
+		}
+
+		commit_time = packed_commit->commit_time;
+		word = htonl((uint32_t)((packed_commit->generation << 2) | ((commit_time >> 32ull) & 0x3ull)));
+		error = git_buf_put(&commit_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+		word = htonl((uint32_t)(commit_time & 0xffffffffull));
+		error = git_buf_put(&commit_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+	}
+
+	/* Write the header. */
+	hdr.chunks = 3;
+	if (git_buf_len(&extra_edge_list) > 0)
+		hdr.chunks++;
+	error = write_cb((const char *)&hdr, sizeof(hdr), cb_data);
+	if (error < 0)
+		goto cleanup;
+
+	/* Write the chunk headers. */
+	offset = sizeof(hdr) + (hdr.chunks + 1) * COMMIT_GRAPH_CHUNK_TABLE_ENTRY_SIZE;
+	error = commit_graph_write_chunk_header(write_cb, cb_data, COMMIT_GRAPH_OID_FANOUT_ID, offset);
+	if (error < 0)
+		goto cleanup;
+	offset += sizeof(oid_fanout);
+	error = commit_graph_write_chunk_header(write_cb, cb_data, COMMIT_GRAPH_OID_LOOKUP_ID, offset);
+	if (error < 0)
+		goto cleanup;
+	offset += git_buf_len(&oid_lookup);
+	error = commit_graph_write_chunk_header(write_cb, cb_data, COMMIT_GRAPH_COMMIT_DATA_ID, offset);
+	if (error < 0)
+		goto cleanup;
+	offset += git_buf_len(&commit_data);
+	if (git_buf_len(&extra_edge_list) > 0) {
+		error = commit_graph_write_chunk_header(
+				write_cb, cb_data, COMMIT_GRAPH_EXTRA_EDGE_LIST_ID, offset);
+		if (error < 0)
+			goto cleanup;
+		offset += git_buf_len(&extra_edge_list);
+	}
+	error = commit_graph_write_chunk_header(write_cb, cb_data, 0, offset);
+	if (error < 0)
+		goto cleanup;
+
+	/* Write all the chunks. */
+	error = write_cb((const char *)oid_fanout, sizeof(oid_fanout), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_buf_cstr(&oid_lookup), git_buf_len(&oid_lookup), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_buf_cstr(&commit_data), git_buf_len(&commit_data), cb_data);
+	if (error < 0)
+		goto cleanup;
+	error = write_cb(git_buf_cstr(&extra_edge_list), git_buf_len(&extra_edge_list), cb_data);
+	if (error < 0)
+		goto cleanup;
+
+	/* Finalize the checksum and write the trailer. */
+	error = git_hash_final(&cgraph_checksum, &ctx);
+	if (error < 0)
+		goto cleanup;
+	error = hash_cb_data.write_cb((const char *)&cgraph_checksum, sizeof(cgraph_checksum), hash_cb_data.cb_data);
+	if (error < 0)
+		goto cleanup;
+
+cleanup:
+	git_buf_dispose(&oid_lookup);
+	git_buf_dispose(&commit_data);
+	git_buf_dispose(&extra_edge_list);
+	git_hash_ctx_cleanup(&ctx);
+	return error;
+}
+
+static int commit_graph_write_buf(const char *buf, size_t size, void *data)
+{
+	git_buf *b = (git_buf *)data;
+	return git_buf_put(b, buf, size);
+}
+
+static int commit_graph_write_filebuf(const char *buf, size_t size, void *data)
+{
+	git_filebuf *f = (git_filebuf *)data;
+	return git_filebuf_write(f, buf, size);
+}
+
+int git_commit_graph_writer_commit(git_commit_graph_writer *w)
+{
+	int error;
+	int filebuf_flags = GIT_FILEBUF_DO_NOT_BUFFER;
+	git_buf commit_graph_path = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+
+	assert(w);
+
+	error = git_buf_joinpath(&commit_graph_path,
+		git_buf_cstr(&w->objects_info_dir), GIT_COMMIT_GRAPH_FILE);
+	if (error < 0)
+		return error;
+
+	if (git_repository__fsync_gitdir)
+		filebuf_flags |= GIT_FILEBUF_FSYNC;
+
+	/* objects/info is optional in a repository */
+	if ((error = git_futils_mkdir(git_buf_cstr(&w->objects_info_dir),
+			GIT_OBJECT_DIR_MODE, GIT_MKDIR_PATH)) < 0) {
+		git_buf_dispose(&commit_graph_path);
+		return error;
+	}
+
+	error = git_filebuf_open(&output, git_buf_cstr(&commit_graph_path),
+		filebuf_flags, GIT_COMMIT_GRAPH_FILE_MODE);
+	git_buf_dispose(&commit_graph_path);
+	if (error < 0)
+		return error;
+
+	error = commit_graph_write(w, commit_graph_write_filebuf, &output);
+	if (error < 0) {
+		git_filebuf_cleanup(&output);
+		return error;
+	}
+
+	return git_filebuf_commit(&output);
+}
+
+int git_commit_graph_writer_dump(
+		git_buf *cgraph,
+		git_commit_graph_writer *w)
+{
+	assert(cgraph && w);
+
+	return commit_graph_write(w, commit_graph_write_buf, cgraph);
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_commit_graph_h__
+#define INCLUDE_commit_graph_h__
+
+#include "common.h"
+
+#include "git2/types.h"
+#include "git2/sys/commit_graph.h"
+
+#include "fileops.h"
+#include "map.h"
+#include "vector.h"
+
+#define GIT_COMMIT_GRAPH_FILE "commit-graph"
+#define GIT_COMMIT_GRAPH_CHAIN_DIR "commit-graphs"
+#define GIT_COMMIT_GRAPH_CHAIN_FILE "commit-graph-chain"
+#define GIT_COMMIT_GRAPH_FILE_MODE 0444
+
+#define GIT_COMMIT_GRAPH_MISSING_PARENT 0x70000000
+
+/* Generation numbers are stored in 30 bits; 0 means "not computed". */
+#define GIT_COMMIT_GRAPH_GENERATION_NUMBER_ZERO 0
+#define GIT_COMMIT_GRAPH_GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+
+/**
+ * A commit-graph file, or one layer of a split commit-graph chain.
+ *
+ * This file contains metadata about commits, particularly the generation
+ * number for each one. This can help speed up graph operations without
+ * requiring a full graph traversal.
+ *
+ * Support for the commit-graph file was added in git 2.18.
+ */
+typedef struct git_commit_graph_file {
+	git_refcount rc;
+
+	git_map graph_map;
+
+	/* The OID Fanout table. */
+	const uint32_t *oid_fanout;
+	/* The total number of commits in this layer of the graph. */
+	uint32_t num_commits;
+
+	/* The OID Lookup table. */
+	git_oid *oid_lookup;
+
+	/*
+	 * The Commit Data table. Each entry contains the OID of the commit
+	 * followed by two 8-byte fields in network byte order:
+	 * - The indices of the first two parents (32 bits each).
+	 * - The generation number (first 30 bits) and commit time in seconds
+	 *   since UNIX epoch (34 bits).
+	 */
+	const unsigned char *commit_data;
+
+	/*
+	 * The Extra Edge List table. Each 4-byte entry is a network byte order
+	 * index of one of the commit's parents (after the first two), with the
+	 * last parent of a commit marked by the most-significant bit.
+	 */
+	const uint32_t *extra_edge_list;
+	size_t num_extra_edge_list;
+
+	/* The trailer of the file. Contains the SHA1-checksum of the whole file. */
+	git_oid checksum;
+
+	/*
+	 * When this file is a layer of a commit-graph chain, `base` points to
+	 * the layer below it and `num_base_commits` is the number of commits
+	 * contained in all of the layers below. Parent positions are global
+	 * across the whole chain.
+	 */
+	struct git_commit_graph_file *base;
+	uint32_t num_base_commits;
+} git_commit_graph_file;
+
+/**
+ * An entry in the commit-graph file. Provides a subset of the information that
+ * can be obtained from the commit header.
+ */
+typedef struct git_commit_graph_entry {
+	/* The generation number of the commit within the graph */
+	size_t generation;
+
+	/* Time in seconds from UNIX epoch. */
+	git_time_t commit_time;
+
+	/* The number of parents of the commit. */
+	size_t parent_count;
+
+	/*
+	 * The indices of the parent commits within the Commit Data table. The value
+	 * of `GIT_COMMIT_GRAPH_MISSING_PARENT` indicates that no parent is in that
+	 * position.
+	 */
+	size_t parent_indices[2];
+
+	/* The index within the Extra Edge List of any parent after the first two. */
+	size_t extra_parents_index;
+
+	/* The SHA-1 hash of the root tree of the commit. */
+	git_oid tree_oid;
+
+	/* The SHA-1 hash of the requested commit. */
+	git_oid sha1;
+} git_commit_graph_entry;
+
+/* A wrapper for git_commit_graph_file to enable lazy loading in the ODB. */
+typedef struct git_commit_graph {
+	/* The path to the objects/info directory. */
+	git_buf objects_info_dir;
+
+	/*
+	 * The underlying commit-graph file, or the top layer of a chain. The
+	 * graph holds a reference to it; a refresh drops that reference, and
+	 * the file is freed once its last user has released it.
+	 */
+	git_commit_graph_file *file;
+
+	git_futils_filestamp graph_stamp;
+	git_futils_filestamp chain_stamp;
+
+	/* Whether the commit-graph file was already checked for validity. */
+	bool checked;
+} git_commit_graph;
+
+/** Create a new commit-graph, optionally opening the underlying file. */
+int git_commit_graph_new(
+	git_commit_graph **cgraph_out,
+	const char *objects_dir,
+	bool open_file);
+
+/**
+ * Get a reference to the underlying commit-graph file, loading it on
+ * first use; release it with `git_commit_graph_file_release`. Returns
+ * GIT_ENOTFOUND when the repository has no commit-graph.
+ */
+int git_commit_graph_get_file(
+	git_commit_graph_file **file_out,
+	git_commit_graph *cgraph);
+
+/** Re-check the files on disk and pick up a newly written commit-graph. */
+void git_commit_graph_refresh(git_commit_graph *cgraph);
+
+void git_commit_graph_free(git_commit_graph *cgraph);
+
+/* Open and validate a commit-graph file. */
+int git_commit_graph_file_open(
+	git_commit_graph_file **file_out,
+	const char *path);
+
+/* Open and validate every layer of a split commit-graph chain. */
+int git_commit_graph_chain_open(
+	git_commit_graph_file **file_out,
+	const char *chain_dir);
+
+/*
+ * Look up the entry of a commit in the commit-graph file (and any layers
+ * below it). Returns GIT_ENOTFOUND when the commit is not in the graph.
+ */
+int git_commit_graph_entry_find(
+	git_commit_graph_entry *e,
+	const git_commit_graph_file *file,
+	const git_oid *oid);
+
+/* Get the entry of the nth parent of a commit-graph entry. */
+int git_commit_graph_entry_parent(
+	git_commit_graph_entry *parent,
+	const git_commit_graph_file *file,
+	const git_commit_graph_entry *entry,
+	size_t n);
+
+/* Free the commit-graph file and every layer below it. */
+void git_commit_graph_file_free(git_commit_graph_file *cgraph);
+
+/* Release a reference from `git_commit_graph_get_file`. */
+void git_commit_graph_file_release(git_commit_graph_file *file);
+
+/*
+ * Validate the in-memory contents of a commit-graph file and set up the
+ * table pointers of `file` to point into `data`.
+ */
+int git_commit_graph_file_parse(
+	git_commit_graph_file *file,
+	const unsigned char *data,
+	size_t size);
+
+#endif
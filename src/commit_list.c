@@ -24,6 +24,19 @@ int git_commit_list_time_cmp(const void *a, const void *b)
 	return 0;
 }
 
+int git_commit_list_generation_cmp(const void *a, const void *b)
+{
+	uint32_t generation_a = ((git_commit_list_node *) a)->generation;
+	uint32_t generation_b = ((git_commit_list_node *) b)->generation;
+
+	if (generation_a < generation_b)
+		return 1;
+	if (generation_a > generation_b)
+		return -1;
+
+	return git_commit_list_time_cmp(a, b);
+}
+
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p)
 {
 	git_commit_list *new_list = git__malloc(sizeof(git_commit_list));
@@ -177,18 +190,71 @@ static int commit_quick_parse(
 		return commit_error(commit, "cannot parse commit time");
 
 	commit->time = commit_time;
+	commit->generation = GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY;
 	commit->parsed = 1;
 	return 0;
 }
 
+static int commit_graph_parse(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_graph_file *cgraph_file,
+	git_commit_graph_entry *e)
+{
+	git_commit_graph_entry parent;
+	size_t i;
+
+	commit->parents = alloc_parents(walk, commit, e->parent_count);
+	GIT_ERROR_CHECK_ALLOC(commit->parents);
+
+	for (i = 0; i < e->parent_count; ++i) {
+		if (git_commit_graph_entry_parent(&parent, cgraph_file, e, i) < 0)
+			return commit_error(commit, "commit-graph is corrupted");
+
+		commit->parents[i] = git_revwalk__commit_lookup(walk, &parent.sha1);
+		if (commit->parents[i] == NULL)
+			return -1;
+	}
+
+	commit->out_degree = (unsigned short)e->parent_count;
+	commit->time = e->commit_time;
+	commit->parsed = 1;
+
+	/* Graphs written by very old versions of git lack generation numbers */
+	if (e->generation == GIT_COMMIT_GRAPH_GENERATION_NUMBER_ZERO)
+		commit->generation = GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY;
+	else
+		commit->generation = (uint32_t)e->generation;
+
+	return 0;
+}
+
 int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 {
 	git_odb_object *obj;
+	git_commit_graph_entry e;
 	int error;
 
 	if (commit->parsed)
 		return 0;
 
+	if (!walk->cgraph_checked) {
+		walk->cgraph_checked = 1;
+
+		if (git_odb__get_commit_graph_file(&walk->cgraph_file, walk->odb) < 0) {
+			walk->cgraph_file = NULL;
+			git_error_clear();
+		}
+	}
+
+	/* Avoid reading and parsing the commit when it is in the commit-graph. */
+	if (walk->cgraph_file &&
+	    git_commit_graph_entry_find(&e, walk->cgraph_file, &commit->oid) == 0 &&
+	    git__is_uint16(e.parent_count))
+		return commit_graph_parse(walk, commit, walk->cgraph_file, &e);
+
+	git_error_clear();
+
 	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
 
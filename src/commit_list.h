@@ -11,6 +11,8 @@
 
 #include "git2/oid.h"
 
+#include "commit_graph.h"
+
 #define PARENT1  (1 << 0)
 #define PARENT2  (1 << 1)
 #define RESULT   (1 << 2)
@@ -23,9 +25,17 @@
 
 #define FLAG_BITS 4
 
+/*
+ * The generation number of a parsed commit is its topological level as
+ * read from the commit-graph. Commits that are not in the commit-graph
+ * have a generation of GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY: since
+ * the commit-graph contains the whole history of every commit in it, they
+ * cannot be the ancestor of any commit that is.
+ */
 typedef struct git_commit_list_node {
 	git_oid oid;
 	int64_t time;
+	uint32_t generation;
 	unsigned int seen:1,
 			 uninteresting:1,
 			 topo_delay:1,
@@ -46,6 +56,7 @@ typedef struct git_commit_list {
 
 git_commit_list_node *git_commit_list_alloc_node(git_revwalk *walk);
 int git_commit_list_time_cmp(const void *a, const void *b);
+int git_commit_list_generation_cmp(const void *a, const void *b);
 void git_commit_list_free(git_commit_list **list_p);
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p);
 git_commit_list *git_commit_list_insert_by_date(git_commit_list_node *item, git_commit_list **list_p);
@@ -71,6 +71,28 @@ static git_cvar_map _cvar_map_int[] = {
 	{GIT_CVAR_INT32, NULL, 0},
 };
 
+/*
+ *	index.threads
+ *		Whether to use threads to read the index, and how many; `true`
+ *	uses one per CPU.
+ */
+static git_cvar_map _cvar_map_index_threads[] = {
+	{GIT_CVAR_FALSE, NULL, 1},
+	{GIT_CVAR_TRUE, NULL, GIT_INDEXTHREADS_AUTO},
+	{GIT_CVAR_INT32, NULL, 0},
+};
+
+/*
+ *	core.untrackedCache
+ *		Whether to record the untracked files of every directory in the
+ *	index; `keep` uses the cache only if the index already has one.
+ */
+static git_cvar_map _cvar_map_untracked_cache[] = {
+	{GIT_CVAR_FALSE, NULL, GIT_UNTRACKEDCACHE_FALSE},
+	{GIT_CVAR_TRUE, NULL, GIT_UNTRACKEDCACHE_TRUE},
+	{GIT_CVAR_STRING, "keep", GIT_UNTRACKEDCACHE_KEEP},
+};
+
 static struct map_data _cvar_maps[] = {
 	{"core.autocrlf", _cvar_map_autocrlf, ARRAY_SIZE(_cvar_map_autocrlf), GIT_AUTO_CRLF_DEFAULT},
 	{"core.eol", _cvar_map_eol, ARRAY_SIZE(_cvar_map_eol), GIT_EOL_DEFAULT},
@@ -86,6 +108,10 @@ static struct map_data _cvar_maps[] = {
 	{"core.protecthfs", NULL, 0, GIT_PROTECTHFS_DEFAULT },
 	{"core.protectntfs", NULL, 0, GIT_PROTECTNTFS_DEFAULT },
 	{"core.fsyncobjectfiles", NULL, 0, GIT_FSYNCOBJECTFILES_DEFAULT },
+	{"index.threads", _cvar_map_index_threads, ARRAY_SIZE(_cvar_map_index_threads), GIT_INDEXTHREADS_DEFAULT },
+	{"index.recordendofindexentries", NULL, 0, GIT_INDEXRECORD_DEFAULT },
+	{"index.recordoffsettable", NULL, 0, GIT_INDEXRECORD_DEFAULT },
+	{"core.untrackedcache", _cvar_map_untracked_cache, ARRAY_SIZE(_cvar_map_untracked_cache), GIT_UNTRACKEDCACHE_DEFAULT },
 };
 
 int git_config__cvar(int *out, git_config *config, git_cvar_cached cvar)
@@ -499,6 +499,171 @@ int git_delta_read_header(
 	return 0;
 }
 
+/*
+ * Append an instruction, extending the last one instead when it copies
+ * the bytes that come right before.
+ */
+static int delta_ops_push(
+	git_delta_ops *ops,
+	const unsigned char *literal,
+	size_t offset,
+	size_t len)
+{
+	git_delta_op *last = git_array_last(*ops);
+	size_t out = 0;
+
+	if (last) {
+		if (literal && last->literal && last->literal + last->len == literal) {
+			last->len += len;
+			return 0;
+		}
+
+		if (!literal && !last->literal && last->offset + last->len == offset) {
+			last->len += len;
+			return 0;
+		}
+
+		out = last->out + last->len;
+	}
+
+	last = git_array_alloc(*ops);
+	GIT_ERROR_CHECK_ALLOC(last);
+
+	last->literal = literal;
+	last->offset = offset;
+	last->len = len;
+	last->out = out;
+	return 0;
+}
+
+int git_delta_ops_parse(
+	git_delta_ops *out,
+	size_t *base_len,
+	size_t *result_len,
+	const unsigned char *delta,
+	size_t delta_len)
+{
+	const unsigned char *delta_end = delta + delta_len;
+	size_t base_sz, res_sz, remain;
+
+	if (hdr_sz(&base_sz, &delta, delta_end) < 0 ||
+	    hdr_sz(&res_sz, &delta, delta_end) < 0)
+		goto fail;
+
+	remain = res_sz;
+
+	while (delta < delta_end) {
+		unsigned char cmd = *delta++;
+		size_t off = 0, len = 0, end;
+
+		if (cmd & 0x80) {
+#define ADD_DELTA(o, shift) { if (delta < delta_end) (o) |= ((unsigned) *delta++ << shift); else goto fail; }
+			if (cmd & 0x01) ADD_DELTA(off, 0UL);
+			if (cmd & 0x02) ADD_DELTA(off, 8UL);
+			if (cmd & 0x04) ADD_DELTA(off, 16UL);
+			if (cmd & 0x08) ADD_DELTA(off, 24UL);
+
+			if (cmd & 0x10) ADD_DELTA(len, 0UL);
+			if (cmd & 0x20) ADD_DELTA(len, 8UL);
+			if (cmd & 0x40) ADD_DELTA(len, 16UL);
+			if (!len)       len = 0x10000;
+#undef ADD_DELTA
+
+			if (GIT_ADD_SIZET_OVERFLOW(&end, off, len) ||
+			    base_sz < end || remain < len)
+				goto fail;
+
+			if (delta_ops_push(out, NULL, off, len) < 0)
+				return -1;
+		} else if (cmd) {
+			if (delta_end - delta < cmd || remain < cmd)
+				goto fail;
+
+			if (delta_ops_push(out, delta, 0, cmd) < 0)
+				return -1;
+
+			delta += cmd;
+			len = cmd;
+		} else {
+			/* cmd == 0 is reserved for future encodings. */
+			goto fail;
+		}
+
+		remain -= len;
+	}
+
+	if (remain)
+		goto fail;
+
+	*base_len = base_sz;
+	*result_len = res_sz;
+	return 0;
+
+fail:
+	git_error_set(GIT_ERROR_INVALID, "failed to parse delta");
+	return -1;
+}
+
+/* Find the instruction that produces the byte at `out` of the result */
+static size_t delta_ops_find(const git_delta_ops *ops, size_t out)
+{
+	size_t lo = 0, hi = git_array_size(*ops);
+
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (git_array_get(*ops, mid)->out <= out)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+int git_delta_ops_compose(
+	git_delta_ops *out,
+	const git_delta_ops *ops,
+	const git_delta_ops *base_ops)
+{
+	const git_delta_op *op, *base_op;
+	size_t i, j, off, len, skip, chunk;
+
+	git_array_foreach(*ops, i, op) {
+		if (op->literal) {
+			if (delta_ops_push(out, op->literal, 0, op->len) < 0)
+				return -1;
+			continue;
+		}
+
+		off = op->offset;
+		len = op->len;
+
+		/* the copy spans as many instructions of the base as it needs */
+		for (j = delta_ops_find(base_ops, off); len; j++) {
+			if ((base_op = git_array_get(*base_ops, j)) == NULL ||
+			    base_op->out > off || off - base_op->out >= base_op->len) {
+				git_error_set(GIT_ERROR_INVALID, "failed to compose deltas: copy out of the base");
+				return -1;
+			}
+
+			skip = off - base_op->out;
+			chunk = min(base_op->len - skip, len);
+
+			if (delta_ops_push(out,
+					base_op->literal ? base_op->literal + skip : NULL,
+					base_op->literal ? 0 : base_op->offset + skip,
+					chunk) < 0)
+				return -1;
+
+			off += chunk;
+			len -= chunk;
+		}
+	}
+
+	return 0;
+}
+
 #define DELTA_HEADER_BUFFER_LEN 16
 int git_delta_read_header_fromstream(
 	size_t *base_sz, size_t *res_sz, git_packfile_stream *stream)
@@ -531,20 +696,17 @@ int git_delta_read_header_fromstream(
 	return 0;
 }
 
-int git_delta_apply(
-	void **out,
-	size_t *out_len,
+int git_delta_apply_to(
+	unsigned char *out,
+	size_t out_len,
 	const unsigned char *base,
 	size_t base_len,
 	const unsigned char *delta,
 	size_t delta_len)
 {
 	const unsigned char *delta_end = delta + delta_len;
-	size_t base_sz, res_sz, alloc_sz;
-	unsigned char *res_dp;
-
-	*out = NULL;
-	*out_len = 0;
+	unsigned char *res_dp = out;
+	size_t base_sz, res_sz;
 
 	/*
 	 * Check that the base size matches the data we were given;
@@ -556,19 +718,11 @@ int git_delta_apply(
 		return -1;
 	}
 
-	if (hdr_sz(&res_sz, &delta, delta_end) < 0) {
-		git_error_set(GIT_ERROR_INVALID, "failed to apply delta: base size does not match given data");
+	if (hdr_sz(&res_sz, &delta, delta_end) < 0 || res_sz != out_len) {
+		git_error_set(GIT_ERROR_INVALID, "failed to apply delta: result size does not match given buffer");
 		return -1;
 	}
 
-	GIT_ERROR_CHECK_ALLOC_ADD(&alloc_sz, res_sz, 1);
-	res_dp = git__malloc(alloc_sz);
-	GIT_ERROR_CHECK_ALLOC(res_dp);
-
-	res_dp[res_sz] = '\0';
-	*out = res_dp;
-	*out_len = res_sz;
-
 	while (delta < delta_end) {
 		unsigned char cmd = *delta++;
 		if (cmd & 0x80) {
@@ -615,14 +769,44 @@ int git_delta_apply(
 
 	if (delta != delta_end || res_sz)
 		goto fail;
+
+	out[out_len] = '\0';
 	return 0;
 
 fail:
-	git__free(*out);
+	git_error_set(GIT_ERROR_INVALID, "failed to apply delta");
+	return -1;
+}
+
+int git_delta_apply(
+	void **out,
+	size_t *out_len,
+	const unsigned char *base,
+	size_t base_len,
+	const unsigned char *delta,
+	size_t delta_len)
+{
+	size_t base_sz, res_sz, alloc_sz;
+	unsigned char *res_dp;
 
 	*out = NULL;
 	*out_len = 0;
 
-	git_error_set(GIT_ERROR_INVALID, "failed to apply delta");
-	return -1;
+	if (git_delta_read_header(&base_sz, &res_sz, delta, delta_len) < 0) {
+		git_error_set(GIT_ERROR_INVALID, "failed to apply delta: invalid delta header");
+		return -1;
+	}
+
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloc_sz, res_sz, 1);
+	res_dp = git__malloc(alloc_sz);
+	GIT_ERROR_CHECK_ALLOC(res_dp);
+
+	if (git_delta_apply_to(res_dp, res_sz, base, base_len, delta, delta_len) < 0) {
+		git__free(res_dp);
+		return -1;
+	}
+
+	*out = res_dp;
+	*out_len = res_sz;
+	return 0;
 }
@@ -7,6 +7,7 @@
 
 #include "common.h"
 
+#include "array.h"
 #include "pack.h"
 
 typedef struct git_delta_index git_delta_index;
@@ -107,6 +108,77 @@ extern int git_delta_apply(
 	const unsigned char *delta,
 	size_t delta_len);
 
+/**
+* Apply a git binary delta into a buffer that the caller provides.
+*
+* The size of the result must already be known, eg. from
+* `git_delta_read_header`; the buffer must have room for one more
+* byte, as the result is NUL-terminated like with `git_delta_apply`.
+*
+* @param out the buffer to write the result into
+* @param out_len the size of the result, as given by the delta header
+* @param base the base to copy from during copy instructions.
+* @param base_len number of bytes available at base.
+* @param delta the delta to execute copy/insert instructions from.
+* @param delta_len total number of bytes in the delta.
+* @return 0 on success or an error code
+*/
+extern int git_delta_apply_to(
+	unsigned char *out,
+	size_t out_len,
+	const unsigned char *base,
+	size_t base_len,
+	const unsigned char *delta,
+	size_t delta_len);
+
+/*
+ * One instruction of a delta: `len` bytes of the result, at `out`, that
+ * are either copied from the base at `offset`, or taken from `literal`.
+ */
+typedef struct {
+	const unsigned char *literal; /* NULL when copying from the base */
+	size_t offset;
+	size_t len;
+	size_t out;
+} git_delta_op;
+
+typedef git_array_t(git_delta_op) git_delta_ops;
+
+/**
+* Parse the instructions of a git binary delta, without applying them.
+* The literals of the instructions point into `delta`, which must stay
+* around for as long as they are used.
+*
+* @param out the array to append the instructions to
+* @param base_len pointer to store the size of the base.
+* @param result_len pointer to store the size of the result.
+* @param delta the delta to parse.
+* @param delta_len total number of bytes in the delta.
+* @return 0 on success or an error code
+*/
+extern int git_delta_ops_parse(
+	git_delta_ops *out,
+	size_t *base_len,
+	size_t *result_len,
+	const unsigned char *delta,
+	size_t delta_len);
+
+/**
+* Compose the instructions of two consecutive deltas of a chain: `ops`
+* produce an object out of the result of `base_ops`, and the composed
+* instructions produce that same object out of the base of `base_ops`,
+* without the result in between ever being built.
+*
+* @param out the array to append the composed instructions to
+* @param ops the instructions of the later delta
+* @param base_ops the instructions of the delta that produces its base
+* @return 0 on success or an error code
+*/
+extern int git_delta_ops_compose(
+	git_delta_ops *out,
+	const git_delta_ops *ops,
+	const git_delta_ops *base_ops);
+
 /**
 * Read the header of a git binary delta.
 *
@@ -10,6 +10,7 @@
 #include "git2/version.h"
 #include "diff_generate.h"
 #include "patch.h"
+#include "patch_generate.h"
 #include "commit.h"
 #include "index.h"
 
@@ -134,6 +135,12 @@ int git_diff_foreach(
 
 	assert(diff);
 
+#ifdef GIT_THREADS
+	if (diff->type == GIT_DIFF_TYPE_GENERATED && diff->opts.threads > 1)
+		return git_patch_generated_foreach_threaded(
+			diff, file_cb, binary_cb, hunk_cb, data_cb, payload);
+#endif
+
 	git_vector_foreach(&diff->deltas, idx, delta) {
 		git_patch *patch;
 
@@ -15,6 +15,7 @@
 #include "filter.h"
 #include "pathspec.h"
 #include "index.h"
+#include "fsmonitor.h"
 #include "odb.h"
 #include "submodule.h"
 
@@ -743,7 +744,9 @@ static int maybe_modified(
 	unsigned int omode = oitem->mode;
 	unsigned int nmode = nitem->mode;
 	bool new_is_workdir = (info->new_iter->type == GIT_ITERATOR_TYPE_WORKDIR);
-	bool modified_uncertain = false;
+	bool use_fsmonitor = new_is_workdir &&
+		(info->new_iter->flags & GIT_ITERATOR_FSMONITOR) != 0;
+	bool modified_uncertain = false, examined = false;
 	const char *matched_pathspec;
 	int error = 0;
 
@@ -776,6 +779,11 @@ static int maybe_modified(
 	} else if ((oitem->flags_extended & GIT_INDEX_ENTRY_SKIP_WORKTREE) != 0) {
 		status = GIT_DELTA_UNMODIFIED;
 
+	/* the filesystem monitor saw no change since it was found unmodified */
+	} else if (use_fsmonitor &&
+		(oitem->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID) != 0) {
+		status = GIT_DELTA_UNMODIFIED;
+
 	/* if basic type of file changed, then split into delete and add */
 	} else if (GIT_MODE_TYPE(omode) != GIT_MODE_TYPE(nmode)) {
 		if (DIFF_FLAG_IS_SET(diff, GIT_DIFF_INCLUDE_TYPECHANGE)) {
@@ -799,6 +807,7 @@ static int maybe_modified(
 			 omode == nmode &&
 			 !git_oid_iszero(&oitem->id)) {
 		status = GIT_DELTA_UNMODIFIED;
+		examined = new_is_workdir;
 
 	/* if we have an unknown OID and a workdir iterator, then check some
 	 * circumstances that can accelerate things or need special handling
@@ -809,6 +818,7 @@ static int maybe_modified(
 		git_index *index = git_iterator_index(info->new_iter);
 
 		status = GIT_DELTA_UNMODIFIED;
+		examined = !S_ISGITLINK(nmode);
 
 		if (S_ISGITLINK(nmode)) {
 			if ((error = maybe_modified_submodule(&status, &noid, diff, info)) < 0)
@@ -875,6 +885,11 @@ static int maybe_modified(
 		return error;
 	}
 
+	/* the monitor can vouch for the file until it reports a change */
+	if (use_fsmonitor && examined && status == GIT_DELTA_UNMODIFIED)
+		git_index__fsmonitor_mark_valid(
+			git_iterator_index(info->new_iter), (git_index_entry *)oitem);
+
 	return diff_delta__from_two(
 		diff, status, oitem, omode, nitem, nmode,
 		git_oid_iszero(&noid) ? NULL : &noid, matched_pathspec);
@@ -982,6 +997,11 @@ static int handle_unmatched_new_item(
 	git_delta_t delta_type = GIT_DELTA_UNTRACKED;
 	bool contains_oitem;
 
+	/* the contents of a tree from a tree or the index are all new */
+	if (nitem->mode == GIT_FILEMODE_TREE &&
+	    info->new_iter->type != GIT_ITERATOR_TYPE_WORKDIR)
+		return iterator_advance_into(&info->nitem, info->new_iter);
+
 	/* check if this is a prefix of the other side */
 	contains_oitem = entry_is_prefixed(diff, info->oitem, nitem);
 
@@ -1137,6 +1157,10 @@ static int handle_unmatched_old_item(
 	git_delta_t delta_type = GIT_DELTA_DELETED;
 	int error;
 
+	/* the contents of a tree are all gone */
+	if (info->oitem->mode == GIT_FILEMODE_TREE)
+		return iterator_advance_into(&info->oitem, info->old_iter);
+
 	/* update delta_type if this item is conflicted */
 	if (git_index_entry_is_conflict(info->oitem))
 		delta_type = GIT_DELTA_CONFLICTED;
@@ -1162,6 +1186,7 @@ static int handle_unmatched_old_item(
 		 * Unless RECURSE_UNTRACKED_DIRS is set, skip over them...
 		 */
 		if (S_ISDIR(info->nitem->mode) &&
+			info->new_iter->type == GIT_ITERATOR_TYPE_WORKDIR &&
 			DIFF_FLAG_ISNT_SET(diff, GIT_DIFF_RECURSE_UNTRACKED_DIRS))
 			return iterator_advance(&info->nitem, info->new_iter);
 	}
@@ -1169,6 +1194,30 @@ static int handle_unmatched_old_item(
 	return iterator_advance(&info->oitem, info->old_iter);
 }
 
+/*
+ * A tree that is on both sides is skipped without being read when it is
+ * the same on both, unless the unmodified files are to be listed.
+ */
+static int handle_matched_tree(
+	git_diff_generated *diff, diff_in_progress *info)
+{
+	int error;
+
+	if (!git_oid_iszero(&info->oitem->id) &&
+	    git_oid_equal(&info->oitem->id, &info->nitem->id) &&
+	    DIFF_FLAG_ISNT_SET(diff, GIT_DIFF_INCLUDE_UNMODIFIED)) {
+		if (!(error = iterator_advance(&info->oitem, info->old_iter)))
+			error = iterator_advance(&info->nitem, info->new_iter);
+
+		return error;
+	}
+
+	if (!(error = iterator_advance_into(&info->oitem, info->old_iter)))
+		error = iterator_advance_into(&info->nitem, info->new_iter);
+
+	return error;
+}
+
 static int handle_matched_item(
 	git_diff_generated *diff, diff_in_progress *info)
 {
@@ -1243,6 +1292,11 @@ int git_diff__from_iterators(
 		else if (cmp > 0)
 			error = handle_unmatched_new_item(diff, &info);
 
+		/* trees on both sides are only looked into when they differ */
+		else if (info.oitem->mode == GIT_FILEMODE_TREE &&
+			info.nitem->mode == GIT_FILEMODE_TREE)
+			error = handle_matched_tree(diff, &info);
+
 		/* otherwise item paths match, so create MODIFIED record
 		 * (or ADDED and DELETED pair if type changed)
 		 */
@@ -1262,6 +1316,13 @@ cleanup:
 	return error;
 }
 
+/*
+ * Tree and index iterators can hand out trees, with the ids of the trees
+ * for the index when its tree cache has them, without going into them.
+ */
+#define DIFF_SKIP_SUBTREES \
+	(GIT_ITERATOR_INCLUDE_TREES | GIT_ITERATOR_DONT_AUTOEXPAND)
+
 #define DIFF_FROM_ITERATORS(MAKE_FIRST, FLAGS_FIRST, MAKE_SECOND, FLAGS_SECOND) do { \
 	git_iterator *a = NULL, *b = NULL; \
 	char *pfx = (opts && !(opts->flags & GIT_DIFF_DISABLE_PATHSPEC_MATCH)) ? \
@@ -1308,6 +1369,14 @@ int git_diff_tree_to_tree(
 	if (opts && (opts->flags & GIT_DIFF_IGNORE_CASE) != 0)
 		iflag = GIT_ITERATOR_IGNORE_CASE;
 
+	/*
+	 * Hand out the trees, to skip the ones that are the same on both
+	 * sides.  Not when ignoring case, where the contents of directories
+	 * whose names only differ in case are merged.
+	 */
+	else
+		iflag |= DIFF_SKIP_SUBTREES;
+
 	DIFF_FROM_ITERATORS(
 		git_iterator_for_tree(&a, old_tree, &a_opts), iflag,
 		git_iterator_for_tree(&b, new_tree, &b_opts), iflag
@@ -1347,6 +1416,9 @@ int git_diff_tree_to_index(
 
 	*out = NULL;
 
+	if (!opts || (opts->flags & GIT_DIFF_IGNORE_CASE) == 0)
+		iflag |= DIFF_SKIP_SUBTREES;
+
 	if (!index && (error = diff_load_index(&index, repo)) < 0)
 		return error;
 
@@ -1367,13 +1439,30 @@ int git_diff_tree_to_index(
 	return error;
 }
 
-int git_diff_index_to_workdir(
+/*
+ * The untracked cache leaves out the ignored files, and untracked
+ * directories without any untracked files that are not ignored.
+ */
+static unsigned int diff_workdir_untracked_cache_flag(const git_diff_options *opts)
+{
+	if (!opts ||
+	    !(opts->flags & (GIT_DIFF_INCLUDE_UNTRACKED | GIT_DIFF_SHOW_UNTRACKED_CONTENT)) ||
+	    (opts->flags & (GIT_DIFF_INCLUDE_IGNORED | GIT_DIFF_RECURSE_IGNORED_DIRS |
+		GIT_DIFF_ENABLE_FAST_UNTRACKED_DIRS)))
+		return 0;
+
+	return GIT_ITERATOR_UNTRACKED_CACHE;
+}
+
+int git_diff__index_to_workdir(
 	git_diff **out,
 	git_repository *repo,
 	git_index *index,
-	const git_diff_options *opts)
+	const git_diff_options *opts,
+	bool use_fsmonitor)
 {
 	git_diff *diff = NULL;
+	unsigned int fsmonitor_flag = 0;
 	int error = 0;
 
 	assert(out && repo);
@@ -1383,16 +1472,27 @@ int git_diff_index_to_workdir(
 	if (!index && (error = diff_load_index(&index, repo)) < 0)
 		return error;
 
+	if (use_fsmonitor) {
+		if ((error = git_fsmonitor_refresh(repo, index)) < 0)
+			return error;
+
+		if (git_index__fsmonitor_enabled(index))
+			fsmonitor_flag = GIT_ITERATOR_FSMONITOR;
+	}
+
 	DIFF_FROM_ITERATORS(
 		git_iterator_for_index(&a, repo, index, &a_opts),
 		GIT_ITERATOR_INCLUDE_CONFLICTS,
 
 		git_iterator_for_workdir(&b, repo, index, NULL, &b_opts),
-		GIT_ITERATOR_DONT_AUTOEXPAND
+		GIT_ITERATOR_DONT_AUTOEXPAND | fsmonitor_flag |
+		diff_workdir_untracked_cache_flag(opts)
 	);
 
 	if (!error && (diff->opts.flags & GIT_DIFF_UPDATE_INDEX) != 0 &&
-		((git_diff_generated *)diff)->index_updated)
+		(((git_diff_generated *)diff)->index_updated ||
+		 git_index__untracked_cache_changed(index) ||
+		 git_index__fsmonitor_changed(index)))
 		error = git_index_write(index);
 
 	if (!error)
@@ -1401,6 +1501,15 @@ int git_diff_index_to_workdir(
 	return error;
 }
 
+int git_diff_index_to_workdir(
+	git_diff **out,
+	git_repository *repo,
+	git_index *index,
+	const git_diff_options *opts)
+{
+	return git_diff__index_to_workdir(out, repo, index, opts, true);
+}
+
 int git_diff_tree_to_workdir(
 	git_diff **out,
 	git_repository *repo,
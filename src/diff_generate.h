@@ -83,6 +83,17 @@ extern git_diff_delta *git_diff__merge_like_cgit(
 extern git_diff_delta *git_diff__delta_dup(
 	const git_diff_delta *d, git_pool *pool);
 
+/*
+ * Like `git_diff_index_to_workdir`; `use_fsmonitor` says whether the
+ * repository's filesystem monitor may be asked what changed.
+ */
+extern int git_diff__index_to_workdir(
+	git_diff **out,
+	git_repository *repo,
+	git_index *index,
+	const git_diff_options *opts,
+	bool use_fsmonitor);
+
 extern int git_diff__oid_for_file(
 	git_oid *out,
 	git_diff *diff,
@@ -9,13 +9,13 @@
 
 #include "git2/config.h"
 #include "git2/blob.h"
-#include "git2/sys/hashsig.h"
-
 #include "diff.h"
 #include "diff_generate.h"
 #include "path.h"
 #include "fileops.h"
 #include "config.h"
+#include "hashsig.h"
+#include "sigcache.h"
 
 git_diff_delta *git_diff__delta_dup(
 	const git_diff_delta *d, git_pool *pool)
@@ -467,11 +467,59 @@ static int similarity_init(
 		info->file, &info->odb_obj, info->repo);
 }
 
+/*
+ * The signatures of blobs with the internal metric are kept in the
+ * signature cache of the repository, when it has one.
+ */
+static git_sigcache *similarity_sigcache(
+	git_repository *repo,
+	git_iterator_type_t src,
+	const git_diff_file *file,
+	const git_diff_find_options *opts)
+{
+	if (!repo || !repo->sigcache ||
+		src == GIT_ITERATOR_TYPE_WORKDIR ||
+		git_oid_iszero(&file->id) ||
+		!git_diff_find_similar__is_internal(opts->metric))
+		return NULL;
+
+	return repo->sigcache;
+}
+
+static int similarity_sig_from_cache(
+	git_diff *diff,
+	const git_diff_find_options *opts,
+	void **cache,
+	size_t file_idx)
+{
+	git_iterator_type_t src = (file_idx & 1) ? diff->new_src : diff->old_src;
+	git_diff_file *file = similarity_get_file(diff, file_idx);
+	git_sigcache *sigcache;
+	git_off_t size;
+	int error;
+
+	if ((sigcache = similarity_sigcache(diff->repo, src, file, opts)) == NULL)
+		return 0;
+
+	error = git_sigcache_get((git_hashsig **)&cache[file_idx], &size,
+		sigcache, &file->id,
+		(git_hashsig_option_t)(intptr_t)opts->metric->payload);
+
+	if (error == GIT_ENOTFOUND)
+		return 0;
+	else if (error < 0)
+		return error;
+
+	file->size = size;
+	return 0;
+}
+
 static int similarity_sig(
 	similarity_info *info,
 	const git_diff_find_options *opts,
 	void **cache)
 {
+	git_sigcache *sigcache;
 	int error = 0;
 	git_diff_file *file = info->file;
 
@@ -515,6 +563,13 @@ static int similarity_sig(
 			error = opts->metric->buffer_signature(
 				&cache[info->idx], info->file,
 				git_blob_rawcontent(info->blob), sz, opts->metric->payload);
+
+			if (!error && cache[info->idx] &&
+				(sigcache = similarity_sigcache(
+					info->repo, info->src, file, opts)) != NULL)
+				error = git_sigcache_put(sigcache, &file->id,
+					(git_hashsig_option_t)(intptr_t)opts->metric->payload,
+					file->size, cache[info->idx]);
 		}
 	}
 
@@ -534,6 +589,16 @@ static void similarity_unload(similarity_info *info)
 
 #define FLAG_SET(opts,flag_name) (((opts)->flags & flag_name) != 0)
 
+static void similarity_resolve_id(
+	git_diff *diff, git_diff_file *file, git_iterator_type_t src)
+{
+	if (git_oid_iszero(&file->id) &&
+		src == GIT_ITERATOR_TYPE_WORKDIR &&
+		!git_diff__oid_for_file(&file->id,
+			diff, file->path, file->mode, file->size))
+		file->flags |= GIT_DIFF_FLAG_VALID_ID;
+}
+
 /* - score < 0 means files cannot be compared
  * - score >= 100 means files are exact match
  * - score == 0 means files are completely different
@@ -560,17 +625,8 @@ static int similarity_measure(
 
 	/* if exact match is requested, force calculation of missing OIDs now */
 	if (exact_match) {
-		if (git_oid_iszero(&a_file->id) &&
-			diff->old_src == GIT_ITERATOR_TYPE_WORKDIR &&
-			!git_diff__oid_for_file(&a_file->id,
-				diff, a_file->path, a_file->mode, a_file->size))
-			a_file->flags |= GIT_DIFF_FLAG_VALID_ID;
-
-		if (git_oid_iszero(&b_file->id) &&
-			diff->new_src == GIT_ITERATOR_TYPE_WORKDIR &&
-			!git_diff__oid_for_file(&b_file->id,
-				diff, b_file->path, b_file->mode, b_file->size))
-			b_file->flags |= GIT_DIFF_FLAG_VALID_ID;
+		similarity_resolve_id(diff, a_file, diff->old_src);
+		similarity_resolve_id(diff, b_file, diff->new_src);
 	}
 
 	/* check OID match as a quick test */
@@ -588,6 +644,13 @@ static int similarity_measure(
 	memset(&a_info, 0, sizeof(a_info));
 	memset(&b_info, 0, sizeof(b_info));
 
+	/* use the signatures that the repository kept, along with the sizes */
+	if ((!cache[a_idx] &&
+		(error = similarity_sig_from_cache(diff, opts, cache, a_idx)) < 0) ||
+		(!cache[b_idx] &&
+		(error = similarity_sig_from_cache(diff, opts, cache, b_idx)) < 0))
+		return error;
+
 	/* set up similarity data (will try to update missing file sizes) */
 	if (!cache[a_idx] && (error = similarity_init(&a_info, diff, a_idx)) < 0)
 		return error;
@@ -796,13 +859,582 @@ typedef struct {
 	uint16_t similarity;
 } diff_find_match;
 
+static int similarity_sig_for_file(
+	git_diff *diff,
+	const git_diff_find_options *opts,
+	void **cache,
+	size_t file_idx)
+{
+	similarity_info info;
+	int error;
+
+	if ((error = similarity_sig_from_cache(diff, opts, cache, file_idx)) < 0 ||
+		cache[file_idx])
+		return error;
+
+	memset(&info, 0, sizeof(info));
+
+	if ((error = similarity_init(&info, diff, file_idx)) == 0)
+		error = similarity_sig(&info, opts, cache);
+
+	similarity_unload(&info);
+	return error;
+}
+
+#ifdef GIT_THREADS
+
+/*
+ * The signatures of the internal metric are computed from the blobs and
+ * the files on disk as they are, without filters, so several of them can
+ * be computed at once.
+ */
+typedef struct {
+	git_diff *diff;
+	const git_diff_find_options *opts;
+	void **cache;
+	const size_t *files;
+	size_t files_len;
+	size_t next;
+	git_mutex lock;
+	git_error_state error;
+} similarity_sig_pool;
+
+typedef struct {
+	similarity_sig_pool *pool;
+	git_thread thread;
+} similarity_sig_worker;
+
+static void *similarity_sig_worker_run(void *arg)
+{
+	similarity_sig_worker *worker = arg;
+	similarity_sig_pool *pool = worker->pool;
+	size_t file_idx;
+	int error;
+
+	git_mutex_lock(&pool->lock);
+
+	while (pool->next < pool->files_len && !pool->error.error_code) {
+		file_idx = pool->files[pool->next++];
+		git_mutex_unlock(&pool->lock);
+
+		error = similarity_sig_for_file(
+			pool->diff, pool->opts, pool->cache, file_idx);
+
+		git_mutex_lock(&pool->lock);
+
+		if (error < 0 && !pool->error.error_code)
+			git_error_state_capture(&pool->error, error);
+	}
+
+	git_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static int similarity_sigs_threaded(
+	git_diff *diff,
+	const git_diff_find_options *opts,
+	void **cache,
+	const size_t *files,
+	size_t files_len)
+{
+	similarity_sig_pool pool = {0};
+	similarity_sig_worker *workers;
+	size_t nr_workers = 0, i;
+	int error = 0;
+
+	pool.diff = diff;
+	pool.opts = opts;
+	pool.cache = cache;
+	pool.files = files;
+	pool.files_len = files_len;
+
+	if (git_mutex_init(&pool.lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize similarity threads");
+		return -1;
+	}
+
+	workers = git__calloc(opts->threads, sizeof(similarity_sig_worker));
+	GIT_ERROR_CHECK_ALLOC(workers);
+
+	for (; nr_workers < opts->threads && nr_workers < files_len; nr_workers++) {
+		workers[nr_workers].pool = &pool;
+
+		if ((error = git_thread_create(&workers[nr_workers].thread,
+				similarity_sig_worker_run, &workers[nr_workers])) < 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+
+			/* let the workers that did start stop at the next file */
+			git_mutex_lock(&pool.lock);
+			pool.next = files_len;
+			git_mutex_unlock(&pool.lock);
+			break;
+		}
+	}
+
+	for (i = 0; i < nr_workers; i++)
+		git_thread_join(&workers[i].thread, NULL);
+
+	if (!error && pool.error.error_code < 0)
+		error = git_error_state_restore(&pool.error);
+
+	git_error_state_free(&pool.error);
+	git_mutex_free(&pool.lock);
+	git__free(workers);
+
+	return error;
+}
+
+#endif
+
+/*
+ * Get everything that measuring the sources against the targets needs
+ * ahead of time: the ids of the files in the working directory for
+ * exact matches, or the signatures of the files otherwise.
+ */
+static int similarity_prepare(
+	git_diff *diff,
+	const git_diff_find_options *opts,
+	void **cache)
+{
+	git_array_t(size_t) files = GIT_ARRAY_INIT;
+	git_diff_delta *delta;
+	size_t i, *file_idx;
+	int error = 0;
+
+	git_vector_foreach(&diff->deltas, i, delta) {
+		if (FLAG_SET(opts, GIT_DIFF_FIND_EXACT_MATCH_ONLY)) {
+			if ((delta->flags & GIT_DIFF_FLAG__IS_RENAME_SOURCE) != 0)
+				similarity_resolve_id(diff, &delta->old_file, diff->old_src);
+			if ((delta->flags & GIT_DIFF_FLAG__IS_RENAME_TARGET) != 0)
+				similarity_resolve_id(diff, &delta->new_file, diff->new_src);
+			continue;
+		}
+
+		if ((delta->flags & GIT_DIFF_FLAG__IS_RENAME_SOURCE) != 0 &&
+			!cache[2 * i]) {
+			file_idx = git_array_alloc(files);
+			GIT_ERROR_CHECK_ALLOC(file_idx);
+			*file_idx = 2 * i;
+		}
+
+		if ((delta->flags & GIT_DIFF_FLAG__IS_RENAME_TARGET) != 0 &&
+			!cache[2 * i + 1]) {
+			file_idx = git_array_alloc(files);
+			GIT_ERROR_CHECK_ALLOC(file_idx);
+			*file_idx = 2 * i + 1;
+		}
+	}
+
+#ifdef GIT_THREADS
+	if (opts->threads > 1 && git_array_size(files) > 1) {
+		error = similarity_sigs_threaded(
+			diff, opts, cache, files.ptr, git_array_size(files));
+		goto done;
+	}
+#endif
+
+	git_array_foreach(files, i, file_idx) {
+		if ((error = similarity_sig_for_file(diff, opts, cache, *file_idx)) < 0)
+			break;
+	}
+
+#ifdef GIT_THREADS
+done:
+#endif
+	git_array_clear(files);
+	return error;
+}
+
+/*
+ * The internal metric only finds two files similar when their signatures
+ * have some hashes in common (or when neither has any), so rather than
+ * measuring every target against every source, the sources are indexed
+ * by those hashes and each target is only measured against the sources
+ * that it shares the most of them with.
+ */
+typedef struct {
+	uint32_t hash;
+	uint32_t src;
+} similarity_posting;
+
+typedef struct {
+	git_diff *diff;
+	git_array_t(size_t) srcs; /* the deltas that are rename sources */
+	git_array_t(similarity_posting) postings; /* their hashes, in order */
+	git_array_t(uint32_t) by_id; /* the sources, in the order of their ids */
+	git_array_t(uint32_t) blank; /* the sources whose signatures have no hashes */
+	uint32_t *counts; /* what each source has in common with a target */
+	git_array_t(uint32_t) touched; /* the sources with a count */
+	git_array_t(diff_find_match) candidates;
+	size_t *starts; /* where the candidates of each delta start */
+} similarity_index;
+
+/* An identical file goes ahead of any that only has hashes in common */
+#define SIMILARITY_ID_WEIGHT (GIT_HASHSIG_MAX_HASHES + 1)
+
+static int similarity_posting_cmp(const void *a, const void *b, void *payload)
+{
+	const similarity_posting *pa = a, *pb = b;
+
+	GIT_UNUSED(payload);
+
+	if (pa->hash != pb->hash)
+		return (pa->hash < pb->hash) ? -1 : 1;
+
+	return (pa->src < pb->src) ? -1 : (pa->src > pb->src);
+}
+
+GIT_INLINE(const git_oid *) similarity_index_src_id(
+	similarity_index *index, uint32_t src)
+{
+	git_diff_delta *delta = git_vector_get(
+		&index->diff->deltas, index->srcs.ptr[src]);
+	return &delta->old_file.id;
+}
+
+static int similarity_by_id_cmp(const void *a, const void *b, void *payload)
+{
+	uint32_t sa = *(const uint32_t *)a, sb = *(const uint32_t *)b;
+	int cmp = git_oid__cmp(similarity_index_src_id(payload, sa),
+		similarity_index_src_id(payload, sb));
+
+	return cmp ? cmp : (sa < sb) ? -1 : (sa > sb);
+}
+
+static int similarity_src_cmp(const void *a, const void *b, void *payload)
+{
+	uint32_t sa = *(const uint32_t *)a, sb = *(const uint32_t *)b;
+
+	GIT_UNUSED(payload);
+	return (sa < sb) ? -1 : (sa > sb);
+}
+
+/* the sources with the most in common first, then in the order of the deltas */
+static int similarity_count_cmp(const void *a, const void *b, void *payload)
+{
+	uint32_t sa = *(const uint32_t *)a, sb = *(const uint32_t *)b;
+	const uint32_t *counts = payload;
+
+	if (counts[sa] != counts[sb])
+		return (counts[sa] > counts[sb]) ? -1 : 1;
+
+	return (sa < sb) ? -1 : (sa > sb);
+}
+
+static void similarity_index_free(similarity_index *index)
+{
+	git_array_clear(index->srcs);
+	git_array_clear(index->postings);
+	git_array_clear(index->by_id);
+	git_array_clear(index->blank);
+	git_array_clear(index->touched);
+	git_array_clear(index->candidates);
+	git__free(index->counts);
+	git__free(index->starts);
+}
+
+static int similarity_index_init(
+	similarity_index *index,
+	git_diff *diff,
+	const git_diff_find_options *opts,
+	void **cache)
+{
+	uint32_t hashes[GIT_HASHSIG_MAX_HASHES], src, *pos;
+	bool use_hashes = git_diff_find_similar__is_internal(opts->metric);
+	similarity_posting *posting;
+	git_diff_delta *delta;
+	size_t s, i, len, *src_idx;
+
+	memset(index, 0, sizeof(*index));
+	index->diff = diff;
+
+	git_vector_foreach(&diff->deltas, s, delta) {
+		if ((delta->flags & GIT_DIFF_FLAG__IS_RENAME_SOURCE) == 0)
+			continue;
+
+		src = (uint32_t)git_array_size(index->srcs);
+
+		src_idx = git_array_alloc(index->srcs);
+		GIT_ERROR_CHECK_ALLOC(src_idx);
+		*src_idx = s;
+
+		pos = git_array_alloc(index->by_id);
+		GIT_ERROR_CHECK_ALLOC(pos);
+		*pos = src;
+
+		if (!use_hashes || !cache[2 * s])
+			continue;
+
+		if (!(len = git_hashsig__hashes(hashes, cache[2 * s]))) {
+			pos = git_array_alloc(index->blank);
+			GIT_ERROR_CHECK_ALLOC(pos);
+			*pos = src;
+		}
+
+		for (i = 0; i < len; i++) {
+			posting = git_array_alloc(index->postings);
+			GIT_ERROR_CHECK_ALLOC(posting);
+			posting->hash = hashes[i];
+			posting->src = src;
+		}
+	}
+
+	git__qsort_r(index->postings.ptr, git_array_size(index->postings),
+		sizeof(similarity_posting), similarity_posting_cmp, NULL);
+	git__qsort_r(index->by_id.ptr, git_array_size(index->by_id),
+		sizeof(uint32_t), similarity_by_id_cmp, index);
+
+	index->counts = git__calloc(git_array_size(index->srcs), sizeof(uint32_t));
+	GIT_ERROR_CHECK_ALLOC(index->counts);
+
+	index->starts = git__calloc(diff->deltas.length + 1, sizeof(size_t));
+	GIT_ERROR_CHECK_ALLOC(index->starts);
+
+	return 0;
+}
+
+GIT_INLINE(int) similarity_index_count(
+	similarity_index *index, uint32_t src, uint32_t weight)
+{
+	uint32_t *touched;
+
+	if (!index->counts[src]) {
+		touched = git_array_alloc(index->touched);
+		GIT_ERROR_CHECK_ALLOC(touched);
+		*touched = src;
+	}
+
+	index->counts[src] += weight;
+	return 0;
+}
+
+/* Find the first of the postings of a hash, and how many there are */
+static size_t similarity_index_postings(
+	size_t *out, similarity_index *index, uint32_t hash)
+{
+	size_t lo = 0, hi = git_array_size(index->postings), mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (index->postings.ptr[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*out = lo;
+
+	for (hi = lo; hi < git_array_size(index->postings) &&
+			index->postings.ptr[hi].hash == hash; hi++)
+		/* count them */;
+
+	return hi - lo;
+}
+
+static int similarity_index_count_id(
+	similarity_index *index, const git_oid *id)
+{
+	size_t lo = 0, hi = git_array_size(index->by_id), mid;
+	int error;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (git_oid__cmp(similarity_index_src_id(index, index->by_id.ptr[mid]), id) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < git_array_size(index->by_id) &&
+			!git_oid__cmp(similarity_index_src_id(index, index->by_id.ptr[lo]), id); lo++) {
+		if ((error = similarity_index_count(
+				index, index->by_id.ptr[lo], SIMILARITY_ID_WEIGHT)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+/*
+ * Count what each source has in common with a target: the same id, or
+ * the hashes of their signatures.  Hashes that more sources than the
+ * rename limit have are too common to tell them apart, and are only
+ * counted when the target has nothing else in common with any source.
+ */
+static int similarity_index_count_target(
+	similarity_index *index,
+	const git_diff_find_options *opts,
+	void **cache,
+	size_t t)
+{
+	uint32_t hashes[GIT_HASHSIG_MAX_HASHES], *src;
+	git_diff_delta *delta = git_vector_get(&index->diff->deltas, t);
+	size_t len, first, count, skipped = 0, i, j;
+	int error;
+
+	if ((error = similarity_index_count_id(index, &delta->new_file.id)) < 0)
+		return error;
+
+	if (!git_diff_find_similar__is_internal(opts->metric) || !cache[2 * t + 1])
+		return 0;
+
+	if (!(len = git_hashsig__hashes(hashes, cache[2 * t + 1]))) {
+		git_array_foreach(index->blank, i, src) {
+			if ((error = similarity_index_count(index, *src, 1)) < 0)
+				return error;
+		}
+
+		return 0;
+	}
+
+	for (i = 0; i < len; i++) {
+		count = similarity_index_postings(&first, index, hashes[i]);
+
+		if (count > opts->rename_limit) {
+			skipped++;
+			continue;
+		}
+
+		for (j = first; j < first + count; j++) {
+			if ((error = similarity_index_count(
+					index, index->postings.ptr[j].src, 1)) < 0)
+				return error;
+		}
+	}
+
+	if (git_array_size(index->touched) || !skipped)
+		return 0;
+
+	for (i = 0; i < len; i++) {
+		count = similarity_index_postings(&first, index, hashes[i]);
+
+		for (j = first; j < first + count; j++) {
+			if ((error = similarity_index_count(
+					index, index->postings.ptr[j].src, 1)) < 0)
+				return error;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Measure each target against the sources that it has the most in common
+ * with, up to the rename limit of them, and keep the similarities that
+ * could make a match, in the order of the sources.
+ */
+static int similarity_index_measure(
+	similarity_index *index,
+	const git_diff_find_options *opts,
+	void **cache)
+{
+	git_diff *diff = index->diff;
+	git_diff_delta *delta;
+	diff_find_match *match;
+	uint32_t *src;
+	size_t t, s, i;
+	int error = 0, score;
+
+	git_vector_foreach(&diff->deltas, t, delta) {
+		index->starts[t] = git_array_size(index->candidates);
+
+		if ((delta->flags & GIT_DIFF_FLAG__IS_RENAME_TARGET) == 0)
+			continue;
+
+		error = similarity_index_count_target(index, opts, cache, t);
+
+		if (git_array_size(index->touched) > opts->rename_limit)
+			git__qsort_r(index->touched.ptr, git_array_size(index->touched),
+				sizeof(uint32_t), similarity_count_cmp, index->counts);
+
+		git_array_foreach(index->touched, i, src)
+			index->counts[*src] = 0;
+
+		if (error < 0)
+			return error;
+
+		if (git_array_size(index->touched) > opts->rename_limit)
+			index->touched.size = opts->rename_limit;
+
+		git__qsort_r(index->touched.ptr, git_array_size(index->touched),
+			sizeof(uint32_t), similarity_src_cmp, NULL);
+
+		git_array_foreach(index->touched, i, src) {
+			/* don't measure self-similarity here */
+			if ((s = index->srcs.ptr[*src]) == t)
+				continue;
+
+			if ((error = similarity_measure(
+					&score, diff, opts, cache, 2 * s, 2 * t + 1)) < 0)
+				return error;
+
+			if (score <= 0)
+				continue;
+
+			match = git_array_alloc(index->candidates);
+			GIT_ERROR_CHECK_ALLOC(match);
+			match->idx = s;
+			match->similarity = (uint16_t)score;
+		}
+
+		index->touched.size = 0;
+	}
+
+	index->starts[diff->deltas.length] = git_array_size(index->candidates);
+	return 0;
+}
+
+/* Match a target to a source if they are the best that either has yet */
+static size_t find_match_update(
+	diff_find_match *tgt2src,
+	diff_find_match *src2tgt,
+	diff_find_match *tgt2src_copy,
+	size_t s,
+	size_t t,
+	uint16_t similarity)
+{
+	size_t num_bumped = 0;
+
+	/* is this a better rename? */
+	if (tgt2src[t].similarity < similarity &&
+		src2tgt[s].similarity < similarity)
+	{
+		/* eject old mapping */
+		if (src2tgt[s].similarity > 0) {
+			tgt2src[src2tgt[s].idx].similarity = 0;
+			num_bumped++;
+		}
+		if (tgt2src[t].similarity > 0) {
+			src2tgt[tgt2src[t].idx].similarity = 0;
+			num_bumped++;
+		}
+
+		/* write new mapping */
+		tgt2src[t].idx = s;
+		tgt2src[t].similarity = similarity;
+		src2tgt[s].idx = t;
+		src2tgt[s].similarity = similarity;
+	}
+
+	/* keep best absolute match for copies */
+	if (tgt2src_copy != NULL &&
+		tgt2src_copy[t].similarity < similarity)
+	{
+		tgt2src_copy[t].idx = s;
+		tgt2src_copy[t].similarity = similarity;
+	}
+
+	return num_bumped;
+}
+
 int git_diff_find_similar(
 	git_diff *diff,
 	const git_diff_find_options *given_opts)
 {
-	size_t s, t;
+	size_t s, t, c;
 	int error = 0, result;
-	uint16_t similarity;
 	git_diff_delta *src, *tgt;
 	git_diff_find_options opts = GIT_DIFF_FIND_OPTIONS_INIT;
 	size_t num_deltas, num_srcs = 0, num_tgts = 0;
@@ -813,7 +1445,9 @@ int git_diff_find_similar(
 	diff_find_match *tgt2src = NULL;
 	diff_find_match *src2tgt = NULL;
 	diff_find_match *tgt2src_copy = NULL;
-	diff_find_match *best_match;
+	diff_find_match *best_match, *match;
+	similarity_index index = {0};
+	bool use_index = false;
 	git_diff_file swap;
 
 	assert(diff);
@@ -865,6 +1499,16 @@ int git_diff_find_similar(
 		GIT_ERROR_CHECK_ALLOC(tgt2src_copy);
 	}
 
+	if (FLAG_SET(&opts, GIT_DIFF_FIND_EXACT_MATCH_ONLY) ||
+		git_diff_find_similar__is_internal(opts.metric)) {
+		if ((error = similarity_prepare(diff, &opts, sigcache)) < 0 ||
+			(error = similarity_index_init(&index, diff, &opts, sigcache)) < 0 ||
+			(error = similarity_index_measure(&index, &opts, sigcache)) < 0)
+			goto cleanup;
+
+		use_index = true;
+	}
+
 	/*
 	 * Find best-fit matches for rename / copy candidates
 	 */
@@ -877,59 +1521,40 @@ find_best_matches:
 		if ((tgt->flags & GIT_DIFF_FLAG__IS_RENAME_TARGET) == 0)
 			continue;
 
-		tried_srcs = 0;
-
-		git_vector_foreach(&diff->deltas, s, src) {
-			/* skip things that are not rename sources */
-			if ((src->flags & GIT_DIFF_FLAG__IS_RENAME_SOURCE) == 0)
-				continue;
+		if (use_index) {
+			for (c = index.starts[t]; c < index.starts[t + 1]; c++) {
+				match = git_array_get(index.candidates, c);
+				num_bumped += find_match_update(tgt2src, src2tgt,
+					tgt2src_copy, match->idx, t, match->similarity);
+			}
+		} else {
+			tried_srcs = 0;
 
-			/* calculate similarity for this pair and find best match */
-			if (s == t)
-				result = -1; /* don't measure self-similarity here */
-			else if ((error = similarity_measure(
-				&result, diff, &opts, sigcache, 2 * s, 2 * t + 1)) < 0)
-				goto cleanup;
+			git_vector_foreach(&diff->deltas, s, src) {
+				/* skip things that are not rename sources */
+				if ((src->flags & GIT_DIFF_FLAG__IS_RENAME_SOURCE) == 0)
+					continue;
 
-			if (result < 0)
-				continue;
-			similarity = (uint16_t)result;
-
-			/* is this a better rename? */
-			if (tgt2src[t].similarity < similarity &&
-				src2tgt[s].similarity < similarity)
-			{
-				/* eject old mapping */
-				if (src2tgt[s].similarity > 0) {
-					tgt2src[src2tgt[s].idx].similarity = 0;
-					num_bumped++;
-				}
-				if (tgt2src[t].similarity > 0) {
-					src2tgt[tgt2src[t].idx].similarity = 0;
-					num_bumped++;
-				}
+				/* calculate similarity for this pair and find best match */
+				if (s == t)
+					result = -1; /* don't measure self-similarity here */
+				else if ((error = similarity_measure(
+					&result, diff, &opts, sigcache, 2 * s, 2 * t + 1)) < 0)
+					goto cleanup;
 
-				/* write new mapping */
-				tgt2src[t].idx = s;
-				tgt2src[t].similarity = similarity;
-				src2tgt[s].idx = t;
-				src2tgt[s].similarity = similarity;
-			}
+				if (result < 0)
+					continue;
 
-			/* keep best absolute match for copies */
-			if (tgt2src_copy != NULL &&
-				tgt2src_copy[t].similarity < similarity)
-			{
-				tgt2src_copy[t].idx = s;
-				tgt2src_copy[t].similarity = similarity;
-			}
+				num_bumped += find_match_update(tgt2src, src2tgt,
+					tgt2src_copy, s, t, (uint16_t)result);
 
-			if (++tried_srcs >= num_srcs)
-				break;
+				if (++tried_srcs >= num_srcs)
+					break;
 
-			/* cap on maximum targets we'll examine (per "tgt" file) */
-			if (tried_srcs > opts.rename_limit)
-				break;
+				/* cap on maximum targets we'll examine (per "tgt" file) */
+				if (tried_srcs > opts.rename_limit)
+					break;
+			}
 		}
 
 		if (++tried_tgts >= num_tgts)
@@ -1099,6 +1724,7 @@ find_best_matches:
 			!FLAG_SET(&opts, GIT_DIFF_BREAK_REWRITES_FOR_RENAMES_ONLY));
 
 cleanup:
+	similarity_index_free(&index);
 	git__free(tgt2src);
 	git__free(src2tgt);
 	git__free(tgt2src_copy);
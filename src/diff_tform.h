@@ -22,4 +22,16 @@ extern void git_diff_find_similar__hashsig_free(void *sig, void *payload);
 extern int git_diff_find_similar__calc_similarity(
 	int *score, void *siga, void *sigb, void *payload);
 
+/*
+ * Whether a metric is the internal one, whose signatures are hashsigs and
+ * whose payload is their options.
+ */
+GIT_INLINE(bool) git_diff_find_similar__is_internal(
+	const git_diff_similarity_metric *metric)
+{
+	return (metric->file_signature == git_diff_find_similar__hashsig_for_file &&
+		metric->buffer_signature == git_diff_find_similar__hashsig_for_buf &&
+		metric->similarity == git_diff_find_similar__calc_similarity);
+}
+
 #endif
@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "ewah.h"
+
+/*
+ * A serialized EWAH bitmap is made of:
+ *
+ * - the number of bits in the bitmap (32 bits, network byte order)
+ * - the number of 64-bit words that follow (32 bits)
+ * - the words, in network byte order
+ * - the position of the last "running length word" (32 bits)
+ *
+ * The words are a sequence of running length words, each of which is
+ * followed by a number of literal words. A running length word stores
+ * a run of words that are all zeros or all ones (the lowest bit tells
+ * which), the length of that run in the next 32 bits, and the number
+ * of literal words following it in the upper 31 bits.
+ */
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS 31
+#define RLW_LARGEST_RUNNING_COUNT ((1ull << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL_COUNT ((1ull << RLW_LITERAL_BITS) - 1)
+
+#define RLW_RUNNING_BIT(w) ((w) & 1)
+#define RLW_RUNNING_LEN(w) (((w) >> 1) & RLW_LARGEST_RUNNING_COUNT)
+#define RLW_LITERAL_WORDS(w) ((w) >> (1 + RLW_RUNNING_BITS))
+
+#define BITMAP_WORD_BITS 64
+
+GIT_INLINE(uint32_t) ewah_get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+GIT_INLINE(uint64_t) ewah_get_be64(const unsigned char *p)
+{
+	return ((uint64_t)ewah_get_be32(p) << 32) | ewah_get_be32(p + 4);
+}
+
+static int ewah_put_be32(git_buf *out, uint32_t v)
+{
+	unsigned char buf[4];
+
+	buf[0] = (unsigned char)(v >> 24);
+	buf[1] = (unsigned char)(v >> 16);
+	buf[2] = (unsigned char)(v >> 8);
+	buf[3] = (unsigned char)v;
+
+	return git_buf_put(out, (const char *)buf, sizeof(buf));
+}
+
+static void ewah_set_be64(unsigned char *p, uint64_t v)
+{
+	size_t i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = (unsigned char)(v >> (56 - 8 * i));
+}
+
+static int bitmap_grow(git_bitmap *bitmap, size_t words)
+{
+	uint64_t *new_words;
+	size_t new_alloc;
+
+	if (words <= bitmap->word_alloc)
+		return 0;
+
+	new_alloc = bitmap->word_alloc ? bitmap->word_alloc : 8;
+	while (new_alloc < words) {
+		GIT_ERROR_CHECK_ALLOC_MULTIPLY(&new_alloc, new_alloc, 2);
+	}
+
+	new_words = git__reallocarray(bitmap->words, new_alloc, sizeof(uint64_t));
+	GIT_ERROR_CHECK_ALLOC(new_words);
+
+	memset(new_words + bitmap->word_alloc, 0,
+		(new_alloc - bitmap->word_alloc) * sizeof(uint64_t));
+
+	bitmap->words = new_words;
+	bitmap->word_alloc = new_alloc;
+	return 0;
+}
+
+int git_bitmap_set(git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / BITMAP_WORD_BITS;
+
+	if (bitmap_grow(bitmap, block + 1) < 0)
+		return -1;
+
+	bitmap->words[block] |= (uint64_t)1 << (pos % BITMAP_WORD_BITS);
+	return 0;
+}
+
+bool git_bitmap_get(const git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / BITMAP_WORD_BITS;
+
+	return block < bitmap->word_alloc &&
+		(bitmap->words[block] & ((uint64_t)1 << (pos % BITMAP_WORD_BITS))) != 0;
+}
+
+int git_bitmap_or(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < src->word_alloc; i++)
+		dst->words[i] |= src->words[i];
+
+	return 0;
+}
+
+void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i, words = min(dst->word_alloc, src->word_alloc);
+
+	for (i = 0; i < words; i++)
+		dst->words[i] &= ~src->words[i];
+}
+
+int git_bitmap_xor(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < src->word_alloc; i++)
+		dst->words[i] ^= src->words[i];
+
+	return 0;
+}
+
+GIT_INLINE(size_t) word_popcount(uint64_t w)
+{
+	size_t count = 0;
+
+	while (w) {
+		w &= w - 1;
+		count++;
+	}
+
+	return count;
+}
+
+size_t git_bitmap_popcount(const git_bitmap *bitmap)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < bitmap->word_alloc; i++)
+		count += word_popcount(bitmap->words[i]);
+
+	return count;
+}
+
+void git_bitmap_clear(git_bitmap *bitmap)
+{
+	if (bitmap->words)
+		memset(bitmap->words, 0, bitmap->word_alloc * sizeof(uint64_t));
+}
+
+void git_bitmap_dispose(git_bitmap *bitmap)
+{
+	if (!bitmap)
+		return;
+
+	git__free(bitmap->words);
+	bitmap->words = NULL;
+	bitmap->word_alloc = 0;
+}
+
+int git_bitmap_foreach(
+	const git_bitmap *bitmap,
+	int (*cb)(size_t pos, void *payload),
+	void *payload)
+{
+	size_t i, bit;
+	uint64_t word;
+	int error;
+
+	for (i = 0; i < bitmap->word_alloc; i++) {
+		for (word = bitmap->words[i], bit = 0; word; word >>= 1, bit++) {
+			if (!(word & 1))
+				continue;
+
+			if ((error = cb(i * BITMAP_WORD_BITS + bit, payload)) != 0)
+				return error;
+		}
+	}
+
+	return 0;
+}
+
+static int ewah_error(const char *message)
+{
+	git_error_set(GIT_ERROR_ODB, "invalid EWAH bitmap - %s", message);
+	return -1;
+}
+
+int git_ewah_size(size_t *out, const unsigned char *data, size_t len)
+{
+	size_t word_count, words_len, total_len;
+
+	if (len < 3 * sizeof(uint32_t))
+		return ewah_error("bitmap is too short");
+
+	word_count = ewah_get_be32(data + 4);
+
+	if (GIT_MULTIPLY_SIZET_OVERFLOW(&words_len, word_count, sizeof(uint64_t)) ||
+	    GIT_ADD_SIZET_OVERFLOW(&total_len, words_len, 3 * sizeof(uint32_t)) ||
+	    total_len > len)
+		return ewah_error("bitmap is truncated");
+
+	*out = total_len;
+	return 0;
+}
+
+int git_ewah_read(
+	git_bitmap *out,
+	size_t *consumed,
+	const unsigned char *data,
+	size_t len)
+{
+	size_t bit_size, word_count, total_len, max_words, i, pos = 0;
+	const unsigned char *words;
+	uint64_t rlw, run, literals, j;
+
+	if (git_ewah_size(&total_len, data, len) < 0)
+		return -1;
+
+	bit_size = ewah_get_be32(data);
+	word_count = ewah_get_be32(data + 4);
+
+	words = data + 2 * sizeof(uint32_t);
+
+	max_words = (bit_size + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+
+	git_bitmap_clear(out);
+	if (bitmap_grow(out, max_words) < 0)
+		return -1;
+
+	for (i = 0; i < word_count; ) {
+		rlw = ewah_get_be64(words + i * 8);
+		run = RLW_RUNNING_LEN(rlw);
+		literals = RLW_LITERAL_WORDS(rlw);
+		i++;
+
+		if (literals > word_count - i)
+			return ewah_error("literal words extend beyond the bitmap");
+
+		if (run + literals > max_words - pos)
+			return ewah_error("words extend beyond the size of the bitmap");
+
+		if (RLW_RUNNING_BIT(rlw)) {
+			for (j = 0; j < run; j++)
+				out->words[pos + j] = UINT64_MAX;
+		}
+		pos += run;
+
+		for (j = 0; j < literals; j++, i++)
+			out->words[pos++] = ewah_get_be64(words + i * 8);
+	}
+
+	*consumed = total_len;
+	return 0;
+}
+
+static void ewah_write_rlw(
+	git_buf *words,
+	size_t rlw_pos,
+	bool running_bit,
+	uint64_t run,
+	uint64_t literals)
+{
+	uint64_t rlw = (running_bit ? 1 : 0) |
+		(run << 1) |
+		(literals << (1 + RLW_RUNNING_BITS));
+
+	ewah_set_be64((unsigned char *)words->ptr + rlw_pos * 8, rlw);
+}
+
+int git_ewah_write(
+	git_buf *out,
+	const git_bitmap *bitmap,
+	size_t bit_size)
+{
+	git_buf words = GIT_BUF_INIT;
+	size_t word_count = (bit_size + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+	size_t i = 0, rlw_pos = 0, nwords = 0;
+	unsigned char literal[8];
+	uint64_t run, literals, w;
+	bool running_bit;
+	int error = 0;
+
+	if (bit_size > UINT32_MAX)
+		return ewah_error("bitmap is too large");
+
+#define WORD_AT(n) \
+	((n) < bitmap->word_alloc ? \
+		(((n) == word_count - 1 && bit_size % BITMAP_WORD_BITS) ? \
+			bitmap->words[n] & (((uint64_t)1 << (bit_size % BITMAP_WORD_BITS)) - 1) : \
+			bitmap->words[n]) : \
+		0)
+
+	do {
+		/* Reserve room for the running length word. */
+		rlw_pos = nwords++;
+		if ((error = git_buf_put(&words, (const char *)literal, sizeof(literal))) < 0)
+			goto done;
+
+		run = 0;
+		running_bit = (i < word_count && WORD_AT(i) == UINT64_MAX);
+		while (i < word_count && run < RLW_LARGEST_RUNNING_COUNT &&
+		       WORD_AT(i) == (running_bit ? UINT64_MAX : 0)) {
+			run++;
+			i++;
+		}
+
+		literals = 0;
+		while (i < word_count && literals < RLW_LARGEST_LITERAL_COUNT &&
+		       (w = WORD_AT(i)) != 0 && w != UINT64_MAX) {
+			ewah_set_be64(literal, w);
+			if ((error = git_buf_put(&words, (const char *)literal, sizeof(literal))) < 0)
+				goto done;
+			nwords++;
+			literals++;
+			i++;
+		}
+
+		ewah_write_rlw(&words, rlw_pos, running_bit, run, literals);
+	} while (i < word_count);
+
+#undef WORD_AT
+
+	if (nwords > UINT32_MAX) {
+		error = ewah_error("bitmap is too large");
+		goto done;
+	}
+
+	if ((error = ewah_put_be32(out, (uint32_t)bit_size)) < 0 ||
+	    (error = ewah_put_be32(out, (uint32_t)nwords)) < 0 ||
+	    (error = git_buf_put(out, words.ptr, words.size)) < 0 ||
+	    (error = ewah_put_be32(out, (uint32_t)rlw_pos)) < 0)
+		goto done;
+
+done:
+	git_buf_dispose(&words);
+	return error;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_ewah_h__
+#define INCLUDE_ewah_h__
+
+#include "common.h"
+
+#include "buffer.h"
+
+/*
+ * An uncompressed bitmap. Bit `n` is stored in word `n / 64` at position
+ * `n % 64`, which is also the layout that git uses for the words of its
+ * EWAH-compressed bitmaps. The bitmap grows as bits are set.
+ */
+typedef struct {
+	uint64_t *words;
+	size_t word_alloc;
+} git_bitmap;
+
+#define GIT_BITMAP_INIT {0}
+
+extern int git_bitmap_set(git_bitmap *bitmap, size_t pos);
+extern bool git_bitmap_get(const git_bitmap *bitmap, size_t pos);
+
+/* `dst |= src` */
+extern int git_bitmap_or(git_bitmap *dst, const git_bitmap *src);
+
+/* `dst &= ~src` */
+extern void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src);
+
+/* `dst ^= src` */
+extern int git_bitmap_xor(git_bitmap *dst, const git_bitmap *src);
+
+extern size_t git_bitmap_popcount(const git_bitmap *bitmap);
+
+extern void git_bitmap_clear(git_bitmap *bitmap);
+extern void git_bitmap_dispose(git_bitmap *bitmap);
+
+/*
+ * Call `cb` with the position of every bit that is set, in increasing
+ * order. A non-zero return from the callback stops the iteration.
+ */
+extern int git_bitmap_foreach(
+	const git_bitmap *bitmap,
+	int (*cb)(size_t pos, void *payload),
+	void *payload);
+
+/*
+ * Decompress a serialized EWAH bitmap, as found in git's `.bitmap` files,
+ * from `data`. On success, `consumed` is set to the size of the serialized
+ * bitmap.
+ */
+extern int git_ewah_read(
+	git_bitmap *out,
+	size_t *consumed,
+	const unsigned char *data,
+	size_t len);
+
+/*
+ * Get the size of the serialized EWAH bitmap at `data` without
+ * decompressing it.
+ */
+extern int git_ewah_size(size_t *out, const unsigned char *data, size_t len);
+
+/*
+ * Compress the first `bit_size` bits of `bitmap` to git's serialized
+ * EWAH format and append it to `out`.
+ */
+extern int git_ewah_write(
+	git_buf *out,
+	const git_bitmap *bitmap,
+	size_t bit_size);
+
+#endif
@@ -17,6 +17,9 @@
 #include "blob.h"
 #include "attr_file.h"
 #include "array.h"
+#include "odb.h"
+
+size_t git_filter__stream_blob_threshold = GIT_FILTER_STREAM_BLOB_THRESHOLD;
 
 struct git_filter_source {
 	git_repository *repo;
@@ -510,6 +513,8 @@ int git_filter_list__load_ext(
 
 	if (blob)
 		git_oid_cpy(&src.oid, git_blob_id(blob));
+	else if (filter_opts->blob_id)
+		git_oid_cpy(&src.oid, filter_opts->blob_id);
 
 	git_vector_foreach(&filter_registry.filters, idx, fdef) {
 		const char **values = NULL;
@@ -1030,6 +1035,99 @@ int git_filter_list_stream_blob(
 	return git_filter_list_stream_data(filters, &in, target);
 }
 
+static int stream_blob_by_id(
+	git_filter_list *filters,
+	git_repository *repo,
+	const git_oid *id,
+	git_writestream *target)
+{
+	git_blob *blob;
+	int error;
+
+	if ((error = git_blob_lookup(&blob, repo, id)) < 0)
+		return error;
+
+	error = git_filter_list_stream_blob(filters, blob, target);
+
+	git_blob_free(blob);
+	return error;
+}
+
+int git_filter_list__stream_blob_id(
+	git_filter_list *filters,
+	git_repository *repo,
+	const git_oid *id,
+	git_writestream *target)
+{
+	char buf[FILTERIO_BUFSIZE], hdr[64];
+	git_vector filter_streams = GIT_VECTOR_INIT;
+	git_writestream *stream_start;
+	git_odb_stream *rstream = NULL;
+	git_odb *odb;
+	git_object_t type;
+	git_hash_ctx hash;
+	git_oid actual;
+	size_t len, hdr_len, total = 0;
+	int readlen, error, initialized = 0;
+
+	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0 ||
+	    (error = git_odb_read_header(&len, &type, odb, id)) < 0)
+		return error;
+
+	/* small blobs, and the ones that can't be streamed, are read whole */
+	if (type != GIT_OBJECT_BLOB || len < git_filter__stream_blob_threshold ||
+	    git_odb_open_rstream(&rstream, &len, &type, odb, id) < 0) {
+		git_error_clear();
+		return stream_blob_by_id(filters, repo, id, target);
+	}
+
+	if (filters)
+		git_oid_cpy(&filters->source.oid, id);
+
+	if ((error = git_hash_ctx_init(&hash)) < 0)
+		goto done;
+
+	if ((error = git_odb__format_object_header(&hdr_len, hdr, sizeof(hdr), len, type)) < 0 ||
+	    (error = git_hash_update(&hash, hdr, hdr_len)) < 0 ||
+	    (error = stream_list_init(&stream_start, &filter_streams, filters, target)) < 0)
+		goto done;
+	initialized = 1;
+
+	while ((readlen = git_odb_stream_read(rstream, buf, sizeof(buf))) > 0) {
+		total += readlen;
+
+		if ((error = git_hash_update(&hash, buf, readlen)) < 0 ||
+		    (error = stream_start->write(stream_start, buf, readlen)) < 0)
+			goto done;
+	}
+
+	if (readlen < 0) {
+		error = readlen;
+		goto done;
+	}
+
+	if (total != len) {
+		git_error_set(GIT_ERROR_ODB, "blob is %" PRIuZ " bytes instead of %" PRIuZ, total, len);
+		error = -1;
+		goto done;
+	}
+
+	/* like a read of the whole object, check what was written */
+	if (git_odb__strict_hash_verification &&
+	    (error = git_hash_final(&actual, &hash)) == 0 &&
+	    !git_oid_equal(id, &actual))
+		error = git_odb__error_mismatch(id, &actual);
+
+done:
+	if (initialized)
+		error |= stream_start->close(stream_start);
+
+	git_hash_ctx_cleanup(&hash);
+	git_odb_stream_free(rstream);
+	stream_list_free(&filter_streams);
+	return error;
+}
+
 int git_filter_init(git_filter *filter, unsigned int version)
 {
 	GIT_INIT_STRUCTURE_FROM_TEMPLATE(filter, version, git_filter, GIT_FILTER_INIT);
@@ -15,10 +15,16 @@
 /* Amount of file to examine for NUL byte when checking binary-ness */
 #define GIT_FILTER_BYTES_TO_CHECK_NUL 8000
 
+/* Blobs from this size are read from the odb a piece at a time */
+#define GIT_FILTER_STREAM_BLOB_THRESHOLD (16 * 1024 * 1024)
+
+extern size_t git_filter__stream_blob_threshold;
+
 typedef struct {
 	git_attr_session *attr_session;
 	git_buf *temp_buf;
 	uint32_t flags;
+	const git_oid *blob_id; /* when the blob has not been read */
 } git_filter_options;
 
 #define GIT_FILTER_OPTIONS_INIT {0}
@@ -35,6 +41,19 @@ extern int git_filter_list__load_ext(
 	git_filter_mode_t mode,
 	git_filter_options *filter_opts);
 
+/*
+ * Stream the blob with the given id through the filters.  When it is
+ * large, it is read from the object database a piece at a time instead
+ * of being loaded whole, as far as the filters don't need all of it.
+ * Its hash can then only be checked once it went through the filters,
+ * so on error, the caller must discard what was written to `target`.
+ */
+extern int git_filter_list__stream_blob_id(
+	git_filter_list *filters,
+	git_repository *repo,
+	const git_oid *id,
+	git_writestream *target);
+
 /*
  * Available filters
  */
@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "fsmonitor.h"
+
+#include "config.h"
+#include "index.h"
+#include "repository.h"
+
+/* the version of git's fsmonitor hook protocol that we speak */
+#define FSMONITOR_HOOK_VERSION "2"
+
+static void fsmonitor_invalidate_all(git_index *index)
+{
+	git_index_entry *entry;
+	size_t i;
+
+	git_vector_foreach(&index->entries, i, entry)
+		entry->flags_extended &= ~GIT_INDEX_ENTRY_FSMONITOR_VALID;
+
+	index->fsmonitor_changed = 1;
+}
+
+/* Stop vouching for the entry at `path`, and for everything below it */
+static void fsmonitor_invalidate_path(git_index *index, const char *path)
+{
+	int (*strncomp)(const char *a, const char *b, size_t sz);
+	git_index_entry *entry;
+	size_t path_len = strlen(path), pos;
+
+	while (path_len && path[path_len - 1] == '/')
+		path_len--;
+
+	if (!path_len)
+		return;
+
+	strncomp = index->ignore_case ? git__strncasecmp : git__strncmp;
+
+	git_index__find_pos(&pos, index, path, path_len, 0);
+
+	while ((entry = git_vector_get(&index->entries, pos++)) != NULL &&
+	       strncomp(entry->path, path, path_len) == 0) {
+		if (entry->path[path_len] != '\0' && entry->path[path_len] != '/')
+			continue;
+
+		if ((entry->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID) != 0) {
+			entry->flags_extended &= ~GIT_INDEX_ENTRY_FSMONITOR_VALID;
+			index->fsmonitor_changed = 1;
+		}
+	}
+}
+
+/*
+ * Apply the answer of the monitor: a token, and the paths that changed,
+ * each terminated by a NUL.  A path of "/" stands for everything.
+ */
+static int fsmonitor_apply(char **token, git_index *index, git_buf *result)
+{
+	const char *path, *end = result->ptr + result->size;
+
+	*token = NULL;
+
+	/* the token must be terminated, and must not be empty */
+	if (!result->size || !result->ptr[0])
+		return 0;
+
+	*token = git__strdup(result->ptr);
+	GIT_ERROR_CHECK_ALLOC(*token);
+
+	for (path = result->ptr + strlen(result->ptr) + 1;
+	     path < end;
+	     path += strlen(path) + 1) {
+		if (strcmp(path, "/") == 0) {
+			fsmonitor_invalidate_all(index);
+			break;
+		}
+
+		fsmonitor_invalidate_path(index, path);
+	}
+
+	return 0;
+}
+
+#ifdef GIT_WIN32
+
+static int fsmonitor_run_hook(
+	git_buf *out, git_repository *repo, const char *hook, const char *token)
+{
+	GIT_UNUSED(out);
+	GIT_UNUSED(repo);
+	GIT_UNUSED(hook);
+	GIT_UNUSED(token);
+
+	/* without an answer, all the paths are examined */
+	return GIT_PASSTHROUGH;
+}
+
+#else
+
+static int shell_quote(git_buf *out, const char *str)
+{
+	git_buf_putc(out, '\'');
+
+	for (; *str; str++) {
+		if (*str == '\'')
+			git_buf_puts(out, "'\\''");
+		else
+			git_buf_putc(out, *str);
+	}
+
+	git_buf_putc(out, '\'');
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+/*
+ * Run the hook like git does: in the working directory, with the version
+ * of the protocol and the token as its arguments.  The hook is given to
+ * the shell as is, so that it may have arguments of its own.
+ */
+static int fsmonitor_run_hook(
+	git_buf *out, git_repository *repo, const char *hook, const char *token)
+{
+	git_buf command = GIT_BUF_INIT;
+	char buf[4096];
+	size_t read_len;
+	FILE *fp;
+	int error = 0;
+
+	git_buf_puts(&command, "cd ");
+
+	if ((error = shell_quote(&command, repo->workdir)) < 0 ||
+	    (error = git_buf_printf(&command, " && %s " FSMONITOR_HOOK_VERSION " ", hook)) < 0 ||
+	    (error = shell_quote(&command, token)) < 0)
+		goto done;
+
+	if ((fp = popen(command.ptr, "r")) == NULL) {
+		error = GIT_PASSTHROUGH;
+		goto done;
+	}
+
+	while ((read_len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		if ((error = git_buf_put(out, buf, read_len)) < 0)
+			break;
+	}
+
+	/* a hook that fails gives no answer */
+	if (pclose(fp) != 0 && !error)
+		error = GIT_PASSTHROUGH;
+
+done:
+	git_buf_dispose(&command);
+	return error;
+}
+
+#endif
+
+/*
+ * Look up the hook to run.  `core.fsmonitor` may also be a boolean, as
+ * newer versions of git have a builtin monitor, which we do not support.
+ */
+static int fsmonitor_hook(git_buf *out, git_repository *repo)
+{
+	git_config *cfg;
+	git_config_entry *entry = NULL;
+	int error, value;
+
+	if ((error = git_repository_config__weakptr(&cfg, repo)) < 0 ||
+	    (error = git_config__lookup_entry(&entry, cfg, "core.fsmonitor", false)) < 0)
+		return error;
+
+	if (entry && entry->value && *entry->value &&
+	    git_config_parse_bool(&value, entry->value) < 0) {
+		git_error_clear();
+		error = git_buf_sets(out, entry->value);
+	}
+
+	git_config_entry_free(entry);
+	return error;
+}
+
+static int fsmonitor_query(
+	git_buf *out,
+	git_repository *repo,
+	const char *hook,
+	const char *token)
+{
+	int error;
+
+	if (!repo->fsmonitor_cb)
+		return fsmonitor_run_hook(out, repo, hook, token);
+
+	if ((error = repo->fsmonitor_cb(out, token, repo->fsmonitor_payload)) > 0)
+		error = GIT_PASSTHROUGH;
+
+	if (error < 0 && error != GIT_PASSTHROUGH)
+		git_error_set_after_callback_function(error, "git_fsmonitor_cb");
+
+	return error;
+}
+
+int git_fsmonitor_refresh(git_repository *repo, git_index *index)
+{
+	git_buf hook = GIT_BUF_INIT, result = GIT_BUF_INIT;
+	char *token = NULL;
+	uint64_t now;
+	int error = 0;
+
+	assert(repo && index);
+
+	if (!repo->workdir)
+		return 0;
+
+	if (!repo->fsmonitor_cb && (error = fsmonitor_hook(&hook, repo)) < 0)
+		return error;
+
+	/* without a monitor, drop what an earlier one told us */
+	if (!repo->fsmonitor_cb && !hook.size) {
+		if (index->fsmonitor_token) {
+			fsmonitor_invalidate_all(index);
+			git__free(index->fsmonitor_token);
+			index->fsmonitor_token = NULL;
+		}
+
+		goto done;
+	}
+
+	/*
+	 * Remember when we started: whatever changes while we look is
+	 * reported the next time.  Like git, we use nanoseconds.
+	 */
+	now = (uint64_t)time(NULL) * 1000000000;
+
+	if (index->fsmonitor_token) {
+		error = fsmonitor_query(&result, repo, hook.ptr, index->fsmonitor_token);
+
+		if (!error)
+			error = fsmonitor_apply(&token, index, &result);
+		else if (error == GIT_PASSTHROUGH)
+			error = 0;
+
+		if (error < 0)
+			goto done;
+	}
+
+	/* we have no idea what changed; examine everything */
+	if (!token) {
+		fsmonitor_invalidate_all(index);
+
+		if ((token = git__malloc(GIT_FSMONITOR_TIMESTAMP_LEN)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		p_snprintf(token, GIT_FSMONITOR_TIMESTAMP_LEN, "%"PRIu64, now);
+	}
+
+	if (!index->fsmonitor_token || strcmp(index->fsmonitor_token, token) != 0)
+		index->fsmonitor_changed = 1;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = token;
+
+done:
+	git_buf_dispose(&hook);
+	git_buf_dispose(&result);
+	return error;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_fsmonitor_h__
+#define INCLUDE_fsmonitor_h__
+
+#include "common.h"
+
+#include "git2/sys/repository.h"
+
+/* The size of a timestamp token, in nanoseconds, including the NUL */
+#define GIT_FSMONITOR_TIMESTAMP_LEN 21
+
+/*
+ * Ask the repository's filesystem monitor (the callback given to
+ * `git_repository_set_fsmonitor`, or the `core.fsmonitor` hook) which
+ * paths changed since the index's token, and stop vouching for their
+ * entries.  When there is no token, or the monitor cannot answer, none
+ * of the entries are vouched for.  The index then has a new token.
+ *
+ * When the repository has no monitor, the index's token is dropped.
+ */
+extern int git_fsmonitor_refresh(git_repository *repo, git_index *index);
+
+#endif
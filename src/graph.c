@@ -43,7 +43,7 @@ static int mark_parents(git_revwalk *walk, git_commit_list_node *one,
 		return 0;
 	}
 
-	if (git_pqueue_init(&list, 0, 2, git_commit_list_time_cmp) < 0)
+	if (git_pqueue_init(&list, 0, 2, git_commit_list_generation_cmp) < 0)
 		return -1;
 
 	if (git_commit_list_parse(walk, one) < 0)
@@ -87,8 +87,13 @@ static int mark_parents(git_revwalk *walk, git_commit_list_node *one,
 				goto on_error;
 		}
 
-		/* Keep track of root commits, to make sure the path gets marked */
-		if (commit->out_degree == 0) {
+		/*
+		 * Keep track of root commits, to make sure the path gets marked.
+		 * Commits with a generation number are visited after all of
+		 * their descendants, so their flags are already final.
+		 */
+		if (commit->out_degree == 0 &&
+		    commit->generation == GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY) {
 			if (git_commit_list_insert(commit, &roots) == NULL)
 				goto on_error;
 		}
@@ -176,19 +181,25 @@ on_error:
 
 int git_graph_descendant_of(git_repository *repo, const git_oid *commit, const git_oid *ancestor)
 {
-	git_oid merge_base;
+	git_revwalk *walk;
+	git_commit_list_node *commit_node, *ancestor_node;
 	int error;
 
 	if (git_oid_equal(commit, ancestor))
 		return 0;
 
-	error = git_merge_base(&merge_base, repo, commit, ancestor);
-	/* No merge-base found, it's not a descendant */
-	if (error == GIT_ENOTFOUND)
-		return 0;
-
-	if (error < 0)
+	if ((error = git_revwalk_new(&walk, repo)) < 0)
 		return error;
 
-	return git_oid_equal(&merge_base, ancestor);
+	if ((commit_node = git_revwalk__commit_lookup(walk, commit)) == NULL ||
+	    (ancestor_node = git_revwalk__commit_lookup(walk, ancestor)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	error = git_merge__in_merge_bases(walk, ancestor_node, commit_node);
+
+done:
+	git_revwalk_free(walk);
+	return error;
 }
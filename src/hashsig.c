@@ -5,9 +5,8 @@
  * a Linking Exception. For full terms see the included COPYING file.
  */
 
-#include "common.h"
+#include "hashsig.h"
 
-#include "git2/sys/hashsig.h"
 #include "fileops.h"
 #include "util.h"
 
@@ -23,7 +22,7 @@ typedef uint64_t hashsig_state;
 #define HASHSIG_HASH_MIX(S,CH) \
 	(S) = ((S) << HASHSIG_HASH_SHIFT) - (S) + (hashsig_state)(CH)
 
-#define HASHSIG_HEAP_SIZE ((1 << 7) - 1)
+#define HASHSIG_HEAP_SIZE GIT_HASHSIG_SAMPLES
 #define HASHSIG_HEAP_MIN_SIZE 4
 
 typedef int (*hashsig_cmp)(const void *a, const void *b, void *);
@@ -107,8 +106,10 @@ static void hashsig_heap_down(hashsig_heap *h, int el)
 
 static void hashsig_heap_sort(hashsig_heap *h)
 {
-	/* only need to do this at the end for signature comparison */
-	git__qsort_r(h->values, h->size, sizeof(hashsig_t), h->cmp, NULL);
+	/* only need to do this at the end for signature comparison, which
+	 * wants the values of both heaps in ascending order
+	 */
+	git__qsort_r(h->values, h->size, sizeof(hashsig_t), hashsig_cmp_max, NULL);
 }
 
 static void hashsig_heap_insert(hashsig_heap *h, hashsig_t val)
@@ -130,29 +131,76 @@ static void hashsig_heap_insert(hashsig_heap *h, hashsig_t val)
 
 typedef struct {
 	int use_ignores;
-	uint8_t ignore_ch[256];
+	/* the characters that end a stretch of plain ones, by use_ignores */
+	uint8_t stop_ch[2][256];
 } hashsig_in_progress;
 
 static void hashsig_in_progress_init(
 	hashsig_in_progress *prog, git_hashsig *sig)
 {
-	int i;
+	int ignores_cr, i;
 
 	/* no more than one can be set */
 	assert(!(sig->opt & GIT_HASHSIG_IGNORE_WHITESPACE) ||
 		   !(sig->opt & GIT_HASHSIG_SMART_WHITESPACE));
 
-	if (sig->opt & GIT_HASHSIG_IGNORE_WHITESPACE) {
-		for (i = 0; i < 256; ++i)
-			prog->ignore_ch[i] = git__isspace_nonlf(i);
-		prog->use_ignores = 1;
-	} else if (sig->opt & GIT_HASHSIG_SMART_WHITESPACE) {
-		for (i = 0; i < 256; ++i)
-			prog->ignore_ch[i] = git__isspace(i);
-		prog->use_ignores = 1;
-	} else {
-		memset(prog, 0, sizeof(*prog));
+	ignores_cr = (sig->opt &
+		(GIT_HASHSIG_IGNORE_WHITESPACE | GIT_HASHSIG_SMART_WHITESPACE)) != 0;
+
+	prog->use_ignores = ignores_cr;
+
+	for (i = 0; i < 256; ++i) {
+		prog->stop_ch[0][i] = (i == '\n' || i == '\0' || (ignores_cr && i == '\r'));
+		prog->stop_ch[1][i] = (i == '\n' || i == '\0' || git__isspace_nonlf(i));
+	}
+}
+
+/* The powers of the multiplier of HASHSIG_HASH_MIX */
+#define HASHSIG_HASH_POW2 961ull
+#define HASHSIG_HASH_POW3 29791ull
+#define HASHSIG_HASH_POW4 923521ull
+#define HASHSIG_HASH_POW5 28629151ull
+#define HASHSIG_HASH_POW6 887503681ull
+#define HASHSIG_HASH_POW7 27512614111ull
+#define HASHSIG_HASH_POW8 852891037441ull
+
+/*
+ * Mix in the plain characters at the start of `data`, up to `max` of
+ * them, to the same state as HASHSIG_HASH_MIX one at a time would.  Eight
+ * characters at a time are checked with one branch, and mixed with
+ * products that do not depend on each other.
+ */
+static size_t hashsig_mix_plain(
+	hashsig_state *out,
+	const uint8_t *data,
+	size_t max,
+	const uint8_t stop_ch[256])
+{
+	hashsig_state state = *out;
+	size_t len = 0;
+
+	while (len + 8 <= max &&
+		!(stop_ch[data[len]] | stop_ch[data[len + 1]] |
+		  stop_ch[data[len + 2]] | stop_ch[data[len + 3]] |
+		  stop_ch[data[len + 4]] | stop_ch[data[len + 5]] |
+		  stop_ch[data[len + 6]] | stop_ch[data[len + 7]])) {
+		state = state * HASHSIG_HASH_POW8 +
+			data[len] * HASHSIG_HASH_POW7 +
+			data[len + 1] * HASHSIG_HASH_POW6 +
+			data[len + 2] * HASHSIG_HASH_POW5 +
+			data[len + 3] * HASHSIG_HASH_POW4 +
+			data[len + 4] * HASHSIG_HASH_POW3 +
+			data[len + 5] * HASHSIG_HASH_POW2 +
+			data[len + 6] * 31ull +
+			data[len + 7];
+		len += 8;
 	}
+
+	for (; len < max && !stop_ch[data[len]]; len++)
+		HASHSIG_HASH_MIX(state, data[len]);
+
+	*out = state;
+	return len;
 }
 
 static int hashsig_add_hashes(
@@ -164,6 +212,7 @@ static int hashsig_add_hashes(
 	const uint8_t *scan = data, *end = data + size;
 	hashsig_state state = HASHSIG_HASH_START;
 	int use_ignores = prog->use_ignores, len;
+	size_t plain;
 	uint8_t ch;
 
 	while (scan < end) {
@@ -196,6 +245,12 @@ static int hashsig_add_hashes(
 
 			++len;
 			HASHSIG_HASH_MIX(state, ch);
+
+			plain = hashsig_mix_plain(&state, scan,
+				min((size_t)(end - scan), (size_t)(HASHSIG_MAX_RUN - len)),
+				prog->stop_ch[use_ignores]);
+			scan += plain;
+			len += (int)plain;
 		}
 
 		if (len > 0) {
@@ -314,24 +369,123 @@ void git_hashsig_free(git_hashsig *sig)
 	git__free(sig);
 }
 
-static int hashsig_heap_compare(const hashsig_heap *a, const hashsig_heap *b)
+size_t git_hashsig__hashes(
+	uint32_t out[GIT_HASHSIG_MAX_HASHES], const git_hashsig *sig)
 {
-	int matches = 0, i, j, cmp;
+	const hashsig_heap *mins = &sig->mins, *maxs = &sig->maxs;
+	size_t len = 0;
+	int i = 0, j = 0;
+	hashsig_t v;
+
+	/* both are sorted; with few chunks, they hold the same hashes */
+	while (i < mins->size || j < maxs->size) {
+		if (j == maxs->size ||
+			(i < mins->size && mins->values[i] <= maxs->values[j]))
+			v = mins->values[i++];
+		else
+			v = maxs->values[j++];
+
+		if (!len || out[len - 1] != v)
+			out[len++] = v;
+	}
+
+	return len;
+}
 
-	assert(a->cmp == b->cmp);
+/*
+ * The number of lines (64 bits), the number of values of each heap
+ * (8 bits each), and then their values, all in network byte order.
+ */
+#define HASHSIG_HEADER_SIZE 10
 
-	/* hash heaps are sorted - just look for overlap vs total */
+static void hashsig_put_uint32(git_buf *out, uint32_t value)
+{
+	uint32_t v = htonl(value);
+	git_buf_put(out, (const char *)&v, sizeof(v));
+}
 
-	for (i = 0, j = 0; i < a->size && j < b->size; ) {
-		cmp = a->cmp(&a->values[i], &b->values[j], NULL);
+static uint32_t hashsig_get_uint32(const unsigned char *data)
+{
+	uint32_t v;
+	memcpy(&v, data, sizeof(v));
+	return ntohl(v);
+}
 
-		if (cmp < 0)
-			++i;
-		else if (cmp > 0)
-			++j;
-		else {
-			++i; ++j; ++matches;
-		}
+int git_hashsig__write(git_buf *out, const git_hashsig *sig)
+{
+	unsigned char sizes[2];
+	int i;
+
+	hashsig_put_uint32(out, (uint32_t)((uint64_t)sig->lines >> 32));
+	hashsig_put_uint32(out, (uint32_t)sig->lines);
+
+	sizes[0] = (unsigned char)sig->mins.size;
+	sizes[1] = (unsigned char)sig->maxs.size;
+	git_buf_put(out, (const char *)sizes, sizeof(sizes));
+
+	for (i = 0; i < sig->mins.size; i++)
+		hashsig_put_uint32(out, sig->mins.values[i]);
+	for (i = 0; i < sig->maxs.size; i++)
+		hashsig_put_uint32(out, sig->maxs.values[i]);
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+int git_hashsig__read(
+	git_hashsig **out,
+	const unsigned char *data,
+	size_t len,
+	git_hashsig_option_t opts)
+{
+	git_hashsig *sig;
+	uint64_t lines;
+	int mins, maxs, i;
+
+	if (len < HASHSIG_HEADER_SIZE ||
+		(mins = data[8]) > HASHSIG_HEAP_SIZE ||
+		(maxs = data[9]) > HASHSIG_HEAP_SIZE ||
+		len != HASHSIG_HEADER_SIZE + (size_t)(mins + maxs) * sizeof(hashsig_t)) {
+		git_error_set(GIT_ERROR_INVALID, "invalid similarity signature");
+		return -1;
+	}
+
+	lines = ((uint64_t)hashsig_get_uint32(data) << 32) |
+		hashsig_get_uint32(data + 4);
+
+	sig = hashsig_alloc(opts);
+	GIT_ERROR_CHECK_ALLOC(sig);
+
+	sig->lines = (size_t)lines;
+	data += HASHSIG_HEADER_SIZE;
+
+	for (i = 0; i < mins; i++, data += sizeof(hashsig_t))
+		sig->mins.values[i] = hashsig_get_uint32(data);
+	for (i = 0; i < maxs; i++, data += sizeof(hashsig_t))
+		sig->maxs.values[i] = hashsig_get_uint32(data);
+
+	sig->mins.size = mins;
+	sig->maxs.size = maxs;
+
+	*out = sig;
+	return 0;
+}
+
+static int hashsig_heap_compare(const hashsig_heap *a, const hashsig_heap *b)
+{
+	int matches = 0, i = 0, j = 0;
+	hashsig_t av, bv;
+
+	/* hash heaps are sorted - just look for overlap vs total, stepping
+	 * past the smaller value (or both) without a branch on which it is
+	 */
+
+	while (i < a->size && j < b->size) {
+		av = a->values[i];
+		bv = b->values[j];
+
+		matches += (av == bv);
+		i += (av <= bv);
+		j += (av >= bv);
 	}
 
 	return HASHSIG_SCALE * (matches * 2) / (a->size + b->size);
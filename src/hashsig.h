@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_hashsig_h__
+#define INCLUDE_hashsig_h__
+
+#include "common.h"
+
+#include "buffer.h"
+#include "git2/sys/hashsig.h"
+
+/* The hashes that a signature keeps of the smallest and of the largest */
+#define GIT_HASHSIG_SAMPLES ((1 << 7) - 1)
+
+#define GIT_HASHSIG_MAX_HASHES (2 * GIT_HASHSIG_SAMPLES)
+
+/*
+ * Get the distinct hashes that a signature keeps, in ascending order.
+ * Two signatures only compare as similar when they have some of these in
+ * common, or when neither has any.
+ */
+extern size_t git_hashsig__hashes(
+	uint32_t out[GIT_HASHSIG_MAX_HASHES], const git_hashsig *sig);
+
+/*
+ * Write a signature compactly to a buffer, and read it back with the
+ * options it was computed with, for the signature cache.
+ */
+extern int git_hashsig__write(git_buf *out, const git_hashsig *sig);
+
+extern int git_hashsig__read(
+	git_hashsig **out,
+	const unsigned char *data,
+	size_t len,
+	git_hashsig_option_t opts);
+
+#endif
@@ -19,6 +19,8 @@
 #include "blob.h"
 #include "idxmap.h"
 #include "diff.h"
+#include "diff_generate.h"
+#include "fsmonitor.h"
 #include "varint.h"
 
 #include "git2/odb.h"
@@ -69,6 +71,20 @@ static const unsigned int INDEX_HEADER_SIG = 0x44495243;
 static const char INDEX_EXT_TREECACHE_SIG[] = {'T', 'R', 'E', 'E'};
 static const char INDEX_EXT_UNMERGED_SIG[] = {'R', 'E', 'U', 'C'};
 static const char INDEX_EXT_CONFLICT_NAME_SIG[] = {'N', 'A', 'M', 'E'};
+static const char INDEX_EXT_EOIE_SIG[] = {'E', 'O', 'I', 'E'};
+static const char INDEX_EXT_IEOT_SIG[] = {'I', 'E', 'O', 'T'};
+static const char INDEX_EXT_UNTRACKED_SIG[] = {'U', 'N', 'T', 'R'};
+static const char INDEX_EXT_FSMONITOR_SIG[] = {'F', 'S', 'M', 'N'};
+
+#define INDEX_FSMONITOR_VERSION_TIMESTAMP 1
+#define INDEX_FSMONITOR_VERSION_TOKEN 2
+
+/* offset of the first extension and the hash of the extension headers */
+static const size_t INDEX_EOIE_SIZE = 4 + GIT_OID_RAWSZ;
+static const unsigned int INDEX_IEOT_VERSION = 1;
+
+/* number of entries it takes to be worth reading them on another thread */
+static const size_t INDEX_THREAD_COST = 10000;
 
 #define INDEX_OWNER(idx) ((git_repository *)(GIT_REFCOUNT_OWNER(idx)))
 
@@ -83,6 +99,14 @@ struct index_extension {
 	uint32_t extension_size;
 };
 
+/* a block of entries in the index entry offset table */
+struct index_entry_block {
+	size_t offset;
+	size_t end;
+	size_t first;
+	size_t nr;
+};
+
 struct entry_time {
 	uint32_t seconds;
 	uint32_t nanoseconds;
@@ -462,6 +486,9 @@ static void index_free(git_index *index)
 	assert(!git_atomic_get(&index->readers));
 
 	git_index_clear(index);
+	git_untracked_cache_free(index->untracked);
+	git__free(index->fsmonitor_token);
+	git_bitmap_dispose(&index->fsmonitor_dirty);
 	git_idxmap_free(index->entries_map);
 	git_vector_free(&index->entries);
 	git_vector_free(&index->names);
@@ -507,6 +534,7 @@ static int index_remove_entry(git_index *index, size_t pos)
 
 	if (entry != NULL) {
 		git_tree_cache_invalidate_path(index->tree, entry->path);
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 		DELETE_IN_MAP(index, entry);
 	}
 
@@ -527,6 +555,7 @@ static int index_remove_entry(git_index *index, size_t pos)
 
 int git_index_clear(git_index *index)
 {
+	git_untracked_cache *untracked;
 	int error = 0;
 
 	assert(index);
@@ -535,11 +564,17 @@ int git_index_clear(git_index *index)
 	index->tree = NULL;
 	git_pool_clear(&index->tree_pool);
 
+	/* invalidate the untracked cache once, rather than for every entry */
+	untracked = git__swap(index->untracked, NULL);
+
 	git_idxmap_clear(index->entries_map);
 	while (!error && index->entries.length > 0)
 		error = index_remove_entry(index, index->entries.length - 1);
 	index_free_deleted(index);
 
+	index->untracked = untracked;
+	git_untracked_cache_invalidate_all(index->untracked);
+
 	git_index_reuc_clear(index);
 	git_index_name_clear(index);
 
@@ -670,6 +705,13 @@ int git_index_read(git_index *index, int force)
 
 	error = git_index_clear(index);
 
+	/* the new index may not have an untracked cache or fsmonitor token */
+	git_untracked_cache_free(index->untracked);
+	index->untracked = NULL;
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = NULL;
+	index->fsmonitor_changed = 0;
+
 	if (!error)
 		error = parse_index(index, buffer.ptr, buffer.size);
 
@@ -747,7 +789,8 @@ static int truncate_racily_clean(git_index *index)
 	diff_opts.pathspec.count = paths.length;
 	diff_opts.pathspec.strings = (char **)paths.contents;
 
-	if ((error = git_diff_index_to_workdir(&diff, INDEX_OWNER(index), index, &diff_opts)) < 0)
+	/* asking the filesystem monitor on every write would be wasteful */
+	if ((error = git_diff__index_to_workdir(&diff, INDEX_OWNER(index), index, &diff_opts, false)) < 0)
 		return error;
 
 	git_vector_foreach(&diff->deltas, i, delta) {
@@ -1403,6 +1446,9 @@ static int index_insert(
 			goto out;
 
 		INSERT_IN_MAP(index, entry, error);
+
+		/* the path is no longer untracked */
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 	}
 
 	index->dirty = 1;
@@ -1640,6 +1686,7 @@ int git_index__fill(git_index *index, const git_vector *source_entries)
 		if (ret < 0)
 			break;
 
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 		index->dirty = 1;
 	}
 
@@ -2385,6 +2432,77 @@ out_err:
 	return 0;
 }
 
+/*
+ * Read the filesystem monitor's token and the entries that it did not
+ * vouch for.  The entries are flagged once they have been read; an
+ * extension that we do not understand is ignored, so that all the
+ * entries are examined.
+ */
+static int read_fsmonitor(git_index *index, const char *buffer, size_t size)
+{
+	const char *end = buffer + size;
+	char *token = NULL;
+	uint32_t version, ewah_size, timestamp[2];
+	size_t len, consumed;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = NULL;
+	git_bitmap_clear(&index->fsmonitor_dirty);
+
+	if (size < sizeof(uint32_t))
+		return 0;
+
+	memcpy(&version, buffer, sizeof(uint32_t));
+	version = ntohl(version);
+	buffer += sizeof(uint32_t);
+
+	if (version == INDEX_FSMONITOR_VERSION_TIMESTAMP) {
+		if ((size_t)(end - buffer) < sizeof(uint64_t))
+			return 0;
+
+		memcpy(timestamp, buffer, sizeof(uint64_t));
+		buffer += sizeof(uint64_t);
+
+		/* version 1 has the time of the last query, in nanoseconds */
+		token = git__malloc(GIT_FSMONITOR_TIMESTAMP_LEN);
+		GIT_ERROR_CHECK_ALLOC(token);
+		p_snprintf(token, GIT_FSMONITOR_TIMESTAMP_LEN, "%"PRIu64,
+			((uint64_t)ntohl(timestamp[0])) << 32 | ntohl(timestamp[1]));
+	} else if (version == INDEX_FSMONITOR_VERSION_TOKEN) {
+		if ((len = p_strnlen(buffer, end - buffer)) == (size_t)(end - buffer))
+			return 0;
+
+		token = git__strndup(buffer, len);
+		GIT_ERROR_CHECK_ALLOC(token);
+		buffer += len + 1;
+	} else {
+		return 0;
+	}
+
+	if ((size_t)(end - buffer) < sizeof(uint32_t))
+		goto invalid;
+
+	memcpy(&ewah_size, buffer, sizeof(uint32_t));
+	ewah_size = ntohl(ewah_size);
+	buffer += sizeof(uint32_t);
+
+	if (ewah_size > (size_t)(end - buffer) ||
+	    git_ewah_read(&index->fsmonitor_dirty, &consumed,
+			(const unsigned char *)buffer, ewah_size) < 0 ||
+	    consumed != ewah_size) {
+		git_error_clear();
+		git_bitmap_clear(&index->fsmonitor_dirty);
+		goto invalid;
+	}
+
+	index->fsmonitor_token = token;
+	return 0;
+
+invalid:
+	git__free(token);
+	return 0;
+}
+
 static size_t index_entry_size(size_t path_len, size_t varint_len, uint32_t flags)
 {
 	if (varint_len) {
@@ -2471,13 +2589,17 @@ static int read_entry(
 		size_t varint_len, last_len, prefix_len, suffix_len, path_len;
 		uintmax_t strip_len;
 
+		/*
+		 * The first entry of an IEOT block is read without the
+		 * preceding one (`last` is NULL); it shares no prefix with it.
+		 */
 		strip_len = git_decode_varint((const unsigned char *)path_ptr, &varint_len);
-		last_len = strlen(last);
+		last_len = last ? strlen(last) : 0;
 
-		if (varint_len == 0 || last_len < strip_len)
+		if (varint_len == 0 || (last && last_len < strip_len))
 			return index_error_invalid("incorrect prefix length");
 
-		prefix_len = last_len - (size_t)strip_len;
+		prefix_len = last ? last_len - (size_t)strip_len : 0;
 		suffix_len = strlen(path_ptr + varint_len);
 
 		GIT_ERROR_CHECK_ALLOC_ADD(&path_len, prefix_len, suffix_len);
@@ -2489,7 +2611,8 @@ static int read_entry(
 		tmp_path = git__malloc(path_len);
 		GIT_ERROR_CHECK_ALLOC(tmp_path);
 
-		memcpy(tmp_path, last, prefix_len);
+		if (prefix_len)
+			memcpy(tmp_path, last, prefix_len);
 		memcpy(tmp_path + prefix_len, path_ptr + varint_len, suffix_len + 1);
 		entry_size = index_entry_size(suffix_len, varint_len, entry.flags);
 		entry.path = tmp_path;
@@ -2558,6 +2681,14 @@ static int read_extension(size_t *read_len, git_index *index, const char *buffer
 		} else if (memcmp(dest.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4) == 0) {
 			if (read_conflict_names(index, buffer + 8, dest.extension_size) < 0)
 				return -1;
+		} else if (memcmp(dest.signature, INDEX_EXT_UNTRACKED_SIG, 4) == 0) {
+			git_untracked_cache_free(index->untracked);
+
+			if (git_untracked_cache_read(&index->untracked, buffer + 8, dest.extension_size) < 0)
+				return -1;
+		} else if (memcmp(dest.signature, INDEX_EXT_FSMONITOR_SIG, 4) == 0) {
+			if (read_fsmonitor(index, buffer + 8, dest.extension_size) < 0)
+				return -1;
 		}
 		/* else, unsupported extension. We cannot parse this, but we can skip
 		 * it by returning `total_size */
@@ -2573,39 +2704,417 @@ static int read_extension(size_t *read_len, git_index *index, const char *buffer
 	return 0;
 }
 
+static int read_extensions(git_index *index, const char *buffer, size_t buffer_size)
+{
+	size_t extension_size;
+
+	while (buffer_size > INDEX_FOOTER_SIZE) {
+		if (read_extension(&extension_size, index, buffer, buffer_size) < 0)
+			return -1;
+
+		if (extension_size >= buffer_size)
+			return index_error_invalid("ran out of data while parsing");
+
+		buffer += extension_size;
+		buffer_size -= extension_size;
+	}
+
+	if (buffer_size != INDEX_FOOTER_SIZE)
+		return index_error_invalid("buffer size does not match index footer size");
+
+	return 0;
+}
+
+/*
+ * Read `nr` entries into `entries`. For index v4, `last` is the path
+ * the first entry is compressed against.
+ */
+static int read_entries(
+	size_t *read_len,
+	git_index_entry **entries,
+	size_t nr,
+	git_index *index,
+	const char *buffer,
+	size_t buffer_size,
+	const char *last)
+{
+	size_t i, entry_size, total = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (buffer_size <= INDEX_FOOTER_SIZE)
+			return index_error_invalid("header entries changed while parsing");
+
+		if (read_entry(&entries[i], &entry_size, index, buffer, buffer_size, last) < 0)
+			return index_error_invalid("invalid entry");
+
+		if (index->version >= INDEX_VERSION_NUMBER_COMP)
+			last = entries[i]->path;
+
+		if (entry_size >= buffer_size)
+			return index_error_invalid("ran out of data while parsing");
+
+		buffer += entry_size;
+		buffer_size -= entry_size;
+		total += entry_size;
+	}
+
+	*read_len = total;
+	return 0;
+}
+
+/*
+ * Find the End Of Index Entries extension, which must be the last one,
+ * and return the offset of the first extension that it records. Returns
+ * 0 if there is no valid EOIE extension.
+ */
+static size_t read_eoie(const char *buffer, size_t buffer_size)
+{
+	struct index_extension extension;
+	const char *eoie;
+	git_hash_ctx ctx;
+	git_oid expected, actual;
+	size_t offset, pos, end;
+	uint32_t raw;
+
+	if (buffer_size < INDEX_HEADER_SIZE + sizeof(struct index_extension) +
+	    INDEX_EOIE_SIZE + INDEX_FOOTER_SIZE)
+		return 0;
+
+	end = buffer_size - INDEX_FOOTER_SIZE - INDEX_EOIE_SIZE - sizeof(struct index_extension);
+	eoie = buffer + end;
+
+	memcpy(&extension, eoie, sizeof(extension));
+	if (memcmp(extension.signature, INDEX_EXT_EOIE_SIG, 4) != 0 ||
+	    ntohl(extension.extension_size) != INDEX_EOIE_SIZE)
+		return 0;
+
+	memcpy(&raw, eoie + sizeof(extension), sizeof(raw));
+	offset = ntohl(raw);
+	git_oid_fromraw(&expected, (const unsigned char *)eoie + sizeof(extension) + sizeof(raw));
+
+	if (offset < INDEX_HEADER_SIZE || offset > end)
+		return 0;
+
+	/* The hash covers the header of every extension before the EOIE */
+	if (git_hash_ctx_init(&ctx) < 0) {
+		git_error_clear();
+		return 0;
+	}
+
+	for (pos = offset; pos < end; pos += sizeof(extension) + ntohl(extension.extension_size)) {
+		if (end - pos < sizeof(extension))
+			break;
+
+		memcpy(&extension, buffer + pos, sizeof(extension));
+		if (ntohl(extension.extension_size) > end - pos - sizeof(extension) ||
+		    git_hash_update(&ctx, &extension, sizeof(extension)) < 0)
+			break;
+	}
+
+	if (pos != end || git_hash_final(&actual, &ctx) < 0 ||
+	    git_oid__cmp(&expected, &actual) != 0)
+		offset = 0;
+
+	git_hash_ctx_cleanup(&ctx);
+	git_error_clear();
+	return offset;
+}
+
+static unsigned int index_read_threads(git_index *index, size_t entry_count)
+{
+	int threads = GIT_INDEXTHREADS_UNSET;
+	int cpus;
+
+#ifdef GIT_THREADS
+	if (INDEX_OWNER(index) &&
+	    git_repository__cvar(&threads, INDEX_OWNER(index), GIT_CVAR_INDEXTHREADS) < 0) {
+		git_error_clear();
+		threads = GIT_INDEXTHREADS_UNSET;
+	}
+
+	if (threads <= 0) {
+		threads = (int)min(entry_count / INDEX_THREAD_COST, INT_MAX);
+
+		if ((cpus = git_online_cpus()) < threads)
+			threads = cpus;
+	}
+#else
+	GIT_UNUSED(index);
+	GIT_UNUSED(entry_count);
+	GIT_UNUSED(cpus);
+#endif
+
+	return threads > 1 ? (unsigned int)threads : 1;
+}
+
+#ifdef GIT_THREADS
+
+/*
+ * Find the Index Entry Offset Table among the extensions starting at
+ * `extensions`, and check that it describes the entries. Returns 0 if
+ * there is no usable IEOT extension.
+ */
+static size_t read_ieot(
+	struct index_entry_block **out,
+	const char *buffer,
+	size_t buffer_size,
+	size_t extensions,
+	size_t entry_count)
+{
+	struct index_extension extension;
+	struct index_entry_block *blocks;
+	const char *data;
+	size_t pos, size, nr_blocks, i, first = 0;
+	uint32_t raw[2];
+
+	for (pos = extensions; buffer_size - pos > sizeof(extension) + INDEX_FOOTER_SIZE; pos += size) {
+		memcpy(&extension, buffer + pos, sizeof(extension));
+		size = sizeof(extension) + ntohl(extension.extension_size);
+
+		if (size > buffer_size - pos)
+			return 0;
+
+		if (memcmp(extension.signature, INDEX_EXT_IEOT_SIG, 4) == 0)
+			break;
+	}
+
+	if (buffer_size - pos <= sizeof(extension) + INDEX_FOOTER_SIZE)
+		return 0;
+
+	size = ntohl(extension.extension_size);
+	data = buffer + pos + sizeof(extension);
+
+	if (size < sizeof(uint32_t) || (size - sizeof(uint32_t)) % sizeof(raw) != 0)
+		return 0;
+
+	memcpy(&raw[0], data, sizeof(uint32_t));
+	if (ntohl(raw[0]) != INDEX_IEOT_VERSION)
+		return 0;
+
+	data += sizeof(uint32_t);
+	nr_blocks = (size - sizeof(uint32_t)) / sizeof(raw);
+
+	if (!nr_blocks || (blocks = git__calloc(nr_blocks, sizeof(*blocks))) == NULL) {
+		git_error_clear();
+		return 0;
+	}
+
+	for (i = 0; i < nr_blocks; i++, data += sizeof(raw)) {
+		memcpy(raw, data, sizeof(raw));
+		blocks[i].offset = ntohl(raw[0]);
+		blocks[i].nr = ntohl(raw[1]);
+		blocks[i].first = first;
+		first += blocks[i].nr;
+
+		if (i > 0)
+			blocks[i - 1].end = blocks[i].offset;
+	}
+	blocks[nr_blocks - 1].end = extensions;
+
+	/* The blocks must cover every entry, in order */
+	for (i = 0; i < nr_blocks; i++) {
+		if (blocks[i].end <= blocks[i].offset || !blocks[i].nr ||
+		    (i == 0 && blocks[i].offset != INDEX_HEADER_SIZE)) {
+			git__free(blocks);
+			return 0;
+		}
+	}
+
+	if (first != entry_count) {
+		git__free(blocks);
+		return 0;
+	}
+
+	*out = blocks;
+	return nr_blocks;
+}
+
+struct entries_thread {
+	git_thread thread;
+	git_index *index;
+	const char *buffer;
+	size_t buffer_size;
+	git_index_entry **entries;
+	struct index_entry_block *blocks;
+	size_t nr_blocks;
+	int error;
+	git_error_state error_state;
+};
+
+static void *read_entries_thread(void *payload)
+{
+	struct entries_thread *data = payload;
+	struct index_entry_block *block;
+	size_t i, read_len;
+
+	for (i = 0; i < data->nr_blocks; i++) {
+		block = &data->blocks[i];
+
+		if ((data->error = read_entries(&read_len,
+				data->entries + block->first, block->nr, data->index,
+				data->buffer + block->offset,
+				data->buffer_size - block->offset, NULL)) < 0)
+			break;
+
+		if (read_len != block->end - block->offset) {
+			data->error = index_error_invalid("entries do not match the offset table");
+			break;
+		}
+	}
+
+	if (data->error < 0)
+		git_error_state_capture(&data->error_state, data->error);
+
+	return NULL;
+}
+
+struct extensions_thread {
+	git_thread thread;
+	git_index *index;
+	const char *buffer;
+	size_t buffer_size;
+	size_t offset;
+	git_oid checksum;
+	int error;
+	git_error_state error_state;
+};
+
+static void *read_extensions_thread(void *payload)
+{
+	struct extensions_thread *data = payload;
+
+	data->error = read_extensions(data->index,
+		data->buffer + data->offset, data->buffer_size - data->offset);
+
+	if (!data->error)
+		data->error = git_hash_buf(&data->checksum,
+			data->buffer, data->buffer_size - INDEX_FOOTER_SIZE);
+
+	if (data->error < 0)
+		git_error_state_capture(&data->error_state, data->error);
+
+	return NULL;
+}
+
+/*
+ * Read the extensions on their own thread while the entries are read,
+ * split across threads along the blocks of the offset table if there
+ * is one.
+ */
+static int read_index_threaded(
+	git_oid *checksum,
+	git_index_entry **entries,
+	git_index *index,
+	const char *buffer,
+	size_t buffer_size,
+	size_t entry_count,
+	size_t extensions,
+	unsigned int nr_threads)
+{
+	struct extensions_thread ext = {0};
+	struct entries_thread *threads = NULL;
+	struct index_entry_block *blocks = NULL, whole;
+	size_t nr_blocks, nr_entry_threads, i, first_block = 0;
+	int error = 0;
+
+	ext.index = index;
+	ext.buffer = buffer;
+	ext.buffer_size = buffer_size;
+	ext.offset = extensions;
+
+	/* The first thread is the one we're running on */
+	nr_blocks = read_ieot(&blocks, buffer, buffer_size, extensions, entry_count);
+	if (!nr_blocks) {
+		whole.offset = INDEX_HEADER_SIZE;
+		whole.end = extensions;
+		whole.first = 0;
+		whole.nr = entry_count;
+		nr_blocks = 1;
+	}
+
+	nr_entry_threads = min(nr_blocks, max(nr_threads - 1, 1));
+	threads = git__calloc(nr_entry_threads, sizeof(*threads));
+	GIT_ERROR_CHECK_ALLOC(threads);
+
+	for (i = 0; i < nr_entry_threads; i++) {
+		size_t next_block = nr_blocks * (i + 1) / nr_entry_threads;
+
+		threads[i].index = index;
+		threads[i].buffer = buffer;
+		threads[i].buffer_size = buffer_size;
+		threads[i].entries = entries;
+		threads[i].blocks = blocks ? blocks + first_block : &whole;
+		threads[i].nr_blocks = next_block - first_block;
+
+		first_block = next_block;
+	}
+
+	/*
+	 * If a thread cannot be started, the index is read again from the
+	 * start on this thread.
+	 */
+	if (git_thread_create(&ext.thread, read_extensions_thread, &ext) != 0) {
+		error = GIT_PASSTHROUGH;
+		goto done;
+	}
+
+	for (i = 1; i < nr_entry_threads; i++) {
+		if (git_thread_create(&threads[i].thread, read_entries_thread, &threads[i]) != 0) {
+			error = GIT_PASSTHROUGH;
+			nr_entry_threads = i;
+			break;
+		}
+	}
+
+	if (!error)
+		read_entries_thread(&threads[0]);
+
+	for (i = 1; i < nr_entry_threads; i++)
+		git_thread_join(&threads[i].thread, NULL);
+
+	git_thread_join(&ext.thread, NULL);
+
+	for (i = 0; i < nr_entry_threads && !error; i++) {
+		if ((error = threads[i].error) < 0)
+			git_error_state_restore(&threads[i].error_state);
+	}
+
+	if (!error && (error = ext.error) < 0)
+		git_error_state_restore(&ext.error_state);
+
+	git_oid_cpy(checksum, &ext.checksum);
+
+done:
+	for (i = 0; i < nr_entry_threads; i++)
+		git_error_state_free(&threads[i].error_state);
+	git_error_state_free(&ext.error_state);
+	git__free(threads);
+	git__free(blocks);
+	return error;
+}
+
+#endif
+
 static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 {
 	int error = 0;
-	unsigned int i;
+	size_t i, entries_size = 0, extensions = 0;
 	struct index_header header = { 0 };
 	git_oid checksum_calculated, checksum_expected;
-	const char *last = NULL;
-	const char *empty = "";
-
-#define seek_forward(_increase) { \
-	if (_increase >= buffer_size) { \
-		error = index_error_invalid("ran out of data while parsing"); \
-		goto done; } \
-	buffer += _increase; \
-	buffer_size -= _increase;\
-}
+	git_index_entry **entries = NULL;
+	unsigned int nr_threads;
+#ifdef GIT_THREADS
+	int protect;
+#endif
 
 	if (buffer_size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE)
 		return index_error_invalid("insufficient buffer space");
 
-	/* Precalculate the SHA1 of the files's contents -- we'll match it to
-	 * the provided SHA1 in the footer */
-	git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
-
 	/* Parse header */
 	if ((error = read_header(&header, buffer)) < 0)
 		return error;
 
 	index->version = header.version;
-	if (index->version >= INDEX_VERSION_NUMBER_COMP)
-		last = empty;
-
-	seek_forward(INDEX_HEADER_SIZE);
 
 	assert(!index->entries.length);
 
@@ -2616,59 +3125,88 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 	else if ((error = git_idxmap_resize(index->entries_map, header.entry_count)) < 0)
 		return error;
 
-	/* Parse all the entries */
-	for (i = 0; i < header.entry_count && buffer_size > INDEX_FOOTER_SIZE; ++i) {
-		git_index_entry *entry = NULL;
-		size_t entry_size;
+	if ((error = git_vector_size_hint(&index->entries, header.entry_count)) < 0)
+		return error;
 
-		if ((error = read_entry(&entry, &entry_size, index, buffer, buffer_size, last)) < 0) {
-			error = index_error_invalid("invalid entry");
-			goto done;
-		}
+	if (header.entry_count) {
+		entries = git__calloc(header.entry_count, sizeof(git_index_entry *));
+		GIT_ERROR_CHECK_ALLOC(entries);
+	}
 
-		if ((error = git_vector_insert(&index->entries, entry)) < 0) {
-			index_entry_free(entry);
+	nr_threads = index_read_threads(index, header.entry_count);
+
+	if (nr_threads > 1)
+		extensions = read_eoie(buffer, buffer_size);
+
+#ifdef GIT_THREADS
+	if (extensions) {
+		/*
+		 * Validating entry paths may look up configuration in the
+		 * repository; load it before there are threads to race on it.
+		 */
+		if (INDEX_OWNER(index) &&
+		    ((error = git_repository__cvar(&protect, INDEX_OWNER(index), GIT_CVAR_PROTECTHFS)) < 0 ||
+		     (error = git_repository__cvar(&protect, INDEX_OWNER(index), GIT_CVAR_PROTECTNTFS)) < 0))
 			goto done;
-		}
 
-		INSERT_IN_MAP(index, entry, error);
+		error = read_index_threaded(&checksum_calculated, entries, index,
+			buffer, buffer_size, header.entry_count, extensions, nr_threads);
 
-		if (error < 0) {
-			index_entry_free(entry);
+		if (error == GIT_PASSTHROUGH) {
+			for (i = 0; i < header.entry_count; i++) {
+				index_entry_free(entries[i]);
+				entries[i] = NULL;
+			}
+
+			index->tree = NULL;
+			git_pool_clear(&index->tree_pool);
+			git_index_reuc_clear(index);
+			git_index_name_clear(index);
+			git_untracked_cache_free(index->untracked);
+			index->untracked = NULL;
+			git__free(index->fsmonitor_token);
+			index->fsmonitor_token = NULL;
+			git_bitmap_dispose(&index->fsmonitor_dirty);
+			extensions = 0;
+		} else if (error < 0) {
 			goto done;
 		}
-		error = 0;
+	}
+#endif
 
-		if (index->version >= INDEX_VERSION_NUMBER_COMP)
-			last = entry->path;
+	if (!extensions) {
+		/* Precalculate the SHA1 of the files's contents -- we'll match it to
+		 * the provided SHA1 in the footer */
+		git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
 
-		seek_forward(entry_size);
+		if ((error = read_entries(&entries_size, entries, header.entry_count, index,
+				buffer + INDEX_HEADER_SIZE, buffer_size - INDEX_HEADER_SIZE, "")) < 0 ||
+		    (error = read_extensions(index, buffer + INDEX_HEADER_SIZE + entries_size,
+				buffer_size - INDEX_HEADER_SIZE - entries_size)) < 0)
+			goto done;
 	}
 
-	if (i != header.entry_count) {
-		error = index_error_invalid("header entries changed while parsing");
-		goto done;
-	}
+	for (i = 0; i < header.entry_count; i++) {
+		/* the filesystem monitor vouches for the entries not marked dirty */
+		if (index->fsmonitor_token &&
+		    !git_bitmap_get(&index->fsmonitor_dirty, i))
+			entries[i]->flags_extended |= GIT_INDEX_ENTRY_FSMONITOR_VALID;
 
-	/* There's still space for some extensions! */
-	while (buffer_size > INDEX_FOOTER_SIZE) {
-		size_t extension_size;
+		if ((error = git_vector_insert(&index->entries, entries[i])) < 0)
+			goto done;
+
+		INSERT_IN_MAP(index, entries[i], error);
 
-		if ((error = read_extension(&extension_size, index, buffer, buffer_size)) < 0) {
+		if (error < 0) {
+			git_vector_pop(&index->entries);
 			goto done;
 		}
 
-		seek_forward(extension_size);
-	}
-
-	if (buffer_size != INDEX_FOOTER_SIZE) {
-		error = index_error_invalid(
-			"buffer size does not match index footer size");
-		goto done;
+		entries[i] = NULL;
 	}
 
 	/* 160-bit SHA-1 over the content of the index file before this checksum. */
-	git_oid_fromraw(&checksum_expected, (const unsigned char *)buffer);
+	git_oid_fromraw(&checksum_expected, (const unsigned char *)buffer + buffer_size - INDEX_FOOTER_SIZE);
 
 	if (git_oid__cmp(&checksum_calculated, &checksum_expected) != 0) {
 		error = index_error_invalid(
@@ -2678,8 +3216,6 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 
 	git_oid_cpy(&index->checksum, &checksum_calculated);
 
-#undef seek_forward
-
 	/* Entries are stored case-sensitively on disk, so re-sort now if
 	 * in-memory index is supposed to be case-insensitive
 	 */
@@ -2688,6 +3224,14 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 
 	index->dirty = 0;
 done:
+	git_bitmap_dispose(&index->fsmonitor_dirty);
+
+	if (entries) {
+		for (i = 0; i < header.entry_count; i++)
+			index_entry_free(entries[i]);
+		git__free(entries);
+	}
+
 	return error;
 }
 
@@ -2709,7 +3253,17 @@ static bool is_index_extended(git_index *index)
 	return (extended > 0);
 }
 
-static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const char *last)
+/*
+ * For index v4, `last` is the path of the previous entry, and `share`
+ * is whether this entry's path may be compressed against it; the
+ * first entry of an IEOT block shares no prefix with the one before.
+ */
+static int write_disk_entry(
+	size_t *out_size,
+	git_filebuf *file,
+	git_index_entry *entry,
+	const char *last,
+	bool share)
 {
 	void *mem = NULL;
 	struct entry_short ondisk;
@@ -2717,14 +3271,14 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 	int varint_len = 0;
 	char *path;
 	const char *path_start = entry->path;
-	size_t same_len = 0;
+	size_t same_len = 0, strip_len = 0;
 
 	path_len = ((struct entry_internal *)entry)->pathlen;
 
 	if (last) {
 		const char *last_c = last;
 
-		while (*path_start == *last_c) {
+		while (share && *path_start == *last_c) {
 			if (!*path_start || !*last_c)
 				break;
 			++path_start;
@@ -2732,10 +3286,14 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 			++same_len;
 		}
 		path_len -= same_len;
-		varint_len = git_encode_varint(NULL, 0, same_len);
+
+		/* the number of bytes to remove from the end of `last` */
+		strip_len = strlen(last) - same_len;
+		varint_len = git_encode_varint(NULL, 0, strip_len);
 	}
 
 	disk_size = index_entry_size(path_len, varint_len, entry->flags);
+	*out_size = disk_size;
 
 	if (git_filebuf_reserve(file, &mem, disk_size) < 0)
 		return -1;
@@ -2783,7 +3341,7 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 
 	if (last) {
 		varint_len = git_encode_varint((unsigned char *) path,
-					  disk_size, same_len);
+					  disk_size, strip_len);
 		assert(varint_len > 0);
 		path += varint_len;
 		disk_size -= varint_len;
@@ -2807,13 +3365,25 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 	return 0;
 }
 
-static int write_entries(git_index *index, git_filebuf *file)
+/*
+ * Write the entries; when `blocks` is given, they are split into
+ * `nr_blocks` blocks of about the same size whose offsets are recorded
+ * for the IEOT extension.
+ */
+static int write_entries(
+	size_t *entries_end,
+	struct index_entry_block *blocks,
+	size_t nr_blocks,
+	git_index *index,
+	git_filebuf *file)
 {
 	int error = 0;
-	size_t i;
+	size_t i, block = 0, block_size = 0, entry_size;
+	size_t offset = INDEX_HEADER_SIZE;
 	git_vector case_sorted, *entries;
 	git_index_entry *entry;
 	const char *last = NULL;
+	bool block_start;
 
 	/* If index->entries is sorted case-insensitively, then we need
 	 * to re-sort it case-sensitively before writing */
@@ -2828,20 +3398,40 @@ static int write_entries(git_index *index, git_filebuf *file)
 	if (index->version >= INDEX_VERSION_NUMBER_COMP)
 		last = "";
 
+	if (blocks)
+		block_size = (entries->length + nr_blocks - 1) / nr_blocks;
+
 	git_vector_foreach(entries, i, entry) {
-		if ((error = write_disk_entry(file, entry, last)) < 0)
+		block_start = blocks && i % block_size == 0;
+
+		if (block_start) {
+			blocks[block].offset = offset;
+			blocks[block].first = i;
+			blocks[block].nr = min(block_size, entries->length - i);
+			block++;
+		}
+
+		if ((error = write_disk_entry(&entry_size, file, entry, last, !block_start)) < 0)
 			break;
 		if (index->version >= INDEX_VERSION_NUMBER_COMP)
 			last = entry->path;
+
+		offset += entry_size;
 	}
 
 	if (index->ignore_case)
 		git_vector_free(&case_sorted);
 
+	*entries_end = offset;
 	return error;
 }
 
-static int write_extension(git_filebuf *file, struct index_extension *header, git_buf *data)
+/* The on-disk header of the extension is added to `eoie` if given */
+static int write_extension(
+	git_filebuf *file,
+	git_hash_ctx *eoie,
+	struct index_extension *header,
+	git_buf *data)
 {
 	struct index_extension ondisk;
 
@@ -2849,6 +3439,9 @@ static int write_extension(git_filebuf *file, struct index_extension *header, gi
 	memcpy(&ondisk, header, 4);
 	ondisk.extension_size = htonl(header->extension_size);
 
+	if (eoie && git_hash_update(eoie, &ondisk, sizeof(struct index_extension)) < 0)
+		return -1;
+
 	git_filebuf_write(file, &ondisk, sizeof(struct index_extension));
 	return git_filebuf_write(file, data->ptr, data->size);
 }
@@ -2882,7 +3475,7 @@ on_error:
 	return error;
 }
 
-static int write_name_extension(git_index *index, git_filebuf *file)
+static int write_name_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
 {
 	git_buf name_buf = GIT_BUF_INIT;
 	git_vector *out = &index->names;
@@ -2900,7 +3493,7 @@ static int write_name_extension(git_index *index, git_filebuf *file)
 	memcpy(&extension.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4);
 	extension.extension_size = (uint32_t)name_buf.size;
 
-	error = write_extension(file, &extension, &name_buf);
+	error = write_extension(file, eoie, &extension, &name_buf);
 
 	git_buf_dispose(&name_buf);
 
@@ -2930,7 +3523,7 @@ static int create_reuc_extension_data(git_buf *reuc_buf, git_index_reuc_entry *r
 	return 0;
 }
 
-static int write_reuc_extension(git_index *index, git_filebuf *file)
+static int write_reuc_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
 {
 	git_buf reuc_buf = GIT_BUF_INIT;
 	git_vector *out = &index->reuc;
@@ -2948,7 +3541,7 @@ static int write_reuc_extension(git_index *index, git_filebuf *file)
 	memcpy(&extension.signature, INDEX_EXT_UNMERGED_SIG, 4);
 	extension.extension_size = (uint32_t)reuc_buf.size;
 
-	error = write_extension(file, &extension, &reuc_buf);
+	error = write_extension(file, eoie, &extension, &reuc_buf);
 
 	git_buf_dispose(&reuc_buf);
 
@@ -2956,7 +3549,7 @@ done:
 	return error;
 }
 
-static int write_tree_extension(git_index *index, git_filebuf *file)
+static int write_tree_extension(git_index *index, git_filebuf *file, git_hash_ctx *eoie)
 {
 	struct index_extension extension;
 	git_buf buf = GIT_BUF_INIT;
@@ -2972,13 +3565,206 @@ static int write_tree_extension(git_index *index, git_filebuf *file)
 	memcpy(&extension.signature, INDEX_EXT_TREECACHE_SIG, 4);
 	extension.extension_size = (uint32_t)buf.size;
 
-	error = write_extension(file, &extension, &buf);
+	error = write_extension(file, eoie, &extension, &buf);
 
 	git_buf_dispose(&buf);
 
 	return error;
 }
 
+static int write_untracked_extension(
+	git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_untracked_cache_write(&buf, index->untracked)) < 0)
+		return error;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_UNTRACKED_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, eoie, &extension, &buf);
+
+	git_buf_dispose(&buf);
+
+	return error;
+}
+
+static int write_fsmonitor_extension(
+	git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	struct index_extension extension;
+	git_vector case_sorted = GIT_VECTOR_INIT, *entries;
+	git_bitmap dirty = GIT_BITMAP_INIT;
+	git_buf buf = GIT_BUF_INIT;
+	git_index_entry *entry;
+	uint32_t version, ewah_size;
+	size_t i, ewah_offset;
+	int error = 0;
+
+	/* the bitmap follows the order of the entries on disk */
+	if (index->ignore_case) {
+		if ((error = git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp)) < 0)
+			return error;
+
+		git_vector_sort(&case_sorted);
+		entries = &case_sorted;
+	} else {
+		entries = &index->entries;
+	}
+
+	git_vector_foreach(entries, i, entry) {
+		if ((entry->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID) == 0 &&
+		    (error = git_bitmap_set(&dirty, i)) < 0)
+			goto done;
+	}
+
+	version = htonl(INDEX_FSMONITOR_VERSION_TOKEN);
+	git_buf_put(&buf, (const char *)&version, sizeof(uint32_t));
+	git_buf_put(&buf, index->fsmonitor_token, strlen(index->fsmonitor_token) + 1);
+
+	/* the size of the bitmap precedes it */
+	ewah_offset = buf.size;
+	git_buf_put(&buf, (const char *)&ewah_size, sizeof(uint32_t));
+
+	if (git_buf_oom(&buf) ||
+	    (error = git_ewah_write(&buf, &dirty, entries->length)) < 0) {
+		error = -1;
+		goto done;
+	}
+
+	ewah_size = htonl((uint32_t)(buf.size - ewah_offset - sizeof(uint32_t)));
+	memcpy(buf.ptr + ewah_offset, &ewah_size, sizeof(uint32_t));
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_FSMONITOR_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, eoie, &extension, &buf);
+
+done:
+	git_vector_free(&case_sorted);
+	git_bitmap_dispose(&dirty);
+	git_buf_dispose(&buf);
+	return error;
+}
+
+static int write_ieot_extension(
+	git_filebuf *file,
+	git_hash_ctx *eoie,
+	struct index_entry_block *blocks,
+	size_t nr_blocks)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	uint32_t raw;
+	size_t i;
+	int error;
+
+	raw = htonl(INDEX_IEOT_VERSION);
+	git_buf_put(&buf, (const char *)&raw, sizeof(raw));
+
+	for (i = 0; i < nr_blocks; i++) {
+		raw = htonl((uint32_t)blocks[i].offset);
+		git_buf_put(&buf, (const char *)&raw, sizeof(raw));
+		raw = htonl((uint32_t)blocks[i].nr);
+		git_buf_put(&buf, (const char *)&raw, sizeof(raw));
+	}
+
+	if (git_buf_oom(&buf))
+		return -1;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_IEOT_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, eoie, &extension, &buf);
+
+	git_buf_dispose(&buf);
+
+	return error;
+}
+
+static int write_eoie_extension(
+	git_filebuf *file,
+	git_hash_ctx *eoie,
+	size_t entries_end)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	git_oid hash;
+	uint32_t raw = htonl((uint32_t)entries_end);
+	int error;
+
+	if (git_hash_final(&hash, eoie) < 0)
+		return -1;
+
+	git_buf_put(&buf, (const char *)&raw, sizeof(raw));
+	git_buf_put(&buf, (const char *)hash.id, GIT_OID_RAWSZ);
+
+	if (git_buf_oom(&buf))
+		return -1;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_EOIE_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, NULL, &extension, &buf);
+
+	git_buf_dispose(&buf);
+
+	return error;
+}
+
+/*
+ * Whether to record an EOIE or IEOT extension; unless configured, they
+ * are recorded when the index is configured to be read with threads.
+ */
+static bool index_record_extension(git_index *index, git_cvar_cached cvar)
+{
+	git_repository *repo = INDEX_OWNER(index);
+	int record, threads;
+
+	if (!repo)
+		return false;
+
+	if (git_repository__cvar(&record, repo, cvar) < 0 ||
+	    git_repository__cvar(&threads, repo, GIT_CVAR_INDEXTHREADS) < 0) {
+		git_error_clear();
+		return false;
+	}
+
+	if (record != GIT_INDEXRECORD_UNSET)
+		return !!record;
+
+	return threads != GIT_INDEXTHREADS_UNSET && threads != 1;
+}
+
+/* The number of blocks to split the entries into for the IEOT extension */
+static size_t index_write_blocks(git_index *index)
+{
+	int threads = GIT_INDEXTHREADS_UNSET;
+	size_t blocks;
+
+	if (!index_record_extension(index, GIT_CVAR_INDEXRECORDIEOT) ||
+	    git_repository__cvar(&threads, INDEX_OWNER(index), GIT_CVAR_INDEXTHREADS) < 0)
+		return 0;
+
+	if (threads > 0) {
+		blocks = (size_t)threads;
+	} else {
+		/* one thread of the reader is busy with the extensions */
+		blocks = min(index->entries.length / INDEX_THREAD_COST,
+			(size_t)max(git_online_cpus() - 1, 1));
+	}
+
+	blocks = min(blocks, index->entries.length);
+	return blocks > 1 ? blocks : 0;
+}
+
 static void clear_uptodate(git_index *index)
 {
 	git_index_entry *entry;
@@ -2994,6 +3780,10 @@ static int write_index(git_oid *checksum, git_index *index, git_filebuf *file)
 	struct index_header header;
 	bool is_extended;
 	uint32_t index_version_number;
+	struct index_entry_block *blocks = NULL;
+	size_t nr_blocks, entries_end;
+	git_hash_ctx eoie_ctx, *eoie = NULL;
+	int error = -1;
 
 	assert(index && file);
 
@@ -3011,20 +3801,46 @@ static int write_index(git_oid *checksum, git_index *index, git_filebuf *file)
 	if (git_filebuf_write(file, &header, sizeof(struct index_header)) < 0)
 		return -1;
 
-	if (write_entries(index, file) < 0)
+	if (git_hash_ctx_init(&eoie_ctx) < 0)
 		return -1;
 
+	if ((nr_blocks = index_write_blocks(index)) > 0 &&
+	    (blocks = git__calloc(nr_blocks, sizeof(struct index_entry_block))) == NULL)
+		goto done;
+
+	if (index_record_extension(index, GIT_CVAR_INDEXRECORDEOIE))
+		eoie = &eoie_ctx;
+
+	if (write_entries(&entries_end, blocks, nr_blocks, index, file) < 0)
+		goto done;
+
+	/* write the index entry offset table first, so readers find it early */
+	if (blocks && write_ieot_extension(file, eoie, blocks, nr_blocks) < 0)
+		goto done;
+
 	/* write the tree cache extension */
-	if (index->tree != NULL && write_tree_extension(index, file) < 0)
-		return -1;
+	if (index->tree != NULL && write_tree_extension(index, file, eoie) < 0)
+		goto done;
 
 	/* write the rename conflict extension */
-	if (index->names.length > 0 && write_name_extension(index, file) < 0)
-		return -1;
+	if (index->names.length > 0 && write_name_extension(index, file, eoie) < 0)
+		goto done;
 
 	/* write the reuc extension */
-	if (index->reuc.length > 0 && write_reuc_extension(index, file) < 0)
-		return -1;
+	if (index->reuc.length > 0 && write_reuc_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* write the untracked cache extension */
+	if (index->untracked != NULL && write_untracked_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* write the filesystem monitor extension */
+	if (index->fsmonitor_token != NULL && write_fsmonitor_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* the end of index entries extension must be the last one */
+	if (eoie && write_eoie_extension(file, eoie, entries_end) < 0)
+		goto done;
 
 	/* get out the hash for all the contents we've appended to the file */
 	git_filebuf_hash(&hash_final, file);
@@ -3032,12 +3848,17 @@ static int write_index(git_oid *checksum, git_index *index, git_filebuf *file)
 
 	/* write it at the end of the file */
 	if (git_filebuf_write(file, hash_final.id, GIT_OID_RAWSZ) < 0)
-		return -1;
+		goto done;
 
 	/* file entries are no longer up to date */
 	clear_uptodate(index);
 
-	return 0;
+	error = 0;
+
+done:
+	git_hash_ctx_cleanup(&eoie_ctx);
+	git__free(blocks);
+	return error;
 }
 
 int git_index_entry_stage(const git_index_entry *entry)
@@ -3255,8 +4076,12 @@ static int git_index_read_iterator(
 		/* invalidate this path in the tree cache if this is new (to
 		 * invalidate the parent trees)
 		 */
-		if (dup_entry && !remove_entry && index->tree)
-			git_tree_cache_invalidate_path(index->tree, dup_entry->path);
+		if (dup_entry && !remove_entry) {
+			if (index->tree)
+				git_tree_cache_invalidate_path(index->tree, dup_entry->path);
+
+			git_untracked_cache_invalidate_path(index->untracked, dup_entry->path);
+		}
 
 		if (add_entry) {
 			if ((error = git_vector_insert(&new_entries, add_entry)) == 0)
@@ -3294,6 +4119,7 @@ static int git_index_read_iterator(
 		if (index->tree)
 			git_tree_cache_invalidate_path(index->tree, entry->path);
 
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 		index_entry_free(entry);
 	}
 
@@ -3332,6 +4158,50 @@ done:
 	return error;
 }
 
+int git_index__untracked_cache(
+	git_untracked_cache **out, git_index *index, const char *workdir)
+{
+	git_repository *repo = INDEX_OWNER(index);
+	git_untracked_cache *untracked;
+	int setting = GIT_UNTRACKEDCACHE_DEFAULT, error;
+	bool usable;
+
+	assert(out && index && workdir);
+
+	*out = NULL;
+
+	if (repo &&
+	    (error = git_repository__cvar(&setting, repo, GIT_CVAR_UNTRACKEDCACHE)) < 0)
+		return error;
+
+	/* it is left out the next time the index is written */
+	if (setting == GIT_UNTRACKEDCACHE_FALSE) {
+		git_untracked_cache_free(index->untracked);
+		index->untracked = NULL;
+		return 0;
+	}
+
+	usable = index->untracked &&
+		git_untracked_cache_is_for(index->untracked, workdir);
+
+	/* a cache recorded elsewhere is kept, unless a new one is wanted */
+	if (!usable && setting == GIT_UNTRACKEDCACHE_TRUE) {
+		if ((error = git_untracked_cache_new(&untracked, workdir)) < 0)
+			return error;
+
+		git_untracked_cache_free(index->untracked);
+		index->untracked = untracked;
+		usable = true;
+	}
+
+	if (usable) {
+		GIT_REFCOUNT_INC(index->untracked);
+		*out = index->untracked;
+	}
+
+	return 0;
+}
+
 git_repository *git_index_owner(const git_index *index)
 {
 	return INDEX_OWNER(index);
@@ -3693,6 +4563,7 @@ int git_indexwriter_commit(git_indexwriter *writer)
 	}
 
 	writer->index->dirty = 0;
+	writer->index->fsmonitor_changed = 0;
 	writer->index->on_disk = 1;
 	git_oid_cpy(&writer->index->checksum, &checksum);
 
@@ -14,12 +14,21 @@
 #include "vector.h"
 #include "idxmap.h"
 #include "tree-cache.h"
+#include "untracked_cache.h"
+#include "ewah.h"
 #include "git2/odb.h"
 #include "git2/index.h"
 
 #define GIT_INDEX_FILE "index"
 #define GIT_INDEX_FILE_MODE 0666
 
+/*
+ * In-memory `flags_extended` bit: the entry was found unmodified in the
+ * working directory, and the filesystem monitor has not reported a
+ * change to its path since.
+ */
+#define GIT_INDEX_ENTRY_FSMONITOR_VALID (1 << 3)
+
 extern bool git_index__enforce_unsaved_safety;
 
 struct git_index {
@@ -40,10 +49,18 @@ struct git_index {
 	unsigned int distrust_filemode:1;
 	unsigned int no_symlinks:1;
 	unsigned int dirty:1;	/* whether we have unsaved changes */
+	unsigned int fsmonitor_changed:1;
 
 	git_tree_cache *tree;
 	git_pool tree_pool;
 
+	git_untracked_cache *untracked;
+
+	/* the filesystem monitor's token, and the entries it did not vouch
+	 * for when the index was read */
+	char *fsmonitor_token;
+	git_bitmap fsmonitor_dirty;
+
 	git_vector names;
 	git_vector reuc;
 
@@ -159,6 +176,44 @@ GIT_INLINE(int) git_index_is_dirty(git_index *index)
 
 extern int git_index_read_safely(git_index *index);
 
+/*
+ * Get the untracked cache to use for the working directory `workdir`,
+ * creating or dropping the index's cache as `core.untrackedCache` asks.
+ * Sets `out` to a new reference to it, or to NULL if there is none.
+ */
+extern int git_index__untracked_cache(
+	git_untracked_cache **out, git_index *index, const char *workdir);
+
+/* Whether the untracked cache changed since the index was written */
+GIT_INLINE(bool) git_index__untracked_cache_changed(git_index *index)
+{
+	return index->untracked && index->untracked->changed;
+}
+
+/* Whether the index has a filesystem monitor token */
+GIT_INLINE(bool) git_index__fsmonitor_enabled(git_index *index)
+{
+	return index->fsmonitor_token != NULL;
+}
+
+/* Whether the filesystem monitor state changed since the index was written */
+GIT_INLINE(bool) git_index__fsmonitor_changed(git_index *index)
+{
+	return index->fsmonitor_changed;
+}
+
+/* Record that `entry` was found unmodified in the working directory */
+GIT_INLINE(void) git_index__fsmonitor_mark_valid(
+	git_index *index, git_index_entry *entry)
+{
+	if (!index->fsmonitor_token ||
+	    (entry->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID) != 0)
+		return;
+
+	entry->flags_extended |= GIT_INDEX_ENTRY_FSMONITOR_VALID;
+	index->fsmonitor_changed = 1;
+}
+
 typedef struct {
 	git_index *index;
 	git_filebuf file;
@@ -10,6 +10,7 @@
 #include "git2/indexer.h"
 #include "git2/object.h"
 
+#include "array.h"
 #include "commit.h"
 #include "tree.h"
 #include "tag.h"
@@ -23,6 +24,7 @@
 #include "oidmap.h"
 #include "zstream.h"
 #include "object.h"
+#include "delta.h"
 
 extern git_mutex git__mwindow_mutex;
 
@@ -50,6 +52,9 @@ struct git_indexer {
 	git_off_t off;
 	git_off_t entry_start;
 	git_object_t entry_type;
+	size_t entry_size;
+	git_off_t entry_data_start;
+	git_off_t entry_base_offset;
 	git_buf entry_data;
 	git_packfile_stream stream;
 	size_t nr_objects;
@@ -60,6 +65,7 @@ struct git_indexer {
 	git_oid hash;
 	git_indexer_progress_cb progress_cb;
 	void *progress_payload;
+	unsigned int nr_threads;
 	char objbuf[8*1024];
 
 	/* OIDs referenced from pack objects. Used for verification. */
@@ -76,6 +82,13 @@ struct git_indexer {
 
 struct delta_info {
 	git_off_t delta_off;
+	git_off_t data_off;
+	size_t size;
+	git_object_t type;
+	/* The base is at `base_off` for OFS deltas, `base_id` for REF deltas */
+	git_off_t base_off;
+	git_oid base_id;
+	unsigned int resolved :1;
 };
 
 const git_oid *git_indexer_hash(const git_indexer *idx)
@@ -141,14 +154,17 @@ int git_indexer_new(
 	static const char suff[] = "/pack";
 	int error, fd = -1;
 
+	/* The first version of the options ended before `threads` */
 	if (in_opts)
-		memcpy(&opts, in_opts, sizeof(opts));
+		memcpy(&opts, in_opts, in_opts->version == 1 ?
+			offsetof(git_indexer_options, threads) : sizeof(opts));
 
 	idx = git__calloc(1, sizeof(git_indexer));
 	GIT_ERROR_CHECK_ALLOC(idx);
 	idx->odb = odb;
 	idx->progress_cb = opts.progress_cb;
 	idx->progress_payload = opts.progress_cb_payload;
+	idx->nr_threads = opts.threads;
 	idx->mode = mode ? mode : GIT_PACK_FILE_MODE;
 	git_hash_ctx_init(&idx->hash_ctx);
 	git_hash_ctx_init(&idx->trailer);
@@ -205,6 +221,24 @@ void git_indexer__set_fsync(git_indexer *idx, int do_fsync)
 	idx->do_fsync = !!do_fsync;
 }
 
+static int read_delta_base_id(git_oid *out, git_indexer *idx, git_off_t data_off)
+{
+	git_mwindow *w = NULL;
+	unsigned char *base_info;
+	unsigned int left = 0;
+
+	base_info = git_mwindow_open(&idx->pack->mwf, &w,
+		data_off - GIT_OID_RAWSZ, GIT_OID_RAWSZ, &left);
+	if (base_info == NULL) {
+		git_error_set(GIT_ERROR_INDEXER, "failed to map delta information");
+		return -1;
+	}
+
+	git_oid_fromraw(out, base_info);
+	git_mwindow_close(&w);
+	return 0;
+}
+
 /* Try to store the delta so we can try to resolve it later */
 static int store_delta(git_indexer *idx)
 {
@@ -213,11 +247,23 @@ static int store_delta(git_indexer *idx)
 	delta = git__calloc(1, sizeof(struct delta_info));
 	GIT_ERROR_CHECK_ALLOC(delta);
 	delta->delta_off = idx->entry_start;
+	delta->data_off = idx->entry_data_start;
+	delta->size = idx->entry_size;
+	delta->type = idx->entry_type;
+
+	if (delta->type == GIT_OBJECT_OFS_DELTA)
+		delta->base_off = idx->entry_base_offset;
+	else if (read_delta_base_id(&delta->base_id, idx, delta->data_off) < 0)
+		goto on_error;
 
 	if (git_vector_insert(&idx->deltas, delta) < 0)
-		return -1;
+		goto on_error;
 
 	return 0;
+
+on_error:
+	git__free(delta);
+	return -1;
 }
 
 static int hash_header(git_hash_ctx *ctx, git_off_t len, git_object_t type)
@@ -269,6 +315,8 @@ static int advance_delta_offset(git_indexer *idx, git_object_t type)
 		git_mwindow_close(&w);
 		if (base_off < 0)
 			return (int)base_off;
+
+		idx->entry_base_offset = base_off;
 	}
 
 	return 0;
@@ -514,41 +562,6 @@ static int save_entry(git_indexer *idx, struct entry *entry, struct git_pack_ent
 	return 0;
 }
 
-static int hash_and_save(git_indexer *idx, git_rawobj *obj, git_off_t entry_start)
-{
-	git_oid oid;
-	size_t entry_size;
-	struct entry *entry;
-	struct git_pack_entry *pentry = NULL;
-
-	entry = git__calloc(1, sizeof(*entry));
-	GIT_ERROR_CHECK_ALLOC(entry);
-
-	if (git_odb__hashobj(&oid, obj) < 0) {
-		git_error_set(GIT_ERROR_INDEXER, "failed to hash object");
-		goto on_error;
-	}
-
-	pentry = git__calloc(1, sizeof(struct git_pack_entry));
-	GIT_ERROR_CHECK_ALLOC(pentry);
-
-	git_oid_cpy(&pentry->sha1, &oid);
-	git_oid_cpy(&entry->oid, &oid);
-	entry->crc = crc32(0L, Z_NULL, 0);
-
-	entry_size = (size_t)(idx->off - entry_start);
-	if (crc_object(&entry->crc, &idx->pack->mwf, entry_start, entry_size) < 0)
-		goto on_error;
-
-	return save_entry(idx, entry, pentry, entry_start);
-
-on_error:
-	git__free(pentry);
-	git__free(entry);
-	git__free(obj->data);
-	return -1;
-}
-
 static int do_progress_callback(git_indexer *idx, git_indexer_progress *stats)
 {
 	if (idx->progress_cb)
@@ -703,6 +716,8 @@ static int read_stream_object(git_indexer *idx, git_indexer_progress *stats)
 
 		idx->have_stream = 1;
 		idx->entry_type = type;
+		idx->entry_size = entry_size;
+		idx->entry_data_start = idx->off;
 
 		error = git_packfile_stream_open(stream, idx->pack, idx->off);
 		if (error < 0)
@@ -856,7 +871,7 @@ static void seek_back_trailer(git_indexer *idx)
 	git_mwindow_free_all(&idx->pack->mwf);
 }
 
-static int inject_object(git_indexer *idx, git_oid *id)
+static int inject_object(struct entry **out, git_indexer *idx, git_oid *id)
 {
 	git_odb_object *obj;
 	struct entry *entry;
@@ -918,7 +933,8 @@ static int inject_object(git_indexer *idx, git_oid *id)
 	git_oid_cpy(&entry->oid, id);
 	idx->off = entry_start + hdr_len + len;
 
-	error = save_entry(idx, entry, pentry, entry_start);
+	if ((error = save_entry(idx, entry, pentry, entry_start)) == 0)
+		*out = entry;
 
 cleanup:
 	if (error) {
@@ -930,18 +946,11 @@ cleanup:
 	return error;
 }
 
-static int fix_thin_pack(git_indexer *idx, git_indexer_progress *stats)
+static int fix_thin_pack(struct entry **out, git_indexer *idx, git_indexer_progress *stats)
 {
-	int error, found_ref_delta = 0;
-	unsigned int i;
 	struct delta_info *delta;
-	size_t size;
-	git_object_t type;
-	git_mwindow *w = NULL;
-	git_off_t curpos = 0;
-	unsigned char *base_info;
-	unsigned int left = 0;
-	git_oid base;
+	bool found_ref_delta = false;
+	size_t i;
 
 	assert(git_vector_length(&idx->deltas) > 0);
 
@@ -950,18 +959,11 @@ static int fix_thin_pack(git_indexer *idx, git_indexer_progress *stats)
 		return -1;
 	}
 
-	/* Loop until we find the first REF delta */
+	/* Find the first REF delta whose base is not in the pack */
 	git_vector_foreach(&idx->deltas, i, delta) {
-		if (!delta)
-			continue;
-
-		curpos = delta->delta_off;
-		error = git_packfile_unpack_header(&size, &type, &idx->pack->mwf, &w, &curpos);
-		if (error < 0)
-			return error;
-
-		if (type == GIT_OBJECT_REF_DELTA) {
-			found_ref_delta = 1;
+		if (!delta->resolved && delta->type == GIT_OBJECT_REF_DELTA &&
+		    !has_entry(idx, &delta->base_id)) {
+			found_ref_delta = true;
 			break;
 		}
 	}
@@ -971,84 +973,496 @@ static int fix_thin_pack(git_indexer *idx, git_indexer_progress *stats)
 		return -1;
 	}
 
-	/* curpos now points to the base information, which is an OID */
-	base_info = git_mwindow_open(&idx->pack->mwf, &w, curpos, GIT_OID_RAWSZ, &left);
-	if (base_info == NULL) {
-		git_error_set(GIT_ERROR_INDEXER, "failed to map delta information");
+	if (inject_object(out, idx, &delta->base_id) < 0)
+		return -1;
+
+	stats->local_objects++;
+
+	return 0;
+}
+
+/*
+ * Deltas are resolved by walking the delta trees: the roots are the
+ * objects that are stored whole in the pack and the children of an
+ * object are the deltas against it. Each root is inflated once and all
+ * of its descendants are resolved from it, depth first, by one thread.
+ * Distinct roots are resolved in parallel.
+ */
+struct resolve_context {
+	git_indexer *idx;
+	git_indexer_progress *stats;
+
+	/* OFS deltas sorted by base offset, REF deltas by base id */
+	git_vector ofs_deltas;
+	git_vector ref_deltas;
+
+	/* The objects with deltas against them */
+	git_vector roots;
+
+	/* Whether the workers run in their own threads */
+	bool threaded;
+
+	/* Everything below is protected by the lock */
+	git_mutex lock;
+	git_cond cond;
+	size_t next_root;
+	size_t resolved;
+	unsigned int running;
+	unsigned int progressed :1,
+		has_error_state :1;
+	int error;
+	git_error_state error_state;
+};
+
+/* An object being resolved and the range of its children left to resolve */
+struct delta_base {
+	git_rawobj obj;
+	size_t ofs_next, ofs_end;
+	size_t ref_next, ref_end;
+};
+
+typedef git_array_t(struct delta_base) delta_base_array;
+
+static int ofs_delta_cmp(const void *a, const void *b)
+{
+	const struct delta_info *delta_a = a, *delta_b = b;
+
+	if (delta_a->base_off < delta_b->base_off)
 		return -1;
+	return delta_a->base_off > delta_b->base_off;
+}
+
+static int ref_delta_cmp(const void *a, const void *b)
+{
+	const struct delta_info *delta_a = a, *delta_b = b;
+
+	return git_oid_cmp(&delta_a->base_id, &delta_b->base_id);
+}
+
+GIT_INLINE(git_off_t) entry_offset(const struct entry *entry)
+{
+	return entry->offset == UINT32_MAX ? (git_off_t)entry->offset_long : entry->offset;
+}
+
+static void find_range(
+	size_t *start,
+	size_t *end,
+	git_vector *deltas,
+	git_vector_cmp cmp,
+	const struct delta_info *key)
+{
+	size_t lo = 0, hi = git_vector_length(deltas), mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (cmp(git_vector_get(deltas, mid), key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	git_oid_fromraw(&base, base_info);
+	*start = lo;
+	while (lo < git_vector_length(deltas) &&
+	       cmp(git_vector_get(deltas, lo), key) == 0)
+		lo++;
+	*end = lo;
+}
+
+static bool find_children(
+	struct delta_base *base,
+	struct resolve_context *ctx,
+	git_off_t offset,
+	const git_oid *id)
+{
+	struct delta_info key;
+
+	key.base_off = offset;
+	git_oid_cpy(&key.base_id, id);
+
+	find_range(&base->ofs_next, &base->ofs_end, &ctx->ofs_deltas, ofs_delta_cmp, &key);
+	find_range(&base->ref_next, &base->ref_end, &ctx->ref_deltas, ref_delta_cmp, &key);
+
+	return base->ofs_next < base->ofs_end || base->ref_next < base->ref_end;
+}
+
+static int read_root(git_rawobj *out, git_indexer *idx, struct entry *root)
+{
+	git_off_t curpos = entry_offset(root);
+	git_mwindow *w = NULL;
+	git_object_t type;
+	size_t size;
+	int error;
+
+	if ((error = git_packfile_unpack_header(&size, &type, &idx->pack->mwf, &w, &curpos)) < 0)
+		return error;
+
 	git_mwindow_close(&w);
 
-	if (has_entry(idx, &base))
-		return 0;
+	error = git_packfile_unpack_compressed(out, idx->pack, &w, &curpos, size, type);
+	git_mwindow_close(&w);
 
-	if (inject_object(idx, &base) < 0)
-		return -1;
+	return error;
+}
 
-	stats->local_objects++;
+static int save_resolved(
+	struct resolve_context *ctx,
+	git_rawobj *obj,
+	struct delta_info *delta,
+	struct entry *entry)
+{
+	git_indexer *idx = ctx->idx;
+	struct git_pack_entry *pentry;
+	int error;
 
-	return 0;
+	pentry = git__calloc(1, sizeof(struct git_pack_entry));
+	GIT_ERROR_CHECK_ALLOC(pentry);
+
+	git_oid_cpy(&pentry->sha1, &entry->oid);
+
+	git_mutex_lock(&ctx->lock);
+
+	if ((error = ctx->error) == 0 &&
+	    (!idx->do_verify || (error = check_object_connectivity(idx, obj)) == 0) &&
+	    (error = save_entry(idx, entry, pentry, delta->delta_off)) == 0) {
+		delta->resolved = 1;
+		ctx->resolved++;
+		ctx->stats->indexed_objects++;
+		ctx->stats->indexed_deltas++;
+		ctx->progressed = 1;
+
+		if (ctx->threaded)
+			git_cond_signal(&ctx->cond);
+	}
+
+	/* The pack entry belongs to the cache if it made it there */
+	if (error && git_oidmap_get(idx->pack->idx_cache, &pentry->sha1) != pentry)
+		git__free(pentry);
+
+	git_mutex_unlock(&ctx->lock);
+
+	if (!error && !ctx->threaded)
+		error = do_progress_callback(idx, ctx->stats);
+
+	return error;
 }
 
-static int resolve_deltas(git_indexer *idx, git_indexer_progress *stats)
+static int resolve_delta(
+	git_rawobj *out,
+	git_oid *id,
+	struct resolve_context *ctx,
+	const git_rawobj *base,
+	struct delta_info *delta)
 {
-	unsigned int i;
+	git_indexer *idx = ctx->idx;
+	git_off_t curpos = delta->data_off;
+	git_mwindow *w = NULL;
+	git_rawobj delta_obj;
+	struct entry *entry;
 	int error;
+
+	error = git_packfile_unpack_compressed(&delta_obj, idx->pack, &w, &curpos, delta->size, delta->type);
+	git_mwindow_close(&w);
+
+	if (error < 0)
+		return error;
+
+	error = git_delta_apply(&out->data, &out->len,
+		base->data, base->len, delta_obj.data, delta_obj.len);
+	git__free(delta_obj.data);
+
+	if (error < 0)
+		return error;
+
+	out->type = base->type;
+
+	entry = git__calloc(1, sizeof(*entry));
+	if (!entry) {
+		error = -1;
+		goto on_error;
+	}
+
+	if ((error = git_odb__hashobj(&entry->oid, out)) < 0 ||
+	    (error = crc_object(&entry->crc, &idx->pack->mwf,
+		delta->delta_off, curpos - delta->delta_off)) < 0 ||
+	    (error = save_resolved(ctx, out, delta, entry)) < 0) {
+		if (!delta->resolved)
+			git__free(entry);
+		goto on_error;
+	}
+
+	git_oid_cpy(id, &entry->oid);
+	return 0;
+
+on_error:
+	git__free(out->data);
+	out->data = NULL;
+	return error;
+}
+
+/* Get the next delta to resolve, depth first, and the base it applies to */
+static struct delta_info *next_delta(
+	struct delta_base **out,
+	struct resolve_context *ctx,
+	delta_base_array *stack)
+{
+	struct delta_base *base;
+
+	while ((base = git_array_last(*stack)) != NULL) {
+		*out = base;
+
+		if (base->ofs_next < base->ofs_end)
+			return git_vector_get(&ctx->ofs_deltas, base->ofs_next++);
+
+		if (base->ref_next < base->ref_end)
+			return git_vector_get(&ctx->ref_deltas, base->ref_next++);
+
+		git__free(base->obj.data);
+		git_array_pop(*stack);
+	}
+
+	return NULL;
+}
+
+static int resolve_root(struct resolve_context *ctx, struct entry *root)
+{
+	delta_base_array stack = GIT_ARRAY_INIT;
+	struct delta_base *base, child;
 	struct delta_info *delta;
-	int progressed = 0, non_null = 0, progress_cb_result;
-
-	while (idx->deltas.length > 0) {
-		progressed = 0;
-		non_null = 0;
-		git_vector_foreach(&idx->deltas, i, delta) {
-			git_rawobj obj = {0};
-
-			if (!delta)
-				continue;
-
-			non_null = 1;
-			idx->off = delta->delta_off;
-			if ((error = git_packfile_unpack(&obj, idx->pack, &idx->off)) < 0) {
-				if (error == GIT_PASSTHROUGH) {
-					/* We have not seen the base object, we'll try again later. */
-					continue;
-				}
-				return -1;
-			}
+	git_rawobj obj;
+	git_oid id;
+	size_t i;
+	int error = 0;
 
-			if (idx->do_verify && check_object_connectivity(idx, &obj) < 0)
-				/* TODO: error? continue? */
-				continue;
+	if (!find_children(&child, ctx, entry_offset(root), &root->oid))
+		return 0;
 
-			if (hash_and_save(idx, &obj, delta->delta_off) < 0)
-				continue;
+	if ((error = read_root(&child.obj, ctx->idx, root)) < 0)
+		return error;
+
+	base = git_array_alloc(stack);
+	if (!base) {
+		git__free(child.obj.data);
+		return -1;
+	}
 
+	memcpy(base, &child, sizeof(child));
+
+	while ((delta = next_delta(&base, ctx, &stack)) != NULL) {
+		if ((error = resolve_delta(&obj, &id, ctx, &base->obj, delta)) < 0)
+			break;
+
+		if (!find_children(&child, ctx, delta->delta_off, &id)) {
 			git__free(obj.data);
-			stats->indexed_objects++;
-			stats->indexed_deltas++;
-			progressed = 1;
-			if ((progress_cb_result = do_progress_callback(idx, stats)) < 0)
-				return progress_cb_result;
-
-			/* remove from the list */
-			git_vector_set(NULL, &idx->deltas, i, NULL);
-			git__free(delta);
+			continue;
 		}
 
-		/* if none were actually set, we're done */
-		if (!non_null)
+		memcpy(&child.obj, &obj, sizeof(obj));
+
+		if ((base = git_array_alloc(stack)) == NULL) {
+			git__free(obj.data);
+			error = -1;
 			break;
+		}
 
-		if (!progressed && (fix_thin_pack(idx, stats) < 0)) {
-			return -1;
+		memcpy(base, &child, sizeof(child));
+	}
+
+	git_array_foreach(stack, i, base)
+		git__free(base->obj.data);
+	git_array_clear(stack);
+
+	return error;
+}
+
+static void *resolve_worker(void *payload)
+{
+	struct resolve_context *ctx = payload;
+	struct entry *root;
+	int error = 0;
+
+	while (1) {
+		root = NULL;
+
+		git_mutex_lock(&ctx->lock);
+		if (!ctx->error && ctx->next_root < git_vector_length(&ctx->roots))
+			root = git_vector_get(&ctx->roots, ctx->next_root++);
+		git_mutex_unlock(&ctx->lock);
+
+		if (!root || (error = resolve_root(ctx, root)) < 0)
+			break;
+	}
+
+	git_mutex_lock(&ctx->lock);
+	if (error < 0 && !ctx->error) {
+		ctx->error = error;
+		ctx->has_error_state = 1;
+		git_error_state_capture(&ctx->error_state, error);
+	}
+	ctx->running--;
+	git_cond_signal(&ctx->cond);
+	git_mutex_unlock(&ctx->lock);
+
+	return NULL;
+}
+
+#ifdef GIT_THREADS
+
+static int resolve_roots_threaded(struct resolve_context *ctx, unsigned int nr_threads)
+{
+	git_indexer_progress stats;
+	git_thread *threads;
+	unsigned int i, started = 0;
+	int error;
+
+	threads = git__mallocarray(nr_threads, sizeof(git_thread));
+	GIT_ERROR_CHECK_ALLOC(threads);
+
+	ctx->threaded = true;
+	ctx->running = nr_threads;
+
+	for (i = 0; i < nr_threads; i++) {
+		if (git_thread_create(&threads[i], resolve_worker, ctx) != 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+
+			git_mutex_lock(&ctx->lock);
+			ctx->running -= nr_threads - i;
+			if (!ctx->error)
+				ctx->error = -1;
+			git_mutex_unlock(&ctx->lock);
+			break;
 		}
+
+		started++;
 	}
 
+	/*
+	 * Report the progress from this thread so that the callback is
+	 * never invoked concurrently or from a thread the caller doesn't
+	 * know about.
+	 */
+	git_mutex_lock(&ctx->lock);
+	while (1) {
+		if (ctx->progressed && !ctx->error) {
+			ctx->progressed = 0;
+			memcpy(&stats, ctx->stats, sizeof(stats));
+			git_mutex_unlock(&ctx->lock);
+
+			error = do_progress_callback(ctx->idx, &stats);
+
+			git_mutex_lock(&ctx->lock);
+			if (error < 0 && !ctx->error)
+				ctx->error = error;
+			continue;
+		}
+
+		if (!ctx->running)
+			break;
+
+		git_cond_wait(&ctx->cond, &ctx->lock);
+	}
+	git_mutex_unlock(&ctx->lock);
+
+	for (i = 0; i < started; i++)
+		git_thread_join(&threads[i], NULL);
+
+	git__free(threads);
+	ctx->threaded = false;
+
 	return 0;
 }
 
+#endif
+
+static int resolve_roots(struct resolve_context *ctx, unsigned int nr_threads)
+{
+	int error = 0;
+
+	ctx->next_root = 0;
+
+	if (nr_threads > git_vector_length(&ctx->roots))
+		nr_threads = (unsigned int)git_vector_length(&ctx->roots);
+
+#ifdef GIT_THREADS
+	if (nr_threads > 1)
+		error = resolve_roots_threaded(ctx, nr_threads);
+	else
+#endif
+	{
+		ctx->running = 1;
+		resolve_worker(ctx);
+	}
+
+	if (ctx->has_error_state) {
+		git_error_state_restore(&ctx->error_state);
+		ctx->has_error_state = 0;
+	}
+
+	return error < 0 ? error : ctx->error;
+}
+
+static int resolve_deltas(git_indexer *idx, git_indexer_progress *stats)
+{
+	struct resolve_context ctx = {0};
+	struct delta_info *delta;
+	struct entry *entry;
+	size_t i;
+	int error;
+
+	if (git_vector_length(&idx->deltas) == 0)
+		return 0;
+
+	ctx.idx = idx;
+	ctx.stats = stats;
+	git_mutex_init(&ctx.lock);
+	git_cond_init(&ctx.cond);
+
+	if ((error = git_vector_init(&ctx.ofs_deltas, 0, ofs_delta_cmp)) < 0 ||
+	    (error = git_vector_init(&ctx.ref_deltas, 0, ref_delta_cmp)) < 0 ||
+	    (error = git_vector_init(&ctx.roots, 0, NULL)) < 0)
+		goto cleanup;
+
+	git_vector_foreach(&idx->deltas, i, delta) {
+		git_vector *children = (delta->type == GIT_OBJECT_OFS_DELTA) ?
+			&ctx.ofs_deltas : &ctx.ref_deltas;
+
+		if ((error = git_vector_insert(children, delta)) < 0)
+			goto cleanup;
+	}
+
+	git_vector_sort(&ctx.ofs_deltas);
+	git_vector_sort(&ctx.ref_deltas);
+
+	git_vector_foreach(&idx->objects, i, entry) {
+		struct delta_base children;
+
+		if (find_children(&children, &ctx, entry_offset(entry), &entry->oid) &&
+		    (error = git_vector_insert(&ctx.roots, entry)) < 0)
+			goto cleanup;
+	}
+
+	error = resolve_roots(&ctx, idx->nr_threads);
+
+	/* Whatever is left is based on objects that are missing from the pack */
+	while (!error && ctx.resolved < git_vector_length(&idx->deltas)) {
+		git_vector_clear(&ctx.roots);
+
+		if ((error = fix_thin_pack(&entry, idx, stats)) < 0 ||
+		    (error = git_vector_insert(&ctx.roots, entry)) < 0)
+			break;
+
+		error = resolve_roots(&ctx, 1);
+	}
+
+cleanup:
+	git_vector_free(&ctx.ofs_deltas);
+	git_vector_free(&ctx.ref_deltas);
+	git_vector_free(&ctx.roots);
+	git_cond_free(&ctx.cond);
+	git_mutex_free(&ctx.lock);
+	return error;
+}
+
 static int update_header_and_rehash(git_indexer *idx, git_indexer_progress *stats)
 {
 	void *ptr;
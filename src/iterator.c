@@ -9,6 +9,8 @@
 
 #include "tree.h"
 #include "index.h"
+#include "attrcache.h"
+#include "untracked_cache.h"
 
 #define GIT_ITERATOR_FIRST_ACCESS   (1 << 15)
 #define GIT_ITERATOR_HONOR_IGNORES  (1 << 16)
@@ -1003,11 +1005,21 @@ int git_iterator_current_parent_tree(
 
 /* Filesystem iterator */
 
+typedef enum {
+	FILESYSTEM_UNTRACKED_UNKNOWN = 0,
+	FILESYSTEM_UNTRACKED_EMPTY,
+	FILESYSTEM_UNTRACKED_NONEMPTY,
+} filesystem_iterator_untracked_t;
+
 typedef struct {
 	struct stat st;
 	size_t path_len;
 	iterator_pathlist_search_t match;
 	git_oid id;
+
+	/* whether a directory has untracked files that are not ignored */
+	filesystem_iterator_untracked_t untracked;
+
 	char path[GIT_FLEX_ARRAY];
 } filesystem_iterator_entry;
 
@@ -1018,6 +1030,14 @@ typedef struct {
 
 	size_t path_len;
 	int is_ignored;
+
+	/* the untracked cache node of the directory and what it records */
+	git_untracked_cache_dir *untracked_dir;
+	filesystem_iterator_entry *frame_entry;
+	git_untracked_stat untracked_st;
+	git_oid exclude_id;
+	unsigned int untracked_cached:1,
+		untracked_nonempty:1;
 } filesystem_iterator_frame;
 
 typedef struct {
@@ -1034,6 +1054,10 @@ typedef struct {
 	git_array_t(filesystem_iterator_frame) frames;
 	git_ignores ignores;
 
+	/* the index's untracked cache, and when the iteration started */
+	git_untracked_cache *untracked;
+	time_t untracked_time;
+
 	/* info about the current entry */
 	git_index_entry entry;
 	git_buf current_path;
@@ -1308,6 +1332,7 @@ static int filesystem_iterator_entry_init(
 
 	entry->path_len = path_len;
 	entry->match = pathlist_match;
+	entry->untracked = FILESYSTEM_UNTRACKED_UNKNOWN;
 	memcpy(entry->path, path, path_len);
 	memcpy(&entry->st, statbuf, sizeof(struct stat));
 
@@ -1326,66 +1351,109 @@ static int filesystem_iterator_entry_init(
 	return error;
 }
 
-static int filesystem_iterator_frame_push(
+static int filesystem_iterator_frame_add(
 	filesystem_iterator *iter,
-	filesystem_iterator_entry *frame_entry)
+	filesystem_iterator_frame *new_frame,
+	const char *path,
+	size_t path_len,
+	struct stat *statbuf,
+	bool dir_expected,
+	iterator_pathlist_search_t pathlist_match)
 {
-	filesystem_iterator_frame *new_frame = NULL;
-	git_path_diriter diriter = GIT_PATH_DIRITER_INIT;
-	git_buf root = GIT_BUF_INIT;
-	const char *path;
 	filesystem_iterator_entry *entry;
-	struct stat statbuf;
-	size_t path_len;
 	int error;
 
-	if (iter->frames.size == FILESYSTEM_MAX_DEPTH) {
-		git_error_set(GIT_ERROR_REPOSITORY,
-			"directory nesting too deep (%"PRIuZ")", iter->frames.size);
-		return -1;
-	}
+	/* Ignore wacky things in the filesystem */
+	if (!S_ISDIR(statbuf->st_mode) &&
+		!S_ISREG(statbuf->st_mode) &&
+		!S_ISLNK(statbuf->st_mode) &&
+		statbuf->st_mode != GIT_FILEMODE_UNREADABLE)
+		return 0;
 
-	new_frame = git_array_alloc(iter->frames);
-	GIT_ERROR_CHECK_ALLOC(new_frame);
+	if (filesystem_iterator_is_dot_git(iter, path, path_len))
+		return 0;
 
-	memset(new_frame, 0, sizeof(filesystem_iterator_frame));
+	/* convert submodules to GITLINK and remove trailing slashes */
+	if (S_ISDIR(statbuf->st_mode)) {
+		bool submodule = false;
 
-	if (frame_entry)
-		git_buf_joinpath(&root, iter->root, frame_entry->path);
-	else
-		git_buf_puts(&root, iter->root);
+		if ((error = filesystem_iterator_is_submodule(&submodule,
+				iter, path, path_len)) < 0)
+			return error;
 
-	if (git_buf_oom(&root)) {
-		error = -1;
-		goto done;
+		if (submodule)
+			statbuf->st_mode = GIT_FILEMODE_COMMIT;
 	}
 
-	new_frame->path_len = frame_entry ? frame_entry->path_len : 0;
+	/* Ensure that the pathlist entry lines up with what we expected */
+	else if (dir_expected)
+		return 0;
 
-	/* Any error here is equivalent to the dir not existing, skip over it */
-	if ((error = git_path_diriter_init(
-			&diriter, root.ptr, iter->dirload_flags)) < 0) {
-		error = GIT_ENOTFOUND;
-		goto done;
-	}
+	if ((error = filesystem_iterator_entry_init(&entry,
+		iter, new_frame, path, path_len, statbuf, pathlist_match)) < 0)
+		return error;
 
-	if ((error = git_vector_init(&new_frame->entries, 64,
-			iterator__ignore_case(&iter->base) ?
-			filesystem_iterator_entry_cmp_icase :
-			filesystem_iterator_entry_cmp)) < 0)
-		goto done;
+	return git_vector_insert(&new_frame->entries, entry);
+}
 
-	git_pool_init(&new_frame->entry_pool, 1);
+/*
+ * Take the stat data of a file from its index entry when the filesystem
+ * monitor vouches for it, so that the file does not need to be stat'ed.
+ */
+static bool filesystem_iterator_stat_from_index(
+	struct stat *statbuf,
+	filesystem_iterator *iter,
+	const char *path,
+	size_t path_len)
+{
+	const git_index_entry *index_entry;
+	size_t pos;
 
-	/* check if this directory is ignored */
-	filesystem_iterator_frame_push_ignores(iter, frame_entry, new_frame);
+	if (!(iter->base.flags & GIT_ITERATOR_FSMONITOR) ||
+	    git_index_snapshot_find(&pos, &iter->index_snapshot,
+			iter->base.entry_srch, path, path_len, 0) < 0)
+		return false;
+
+	index_entry = git_vector_get(&iter->index_snapshot, pos);
+
+	if ((index_entry->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID) == 0 ||
+	    S_ISGITLINK(index_entry->mode))
+		return false;
 
-	while ((error = git_path_diriter_next(&diriter)) == 0) {
+	memset(statbuf, 0, sizeof(struct stat));
+	statbuf->st_mode = index_entry->mode;
+	statbuf->st_size = index_entry->file_size;
+	statbuf->st_ctime = index_entry->ctime.seconds;
+	statbuf->st_mtime = index_entry->mtime.seconds;
+#if defined(GIT_USE_NSEC)
+	statbuf->st_ctime_nsec = index_entry->ctime.nanoseconds;
+	statbuf->st_mtime_nsec = index_entry->mtime.nanoseconds;
+#endif
+	statbuf->st_dev = index_entry->dev;
+	statbuf->st_ino = index_entry->ino;
+	statbuf->st_uid = index_entry->uid;
+	statbuf->st_gid = index_entry->gid;
+
+	return true;
+}
+
+static int filesystem_iterator_frame_readdir(
+	filesystem_iterator *iter,
+	filesystem_iterator_entry *frame_entry,
+	filesystem_iterator_frame *new_frame,
+	git_path_diriter *diriter)
+{
+	const char *path;
+	struct stat statbuf;
+	size_t path_len;
+	int error;
+
+	while ((error = git_path_diriter_next(diriter)) == 0) {
 		iterator_pathlist_search_t pathlist_match = ITERATOR_PATHLIST_FULL;
 		bool dir_expected = false;
 
-		if ((error = git_path_diriter_fullpath(&path, &path_len, &diriter)) < 0)
-			goto done;
+		if ((error = git_path_diriter_fullpath(&path, &path_len, diriter)) < 0)
+			return error;
 
 		assert(path_len > iter->root_len);
 
@@ -1402,59 +1470,328 @@ static int filesystem_iterator_frame_push(
 			iter, frame_entry, path, path_len))
 			continue;
 
-		/* TODO: don't need to stat if assume unchanged for this path and
-		 * we have an index, we can just copy the data out of it.
-		 */
+		if (!filesystem_iterator_stat_from_index(&statbuf, iter, path, path_len)) {
+			iter->base.stat_calls++;
 
-		if ((error = git_path_diriter_stat(&statbuf, &diriter)) < 0) {
-			/* file was removed between readdir and lstat */
-			if (error == GIT_ENOTFOUND)
-				continue;
+			if ((error = git_path_diriter_stat(&statbuf, diriter)) < 0) {
+				/* file was removed between readdir and lstat */
+				if (error == GIT_ENOTFOUND)
+					continue;
 
-			/* treat the file as unreadable */
-			memset(&statbuf, 0, sizeof(statbuf));
-			statbuf.st_mode = GIT_FILEMODE_UNREADABLE;
+				/* treat the file as unreadable */
+				memset(&statbuf, 0, sizeof(statbuf));
+				statbuf.st_mode = GIT_FILEMODE_UNREADABLE;
 
-			error = 0;
+				error = 0;
+			}
 		}
 
-		iter->base.stat_calls++;
+		if ((error = filesystem_iterator_frame_add(iter, new_frame,
+			path, path_len, &statbuf, dir_expected, pathlist_match)) < 0)
+			return error;
+	}
 
-		/* Ignore wacky things in the filesystem */
-		if (!S_ISDIR(statbuf.st_mode) &&
-			!S_ISREG(statbuf.st_mode) &&
-			!S_ISLNK(statbuf.st_mode) &&
-			statbuf.st_mode != GIT_FILEMODE_UNREADABLE)
-			continue;
+	return (error == GIT_ITEROVER) ? 0 : error;
+}
 
-		if (filesystem_iterator_is_dot_git(iter, path, path_len))
-			continue;
+/*
+ * Look up the directory in the untracked cache, and if its contents are
+ * unchanged, copy the untracked files that it records to `untracked`.
+ */
+static int filesystem_iterator_frame_push_untracked(
+	bool *cached,
+	git_vector *untracked,
+	filesystem_iterator *iter,
+	filesystem_iterator_entry *frame_entry,
+	filesystem_iterator_frame *new_frame,
+	const char *root)
+{
+	git_untracked_cache *cache = iter->untracked;
+	git_untracked_cache_dir *dir, *child;
+	git_buf exclude_path = GIT_BUF_INIT;
+	struct stat statbuf;
+	char *name;
+	size_t i;
+	int error = 0;
+
+	*cached = false;
+
+	if (frame_entry)
+		memcpy(&statbuf, &frame_entry->st, sizeof(struct stat));
+	else if (p_lstat(root, &statbuf) < 0)
+		return 0;
+
+	if (!S_ISDIR(statbuf.st_mode))
+		return 0;
+
+	git_untracked_stat_from_stat(&new_frame->untracked_st, &statbuf);
 
-		/* convert submodules to GITLINK and remove trailing slashes */
-		if (S_ISDIR(statbuf.st_mode)) {
-			bool submodule = false;
+	/* the ignore rules of the directory itself */
+	if ((error = git_buf_joinpath(&exclude_path, root, GIT_IGNORE_FILE)) == 0)
+		error = git_untracked_cache_hash_ignore(&new_frame->exclude_id,
+			exclude_path.ptr);
 
-			if ((error = filesystem_iterator_is_submodule(&submodule,
-					iter, path, path_len)) < 0)
+	git_buf_dispose(&exclude_path);
+
+	if (error < 0)
+		return error;
+
+	if (git_mutex_lock(&cache->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock untracked cache");
+		return -1;
+	}
+
+	dir = git_untracked_cache_lookup(cache,
+		frame_entry ? frame_entry->path : "", true);
+
+	if (!dir) {
+		error = -1;
+		goto done;
+	}
+
+	/* the rules for everything in the directory may have changed */
+	if (!git_oid_equal(&dir->exclude_id, &new_frame->exclude_id)) {
+		git_untracked_cache_dir_invalidate(dir);
+		git_oid_cpy(&dir->exclude_id, &new_frame->exclude_id);
+		cache->changed = true;
+	}
+
+	if (dir->valid && !dir->check_only &&
+	    git_untracked_stat_equal(&dir->st, &new_frame->untracked_st)) {
+		git_vector_foreach(&dir->untracked, i, name) {
+			if ((name = git__strdup(name)) == NULL ||
+			    git_vector_insert(untracked, name) < 0) {
+				git__free(name);
+				error = -1;
 				goto done;
+			}
+		}
 
-			if (submodule)
-				statbuf.st_mode = GIT_FILEMODE_COMMIT;
+		/*
+		 * The directories seen before are examined again, as files may
+		 * have been added to those without untracked files.
+		 */
+		git_vector_foreach(&dir->dirs, i, child) {
+			if ((name = git__strdup(child->name)) == NULL ||
+			    git_vector_insert(untracked, name) < 0) {
+				git__free(name);
+				error = -1;
+				goto done;
+			}
 		}
 
-		/* Ensure that the pathlist entry lines up with what we expected */
-		else if (dir_expected)
+		*cached = true;
+		new_frame->untracked_cached = 1;
+		new_frame->untracked_nonempty = (dir->untracked.length > 0);
+	}
+
+	new_frame->untracked_dir = dir;
+	new_frame->frame_entry = frame_entry;
+
+done:
+	git_mutex_unlock(&cache->lock);
+	return error;
+}
+
+static int filesystem_iterator_name_cmp(const void *a, const void *b)
+{
+	return strcmp((const char *)a, (const char *)b);
+}
+
+/*
+ * Build the entries of a directory whose untracked cache is valid: the
+ * files in the index, and the untracked files that are not ignored.
+ */
+static int filesystem_iterator_frame_load_untracked(
+	filesystem_iterator *iter,
+	filesystem_iterator_entry *frame_entry,
+	filesystem_iterator_frame *new_frame,
+	git_vector *names)
+{
+	const char *prefix = frame_entry ? frame_entry->path : "";
+	size_t prefix_len = frame_entry ? frame_entry->path_len : 0;
+	git_buf path = GIT_BUF_INIT, next = GIT_BUF_INIT;
+	const git_index_entry *index_entry;
+	const char *name, *slash, *previous = NULL;
+	struct stat statbuf;
+	size_t pos, name_len, i;
+	char *copy;
+	int error = 0;
+
+	/* the files and directories that the index has in the directory */
+	git_index_snapshot_find(&pos, &iter->index_snapshot,
+		iter->base.entry_srch, prefix, prefix_len, 0);
+
+	while ((index_entry = git_vector_get(&iter->index_snapshot, pos)) != NULL &&
+	       iter->base.strncomp(index_entry->path, prefix, prefix_len) == 0) {
+		name = index_entry->path + prefix_len;
+
+		if ((slash = strchr(name, '/')) == NULL) {
+			name_len = strlen(name);
+			pos++;
+		} else {
+			name_len = slash - name;
+
+			/* skip the directory's contents; '0' sorts right after '/' */
+			git_buf_clear(&next);
+			git_buf_put(&next, index_entry->path, slash - index_entry->path);
+			git_buf_putc(&next, '0');
+
+			if (git_buf_oom(&next)) {
+				error = -1;
+				goto done;
+			}
+
+			git_index_snapshot_find(&pos, &iter->index_snapshot,
+				iter->base.entry_srch, next.ptr, next.size, 0);
+		}
+
+		if ((copy = git__strndup(name, name_len)) == NULL ||
+		    git_vector_insert(names, copy) < 0) {
+			git__free(copy);
+			error = -1;
+			goto done;
+		}
+	}
+
+	/* directories are recorded with a trailing slash */
+	git_vector_foreach(names, i, copy) {
+		if ((name_len = strlen(copy)) > 0 && copy[name_len - 1] == '/')
+			copy[name_len - 1] = '\0';
+	}
+
+	git_vector_set_cmp(names, filesystem_iterator_name_cmp);
+	git_vector_sort(names);
+
+	git_buf_puts(&path, iter->root);
+	git_buf_put(&path, prefix, prefix_len);
+
+	if (git_buf_oom(&path)) {
+		error = -1;
+		goto done;
+	}
+
+	prefix_len = path.size;
+
+	git_vector_foreach(names, i, name) {
+		iterator_pathlist_search_t pathlist_match = ITERATOR_PATHLIST_FULL;
+		bool dir_expected = false;
+
+		/* skip duplicates, and names that do not belong in the directory */
+		if (!*name || strchr(name, '/') != NULL ||
+		    strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+		    (previous && strcmp(previous, name) == 0))
 			continue;
 
-		if ((error = filesystem_iterator_entry_init(&entry,
-			iter, new_frame, path, path_len, &statbuf, pathlist_match)) < 0)
+		previous = name;
+
+		git_buf_truncate(&path, prefix_len);
+
+		if ((error = git_buf_puts(&path, name)) < 0)
 			goto done;
 
-		git_vector_insert(&new_frame->entries, entry);
+		if (!filesystem_iterator_examine_path(&dir_expected, &pathlist_match,
+			iter, frame_entry, path.ptr + iter->root_len,
+			path.size - iter->root_len))
+			continue;
+
+		if (!filesystem_iterator_stat_from_index(&statbuf, iter,
+				path.ptr + iter->root_len, path.size - iter->root_len)) {
+			iter->base.stat_calls++;
+
+			if ((error = git_path_lstat(path.ptr, &statbuf)) < 0) {
+				/* the file is in the index, but not on disk */
+				if (error == GIT_ENOTFOUND) {
+					git_error_clear();
+					error = 0;
+					continue;
+				}
+
+				memset(&statbuf, 0, sizeof(statbuf));
+				statbuf.st_mode = GIT_FILEMODE_UNREADABLE;
+
+				error = 0;
+			}
+		}
+
+		if ((error = filesystem_iterator_frame_add(iter, new_frame,
+			path.ptr + iter->root_len, path.size - iter->root_len,
+			&statbuf, dir_expected, pathlist_match)) < 0)
+			goto done;
 	}
 
-	if (error == GIT_ITEROVER)
-		error = 0;
+done:
+	git_buf_dispose(&path);
+	git_buf_dispose(&next);
+	return error;
+}
+
+static int filesystem_iterator_frame_push(
+	filesystem_iterator *iter,
+	filesystem_iterator_entry *frame_entry)
+{
+	filesystem_iterator_frame *new_frame = NULL;
+	git_path_diriter diriter = GIT_PATH_DIRITER_INIT;
+	git_vector untracked = GIT_VECTOR_INIT;
+	git_buf root = GIT_BUF_INIT;
+	bool cached = false;
+	int error;
+
+	if (iter->frames.size == FILESYSTEM_MAX_DEPTH) {
+		git_error_set(GIT_ERROR_REPOSITORY,
+			"directory nesting too deep (%"PRIuZ")", iter->frames.size);
+		return -1;
+	}
+
+	new_frame = git_array_alloc(iter->frames);
+	GIT_ERROR_CHECK_ALLOC(new_frame);
+
+	memset(new_frame, 0, sizeof(filesystem_iterator_frame));
+
+	if (frame_entry)
+		git_buf_joinpath(&root, iter->root, frame_entry->path);
+	else
+		git_buf_puts(&root, iter->root);
+
+	if (git_buf_oom(&root)) {
+		error = -1;
+		goto done;
+	}
+
+	new_frame->path_len = frame_entry ? frame_entry->path_len : 0;
+
+	if (iter->untracked &&
+	    (error = filesystem_iterator_frame_push_untracked(&cached,
+			&untracked, iter, frame_entry, new_frame, root.ptr)) < 0)
+		goto done;
+
+	/* Any error here is equivalent to the dir not existing, skip over it */
+	if (!cached && (error = git_path_diriter_init(
+			&diriter, root.ptr, iter->dirload_flags)) < 0) {
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+
+	if ((error = git_vector_init(&new_frame->entries, 64,
+			iterator__ignore_case(&iter->base) ?
+			filesystem_iterator_entry_cmp_icase :
+			filesystem_iterator_entry_cmp)) < 0)
+		goto done;
+
+	git_pool_init(&new_frame->entry_pool, 1);
+
+	/* check if this directory is ignored */
+	filesystem_iterator_frame_push_ignores(iter, frame_entry, new_frame);
+
+	if (cached)
+		error = filesystem_iterator_frame_load_untracked(iter,
+			frame_entry, new_frame, &untracked);
+	else
+		error = filesystem_iterator_frame_readdir(iter,
+			frame_entry, new_frame, &diriter);
+
+	if (error < 0)
+		goto done;
 
 	/* sort now that directory suffix is added */
 	git_vector_sort(&new_frame->entries);
@@ -1463,6 +1800,7 @@ done:
 	if (error < 0)
 		git_array_pop(iter->frames);
 
+	git_vector_free_deep(&untracked);
 	git_buf_dispose(&root);
 	git_path_diriter_free(&diriter);
 	return error;
@@ -1481,6 +1819,130 @@ GIT_INLINE(void) filesystem_iterator_frame_pop(filesystem_iterator *iter)
 	git_vector_free(&frame->entries);
 }
 
+static bool filesystem_iterator_is_tracked(
+	filesystem_iterator *iter, filesystem_iterator_entry *entry)
+{
+	const git_index_entry *index_entry;
+	size_t pos;
+
+	if (!S_ISDIR(entry->st.st_mode))
+		return git_index_snapshot_find(&pos, &iter->index_snapshot,
+			iter->base.entry_srch, entry->path, entry->path_len,
+			GIT_INDEX_STAGE_ANY) == 0;
+
+	/* a directory is tracked if the index has anything in it */
+	git_index_snapshot_find(&pos, &iter->index_snapshot,
+		iter->base.entry_srch, entry->path, entry->path_len, 0);
+
+	return (index_entry = git_vector_get(&iter->index_snapshot, pos)) != NULL &&
+		iter->base.strncomp(index_entry->path, entry->path, entry->path_len) == 0;
+}
+
+static bool filesystem_iterator_entry_is_ignored(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *frame,
+	filesystem_iterator_entry *entry)
+{
+	int is_ignored;
+
+	if (git_ignore__lookup(&is_ignored, &iter->ignores, entry->path,
+			S_ISDIR(entry->st.st_mode) ? GIT_DIR_FLAG_TRUE : GIT_DIR_FLAG_FALSE) < 0) {
+		git_error_clear();
+		is_ignored = GIT_IGNORE_NOTFOUND;
+	}
+
+	if (is_ignored <= GIT_IGNORE_NOTFOUND)
+		is_ignored = frame->is_ignored;
+
+	return (is_ignored == GIT_IGNORE_TRUE);
+}
+
+/*
+ * Record the untracked files of a directory that was read from disk in
+ * the untracked cache, once all its entries have been seen.  Only a
+ * complete list is recorded: every untracked directory in it must have
+ * been iterated to know whether it has untracked files.
+ */
+static int filesystem_iterator_frame_record_untracked(
+	filesystem_iterator *iter, filesystem_iterator_frame *frame)
+{
+	git_vector untracked = GIT_VECTOR_INIT;
+	filesystem_iterator_entry *entry;
+	bool complete = true, nonempty = frame->untracked_nonempty;
+	char *name;
+	size_t i;
+	int error = 0;
+
+	if (!frame->untracked_dir || frame->untracked_cached)
+		goto done;
+
+	git_vector_foreach(&frame->entries, i, entry) {
+		if (filesystem_iterator_is_tracked(iter, entry))
+			continue;
+
+		if (entry->st.st_mode == GIT_FILEMODE_UNREADABLE ||
+		    entry->st.st_mode == GIT_FILEMODE_COMMIT) {
+			complete = false;
+			continue;
+		}
+
+		if (filesystem_iterator_entry_is_ignored(iter, frame, entry))
+			continue;
+
+		/* empty directories are not listed */
+		if (S_ISDIR(entry->st.st_mode) &&
+		    entry->untracked != FILESYSTEM_UNTRACKED_NONEMPTY) {
+			if (entry->untracked == FILESYSTEM_UNTRACKED_UNKNOWN)
+				complete = false;
+
+			continue;
+		}
+
+		nonempty = true;
+
+		if (!complete)
+			continue;
+
+		name = git__strndup(entry->path + frame->path_len,
+			entry->path_len - frame->path_len);
+
+		if (!name || git_vector_insert(&untracked, name) < 0) {
+			git__free(name);
+			error = -1;
+			goto done;
+		}
+	}
+
+	/* a directory changed in this second might change again unnoticed */
+	if (!complete ||
+	    frame->untracked_st.mtime.seconds >= (int32_t)iter->untracked_time)
+		goto done;
+
+	if (git_mutex_lock(&iter->untracked->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock untracked cache");
+		error = -1;
+		goto done;
+	}
+
+	git_untracked_cache_dir_set(frame->untracked_dir, &untracked);
+	memcpy(&frame->untracked_dir->st, &frame->untracked_st, sizeof(git_untracked_stat));
+	git_oid_cpy(&frame->untracked_dir->exclude_id, &frame->exclude_id);
+	iter->untracked->changed = true;
+
+	git_mutex_unlock(&iter->untracked->lock);
+
+done:
+	/* tell the parent directory whether this one has untracked files */
+	if (frame->untracked_dir && frame->frame_entry)
+		frame->frame_entry->untracked =
+			nonempty ? FILESYSTEM_UNTRACKED_NONEMPTY :
+			complete ? FILESYSTEM_UNTRACKED_EMPTY :
+			FILESYSTEM_UNTRACKED_UNKNOWN;
+
+	git_vector_free_deep(&untracked);
+	return error;
+}
+
 static void filesystem_iterator_set_current(
 	filesystem_iterator *iter,
 	filesystem_iterator_entry *entry)
@@ -1586,6 +2048,10 @@ static int filesystem_iterator_advance(
 
 		/* no more entries in this frame.  pop the frame out */
 		if (frame->next_idx == frame->entries.length) {
+			if (iter->untracked &&
+			    (error = filesystem_iterator_frame_record_untracked(iter, frame)) < 0)
+				break;
+
 			filesystem_iterator_frame_pop(iter);
 			continue;
 		}
@@ -1851,6 +2317,71 @@ static void filesystem_iterator_clear(filesystem_iterator *iter)
 	iterator_clear(&iter->base);
 }
 
+static int filesystem_iterator_init_untracked(filesystem_iterator *iter)
+{
+	git_repository *repo = iter->base.repo;
+	git_untracked_cache *untracked;
+	git_buf info_exclude = GIT_BUF_INIT;
+	const char *workdir;
+	int info_changed, excludes_changed, error;
+
+	if (!iterator__flag(&iter->base, UNTRACKED_CACHE) ||
+	    !iterator__honor_ignores(&iter->base) ||
+	    iterator__descend_symlinks(&iter->base) ||
+	    !iter->index || !repo ||
+	    (workdir = git_repository_workdir(repo)) == NULL ||
+	    strcmp(workdir, iter->root) != 0)
+		return 0;
+
+	/* directories are only recorded when all their entries are seen */
+	if (iter->base.start_len || iter->base.end_len ||
+	    iter->base.pathlist.length)
+		return 0;
+
+	if ((error = git_index__untracked_cache(&untracked, iter->index, workdir)) < 0 ||
+	    !untracked)
+		return error;
+
+	if ((error = git_repository_item_path(&info_exclude,
+			repo, GIT_REPOSITORY_ITEM_INFO)) < 0 ||
+	    (error = git_buf_puts(&info_exclude, GIT_IGNORE_FILE_INREPO)) < 0)
+		goto done;
+
+	if (git_mutex_lock(&untracked->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock untracked cache");
+		error = -1;
+		goto done;
+	}
+
+	info_changed = git_untracked_file_update(
+		&untracked->info_exclude, info_exclude.ptr);
+	excludes_changed = git_untracked_file_update(&untracked->excludes_file,
+		git_repository_attr_cache(repo)->cfg_excl_file);
+
+	/* the global ignore rules apply to every directory */
+	if (info_changed < 0 || excludes_changed < 0) {
+		error = -1;
+	} else if (info_changed || excludes_changed) {
+		if (untracked->root)
+			git_untracked_cache_dir_invalidate(untracked->root);
+
+		untracked->changed = true;
+	}
+
+	git_mutex_unlock(&untracked->lock);
+
+done:
+	if (error < 0) {
+		git_untracked_cache_free(untracked);
+	} else {
+		iter->untracked = untracked;
+		iter->untracked_time = time(NULL);
+	}
+
+	git_buf_dispose(&info_exclude);
+	return error;
+}
+
 static int filesystem_iterator_init(filesystem_iterator *iter)
 {
 	int error;
@@ -1860,6 +2391,10 @@ static int filesystem_iterator_init(filesystem_iterator *iter)
 			".gitignore", &iter->ignores)) < 0)
 		return error;
 
+	if (!iter->untracked &&
+	    (error = filesystem_iterator_init_untracked(iter)) < 0)
+		return error;
+
 	if ((error = filesystem_iterator_frame_push(iter, NULL)) < 0)
 		return error;
 
@@ -1882,6 +2417,7 @@ static void filesystem_iterator_free(git_iterator *i)
 	git__free(iter->root);
 	git_buf_dispose(&iter->current_path);
 	git_tree_free(iter->tree);
+	git_untracked_cache_free(iter->untracked);
 	if (iter->index)
 		git_index_snapshot_release(&iter->index_snapshot, iter->index);
 	filesystem_iterator_clear(iter);
@@ -2040,6 +2576,7 @@ static bool index_iterator_create_pseudotree(
 	index_iterator *iter,
 	const char *path)
 {
+	const git_tree_cache *cached;
 	const char *prev_path, *relative_path, *dirsep;
 	size_t common_len;
 
@@ -2058,6 +2595,14 @@ static bool index_iterator_create_pseudotree(
 	iter->tree_entry.mode = GIT_FILEMODE_TREE;
 	iter->tree_entry.path = iter->tree_buf.ptr;
 
+	/* the id of the tree is known when the tree cache of the index has it */
+	memset(&iter->tree_entry.id, 0, sizeof(git_oid));
+
+	if (iter->base.index &&
+	    (cached = git_tree_cache_get(iter->base.index->tree, iter->tree_buf.ptr)) != NULL &&
+	    cached->entry_count >= 0)
+		git_oid_cpy(&iter->tree_entry.id, &cached->oid);
+
 	*out = &iter->tree_entry;
 	return true;
 }
@@ -43,6 +43,10 @@ typedef enum {
 	GIT_ITERATOR_DESCEND_SYMLINKS = (1u << 7),
 	/** hash files in workdir or filesystem iterators */
 	GIT_ITERATOR_INCLUDE_HASH = (1u << 8),
+	/** use and update the index's untracked cache; may omit ignored files */
+	GIT_ITERATOR_UNTRACKED_CACHE = (1u << 9),
+	/** don't stat the files that the index's filesystem monitor vouches for */
+	GIT_ITERATOR_FSMONITOR = (1u << 10),
 } git_iterator_flag_t;
 
 typedef enum {
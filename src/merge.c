@@ -352,8 +352,21 @@ static void clear_commit_marks(git_commit_list_node *commit, unsigned int mark)
 		clear_commit_marks_1(&list, git_commit_list_pop(&list), mark);
 }
 
+/*
+ * Walk down from `one` and `twos`, marking the commits reachable from both.
+ *
+ * Commits are visited in decreasing generation number, so a commit is only
+ * visited after all of its descendants that are part of the walk. When
+ * `min_generation` is given, the walk stops at the first commit whose
+ * generation is lower: none of the commits left in the queue can reach a
+ * commit with a generation of `min_generation` or higher.
+ */
 static int paint_down_to_common(
-	git_commit_list **out, git_revwalk *walk, git_commit_list_node *one, git_vector *twos)
+	git_commit_list **out,
+	git_revwalk *walk,
+	git_commit_list_node *one,
+	git_vector *twos,
+	uint32_t min_generation)
 {
 	git_pqueue list;
 	git_commit_list *result = NULL;
@@ -362,7 +375,7 @@ static int paint_down_to_common(
 	int error;
 	unsigned int i;
 
-	if (git_pqueue_init(&list, 0, twos->length * 2, git_commit_list_time_cmp) < 0)
+	if (git_pqueue_init(&list, 0, twos->length * 2, git_commit_list_generation_cmp) < 0)
 		return -1;
 
 	one->flags |= PARENT1;
@@ -387,6 +400,9 @@ static int paint_down_to_common(
 		if (commit == NULL)
 			break;
 
+		if (min_generation && commit->generation < min_generation)
+			break;
+
 		flags = commit->flags & (PARENT1 | PARENT2 | STALE);
 		if (flags == (PARENT1 | PARENT2)) {
 			if (!(commit->flags & RESULT)) {
@@ -438,6 +454,7 @@ static int remove_redundant(git_revwalk *walk, git_vector *commits)
 	for (i = 0; i < commits->length; ++i) {
 		git_commit_list *common = NULL;
 		git_commit_list_node *commit = commits->contents[i];
+		uint32_t min_generation = GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY;
 
 		if (redundant[i])
 			continue;
@@ -445,15 +462,20 @@ static int remove_redundant(git_revwalk *walk, git_vector *commits)
 		git_vector_clear(&work);
 
 		for (j = 0; j < commits->length; j++) {
+			git_commit_list_node *other = commits->contents[j];
+
 			if (i == j || redundant[j])
 				continue;
 
 			filled_index[work.length] = j;
-			if ((error = git_vector_insert(&work, commits->contents[j])) < 0)
+			if ((error = git_vector_insert(&work, other)) < 0)
 				goto done;
+
+			if (other->generation < min_generation)
+				min_generation = other->generation;
 		}
 
-		error = paint_down_to_common(&common, walk, commit, &work);
+		error = paint_down_to_common(&common, walk, commit, &work, min_generation);
 		if (error < 0)
 			goto done;
 
@@ -506,7 +528,7 @@ int git_merge__bases_many(git_commit_list **out, git_revwalk *walk, git_commit_l
 	if (git_commit_list_parse(walk, one) < 0)
 		return -1;
 
-	error = paint_down_to_common(&result, walk, one, twos);
+	error = paint_down_to_common(&result, walk, one, twos, 0);
 	if (error < 0)
 		return error;
 
@@ -551,6 +573,43 @@ int git_merge__bases_many(git_commit_list **out, git_revwalk *walk, git_commit_l
 	return 0;
 }
 
+int git_merge__in_merge_bases(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_list_node *reference)
+{
+	git_commit_list *result = NULL;
+	git_vector twos;
+	void *contents[1];
+	int error;
+
+	if (commit == reference)
+		return 1;
+
+	if ((error = git_commit_list_parse(walk, commit)) < 0 ||
+	    (error = git_commit_list_parse(walk, reference)) < 0)
+		return error;
+
+	/* An ancestor always has a lower generation than its descendants */
+	if (commit->generation != GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY &&
+	    commit->generation >= reference->generation)
+		return 0;
+
+	/* This is just one value, so we can do it on the stack */
+	memset(&twos, 0x0, sizeof(git_vector));
+	contents[0] = reference;
+	twos.length = 1;
+	twos.contents = contents;
+
+	error = paint_down_to_common(&result, walk, commit, &twos, commit->generation);
+	git_commit_list_free(&result);
+
+	if (error < 0)
+		return error;
+
+	return (commit->flags & PARENT2) ? 1 : 0;
+}
+
 int git_repository_mergehead_foreach(
 	git_repository *repo,
 	git_repository_mergehead_foreach_cb cb,
@@ -1016,10 +1075,25 @@ static int index_entry_similarity_calc(
 	git_blob *blob;
 	git_diff_file diff_file = {{{0}}};
 	git_off_t blobsize;
+	git_hashsig_option_t sigopts;
+	bool cached = false;
 	int error;
 
 	*out = NULL;
 
+	/* the repository may have kept the signature of the internal metric */
+	if (repo->sigcache &&
+		git_diff_find_similar__is_internal(opts->metric)) {
+		sigopts = (git_hashsig_option_t)(intptr_t)opts->metric->payload;
+		cached = true;
+
+		error = git_sigcache_get((git_hashsig **)out, &blobsize,
+			repo->sigcache, &entry->id, sigopts);
+
+		if (error != GIT_ENOTFOUND)
+			return error;
+	}
+
 	if ((error = git_blob_lookup(&blob, repo, &entry->id)) < 0)
 		return error;
 
@@ -1039,6 +1113,10 @@ static int index_entry_similarity_calc(
 		git_blob_rawcontent(blob), (size_t)blobsize,
 		opts->metric->payload);
 
+	if (!error && *out && cached)
+		error = git_sigcache_put(repo->sigcache,
+			&entry->id, sigopts, blobsize, *out);
+
 	git_blob_free(blob);
 
 	return error;
@@ -131,6 +131,15 @@ int git_merge__bases_many(
 	git_commit_list_node *one,
 	git_vector *twos);
 
+/*
+ * Determine whether `commit` is reachable from `reference`. Returns 1 if
+ * it is, 0 if it is not, or an error code.
+ */
+int git_merge__in_merge_bases(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_list_node *reference);
+
 /*
  * Three-way tree differencing
  */
@@ -25,7 +25,10 @@
 size_t git_mwindow__window_size = DEFAULT_WINDOW_SIZE;
 size_t git_mwindow__mapped_limit = DEFAULT_MAPPED_LIMIT;
 
-/* Whenever you want to read or modify this, grab git__mwindow_mutex */
+/*
+ * Whenever you want to read or modify this, grab git__mwindow_mutex;
+ * only `used_ctr` is updated atomically, without it.
+ */
 static git_mwindow_ctl mem_ctl;
 
 /* Global list of mwindow files, to open packs once across repos */
@@ -126,6 +129,27 @@ void git_mwindow_free_all(git_mwindow_file *mwf)
 	git_mutex_unlock(&git__mwindow_mutex);
 }
 
+/*
+ * Whether a window is in use; this is an atomic read, so that a window
+ * is only unmapped after the reads of the thread that last released it.
+ */
+GIT_INLINE(bool) window_pinned(git_mwindow *w)
+{
+	return git_atomic_add(&w->inuse_cnt, 0) != 0;
+}
+
+/* Unmap a window that is no longer in the list of its file */
+static void free_window(git_mwindow *w)
+{
+	git_mwindow_ctl *ctl = &mem_ctl;
+
+	ctl->mapped -= w->window_map.len;
+	ctl->open_windows--;
+
+	git_futils_mmap_free(&w->window_map);
+	git__free(w);
+}
+
 /*
  * Free all the windows in a sequence, typically because we're done
  * with the file
@@ -150,18 +174,20 @@ void git_mwindow_free_all_locked(git_mwindow_file *mwf)
 		ctl->windowfiles.contents = NULL;
 	}
 
+	if (git_rwlock_wrlock(&mwf->lock) < 0) {
+		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow file");
+		return;
+	}
+
 	while (mwf->windows) {
 		git_mwindow *w = mwf->windows;
-		assert(w->inuse_cnt == 0);
-
-		ctl->mapped -= w->window_map.len;
-		ctl->open_windows--;
-
-		git_futils_mmap_free(&w->window_map);
+		assert(git_atomic_get(&w->inuse_cnt) == 0);
 
 		mwf->windows = w->next;
-		git__free(w);
+		free_window(w);
 	}
+
+	git_rwlock_wrunlock(&mwf->lock);
 }
 
 /*
@@ -175,7 +201,9 @@ int git_mwindow_contains(git_mwindow *win, git_off_t offset)
 }
 
 /*
- * Find the least-recently-used window in a file
+ * Find the least-recently-used window in a file.  Readers pin windows
+ * and stamp them as used under the read lock of the file only, so this
+ * is a hint that the caller checks again under the write lock.
  */
 static void git_mwindow_scan_lru(
 	git_mwindow_file *mwf,
@@ -185,7 +213,7 @@ static void git_mwindow_scan_lru(
 	git_mwindow *w, *w_l;
 
 	for (w_l = NULL, w = mwf->windows; w; w = w->next) {
-		if (!w->inuse_cnt) {
+		if (!window_pinned(w)) {
 			/*
 			 * If the current one is more recent than the last one,
 			 * store it in the output parameter. If lru_w is NULL,
@@ -203,42 +231,56 @@ static void git_mwindow_scan_lru(
 /*
  * Close the least recently used window. You should check to see if
  * the file descriptors need closing from time to time. Called under
- * lock from new_window.
+ * the global lock, from new_window, without the lock of any file.
  */
 static int git_mwindow_close_lru(git_mwindow_file *mwf)
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
 	size_t i;
-	git_mwindow *lru_w = NULL, *lru_l = NULL, **list = &mwf->windows;
-
-	/* FIXME: Does this give us any advantage? */
-	if(mwf->windows)
-		git_mwindow_scan_lru(mwf, &lru_w, &lru_l);
-
-	for (i = 0; i < ctl->windowfiles.length; ++i) {
-		git_mwindow *last = lru_w;
-		git_mwindow_file *cur = git_vector_get(&ctl->windowfiles, i);
-		git_mwindow_scan_lru(cur, &lru_w, &lru_l);
-		if (lru_w != last)
-			list = &cur->windows;
-	}
+	git_mwindow *lru_w, *lru_l;
+	git_mwindow_file *lru_f;
+
+	do {
+		lru_w = lru_l = NULL;
+		lru_f = mwf;
+
+		/* FIXME: Does this give us any advantage? */
+		if (mwf->windows)
+			git_mwindow_scan_lru(mwf, &lru_w, &lru_l);
+
+		for (i = 0; i < ctl->windowfiles.length; ++i) {
+			git_mwindow *last = lru_w;
+			git_mwindow_file *cur = git_vector_get(&ctl->windowfiles, i);
+			git_mwindow_scan_lru(cur, &lru_w, &lru_l);
+			if (lru_w != last)
+				lru_f = cur;
+		}
 
-	if (!lru_w) {
-		git_error_set(GIT_ERROR_OS, "failed to close memory window; couldn't find LRU");
-		return -1;
-	}
+		if (!lru_w) {
+			git_error_set(GIT_ERROR_OS, "failed to close memory window; couldn't find LRU");
+			return -1;
+		}
+
+		if (git_rwlock_wrlock(&lru_f->lock) < 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow file");
+			return -1;
+		}
+
+		/* somebody pinned it since we looked; look again */
+		if (!window_pinned(lru_w))
+			break;
 
-	ctl->mapped -= lru_w->window_map.len;
-	git_futils_mmap_free(&lru_w->window_map);
+		git_rwlock_wrunlock(&lru_f->lock);
+	} while (1);
 
 	if (lru_l)
 		lru_l->next = lru_w->next;
 	else
-		*list = lru_w->next;
+		lru_f->windows = lru_w->next;
 
-	git__free(lru_w);
-	ctl->open_windows--;
+	git_rwlock_wrunlock(&lru_f->lock);
 
+	free_window(lru_w);
 	return 0;
 }
 
@@ -304,6 +346,27 @@ static git_mwindow *new_window(
 	return w;
 }
 
+/* Find the window of the file that holds the range, under one of its locks */
+static git_mwindow *find_window(
+	git_mwindow_file *mwf, git_off_t offset, size_t extra)
+{
+	git_mwindow *w;
+
+	for (w = mwf->windows; w; w = w->next) {
+		if (git_mwindow_contains(w, offset) &&
+			git_mwindow_contains(w, offset + extra))
+			break;
+	}
+
+	return w;
+}
+
+static void pin_window(git_mwindow *w)
+{
+	w->last_used = (size_t)git_atomic_ssize_add(&mem_ctl.used_ctr, 1);
+	git_atomic_inc(&w->inuse_cnt);
+}
+
 /*
  * Open a new window, closing the least recenty used until we have
  * enough space. Don't forget to add it to your list
@@ -315,44 +378,63 @@ unsigned char *git_mwindow_open(
 	size_t extra,
 	unsigned int *left)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
 	git_mwindow *w = *cursor;
 
-	if (git_mutex_lock(&git__mwindow_mutex)) {
-		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
-		return NULL;
-	}
-
+	/*
+	 * The window of the cursor is pinned, so nobody unmaps it: if it
+	 * holds the range, there is nothing to lock.
+	 */
 	if (!w || !(git_mwindow_contains(w, offset) && git_mwindow_contains(w, offset + extra))) {
 		if (w) {
-			w->inuse_cnt--;
+			git_atomic_dec(&w->inuse_cnt);
+			*cursor = NULL;
 		}
 
-		for (w = mwf->windows; w; w = w->next) {
-			if (git_mwindow_contains(w, offset) &&
-				git_mwindow_contains(w, offset + extra))
-				break;
+		if (git_rwlock_rdlock(&mwf->lock) < 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow file");
+			return NULL;
 		}
 
+		if ((w = find_window(mwf, offset, extra)) != NULL)
+			pin_window(w);
+
+		git_rwlock_rdunlock(&mwf->lock);
+
 		/*
 		 * If there isn't a suitable window, we need to create a new
-		 * one.
+		 * one.  Windows are only added or closed under the global
+		 * lock, so we can look again and pin the one that another
+		 * thread may have created in the meantime without the lock
+		 * of the file.
 		 */
 		if (!w) {
-			w = new_window(mwf, mwf->fd, mwf->size, offset);
-			if (w == NULL) {
-				git_mutex_unlock(&git__mwindow_mutex);
+			if (git_mutex_lock(&git__mwindow_mutex)) {
+				git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
 				return NULL;
 			}
-			w->next = mwf->windows;
-			mwf->windows = w;
+
+			if ((w = find_window(mwf, offset, extra)) == NULL) {
+				if ((w = new_window(mwf, mwf->fd, mwf->size, offset)) == NULL) {
+					git_mutex_unlock(&git__mwindow_mutex);
+					return NULL;
+				}
+
+				if (git_rwlock_wrlock(&mwf->lock) < 0) {
+					git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow file");
+					free_window(w);
+					git_mutex_unlock(&git__mwindow_mutex);
+					return NULL;
+				}
+
+				w->next = mwf->windows;
+				mwf->windows = w;
+				git_rwlock_wrunlock(&mwf->lock);
+			}
+
+			pin_window(w);
+			git_mutex_unlock(&git__mwindow_mutex);
 		}
-	}
 
-	/* If we changed w, store it in the cursor */
-	if (w != *cursor) {
-		w->last_used = ctl->used_ctr++;
-		w->inuse_cnt++;
 		*cursor = w;
 	}
 
@@ -361,7 +443,6 @@ unsigned char *git_mwindow_open(
 	if (left)
 		*left = (unsigned int)(w->window_map.len - offset);
 
-	git_mutex_unlock(&git__mwindow_mutex);
 	return (unsigned char *) w->window_map.data + offset;
 }
 
@@ -410,13 +491,7 @@ void git_mwindow_close(git_mwindow **window)
 {
 	git_mwindow *w = *window;
 	if (w) {
-		if (git_mutex_lock(&git__mwindow_mutex)) {
-			git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
-			return;
-		}
-
-		w->inuse_cnt--;
-		git_mutex_unlock(&git__mwindow_mutex);
+		git_atomic_dec(&w->inuse_cnt);
 		*window = NULL;
 	}
 }
@@ -18,10 +18,16 @@ typedef struct git_mwindow {
 	git_map window_map;
 	git_off_t offset;
 	size_t last_used;
-	size_t inuse_cnt;
+	git_atomic inuse_cnt;
 } git_mwindow;
 
+/*
+ * The windows of a file are only added and removed under the global
+ * mwindow mutex and the write lock of the file, so that looking up and
+ * pinning a window only takes the read lock of its file.
+ */
 typedef struct git_mwindow_file {
+	git_rwlock lock;
 	git_mwindow *windows;
 	int fd;
 	git_off_t size;
@@ -33,7 +39,7 @@ typedef struct git_mwindow_ctl {
 	unsigned int mmap_calls;
 	unsigned int peak_open_windows;
 	size_t peak_mapped;
-	size_t used_ctr;
+	git_atomic_ssize used_ctr;
 	git_vector windowfiles;
 } git_mwindow_ctl;
 
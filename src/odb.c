@@ -452,6 +452,13 @@ int git_odb_new(git_odb **out)
 		git__free(db);
 		return -1;
 	}
+	if (git_mutex_init(&db->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize odb mutex");
+		git_vector_free(&db->backends);
+		git_cache_dispose(&db->own_cache);
+		git__free(db);
+		return -1;
+	}
 
 	*out = db;
 	GIT_REFCOUNT_INC(db);
@@ -573,6 +580,11 @@ int git_odb__add_default_backends(
 		add_backend_internal(db, packed, GIT_PACKED_PRIORITY, as_alternates, inode) < 0)
 		return -1;
 
+	/* the commit-graph is opened lazily, on first use */
+	if (!as_alternates && !db->cgraph &&
+		git_commit_graph_new(&db->cgraph, objects_dir, false) < 0)
+		return -1;
+
 	return load_alternates(db, objects_dir, alternate_depth);
 }
 
@@ -687,6 +699,8 @@ static void odb_free(git_odb *db)
 
 	git_vector_free(&db->backends);
 	git_cache_dispose(&db->own_cache);
+	git_commit_graph_free(db->cgraph);
+	git_mutex_free(&db->lock);
 
 	git__memzero(db, sizeof(*db));
 	git__free(db);
@@ -1497,6 +1511,35 @@ int git_odb_write_pack(struct git_odb_writepack **out, git_odb *db, git_indexer_
 	return error;
 }
 
+int git_odb_write_multi_pack_index(git_odb *db)
+{
+	size_t i, writes = 0;
+	int error = GIT_ERROR;
+
+	assert(db);
+
+	for (i = 0; i < db->backends.length && error < 0; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		/* we don't write in alternates! */
+		if (internal->is_alternate)
+			continue;
+
+		if (b->writemidx != NULL) {
+			++writes;
+			error = b->writemidx(b);
+		}
+	}
+
+	if (error == GIT_PASSTHROUGH)
+		error = 0;
+	if (error < 0 && !writes)
+		error = git_odb__error_unsupported_in_backend("write multi-pack-index");
+
+	return error;
+}
+
 void *git_odb_backend_data_alloc(git_odb_backend *backend, size_t len)
 {
 	GIT_UNUSED(backend);
@@ -1530,9 +1573,56 @@ int git_odb_refresh(struct git_odb *db)
 		}
 	}
 
+	if (db->cgraph) {
+		if (git_mutex_lock(&db->lock) < 0) {
+			git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+			return -1;
+		}
+		git_commit_graph_refresh(db->cgraph);
+		git_mutex_unlock(&db->lock);
+	}
+
 	return 0;
 }
 
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb)
+{
+	int error;
+
+	if (!odb->cgraph)
+		return GIT_ENOTFOUND;
+
+	if (git_mutex_lock(&odb->lock) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return -1;
+	}
+	error = git_commit_graph_get_file(out, odb->cgraph);
+	git_mutex_unlock(&odb->lock);
+
+	return error;
+}
+
+int git_odb__find_pack_entry(
+	struct git_pack_entry *out, git_odb *odb, const git_oid *id)
+{
+	size_t i;
+	int error;
+
+	assert(out && odb && id);
+
+	for (i = 0; i < odb->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&odb->backends, i);
+
+		error = git_odb__pack_backend_entry(out, internal->backend, id);
+
+		if (error != GIT_ENOTFOUND)
+			return error;
+	}
+
+	git_error_clear();
+	return GIT_ENOTFOUND;
+}
+
 int git_odb__error_mismatch(const git_oid *expected, const git_oid *actual)
 {
 	char expected_oid[GIT_OID_HEXSZ + 1], actual_oid[GIT_OID_HEXSZ + 1];
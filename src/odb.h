@@ -15,6 +15,7 @@
 
 #include "vector.h"
 #include "cache.h"
+#include "commit_graph.h"
 #include "posix.h"
 #include "filter.h"
 
@@ -24,6 +25,8 @@
 
 extern bool git_odb__strict_hash_verification;
 
+struct git_pack_entry;
+
 /* DO NOT EXPORT */
 typedef struct {
 	void *data;			/**< Raw, decompressed object data. */
@@ -40,8 +43,10 @@ struct git_odb_object {
 /* EXPORT */
 struct git_odb {
 	git_refcount rc;
+	git_mutex lock;  /* protects the lazily loaded commit-graph */
 	git_vector backends;
 	git_cache own_cache;
+	git_commit_graph *cgraph;
 	unsigned int do_fsync :1;
 };
 
@@ -61,6 +66,29 @@ int git_odb__add_default_backends(
 	git_odb *db, const char *objects_dir,
 	bool as_alternates, int alternate_depth);
 
+/*
+ * Get the commit-graph file of the (non-alternate) object directory, if
+ * there is one. Returns GIT_ENOTFOUND when the repository has no usable
+ * commit-graph. The caller gets a reference to the file and must release
+ * it with `git_commit_graph_file_release`.
+ */
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb);
+
+/*
+ * Find where the object is stored in the packfiles of the database, if
+ * it is packed at all. Returns GIT_ENOTFOUND otherwise. The packfile is
+ * owned by the odb.
+ */
+int git_odb__find_pack_entry(
+	struct git_pack_entry *out, git_odb *odb, const git_oid *id);
+
+/*
+ * Find the object in the packfiles of `backend`. Returns GIT_ENOTFOUND
+ * if the object is not there, or if `backend` is not a pack backend.
+ */
+int git_odb__pack_backend_entry(
+	struct git_pack_entry *out, git_odb_backend *backend, const git_oid *id);
+
 /*
  * Hash a git_rawobj internally.
  * The `git_rawobj` is supposed to be previously initialized
@@ -16,6 +16,7 @@
 #include "odb.h"
 #include "delta.h"
 #include "sha1_lookup.h"
+#include "midx.h"
 #include "mwindow.h"
 #include "pack.h"
 
@@ -26,6 +27,8 @@
 
 struct pack_backend {
 	git_odb_backend parent;
+	git_midx_file *midx;
+	git_vector midx_packs;
 	git_vector packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
@@ -36,6 +39,11 @@ struct pack_writepack {
 	git_indexer *indexer;
 };
 
+struct pack_readstream {
+	git_odb_stream parent;
+	git_packfile_object_stream *object;
+};
+
 /**
  * The wonderful tale of a Packed Object lookup query
  * ===================================================
@@ -94,6 +102,12 @@ struct pack_writepack {
  *	| (starting by the pack where the latest object was found)
  *	| to try to find the OID in one of them.
  *	|
+ *	|-# git_midx_entry_find
+ *	| If the pack folder has a `multi-pack-index`, look the OID up
+ *	| in it: a single binary search yields both the packfile and
+ *	| the offset of the object. Only the packs that are not covered
+ *	| by the multi-pack-index are searched one by one.
+ *	|
  *	|-# pack_entry_find1
  *		| Check the index of an individual pack to see if the SHA1
  *		| OID can be found. If we can find the offset to that SHA1
@@ -214,6 +228,14 @@ static int packfile_load__cb(void *data, git_buf *path)
 			return 0;
 	}
 
+	/* packs covered by the multi-pack-index are looked up through it */
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+
+		if (strncmp(p->pack_name, path_str, cmp_len) == 0)
+			return 0;
+	}
+
 	error = git_mwindow_get_pack(&pack, path->ptr);
 
 	/* ignore missing .pack file as git does */
@@ -229,6 +251,26 @@ static int packfile_load__cb(void *data, git_buf *path)
 
 }
 
+static int pack_entry_find_midx(
+	struct git_pack_entry *e,
+	struct pack_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	git_midx_entry midx_entry;
+	struct git_pack_file *p;
+	int error;
+
+	if ((error = git_midx_entry_find(&midx_entry, backend->midx, short_oid, len)) < 0)
+		return error;
+
+	if ((p = git_vector_get(&backend->midx_packs, midx_entry.pack_index)) == NULL)
+		return git_odb__error_notfound(
+			"multi-pack-index refers to a missing pack", short_oid, len);
+
+	return git_pack_entry_init(e, p, &midx_entry.sha1, midx_entry.offset);
+}
+
 static int pack_entry_find_inner(
 	struct git_pack_entry *e,
 	struct pack_backend *backend,
@@ -241,6 +283,12 @@ static int pack_entry_find_inner(
 		git_pack_entry_find(e, last_found, oid, GIT_OID_HEXSZ) == 0)
 		return 0;
 
+	if (backend->midx &&
+		pack_entry_find_midx(e, backend, oid, GIT_OID_HEXSZ) == 0) {
+		backend->last_found = e->p;
+		return 0;
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
 
@@ -261,10 +309,6 @@ static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backen
 {
 	struct git_pack_file *last_found = backend->last_found;
 
-	if (backend->last_found &&
-		git_pack_entry_find(e, backend->last_found, oid, GIT_OID_HEXSZ) == 0)
-		return 0;
-
 	if (!pack_entry_find_inner(e, backend, oid, last_found))
 		return 0;
 
@@ -294,6 +338,19 @@ static int pack_entry_find_prefix(
 		}
 	}
 
+	if (backend->midx) {
+		error = pack_entry_find_midx(e, backend, short_oid, len);
+		if (error == GIT_EAMBIGUOUS)
+			return error;
+		if (!error) {
+			if (found && git_oid_cmp(&e->sha1, &found_full_oid))
+				return git_odb__error_ambiguous("found multiple pack entries");
+			git_oid_cpy(&found_full_oid, &e->sha1);
+			found = true;
+			backend->last_found = e->p;
+		}
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
 
@@ -328,6 +385,111 @@ static int pack_entry_find_prefix(
  * Implement the git_odb_backend API calls
  *
  ***********************************************************/
+static void remove_multi_pack_index(struct pack_backend *backend)
+{
+	size_t i;
+
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+
+		if (backend->last_found == p)
+			backend->last_found = NULL;
+
+		git_mwindow_put_pack(p);
+	}
+
+	git_vector_clear(&backend->midx_packs);
+	git_midx_free(backend->midx);
+	backend->midx = NULL;
+}
+
+/*
+ * The packs that were loaded before the multi-pack-index that covers
+ * them are dropped from the list of packs, so that the objects that are
+ * missing from it are not looked up in them a second time.
+ */
+static void remove_packs_in_multi_pack_index(struct pack_backend *backend)
+{
+	struct git_pack_file *p;
+	size_t i, j;
+
+	for (i = backend->packs.length; i > 0; i--) {
+		p = git_vector_get(&backend->packs, i - 1);
+
+		for (j = 0; j < backend->midx_packs.length; j++) {
+			if (git_vector_get(&backend->midx_packs, j) == p)
+				break;
+		}
+
+		if (j == backend->midx_packs.length)
+			continue;
+
+		git_vector_remove(&backend->packs, i - 1);
+		git_mwindow_put_pack(p);
+	}
+}
+
+/*
+ * Load the `multi-pack-index` of the pack folder, if there is one and it
+ * changed since we last looked. A multi-pack-index that cannot be used
+ * (because it is corrupt, or because one of the packs it refers to has
+ * gone away) is ignored, and the packs are searched one by one instead.
+ */
+static int refresh_multi_pack_index(struct pack_backend *backend)
+{
+	git_buf midx_path = GIT_BUF_INIT, idx_path = GIT_BUF_INIT;
+	const char *packfile_name;
+	struct git_pack_file *p;
+	size_t i;
+	int error;
+
+	if ((error = git_buf_joinpath(&midx_path, backend->pack_folder, GIT_MIDX_FILE)) < 0)
+		return error;
+
+	if (!git_path_exists(git_buf_cstr(&midx_path))) {
+		remove_multi_pack_index(backend);
+		goto done;
+	}
+
+	if (backend->midx && !git_midx_needs_refresh(backend->midx, git_buf_cstr(&midx_path)))
+		goto done;
+
+	remove_multi_pack_index(backend);
+
+	if (git_midx_open(&backend->midx, git_buf_cstr(&midx_path)) < 0) {
+		backend->midx = NULL;
+		git_error_clear();
+		goto done;
+	}
+
+	git_vector_foreach(&backend->midx->packfile_names, i, packfile_name) {
+		git_buf_clear(&idx_path);
+
+		if ((error = git_buf_joinpath(&idx_path, backend->pack_folder, packfile_name)) < 0)
+			break;
+
+		if ((error = git_mwindow_get_pack(&p, git_buf_cstr(&idx_path))) < 0) {
+			git_error_clear();
+			error = 0;
+			remove_multi_pack_index(backend);
+			break;
+		}
+
+		if ((error = git_vector_insert(&backend->midx_packs, p)) < 0) {
+			git_mwindow_put_pack(p);
+			break;
+		}
+	}
+
+	if (backend->midx && !error)
+		remove_packs_in_multi_pack_index(backend);
+
+done:
+	git_buf_dispose(&midx_path);
+	git_buf_dispose(&idx_path);
+	return error;
+}
+
 static int pack_backend__refresh(git_odb_backend *backend_)
 {
 	int error;
@@ -341,6 +503,9 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL, 0);
 
+	if ((error = refresh_multi_pack_index(backend)) < 0)
+		return error;
+
 	git_buf_sets(&path, backend->pack_folder);
 
 	/* reload all packs */
@@ -408,6 +573,77 @@ static int pack_backend__read(
 	return 0;
 }
 
+static int pack_backend__readstream_read(
+	git_odb_stream *_stream,
+	char *buffer,
+	size_t len)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+
+	return (int)git_packfile_object_stream_read(stream->object,
+		buffer, min(len, INT_MAX));
+}
+
+static void pack_backend__readstream_free(git_odb_stream *_stream)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+
+	git_packfile_object_stream_free(stream->object);
+	git__free(stream);
+}
+
+static int pack_backend__readstream(
+	git_odb_stream **stream_out,
+	size_t *len_out,
+	git_object_t *type_out,
+	git_odb_backend *backend,
+	const git_oid *oid)
+{
+	struct pack_readstream *stream = NULL;
+	git_hash_ctx *hash_ctx = NULL;
+	struct git_pack_entry e;
+	int error;
+
+	assert(stream_out && len_out && type_out && backend && oid);
+
+	*stream_out = NULL;
+
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0)
+		return error;
+
+	stream = git__calloc(1, sizeof(struct pack_readstream));
+	GIT_ERROR_CHECK_ALLOC(stream);
+
+	hash_ctx = git__malloc(sizeof(git_hash_ctx));
+	if (!hash_ctx) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_hash_ctx_init(hash_ctx)) < 0 ||
+	    (error = git_packfile_object_stream_open(&stream->object,
+			len_out, type_out, e.p, e.offset)) < 0)
+		goto done;
+
+	stream->parent.backend = backend;
+	stream->parent.hash_ctx = hash_ctx;
+	stream->parent.read = &pack_backend__readstream_read;
+	stream->parent.free = &pack_backend__readstream_free;
+
+	*stream_out = (git_odb_stream *)stream;
+
+done:
+	if (error < 0) {
+		if (hash_ctx) {
+			git_hash_ctx_cleanup(hash_ctx);
+			git__free(hash_ctx);
+		}
+		git__free(stream);
+	}
+
+	return error;
+}
+
 static int pack_backend__read_prefix(
 	git_oid *out_oid,
 	void **buffer_p,
@@ -477,6 +713,11 @@ static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb c
 	if ((error = pack_backend__refresh(_backend)) < 0)
 		return error;
 
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if ((error = git_pack_foreach_entry(p, cb, data)) != 0)
+			return error;
+	}
+
 	git_vector_foreach(&backend->packs, i, p) {
 		if ((error = git_pack_foreach_entry(p, cb, data)) != 0)
 			return error;
@@ -485,6 +726,61 @@ static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb c
 	return 0;
 }
 
+static int add_packs_to_midx_writer(
+	git_midx_writer *w,
+	const git_vector *packs)
+{
+	struct git_pack_file *p;
+	git_buf idx_path = GIT_BUF_INIT;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(packs, i, p) {
+		git_buf_clear(&idx_path);
+
+		if ((error = git_buf_puts(&idx_path, p->pack_name)) < 0)
+			break;
+
+		git_buf_truncate(&idx_path, git_buf_len(&idx_path) - strlen(".pack"));
+
+		if ((error = git_buf_puts(&idx_path, ".idx")) < 0 ||
+		    (error = git_midx_writer_add(w, git_buf_cstr(&idx_path))) < 0)
+			break;
+	}
+
+	git_buf_dispose(&idx_path);
+	return error;
+}
+
+static int pack_backend__writemidx(git_odb_backend *_backend)
+{
+	struct pack_backend *backend;
+	git_midx_writer *w = NULL;
+	int error;
+
+	assert(_backend);
+
+	backend = (struct pack_backend *)_backend;
+
+	if (backend->pack_folder == NULL)
+		return GIT_PASSTHROUGH;
+
+	/* Make sure we know about the packfiles */
+	if ((error = pack_backend__refresh(_backend)) < 0 ||
+	    (error = git_midx_writer_new(&w, backend->pack_folder)) < 0 ||
+	    (error = add_packs_to_midx_writer(w, &backend->midx_packs)) < 0 ||
+	    (error = add_packs_to_midx_writer(w, &backend->packs)) < 0 ||
+	    (error = git_midx_writer_commit(w)) < 0)
+		goto done;
+
+	/* Start using the new multi-pack-index right away. */
+	error = refresh_multi_pack_index(backend);
+
+done:
+	git_midx_writer_free(w);
+	return error;
+}
+
 static int pack_backend__writepack_append(struct git_odb_writepack *_writepack, const void *data, size_t size, git_indexer_progress *stats)
 {
 	struct pack_writepack *writepack = (struct pack_writepack *)_writepack;
@@ -560,11 +856,14 @@ static void pack_backend__free(git_odb_backend *_backend)
 
 	backend = (struct pack_backend *)_backend;
 
+	remove_multi_pack_index(backend);
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p = git_vector_get(&backend->packs, i);
 		git_mwindow_put_pack(p);
 	}
 
+	git_vector_free(&backend->midx_packs);
 	git_vector_free(&backend->packs);
 	git__free(backend->pack_folder);
 	git__free(backend);
@@ -575,7 +874,13 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	struct pack_backend *backend = git__calloc(1, sizeof(struct pack_backend));
 	GIT_ERROR_CHECK_ALLOC(backend);
 
+	if (git_vector_init(&backend->midx_packs, 0, NULL) < 0) {
+		git__free(backend);
+		return -1;
+	}
+
 	if (git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+		git_vector_free(&backend->midx_packs);
 		git__free(backend);
 		return -1;
 	}
@@ -585,11 +890,13 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
 	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.readstream = &pack_backend__readstream;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.exists_prefix = &pack_backend__exists_prefix;
 	backend->parent.refresh = &pack_backend__refresh;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.writepack = &pack_backend__writepack;
+	backend->parent.writemidx = &pack_backend__writemidx;
 	backend->parent.freshen = &pack_backend__freshen;
 	backend->parent.free = &pack_backend__free;
 
@@ -597,6 +904,15 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	return 0;
 }
 
+int git_odb__pack_backend_entry(
+	struct git_pack_entry *out, git_odb_backend *backend, const git_oid *id)
+{
+	if (backend->free != pack_backend__free)
+		return GIT_ENOTFOUND;
+
+	return pack_entry_find(out, (struct pack_backend *)backend, id);
+}
+
 int git_odb_backend_one_pack(git_odb_backend **backend_out, const char *idx)
 {
 	struct pack_backend *backend = NULL;
@@ -0,0 +1,1021 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack-bitmap.h"
+
+#include "git2/commit.h"
+#include "git2/revwalk.h"
+#include "git2/tree.h"
+
+#include "filebuf.h"
+#include "fileops.h"
+#include "mwindow.h"
+#include "path.h"
+#include "pool.h"
+#include "repository.h"
+
+#define BITMAP_SIGNATURE "BITM"
+#define BITMAP_VERSION 1
+#define BITMAP_HEADER_SIZE (4 + 2 + 2 + 4 + GIT_OID_RAWSZ)
+#define BITMAP_ENTRY_HEADER_SIZE (4 + 1 + 1)
+#define BITMAP_MAX_XOR_OFFSET 160
+
+#define BITMAP_OPT_FULL_DAG 0x1
+#define BITMAP_OPT_HASH_CACHE 0x4
+
+/* One in this many commits gets a bitmap when writing. */
+#define BITMAP_COMMIT_INTERVAL 100
+
+struct stored_bitmap {
+	const git_oid *commit;
+
+	/* The serialized bitmap, XOR'ed with the one of `xor_base`. */
+	const unsigned char *ewah;
+	size_t ewah_len;
+	struct stored_bitmap *xor_base;
+
+	git_bitmap bitmap;
+	unsigned int loaded:1;
+};
+
+/* An object that is reachable but not part of the pack. */
+struct ext_object {
+	git_oid id;
+	git_object_t type;
+	size_t pos;
+};
+
+typedef git_array_t(git_oid) bitmap_oid_array;
+
+struct git_pack_bitmap_index {
+	git_repository *repo;
+	struct git_pack_file *pack;
+	git_map map;
+
+	size_t num_objects;
+	git_oid *oids; /* in index order */
+	git_off_t *offsets; /* in index order */
+	uint32_t *pack_order; /* pack position -> index position */
+	uint32_t *index_to_pack; /* index position -> pack position */
+	const unsigned char *name_hashes;
+
+	git_bitmap commits;
+	git_bitmap trees;
+	git_bitmap blobs;
+	git_bitmap tags;
+
+	struct stored_bitmap *stored;
+	size_t stored_len;
+	git_oidmap *stored_map;
+
+	git_pool ext_pool;
+	git_array_t(struct ext_object *) ext;
+	git_oidmap *ext_map;
+};
+
+GIT_INLINE(uint32_t) bitmap_get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+GIT_INLINE(uint16_t) bitmap_get_be16(const unsigned char *p)
+{
+	return (uint16_t)(((uint16_t)p[0] << 8) | p[1]);
+}
+
+static int bitmap_error(const char *message)
+{
+	git_error_set(GIT_ERROR_ODB, "invalid pack bitmap - %s", message);
+	return -1;
+}
+
+static int count_object(const git_oid *id, git_off_t offset, void *payload)
+{
+	GIT_UNUSED(id);
+	GIT_UNUSED(offset);
+	GIT_UNUSED(payload);
+	return 0;
+}
+
+struct collect_data {
+	git_pack_bitmap_index *idx;
+	size_t i;
+};
+
+static int collect_object(const git_oid *id, git_off_t offset, void *payload)
+{
+	struct collect_data *data = payload;
+
+	if (data->i >= data->idx->num_objects)
+		return bitmap_error("the pack index changed");
+
+	git_oid_cpy(&data->idx->oids[data->i], id);
+	data->idx->offsets[data->i] = offset;
+	data->i++;
+
+	return 0;
+}
+
+static int offset_cmp(const void *a, const void *b, void *payload)
+{
+	const git_off_t *offsets = payload;
+	git_off_t offset_a = offsets[*(const uint32_t *)a];
+	git_off_t offset_b = offsets[*(const uint32_t *)b];
+
+	return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+/*
+ * Allocate the index for the pack at `idx_path`, and compute the
+ * position of each of its objects in the pack.
+ */
+static int bitmap_index_new(
+	git_pack_bitmap_index **out,
+	git_repository *repo,
+	const char *idx_path)
+{
+	git_pack_bitmap_index *idx;
+	struct collect_data data = {0};
+	size_t i;
+	int error;
+
+	idx = git__calloc(1, sizeof(git_pack_bitmap_index));
+	GIT_ERROR_CHECK_ALLOC(idx);
+
+	idx->repo = repo;
+	git_pool_init(&idx->ext_pool, sizeof(struct ext_object));
+
+	if ((error = git_oidmap_new(&idx->stored_map)) < 0 ||
+	    (error = git_oidmap_new(&idx->ext_map)) < 0 ||
+	    (error = git_mwindow_get_pack(&idx->pack, idx_path)) < 0)
+		goto done;
+
+	/* Open the pack index so we know the number of objects. */
+	if ((error = git_pack_foreach_entry_offset(idx->pack, count_object, NULL)) < 0)
+		goto done;
+
+	idx->num_objects = idx->pack->num_objects;
+
+	idx->oids = git__calloc(idx->num_objects + 1, sizeof(git_oid));
+	idx->offsets = git__calloc(idx->num_objects + 1, sizeof(git_off_t));
+	idx->pack_order = git__calloc(idx->num_objects + 1, sizeof(uint32_t));
+	idx->index_to_pack = git__calloc(idx->num_objects + 1, sizeof(uint32_t));
+
+	if (!idx->oids || !idx->offsets || !idx->pack_order || !idx->index_to_pack) {
+		git_error_set_oom();
+		error = -1;
+		goto done;
+	}
+
+	data.idx = idx;
+	if ((error = git_pack_foreach_entry_offset(idx->pack, collect_object, &data)) < 0)
+		goto done;
+
+	for (i = 0; i < idx->num_objects; i++)
+		idx->pack_order[i] = (uint32_t)i;
+
+	git__qsort_r(idx->pack_order, idx->num_objects, sizeof(uint32_t),
+		offset_cmp, idx->offsets);
+
+	for (i = 0; i < idx->num_objects; i++)
+		idx->index_to_pack[idx->pack_order[i]] = (uint32_t)i;
+
+done:
+	if (error < 0)
+		git_pack_bitmap_index_free(idx);
+	else
+		*out = idx;
+
+	return error;
+}
+
+void git_pack_bitmap_index_free(git_pack_bitmap_index *idx)
+{
+	size_t i;
+
+	if (!idx)
+		return;
+
+	for (i = 0; i < idx->stored_len; i++)
+		git_bitmap_dispose(&idx->stored[i].bitmap);
+
+	git__free(idx->stored);
+	git_oidmap_free(idx->stored_map);
+
+	git_bitmap_dispose(&idx->commits);
+	git_bitmap_dispose(&idx->trees);
+	git_bitmap_dispose(&idx->blobs);
+	git_bitmap_dispose(&idx->tags);
+
+	git_array_clear(idx->ext);
+	git_oidmap_free(idx->ext_map);
+	git_pool_clear(&idx->ext_pool);
+
+	git__free(idx->oids);
+	git__free(idx->offsets);
+	git__free(idx->pack_order);
+	git__free(idx->index_to_pack);
+
+	if (idx->map.data)
+		git_futils_mmap_free(&idx->map);
+
+	if (idx->pack)
+		git_mwindow_put_pack(idx->pack);
+
+	git__free(idx);
+}
+
+size_t git_pack_bitmap_index_num_objects(git_pack_bitmap_index *idx)
+{
+	return idx->num_objects;
+}
+
+/* Find the position of an object of the pack in the index order. */
+static bool index_position(size_t *out, git_pack_bitmap_index *idx, const git_oid *id)
+{
+	size_t lo = 0, hi = idx->num_objects, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = git_oid__cmp(id, &idx->oids[mid]);
+
+		if (cmp == 0) {
+			*out = mid;
+			return true;
+		}
+
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return false;
+}
+
+/*
+ * Find the bitmap position of an object, adding it to the extended index
+ * if it is not part of the pack.
+ */
+static int bitmap_position(
+	size_t *out,
+	git_pack_bitmap_index *idx,
+	const git_oid *id,
+	git_object_t type)
+{
+	struct ext_object *ext;
+	size_t pos;
+
+	if (index_position(&pos, idx, id)) {
+		*out = idx->index_to_pack[pos];
+		return 0;
+	}
+
+	if ((ext = git_oidmap_get(idx->ext_map, id)) != NULL) {
+		*out = ext->pos;
+		return 0;
+	}
+
+	ext = git_pool_mallocz(&idx->ext_pool, 1);
+	GIT_ERROR_CHECK_ALLOC(ext);
+
+	git_oid_cpy(&ext->id, id);
+	ext->type = type;
+	ext->pos = idx->num_objects + git_array_size(idx->ext);
+
+	if (git_array_alloc(idx->ext) == NULL) {
+		git_error_set_oom();
+		return -1;
+	}
+	*git_array_last(idx->ext) = ext;
+
+	if (git_oidmap_set(idx->ext_map, &ext->id, ext) < 0)
+		return -1;
+
+	*out = ext->pos;
+	return 0;
+}
+
+static int load_stored_bitmap(git_bitmap **out, struct stored_bitmap *stored)
+{
+	git_array_t(struct stored_bitmap *) chain = GIT_ARRAY_INIT;
+	struct stored_bitmap *entry, **item;
+	size_t consumed;
+	int error = 0;
+
+	/* Decode the XOR chain down from the first bitmap that is loaded. */
+	for (entry = stored; entry && !entry->loaded; entry = entry->xor_base) {
+		if ((item = git_array_alloc(chain)) == NULL) {
+			git_error_set_oom();
+			error = -1;
+			goto done;
+		}
+
+		*item = entry;
+	}
+
+	while ((item = git_array_pop(chain)) != NULL) {
+		entry = *item;
+
+		if ((error = git_ewah_read(&entry->bitmap, &consumed, entry->ewah, entry->ewah_len)) < 0)
+			goto done;
+
+		if (entry->xor_base &&
+		    (error = git_bitmap_xor(&entry->bitmap, &entry->xor_base->bitmap)) < 0)
+			goto done;
+
+		entry->loaded = 1;
+	}
+
+	*out = &stored->bitmap;
+
+done:
+	git_array_clear(chain);
+	return error;
+}
+
+static int add_tree(git_bitmap *out, git_pack_bitmap_index *idx, const git_oid *tree_id)
+{
+	git_tree *tree;
+	const git_tree_entry *entry;
+	git_object_t type;
+	size_t i, pos;
+	int error;
+
+	if ((error = bitmap_position(&pos, idx, tree_id, GIT_OBJECT_TREE)) < 0)
+		return error;
+
+	/* The tree and everything below it is already part of the set. */
+	if (git_bitmap_get(out, pos))
+		return 0;
+
+	if ((error = git_bitmap_set(out, pos)) < 0 ||
+	    (error = git_tree_lookup(&tree, idx->repo, tree_id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree); i++) {
+		entry = git_tree_entry_byindex(tree, i);
+		type = git_tree_entry_type(entry);
+
+		if (type == GIT_OBJECT_TREE) {
+			error = add_tree(out, idx, git_tree_entry_id(entry));
+		} else if (type == GIT_OBJECT_BLOB) {
+			if ((error = bitmap_position(&pos, idx, git_tree_entry_id(entry), type)) == 0)
+				error = git_bitmap_set(out, pos);
+		}
+
+		/* Submodule commits are not part of the repository. */
+
+		if (error < 0)
+			break;
+	}
+
+	git_tree_free(tree);
+	return error;
+}
+
+int git_pack_bitmap_reachable(
+	git_bitmap *out,
+	git_pack_bitmap_index *idx,
+	const git_oid *commits,
+	size_t commits_len)
+{
+	bitmap_oid_array stack = GIT_ARRAY_INIT, trees = GIT_ARRAY_INIT;
+	struct stored_bitmap *stored;
+	git_bitmap *bitmap;
+	git_commit *commit;
+	git_oid id, *item;
+	size_t i, pos;
+	unsigned int p;
+	int error = 0;
+
+	for (i = 0; i < commits_len; i++) {
+		if ((item = git_array_alloc(stack)) == NULL)
+			goto oom;
+		git_oid_cpy(item, &commits[i]);
+	}
+
+	/*
+	 * Walk the commits that are neither part of the set already nor
+	 * covered by a stored bitmap, remembering their trees.
+	 */
+	while ((item = git_array_pop(stack)) != NULL) {
+		git_oid_cpy(&id, item);
+
+		if ((error = bitmap_position(&pos, idx, &id, GIT_OBJECT_COMMIT)) < 0)
+			goto done;
+
+		if (git_bitmap_get(out, pos))
+			continue;
+
+		if ((stored = git_oidmap_get(idx->stored_map, &id)) != NULL) {
+			if ((error = load_stored_bitmap(&bitmap, stored)) < 0 ||
+			    (error = git_bitmap_or(out, bitmap)) < 0)
+				goto done;
+			continue;
+		}
+
+		if ((error = git_bitmap_set(out, pos)) < 0 ||
+		    (error = git_commit_lookup(&commit, idx->repo, &id)) < 0)
+			goto done;
+
+		if ((item = git_array_alloc(trees)) == NULL) {
+			git_commit_free(commit);
+			goto oom;
+		}
+		git_oid_cpy(item, git_commit_tree_id(commit));
+
+		for (p = 0; p < git_commit_parentcount(commit); p++) {
+			if ((item = git_array_alloc(stack)) == NULL) {
+				git_commit_free(commit);
+				goto oom;
+			}
+			git_oid_cpy(item, git_commit_parent_id(commit, p));
+		}
+
+		git_commit_free(commit);
+	}
+
+	for (i = 0; i < git_array_size(trees); i++) {
+		if ((error = add_tree(out, idx, git_array_get(trees, i))) < 0)
+			goto done;
+	}
+
+	goto done;
+
+oom:
+	git_error_set_oom();
+	error = -1;
+
+done:
+	git_array_clear(stack);
+	git_array_clear(trees);
+	return error;
+}
+
+int git_pack_bitmap_object(
+	git_oid *id,
+	git_object_t *type,
+	uint32_t *name_hash,
+	git_pack_bitmap_index *idx,
+	size_t pos)
+{
+	struct ext_object *ext;
+	size_t index_pos;
+
+	if (pos >= idx->num_objects) {
+		if (pos - idx->num_objects >= git_array_size(idx->ext)) {
+			git_error_set(GIT_ERROR_INVALID, "invalid bitmap position %"PRIuZ, pos);
+			return -1;
+		}
+
+		ext = *git_array_get(idx->ext, pos - idx->num_objects);
+		git_oid_cpy(id, &ext->id);
+		*type = ext->type;
+		*name_hash = 0;
+		return 0;
+	}
+
+	index_pos = idx->pack_order[pos];
+	git_oid_cpy(id, &idx->oids[index_pos]);
+	*name_hash = idx->name_hashes ?
+		bitmap_get_be32(idx->name_hashes + index_pos * 4) : 0;
+
+	if (git_bitmap_get(&idx->commits, pos))
+		*type = GIT_OBJECT_COMMIT;
+	else if (git_bitmap_get(&idx->trees, pos))
+		*type = GIT_OBJECT_TREE;
+	else if (git_bitmap_get(&idx->blobs, pos))
+		*type = GIT_OBJECT_BLOB;
+	else if (git_bitmap_get(&idx->tags, pos))
+		*type = GIT_OBJECT_TAG;
+	else
+		return bitmap_error("object has no type");
+
+	return 0;
+}
+
+static int bitmap_parse(git_pack_bitmap_index *idx, const unsigned char *data, size_t size)
+{
+	git_bitmap *type_bitmaps[] = { &idx->commits, &idx->trees, &idx->blobs, &idx->tags };
+	const unsigned char *pack_checksum;
+	struct stored_bitmap *stored;
+	size_t i, consumed, pos, xor_offset, end;
+	uint16_t options;
+
+	if (size < BITMAP_HEADER_SIZE + GIT_OID_RAWSZ)
+		return bitmap_error("bitmap is too short");
+
+	/* Leave out the trailer. */
+	end = size - GIT_OID_RAWSZ;
+
+	if (memcmp(data, BITMAP_SIGNATURE, 4) != 0)
+		return bitmap_error("unknown signature");
+
+	if (bitmap_get_be16(data + 4) != BITMAP_VERSION)
+		return bitmap_error("unsupported version");
+
+	options = bitmap_get_be16(data + 6);
+	if (!(options & BITMAP_OPT_FULL_DAG))
+		return bitmap_error("bitmaps do not cover the full DAG");
+
+	idx->stored_len = bitmap_get_be32(data + 8);
+
+	pack_checksum = (const unsigned char *)idx->pack->index_map.data +
+		idx->pack->index_map.len - 2 * GIT_OID_RAWSZ;
+	if (memcmp(data + 12, pack_checksum, GIT_OID_RAWSZ) != 0)
+		return bitmap_error("bitmap does not match the packfile");
+
+	data += BITMAP_HEADER_SIZE;
+	end -= BITMAP_HEADER_SIZE;
+
+	for (i = 0; i < ARRAY_SIZE(type_bitmaps); i++) {
+		if (git_ewah_read(type_bitmaps[i], &consumed, data, end) < 0)
+			return -1;
+
+		data += consumed;
+		end -= consumed;
+	}
+
+	if (idx->stored_len > end / BITMAP_ENTRY_HEADER_SIZE)
+		return bitmap_error("bitmap entries are truncated");
+
+	idx->stored = git__calloc(idx->stored_len, sizeof(struct stored_bitmap));
+	GIT_ERROR_CHECK_ALLOC(idx->stored);
+
+	for (i = 0; i < idx->stored_len; i++) {
+		stored = &idx->stored[i];
+
+		if (end < BITMAP_ENTRY_HEADER_SIZE)
+			return bitmap_error("bitmap entries are truncated");
+
+		pos = bitmap_get_be32(data);
+		xor_offset = data[4];
+
+		if (pos >= idx->num_objects)
+			return bitmap_error("bitmap entry refers to an invalid object");
+
+		if (xor_offset > BITMAP_MAX_XOR_OFFSET || xor_offset > i)
+			return bitmap_error("invalid XOR offset");
+
+		data += BITMAP_ENTRY_HEADER_SIZE;
+		end -= BITMAP_ENTRY_HEADER_SIZE;
+
+		if (git_ewah_size(&consumed, data, end) < 0)
+			return -1;
+
+		stored->commit = &idx->oids[pos];
+		stored->ewah = data;
+		stored->ewah_len = consumed;
+		stored->xor_base = xor_offset ? &idx->stored[i - xor_offset] : NULL;
+
+		if (!git_bitmap_get(&idx->commits, idx->index_to_pack[pos]))
+			return bitmap_error("bitmap entry is not a commit");
+
+		if (git_oidmap_set(idx->stored_map, stored->commit, stored) < 0)
+			return -1;
+
+		data += consumed;
+		end -= consumed;
+	}
+
+	if (options & BITMAP_OPT_HASH_CACHE) {
+		if (end / 4 < idx->num_objects)
+			return bitmap_error("name hash cache is truncated");
+
+		idx->name_hashes = data;
+	}
+
+	return 0;
+}
+
+int git_pack_bitmap_index_open(
+	git_pack_bitmap_index **out,
+	git_repository *repo,
+	const char *idx_path)
+{
+	git_pack_bitmap_index *idx = NULL;
+	git_buf path = GIT_BUF_INIT;
+	git_file fd = -1;
+	struct stat st;
+	int error;
+
+	if (!git__suffixcmp(idx_path, ".idx"))
+		error = git_buf_set(&path, idx_path, strlen(idx_path) - strlen(".idx"));
+	else
+		error = git_buf_sets(&path, idx_path);
+
+	if (error < 0 || (error = git_buf_puts(&path, ".bitmap")) < 0)
+		goto done;
+
+	if ((fd = git_futils_open_ro(path.ptr)) < 0) {
+		error = fd;
+		goto done;
+	}
+
+	if (p_fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		git_error_set(GIT_ERROR_ODB, "invalid pack bitmap '%s'", path.ptr);
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+
+	if ((error = bitmap_index_new(&idx, repo, idx_path)) < 0 ||
+	    (error = git_futils_mmap_ro(&idx->map, fd, 0, (size_t)st.st_size)) < 0 ||
+	    (error = bitmap_parse(idx, idx->map.data, idx->map.len)) < 0)
+		goto done;
+
+	*out = idx;
+
+done:
+	if (fd >= 0)
+		p_close(fd);
+
+	if (error < 0)
+		git_pack_bitmap_index_free(idx);
+
+	git_buf_dispose(&path);
+	return error;
+}
+
+struct load_data {
+	git_repository *repo;
+	git_pack_bitmap_index *idx;
+};
+
+static int load_bitmap_cb(void *payload, git_buf *path)
+{
+	struct load_data *data = payload;
+	git_buf idx_path = GIT_BUF_INIT;
+	int error;
+
+	if (git__suffixcmp(path->ptr, ".bitmap") != 0)
+		return 0;
+
+	if ((error = git_buf_set(&idx_path, path->ptr, path->size - strlen(".bitmap"))) < 0 ||
+	    (error = git_buf_puts(&idx_path, ".idx")) < 0)
+		goto done;
+
+	/* A bitmap that cannot be used is not fatal; look for another one. */
+	if (git_pack_bitmap_index_open(&data->idx, data->repo, idx_path.ptr) < 0) {
+		git_error_clear();
+		error = 0;
+	} else {
+		error = GIT_ITEROVER;
+	}
+
+done:
+	git_buf_dispose(&idx_path);
+	return error;
+}
+
+int git_pack_bitmap_index_load(
+	git_pack_bitmap_index **out,
+	git_repository *repo)
+{
+	struct load_data data = { repo, NULL };
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_repository_item_path(&path, repo, GIT_REPOSITORY_ITEM_OBJECTS)) < 0 ||
+	    (error = git_buf_joinpath(&path, path.ptr, "pack")) < 0)
+		goto done;
+
+	if (!git_path_isdir(path.ptr)) {
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+
+	error = git_path_direach(&path, 0, load_bitmap_cb, &data);
+
+	if (error == GIT_ITEROVER) {
+		*out = data.idx;
+		error = 0;
+	} else if (error == 0) {
+		git_error_set(GIT_ERROR_ODB, "no pack bitmap found");
+		error = GIT_ENOTFOUND;
+	}
+
+done:
+	git_buf_dispose(&path);
+	return error;
+}
+
+static int compute_types(git_pack_bitmap_index *idx)
+{
+	struct git_pack_entry e;
+	git_bitmap *bitmap;
+	git_object_t type;
+	size_t i, index_pos, size;
+	int error;
+
+	for (i = 0; i < idx->num_objects; i++) {
+		index_pos = idx->pack_order[i];
+
+		if ((error = git_pack_entry_init(&e, idx->pack, &idx->oids[index_pos], idx->offsets[index_pos])) < 0 ||
+		    (error = git_packfile_resolve_header(&size, &type, idx->pack, e.offset)) < 0)
+			return error;
+
+		switch (type) {
+		case GIT_OBJECT_COMMIT:
+			bitmap = &idx->commits;
+			break;
+		case GIT_OBJECT_TREE:
+			bitmap = &idx->trees;
+			break;
+		case GIT_OBJECT_BLOB:
+			bitmap = &idx->blobs;
+			break;
+		case GIT_OBJECT_TAG:
+			bitmap = &idx->tags;
+			break;
+		default:
+			return bitmap_error("object has an invalid type");
+		}
+
+		if ((error = git_bitmap_set(bitmap, i)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+/* Find the commits of the pack that are not the parent of another one. */
+static int collect_tips(bitmap_oid_array *tips, git_pack_bitmap_index *idx)
+{
+	git_bitmap has_child = GIT_BITMAP_INIT;
+	git_commit *commit;
+	const git_oid *id;
+	size_t i, index_pos;
+	unsigned int p;
+	int error = 0;
+
+	for (i = 0; i < idx->num_objects; i++) {
+		if (!git_bitmap_get(&idx->commits, i))
+			continue;
+
+		if ((error = git_commit_lookup(&commit, idx->repo,
+				&idx->oids[idx->pack_order[i]])) < 0)
+			goto done;
+
+		for (p = 0; p < git_commit_parentcount(commit); p++) {
+			id = git_commit_parent_id(commit, p);
+
+			if (index_position(&index_pos, idx, id) &&
+			    (error = git_bitmap_set(&has_child, idx->index_to_pack[index_pos])) < 0)
+				break;
+		}
+
+		git_commit_free(commit);
+
+		if (error < 0)
+			goto done;
+	}
+
+	for (i = 0; i < idx->num_objects; i++) {
+		git_oid *tip;
+
+		if (!git_bitmap_get(&idx->commits, i) || git_bitmap_get(&has_child, i))
+			continue;
+
+		if ((tip = git_array_alloc(*tips)) == NULL) {
+			git_error_set_oom();
+			error = -1;
+			goto done;
+		}
+
+		git_oid_cpy(tip, &idx->oids[idx->pack_order[i]]);
+	}
+
+done:
+	git_bitmap_dispose(&has_child);
+	return error;
+}
+
+/*
+ * Select the commits to store a bitmap for: the tips, and regularly
+ * spaced commits in between so that walks from older commits are cheap
+ * as well. They are returned in an order where ancestors come first.
+ */
+static int select_commits(bitmap_oid_array *out, git_pack_bitmap_index *idx)
+{
+	bitmap_oid_array tips = GIT_ARRAY_INIT;
+	git_bitmap tip_bitmap = GIT_BITMAP_INIT;
+	git_revwalk *walk = NULL;
+	git_oid id, *item;
+	size_t i, index_pos, count = 0;
+	int error;
+
+	if ((error = collect_tips(&tips, idx)) < 0 ||
+	    (error = git_revwalk_new(&walk, idx->repo)) < 0)
+		goto done;
+
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
+
+	for (i = 0; i < git_array_size(tips); i++) {
+		item = git_array_get(tips, i);
+
+		if ((error = git_revwalk_push(walk, item)) < 0)
+			goto done;
+
+		index_position(&index_pos, idx, item);
+		if ((error = git_bitmap_set(&tip_bitmap, index_pos)) < 0)
+			goto done;
+	}
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		bool is_tip = index_position(&index_pos, idx, &id) &&
+			git_bitmap_get(&tip_bitmap, index_pos);
+
+		if (is_tip || ++count % BITMAP_COMMIT_INTERVAL == 0) {
+			if ((item = git_array_alloc(*out)) == NULL) {
+				git_error_set_oom();
+				error = -1;
+				goto done;
+			}
+
+			git_oid_cpy(item, &id);
+		}
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+done:
+	git_revwalk_free(walk);
+	git_bitmap_dispose(&tip_bitmap);
+	git_array_clear(tips);
+	return error;
+}
+
+static int compute_bitmaps(git_pack_bitmap_index *idx)
+{
+	bitmap_oid_array selected = GIT_ARRAY_INIT;
+	struct stored_bitmap *stored;
+	size_t i, index_pos;
+	int error;
+
+	if ((error = select_commits(&selected, idx)) < 0)
+		goto done;
+
+	idx->stored = git__calloc(git_array_size(selected) + 1, sizeof(struct stored_bitmap));
+	if (!idx->stored) {
+		git_error_set_oom();
+		error = -1;
+		goto done;
+	}
+
+	/*
+	 * Ancestors come first, so the bitmaps computed so far are reused
+	 * for the following ones.
+	 */
+	for (i = 0; i < git_array_size(selected); i++) {
+		if (!index_position(&index_pos, idx, git_array_get(selected, i))) {
+			git_error_set(GIT_ERROR_ODB, "the packfile is not self-contained");
+			error = GIT_ENOTFOUND;
+			goto done;
+		}
+
+		stored = &idx->stored[idx->stored_len];
+		stored->commit = &idx->oids[index_pos];
+
+		if ((error = git_pack_bitmap_reachable(&stored->bitmap, idx, stored->commit, 1)) < 0) {
+			git_bitmap_dispose(&stored->bitmap);
+			goto done;
+		}
+
+		if (git_array_size(idx->ext) > 0) {
+			git_bitmap_dispose(&stored->bitmap);
+			git_error_set(GIT_ERROR_ODB, "the packfile is not self-contained");
+			error = GIT_ENOTFOUND;
+			goto done;
+		}
+
+		stored->loaded = 1;
+		idx->stored_len++;
+
+		if ((error = git_oidmap_set(idx->stored_map, stored->commit, stored)) < 0)
+			goto done;
+	}
+
+done:
+	git_array_clear(selected);
+	return error;
+}
+
+static int write_be32(git_filebuf *file, uint32_t value)
+{
+	value = htonl(value);
+	return git_filebuf_write(file, &value, sizeof(value));
+}
+
+static int write_bitmap(git_filebuf *file, git_buf *buf, const git_bitmap *bitmap, size_t bit_size)
+{
+	int error;
+
+	git_buf_clear(buf);
+
+	if ((error = git_ewah_write(buf, bitmap, bit_size)) < 0)
+		return error;
+
+	return git_filebuf_write(file, buf->ptr, buf->size);
+}
+
+static int write_bitmap_file(
+	git_pack_bitmap_index *idx,
+	const char *path,
+	git_pack_bitmap_name_hash_cb name_hash_cb,
+	void *payload)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf buf = GIT_BUF_INIT;
+	const git_bitmap *type_bitmaps[] = { &idx->commits, &idx->trees, &idx->blobs, &idx->tags };
+	const unsigned char *pack_checksum;
+	uint16_t header[2];
+	unsigned char entry_flags[2] = { 0, 0 };
+	git_oid trailer;
+	size_t i, index_pos;
+	int error;
+
+	if ((error = git_filebuf_open(&file, path, GIT_FILEBUF_HASH_CONTENTS,
+			GIT_PACK_BITMAP_FILE_MODE)) < 0)
+		goto done;
+
+	header[0] = htons(BITMAP_VERSION);
+	header[1] = htons(BITMAP_OPT_FULL_DAG | (name_hash_cb ? BITMAP_OPT_HASH_CACHE : 0));
+	pack_checksum = (const unsigned char *)idx->pack->index_map.data +
+		idx->pack->index_map.len - 2 * GIT_OID_RAWSZ;
+
+	if ((error = git_filebuf_write(&file, BITMAP_SIGNATURE, 4)) < 0 ||
+	    (error = git_filebuf_write(&file, header, sizeof(header))) < 0 ||
+	    (error = write_be32(&file, (uint32_t)idx->stored_len)) < 0 ||
+	    (error = git_filebuf_write(&file, pack_checksum, GIT_OID_RAWSZ)) < 0)
+		goto done;
+
+	for (i = 0; i < ARRAY_SIZE(type_bitmaps); i++) {
+		if ((error = write_bitmap(&file, &buf, type_bitmaps[i], idx->num_objects)) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < idx->stored_len; i++) {
+		index_pos = idx->stored[i].commit - idx->oids;
+
+		if ((error = write_be32(&file, (uint32_t)index_pos)) < 0 ||
+		    (error = git_filebuf_write(&file, entry_flags, sizeof(entry_flags))) < 0 ||
+		    (error = write_bitmap(&file, &buf, &idx->stored[i].bitmap, idx->num_objects)) < 0)
+			goto done;
+	}
+
+	if (name_hash_cb) {
+		for (i = 0; i < idx->num_objects; i++) {
+			if ((error = write_be32(&file, name_hash_cb(&idx->oids[i], payload))) < 0)
+				goto done;
+		}
+	}
+
+	if ((error = git_filebuf_hash(&trailer, &file)) < 0 ||
+	    (error = git_filebuf_write(&file, trailer.id, GIT_OID_RAWSZ)) < 0)
+		goto done;
+
+	error = git_filebuf_commit(&file);
+
+done:
+	git_filebuf_cleanup(&file);
+	git_buf_dispose(&buf);
+	return error;
+}
+
+int git_pack_bitmap_write(
+	git_repository *repo,
+	const char *idx_path,
+	git_pack_bitmap_name_hash_cb name_hash_cb,
+	void *payload)
+{
+	git_pack_bitmap_index *idx = NULL;
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	if (git__suffixcmp(idx_path, ".idx") != 0) {
+		git_error_set(GIT_ERROR_INVALID, "'%s' is not a pack index", idx_path);
+		return -1;
+	}
+
+	if ((error = git_buf_set(&path, idx_path, strlen(idx_path) - strlen(".idx"))) < 0 ||
+	    (error = git_buf_puts(&path, ".bitmap")) < 0 ||
+	    (error = bitmap_index_new(&idx, repo, idx_path)) < 0 ||
+	    (error = compute_types(idx)) < 0 ||
+	    (error = compute_bitmaps(idx)) < 0)
+		goto done;
+
+	error = write_bitmap_file(idx, path.ptr, name_hash_cb, payload);
+
+done:
+	git_pack_bitmap_index_free(idx);
+	git_buf_dispose(&path);
+	return error;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_pack_bitmap_h__
+#define INCLUDE_pack_bitmap_h__
+
+#include "common.h"
+
+#include "git2/oid.h"
+#include "git2/repository.h"
+
+#include "array.h"
+#include "ewah.h"
+#include "map.h"
+#include "oidmap.h"
+#include "pack.h"
+
+#define GIT_PACK_BITMAP_FILE_MODE 0444
+
+/*
+ * The reachability bitmaps of a packfile (`pack-*.bitmap`).
+ *
+ * Every object of the pack is identified by its position in the pack
+ * (i.e. objects are numbered by increasing offset). A bitmap with bit `n`
+ * set contains the `n`th object. The file stores, for a selection of
+ * commits, the set of objects reachable from the commit, so the objects
+ * reachable from any set of commits can be computed by walking only the
+ * commits (and trees) that are not covered by a stored bitmap.
+ *
+ * Objects that are reachable but not part of the pack are given
+ * positions after the ones of the pack (the "extended index").
+ */
+typedef struct git_pack_bitmap_index git_pack_bitmap_index;
+
+/*
+ * Open the first usable `.bitmap` file in the repository's pack
+ * directory. Returns GIT_ENOTFOUND if there is none.
+ */
+int git_pack_bitmap_index_load(
+	git_pack_bitmap_index **out,
+	git_repository *repo);
+
+/* Open the bitmaps of the pack whose index is at `idx_path`. */
+int git_pack_bitmap_index_open(
+	git_pack_bitmap_index **out,
+	git_repository *repo,
+	const char *idx_path);
+
+void git_pack_bitmap_index_free(git_pack_bitmap_index *idx);
+
+/* The number of objects in the pack the bitmaps belong to. */
+size_t git_pack_bitmap_index_num_objects(git_pack_bitmap_index *idx);
+
+/*
+ * Add every object reachable from the given commits to `out`, including
+ * the commits themselves.
+ */
+int git_pack_bitmap_reachable(
+	git_bitmap *out,
+	git_pack_bitmap_index *idx,
+	const git_oid *commits,
+	size_t commits_len);
+
+/*
+ * Get the id, type and name hash (0 when unknown) of the object at the
+ * given position.
+ */
+int git_pack_bitmap_object(
+	git_oid *id,
+	git_object_t *type,
+	uint32_t *name_hash,
+	git_pack_bitmap_index *idx,
+	size_t pos);
+
+/* Returns the name hash of an object, which is stored in the bitmap. */
+typedef uint32_t (*git_pack_bitmap_name_hash_cb)(const git_oid *id, void *payload);
+
+/*
+ * Write the `.bitmap` file for the pack whose index is at `idx_path`.
+ *
+ * Bitmaps can only be written for packs that contain every object
+ * reachable from the commits in them; GIT_ENOTFOUND is returned for any
+ * other pack.
+ */
+int git_pack_bitmap_write(
+	git_repository *repo,
+	const char *idx_path,
+	git_pack_bitmap_name_hash_cb name_hash_cb,
+	void *payload);
+
+#endif
@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack-cache.h"
+
+#include "global.h"
+
+#define kmalloc git__malloc
+#define kcalloc git__calloc
+#define krealloc git__realloc
+#define kreallocarray git__reallocarray
+#define kfree git__free
+#include "khash.h"
+
+GIT_INLINE(uint64_t) pack_cache_key_hash(const struct git_pack_file *pack, git_off_t offset)
+{
+	uint64_t h = ((uint64_t)(uintptr_t)pack >> 4) * 0x9e3779b97f4a7c15ULL;
+
+	h ^= (uint64_t)offset;
+	h *= 0xff51afd7ed558ccdULL;
+	return h ^ (h >> 33);
+}
+
+#define pack_cache_hash(e) ((khint_t)pack_cache_key_hash((e)->pack, (e)->offset))
+#define pack_cache_equal(a, b) ((a)->pack == (b)->pack && (a)->offset == (b)->offset)
+
+__KHASH_TYPE(pack_cache, const git_pack_cache_entry *, char)
+
+__KHASH_IMPL(pack_cache, static kh_inline, const git_pack_cache_entry *, char, 0,
+	pack_cache_hash, pack_cache_equal)
+
+/*
+ * The bases are spread over the shards by packfile and offset, so that
+ * threads reading different objects rarely wait for each other.  Each
+ * shard keeps its bases in a list, from the most to the least recently
+ * used.  Every use of a base is stamped from a counter of the whole
+ * cache, and each shard publishes the stamp of its tail, so that making
+ * room evicts the least recently used base of all the shards, whichever
+ * shard the new base goes to.
+ */
+typedef struct {
+	git_mutex lock;
+	khash_t(pack_cache) *map;
+	git_pack_cache_entry *head, *tail;
+
+	/* the stamp of the tail, or zero when the shard is empty */
+	git_atomic_ssize tail_used;
+
+	size_t hits;
+	size_t misses;
+	size_t saved;
+} pack_cache_shard;
+
+#define GIT_PACK_CACHE_SHARDS 16
+
+size_t git_pack_cache__max_size = GIT_PACK_CACHE_MEMORY_LIMIT;
+
+static pack_cache_shard pack_cache_shards[GIT_PACK_CACHE_SHARDS];
+static git_atomic_ssize pack_cache_used;
+static git_atomic_ssize pack_cache_clock;
+
+GIT_INLINE(pack_cache_shard *) shard_for(const struct git_pack_file *pack, git_off_t offset)
+{
+	/* the map uses the low bits of the hash */
+	return &pack_cache_shards[
+		(pack_cache_key_hash(pack, offset) >> 32) % GIT_PACK_CACHE_SHARDS];
+}
+
+/* Run with the shard lock held, after its list changed */
+static void shard_update_tail(pack_cache_shard *shard)
+{
+	ssize_t tail_used = shard->tail ? shard->tail->last_used : 0;
+
+	/* only the holder of the lock changes it, so adding sets it */
+	if (shard->tail_used.val != tail_used)
+		git_atomic_ssize_add(&shard->tail_used, tail_used - shard->tail_used.val);
+}
+
+static void entry_unlink(pack_cache_shard *shard, git_pack_cache_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		shard->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		shard->tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+	shard_update_tail(shard);
+}
+
+static void entry_push(pack_cache_shard *shard, git_pack_cache_entry *entry)
+{
+	entry->last_used = (ssize_t)git_atomic_ssize_add(&pack_cache_clock, 1);
+	entry->prev = NULL;
+	entry->next = shard->head;
+
+	if (shard->head)
+		shard->head->prev = entry;
+	else
+		shard->tail = entry;
+
+	shard->head = entry;
+	shard_update_tail(shard);
+}
+
+/* Run with the shard lock held */
+static void entry_evict(pack_cache_shard *shard, git_pack_cache_entry *entry)
+{
+	khiter_t pos = kh_get(pack_cache, shard->map, entry);
+
+	if (pos != kh_end(shard->map))
+		kh_del(pack_cache, shard->map, pos);
+
+	entry_unlink(shard, entry);
+	git_atomic_ssize_add(&pack_cache_used, -(ssize_t)entry->raw.len);
+
+	git_pack_cache_release(entry);
+}
+
+static void pack_cache_global_shutdown(void)
+{
+	pack_cache_shard *shard;
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		shard = &pack_cache_shards[i];
+
+		while (shard->head)
+			entry_evict(shard, shard->head);
+
+		kh_destroy(pack_cache, shard->map);
+		shard->map = NULL;
+
+		git_mutex_free(&shard->lock);
+	}
+}
+
+int git_pack_cache_global_init(void)
+{
+	pack_cache_shard *shard;
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		shard = &pack_cache_shards[i];
+		memset(shard, 0, sizeof(*shard));
+
+		if (git_mutex_init(&shard->lock) < 0) {
+			git_error_set(GIT_ERROR_OS, "failed to initialize delta base cache mutex");
+			return -1;
+		}
+
+		shard->map = kh_init(pack_cache);
+		GIT_ERROR_CHECK_ALLOC(shard->map);
+	}
+
+	git__on_shutdown(pack_cache_global_shutdown);
+	return 0;
+}
+
+git_pack_cache_entry *git_pack_cache_get(
+	const struct git_pack_file *pack, git_off_t offset)
+{
+	pack_cache_shard *shard = shard_for(pack, offset);
+	git_pack_cache_entry probe, *entry = NULL;
+	khiter_t pos;
+
+	probe.pack = pack;
+	probe.offset = offset;
+
+	if (git_mutex_lock(&shard->lock) < 0)
+		return NULL;
+
+	pos = kh_get(pack_cache, shard->map, &probe);
+
+	if (pos != kh_end(shard->map)) {
+		entry = (git_pack_cache_entry *)kh_key(shard->map, pos);
+		git_atomic_inc(&entry->refcount);
+
+		if (entry != shard->head) {
+			entry_unlink(shard, entry);
+			entry_push(shard, entry);
+		}
+
+		shard->hits++;
+		shard->saved += entry->raw.len;
+	} else {
+		shard->misses++;
+	}
+
+	git_mutex_unlock(&shard->lock);
+	return entry;
+}
+
+static bool pack_cache_contains(
+	pack_cache_shard *shard, const git_pack_cache_entry *probe)
+{
+	bool found;
+
+	if (git_mutex_lock(&shard->lock) < 0)
+		return false;
+
+	found = (kh_get(pack_cache, shard->map, probe) != kh_end(shard->map));
+
+	git_mutex_unlock(&shard->lock);
+	return found;
+}
+
+/*
+ * Evict the least recently used bases of all the shards until there is
+ * room for `len` more bytes, or nothing is left to evict.  Only one
+ * shard is locked at a time.
+ */
+static void pack_cache_make_room(size_t len, size_t max_size)
+{
+	pack_cache_shard *oldest;
+	ssize_t tail_used, oldest_used;
+	size_t i;
+
+	while ((size_t)pack_cache_used.val + len > max_size) {
+		oldest = NULL;
+		oldest_used = 0;
+
+		for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+			tail_used = pack_cache_shards[i].tail_used.val;
+
+			if (tail_used && (!oldest || tail_used < oldest_used)) {
+				oldest = &pack_cache_shards[i];
+				oldest_used = tail_used;
+			}
+		}
+
+		if (!oldest || git_mutex_lock(&oldest->lock) < 0)
+			break;
+
+		/* another thread may have used or evicted it meanwhile */
+		if (oldest->tail)
+			entry_evict(oldest, oldest->tail);
+
+		git_mutex_unlock(&oldest->lock);
+	}
+}
+
+int git_pack_cache_add(
+	git_pack_cache_entry **out,
+	const struct git_pack_file *pack,
+	git_off_t offset,
+	git_rawobj *base)
+{
+	pack_cache_shard *shard = shard_for(pack, offset);
+	git_pack_cache_entry *entry;
+	size_t max_size = git_pack_cache__max_size;
+	int error;
+
+	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT || base->len > max_size)
+		return -1;
+
+	entry = git__calloc(1, sizeof(git_pack_cache_entry));
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	entry->pack = pack;
+	entry->offset = offset;
+	memcpy(&entry->raw, base, sizeof(git_rawobj));
+
+	/* one reference for the cache, and one for the caller */
+	git_atomic_set(&entry->refcount, 2);
+
+	/* a base that another thread added meanwhile must not evict others */
+	if ((size_t)pack_cache_used.val + base->len > max_size &&
+	    !pack_cache_contains(shard, entry))
+		pack_cache_make_room(base->len, max_size);
+
+	if (git_mutex_lock(&shard->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock delta base cache");
+		git__free(entry);
+		return -1;
+	}
+
+	/* somebody beat us to adding it into the cache */
+	if (kh_get(pack_cache, shard->map, entry) != kh_end(shard->map)) {
+		error = -1;
+		goto done;
+	}
+
+	/* other threads may have taken the room meanwhile */
+	if ((size_t)pack_cache_used.val + base->len > max_size) {
+		error = -1;
+		goto done;
+	}
+
+	kh_put(pack_cache, shard->map, entry, &error);
+	if (error < 0)
+		goto done;
+
+	entry_push(shard, entry);
+	git_atomic_ssize_add(&pack_cache_used, (ssize_t)base->len);
+
+	*out = entry;
+	error = 0;
+
+done:
+	git_mutex_unlock(&shard->lock);
+
+	if (error < 0)
+		git__free(entry);
+
+	return error;
+}
+
+void git_pack_cache_release(git_pack_cache_entry *entry)
+{
+	if (entry && git_atomic_dec(&entry->refcount) == 0) {
+		git__free(entry->raw.data);
+		git__free(entry);
+	}
+}
+
+void git_pack_cache_purge(const struct git_pack_file *pack)
+{
+	pack_cache_shard *shard;
+	git_pack_cache_entry *entry, *next;
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		shard = &pack_cache_shards[i];
+
+		if (!shard->map || git_mutex_lock(&shard->lock) < 0)
+			continue;
+
+		for (entry = shard->head; entry; entry = next) {
+			next = entry->next;
+
+			if (entry->pack == pack)
+				entry_evict(shard, entry);
+		}
+
+		git_mutex_unlock(&shard->lock);
+	}
+}
+
+size_t git_pack_cache__shard(const struct git_pack_file *pack, git_off_t offset)
+{
+	return (size_t)(shard_for(pack, offset) - pack_cache_shards);
+}
+
+void git_pack_cache_get_memory(size_t *current, size_t *allowed)
+{
+	*current = (size_t)pack_cache_used.val;
+	*allowed = git_pack_cache__max_size;
+}
+
+void git_pack_cache_get_stats(size_t *hits, size_t *misses, size_t *saved)
+{
+	pack_cache_shard *shard;
+	size_t i;
+
+	*hits = *misses = *saved = 0;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		shard = &pack_cache_shards[i];
+
+		if (git_mutex_lock(&shard->lock) < 0)
+			continue;
+
+		*hits += shard->hits;
+		*misses += shard->misses;
+		*saved += shard->saved;
+
+		git_mutex_unlock(&shard->lock);
+	}
+}
+
+void git_pack_cache_reset_stats(void)
+{
+	pack_cache_shard *shard;
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		shard = &pack_cache_shards[i];
+
+		if (git_mutex_lock(&shard->lock) < 0)
+			continue;
+
+		shard->hits = shard->misses = shard->saved = 0;
+		git_mutex_unlock(&shard->lock);
+	}
+}
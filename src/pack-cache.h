@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_pack_cache_h__
+#define INCLUDE_pack_cache_h__
+
+#include "common.h"
+
+#include "odb.h"
+#include "thread-utils.h"
+
+/*
+ * The delta base cache keeps the inflated objects that deltas were
+ * applied to, so that the other deltas against them do not have to
+ * inflate the whole chain again.  It is shared by all the packfiles of
+ * the process, within a single byte budget, and evicts the least
+ * recently used bases first.
+ */
+
+struct git_pack_file;
+
+#define GIT_PACK_CACHE_MEMORY_LIMIT (96 * 1024 * 1024)
+#define GIT_PACK_CACHE_SIZE_LIMIT (1024 * 1024) /* don't bother caching anything over 1MB */
+
+typedef struct git_pack_cache_entry {
+	const struct git_pack_file *pack;
+	git_off_t offset;
+	git_rawobj raw;
+
+	/* the cache holds one reference for as long as the entry is in it */
+	git_atomic refcount;
+	ssize_t last_used;
+	struct git_pack_cache_entry *prev, *next;
+} git_pack_cache_entry;
+
+extern size_t git_pack_cache__max_size;
+
+extern int git_pack_cache_global_init(void);
+
+/** Look up a base, which must be released with `git_pack_cache_release`. */
+extern git_pack_cache_entry *git_pack_cache_get(
+	const struct git_pack_file *pack, git_off_t offset);
+
+/**
+ * Add a base to the cache.  On success, the cache owns the data of
+ * `base`, and `out` is a reference to the new entry; otherwise, when
+ * the base is too large or already cached, the caller keeps it.
+ */
+extern int git_pack_cache_add(
+	git_pack_cache_entry **out,
+	const struct git_pack_file *pack,
+	git_off_t offset,
+	git_rawobj *base);
+
+extern void git_pack_cache_release(git_pack_cache_entry *entry);
+
+/** Drop the bases of a packfile that is being freed. */
+extern void git_pack_cache_purge(const struct git_pack_file *pack);
+
+/** The shard that the base of a packfile at an offset goes to. */
+extern size_t git_pack_cache__shard(
+	const struct git_pack_file *pack, git_off_t offset);
+
+extern void git_pack_cache_get_memory(size_t *current, size_t *allowed);
+extern void git_pack_cache_get_stats(size_t *hits, size_t *misses, size_t *saved);
+extern void git_pack_cache_reset_stats(void);
+
+#endif
@@ -12,11 +12,13 @@
 #include "iterator.h"
 #include "netops.h"
 #include "pack.h"
+#include "pack-bitmap.h"
 #include "thread-utils.h"
 #include "tree.h"
 #include "util.h"
 #include "revwalk.h"
 #include "commit_list.h"
+#include "transports/smart.h"
 
 #include "git2/pack.h"
 #include "git2/commit.h"
@@ -95,7 +97,7 @@ static unsigned name_hash(const char *name)
 static int packbuilder_config(git_packbuilder *pb)
 {
 	git_config *config;
-	int ret = 0;
+	int ret = 0, use_bitmaps;
 	int64_t val;
 
 	if ((ret = git_repository_config_snapshot(&config, pb->repo)) < 0)
@@ -126,6 +128,15 @@ static int packbuilder_config(git_packbuilder *pb)
 
 #undef config_get
 
+	if ((ret = git_config_get_bool(&use_bitmaps, config, "pack.useBitmaps")) == GIT_ENOTFOUND) {
+		use_bitmaps = 1;
+		ret = 0;
+	} else if (ret < 0) {
+		goto out;
+	}
+
+	pb->use_bitmaps = !!use_bitmaps;
+
 out:
 	git_config_free(config);
 
@@ -149,8 +160,13 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 
 	git_pool_init(&pb->object_pool, sizeof(struct walk_object));
 
+	if (git_vector_init(&pb->reuse_packs, 0, NULL) < 0)
+		goto on_error;
+
 	pb->repo = repo;
 	pb->nr_threads = 1; /* do not spawn any thread by default */
+	pb->reuse = true;
+	pb->ofs_delta = git_smart__ofs_delta_enabled;
 
 	if (git_hash_ctx_init(&pb->ctx) < 0 ||
 		git_zstream_init(&pb->zstream, GIT_ZSTREAM_DEFLATE) < 0 ||
@@ -207,15 +223,27 @@ static int rehash(git_packbuilder *pb)
 	return 0;
 }
 
-int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
-			   const char *name)
+void git_packbuilder_set_write_bitmap(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+
+	pb->write_bitmap = !!enabled;
+}
+
+void git_packbuilder_set_reuse(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+
+	pb->reuse = !!enabled;
+}
+
+static int packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			      unsigned int hash)
 {
 	git_pobject *po;
 	size_t newsize;
 	int ret;
 
-	assert(pb && oid);
-
 	/* If the object already exists in the hash table, then we don't
 	 * have any work to do */
 	if (git_oidmap_exists(pb->object_ix, oid))
@@ -248,7 +276,7 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 
 	pb->nr_objects++;
 	git_oid_cpy(&po->id, oid);
-	po->hash = name_hash(name);
+	po->hash = hash;
 
 	if (git_oidmap_set(pb->object_ix, &po->id, po) < 0) {
 		git_error_set_oom();
@@ -276,7 +304,15 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	return 0;
 }
 
-static int get_delta(void **out, git_odb *odb, git_pobject *po)
+int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			   const char *name)
+{
+	assert(pb && oid);
+
+	return packbuilder_insert(pb, oid, name_hash(name));
+}
+
+static int get_delta(void **out, git_odb *odb, git_pobject *po, git_pobject *base)
 {
 	git_odb_object *src = NULL, *trg = NULL;
 	size_t delta_size;
@@ -285,7 +321,7 @@ static int get_delta(void **out, git_odb *odb, git_pobject *po)
 
 	*out = NULL;
 
-	if (git_odb_read(&src, odb, &po->delta->id) < 0 ||
+	if (git_odb_read(&src, odb, &base->id) < 0 ||
 	    git_odb_read(&trg, odb, &po->id) < 0)
 		goto on_error;
 
@@ -314,19 +350,464 @@ on_error:
 	return -1;
 }
 
+/* Write to the pack, keeping track of its checksum and size */
+static int write_data(
+	git_packbuilder *pb,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data,
+	const void *buf,
+	size_t len)
+{
+	int error;
+
+	if ((error = write_cb((void *)buf, len, cb_data)) < 0 ||
+	    (error = git_hash_update(&pb->ctx, buf, len)) < 0)
+		return error;
+
+	pb->written_size += len;
+	return 0;
+}
+
+/*
+ * Write the header of an object, or of a delta: an OFS_DELTA when the
+ * base has been written and the receiving end understands offsets, or
+ * a REF_DELTA naming the base otherwise.
+ */
+static int write_header(
+	git_packbuilder *pb,
+	git_pobject *po,
+	git_object_t type,
+	size_t size,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	unsigned char hdr[10], ofs[10];
+	size_t hdr_len, ofs_pos = sizeof(ofs) - 1;
+	uint64_t distance;
+	int error;
+
+	if (type == GIT_OBJECT_REF_DELTA && pb->ofs_delta && po->delta->written)
+		type = GIT_OBJECT_OFS_DELTA;
+
+	hdr_len = git_packfile__object_header(hdr, size, type);
+
+	if ((error = write_data(pb, write_cb, cb_data, hdr, hdr_len)) < 0)
+		return error;
+
+	if (type == GIT_OBJECT_REF_DELTA)
+		return write_data(pb, write_cb, cb_data, po->delta->id.id, GIT_OID_RAWSZ);
+
+	if (type != GIT_OBJECT_OFS_DELTA)
+		return 0;
+
+	/* The distance to the base, in git's offset encoding */
+	distance = (uint64_t)(po->offset - po->delta->offset);
+	ofs[ofs_pos] = distance & 127;
+
+	while (distance >>= 7)
+		ofs[--ofs_pos] = 128 | (--distance & 127);
+
+	return write_data(pb, write_cb, cb_data, ofs + ofs_pos, sizeof(ofs) - ofs_pos);
+}
+
+struct write_reused_data {
+	git_packbuilder *pb;
+	int (*write_cb)(void *buf, size_t size, void *cb_data);
+	void *cb_data;
+};
+
+static int write_reused_cb(const unsigned char *buf, size_t len, void *payload)
+{
+	struct write_reused_data *data = payload;
+
+	return write_data(data->pb, data->write_cb, data->cb_data, buf, len);
+}
+
+/*
+ * Copy the compressed object, or its compressed delta, from the pack it
+ * is in. Returns GIT_PASSTHROUGH when the packed data cannot be used, in
+ * which case nothing has been written.
+ */
+static int write_reused_object(
+	git_packbuilder *pb,
+	git_pobject *po,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	struct write_reused_data data = { pb, write_cb, cb_data };
+	git_packfile_raw_entry entry;
+	bool is_delta;
+	int error;
+
+	if ((error = git_packfile_raw_entry_init(&entry, po->reuse_pack, po->reuse_offset)) < 0)
+		return error;
+
+	is_delta = (entry.type == GIT_OBJECT_OFS_DELTA ||
+		    entry.type == GIT_OBJECT_REF_DELTA);
+
+	/* We may have dropped the delta, or found another one */
+	if (is_delta ? !(po->reuse_delta && po->delta) : po->delta != NULL)
+		return GIT_PASSTHROUGH;
+
+	if ((error = git_packfile_raw_check(po->reuse_pack, &entry)) < 0) {
+		if (error != GIT_EMISMATCH)
+			return error;
+
+		/* Write the whole object instead of trusting the pack */
+		git_error_clear();
+
+		po->reuse_pack = NULL;
+		po->reuse_delta = 0;
+		po->delta = NULL;
+
+		return GIT_PASSTHROUGH;
+	}
+
+	if ((error = write_header(pb, po, is_delta ? GIT_OBJECT_REF_DELTA : entry.type,
+			entry.size, write_cb, cb_data)) < 0)
+		return error;
+
+	return git_packfile_raw_copy(po->reuse_pack, &entry,
+		entry.data_offset, write_reused_cb, &data);
+}
+
+#ifdef GIT_THREADS
+
+/*
+ * While the pack is written, worker threads compress the objects ahead of
+ * the writer, in the order in which they are written.  They stay within
+ * COMPRESS_AHEAD_OBJECTS objects and COMPRESS_AHEAD_MEMORY bytes of the
+ * writer.  When the writer gets to an object that no worker has started
+ * on, it compresses the object itself.
+ */
+#define COMPRESS_AHEAD_OBJECTS 1024
+#define COMPRESS_AHEAD_MEMORY (64 * 1024 * 1024)
+
+enum compressed_state {
+	COMPRESS_PENDING = 0,
+	COMPRESS_RUNNING,
+	COMPRESS_DONE,
+	COMPRESS_TAKEN /* the writer has the object */
+};
+
+struct compressed_object {
+	enum compressed_state state;
+	git_pobject *delta; /* the base the data is a delta against */
+	git_object_t type;
+	size_t size; /* the inflated size */
+	git_buf data;
+};
+
+struct pack_compress {
+	git_packbuilder *pb;
+	git_pobject **write_order;
+	struct compressed_object *objects; /* indexed like pb->object_list */
+
+	size_t next; /* in write order */
+	size_t ready; /* compressed objects that the writer has not taken */
+	size_t ready_size;
+	bool stop;
+
+	git_mutex mutex;
+	git_cond cond;
+	git_thread *threads;
+	size_t nr_threads;
+};
+
+static int compress_object(
+	struct compressed_object *out,
+	git_zstream *zs,
+	unsigned char *zbuf,
+	git_odb *odb,
+	git_pobject *po,
+	void *delta_data)
+{
+	git_odb_object *obj = NULL;
+	void *delta_buf = NULL;
+	const void *data;
+	size_t zbuf_len;
+	int error;
+
+	if (out->delta) {
+		if (!delta_data &&
+		    (error = get_delta(&delta_buf, odb, po, out->delta)) < 0)
+			goto done;
+
+		data = delta_data ? delta_data : delta_buf;
+		out->size = po->delta_size;
+		out->type = GIT_OBJECT_REF_DELTA;
+	} else {
+		if ((error = git_odb_read(&obj, odb, &po->id)) < 0)
+			goto done;
+
+		data = git_odb_object_data(obj);
+		out->size = git_odb_object_size(obj);
+		out->type = git_odb_object_type(obj);
+	}
+
+	git_zstream_reset(zs);
+	git_zstream_set_input(zs, data, out->size);
+
+	/* Deflate in the same steps as write_object, for the same output */
+	while (!git_zstream_done(zs)) {
+		zbuf_len = COMPRESS_BUFLEN;
+
+		if ((error = git_zstream_get_output(zbuf, &zbuf_len, zs)) < 0 ||
+		    (error = git_buf_put(&out->data, (char *)zbuf, zbuf_len)) < 0)
+			goto done;
+	}
+
+done:
+	git__free(delta_buf);
+	git_odb_object_free(obj);
+	return error;
+}
+
+static bool compress_can_start(struct pack_compress *compress)
+{
+	return compress->ready < COMPRESS_AHEAD_OBJECTS &&
+		compress->ready_size < COMPRESS_AHEAD_MEMORY;
+}
+
+static void *threaded_compress(void *arg)
+{
+	struct pack_compress *compress = arg;
+	git_packbuilder *pb = compress->pb;
+	struct compressed_object *item;
+	git_zstream zs = GIT_ZSTREAM_INIT;
+	unsigned char *zbuf;
+	git_pobject *po;
+	void *delta_data;
+	int error;
+
+	if ((zbuf = git__malloc(COMPRESS_BUFLEN)) == NULL ||
+	    git_zstream_init(&zs, GIT_ZSTREAM_DEFLATE) < 0)
+		goto done;
+
+	git_mutex_lock(&compress->mutex);
+
+	while (!compress->stop && compress->next < pb->nr_objects) {
+		if (!compress_can_start(compress)) {
+			git_cond_wait(&compress->cond, &compress->mutex);
+			continue;
+		}
+
+		po = compress->write_order[compress->next++];
+		item = &compress->objects[po - pb->object_list];
+
+		/* Copied or already compressed objects are left to the writer */
+		if (item->state != COMPRESS_PENDING ||
+		    po->reuse_pack || (po->delta && po->z_delta_size))
+			continue;
+
+		item->state = COMPRESS_RUNNING;
+		item->delta = po->delta;
+		delta_data = po->delta_data;
+		po->delta_data = NULL;
+
+		git_mutex_unlock(&compress->mutex);
+		error = compress_object(item, &zs, zbuf, pb->odb, po, delta_data);
+		git_mutex_lock(&compress->mutex);
+
+		if (error < 0) {
+			/* The writer will have another go, and report the error */
+			git_error_clear();
+			git_buf_dispose(&item->data);
+			po->delta_data = delta_data;
+			item->state = COMPRESS_PENDING;
+		} else {
+			git__free(delta_data);
+			item->state = COMPRESS_DONE;
+			compress->ready++;
+			compress->ready_size += item->data.size;
+		}
+
+		git_cond_broadcast(&compress->cond);
+	}
+
+	git_mutex_unlock(&compress->mutex);
+
+done:
+	git_zstream_free(&zs);
+	git__free(zbuf);
+	return NULL;
+}
+
+static void compress_stop(git_packbuilder *pb)
+{
+	struct pack_compress *compress = pb->compress;
+	size_t i;
+
+	if (!compress)
+		return;
+
+	git_mutex_lock(&compress->mutex);
+	compress->stop = true;
+	git_cond_broadcast(&compress->cond);
+	git_mutex_unlock(&compress->mutex);
+
+	for (i = 0; i < compress->nr_threads; i++)
+		git_thread_join(&compress->threads[i], NULL);
+
+	for (i = 0; i < pb->nr_objects; i++)
+		git_buf_dispose(&compress->objects[i].data);
+
+	git_cond_free(&compress->cond);
+	git_mutex_free(&compress->mutex);
+	git__free(compress->threads);
+	git__free(compress->objects);
+	git__free(compress);
+
+	pb->compress = NULL;
+}
+
+static int compress_start(git_packbuilder *pb, git_pobject **write_order)
+{
+	struct pack_compress *compress;
+	size_t nr_threads = pb->nr_threads;
+	int error = 0;
+
+	if (!nr_threads)
+		nr_threads = git_online_cpus();
+
+	if (nr_threads <= 1 || pb->nr_objects <= 1)
+		return 0;
+
+	compress = git__calloc(1, sizeof(struct pack_compress));
+	GIT_ERROR_CHECK_ALLOC(compress);
+
+	compress->pb = pb;
+	compress->write_order = write_order;
+
+	if (git_mutex_init(&compress->mutex) < 0 ||
+	    git_cond_init(&compress->cond) < 0) {
+		git__free(compress);
+		return -1;
+	}
+
+	pb->compress = compress;
+
+	compress->objects = git__calloc(pb->nr_objects, sizeof(struct compressed_object));
+	compress->threads = git__calloc(nr_threads, sizeof(git_thread));
+
+	if (!compress->objects || !compress->threads) {
+		error = -1;
+		goto on_error;
+	}
+
+	for (; compress->nr_threads < nr_threads; compress->nr_threads++) {
+		if ((error = git_thread_create(&compress->threads[compress->nr_threads],
+				threaded_compress, compress)) < 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+			goto on_error;
+		}
+	}
+
+	return 0;
+
+on_error:
+	compress_stop(pb);
+	return error;
+}
+
+/*
+ * Take the object from the workers: its compressed data, if a worker has
+ * it for the delta that the object has now, or NULL when the writer is to
+ * compress the object itself.  The workers leave it alone from now on.
+ */
+static struct compressed_object *compress_take(git_packbuilder *pb, git_pobject *po)
+{
+	struct pack_compress *compress = pb->compress;
+	struct compressed_object *item;
+
+	if (!compress)
+		return NULL;
+
+	item = &compress->objects[po - pb->object_list];
+
+	git_mutex_lock(&compress->mutex);
+
+	while (item->state == COMPRESS_RUNNING)
+		git_cond_wait(&compress->cond, &compress->mutex);
+
+	if (item->state == COMPRESS_DONE) {
+		compress->ready--;
+		compress->ready_size -= item->data.size;
+		git_cond_broadcast(&compress->cond);
+	}
+
+	if (item->state != COMPRESS_DONE || item->delta != po->delta) {
+		git_buf_dispose(&item->data);
+		item = NULL;
+	}
+
+	compress->objects[po - pb->object_list].state = COMPRESS_TAKEN;
+
+	git_mutex_unlock(&compress->mutex);
+
+	return item;
+}
+
+/* Change the delta base of an object that the workers may be looking at */
+static void compress_set_delta(git_packbuilder *pb, git_pobject *po, git_pobject *delta)
+{
+	if (pb->compress)
+		git_mutex_lock(&pb->compress->mutex);
+
+	po->delta = delta;
+
+	if (pb->compress)
+		git_mutex_unlock(&pb->compress->mutex);
+}
+
+#else
+
+struct compressed_object {
+	git_object_t type;
+	size_t size;
+	git_buf data;
+};
+
+#define compress_start(pb, write_order) 0
+#define compress_stop(pb) GIT_UNUSED(pb)
+#define compress_take(pb, po) NULL
+#define compress_set_delta(pb, po, base) (po)->delta = (base)
+
+#endif /* GIT_THREADS */
+
 static int write_object(
 	git_packbuilder *pb,
 	git_pobject *po,
 	int (*write_cb)(void *buf, size_t size, void *cb_data),
 	void *cb_data)
 {
+	struct compressed_object *compressed;
 	git_odb_object *obj = NULL;
 	git_object_t type;
-	unsigned char hdr[10], *zbuf = NULL;
+	unsigned char *zbuf = NULL;
 	void *data = NULL;
-	size_t hdr_len, zbuf_len = COMPRESS_BUFLEN, data_len;
+	size_t zbuf_len = COMPRESS_BUFLEN, data_len;
 	int error;
 
+	po->offset = pb->written_size;
+
+	if ((compressed = compress_take(pb, po)) != NULL) {
+		if ((error = write_header(pb, po, compressed->type, compressed->size, write_cb, cb_data)) < 0 ||
+		    (error = write_data(pb, write_cb, cb_data, compressed->data.ptr, compressed->data.size)) < 0)
+			goto done;
+
+		pb->nr_written++;
+		goto done;
+	}
+
+	if (po->reuse_pack &&
+	    (error = write_reused_object(pb, po, write_cb, cb_data)) != GIT_PASSTHROUGH) {
+		if (!error)
+			pb->nr_written++;
+
+		return error;
+	}
+
 	/*
 	 * If we have a delta base, let's use the delta to save space.
 	 * Otherwise load the whole object. 'data' ends up pointing to
@@ -335,7 +816,7 @@ static int write_object(
 	if (po->delta) {
 		if (po->delta_data)
 			data = po->delta_data;
-		else if ((error = get_delta(&data, pb->odb, po)) < 0)
+		else if ((error = get_delta(&data, pb->odb, po, po->delta)) < 0)
 				goto done;
 
 		data_len = po->delta_size;
@@ -350,24 +831,14 @@ static int write_object(
 	}
 
 	/* Write header */
-	hdr_len = git_packfile__object_header(hdr, data_len, type);
-
-	if ((error = write_cb(hdr, hdr_len, cb_data)) < 0 ||
-		(error = git_hash_update(&pb->ctx, hdr, hdr_len)) < 0)
+	if ((error = write_header(pb, po, type, data_len, write_cb, cb_data)) < 0)
 		goto done;
 
-	if (type == GIT_OBJECT_REF_DELTA) {
-		if ((error = write_cb(po->delta->id.id, GIT_OID_RAWSZ, cb_data)) < 0 ||
-			(error = git_hash_update(&pb->ctx, po->delta->id.id, GIT_OID_RAWSZ)) < 0)
-			goto done;
-	}
-
 	/* Write data */
 	if (po->z_delta_size) {
 		data_len = po->z_delta_size;
 
-		if ((error = write_cb(data, data_len, cb_data)) < 0 ||
-			(error = git_hash_update(&pb->ctx, data, data_len)) < 0)
+		if ((error = write_data(pb, write_cb, cb_data, data, data_len)) < 0)
 			goto done;
 	} else {
 		zbuf = git__malloc(zbuf_len);
@@ -378,8 +849,7 @@ static int write_object(
 
 		while (!git_zstream_done(&pb->zstream)) {
 			if ((error = git_zstream_get_output(zbuf, &zbuf_len, &pb->zstream)) < 0 ||
-				(error = write_cb(zbuf, zbuf_len, cb_data)) < 0 ||
-				(error = git_hash_update(&pb->ctx, zbuf, zbuf_len)) < 0)
+				(error = write_data(pb, write_cb, cb_data, zbuf, zbuf_len)) < 0)
 				goto done;
 
 			zbuf_len = COMPRESS_BUFLEN; /* reuse buffer */
@@ -401,6 +871,9 @@ static int write_object(
 	pb->nr_written++;
 
 done:
+	if (compressed)
+		git_buf_dispose(&compressed->data);
+
 	git__free(zbuf);
 	git_odb_object_free(obj);
 	return error;
@@ -438,7 +911,7 @@ static int write_one(
 
 		/* we cannot depend on this one */
 		if (*status == WRITE_ONE_RECURSIVE)
-			po->delta = NULL;
+			compress_set_delta(pb, po, NULL);
 	}
 
 	*status = WRITE_ONE_WRITTEN;
@@ -650,8 +1123,10 @@ static int write_pack(git_packbuilder *pb,
 	ph.hdr_version = htonl(PACK_VERSION);
 	ph.hdr_entries = htonl(pb->nr_objects);
 
-	if ((error = write_cb(&ph, sizeof(ph), cb_data)) < 0 ||
-		(error = git_hash_update(&pb->ctx, &ph, sizeof(ph))) < 0)
+	pb->written_size = 0;
+
+	if ((error = compress_start(pb, write_order)) < 0 ||
+	    (error = write_data(pb, write_cb, cb_data, &ph, sizeof(ph))) < 0)
 		goto done;
 
 	pb->nr_remaining = pb->nr_objects;
@@ -673,12 +1148,15 @@ static int write_pack(git_packbuilder *pb,
 	error = write_cb(entry_oid.id, GIT_OID_RAWSZ, cb_data);
 
 done:
+	compress_stop(pb);
+
 	/* if callback cancelled writing, we must still free delta_data */
 	for ( ; i < pb->nr_objects; ++i) {
 		po = write_order[i];
 		if (po->delta_data) {
 			git__free(po->delta_data);
 			po->delta_data = NULL;
+			po->z_delta_size = 0;
 		}
 	}
 
@@ -763,8 +1241,6 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 
 	*ret = 0;
 
-	/* TODO: support reuse-delta */
-
 	/* Let's not bust the allowed depth. */
 	if (src->depth >= max_depth)
 		return 0;
@@ -1309,6 +1785,103 @@ static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 #define ll_find_deltas(pb, l, ls, w, d) find_deltas(pb, l, &ls, w, d)
 #endif
 
+static int reuse_pack_ref(git_packbuilder *pb, struct git_pack_file *p)
+{
+	struct git_pack_file *ref;
+	git_buf idx_path = GIT_BUF_INIT;
+	size_t i;
+	int error;
+
+	git_vector_foreach(&pb->reuse_packs, i, ref) {
+		if (ref == p)
+			return 0;
+	}
+
+	/* Hold on to the pack, in case the odb lets go of it */
+	if ((error = git_buf_put(&idx_path, p->pack_name, strlen(p->pack_name) - strlen(".pack"))) < 0 ||
+	    (error = git_buf_puts(&idx_path, ".idx")) < 0 ||
+	    (error = git_mwindow_get_pack(&ref, idx_path.ptr)) < 0)
+		goto done;
+
+	assert(ref == p);
+
+	if ((error = git_vector_insert(&pb->reuse_packs, ref)) < 0)
+		git_mwindow_put_pack(ref);
+
+done:
+	git_buf_dispose(&idx_path);
+	return error;
+}
+
+/*
+ * Find the objects that are already packed, so that we can copy their
+ * packed data instead of compressing them again.  An object that is
+ * packed as a delta against another object that we send from the same
+ * pack keeps that delta, and is not searched for another one.  (Keeping
+ * to deltas within a single pack cannot create a cycle.)
+ */
+static int find_reusable_objects(git_packbuilder *pb)
+{
+	struct git_pack_entry e;
+	git_packfile_raw_entry entry;
+	git_pobject *po, *base;
+	size_t i;
+	int error;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+
+		if (po->reuse_pack || po->delta)
+			continue;
+
+		if ((error = git_odb__find_pack_entry(&e, pb->odb, &po->id)) == GIT_ENOTFOUND)
+			continue;
+		else if (error < 0)
+			return error;
+
+		/* The object is read from the odb if its packed data cannot be used */
+		if (git_packfile_raw_entry_init(&entry, e.p, e.offset) < 0) {
+			git_error_clear();
+			continue;
+		}
+
+		if (entry.type != GIT_OBJECT_OFS_DELTA &&
+		    entry.type != GIT_OBJECT_REF_DELTA &&
+		    (entry.type != po->type || entry.size != po->size))
+			continue;
+
+		if ((error = reuse_pack_ref(pb, e.p)) < 0)
+			return error;
+
+		po->reuse_pack = e.p;
+		po->reuse_offset = e.offset;
+	}
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+
+		if (!po->reuse_pack || po->reuse_delta || po->delta)
+			continue;
+
+		if ((error = git_packfile_raw_entry_init(&entry, po->reuse_pack, po->reuse_offset)) < 0)
+			return error;
+
+		if (entry.type != GIT_OBJECT_OFS_DELTA &&
+		    entry.type != GIT_OBJECT_REF_DELTA)
+			continue;
+
+		if ((base = git_oidmap_get(pb->object_ix, &entry.base)) == NULL ||
+		    base->reuse_pack != po->reuse_pack)
+			continue;
+
+		po->delta = base;
+		po->delta_size = entry.size;
+		po->reuse_delta = 1;
+	}
+
+	return 0;
+}
+
 static int prepare_pack(git_packbuilder *pb)
 {
 	git_pobject **delta_list;
@@ -1324,12 +1897,19 @@ static int prepare_pack(git_packbuilder *pb)
 	if (pb->progress_cb)
 			pb->progress_cb(GIT_PACKBUILDER_DELTAFICATION, 0, pb->nr_objects, pb->progress_cb_payload);
 
+	if (pb->reuse && find_reusable_objects(pb) < 0)
+		return -1;
+
 	delta_list = git__mallocarray(pb->nr_objects, sizeof(*delta_list));
 	GIT_ERROR_CHECK_ALLOC(delta_list);
 
 	for (i = 0; i < pb->nr_objects; ++i) {
 		git_pobject *po = pb->object_list + i;
 
+		/* We keep the delta that we found in a pack */
+		if (po->reuse_delta)
+			continue;
+
 		/* Make sure the item is within our size limits */
 		if (po->size < 50 || po->size > pb->big_file_threshold)
 			continue;
@@ -1369,6 +1949,39 @@ int git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb)
 	return write_pack(pb, &write_pack_buf, buf);
 }
 
+static uint32_t bitmap_name_hash_cb(const git_oid *id, void *payload)
+{
+	git_packbuilder *pb = payload;
+	git_pobject *po = git_oidmap_get(pb->object_ix, id);
+
+	return po ? po->hash : 0;
+}
+
+static int write_bitmap(git_packbuilder *pb, const char *path)
+{
+	git_buf idx_path = GIT_BUF_INIT;
+	char hash[GIT_OID_HEXSZ + 1];
+	int error;
+
+	git_oid_tostr(hash, sizeof(hash), &pb->pack_oid);
+
+	if ((error = git_buf_joinpath(&idx_path, path, "pack-")) < 0 ||
+	    (error = git_buf_printf(&idx_path, "%s.idx", hash)) < 0)
+		goto done;
+
+	error = git_pack_bitmap_write(pb->repo, idx_path.ptr, bitmap_name_hash_cb, pb);
+
+	/* Bitmaps can only be written for packs that are self-contained. */
+	if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+		error = 0;
+	}
+
+done:
+	git_buf_dispose(&idx_path);
+	return error;
+}
+
 static int write_cb(void *buf, size_t len, void *payload)
 {
 	struct pack_write_context *ctx = payload;
@@ -1412,6 +2025,10 @@ int git_packbuilder_write(
 	git_oid_cpy(&pb->pack_oid, git_indexer_hash(indexer));
 
 	git_indexer_free(indexer);
+
+	if (pb->write_bitmap)
+		return write_bitmap(pb, path);
+
 	return 0;
 }
 
@@ -1711,6 +2328,84 @@ cleanup:
 	return error;
 }
 
+struct bitmap_insert_data {
+	git_packbuilder *pb;
+	git_pack_bitmap_index *idx;
+};
+
+static int insert_bitmap_object(size_t pos, void *payload)
+{
+	struct bitmap_insert_data *data = payload;
+	git_object_t type;
+	uint32_t hash;
+	git_oid id;
+	int error;
+
+	if ((error = git_pack_bitmap_object(&id, &type, &hash, data->idx, pos)) < 0)
+		return error;
+
+	return packbuilder_insert(data->pb, &id, hash);
+}
+
+/*
+ * Compute the objects reachable from the interesting commits but not
+ * from the uninteresting ones with the reachability bitmaps of the
+ * repository. Returns GIT_ENOTFOUND if the bitmaps cannot be used.
+ */
+static int insert_walk_bitmap(git_packbuilder *pb, git_revwalk *walk)
+{
+	git_array_t(git_oid) wants = GIT_ARRAY_INIT, haves = GIT_ARRAY_INIT;
+	git_bitmap want_bitmap = GIT_BITMAP_INIT, have_bitmap = GIT_BITMAP_INIT;
+	struct bitmap_insert_data data;
+	git_pack_bitmap_index *idx = NULL;
+	git_commit_list *list;
+	git_oid *id;
+	int error = 0;
+
+	if (!pb->use_bitmaps || walk->walking || walk->hide_cb || walk->first_parent)
+		return GIT_ENOTFOUND;
+
+	for (list = walk->user_input; list; list = list->next) {
+		if (list->item->uninteresting)
+			id = git_array_alloc(haves);
+		else
+			id = git_array_alloc(wants);
+
+		if (!id) {
+			git_error_set_oom();
+			error = -1;
+			goto done;
+		}
+
+		git_oid_cpy(id, &list->item->oid);
+	}
+
+	/* Leave the objects to the revwalk if the bitmaps cannot be used. */
+	if (git_pack_bitmap_index_load(&idx, pb->repo) < 0 ||
+	    git_pack_bitmap_reachable(&want_bitmap, idx,
+			wants.ptr, git_array_size(wants)) < 0 ||
+	    git_pack_bitmap_reachable(&have_bitmap, idx,
+			haves.ptr, git_array_size(haves)) < 0) {
+		git_error_clear();
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+
+	git_bitmap_and_not(&want_bitmap, &have_bitmap);
+
+	data.pb = pb;
+	data.idx = idx;
+	error = git_bitmap_foreach(&want_bitmap, insert_bitmap_object, &data);
+
+done:
+	git_pack_bitmap_index_free(idx);
+	git_bitmap_dispose(&want_bitmap);
+	git_bitmap_dispose(&have_bitmap);
+	git_array_clear(wants);
+	git_array_clear(haves);
+	return error;
+}
+
 int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 {
 	int error;
@@ -1719,6 +2414,9 @@ int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 
 	assert(pb && walk);
 
+	if ((error = insert_walk_bitmap(pb, walk)) != GIT_ENOTFOUND)
+		return error;
+
 	if ((error = mark_edges_uninteresting(pb, walk->user_input)) < 0)
 		return error;
 
@@ -1760,6 +2458,9 @@ int git_packbuilder_set_callbacks(git_packbuilder *pb, git_packbuilder_progress
 
 void git_packbuilder_free(git_packbuilder *pb)
 {
+	struct git_pack_file *p;
+	size_t i;
+
 	if (pb == NULL)
 		return;
 
@@ -1783,6 +2484,10 @@ void git_packbuilder_free(git_packbuilder *pb)
 	git_oidmap_free(pb->walk_objects);
 	git_pool_clear(&pb->object_pool);
 
+	git_vector_foreach(&pb->reuse_packs, i, p)
+		git_mwindow_put_pack(p);
+	git_vector_free(&pb->reuse_packs);
+
 	git_hash_ctx_cleanup(&pb->ctx);
 	git_zstream_free(&pb->zstream);
 
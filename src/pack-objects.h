@@ -46,10 +46,14 @@ typedef struct git_pobject {
 	size_t delta_size;
 	size_t z_delta_size;
 
+	struct git_pack_file *reuse_pack; /* pack to copy the object from */
+	git_off_t reuse_offset;
+
 	int written:1,
 	    recursing:1,
 	    tagged:1,
-	    filled:1;
+	    filled:1,
+	    reuse_delta:1; /* packed as a delta in reuse_pack */
 } git_pobject;
 
 struct git_packbuilder {
@@ -73,12 +77,16 @@ struct git_packbuilder {
 	git_oidmap *walk_objects;
 	git_pool object_pool;
 
+	git_vector reuse_packs; /* the packs that objects are copied from */
+
 	git_oid pack_oid; /* hash of written pack */
+	git_off_t written_size; /* the size of the pack written so far */
 
 	/* synchronization objects */
 	git_mutex cache_mutex;
 	git_mutex progress_mutex;
 	git_cond progress_cond;
+	struct pack_compress *compress; /* objects compressed ahead of the writer */
 
 	/* configs */
 	size_t delta_cache_size;
@@ -93,6 +101,11 @@ struct git_packbuilder {
 	void *progress_cb_payload;
 	double last_progress_report_time; /* the time progress was last reported */
 
+	bool use_bitmaps;
+	bool write_bitmap;
+	bool reuse;
+	bool ofs_delta; /* whether the receiving end understands offset deltas */
+
 	bool done;
 };
 
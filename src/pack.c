@@ -21,13 +21,6 @@ bool git_disable_pack_keep_file_checks = false;
 
 static int packfile_open(struct git_pack_file *p);
 static git_off_t nth_packed_object_offset(const struct git_pack_file *p, uint32_t n);
-static int packfile_unpack_compressed(
-		git_rawobj *obj,
-		struct git_pack_file *p,
-		git_mwindow **w_curs,
-		git_off_t *curpos,
-		size_t size,
-		git_object_t type);
 
 /* Can find the offset of an object given
  * a prefix of an identifier.
@@ -49,138 +42,6 @@ static int packfile_error(const char *message)
 	return -1;
 }
 
-/********************
- * Delta base cache
- ********************/
-
-static git_pack_cache_entry *new_cache_object(git_rawobj *source)
-{
-	git_pack_cache_entry *e = git__calloc(1, sizeof(git_pack_cache_entry));
-	if (!e)
-		return NULL;
-
-	git_atomic_inc(&e->refcount);
-	memcpy(&e->raw, source, sizeof(git_rawobj));
-
-	return e;
-}
-
-static void free_cache_object(void *o)
-{
-	git_pack_cache_entry *e = (git_pack_cache_entry *)o;
-
-	if (e != NULL) {
-		assert(e->refcount.val == 0);
-		git__free(e->raw.data);
-		git__free(e);
-	}
-}
-
-static void cache_free(git_pack_cache *cache)
-{
-	git_pack_cache_entry *entry;
-
-	if (cache->entries) {
-		git_offmap_foreach_value(cache->entries, entry, {
-			free_cache_object(entry);
-		});
-
-		git_offmap_free(cache->entries);
-		cache->entries = NULL;
-	}
-}
-
-static int cache_init(git_pack_cache *cache)
-{
-	if (git_offmap_new(&cache->entries) < 0)
-		return -1;
-
-	cache->memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
-
-	if (git_mutex_init(&cache->lock)) {
-		git_error_set(GIT_ERROR_OS, "failed to initialize pack cache mutex");
-
-		git__free(cache->entries);
-		cache->entries = NULL;
-
-		return -1;
-	}
-
-	return 0;
-}
-
-static git_pack_cache_entry *cache_get(git_pack_cache *cache, git_off_t offset)
-{
-	git_pack_cache_entry *entry;
-
-	if (git_mutex_lock(&cache->lock) < 0)
-		return NULL;
-
-	if ((entry = git_offmap_get(cache->entries, offset)) != NULL) {
-		git_atomic_inc(&entry->refcount);
-		entry->last_usage = cache->use_ctr++;
-	}
-	git_mutex_unlock(&cache->lock);
-
-	return entry;
-}
-
-/* Run with the cache lock held */
-static void free_lowest_entry(git_pack_cache *cache)
-{
-	git_off_t offset;
-	git_pack_cache_entry *entry;
-
-	git_offmap_foreach(cache->entries, offset, entry, {
-		if (entry && entry->refcount.val == 0) {
-			cache->memory_used -= entry->raw.len;
-			git_offmap_delete(cache->entries, offset);
-			free_cache_object(entry);
-		}
-	});
-}
-
-static int cache_add(
-		git_pack_cache_entry **cached_out,
-		git_pack_cache *cache,
-		git_rawobj *base,
-		git_off_t offset)
-{
-	git_pack_cache_entry *entry;
-	int exists;
-
-	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT)
-		return -1;
-
-	entry = new_cache_object(base);
-	if (entry) {
-		if (git_mutex_lock(&cache->lock) < 0) {
-			git_error_set(GIT_ERROR_OS, "failed to lock cache");
-			git__free(entry);
-			return -1;
-		}
-		/* Add it to the cache if nobody else has */
-		exists = git_offmap_exists(cache->entries, offset);
-		if (!exists) {
-			while (cache->memory_used + base->len > cache->memory_limit)
-				free_lowest_entry(cache);
-
-			git_offmap_set(cache->entries, offset, entry);
-			cache->memory_used += entry->raw.len;
-
-			*cached_out = entry;
-		}
-		git_mutex_unlock(&cache->lock);
-		/* Somebody beat us to adding it into the cache */
-		if (exists) {
-			git__free(entry);
-			return -1;
-		}
-	}
-
-	return 0;
-}
-
 /***********************************************************
  *
  * PACK INDEX METHODS
@@ -193,6 +54,10 @@ static void pack_index_free(struct git_pack_file *p)
 		git__free(p->oids);
 		p->oids = NULL;
 	}
+	if (p->revindex) {
+		git__free(p->revindex);
+		p->revindex = NULL;
+	}
 	if (p->index_map.data) {
 		git_futils_mmap_free(&p->index_map);
 		p->index_map.data = NULL;
@@ -545,7 +410,7 @@ static int pack_dependency_chain(git_dependency_chain *chain_out,
 		git_pack_cache_entry *cached = NULL;
 
 		/* if we have a base cached, we can stop here instead */
-		if ((cached = cache_get(&p->bases, obj_offset)) != NULL) {
+		if ((cached = git_pack_cache_get(p, obj_offset)) != NULL) {
 			*cached_out = cached;
 			*cached_off = obj_offset;
 			break;
@@ -629,6 +494,8 @@ int git_packfile_unpack(
 	git_pack_cache_entry *cached = NULL;
 	struct pack_chain_elem small_stack[SMALL_STACK_SIZE];
 	size_t stack_size = 0, elem_pos, alloclen;
+	unsigned char *spare = NULL;
+	size_t obj_alloc = 0, spare_alloc = 0;
 	git_object_t base_type;
 
 	/*
@@ -663,7 +530,7 @@ int git_packfile_unpack(
 	case GIT_OBJECT_TAG:
 		if (!cached) {
 			curpos = elem->offset;
-			error = packfile_unpack_compressed(obj, p, &w_curs, &curpos, elem->size, elem->type);
+			error = git_packfile_unpack_compressed(obj, p, &w_curs, &curpos, elem->size, elem->type);
 			git_mwindow_close(&w_curs);
 			base_type = elem->type;
 		}
@@ -693,28 +560,39 @@ int git_packfile_unpack(
 		GIT_ERROR_CHECK_ALLOC(obj->data);
 
 		memcpy(obj->data, data, obj->len + 1);
-		git_atomic_dec(&cached->refcount);
+		git_pack_cache_release(cached);
 		goto cleanup;
 	}
 
-	/* we now apply each consecutive delta until we run out */
+	/*
+	 * We now apply each consecutive delta until we run out.  Every
+	 * result is written into a spare buffer: the one of the base that
+	 * was just used, when it could not go into the cache, so that a
+	 * long chain of large objects bounces between two buffers instead
+	 * of allocating one for every delta.
+	 */
+	obj_alloc = cached ? 0 : obj->len + 1;
+
 	while (elem_pos > 0 && !error) {
 		git_rawobj base, delta;
+		size_t base_size, result_size;
 
 		/*
 		 * We can now try to add the base to the cache, as
 		 * long as it's not already the cached one.
 		 */
 		if (!cached)
-			free_base = !!cache_add(&cached, &p->bases, obj, elem->base_key);
+			free_base = !!git_pack_cache_add(&cached, p, elem->base_key, obj);
 
 		elem = &stack[elem_pos - 1];
 		curpos = elem->offset;
-		error = packfile_unpack_compressed(&delta, p, &w_curs, &curpos, elem->size, elem->type);
+		error = git_packfile_unpack_compressed(&delta, p, &w_curs, &curpos, elem->size, elem->type);
 		git_mwindow_close(&w_curs);
 
 		if (error < 0) {
-			/* We have transferred ownership of the data to the cache. */
+			/* Unless we have transferred ownership of the data to the cache. */
+			if (free_base)
+				git__free(obj->data);
 			obj->data = NULL;
 			break;
 		}
@@ -725,15 +603,51 @@ int git_packfile_unpack(
 		obj->len = 0;
 		obj->type = GIT_OBJECT_INVALID;
 
-		error = git_delta_apply(&obj->data, &obj->len, base.data, base.len, delta.data, delta.len);
-		obj->type = base_type;
+		error = git_delta_read_header(&base_size, &result_size, delta.data, delta.len);
+
+		if (error < 0 || GIT_ADD_SIZET_OVERFLOW(&alloclen, result_size, 1)) {
+			git_error_set(GIT_ERROR_INVALID, "failed to apply delta: invalid delta header");
+			error = -1;
+		} else if (alloclen > spare_alloc) {
+			git__free(spare);
+			spare_alloc = 0;
+
+			if ((spare = git__malloc(alloclen)) == NULL)
+				error = -1;
+			else
+				spare_alloc = alloclen;
+		}
+
+		if (!error)
+			error = git_delta_apply_to(spare, result_size,
+				base.data, base.len, delta.data, delta.len);
 
 		/*
 		 * We usually don't want to free the base at this
 		 * point, as we put it into the cache in the previous
 		 * iteration. free_base lets us know that we got the
-		 * base object directly from the packfile, so we can free it.
+		 * base object directly from the packfile, so that its
+		 * buffer can take the next result.
 		 */
+		if (!error) {
+			size_t result_alloc = spare_alloc;
+
+			obj->data = spare;
+			obj->len = result_size;
+			obj->type = base_type;
+
+			spare = NULL;
+			spare_alloc = 0;
+
+			if (free_base) {
+				spare = base.data;
+				spare_alloc = obj_alloc;
+				free_base = 0;
+			}
+
+			obj_alloc = result_alloc;
+		}
+
 		git__free(delta.data);
 		if (free_base) {
 			free_base = 0;
@@ -741,7 +655,7 @@ int git_packfile_unpack(
 		}
 
 		if (cached) {
-			git_atomic_dec(&cached->refcount);
+			git_pack_cache_release(cached);
 			cached = NULL;
 		}
 
@@ -751,16 +665,25 @@ int git_packfile_unpack(
 		elem_pos--;
 	}
 
+	/* don't hand a buffer much larger than the object over to the caller */
+	if (!error && obj_alloc > obj->len + 1 + obj->len / 4) {
+		void *shrunk = git__realloc(obj->data, obj->len + 1);
+
+		if (shrunk)
+			obj->data = shrunk;
+	}
+
 cleanup:
 	if (error < 0) {
 		git__free(obj->data);
 		if (cached)
-			git_atomic_dec(&cached->refcount);
+			git_pack_cache_release(cached);
 	}
 
 	if (elem)
 		*obj_offset = curpos;
 
+	git__free(spare);
 	git_array_clear(chain);
 	return error;
 }
@@ -842,7 +765,7 @@ void git_packfile_stream_dispose(git_packfile_stream *obj)
 	inflateEnd(&obj->zstream);
 }
 
-static int packfile_unpack_compressed(
+int git_packfile_unpack_compressed(
 	git_rawobj *obj,
 	struct git_pack_file *p,
 	git_mwindow **w_curs,
@@ -905,6 +828,389 @@ static int packfile_unpack_compressed(
 	return 0;
 }
 
+/* how much of a base that is not cached is inflated at a time */
+#define PACK_OBJECT_STREAM_WINDOW (1024 * 1024)
+
+struct git_packfile_object_stream {
+	struct git_pack_file *p;
+
+	/* the composed instructions, and the next byte that they produce */
+	git_delta_ops ops;
+	size_t op_idx;
+	size_t op_pos;
+
+	/* the deltas of the chain, whose literals the instructions use */
+	git_array_t(void *) deltas;
+
+	/*
+	 * The base of the chain: when it is not in the delta base cache,
+	 * it is inflated from `base_offset` into a window that only slides
+	 * forward.  When the instructions would need to go back before the
+	 * window, the object is unpacked whole instead, and is its own base.
+	 */
+	git_pack_cache_entry *cached;
+	git_rawobj unpacked;
+	git_off_t base_offset;
+	size_t base_size;
+	git_packfile_stream zstream;
+	int zstream_open;
+	unsigned char *window;
+	size_t window_alloc;
+	size_t window_start;
+	size_t window_len;
+};
+
+/*
+ * Whether the instructions can be followed with a window of the base
+ * that only slides forward.  The window covers `window_alloc` bytes at
+ * a multiple of it, so a copy can go back as long as it starts in the
+ * window that the previous copies left.
+ */
+static bool object_stream_forward_only(git_packfile_object_stream *stream)
+{
+	const git_delta_op *op;
+	size_t i, window_start = 0, end;
+
+	if (!stream->window_alloc)
+		return true;
+
+	git_array_foreach(stream->ops, i, op) {
+		if (op->literal || !op->len)
+			continue;
+
+		if (op->offset < window_start)
+			return false;
+
+		end = op->offset + op->len - 1;
+		window_start = max(window_start, end - end % stream->window_alloc);
+	}
+
+	return true;
+}
+
+/*
+ * Unpack the object whole and copy from it instead of from the base:
+ * inflating the base again from its beginning for every copy that goes
+ * back would take time in the size of the base for each of them.
+ */
+static int object_stream_unpack(git_packfile_object_stream *stream, git_off_t offset)
+{
+	git_delta_op *op;
+	void **delta_data;
+	size_t i;
+
+	if (git_packfile_unpack(&stream->unpacked, stream->p, &offset) < 0)
+		return -1;
+
+	git_array_foreach(stream->deltas, i, delta_data)
+		git__free(*delta_data);
+
+	git_array_clear(stream->deltas);
+	git_array_clear(stream->ops);
+	git__free(stream->window);
+	stream->window = NULL;
+
+	if (stream->unpacked.len) {
+		op = git_array_alloc(stream->ops);
+		GIT_ERROR_CHECK_ALLOC(op);
+
+		memset(op, 0, sizeof(git_delta_op));
+		op->len = stream->unpacked.len;
+	}
+
+	return 0;
+}
+
+static int object_stream_window_next(git_packfile_object_stream *stream)
+{
+	ssize_t read;
+	git_off_t curpos;
+
+	stream->window_start += stream->window_len;
+	stream->window_len = 0;
+
+	while (stream->window_len < stream->window_alloc && !stream->zstream.done) {
+		curpos = stream->zstream.curpos;
+		read = git_packfile_stream_read(&stream->zstream,
+			stream->window + stream->window_len,
+			stream->window_alloc - stream->window_len);
+
+		/* inflating may need more input before it can output anything */
+		if (read == GIT_EBUFS && stream->zstream.curpos != curpos)
+			continue;
+		if (read < 0)
+			return read == GIT_EBUFS ? packfile_error("object data is truncated") : (int)read;
+
+		stream->window_len += read;
+	}
+
+	if (!stream->window_len)
+		return packfile_error("object is smaller than its header says");
+
+	return 0;
+}
+
+/* Copy up to `len` bytes of the base at `offset`, returning how many */
+static ssize_t object_stream_read_base(
+	unsigned char *out,
+	git_packfile_object_stream *stream,
+	size_t offset,
+	size_t len)
+{
+	size_t available;
+	int error;
+
+	if (stream->cached) {
+		memcpy(out, (unsigned char *)stream->cached->raw.data + offset, len);
+		return len;
+	}
+
+	if (stream->unpacked.data) {
+		memcpy(out, (unsigned char *)stream->unpacked.data + offset, len);
+		return len;
+	}
+
+	/* the instructions were checked to never go back before the window */
+	assert(offset >= stream->window_start);
+
+	if (!stream->zstream_open) {
+		if (git_packfile_stream_open(&stream->zstream, stream->p, stream->base_offset) < 0)
+			return -1;
+
+		stream->zstream_open = 1;
+	}
+
+	while (offset >= stream->window_start + stream->window_len) {
+		if ((error = object_stream_window_next(stream)) < 0)
+			return error;
+	}
+
+	available = stream->window_start + stream->window_len - offset;
+	len = min(len, available);
+
+	memcpy(out, stream->window + (offset - stream->window_start), len);
+	return len;
+}
+
+int git_packfile_object_stream_open(
+	git_packfile_object_stream **out,
+	size_t *len_out,
+	git_object_t *type_out,
+	struct git_pack_file *p,
+	git_off_t offset)
+{
+	git_packfile_object_stream *stream;
+	git_dependency_chain chain = GIT_ARRAY_INIT;
+	struct pack_chain_elem small_stack[SMALL_STACK_SIZE], *stack, *elem;
+	git_delta_ops level = GIT_ARRAY_INIT, composed = GIT_ARRAY_INIT;
+	git_mwindow *w_curs = NULL;
+	git_off_t cached_off, curpos;
+	size_t stack_size = 0, i, base_len, result_len, expected = 0, object_len = 0;
+	git_object_t base_type;
+	git_rawobj delta;
+	void **delta_data;
+	int error;
+
+	*out = NULL;
+
+	stream = git__calloc(1, sizeof(git_packfile_object_stream));
+	GIT_ERROR_CHECK_ALLOC(stream);
+
+	stream->p = p;
+
+	if ((error = pack_dependency_chain(&chain, &stream->cached, &cached_off,
+			small_stack, &stack_size, p, offset)) < 0)
+		goto done;
+
+	stack = chain.ptr ? chain.ptr : small_stack;
+
+	/* the last element is the base, unless it was found in the cache */
+	if (stream->cached) {
+		base_type = stream->cached->raw.type;
+		stream->base_size = stream->cached->raw.len;
+	} else {
+		elem = &stack[stack_size - 1];
+		base_type = elem->type;
+		stream->base_size = elem->size;
+		stream->base_offset = elem->offset;
+	}
+
+	switch (base_type) {
+	case GIT_OBJECT_COMMIT:
+	case GIT_OBJECT_TREE:
+	case GIT_OBJECT_BLOB:
+	case GIT_OBJECT_TAG:
+		break;
+	case GIT_OBJECT_OFS_DELTA:
+	case GIT_OBJECT_REF_DELTA:
+		error = packfile_error("dependency chain ends in a delta");
+		goto done;
+	default:
+		error = packfile_error("invalid packfile type in header");
+		goto done;
+	}
+
+	/*
+	 * Compose the deltas from the object down to the base, so that
+	 * its bytes come straight from the base or from the deltas.
+	 */
+	for (i = 0; i < stack_size - 1; i++) {
+		elem = &stack[i];
+		curpos = elem->offset;
+
+		error = git_packfile_unpack_compressed(&delta, p, &w_curs, &curpos, elem->size, elem->type);
+		git_mwindow_close(&w_curs);
+
+		if (error < 0)
+			goto done;
+
+		if ((delta_data = git_array_alloc(stream->deltas)) == NULL) {
+			git__free(delta.data);
+			error = -1;
+			goto done;
+		}
+
+		*delta_data = delta.data;
+
+		if (i == 0) {
+			error = git_delta_ops_parse(&stream->ops, &base_len, &object_len,
+				delta.data, delta.len);
+		} else {
+			git_array_clear(level);
+
+			if ((error = git_delta_ops_parse(&level, &base_len, &result_len,
+					delta.data, delta.len)) < 0)
+				goto done;
+
+			if (result_len != expected) {
+				error = packfile_error("delta does not produce the base of the next one");
+				goto done;
+			}
+
+			git_array_clear(composed);
+
+			if ((error = git_delta_ops_compose(&composed, &stream->ops, &level)) == 0) {
+				git_array_clear(stream->ops);
+				stream->ops = composed;
+				git_array_init(composed);
+			}
+		}
+
+		if (error < 0)
+			goto done;
+
+		expected = base_len;
+	}
+
+	if (stack_size == 1) {
+		git_delta_op *op;
+
+		/* an object that is not a delta is its own base */
+		object_len = stream->base_size;
+
+		if (object_len && (op = git_array_alloc(stream->ops)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		if (object_len) {
+			memset(op, 0, sizeof(git_delta_op));
+			op->len = object_len;
+		}
+	} else if (expected != stream->base_size) {
+		error = packfile_error("delta does not apply to the size of its base");
+		goto done;
+	}
+
+	if (!stream->cached) {
+		stream->window_alloc = min(stream->base_size, PACK_OBJECT_STREAM_WINDOW);
+		stream->window = git__malloc(max(stream->window_alloc, 1));
+
+		if (!stream->window) {
+			error = -1;
+			goto done;
+		}
+
+		if (!object_stream_forward_only(stream) &&
+		    (error = object_stream_unpack(stream, offset)) < 0)
+			goto done;
+	}
+
+	*out = stream;
+	*len_out = object_len;
+	*type_out = base_type;
+
+done:
+	git_array_clear(level);
+	git_array_clear(composed);
+	git_array_clear(chain);
+
+	if (error < 0)
+		git_packfile_object_stream_free(stream);
+
+	return error;
+}
+
+ssize_t git_packfile_object_stream_read(
+	git_packfile_object_stream *stream,
+	void *buffer,
+	size_t len)
+{
+	unsigned char *out = buffer;
+	const git_delta_op *op;
+	size_t written = 0, chunk;
+	ssize_t read;
+
+	while (written < len &&
+	       (op = git_array_get(stream->ops, stream->op_idx)) != NULL) {
+		chunk = min(op->len - stream->op_pos, len - written);
+
+		if (op->literal) {
+			memcpy(out + written, op->literal + stream->op_pos, chunk);
+		} else {
+			read = object_stream_read_base(out + written, stream,
+				op->offset + stream->op_pos, chunk);
+
+			if (read < 0)
+				return read;
+
+			chunk = (size_t)read;
+		}
+
+		written += chunk;
+		stream->op_pos += chunk;
+
+		if (stream->op_pos == op->len) {
+			stream->op_idx++;
+			stream->op_pos = 0;
+		}
+	}
+
+	return written;
+}
+
+void git_packfile_object_stream_free(git_packfile_object_stream *stream)
+{
+	void **delta_data;
+	size_t i;
+
+	if (!stream)
+		return;
+
+	git_array_foreach(stream->deltas, i, delta_data)
+		git__free(*delta_data);
+
+	if (stream->zstream_open)
+		git_packfile_stream_dispose(&stream->zstream);
+
+	git_pack_cache_release(stream->cached);
+	git__free(stream->unpacked.data);
+	git_array_clear(stream->deltas);
+	git_array_clear(stream->ops);
+	git__free(stream->window);
+	git__free(stream);
+}
+
 /*
  * curpos is where the data starts, delta_obj_offset is the where the
  * header starts
@@ -1000,7 +1306,7 @@ void git_packfile_free(struct git_pack_file *p)
 	if (!p)
 		return;
 
-	cache_free(&p->bases);
+	git_pack_cache_purge(p);
 
 	git_packfile_close(p, false);
 
@@ -1009,7 +1315,7 @@ void git_packfile_free(struct git_pack_file *p)
 	git__free(p->bad_object_sha1);
 
 	git_mutex_free(&p->lock);
-	git_mutex_free(&p->bases.lock);
+	git_rwlock_free(&p->mwf.lock);
 	git__free(p);
 }
 
@@ -1166,7 +1472,9 @@ int git_packfile_alloc(struct git_pack_file **pack_out, const char *path)
 		return -1;
 	}
 
-	if (cache_init(&p->bases) < 0) {
+	if (git_rwlock_init(&p->mwf.lock)) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize packfile window lock");
+		git_mutex_free(&p->lock);
 		git__free(p);
 		return -1;
 	}
@@ -1269,6 +1577,45 @@ int git_pack_foreach_entry(
 	return error;
 }
 
+int git_pack_foreach_entry_offset(
+	struct git_pack_file *p,
+	git_pack_foreach_entry_offset_cb cb,
+	void *data)
+{
+	const unsigned char *index;
+	const git_oid *current_oid;
+	git_off_t current_offset;
+	uint32_t i;
+	int error;
+
+	if (p->index_version == -1 && (error = pack_index_open(p)) < 0)
+		return error;
+
+	index = p->index_map.data;
+
+	if (p->index_version > 1)
+		index += 8;
+
+	index += 4 * 256;
+
+	for (i = 0; i < p->num_objects; i++) {
+		if (p->index_version > 1)
+			current_oid = (const git_oid *)(index + 20 * i);
+		else
+			current_oid = (const git_oid *)(index + 24 * i + 4);
+
+		if ((current_offset = nth_packed_object_offset(p, i)) < 0) {
+			git_error_set(GIT_ERROR_ODB, "packfile index is corrupt");
+			return -1;
+		}
+
+		if ((error = cb(current_oid, current_offset, data)) != 0)
+			return git_error_set_after_callback(error);
+	}
+
+	return 0;
+}
+
 static int pack_entry_find_offset(
 	git_off_t *offset_out,
 	git_oid *found_oid,
@@ -1404,3 +1751,230 @@ int git_pack_entry_find(
 	git_oid_cpy(&e->sha1, &found_oid);
 	return 0;
 }
+
+int git_pack_entry_init(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset)
+{
+	unsigned i;
+	int error;
+
+	assert(e && p && oid);
+
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (git_oid__cmp(oid, &p->bad_object_sha1[i]) == 0)
+			return packfile_error("bad object found in packfile");
+
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	e->offset = offset;
+	e->p = p;
+
+	git_oid_cpy(&e->sha1, oid);
+	return 0;
+}
+
+static int revindex_cmp(const void *a_, const void *b_)
+{
+	const struct git_pack_revindex_entry *a = a_, *b = b_;
+
+	if (a->offset < b->offset)
+		return -1;
+
+	return (a->offset > b->offset) ? 1 : 0;
+}
+
+/* Sort the objects of the pack by their offset, once. */
+static int pack_revindex_load(struct git_pack_file *p)
+{
+	struct git_pack_revindex_entry *revindex;
+	uint32_t i;
+	int error;
+
+	if ((error = pack_index_open(p)) < 0 ||
+	    (error = git_mutex_lock(&p->lock)) < 0)
+		return error;
+
+	if (p->revindex)
+		goto done;
+
+	if ((revindex = git__mallocarray(p->num_objects + 1, sizeof(*revindex))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < p->num_objects; i++) {
+		revindex[i].nr = i;
+
+		if ((revindex[i].offset = nth_packed_object_offset(p, i)) < 0) {
+			git__free(revindex);
+			error = packfile_error("packfile index is corrupt");
+			goto done;
+		}
+	}
+
+	qsort(revindex, p->num_objects, sizeof(*revindex), revindex_cmp);
+	p->revindex = revindex;
+
+done:
+	git_mutex_unlock(&p->lock);
+	return error;
+}
+
+static const struct git_pack_revindex_entry *pack_revindex_find(
+	struct git_pack_file *p, git_off_t offset)
+{
+	size_t lo = 0, hi = p->num_objects, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (p->revindex[mid].offset == offset)
+			return &p->revindex[mid];
+		else if (p->revindex[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+int git_packfile_raw_entry_init(
+		git_packfile_raw_entry *out,
+		struct git_pack_file *p,
+		git_off_t offset)
+{
+	const struct git_pack_revindex_entry *entry, *base;
+	const unsigned char *index, *base_info;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos = offset, base_offset;
+	unsigned int left;
+	int error;
+
+	assert(out && p);
+
+	memset(out, 0, sizeof(*out));
+
+	if ((error = pack_revindex_load(p)) < 0)
+		return error;
+
+	if (p->index_version < 2)
+		return git_odb__error_notfound("packfile index has no checksums", NULL, 0);
+
+	if ((entry = pack_revindex_find(p, offset)) == NULL)
+		return git_odb__error_notfound("no packed object at offset", NULL, 0);
+
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	if ((error = git_packfile_unpack_header(&out->size, &out->type, &p->mwf, &w_curs, &curpos)) < 0)
+		return error;
+
+	index = (const unsigned char *)p->index_map.data + 8 + 4 * 256;
+
+	if (out->type == GIT_OBJECT_OFS_DELTA) {
+		base_offset = get_delta_base(p, &w_curs, &curpos, out->type, offset);
+		git_mwindow_close(&w_curs);
+
+		if (base_offset <= 0 || (base = pack_revindex_find(p, base_offset)) == NULL)
+			return packfile_error("delta base is not in the pack");
+
+		git_oid_fromraw(&out->base, index + GIT_OID_RAWSZ * base->nr);
+	} else if (out->type == GIT_OBJECT_REF_DELTA) {
+		if ((base_info = pack_window_open(p, &w_curs, curpos, &left)) == NULL)
+			return packfile_error("truncated delta base");
+
+		git_oid_fromraw(&out->base, base_info);
+		git_mwindow_close(&w_curs);
+		curpos += GIT_OID_RAWSZ;
+	}
+
+	out->offset = offset;
+	out->data_offset = curpos;
+	out->end = (entry < p->revindex + p->num_objects - 1) ?
+		(entry + 1)->offset : p->mwf.size - GIT_OID_RAWSZ;
+
+	if (out->end <= out->data_offset)
+		return packfile_error("packed object is truncated");
+
+	index += (GIT_OID_RAWSZ * p->num_objects) + (4 * entry->nr);
+	out->crc = ntohl(*((uint32_t *)index));
+
+	return 0;
+}
+
+static int pack_range_foreach(
+	struct git_pack_file *p,
+	git_off_t start,
+	git_off_t end,
+	git_packfile_raw_cb cb,
+	void *payload)
+{
+	git_mwindow *w_curs = NULL;
+	unsigned char *data;
+	unsigned int left;
+	size_t len;
+	int error = 0;
+
+	while (start < end) {
+		if ((data = git_mwindow_open(&p->mwf, &w_curs, start, 0, &left)) == NULL)
+			return packfile_error("truncated packed object");
+
+		len = min((size_t)left, (size_t)(end - start));
+		error = cb(data, len, payload);
+		git_mwindow_close(&w_curs);
+
+		if (error < 0)
+			break;
+
+		start += len;
+	}
+
+	return error;
+}
+
+static int crc_cb(const unsigned char *buf, size_t len, void *payload)
+{
+	uint32_t *crc = payload;
+
+	*crc = crc32(*crc, buf, (uInt)len);
+	return 0;
+}
+
+int git_packfile_raw_check(
+		struct git_pack_file *p,
+		const git_packfile_raw_entry *entry)
+{
+	uint32_t crc = crc32(0L, Z_NULL, 0);
+	int error;
+
+	assert(p && entry);
+
+	if ((error = pack_range_foreach(p, entry->offset, entry->end, crc_cb, &crc)) < 0)
+		return error;
+
+	if (crc != entry->crc) {
+		git_error_set(GIT_ERROR_ODB, "packed object at offset %" PRId64 " is corrupt - CRC mismatch",
+			(int64_t)entry->offset);
+		return GIT_EMISMATCH;
+	}
+
+	return 0;
+}
+
+int git_packfile_raw_copy(
+		struct git_pack_file *p,
+		const git_packfile_raw_entry *entry,
+		git_off_t start,
+		git_packfile_raw_cb cb,
+		void *payload)
+{
+	assert(p && entry && cb);
+	assert(start >= entry->offset && start <= entry->end);
+
+	return pack_range_foreach(p, start, entry->end, cb, payload);
+}
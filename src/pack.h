@@ -18,6 +18,7 @@
 #include "mwindow.h"
 #include "odb.h"
 #include "offmap.h"
+#include "pack-cache.h"
 #include "oidmap.h"
 #include "array.h"
 
@@ -57,12 +58,6 @@ struct git_pack_idx_header {
 	uint32_t idx_version;
 };
 
-typedef struct git_pack_cache_entry {
-	size_t last_usage; /* enough? */
-	git_atomic refcount;
-	git_rawobj raw;
-} git_pack_cache_entry;
-
 struct pack_chain_elem {
 	git_off_t base_key;
 	git_off_t offset;
@@ -72,16 +67,10 @@ struct pack_chain_elem {
 
 typedef git_array_t(struct pack_chain_elem) git_dependency_chain;
 
-#define GIT_PACK_CACHE_MEMORY_LIMIT 16 * 1024 * 1024
-#define GIT_PACK_CACHE_SIZE_LIMIT 1024 * 1024 /* don't bother caching anything over 1MB */
-
-typedef struct {
-	size_t memory_used;
-	size_t memory_limit;
-	size_t use_ctr;
-	git_mutex lock;
-	git_offmap *entries;
-} git_pack_cache;
+struct git_pack_revindex_entry {
+	git_off_t offset;
+	uint32_t nr; /* position in the pack index */
+};
 
 struct git_pack_file {
 	git_mwindow_file mwf;
@@ -98,8 +87,7 @@ struct git_pack_file {
 	unsigned pack_local:1, pack_keep:1, has_cache:1;
 	git_oidmap *idx_cache;
 	git_oid **oids;
-
-	git_pack_cache bases; /* delta base cache */
+	struct git_pack_revindex_entry *revindex; /* objects by offset */
 
 	time_t last_freshen; /* last time the packfile was freshened */
 
@@ -113,6 +101,21 @@ struct git_pack_entry {
 	struct git_pack_file *p;
 };
 
+/*
+ * How an object is stored in a packfile: the data between `data_offset`
+ * and `end` is the compressed object, or the compressed delta against
+ * `base` when `type` is a delta.
+ */
+typedef struct {
+	git_object_t type;
+	size_t size; /* inflated size of the data */
+	git_oid base;
+	git_off_t offset;
+	git_off_t data_offset;
+	git_off_t end;
+	uint32_t crc; /* of the whole entry, from the pack index */
+} git_packfile_raw_entry;
+
 typedef struct git_packfile_stream {
 	git_off_t curpos;
 	int done;
@@ -140,10 +143,44 @@ int git_packfile_resolve_header(
 
 int git_packfile_unpack(git_rawobj *obj, struct git_pack_file *p, git_off_t *obj_offset);
 
+/*
+ * Inflate the `size` bytes of object data starting at `curpos`, without
+ * resolving deltas. `curpos` is moved past the compressed data.
+ */
+int git_packfile_unpack_compressed(
+		git_rawobj *obj,
+		struct git_pack_file *p,
+		git_mwindow **w_curs,
+		git_off_t *curpos,
+		size_t size,
+		git_object_t type);
+
 int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p, git_off_t curpos);
 ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len);
 void git_packfile_stream_dispose(git_packfile_stream *obj);
 
+/*
+ * Read an object out of a packfile a piece at a time.  The deltas of its
+ * chain are composed into copies from the base of the chain and literal
+ * data, so that only the deltas and a window of the base are held in
+ * memory, rather than the whole object and the bases in between.  When
+ * the instructions would have to go back in the base further than that
+ * window, the object is unpacked whole instead.
+ */
+typedef struct git_packfile_object_stream git_packfile_object_stream;
+
+int git_packfile_object_stream_open(
+		git_packfile_object_stream **out,
+		size_t *len_out,
+		git_object_t *type_out,
+		struct git_pack_file *p,
+		git_off_t offset);
+ssize_t git_packfile_object_stream_read(
+		git_packfile_object_stream *stream,
+		void *buffer,
+		size_t len);
+void git_packfile_object_stream_free(git_packfile_object_stream *stream);
+
 git_off_t get_delta_base(struct git_pack_file *p, git_mwindow **w_curs,
 		git_off_t *curpos, git_object_t type,
 		git_off_t delta_obj_offset);
@@ -162,4 +199,63 @@ int git_pack_foreach_entry(
 		git_odb_foreach_cb cb,
 		void *data);
 
+/*
+ * Fill in a pack entry for an object whose offset within the packfile is
+ * already known (e.g. from a multi-pack-index), making sure that the
+ * packfile backing it can still be read.
+ */
+int git_pack_entry_init(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset);
+
+typedef int (*git_pack_foreach_entry_offset_cb)(
+		const git_oid *id,
+		git_off_t offset,
+		void *payload);
+
+/*
+ * Call `cb` for every object in the packfile along with its offset, in
+ * the order of the pack index.
+ */
+int git_pack_foreach_entry_offset(
+		struct git_pack_file *p,
+		git_pack_foreach_entry_offset_cb cb,
+		void *data);
+
+/*
+ * Describe how the object at `offset` is stored, so that it may be copied
+ * into another pack without being inflated.  This needs a version 2 pack
+ * index, which records the CRC32 of each entry; GIT_ENOTFOUND is returned
+ * for older packs.
+ */
+int git_packfile_raw_entry_init(
+		git_packfile_raw_entry *out,
+		struct git_pack_file *p,
+		git_off_t offset);
+
+typedef int (*git_packfile_raw_cb)(
+		const unsigned char *buf,
+		size_t len,
+		void *payload);
+
+/*
+ * Check the packed data of the entry against its CRC32. Returns
+ * GIT_EMISMATCH if it is corrupt.
+ */
+int git_packfile_raw_check(
+		struct git_pack_file *p,
+		const git_packfile_raw_entry *entry);
+
+/*
+ * Give the packed data between `start` and the end of the entry to `cb`.
+ */
+int git_packfile_raw_copy(
+		struct git_pack_file *p,
+		const git_packfile_raw_entry *entry,
+		git_off_t start,
+		git_packfile_raw_cb cb,
+		void *payload);
+
 #endif
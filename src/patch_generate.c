@@ -746,6 +746,240 @@ int git_patch_generated_from_diff(
 	return error;
 }
 
+#ifdef GIT_THREADS
+
+/*
+ * With more than one thread, a pool of workers loads the files and runs
+ * xdiff for the deltas ahead of the calling thread, which sets up each
+ * patch and then calls the callbacks for it, both in the order of the
+ * deltas.  Only so many patches are set up ahead of the callbacks, so
+ * that the contents of all of the files are not held at once.
+ */
+#define PATCH_GENERATED_JOBS_PER_THREAD 8
+
+typedef struct {
+	git_patch_generated *patch;
+	git_error_state error;
+	unsigned int local : 1, /* diffed on the calling thread */
+		done : 1;
+} patch_generated_job;
+
+typedef struct {
+	patch_generated_job *jobs;
+	size_t prepared; /* jobs that the workers can take */
+	size_t next;
+	bool stop;
+	git_mutex lock;
+	git_cond cond;
+} patch_generated_pool;
+
+typedef struct {
+	patch_generated_pool *pool;
+	git_thread thread;
+} patch_generated_worker;
+
+static int patch_generated_job_run(patch_generated_job *job)
+{
+	git_xdiff_output xo;
+
+	memset(&xo, 0, sizeof(xo));
+	diff_output_to_patch(&xo.output, job->patch);
+	git_xdiff_init(&xo, &job->patch->diff->opts);
+
+	return patch_generated_create(job->patch, &xo.output);
+}
+
+static void *patch_generated_worker_run(void *arg)
+{
+	patch_generated_worker *worker = arg;
+	patch_generated_pool *pool = worker->pool;
+	patch_generated_job *job;
+	int error;
+
+	git_mutex_lock(&pool->lock);
+
+	while (!pool->stop) {
+		if (pool->next == pool->prepared) {
+			git_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+
+		job = &pool->jobs[pool->next++];
+
+		if (!job->local) {
+			git_mutex_unlock(&pool->lock);
+
+			if ((error = patch_generated_job_run(job)) < 0)
+				git_error_state_capture(&job->error, error);
+
+			git_mutex_lock(&pool->lock);
+		}
+
+		job->done = 1;
+		git_cond_broadcast(&pool->cond);
+	}
+
+	git_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/*
+ * Files in the working directory are loaded through filters and the
+ * submodules of the repository, which are not safe to use from several
+ * threads; those deltas are diffed on the calling thread.
+ */
+static int patch_generated_job_prepare(
+	patch_generated_job *job, git_diff *diff, size_t idx)
+{
+	int error;
+
+	if ((error = patch_generated_alloc_from_diff(&job->patch, diff, idx)) < 0)
+		return error;
+
+	job->local = (job->patch->ofile.src == GIT_ITERATOR_TYPE_WORKDIR ||
+		job->patch->nfile.src == GIT_ITERATOR_TYPE_WORKDIR);
+
+	return 0;
+}
+
+static int patch_generated_job_finish(
+	patch_generated_pool *pool,
+	size_t idx,
+	git_diff_file_cb file_cb,
+	git_diff_binary_cb binary_cb,
+	git_diff_hunk_cb hunk_cb,
+	git_diff_line_cb data_cb,
+	void *payload)
+{
+	patch_generated_job *job = &pool->jobs[idx];
+	int error;
+
+	git_mutex_lock(&pool->lock);
+	while (!job->done)
+		git_cond_wait(&pool->cond, &pool->lock);
+	git_mutex_unlock(&pool->lock);
+
+	if (job->error.error_code < 0)
+		return git_error_state_restore(&job->error);
+
+	if (job->local && (error = patch_generated_job_run(job)) < 0)
+		return error;
+
+	error = git_patch__invoke_callbacks(&job->patch->base,
+		file_cb, binary_cb, hunk_cb, data_cb, payload);
+
+	git_patch_free(&job->patch->base);
+	job->patch = NULL;
+
+	return error;
+}
+
+int git_patch_generated_foreach_threaded(
+	git_diff *diff,
+	git_diff_file_cb file_cb,
+	git_diff_binary_cb binary_cb,
+	git_diff_hunk_cb hunk_cb,
+	git_diff_line_cb data_cb,
+	void *payload)
+{
+	patch_generated_pool pool = {0};
+	patch_generated_worker *workers = NULL;
+	git_error_state prepare_error = {0};
+	git_diff_delta *delta;
+	size_t nr_jobs = 0, nr_workers = 0, ahead, idx = 0, i;
+	int error = 0;
+
+	git_vector_foreach(&diff->deltas, i, delta) {
+		if (!git_diff_delta__should_skip(&diff->opts, delta))
+			nr_jobs++;
+	}
+
+	if (!nr_jobs)
+		return 0;
+
+	if (git_mutex_init(&pool.lock) < 0 || git_cond_init(&pool.cond) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize diff threads");
+		return -1;
+	}
+
+	ahead = diff->opts.threads * PATCH_GENERATED_JOBS_PER_THREAD;
+
+	pool.jobs = git__calloc(nr_jobs, sizeof(patch_generated_job));
+	workers = git__calloc(diff->opts.threads, sizeof(patch_generated_worker));
+
+	if (!pool.jobs || !workers) {
+		error = -1;
+		goto done;
+	}
+
+	for (; nr_workers < diff->opts.threads && nr_workers < nr_jobs; nr_workers++) {
+		workers[nr_workers].pool = &pool;
+
+		if ((error = git_thread_create(&workers[nr_workers].thread,
+				patch_generated_worker_run, &workers[nr_workers])) < 0) {
+			git_error_set(GIT_ERROR_THREAD, "unable to create thread");
+			goto done;
+		}
+	}
+
+	for (i = 0; i < nr_jobs; i++) {
+		while (!prepare_error.error_code &&
+		       pool.prepared < nr_jobs && pool.prepared < i + ahead) {
+			while (git_diff_delta__should_skip(&diff->opts,
+					git_vector_get(&diff->deltas, idx)))
+				idx++;
+
+			/* the deltas before the one that failed still get their callbacks */
+			if ((error = patch_generated_job_prepare(
+					&pool.jobs[pool.prepared], diff, idx++)) < 0) {
+				git_error_state_capture(&prepare_error, error);
+				error = 0;
+				break;
+			}
+
+			git_mutex_lock(&pool.lock);
+			pool.prepared++;
+			git_cond_signal(&pool.cond);
+			git_mutex_unlock(&pool.lock);
+		}
+
+		if (i == pool.prepared)
+			break;
+
+		if ((error = patch_generated_job_finish(&pool, i,
+				file_cb, binary_cb, hunk_cb, data_cb, payload)) != 0)
+			break;
+	}
+
+	if (!error && prepare_error.error_code < 0)
+		error = git_error_state_restore(&prepare_error);
+
+done:
+	git_mutex_lock(&pool.lock);
+	pool.stop = true;
+	git_cond_broadcast(&pool.cond);
+	git_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < nr_workers; i++)
+		git_thread_join(&workers[i].thread, NULL);
+
+	for (i = 0; pool.jobs && i < nr_jobs; i++) {
+		if (pool.jobs[i].patch)
+			git_patch_free(&pool.jobs[i].patch->base);
+		git_error_state_free(&pool.jobs[i].error);
+	}
+
+	git_error_state_free(&prepare_error);
+	git_cond_free(&pool.cond);
+	git_mutex_free(&pool.lock);
+	git__free(pool.jobs);
+	git__free(workers);
+
+	return error;
+}
+
+#endif
+
 git_diff_driver *git_patch_generated_driver(git_patch_generated *patch)
 {
 	/* ofile driver is representative for whole patch */
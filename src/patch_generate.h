@@ -46,6 +46,16 @@ extern void git_patch_generated_new_data(
 extern int git_patch_generated_from_diff(
 	git_patch **, git_diff *, size_t);
 
+#ifdef GIT_THREADS
+extern int git_patch_generated_foreach_threaded(
+	git_diff *diff,
+	git_diff_file_cb file_cb,
+	git_diff_binary_cb binary_cb,
+	git_diff_hunk_cb hunk_cb,
+	git_diff_line_cb data_cb,
+	void *payload);
+#endif
+
 typedef struct git_patch_generated_output git_patch_generated_output;
 
 struct git_patch_generated_output {
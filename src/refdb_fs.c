@@ -64,8 +64,16 @@ typedef struct refdb_fs_backend {
 	git_iterator_flag_t iterator_flags;
 	uint32_t direach_flags;
 	int fsync;
+
+	/* the mapped packed-refs, for reading refs without parsing it all */
+	bool packed_mmap;
+	git_mutex packed_map_lock;
+	struct packed_map *packed_map;
+	git_futils_filestamp packed_map_stamp;
 } refdb_fs_backend;
 
+bool git_refdb_fs__packed_refs_mmap = false;
+
 static int refdb_reflog_fs__delete(git_refdb_backend *_backend, const char *name);
 
 static int packref_cmp(const void *a_, const void *b_)
@@ -74,6 +82,325 @@ static int packref_cmp(const void *a_, const void *b_)
 	return strcmp(a->name, b->name);
 }
 
+/*
+ * A packed-refs file with the `sorted` trait can be read in place: a
+ * reference is found with a binary search over its records, and a prefix
+ * of the namespace is iterated from the first record in it.  The records
+ * are "<OID> <refname>\n", each optionally followed by "^<OID>\n".
+ *
+ * The mapping is shared by lookups and iterators, and is replaced when
+ * the file changes; it goes away when the last of them lets go of it.
+ */
+typedef struct packed_map {
+	git_atomic refcount;
+	git_map map;
+	const char *records; /* the first record, after the header */
+	const char *end;
+	bool sorted;
+} packed_map;
+
+typedef struct {
+	git_oid oid;
+	git_oid peel;
+	const char *name;
+	size_t name_len;
+} packed_record;
+
+static void packed_map_free(packed_map *map)
+{
+	if (!map || git_atomic_dec(&map->refcount) > 0)
+		return;
+
+	if (map->map.data)
+		git_futils_mmap_free(&map->map);
+
+	git__free(map);
+}
+
+static int packed_map_open(
+	packed_map **out, const char *path, git_futils_filestamp *stamp)
+{
+	static const char *traits_header = "# pack-refs with: ";
+	packed_map *map = NULL;
+	const char *scan, *eol;
+	struct stat st;
+	git_file fd;
+	int error = 0;
+
+	*out = NULL;
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to stat '%s'", path);
+		error = -1;
+		goto done;
+	}
+
+	if (!git__is_sizet(st.st_size)) {
+		git_error_set(GIT_ERROR_REFERENCE, "packed references file is too large");
+		error = -1;
+		goto done;
+	}
+
+	map = git__calloc(1, sizeof(packed_map));
+	GIT_ERROR_CHECK_ALLOC(map);
+
+	git_atomic_set(&map->refcount, 1);
+	git_futils_filestamp_set_from_stat(stamp, &st);
+
+	/* An empty file has no records to be out of order */
+	map->sorted = true;
+
+	if (!st.st_size)
+		goto done;
+
+	if ((error = git_futils_mmap_ro(&map->map, fd, 0, (size_t)st.st_size)) < 0)
+		goto done;
+
+	scan = map->map.data;
+	map->end = scan + map->map.len;
+
+	/* Like git, only trust the order of the records if the file says so */
+	map->sorted = false;
+
+	if (git__prefixncmp(scan, map->end - scan, traits_header) == 0 &&
+	    (eol = memchr(scan, '\n', map->end - scan)) != NULL) {
+		const char *traits = scan + strlen(traits_header) - 1;
+		map->sorted = (git__memmem(traits, eol - traits, " sorted ", 8) != NULL);
+	}
+
+	while (scan < map->end && *scan == '#') {
+		if ((eol = memchr(scan, '\n', map->end - scan)) == NULL) {
+			git_error_set(GIT_ERROR_REFERENCE, "corrupted packed references file");
+			error = -1;
+			goto done;
+		}
+
+		scan = eol + 1;
+	}
+
+	map->records = scan;
+
+done:
+	p_close(fd);
+
+	if (error < 0) {
+		packed_map_free(map);
+		git_futils_filestamp_set(stamp, NULL);
+	} else {
+		*out = map;
+	}
+
+	return error;
+}
+
+/*
+ * Get the mapping of the packed-refs file, mapping it again if it changed.
+ * `*out` is NULL when there is no file.  Returns GIT_PASSTHROUGH when the
+ * file is not sorted, and has to be parsed as a whole instead.
+ */
+static int packed_map_get(packed_map **out, refdb_fs_backend *backend)
+{
+	const char *path = git_sortedcache_path(backend->refcache);
+	packed_map *map = NULL;
+	int error;
+
+	*out = NULL;
+
+	if (!backend->gitpath)
+		return 0;
+
+	if (git_mutex_lock(&backend->packed_map_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock packed references");
+		return -1;
+	}
+
+	error = git_futils_filestamp_check(&backend->packed_map_stamp, path);
+
+	if (error == 0 && backend->packed_map) {
+		map = backend->packed_map;
+	} else if (error >= 0) {
+		error = packed_map_open(&map, path, &backend->packed_map_stamp);
+
+		if (error == 0) {
+			packed_map_free(backend->packed_map);
+			backend->packed_map = map;
+		}
+	}
+
+	if (error == GIT_ENOTFOUND) {
+		packed_map_free(backend->packed_map);
+		backend->packed_map = NULL;
+		git_error_clear();
+		error = 0;
+	}
+
+	if (!error && map) {
+		git_atomic_inc(&map->refcount);
+		*out = map;
+	}
+
+	git_mutex_unlock(&backend->packed_map_lock);
+
+	if (*out && !(*out)->sorted) {
+		packed_map_free(*out);
+		*out = NULL;
+		return GIT_PASSTHROUGH;
+	}
+
+	return error;
+}
+
+/* Let go of the mapping, so that the file can be replaced on Windows */
+static void packed_map_drop(refdb_fs_backend *backend)
+{
+	if (git_mutex_lock(&backend->packed_map_lock) < 0)
+		return;
+
+	packed_map_free(backend->packed_map);
+	backend->packed_map = NULL;
+	git_futils_filestamp_set(&backend->packed_map_stamp, NULL);
+
+	git_mutex_unlock(&backend->packed_map_lock);
+}
+
+/* Back up from `p` to the start of the record that it is in */
+static const char *packed_map_record_start(const char *start, const char *p)
+{
+	while (p > start && (p[-1] != '\n' || *p == '^'))
+		p--;
+
+	return p;
+}
+
+/* Skip the record at `rec`, along with its peeled line */
+static const char *packed_map_record_end(const char *rec, const char *end)
+{
+	const char *eol;
+
+	eol = memchr(rec, '\n', end - rec);
+	rec = eol ? eol + 1 : end;
+
+	if (rec < end && *rec == '^') {
+		eol = memchr(rec, '\n', end - rec);
+		rec = eol ? eol + 1 : end;
+	}
+
+	return rec;
+}
+
+/*
+ * Compare the name of the record at `rec` with `name`, or with a prefix of
+ * it, of `len` bytes: for a prefix, the names that start with it are equal.
+ */
+static int packed_map_record_cmp(
+	const char *rec, const char *end, const char *name, size_t len, bool prefix)
+{
+	const char *c = rec + GIT_OID_HEXSZ + 1;
+
+	for (; len; c++, name++, len--) {
+		if (c >= end || *c == '\n' || *c == '\r')
+			return -1;
+
+		if (*c != *name)
+			return (unsigned char)*c < (unsigned char)*name ? -1 : 1;
+	}
+
+	if (prefix || c >= end || *c == '\n' || *c == '\r')
+		return 0;
+
+	return 1;
+}
+
+/* Find the first record whose name is not before the `len` bytes of `name` */
+static const char *packed_map_find(
+	const packed_map *map, const char *name, size_t len)
+{
+	const char *lo = map->records, *hi = map->end, *mid;
+
+	while (lo < hi) {
+		mid = packed_map_record_start(lo, lo + (hi - lo) / 2);
+
+		if (packed_map_record_cmp(mid, map->end, name, len, true) < 0)
+			lo = packed_map_record_end(mid, map->end);
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int packed_map_parse(packed_record *out, const char *rec, const char *end)
+{
+	const char *eol;
+
+	memset(out, 0, sizeof(packed_record));
+
+	if (end - rec < GIT_OID_HEXSZ + 1 ||
+	    git_oid_fromstrn(&out->oid, rec, GIT_OID_HEXSZ) < 0 ||
+	    rec[GIT_OID_HEXSZ] != ' ' ||
+	    (eol = memchr(rec, '\n', end - rec)) == NULL)
+		goto corrupt;
+
+	out->name = rec + GIT_OID_HEXSZ + 1;
+	out->name_len = eol - out->name;
+
+	if (out->name_len && out->name[out->name_len - 1] == '\r')
+		out->name_len--;
+
+	rec = eol + 1;
+
+	if (rec < end && *rec == '^' &&
+	    (end - rec < GIT_OID_HEXSZ + 1 ||
+	     git_oid_fromstrn(&out->peel, rec + 1, GIT_OID_HEXSZ) < 0))
+		goto corrupt;
+
+	return 0;
+
+corrupt:
+	git_error_set(GIT_ERROR_REFERENCE, "corrupted packed references file");
+	return -1;
+}
+
+static int ref_error_notfound(const char *name);
+
+/*
+ * Look a reference up in the mapped packed-refs; `out` may be NULL to only
+ * check that it is there.  Returns GIT_PASSTHROUGH if the file cannot be
+ * searched.
+ */
+static int packed_map_lookup(
+	git_reference **out,
+	refdb_fs_backend *backend,
+	const char *ref_name)
+{
+	packed_map *map;
+	packed_record record;
+	const char *rec;
+	size_t len = strlen(ref_name);
+	int error;
+
+	if ((error = packed_map_get(&map, backend)) < 0)
+		return error;
+
+	if (!map)
+		return ref_error_notfound(ref_name);
+
+	rec = packed_map_find(map, ref_name, len);
+
+	if (rec == map->end ||
+	    packed_map_record_cmp(rec, map->end, ref_name, len, false) != 0)
+		error = ref_error_notfound(ref_name);
+	else if ((error = packed_map_parse(&record, rec, map->end)) == 0 && out)
+		error = (*out = git_reference__alloc(
+			ref_name, &record.oid, &record.peel)) ? 0 : -1;
+
+	packed_map_free(map);
+	return error;
+}
+
 static int packed_reload(refdb_fs_backend *backend)
 {
 	int error;
@@ -343,6 +670,18 @@ static int refdb_fs_backend__exists(
 		goto out;
 	}
 
+	if (backend->packed_mmap &&
+	    (error = packed_map_lookup(NULL, backend, ref_name)) != GIT_PASSTHROUGH) {
+		if (error == GIT_ENOTFOUND) {
+			git_error_clear();
+			error = 0;
+		} else if (!error) {
+			*exists = 1;
+		}
+
+		goto out;
+	}
+
 	if ((error = packed_reload(backend)) < 0)
 		goto out;
 
@@ -444,6 +783,10 @@ static int packed_lookup(
 	int error = 0;
 	struct packref *entry;
 
+	if (backend->packed_mmap &&
+	    (error = packed_map_lookup(out, backend, ref_name)) != GIT_PASSTHROUGH)
+		return error;
+
 	if ((error = packed_reload(backend)) < 0)
 		return error;
 
@@ -498,6 +841,18 @@ typedef struct {
 	git_sortedcache *cache;
 	size_t loose_pos;
 	size_t packed_pos;
+
+	/*
+	 * When reading straight from the mapped packed-refs: the records
+	 * that are left, the literal prefix of the glob that they start
+	 * with, and the loose refs that shadow them.
+	 */
+	packed_map *map;
+	const char *packed_cur;
+	const char *prefix;
+	size_t prefix_len;
+	git_strmap *shadowed;
+	git_buf name;
 } refdb_fs_iter;
 
 static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
@@ -507,6 +862,9 @@ static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
 	git_vector_free(&iter->loose);
 	git_pool_clear(&iter->pool);
 	git_sortedcache_free(iter->cache);
+	packed_map_free(iter->map);
+	git_strmap_free(iter->shadowed);
+	git_buf_dispose(&iter->name);
 	git__free(iter);
 }
 
@@ -587,6 +945,52 @@ static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 	return error;
 }
 
+/* A loose ref at `path` hides the packed one of the same name */
+static int iter_shadow(refdb_fs_iter *iter, const char *path)
+{
+	struct packref *ref;
+
+	if (iter->map)
+		return git_strmap_set(iter->shadowed, path, NULL);
+
+	if ((ref = git_sortedcache_lookup(iter->cache, path)) != NULL)
+		ref->flags |= PACKREF_SHADOWED;
+
+	return 0;
+}
+
+/*
+ * Find the next packed ref in the mapping that is not shadowed by a loose
+ * one; its name is left in `iter->name`, until the next call.
+ */
+static int iter_next_mapped(packed_record *out, refdb_fs_iter *iter)
+{
+	const char *rec;
+	int error;
+
+	while ((rec = iter->packed_cur) < iter->map->end) {
+		if (packed_map_record_cmp(rec, iter->map->end,
+			iter->prefix, iter->prefix_len, true) != 0)
+			break;
+
+		iter->packed_cur = packed_map_record_end(rec, iter->map->end);
+
+		if ((error = packed_map_parse(out, rec, iter->map->end)) < 0 ||
+		    (error = git_buf_set(&iter->name, out->name, out->name_len)) < 0)
+			return error;
+
+		if (git_strmap_exists(iter->shadowed, iter->name.ptr))
+			continue;
+		if (iter->glob && p_fnmatch(iter->glob, iter->name.ptr, 0) != 0)
+			continue;
+
+		return 0;
+	}
+
+	iter->packed_cur = iter->map->end;
+	return GIT_ITEROVER;
+}
+
 static int refdb_fs_backend__iterator_next(
 	git_reference **out, git_reference_iterator *_iter)
 {
@@ -594,21 +998,31 @@ static int refdb_fs_backend__iterator_next(
 	refdb_fs_iter *iter = GIT_CONTAINER_OF(_iter, refdb_fs_iter, parent);
 	refdb_fs_backend *backend = GIT_CONTAINER_OF(iter->parent.db->backend, refdb_fs_backend, parent);
 	struct packref *ref;
+	packed_record record;
 
 	while (iter->loose_pos < iter->loose.length) {
 		const char *path = git_vector_get(&iter->loose, iter->loose_pos++);
 
 		if (loose_lookup(out, backend, path) == 0) {
-			ref = git_sortedcache_lookup(iter->cache, path);
-			if (ref)
-				ref->flags |= PACKREF_SHADOWED;
+			if ((error = iter_shadow(iter, path)) < 0) {
+				git_reference_free(*out);
+				*out = NULL;
+			}
 
-			return 0;
+			return error;
 		}
 
 		git_error_clear();
 	}
 
+	if (iter->map) {
+		if ((error = iter_next_mapped(&record, iter)) < 0)
+			return error;
+
+		*out = git_reference__alloc(iter->name.ptr, &record.oid, &record.peel);
+		return (*out != NULL) ? 0 : -1;
+	}
+
 	error = GIT_ITEROVER;
 	while (iter->packed_pos < git_sortedcache_entrycount(iter->cache)) {
 		ref = git_sortedcache_entry(iter->cache, iter->packed_pos++);
@@ -635,15 +1049,14 @@ static int refdb_fs_backend__iterator_next_name(
 	refdb_fs_iter *iter = GIT_CONTAINER_OF(_iter, refdb_fs_iter, parent);
 	refdb_fs_backend *backend = GIT_CONTAINER_OF(iter->parent.db->backend, refdb_fs_backend, parent);
 	struct packref *ref;
+	packed_record record;
 
 	while (iter->loose_pos < iter->loose.length) {
 		const char *path = git_vector_get(&iter->loose, iter->loose_pos++);
-		struct packref *ref;
 
 		if (loose_lookup(NULL, backend, path) == 0) {
-			ref = git_sortedcache_lookup(iter->cache, path);
-			if (ref)
-				ref->flags |= PACKREF_SHADOWED;
+			if ((error = iter_shadow(iter, path)) < 0)
+				return error;
 
 			*out = path;
 			return 0;
@@ -652,6 +1065,14 @@ static int refdb_fs_backend__iterator_next_name(
 		git_error_clear();
 	}
 
+	if (iter->map) {
+		if ((error = iter_next_mapped(&record, iter)) < 0)
+			return error;
+
+		*out = iter->name.ptr;
+		return 0;
+	}
+
 	error = GIT_ITEROVER;
 	while (iter->packed_pos < git_sortedcache_entrycount(iter->cache)) {
 		ref = git_sortedcache_entry(iter->cache, iter->packed_pos++);
@@ -671,6 +1092,32 @@ static int refdb_fs_backend__iterator_next_name(
 	return error;
 }
 
+/*
+ * Read the packed refs straight from the mapping, starting with the first
+ * that may match the glob.  Returns GIT_PASSTHROUGH if the file cannot be
+ * read this way.
+ */
+static int iter_load_packed_map(refdb_fs_backend *backend, refdb_fs_iter *iter)
+{
+	int error;
+
+	if ((error = packed_map_get(&iter->map, backend)) < 0)
+		return error;
+
+	/* without a packed-refs file, let the cache forget its refs */
+	if (!iter->map)
+		return GIT_PASSTHROUGH;
+
+	if ((error = git_strmap_new(&iter->shadowed)) < 0)
+		return error;
+
+	iter->prefix = iter->glob ? iter->glob : "";
+	iter->prefix_len = strcspn(iter->prefix, "?*[\\");
+	iter->packed_cur = packed_map_find(iter->map, iter->prefix, iter->prefix_len);
+
+	return 0;
+}
+
 static int refdb_fs_backend__iterator(
 	git_reference_iterator **out, git_refdb_backend *_backend, const char *glob)
 {
@@ -697,11 +1144,14 @@ static int refdb_fs_backend__iterator(
 	if ((error = iter_load_loose_paths(backend, iter)) < 0)
 		goto out;
 
-	if ((error = packed_reload(backend)) < 0)
-		goto out;
-
-	if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+	if (backend->packed_mmap &&
+	    (error = iter_load_packed_map(backend, iter)) != GIT_PASSTHROUGH) {
+		if (error < 0)
+			goto out;
+	} else if ((error = packed_reload(backend)) < 0 ||
+		   (error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0) {
 		goto out;
+	}
 
 	iter->parent.next = refdb_fs_backend__iterator_next;
 	iter->parent.next_name = refdb_fs_backend__iterator_next_name;
@@ -1052,6 +1502,8 @@ static int packed_write(refdb_fs_backend *backend)
 	if (backend->fsync)
 		open_flags = GIT_FILEBUF_FSYNC;
 
+	packed_map_drop(backend);
+
 	/* Open the file! */
 	if ((error = git_filebuf_open(&pack_file, git_sortedcache_path(refcache), open_flags, GIT_PACKEDREFS_FILE_MODE)) < 0)
 		goto fail;
@@ -1530,6 +1982,8 @@ static void refdb_fs_backend__free(git_refdb_backend *_backend)
 	assert(backend);
 
 	git_sortedcache_free(backend->refcache);
+	packed_map_free(backend->packed_map);
+	git_mutex_free(&backend->packed_map_lock);
 	git__free(backend->gitpath);
 	git__free(backend->commonpath);
 	git__free(backend);
@@ -2126,6 +2580,13 @@ int git_refdb_backend_fs(
 		backend->fsync = 1;
 	backend->iterator_flags |= GIT_ITERATOR_DESCEND_SYMLINKS;
 
+	if (git_mutex_init(&backend->packed_map_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize packed references lock");
+		goto fail;
+	}
+
+	backend->packed_mmap = git_refdb_fs__packed_refs_mmap;
+
 	backend->parent.exists = &refdb_fs_backend__exists;
 	backend->parent.lookup = &refdb_fs_backend__lookup;
 	backend->parent.iterator = &refdb_fs_backend__iterator;
@@ -16,4 +16,7 @@ typedef struct {
 	time_t packfile_time;
 } git_refcache;
 
+/* Whether new filesystem backends read packed-refs through a mapping */
+extern bool git_refdb_fs__packed_refs_mmap;
+
 #endif
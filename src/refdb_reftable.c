@@ -0,0 +1,2532 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "refdb_reftable.h"
+
+#include "config.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "pool.h"
+#include "refdb.h"
+#include "reflog.h"
+#include "refs.h"
+#include "reftable.h"
+#include "repository.h"
+#include "strmap.h"
+
+#include <git2/refdb.h>
+#include <git2/sys/refdb_backend.h>
+#include <git2/sys/refs.h>
+#include <git2/sys/reflog.h>
+
+#define GIT_REFTABLE_DIR_MODE 0777
+#define GIT_REFTABLE_FILE_MODE 0666
+
+/*
+ * The references live in a stack of tables in `<commondir>/reftable`,
+ * whose names `tables.list` lists from the oldest to the newest.  Every
+ * change adds a table on top of the stack, and a table of the stack
+ * shadows the ones below it.  The tables are compacted as they are added,
+ * so that each is at least a few times as large as the ones above it, and
+ * the stack stays short.
+ */
+typedef struct {
+	git_atomic refcount;
+	git_vector tables;
+	uint64_t next_update_index;
+} reftable_stack;
+
+/*
+ * The changes that go into a new table.  The reflog entries that are
+ * added get their update index when the table is written.
+ */
+typedef struct {
+	git_pool pool;
+	git_vector refs;
+	git_strmap *ref_names;
+	git_vector logs;
+} reftable_update;
+
+typedef struct {
+	git_refdb_backend parent;
+	git_repository *repo;
+
+	char *dir;
+	char *list_path;
+	git_reftable_writer_options opts;
+	int geometric_factor;
+	int fsync;
+
+	git_mutex lock;
+	reftable_stack *stack;
+	git_futils_filestamp stamp;
+	git_strmap *ensured_logs;
+
+	/* the locks of the references that transactions hold, by name */
+	git_strmap *locked_refs;
+} refdb_reftable;
+
+/*
+ * A transaction keeps its changes in memory, and writes them as one table
+ * when it unlocks the last of its references.  The lock of each reference
+ * points to the transaction; the stack itself is only locked to write.
+ * Other processes don't know about these locks, so each one remembers the
+ * value of its reference, which must not have changed when they are all
+ * written.
+ */
+typedef struct {
+	reftable_update update;
+	git_vector unlocked;
+	size_t locks;
+	bool failed;
+} reftable_transaction;
+
+typedef struct {
+	reftable_transaction *tx;
+	char *name;
+	git_reference *old; /* NULL when the reference did not exist */
+} reftable_ref_lock;
+
+static int ref_error_notfound(const char *name)
+{
+	git_error_set(GIT_ERROR_REFERENCE, "reference '%s' not found", name);
+	return GIT_ENOTFOUND;
+}
+
+/* A reference that a transaction locked is only changed by the transaction */
+static int ref_check_unlocked(refdb_reftable *backend, const char *name)
+{
+	int error = 0;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	if (git_strmap_exists(backend->locked_refs, name)) {
+		git_error_set(GIT_ERROR_REFERENCE, "reference '%s' is locked", name);
+		error = GIT_ELOCKED;
+	}
+
+	git_mutex_unlock(&backend->lock);
+	return error;
+}
+
+/*
+ * The stack
+ */
+
+static void stack_free(reftable_stack *stack)
+{
+	git_reftable *table;
+	size_t i;
+
+	if (!stack || git_atomic_dec(&stack->refcount) > 0)
+		return;
+
+	git_vector_foreach(&stack->tables, i, table)
+		git_reftable_free(table);
+
+	git_vector_free(&stack->tables);
+	git__free(stack);
+}
+
+static const char *table_name(git_reftable *table)
+{
+	const char *path = git_reftable_path(table);
+	const char *slash = strrchr(path, '/');
+
+	return slash ? slash + 1 : path;
+}
+
+static git_reftable *stack_find(reftable_stack *stack, const char *name)
+{
+	git_reftable *table;
+	size_t i;
+
+	if (!stack)
+		return NULL;
+
+	git_vector_foreach(&stack->tables, i, table) {
+		if (strcmp(table_name(table), name) == 0)
+			return table;
+	}
+
+	return NULL;
+}
+
+/* Read the list of tables, reusing those of `current` that are still in it */
+static int stack_read(
+	reftable_stack **out, refdb_reftable *backend, reftable_stack *current)
+{
+	reftable_stack *stack;
+	git_reftable *table;
+	git_buf list = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	char *scan, *name;
+	int error;
+
+	stack = git__calloc(1, sizeof(reftable_stack));
+	GIT_ERROR_CHECK_ALLOC(stack);
+
+	git_atomic_set(&stack->refcount, 1);
+	stack->next_update_index = 1;
+
+	if ((error = git_vector_init(&stack->tables, 8, NULL)) < 0)
+		goto done;
+
+	if ((error = git_futils_readbuffer(&list, backend->list_path)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			git_error_clear();
+			error = 0;
+		}
+
+		goto done;
+	}
+
+	scan = list.ptr;
+
+	while ((name = git__strsep(&scan, "\n")) != NULL) {
+		if (!*name)
+			continue;
+
+		if (*name == '.' || strchr(name, '/') != NULL) {
+			git_error_set(GIT_ERROR_REFERENCE,
+				"invalid table '%s' in '%s'", name, backend->list_path);
+			error = -1;
+			goto done;
+		}
+
+		if ((table = stack_find(current, name)) != NULL) {
+			git_reftable_incref(table);
+		} else if ((error = git_buf_joinpath(&path, backend->dir, name)) < 0 ||
+			   (error = git_reftable_open(&table, path.ptr)) < 0) {
+			goto done;
+		}
+
+		if ((error = git_vector_insert(&stack->tables, table)) < 0) {
+			git_reftable_free(table);
+			goto done;
+		}
+
+		if (git_reftable_max_update_index(table) >= stack->next_update_index)
+			stack->next_update_index = git_reftable_max_update_index(table) + 1;
+	}
+
+done:
+	if (error < 0) {
+		stack_free(stack);
+		stack = NULL;
+	}
+
+	*out = stack;
+	git_buf_dispose(&list);
+	git_buf_dispose(&path);
+	return error;
+}
+
+/*
+ * Reload the stack if its list changed; must be called with the lock held.
+ * A table may go away between reading the list and opening it, when a
+ * compaction replaces it, in which case the new list has to be read.
+ */
+static int stack_refresh_locked(refdb_reftable *backend, bool force)
+{
+	reftable_stack *stack;
+	int changed, error, retries = 0;
+
+	changed = git_futils_filestamp_check(&backend->stamp, backend->list_path);
+
+	if (changed == GIT_ENOTFOUND)
+		git_futils_filestamp_set(&backend->stamp, NULL);
+
+	if (!changed && !force && backend->stack)
+		return 0;
+
+	while ((error = stack_read(&stack, backend, backend->stack)) == GIT_ENOTFOUND &&
+	       retries++ < 5) {
+		git_error_clear();
+		git_futils_filestamp_check(&backend->stamp, backend->list_path);
+	}
+
+	if (error < 0) {
+		git_futils_filestamp_set(&backend->stamp, NULL);
+		return error;
+	}
+
+	stack_free(backend->stack);
+	backend->stack = stack;
+	return 0;
+}
+
+static int stack_refresh(refdb_reftable *backend, bool force)
+{
+	int error;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	error = stack_refresh_locked(backend, force);
+	git_mutex_unlock(&backend->lock);
+
+	return error;
+}
+
+/* Get the current stack, which the caller has to free */
+static int stack_get(reftable_stack **out, refdb_reftable *backend)
+{
+	int error;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	if ((error = stack_refresh_locked(backend, false)) == 0) {
+		git_atomic_inc(&backend->stack->refcount);
+		*out = backend->stack;
+	}
+
+	git_mutex_unlock(&backend->lock);
+	return error;
+}
+
+/* Lock the list of tables, and load the stack as it is */
+static int stack_lock(git_filebuf *lock, refdb_reftable *backend)
+{
+	int error, flags = 0;
+
+	if (backend->fsync)
+		flags |= GIT_FILEBUF_FSYNC;
+
+	if ((error = git_filebuf_open(lock, backend->list_path, flags, GIT_REFTABLE_FILE_MODE)) < 0)
+		return error;
+
+	if ((error = stack_refresh(backend, true)) < 0)
+		git_filebuf_cleanup(lock);
+
+	return error;
+}
+
+/*
+ * Replace the tables from `first` to `last`, excluded, with the one in
+ * `data`, and commit the list.  Adding a table replaces none.
+ */
+static int stack_replace(
+	refdb_reftable *backend,
+	git_filebuf *lock,
+	reftable_stack *stack,
+	size_t first,
+	size_t last,
+	const git_buf *data,
+	uint64_t min_update_index,
+	uint64_t max_update_index)
+{
+	static git_atomic counter;
+	git_buf name = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_reftable *table;
+	size_t i;
+	int error, flags, attempts = 0;
+
+	flags = O_WRONLY | O_CREAT | O_EXCL;
+
+	if (backend->fsync)
+		flags |= O_FSYNC;
+
+	do {
+		uint32_t suffix = (uint32_t)(git__timer() * 1000000.0) ^
+			(uint32_t)git_atomic_inc(&counter) << 20;
+
+		git_buf_clear(&name);
+		git_buf_printf(&name, "0x%012"PRIx64"-0x%012"PRIx64"-%08x.ref",
+			min_update_index, max_update_index, suffix);
+
+		if ((error = git_buf_joinpath(&path, backend->dir, name.ptr)) < 0)
+			goto done;
+
+		error = git_futils_writebuffer(data, path.ptr, flags, GIT_REFTABLE_FILE_MODE);
+	} while (error < 0 && errno == EEXIST && attempts++ < 5);
+
+	if (error < 0)
+		goto done;
+
+	for (i = 0; i < stack->tables.length; i++) {
+		table = git_vector_get(&stack->tables, i);
+
+		if (i == first)
+			git_filebuf_printf(lock, "%s\n", name.ptr);
+
+		if (i < first || i >= last)
+			git_filebuf_printf(lock, "%s\n", table_name(table));
+	}
+
+	if (first == stack->tables.length)
+		git_filebuf_printf(lock, "%s\n", name.ptr);
+
+	if ((error = git_filebuf_commit(lock)) < 0) {
+		p_unlink(path.ptr);
+		goto done;
+	}
+
+	error = stack_refresh(backend, true);
+
+done:
+	git_buf_dispose(&name);
+	git_buf_dispose(&path);
+	return error;
+}
+
+/*
+ * Reading through the stack
+ */
+
+typedef struct {
+	git_reftable_iter iter;
+	bool valid;
+	git_reftable_ref ref;
+	git_reftable_log log;
+} merged_sub;
+
+/*
+ * Reads the records of a range of tables in order, like those of one
+ * table: when tables have records with the same key, the newest wins.
+ */
+typedef struct {
+	merged_sub *subs;
+	size_t count;
+	bool logs;
+	bool keep_deletions;
+	size_t current;
+} merged_iter;
+
+static int merged_init(
+	merged_iter *mi, reftable_stack *stack, size_t first, size_t last, bool logs)
+{
+	size_t i;
+
+	memset(mi, 0, sizeof(merged_iter));
+	mi->logs = logs;
+	mi->count = last - first;
+	mi->current = mi->count;
+
+	if (!mi->count)
+		return 0;
+
+	mi->subs = git__calloc(mi->count, sizeof(merged_sub));
+	GIT_ERROR_CHECK_ALLOC(mi->subs);
+
+	for (i = 0; i < mi->count; i++) {
+		git_buf_init(&mi->subs[i].iter.inflated, 0);
+		git_buf_init(&mi->subs[i].iter.key, 0);
+		git_buf_init(&mi->subs[i].iter.scratch, 0);
+		git_buf_init(&mi->subs[i].iter.value, 0);
+		mi->subs[i].iter.table = git_vector_get(&stack->tables, first + i);
+	}
+
+	return 0;
+}
+
+static void merged_dispose(merged_iter *mi)
+{
+	size_t i;
+
+	for (i = 0; i < mi->count; i++)
+		git_reftable_iter_dispose(&mi->subs[i].iter);
+
+	git__free(mi->subs);
+	mi->subs = NULL;
+	mi->count = 0;
+}
+
+static int sub_advance(merged_iter *mi, merged_sub *sub)
+{
+	int error;
+
+	if (mi->logs)
+		error = git_reftable_next_log(&sub->log, &sub->iter);
+	else
+		error = git_reftable_next_ref(&sub->ref, &sub->iter);
+
+	sub->valid = (error == 0);
+	return error == GIT_ITEROVER ? 0 : error;
+}
+
+static int merged_seek_ref(merged_iter *mi, const char *name)
+{
+	size_t i;
+	int error;
+
+	for (i = 0; i < mi->count; i++) {
+		merged_sub *sub = &mi->subs[i];
+
+		if ((error = git_reftable_seek_ref(&sub->iter, sub->iter.table, name)) < 0 ||
+		    (error = sub_advance(mi, sub)) < 0)
+			return error;
+	}
+
+	mi->current = mi->count;
+	return 0;
+}
+
+static int merged_seek_log(merged_iter *mi, const char *refname, uint64_t update_index)
+{
+	size_t i;
+	int error;
+
+	for (i = 0; i < mi->count; i++) {
+		merged_sub *sub = &mi->subs[i];
+
+		if ((error = git_reftable_seek_log(&sub->iter, sub->iter.table,
+				refname, update_index)) < 0 ||
+		    (error = sub_advance(mi, sub)) < 0)
+			return error;
+	}
+
+	mi->current = mi->count;
+	return 0;
+}
+
+static int sub_cmp(merged_iter *mi, merged_sub *a, merged_sub *b)
+{
+	int cmp;
+
+	if (!mi->logs)
+		return strcmp(a->ref.name, b->ref.name);
+
+	if ((cmp = strcmp(a->log.refname, b->log.refname)) != 0)
+		return cmp;
+
+	/* the newest entries of a reflog come first */
+	return (a->log.update_index < b->log.update_index) -
+		(a->log.update_index > b->log.update_index);
+}
+
+static bool sub_is_deletion(merged_iter *mi, merged_sub *sub)
+{
+	return mi->logs ? sub->log.deletion : sub->ref.type == GIT_REFTABLE_DELETION;
+}
+
+static int merged_next(merged_iter *mi)
+{
+	merged_sub *best, *sub;
+	size_t i;
+	int error;
+
+	if (mi->current < mi->count &&
+	    (error = sub_advance(mi, &mi->subs[mi->current])) < 0)
+		return error;
+
+	mi->current = mi->count;
+
+	while (true) {
+		best = NULL;
+
+		/* go from the newest table, so that it wins the ties */
+		for (i = mi->count; i > 0; i--) {
+			sub = &mi->subs[i - 1];
+
+			if (sub->valid && (!best || sub_cmp(mi, sub, best) < 0))
+				best = sub;
+		}
+
+		if (!best)
+			return GIT_ITEROVER;
+
+		/* skip the records that it shadows */
+		for (i = 0; i < mi->count; i++) {
+			sub = &mi->subs[i];
+
+			if (sub != best && sub->valid && sub_cmp(mi, sub, best) == 0 &&
+			    (error = sub_advance(mi, sub)) < 0)
+				return error;
+		}
+
+		if (mi->keep_deletions || !sub_is_deletion(mi, best)) {
+			mi->current = best - mi->subs;
+			return 0;
+		}
+
+		if ((error = sub_advance(mi, best)) < 0)
+			return error;
+	}
+}
+
+#define merged_ref(mi) (&(mi)->subs[(mi)->current].ref)
+#define merged_log(mi) (&(mi)->subs[(mi)->current].log)
+
+static int ref_from_record(git_reference **out, const git_reftable_ref *rec)
+{
+	switch (rec->type) {
+	case GIT_REFTABLE_VAL1:
+		*out = git_reference__alloc(rec->name, &rec->oid, NULL);
+		break;
+	case GIT_REFTABLE_VAL2:
+		*out = git_reference__alloc(rec->name, &rec->oid, &rec->peel);
+		break;
+	case GIT_REFTABLE_SYMREF:
+		*out = git_reference__alloc_symbolic(rec->name, rec->target);
+		break;
+	default:
+		return ref_error_notfound(rec->name);
+	}
+
+	GIT_ERROR_CHECK_ALLOC(*out);
+	return 0;
+}
+
+/* Look up a reference in the newest table that has it */
+static int stack_lookup(git_reference **out, reftable_stack *stack, const char *name)
+{
+	git_reftable_iter iter = GIT_REFTABLE_ITER_INIT;
+	git_reftable_ref rec;
+	size_t i = stack->tables.length;
+	int error = 0;
+
+	while (i-- > 0) {
+		if ((error = git_reftable_seek_ref(&iter,
+				git_vector_get(&stack->tables, i), name)) < 0)
+			goto done;
+
+		if ((error = git_reftable_next_ref(&rec, &iter)) == GIT_ITEROVER ||
+		    (error == 0 && strcmp(rec.name, name) != 0))
+			continue;
+
+		if (error < 0)
+			goto done;
+
+		if (rec.type == GIT_REFTABLE_DELETION)
+			break;
+
+		error = out ? ref_from_record(out, &rec) : 0;
+		goto done;
+	}
+
+	error = out ? ref_error_notfound(name) : GIT_ENOTFOUND;
+
+done:
+	git_reftable_iter_dispose(&iter);
+	return error;
+}
+
+/* Call `cb` with the live reflog entries of `refname`, from the newest */
+typedef int (*log_cb)(const git_reftable_log *log, void *payload);
+
+static int stack_foreach_log(
+	reftable_stack *stack, const char *refname, log_cb cb, void *payload)
+{
+	merged_iter mi;
+	int error;
+
+	if ((error = merged_init(&mi, stack, 0, stack->tables.length, true)) < 0 ||
+	    (error = merged_seek_log(&mi, refname, UINT64_MAX)) < 0)
+		goto done;
+
+	while ((error = merged_next(&mi)) == 0 &&
+	       strcmp(merged_log(&mi)->refname, refname) == 0) {
+		if ((error = cb(merged_log(&mi), payload)) != 0)
+			goto done;
+	}
+
+	if (error == GIT_ITEROVER || error == 0)
+		error = 0;
+
+done:
+	merged_dispose(&mi);
+	return error;
+}
+
+/*
+ * The changes of a table
+ */
+
+static int update_init(reftable_update *update)
+{
+	memset(update, 0, sizeof(reftable_update));
+	git_pool_init(&update->pool, 1);
+
+	if (git_vector_init(&update->refs, 8, NULL) < 0 ||
+	    git_vector_init(&update->logs, 8, NULL) < 0 ||
+	    git_strmap_new(&update->ref_names) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void update_clear(reftable_update *update)
+{
+	git_vector_free(&update->refs);
+	git_vector_free(&update->logs);
+	git_strmap_free(update->ref_names);
+	git_pool_clear(&update->pool);
+	memset(update, 0, sizeof(reftable_update));
+}
+
+static bool update_empty(reftable_update *update)
+{
+	return !update->refs.length && !update->logs.length;
+}
+
+static int update_ref(
+	reftable_update *update,
+	const char *name,
+	git_reftable_value_t type,
+	const git_oid *oid,
+	const git_oid *peel,
+	const char *target)
+{
+	git_reftable_ref *rec;
+
+	/* a later change of the same reference replaces the earlier one */
+	if ((rec = git_strmap_get(update->ref_names, name)) == NULL) {
+		rec = git_pool_mallocz(&update->pool, sizeof(git_reftable_ref));
+		GIT_ERROR_CHECK_ALLOC(rec);
+
+		rec->name = git_pool_strdup(&update->pool, name);
+		GIT_ERROR_CHECK_ALLOC(rec->name);
+
+		if (git_vector_insert(&update->refs, rec) < 0 ||
+		    git_strmap_set(update->ref_names, rec->name, rec) < 0)
+			return -1;
+	}
+
+	rec->type = type;
+	rec->target = NULL;
+
+	if (oid)
+		git_oid_cpy(&rec->oid, oid);
+	if (peel)
+		git_oid_cpy(&rec->peel, peel);
+
+	if (target) {
+		rec->target = git_pool_strdup(&update->pool, target);
+		GIT_ERROR_CHECK_ALLOC(rec->target);
+	}
+
+	return 0;
+}
+
+static int update_ref_from(reftable_update *update, const git_reference *ref)
+{
+	if (ref->type == GIT_REFERENCE_SYMBOLIC)
+		return update_ref(update, ref->name, GIT_REFTABLE_SYMREF,
+			NULL, NULL, ref->target.symbolic);
+
+	if (git_reference_target_peel(ref))
+		return update_ref(update, ref->name, GIT_REFTABLE_VAL2,
+			&ref->target.oid, &ref->peel, NULL);
+
+	return update_ref(update, ref->name, GIT_REFTABLE_VAL1,
+		&ref->target.oid, NULL, NULL);
+}
+
+static int update_log_deletion(
+	reftable_update *update, const char *refname, uint64_t update_index)
+{
+	git_reftable_log *rec;
+
+	rec = git_pool_mallocz(&update->pool, sizeof(git_reftable_log));
+	GIT_ERROR_CHECK_ALLOC(rec);
+
+	rec->refname = git_pool_strdup(&update->pool, refname);
+	GIT_ERROR_CHECK_ALLOC(rec->refname);
+
+	rec->update_index = update_index;
+	rec->deletion = true;
+
+	return git_vector_insert(&update->logs, rec);
+}
+
+/* Add a reflog entry, which gets its update index with the table */
+static int update_log(
+	reftable_update *update,
+	const char *refname,
+	const git_oid *old_id,
+	const git_oid *new_id,
+	const git_signature *who,
+	const char *message)
+{
+	git_reftable_log *rec;
+
+	rec = git_pool_mallocz(&update->pool, sizeof(git_reftable_log));
+	GIT_ERROR_CHECK_ALLOC(rec);
+
+	rec->refname = git_pool_strdup(&update->pool, refname);
+	rec->name = git_pool_strdup(&update->pool, who->name);
+	rec->email = git_pool_strdup(&update->pool, who->email);
+
+	/* messages end with a newline, which tells an empty one from none */
+	rec->message = message ?
+		git_pool_strcat(&update->pool, message, "\n") :
+		git_pool_strdup(&update->pool, "");
+
+	if (!rec->refname || !rec->name || !rec->email || !rec->message)
+		return -1;
+
+	git_oid_cpy(&rec->old_id, old_id);
+	git_oid_cpy(&rec->new_id, new_id);
+	rec->time = who->when.time > 0 ? (uint64_t)who->when.time : 0;
+	rec->tz_offset = (int16_t)who->when.offset;
+
+	return git_vector_insert(&update->logs, rec);
+}
+
+static int writer_new(
+	git_reftable_writer **out,
+	refdb_reftable *backend,
+	uint64_t min_update_index,
+	uint64_t max_update_index)
+{
+	git_reftable_writer_options opts;
+
+	memcpy(&opts, &backend->opts, sizeof(opts));
+	opts.min_update_index = min_update_index;
+	opts.max_update_index = max_update_index;
+
+	return git_reftable_writer_new(out, &opts);
+}
+
+/*
+ * Compact the tables from `first` to `last`, excluded.  When they go down
+ * to the oldest table, there is nothing left for deletions to hide.
+ */
+static int stack_compact_range(
+	refdb_reftable *backend,
+	git_filebuf *lock,
+	reftable_stack *stack,
+	size_t first,
+	size_t last)
+{
+	git_reftable_writer *writer = NULL;
+	git_buf data = GIT_BUF_INIT;
+	git_vector old_paths = GIT_VECTOR_INIT;
+	merged_iter mi = { 0 };
+	uint64_t min, max;
+	char *path;
+	size_t i;
+	int error;
+
+	min = git_reftable_min_update_index(git_vector_get(&stack->tables, first));
+	max = git_reftable_max_update_index(git_vector_get(&stack->tables, last - 1));
+
+	if ((error = writer_new(&writer, backend, min, max)) < 0 ||
+	    (error = merged_init(&mi, stack, first, last, false)) < 0)
+		goto done;
+
+	mi.keep_deletions = (first > 0);
+
+	if ((error = merged_seek_ref(&mi, "")) < 0)
+		goto done;
+
+	while ((error = merged_next(&mi)) == 0) {
+		if ((error = git_reftable_writer_add_ref(writer, merged_ref(&mi))) < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	merged_dispose(&mi);
+
+	if ((error = merged_init(&mi, stack, first, last, true)) < 0)
+		goto done;
+
+	mi.keep_deletions = (first > 0);
+
+	if ((error = merged_seek_log(&mi, "", UINT64_MAX)) < 0)
+		goto done;
+
+	while ((error = merged_next(&mi)) == 0) {
+		if ((error = git_reftable_writer_add_log(writer, merged_log(&mi))) < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER ||
+	    (error = git_reftable_writer_finish(&data, writer)) < 0)
+		goto done;
+
+	for (i = first; i < last; i++) {
+		path = git__strdup(git_reftable_path(git_vector_get(&stack->tables, i)));
+
+		if (!path || (error = git_vector_insert(&old_paths, path)) < 0) {
+			error = -1;
+			git__free(path);
+			goto done;
+		}
+	}
+
+	if ((error = stack_replace(backend, lock, stack, first, last, &data, min, max)) < 0)
+		goto done;
+
+	/* readers that still have them mapped keep them until they are done */
+	git_vector_foreach(&old_paths, i, path)
+		p_unlink(path);
+
+done:
+	merged_dispose(&mi);
+	git_reftable_writer_free(writer);
+	git_vector_free_deep(&old_paths);
+	git_buf_dispose(&data);
+	return error;
+}
+
+/*
+ * Keep the stack geometric: going from the newest table, merge the tables
+ * that are not `geometric_factor` times as large as those above them.
+ */
+static int stack_auto_compact(refdb_reftable *backend)
+{
+	git_filebuf lock = GIT_FILEBUF_INIT;
+	reftable_stack *stack = NULL;
+	size_t first, count;
+	uint64_t size;
+	int error;
+
+	/* somebody else is writing, and will compact when they are done */
+	if ((error = stack_lock(&lock, backend)) == GIT_ELOCKED) {
+		git_error_clear();
+		return 0;
+	}
+
+	if (error < 0 || (error = stack_get(&stack, backend)) < 0)
+		goto done;
+
+	if ((count = stack->tables.length) < 2)
+		goto done;
+
+	first = count - 1;
+	size = git_reftable_size(git_vector_get(&stack->tables, first));
+
+	while (first > 0) {
+		uint64_t older = git_reftable_size(git_vector_get(&stack->tables, first - 1));
+
+		if (older >= size * backend->geometric_factor)
+			break;
+
+		size += older;
+		first--;
+	}
+
+	if (count - first >= 2)
+		error = stack_compact_range(backend, &lock, stack, first, count);
+
+done:
+	git_filebuf_cleanup(&lock);
+	stack_free(stack);
+	return error;
+}
+
+/*
+ * Write the changes as a new table on top of the stack, whose lock the
+ * caller holds.  The reflog entries that are added get update indexes
+ * after that of the references, in the order in which they were added.
+ */
+static int stack_write_update(
+	refdb_reftable *backend, git_filebuf *lock, reftable_update *update)
+{
+	git_reftable_writer *writer = NULL;
+	reftable_stack *stack = NULL;
+	git_strmap *counts = NULL;
+	git_reftable_ref *ref;
+	git_reftable_log *log;
+	git_buf data = GIT_BUF_INIT;
+	uint64_t min, max;
+	size_t i;
+	int error;
+
+	if ((error = stack_get(&stack, backend)) < 0 ||
+	    (error = git_strmap_new(&counts)) < 0)
+		goto done;
+
+	min = max = stack->next_update_index;
+
+	git_vector_foreach(&update->logs, i, log) {
+		uintptr_t count;
+
+		if (log->deletion)
+			continue;
+
+		count = (uintptr_t)git_strmap_get(counts, log->refname);
+
+		if ((error = git_strmap_set(counts, log->refname, (void *)(count + 1))) < 0)
+			goto done;
+
+		log->update_index = min + count;
+		max = max(max, log->update_index);
+	}
+
+	if ((error = writer_new(&writer, backend, min, max)) < 0)
+		goto done;
+
+	git_vector_foreach(&update->refs, i, ref) {
+		ref->update_index = min;
+
+		if ((error = git_reftable_writer_add_ref(writer, ref)) < 0)
+			goto done;
+	}
+
+	git_vector_foreach(&update->logs, i, log) {
+		if ((error = git_reftable_writer_add_log(writer, log)) < 0)
+			goto done;
+	}
+
+	if ((error = git_reftable_writer_finish(&data, writer)) < 0 ||
+	    (error = stack_replace(backend, lock, stack, stack->tables.length,
+			stack->tables.length, &data, min, max)) < 0)
+		goto done;
+
+	error = stack_auto_compact(backend);
+
+done:
+	git_filebuf_cleanup(lock);
+	git_reftable_writer_free(writer);
+	git_strmap_free(counts);
+	git_buf_dispose(&data);
+	stack_free(stack);
+	return error;
+}
+
+/*
+ * References
+ */
+
+static int refdb_reftable__exists(
+	int *exists, git_refdb_backend *_backend, const char *ref_name)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	reftable_stack *stack;
+	int error;
+
+	assert(exists && backend && ref_name);
+
+	*exists = 0;
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	if ((error = stack_lookup(NULL, stack, ref_name)) == 0)
+		*exists = 1;
+	else if (error == GIT_ENOTFOUND)
+		error = 0;
+
+	stack_free(stack);
+	return error;
+}
+
+static int refdb_reftable__lookup(
+	git_reference **out, git_refdb_backend *_backend, const char *ref_name)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	reftable_stack *stack;
+	int error;
+
+	assert(out && backend && ref_name);
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	error = stack_lookup(out, stack, ref_name);
+
+	stack_free(stack);
+	return error;
+}
+
+typedef struct {
+	git_reference_iterator parent;
+
+	char *glob;
+	size_t prefix_len;
+	reftable_stack *stack;
+	merged_iter merged;
+	git_buf name;
+} refdb_reftable_iter;
+
+/* Move to the next reference under `refs/` that matches the glob */
+static int iter_next_record(git_reftable_ref **out, refdb_reftable_iter *iter)
+{
+	git_reftable_ref *rec;
+	int error;
+
+	while ((error = merged_next(&iter->merged)) == 0) {
+		rec = merged_ref(&iter->merged);
+
+		if (iter->prefix_len && strncmp(rec->name, iter->glob, iter->prefix_len) != 0)
+			return GIT_ITEROVER;
+
+		if (git__prefixcmp(rec->name, GIT_REFS_DIR) != 0 ||
+		    (iter->glob && p_fnmatch(iter->glob, rec->name, 0) != 0))
+			continue;
+
+		*out = rec;
+		return 0;
+	}
+
+	return error;
+}
+
+static int refdb_reftable__iterator_next(
+	git_reference **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = GIT_CONTAINER_OF(_iter, refdb_reftable_iter, parent);
+	git_reftable_ref *rec;
+	int error;
+
+	if ((error = iter_next_record(&rec, iter)) < 0)
+		return error;
+
+	return ref_from_record(out, rec);
+}
+
+static int refdb_reftable__iterator_next_name(
+	const char **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = GIT_CONTAINER_OF(_iter, refdb_reftable_iter, parent);
+	git_reftable_ref *rec;
+	int error;
+
+	if ((error = iter_next_record(&rec, iter)) < 0 ||
+	    (error = git_buf_sets(&iter->name, rec->name)) < 0)
+		return error;
+
+	*out = iter->name.ptr;
+	return 0;
+}
+
+static void refdb_reftable__iterator_free(git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = GIT_CONTAINER_OF(_iter, refdb_reftable_iter, parent);
+
+	merged_dispose(&iter->merged);
+	stack_free(iter->stack);
+	git_buf_dispose(&iter->name);
+	git__free(iter->glob);
+	git__free(iter);
+}
+
+static int refdb_reftable__iterator(
+	git_reference_iterator **out, git_refdb_backend *_backend, const char *glob)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	refdb_reftable_iter *iter;
+	git_buf prefix = GIT_BUF_INIT;
+	int error;
+
+	assert(backend);
+
+	iter = git__calloc(1, sizeof(refdb_reftable_iter));
+	GIT_ERROR_CHECK_ALLOC(iter);
+
+	git_buf_init(&iter->name, 0);
+
+	if (glob) {
+		iter->glob = git__strdup(glob);
+		GIT_ERROR_CHECK_ALLOC(iter->glob);
+
+		/* the names that match start with the literal part of the glob */
+		iter->prefix_len = strcspn(glob, "?*[\\");
+	}
+
+	if ((error = stack_get(&iter->stack, backend)) < 0 ||
+	    (error = merged_init(&iter->merged, iter->stack, 0,
+			iter->stack->tables.length, false)) < 0 ||
+	    (glob && (error = git_buf_put(&prefix, glob, iter->prefix_len)) < 0) ||
+	    (error = merged_seek_ref(&iter->merged, prefix.ptr)) < 0)
+		goto done;
+
+	iter->parent.next = refdb_reftable__iterator_next;
+	iter->parent.next_name = refdb_reftable__iterator_next_name;
+	iter->parent.free = refdb_reftable__iterator_free;
+
+	*out = &iter->parent;
+
+done:
+	if (error < 0)
+		refdb_reftable__iterator_free(&iter->parent);
+
+	git_buf_dispose(&prefix);
+	return error;
+}
+
+static bool is_old_ref(const char *old_ref, const char *this_ref)
+{
+	return old_ref && strcmp(old_ref, this_ref) == 0;
+}
+
+/*
+ * Check that `new_ref` does not clash with a reference that is a directory
+ * of it, or with one that it is a directory of.
+ */
+static int reference_path_available(
+	reftable_stack *stack, const char *new_ref, const char *old_ref, int force)
+{
+	merged_iter mi;
+	git_buf path = GIT_BUF_INIT;
+	const char *slash;
+	int error = 0;
+
+	if (!force && (error = stack_lookup(NULL, stack, new_ref)) != GIT_ENOTFOUND) {
+		if (error == 0) {
+			git_error_set(GIT_ERROR_REFERENCE,
+				"failed to write reference '%s': a reference with "
+				"that name already exists.", new_ref);
+			error = GIT_EEXISTS;
+		}
+
+		return error;
+	}
+
+	for (slash = strchr(new_ref, '/'); slash; slash = strchr(slash + 1, '/')) {
+		if ((error = git_buf_set(&path, new_ref, slash - new_ref)) < 0)
+			goto done;
+
+		if ((error = stack_lookup(NULL, stack, path.ptr)) == 0 &&
+		    !is_old_ref(old_ref, path.ptr))
+			goto collision;
+
+		if (error != 0 && error != GIT_ENOTFOUND)
+			goto done;
+	}
+
+	git_buf_clear(&path);
+
+	if ((error = git_buf_printf(&path, "%s/", new_ref)) < 0 ||
+	    (error = merged_init(&mi, stack, 0, stack->tables.length, false)) < 0)
+		goto done;
+
+	if ((error = merged_seek_ref(&mi, path.ptr)) == 0) {
+		while ((error = merged_next(&mi)) == 0 &&
+		       git__prefixcmp(merged_ref(&mi)->name, path.ptr) == 0) {
+			if (!is_old_ref(old_ref, merged_ref(&mi)->name)) {
+				merged_dispose(&mi);
+				goto collision;
+			}
+		}
+
+		if (error == GIT_ITEROVER || error == 0)
+			error = 0;
+	}
+
+	merged_dispose(&mi);
+	goto done;
+
+collision:
+	git_error_set(GIT_ERROR_REFERENCE,
+		"path to reference '%s' collides with existing one", new_ref);
+	error = -1;
+
+done:
+	git_buf_dispose(&path);
+	return error;
+}
+
+static int cmp_old_ref(int *cmp, reftable_stack *stack, const char *name,
+	const git_oid *old_id, const char *old_target)
+{
+	int error = 0;
+	git_reference *old_ref = NULL;
+
+	*cmp = 0;
+	/* It "matches" if there is no old value to compare against */
+	if (!old_id && !old_target)
+		return 0;
+
+	if ((error = stack_lookup(&old_ref, stack, name)) < 0)
+		goto out;
+
+	/* If the types don't match, there's no way the values do */
+	if (old_id && old_ref->type != GIT_REFERENCE_DIRECT) {
+		*cmp = -1;
+		goto out;
+	}
+	if (old_target && old_ref->type != GIT_REFERENCE_SYMBOLIC) {
+		*cmp = 1;
+		goto out;
+	}
+
+	if (old_id && old_ref->type == GIT_REFERENCE_DIRECT)
+		*cmp = git_oid_cmp(old_id, &old_ref->target.oid);
+
+	if (old_target && old_ref->type == GIT_REFERENCE_SYMBOLIC)
+		*cmp = git__strcmp(old_target, old_ref->target.symbolic);
+
+out:
+	git_reference_free(old_ref);
+
+	return error;
+}
+
+static int check_old_ref(reftable_stack *stack, const char *name,
+	const git_oid *old_id, const char *old_target)
+{
+	int error, cmp;
+
+	if ((error = cmp_old_ref(&cmp, stack, name, old_id, old_target)) < 0)
+		return error;
+
+	if (cmp) {
+		git_error_set(GIT_ERROR_REFERENCE, "old reference value does not match");
+		return GIT_EMODIFIED;
+	}
+
+	return 0;
+}
+
+/*
+ * Reflogs
+ */
+
+static int has_log_cb(const git_reftable_log *log, void *payload)
+{
+	GIT_UNUSED(log);
+	GIT_UNUSED(payload);
+
+	return 1;
+}
+
+static int has_reflog(refdb_reftable *backend, reftable_stack *stack, const char *name)
+{
+	int error;
+
+	if ((error = stack_foreach_log(stack, name, has_log_cb, NULL)) != 0)
+		return error;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	error = git_strmap_exists(backend->ensured_logs, name);
+	git_mutex_unlock(&backend->lock);
+
+	return error;
+}
+
+static int should_write_reflog(
+	int *write, refdb_reftable *backend, reftable_stack *stack, const char *name)
+{
+	int error, logall, has_log;
+
+	error = git_repository__cvar(&logall, backend->repo, GIT_CVAR_LOGALLREFUPDATES);
+	if (error < 0)
+		return error;
+
+	/* Defaults to the opposite of the repo being bare */
+	if (logall == GIT_LOGALLREFUPDATES_UNSET)
+		logall = !git_repository_is_bare(backend->repo);
+
+	*write = 0;
+	switch (logall) {
+	case GIT_LOGALLREFUPDATES_FALSE:
+		*write = 0;
+		break;
+
+	case GIT_LOGALLREFUPDATES_TRUE:
+		if ((has_log = has_reflog(backend, stack, name)) < 0)
+			return has_log;
+
+		/* Only write if it already has a log,
+		 * or if it's under heads/, remotes/ or notes/
+		 */
+		*write = has_log ||
+			!git__prefixcmp(name, GIT_REFS_HEADS_DIR) ||
+			!git__strcmp(name, GIT_HEAD_FILE) ||
+			!git__prefixcmp(name, GIT_REFS_REMOTES_DIR) ||
+			!git__prefixcmp(name, GIT_REFS_NOTES_DIR);
+		break;
+
+	case GIT_LOGALLREFUPDATES_ALWAYS:
+		*write = 1;
+		break;
+	}
+
+	return 0;
+}
+
+/* Add an entry to the reflog of `ref`, the way the files backend would */
+static int reflog_append(
+	refdb_reftable *backend,
+	reftable_update *update,
+	const git_reference *ref,
+	const git_oid *old,
+	const git_oid *new,
+	const git_signature *who,
+	const char *message)
+{
+	int error, is_symbolic;
+	git_oid old_id = {{0}}, new_id = {{0}};
+	git_repository *repo = backend->repo;
+
+	is_symbolic = ref->type == GIT_REFERENCE_SYMBOLIC;
+
+	/* "normal" symbolic updates do not write */
+	if (is_symbolic &&
+	    strcmp(ref->name, GIT_HEAD_FILE) &&
+	    !(old && new))
+		return 0;
+
+	if (old) {
+		git_oid_cpy(&old_id, old);
+	} else {
+		error = git_reference_name_to_id(&old_id, repo, ref->name);
+		if (error < 0 && error != GIT_ENOTFOUND)
+			return error;
+	}
+
+	if (new) {
+		git_oid_cpy(&new_id, new);
+	} else {
+		if (!is_symbolic) {
+			git_oid_cpy(&new_id, git_reference_target(ref));
+		} else {
+			error = git_reference_name_to_id(&new_id, repo, git_reference_symbolic_target(ref));
+			if (error < 0 && error != GIT_ENOTFOUND)
+				return error;
+			/* detaching HEAD does not create an entry */
+			if (error == GIT_ENOTFOUND)
+				return 0;
+
+			git_error_clear();
+		}
+	}
+
+	git_error_clear();
+	return update_log(update, ref->name, &old_id, &new_id, who, message);
+}
+
+/*
+ * When a branch that HEAD points to is updated directly, the HEAD reflog
+ * is updated as well; see `maybe_append_head` in the files backend.
+ */
+static int maybe_append_head(
+	refdb_reftable *backend,
+	reftable_update *update,
+	const git_reference *ref,
+	const git_signature *who,
+	const char *message)
+{
+	int error;
+	git_oid old_id;
+	git_reference *tmp = NULL, *head = NULL, *peeled = NULL;
+	const char *name;
+
+	if (ref->type == GIT_REFERENCE_SYMBOLIC)
+		return 0;
+
+	/* if we can't resolve, we use {0}*40 as old id */
+	if (git_reference_name_to_id(&old_id, backend->repo, ref->name) < 0)
+		memset(&old_id, 0, sizeof(old_id));
+
+	if ((error = git_reference_lookup(&head, backend->repo, GIT_HEAD_FILE)) < 0)
+		return error;
+
+	if (git_reference_type(head) == GIT_REFERENCE_DIRECT)
+		goto cleanup;
+
+	if ((error = git_reference_lookup(&tmp, backend->repo, GIT_HEAD_FILE)) < 0)
+		goto cleanup;
+
+	/* Go down the symref chain until we find the branch */
+	while (git_reference_type(tmp) == GIT_REFERENCE_SYMBOLIC) {
+		error = git_reference_lookup(&peeled, backend->repo, git_reference_symbolic_target(tmp));
+		if (error < 0)
+			break;
+
+		git_reference_free(tmp);
+		tmp = peeled;
+	}
+
+	if (error == GIT_ENOTFOUND) {
+		error = 0;
+		name = git_reference_symbolic_target(tmp);
+	} else if (error < 0) {
+		goto cleanup;
+	} else {
+		name = git_reference_name(tmp);
+	}
+
+	if (strcmp(name, ref->name))
+		goto cleanup;
+
+	error = reflog_append(backend, update, head, &old_id, git_reference_target(ref), who, message);
+
+cleanup:
+	git_reference_free(tmp);
+	git_reference_free(head);
+	return error;
+}
+
+static int delete_log_cb(const git_reftable_log *log, void *payload)
+{
+	return update_log_deletion(payload, log->refname, log->update_index);
+}
+
+/* Hide the reflog entries of `name` */
+static int update_delete_reflog(
+	reftable_update *update, reftable_stack *stack, const char *name)
+{
+	return stack_foreach_log(stack, name, delete_log_cb, update);
+}
+
+static int stage_write(
+	refdb_reftable *backend,
+	reftable_update *update,
+	reftable_stack *stack,
+	const git_reference *ref,
+	int update_reflog,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	int error = 0, cmp = 0, should_write;
+	const char *new_target = NULL;
+	const git_oid *new_id = NULL;
+
+	if ((error = check_old_ref(stack, ref->name, old_id, old_target)) < 0)
+		return error;
+
+	if (ref->type == GIT_REFERENCE_SYMBOLIC)
+		new_target = ref->target.symbolic;
+	else
+		new_id = &ref->target.oid;
+
+	error = cmp_old_ref(&cmp, stack, ref->name, new_id, new_target);
+	if (error < 0 && error != GIT_ENOTFOUND)
+		return error;
+
+	/* Don't update if we have the same value */
+	if (!error && !cmp)
+		return 0;
+
+	git_error_clear();
+
+	if (update_reflog) {
+		if ((error = should_write_reflog(&should_write, backend, stack, ref->name)) < 0)
+			return error;
+
+		if (should_write) {
+			if ((error = reflog_append(backend, update, ref, NULL, NULL, who, message)) < 0)
+				return error;
+			if ((error = maybe_append_head(backend, update, ref, who, message)) < 0)
+				return error;
+		}
+	}
+
+	return update_ref_from(update, ref);
+}
+
+static int refdb_reftable__write(
+	git_refdb_backend *_backend,
+	const git_reference *ref,
+	int force,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	git_filebuf lock = GIT_FILEBUF_INIT;
+	reftable_stack *stack = NULL;
+	reftable_update update;
+	int error;
+
+	assert(backend && ref);
+
+	if ((error = update_init(&update)) < 0 ||
+	    (error = ref_check_unlocked(backend, ref->name)) < 0 ||
+	    (error = stack_lock(&lock, backend)) < 0 ||
+	    (error = stack_get(&stack, backend)) < 0)
+		goto done;
+
+	if ((error = reference_path_available(stack, ref->name, NULL, force)) < 0 ||
+	    (error = stage_write(backend, &update, stack, ref, true,
+			who, message, old_id, old_target)) < 0)
+		goto done;
+
+	if (!update_empty(&update))
+		error = stack_write_update(backend, &lock, &update);
+
+done:
+	git_filebuf_cleanup(&lock);
+	update_clear(&update);
+	stack_free(stack);
+	return error;
+}
+
+static int refdb_reftable__delete(
+	git_refdb_backend *_backend,
+	const char *ref_name,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	git_filebuf lock = GIT_FILEBUF_INIT;
+	reftable_stack *stack = NULL;
+	reftable_update update;
+	int error;
+
+	assert(backend && ref_name);
+
+	if ((error = update_init(&update)) < 0 ||
+	    (error = ref_check_unlocked(backend, ref_name)) < 0 ||
+	    (error = stack_lock(&lock, backend)) < 0 ||
+	    (error = stack_get(&stack, backend)) < 0)
+		goto done;
+
+	if ((error = check_old_ref(stack, ref_name, old_id, old_target)) < 0 ||
+	    (error = stack_lookup(NULL, stack, ref_name)) < 0) {
+		if (error == GIT_ENOTFOUND)
+			ref_error_notfound(ref_name);
+		goto done;
+	}
+
+	if ((error = update_ref(&update, ref_name, GIT_REFTABLE_DELETION, NULL, NULL, NULL)) < 0 ||
+	    (error = update_delete_reflog(&update, stack, ref_name)) < 0 ||
+	    (error = stack_write_update(backend, &lock, &update)) < 0)
+		goto done;
+
+done:
+	git_filebuf_cleanup(&lock);
+	update_clear(&update);
+	stack_free(stack);
+	return error;
+}
+
+/* Move the reflog of `old_name`, if there is one */
+static int update_rename_reflog(
+	reftable_update *update,
+	reftable_stack *stack,
+	const char *old_name,
+	const char *new_name,
+	bool *found)
+{
+	git_vector entries = GIT_VECTOR_INIT;
+	git_reftable_log *copy, *log;
+	merged_iter mi;
+	size_t i;
+	int error;
+
+	*found = false;
+
+	if ((error = merged_init(&mi, stack, 0, stack->tables.length, true)) < 0 ||
+	    (error = merged_seek_log(&mi, old_name, UINT64_MAX)) < 0)
+		goto done;
+
+	while ((error = merged_next(&mi)) == 0 &&
+	       strcmp(merged_log(&mi)->refname, old_name) == 0) {
+		log = merged_log(&mi);
+
+		if ((error = update_log_deletion(update, old_name, log->update_index)) < 0)
+			goto done;
+
+		if ((copy = git_pool_mallocz(&update->pool, sizeof(git_reftable_log))) == NULL ||
+		    (copy->refname = git_pool_strdup(&update->pool, new_name)) == NULL ||
+		    (copy->name = git_pool_strdup(&update->pool, log->name)) == NULL ||
+		    (copy->email = git_pool_strdup(&update->pool, log->email)) == NULL ||
+		    (copy->message = git_pool_strdup(&update->pool, log->message)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		git_oid_cpy(&copy->old_id, &log->old_id);
+		git_oid_cpy(&copy->new_id, &log->new_id);
+		copy->time = log->time;
+		copy->tz_offset = log->tz_offset;
+
+		if ((error = git_vector_insert(&entries, copy)) < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER && error != 0)
+		goto done;
+
+	error = 0;
+	*found = (entries.length > 0);
+
+	/* the entries come from the newest, but go in from the oldest */
+	for (i = entries.length; i > 0 && !error; i--)
+		error = git_vector_insert(&update->logs, git_vector_get(&entries, i - 1));
+
+done:
+	git_vector_free(&entries);
+	merged_dispose(&mi);
+	return error;
+}
+
+static int refdb_reftable__rename(
+	git_reference **out,
+	git_refdb_backend *_backend,
+	const char *old_name,
+	const char *new_name,
+	int force,
+	const git_signature *who,
+	const char *message)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	git_filebuf lock = GIT_FILEBUF_INIT;
+	reftable_stack *stack = NULL;
+	reftable_update update;
+	git_reference *old = NULL, *new = NULL;
+	bool found;
+	int error;
+
+	assert(backend && old_name && new_name);
+
+	if ((error = update_init(&update)) < 0 ||
+	    (error = ref_check_unlocked(backend, old_name)) < 0 ||
+	    (error = ref_check_unlocked(backend, new_name)) < 0 ||
+	    (error = stack_lock(&lock, backend)) < 0 ||
+	    (error = stack_get(&stack, backend)) < 0)
+		goto done;
+
+	if ((error = reference_path_available(stack, new_name, old_name, force)) < 0 ||
+	    (error = stack_lookup(&old, stack, old_name)) < 0)
+		goto done;
+
+	if ((new = git_reference__set_name(old, new_name)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	old = NULL;
+
+	if ((error = update_ref(&update, old_name, GIT_REFTABLE_DELETION, NULL, NULL, NULL)) < 0 ||
+	    (error = update_ref_from(&update, new)) < 0 ||
+	    (error = update_delete_reflog(&update, stack, new_name)) < 0 ||
+	    (error = update_rename_reflog(&update, stack, old_name, new_name, &found)) < 0 ||
+	    (error = reflog_append(backend, &update, new,
+			git_reference_target(new), NULL, who, message)) < 0 ||
+	    (error = stack_write_update(backend, &lock, &update)) < 0)
+		goto done;
+
+	if (out) {
+		*out = new;
+		new = NULL;
+	}
+
+done:
+	git_filebuf_cleanup(&lock);
+	update_clear(&update);
+	stack_free(stack);
+	git_reference_free(old);
+	git_reference_free(new);
+	return error;
+}
+
+static int refdb_reftable__compress(git_refdb_backend *_backend)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	git_filebuf lock = GIT_FILEBUF_INIT;
+	reftable_stack *stack = NULL;
+	int error;
+
+	assert(backend);
+
+	if ((error = stack_lock(&lock, backend)) < 0 ||
+	    (error = stack_get(&stack, backend)) < 0)
+		goto done;
+
+	if (stack->tables.length > 1)
+		error = stack_compact_range(backend, &lock, stack, 0, stack->tables.length);
+
+done:
+	git_filebuf_cleanup(&lock);
+	stack_free(stack);
+	return error;
+}
+
+/*
+ * Transactions
+ */
+
+/*
+ * The payload that comes in is the lock of another reference of the same
+ * transaction, if it has one, which this one joins.
+ */
+static int refdb_reftable__lock(void **out, git_refdb_backend *_backend, const char *refname)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	reftable_ref_lock *other = *out, *lock = NULL;
+	reftable_transaction *tx = other ? other->tx : NULL;
+	reftable_stack *stack;
+	git_reference *old = NULL;
+	int error;
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	if ((error = stack_lookup(&old, stack, refname)) == GIT_ENOTFOUND) {
+		git_error_clear();
+		error = 0;
+	}
+
+	stack_free(stack);
+
+	if (error < 0)
+		return error;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		git_reference_free(old);
+		return -1;
+	}
+
+	if (git_strmap_exists(backend->locked_refs, refname)) {
+		git_error_set(GIT_ERROR_REFERENCE, "reference '%s' is already locked", refname);
+		error = GIT_ELOCKED;
+		goto done;
+	}
+
+	if ((lock = git__calloc(1, sizeof(reftable_ref_lock))) == NULL ||
+	    (lock->name = git__strdup(refname)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	if (!tx) {
+		if ((tx = git__calloc(1, sizeof(reftable_transaction))) == NULL ||
+		    (error = update_init(&tx->update)) < 0 ||
+		    (error = git_vector_init(&tx->unlocked, 0, NULL)) < 0) {
+			error = -1;
+			goto done;
+		}
+	}
+
+	if ((error = git_strmap_set(backend->locked_refs, lock->name, lock)) < 0)
+		goto done;
+
+	lock->tx = tx;
+	lock->old = old;
+	old = NULL;
+	tx->locks++;
+
+	*out = lock;
+
+done:
+	git_mutex_unlock(&backend->lock);
+
+	if (error < 0) {
+		if (tx && !other) {
+			update_clear(&tx->update);
+			git_vector_free(&tx->unlocked);
+			git__free(tx);
+		}
+
+		if (lock)
+			git__free(lock->name);
+
+		git__free(lock);
+	}
+
+	git_reference_free(old);
+	return error;
+}
+
+static void ref_lock_free(reftable_ref_lock *lock)
+{
+	git_reference_free(lock->old);
+	git__free(lock->name);
+	git__free(lock);
+}
+
+/*
+ * Check that the references of the transaction still have the values
+ * that they had when they were locked; the caller holds the lock of the
+ * list of tables, and has loaded the stack under it.
+ */
+static int check_unchanged(refdb_reftable *backend, reftable_transaction *tx)
+{
+	reftable_ref_lock *lock;
+	reftable_stack *stack;
+	git_reference *ref;
+	size_t i;
+	int error = 0, changed;
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	git_vector_foreach(&tx->unlocked, i, lock) {
+		if ((error = stack_lookup(&ref, stack, lock->name)) == GIT_ENOTFOUND) {
+			git_error_clear();
+			ref = NULL;
+			error = 0;
+		} else if (error < 0) {
+			break;
+		}
+
+		if (ref && lock->old)
+			changed = git_reference_cmp(ref, lock->old) != 0;
+		else
+			changed = ref != lock->old;
+
+		git_reference_free(ref);
+
+		if (changed) {
+			git_error_set(GIT_ERROR_REFERENCE,
+				"reference '%s' changed since it was locked", lock->name);
+			error = GIT_EMODIFIED;
+			break;
+		}
+	}
+
+	stack_free(stack);
+	return error;
+}
+
+static int stage_delete(reftable_update *update, reftable_stack *stack, const char *name)
+{
+	int error;
+
+	if ((error = stack_lookup(NULL, stack, name)) < 0) {
+		if (error == GIT_ENOTFOUND)
+			ref_error_notfound(name);
+		return error;
+	}
+
+	return update_ref(update, name, GIT_REFTABLE_DELETION, NULL, NULL, NULL);
+}
+
+static int refdb_reftable__unlock(git_refdb_backend *_backend, void *payload, int success, int update_reflog,
+				  const git_reference *ref, const git_signature *sig, const char *message)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	reftable_ref_lock *lock = payload;
+	reftable_transaction *tx = lock->tx;
+	git_filebuf list_lock = GIT_FILEBUF_INIT;
+	reftable_stack *stack = NULL;
+	size_t i;
+	int error = 0;
+
+	if (success && !tx->failed) {
+		if ((error = stack_get(&stack, backend)) == 0) {
+			if (success == 2)
+				error = stage_delete(&tx->update, stack, ref->name);
+			else
+				error = stage_write(backend, &tx->update, stack, ref,
+					update_reflog, sig, message, NULL, NULL);
+		}
+
+		tx->failed = (error < 0);
+		stack_free(stack);
+	}
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	git_strmap_delete(backend->locked_refs, lock->name);
+	git_mutex_unlock(&backend->lock);
+
+	/* keep what it was locked at, to check when the transaction is written */
+	if (git_vector_insert(&tx->unlocked, lock) < 0) {
+		ref_lock_free(lock);
+		tx->failed = true;
+		error = -1;
+	}
+
+	/* the last reference of the transaction writes them all out */
+	if (--tx->locks == 0) {
+		if (!tx->failed && !update_empty(&tx->update) &&
+		    (error = stack_lock(&list_lock, backend)) == 0 &&
+		    (error = check_unchanged(backend, tx)) == 0)
+			error = stack_write_update(backend, &list_lock, &tx->update);
+
+		git_vector_foreach(&tx->unlocked, i, lock)
+			ref_lock_free(lock);
+
+		git_filebuf_cleanup(&list_lock);
+		git_vector_free(&tx->unlocked);
+		update_clear(&tx->update);
+		git__free(tx);
+	}
+
+	return error;
+}
+
+/*
+ * Reflog access
+ */
+
+static int refdb_reftable__has_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	reftable_stack *stack;
+	int error;
+
+	assert(backend && name);
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	error = has_reflog(backend, stack, name);
+
+	stack_free(stack);
+	return error;
+}
+
+/*
+ * A reftable has no empty reflogs: remember that this one exists until the
+ * first entry goes in.
+ */
+static int refdb_reftable__ensure_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	char *dup;
+	int error = 0;
+
+	assert(backend && name);
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	if (!git_strmap_exists(backend->ensured_logs, name)) {
+		if ((dup = git__strdup(name)) == NULL ||
+		    (error = git_strmap_set(backend->ensured_logs, dup, dup)) < 0) {
+			git__free(dup);
+			error = -1;
+		}
+	}
+
+	git_mutex_unlock(&backend->lock);
+	return error;
+}
+
+static int read_log_cb(const git_reftable_log *log, void *payload)
+{
+	git_reflog *reflog = payload;
+	git_reflog_entry *entry;
+	git_signature *sig;
+	size_t len = strlen(log->message);
+
+	entry = git__calloc(1, sizeof(git_reflog_entry));
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	entry->committer = sig = git__calloc(1, sizeof(git_signature));
+
+	if (!sig ||
+	    (sig->name = git__strdup(log->name)) == NULL ||
+	    (sig->email = git__strdup(log->email)) == NULL)
+		goto on_error;
+
+	sig->when.time = (git_time_t)log->time;
+	sig->when.offset = log->tz_offset;
+	sig->when.sign = log->tz_offset < 0 ? '-' : '+';
+
+	git_oid_cpy(&entry->oid_old, &log->old_id);
+	git_oid_cpy(&entry->oid_cur, &log->new_id);
+
+	if (len && (entry->msg = git__strndup(log->message,
+			log->message[len - 1] == '\n' ? len - 1 : len)) == NULL)
+		goto on_error;
+
+	if (git_vector_insert(&reflog->entries, entry) < 0)
+		goto on_error;
+
+	return 0;
+
+on_error:
+	git_reflog_entry__free(entry);
+	return -1;
+}
+
+static int refdb_reftable__reflog_read(git_reflog **out, git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	reftable_stack *stack = NULL;
+	git_reflog *log;
+	int error;
+
+	assert(out && backend && name);
+
+	log = git__calloc(1, sizeof(git_reflog));
+	GIT_ERROR_CHECK_ALLOC(log);
+
+	if ((log->ref_name = git__strdup(name)) == NULL ||
+	    git_vector_init(&log->entries, 0, NULL) < 0) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = stack_get(&stack, backend)) < 0 ||
+	    (error = stack_foreach_log(stack, name, read_log_cb, log)) < 0)
+		goto done;
+
+	/* the reflog keeps its entries from the oldest */
+	git_vector_reverse(&log->entries);
+
+	*out = log;
+
+done:
+	if (error < 0)
+		git_reflog_free(log);
+
+	stack_free(stack);
+	return error;
+}
+
+/* Stage the changes against the stack as it is, and write them */
+static int stage_and_write(
+	refdb_reftable *backend,
+	int (*stage)(refdb_reftable *backend, reftable_update *update, reftable_stack *stack, void *payload),
+	void *payload)
+{
+	git_filebuf lock = GIT_FILEBUF_INIT;
+	reftable_stack *stack = NULL;
+	reftable_update update;
+	int error;
+
+	if ((error = update_init(&update)) < 0 ||
+	    (error = stack_lock(&lock, backend)) < 0 ||
+	    (error = stack_get(&stack, backend)) < 0 ||
+	    (error = stage(backend, &update, stack, payload)) < 0)
+		goto done;
+
+	if (!update_empty(&update))
+		error = stack_write_update(backend, &lock, &update);
+
+done:
+	git_filebuf_cleanup(&lock);
+	update_clear(&update);
+	stack_free(stack);
+	return error;
+}
+
+static int stage_reflog_write(
+	refdb_reftable *backend, reftable_update *update, reftable_stack *stack, void *payload)
+{
+	git_reflog *reflog = payload;
+	git_reflog_entry *entry;
+	size_t i;
+	int error;
+
+	GIT_UNUSED(backend);
+
+	/* replace the entries that are there with those of the reflog */
+	if ((error = update_delete_reflog(update, stack, reflog->ref_name)) < 0)
+		return error;
+
+	git_vector_foreach(&reflog->entries, i, entry) {
+		if ((error = update_log(update, reflog->ref_name, &entry->oid_old,
+				&entry->oid_cur, entry->committer, entry->msg)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int refdb_reftable__reflog_write(git_refdb_backend *_backend, git_reflog *reflog)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+
+	assert(backend && reflog);
+
+	return stage_and_write(backend, stage_reflog_write, reflog);
+}
+
+typedef struct {
+	const char *old_name;
+	const char *new_name;
+} rename_payload;
+
+static int stage_reflog_rename(
+	refdb_reftable *backend, reftable_update *update, reftable_stack *stack, void *payload)
+{
+	rename_payload *names = payload;
+	bool found;
+	int error;
+
+	if ((error = update_delete_reflog(update, stack, names->new_name)) < 0 ||
+	    (error = update_rename_reflog(update, stack, names->old_name,
+			names->new_name, &found)) < 0)
+		return error;
+
+	if (!found && (error = has_reflog(backend, stack, names->old_name)) <= 0) {
+		if (error < 0)
+			return error;
+
+		git_error_set(GIT_ERROR_REFERENCE,
+			"reflog for '%s' does not exist", names->old_name);
+		return GIT_ENOTFOUND;
+	}
+
+	return 0;
+}
+
+static int refdb_reftable__reflog_rename(git_refdb_backend *_backend, const char *old_name, const char *new_name)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	git_buf normalized = GIT_BUF_INIT;
+	rename_payload names;
+	int error;
+
+	assert(backend && old_name && new_name);
+
+	if ((error = git_reference__normalize_name(
+		&normalized, new_name, GIT_REFERENCE_FORMAT_ALLOW_ONELEVEL)) < 0)
+		return error;
+
+	names.old_name = old_name;
+	names.new_name = normalized.ptr;
+
+	error = stage_and_write(backend, stage_reflog_rename, &names);
+
+	git_buf_dispose(&normalized);
+	return error;
+}
+
+static int stage_reflog_delete(
+	refdb_reftable *backend, reftable_update *update, reftable_stack *stack, void *payload)
+{
+	GIT_UNUSED(backend);
+	return update_delete_reflog(update, stack, payload);
+}
+
+static int refdb_reftable__reflog_delete(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	char *ensured;
+
+	assert(backend && name);
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	if ((ensured = git_strmap_get(backend->ensured_logs, name)) != NULL) {
+		git_strmap_delete(backend->ensured_logs, name);
+		git__free(ensured);
+	}
+
+	git_mutex_unlock(&backend->lock);
+
+	return stage_and_write(backend, stage_reflog_delete, (void *)name);
+}
+
+/*
+ * The object index
+ */
+
+typedef struct {
+	git_strmap *seen;
+	git_vector names;
+} refs_to_data;
+
+static int refs_to_cb(const git_reftable_ref *ref, void *payload)
+{
+	refs_to_data *data = payload;
+	char *name;
+
+	if (git_strmap_exists(data->seen, ref->name))
+		return 0;
+
+	name = git__strdup(ref->name);
+	GIT_ERROR_CHECK_ALLOC(name);
+
+	if (git_vector_insert(&data->names, name) < 0) {
+		git__free(name);
+		return -1;
+	}
+
+	return git_strmap_set(data->seen, name, name);
+}
+
+int git_refdb_reftable__refs_to(
+	git_vector *out, git_refdb_backend *_backend, const git_oid *id)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	refs_to_data data = { NULL, GIT_VECTOR_INIT };
+	reftable_stack *stack = NULL;
+	git_reference *ref;
+	const char *name;
+	char *dup;
+	size_t i;
+	int error;
+
+	assert(out && backend && id);
+
+	if ((error = stack_get(&stack, backend)) < 0 ||
+	    (error = git_strmap_new(&data.seen)) < 0)
+		goto done;
+
+	/* the tables know which names pointed to the object at some point */
+	for (i = 0; i < stack->tables.length; i++) {
+		if ((error = git_reftable_refs_to(git_vector_get(&stack->tables, i),
+				id, refs_to_cb, &data)) < 0)
+			goto done;
+	}
+
+	/* and the stack knows whether they still do */
+	git_vector_foreach(&data.names, i, name) {
+		if ((error = stack_lookup(&ref, stack, name)) == GIT_ENOTFOUND) {
+			git_error_clear();
+			continue;
+		} else if (error < 0) {
+			goto done;
+		}
+
+		if (ref->type == GIT_REFERENCE_DIRECT &&
+		    (git_oid_equal(&ref->target.oid, id) ||
+		     git_oid_equal(&ref->peel, id))) {
+			if ((dup = git__strdup(name)) == NULL ||
+			    (error = git_vector_insert(out, dup)) < 0) {
+				git__free(dup);
+				error = -1;
+			}
+		}
+
+		git_reference_free(ref);
+
+		if (error < 0)
+			goto done;
+	}
+
+	git_vector_set_cmp(out, git__strcmp_cb);
+	git_vector_sort(out);
+	error = 0;
+
+done:
+	git_vector_free_deep(&data.names);
+	git_strmap_free(data.seen);
+	stack_free(stack);
+	return error;
+}
+
+int git_refdb_reftable__table_count(size_t *out, git_refdb_backend *_backend)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	reftable_stack *stack;
+	int error;
+
+	if ((error = stack_get(&stack, backend)) < 0)
+		return error;
+
+	*out = stack->tables.length;
+	stack_free(stack);
+	return 0;
+}
+
+/*
+ * Setup
+ */
+
+static int import_ref(reftable_update *update, git_refdb *db, git_reference *ref)
+{
+	git_reflog *reflog;
+	git_reflog_entry *entry;
+	size_t i;
+	int error;
+
+	if ((error = update_ref_from(update, ref)) < 0 ||
+	    git_refdb_has_log(db, ref->name) != 1)
+		return error;
+
+	if ((error = git_refdb_reflog_read(&reflog, db, ref->name)) < 0)
+		return error;
+
+	git_vector_foreach(&reflog->entries, i, entry) {
+		if ((error = update_log(update, ref->name, &entry->oid_old,
+				&entry->oid_cur, entry->committer, entry->msg)) < 0)
+			break;
+	}
+
+	git_reflog_free(reflog);
+	return error;
+}
+
+/* Copy the references and reflogs of the files backend into a first table */
+static int stack_import(refdb_reftable *backend)
+{
+	git_filebuf lock = GIT_FILEBUF_INIT;
+	git_refdb_backend *files;
+	git_refdb *db = NULL;
+	git_reference_iterator *iter = NULL;
+	git_reference *ref = NULL;
+	reftable_update update;
+	int error;
+
+	if ((error = update_init(&update)) < 0)
+		goto done;
+
+	if ((error = stack_lock(&lock, backend)) < 0) {
+		/* somebody else is creating it */
+		if (error == GIT_ELOCKED) {
+			git_error_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	if (git_path_exists(backend->list_path) ||
+	    (error = git_refdb_new(&db, backend->repo)) < 0 ||
+	    (error = git_refdb_backend_fs(&files, backend->repo)) < 0)
+		goto done;
+
+	if ((error = git_refdb_set_backend(db, files)) < 0) {
+		files->free(files);
+		goto done;
+	}
+
+	if ((error = git_refdb_iterator(&iter, db, NULL)) < 0)
+		goto done;
+
+	while ((error = git_refdb_iterator_next(&ref, iter)) == 0) {
+		error = import_ref(&update, db, ref);
+		git_reference_free(ref);
+
+		if (error < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	if ((error = git_refdb_lookup(&ref, db, GIT_HEAD_FILE)) == 0) {
+		error = import_ref(&update, db, ref);
+		git_reference_free(ref);
+	} else if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+		error = 0;
+	}
+
+	if (error == 0)
+		error = stack_write_update(backend, &lock, &update);
+
+done:
+	git_filebuf_cleanup(&lock);
+	update_clear(&update);
+	git_reference_iterator_free(iter);
+	git_refdb_free(db);
+	return error;
+}
+
+static void refdb_reftable__free(git_refdb_backend *_backend)
+{
+	refdb_reftable *backend = GIT_CONTAINER_OF(_backend, refdb_reftable, parent);
+	char *name;
+
+	if (!backend)
+		return;
+
+	git_strmap_free(backend->locked_refs);
+
+	if (backend->ensured_logs) {
+		git_strmap_foreach_value(backend->ensured_logs, name, { git__free(name); });
+		git_strmap_free(backend->ensured_logs);
+	}
+
+	stack_free(backend->stack);
+	git_mutex_free(&backend->lock);
+	git__free(backend->dir);
+	git__free(backend->list_path);
+	git__free(backend);
+}
+
+static int load_config(refdb_reftable *backend)
+{
+	git_config *config;
+	int block_size, restart_interval, error;
+
+	if ((error = git_repository_config_snapshot(&config, backend->repo)) < 0)
+		return error;
+
+	block_size = git_config__get_int_force(config,
+		"reftable.blocksize", GIT_REFTABLE_BLOCK_SIZE);
+	restart_interval = git_config__get_int_force(config,
+		"reftable.restartinterval", GIT_REFTABLE_RESTART_INTERVAL);
+	backend->opts.index_objects = git_config__get_bool_force(config,
+		"reftable.indexobjects", 1);
+	backend->geometric_factor = git_config__get_int_force(config,
+		"reftable.geometricfactor", GIT_REFTABLE_GEOMETRIC_FACTOR);
+
+	git_config_free(config);
+
+	if (block_size < 256 || block_size > 0xffffff ||
+	    restart_interval < 1 || restart_interval > 0xffff ||
+	    backend->geometric_factor < 2) {
+		git_error_set(GIT_ERROR_CONFIG, "invalid reftable configuration");
+		return -1;
+	}
+
+	backend->opts.block_size = (uint32_t)block_size;
+	backend->opts.restart_interval = (uint16_t)restart_interval;
+
+	return 0;
+}
+
+int git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repository)
+{
+	git_buf path = GIT_BUF_INIT;
+	refdb_reftable *backend;
+	int t = 0;
+
+	assert(backend_out && repository);
+
+	if (repository->namespace) {
+		git_error_set(GIT_ERROR_REFERENCE,
+			"the reftable backend does not support namespaces");
+		return -1;
+	}
+
+	backend = git__calloc(1, sizeof(refdb_reftable));
+	GIT_ERROR_CHECK_ALLOC(backend);
+
+	backend->repo = repository;
+
+	if (git_mutex_init(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize reftable lock");
+		git__free(backend);
+		return -1;
+	}
+
+	if (git_buf_joinpath(&path, repository->commondir, GIT_REFTABLE_DIR) < 0 ||
+	    (backend->dir = git_buf_detach(&path)) == NULL ||
+	    git_buf_joinpath(&path, backend->dir, GIT_REFTABLE_LIST_FILE) < 0 ||
+	    (backend->list_path = git_buf_detach(&path)) == NULL ||
+	    git_strmap_new(&backend->ensured_logs) < 0 ||
+	    git_strmap_new(&backend->locked_refs) < 0 ||
+	    load_config(backend) < 0 ||
+	    git_futils_mkdir(backend->dir, GIT_REFTABLE_DIR_MODE, GIT_MKDIR_PATH) < 0)
+		goto fail;
+
+	if ((!git_repository__cvar(&t, backend->repo, GIT_CVAR_FSYNCOBJECTFILES) && t) ||
+		git_repository__fsync_gitdir)
+		backend->fsync = 1;
+
+	if (!git_path_exists(backend->list_path) && stack_import(backend) < 0)
+		goto fail;
+
+	backend->parent.exists = &refdb_reftable__exists;
+	backend->parent.lookup = &refdb_reftable__lookup;
+	backend->parent.iterator = &refdb_reftable__iterator;
+	backend->parent.write = &refdb_reftable__write;
+	backend->parent.del = &refdb_reftable__delete;
+	backend->parent.rename = &refdb_reftable__rename;
+	backend->parent.compress = &refdb_reftable__compress;
+	backend->parent.lock = &refdb_reftable__lock;
+	backend->parent.unlock = &refdb_reftable__unlock;
+	backend->parent.has_log = &refdb_reftable__has_log;
+	backend->parent.ensure_log = &refdb_reftable__ensure_log;
+	backend->parent.free = &refdb_reftable__free;
+	backend->parent.reflog_read = &refdb_reftable__reflog_read;
+	backend->parent.reflog_write = &refdb_reftable__reflog_write;
+	backend->parent.reflog_rename = &refdb_reftable__reflog_rename;
+	backend->parent.reflog_delete = &refdb_reftable__reflog_delete;
+
+	*backend_out = &backend->parent;
+	return 0;
+
+fail:
+	git_buf_dispose(&path);
+	refdb_reftable__free(&backend->parent);
+	return -1;
+}
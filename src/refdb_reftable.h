@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_refdb_reftable_h__
+#define INCLUDE_refdb_reftable_h__
+
+#include "common.h"
+
+#include "git2/sys/refdb_backend.h"
+#include "vector.h"
+
+#define GIT_REFTABLE_DIR "reftable"
+#define GIT_REFTABLE_LIST_FILE "tables.list"
+#define GIT_REFTABLE_GEOMETRIC_FACTOR 2
+
+/**
+ * Look up the names of the references that point to `id`, directly or
+ * once peeled, through the object index of the tables.  The names are
+ * added to `out` in order, and are owned by the caller.
+ */
+extern int git_refdb_reftable__refs_to(
+	git_vector *out, git_refdb_backend *backend, const git_oid *id);
+
+/** The number of tables in the stack. */
+extern int git_refdb_reftable__table_count(
+	size_t *out, git_refdb_backend *backend);
+
+#endif
@@ -0,0 +1,1717 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "reftable.h"
+
+#include <zlib.h>
+
+#include "array.h"
+#include "fileops.h"
+#include "pool.h"
+#include "varint.h"
+#include "vector.h"
+
+#define REFTABLE_MAGIC "REFT"
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_OBJ 'o'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+/* The size of the type and length that start every block */
+#define BLOCK_HEADER_SIZE 4
+
+#define MAX_BLOCK_LEN 0xffffff
+#define MAX_RESTARTS 0xffff
+
+struct git_reftable {
+	git_atomic refcount;
+	char *path;
+	git_map map;
+	const unsigned char *data;
+	size_t size;
+
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	size_t footer_pos;
+	uint64_t ref_index_pos;
+	uint64_t obj_pos;
+	uint64_t obj_index_pos;
+	uint64_t log_pos;
+	uint64_t log_index_pos;
+	uint8_t obj_id_len;
+	bool has_refs;
+};
+
+static int reftable_error_corrupt(const char *path)
+{
+	git_error_set(GIT_ERROR_REFERENCE, "corrupted reftable '%s'", path);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) get_be16(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 8) | p[1];
+}
+
+GIT_INLINE(uint32_t) get_be24(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+GIT_INLINE(uint32_t) get_be32(const unsigned char *p)
+{
+	return ((uint32_t)get_be16(p) << 16) | get_be16(p + 2);
+}
+
+GIT_INLINE(uint64_t) get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+GIT_INLINE(void) set_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = (v >> 16) & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = v & 0xff;
+}
+
+static int put_be(git_buf *buf, uint64_t v, size_t len)
+{
+	unsigned char bytes[8];
+	size_t i;
+
+	for (i = len; i > 0; i--, v >>= 8)
+		bytes[i - 1] = v & 0xff;
+
+	return git_buf_put(buf, (const char *)bytes, len);
+}
+
+static int put_varint(git_buf *buf, uint64_t v)
+{
+	unsigned char bytes[16];
+	int len = git_encode_varint(bytes, sizeof(bytes), v);
+
+	return git_buf_put(buf, (const char *)bytes, len);
+}
+
+/* Like `git_decode_varint`, but without reading past `end` */
+static int get_varint(uint64_t *out, const unsigned char **p, const unsigned char *end)
+{
+	const unsigned char *c = *p;
+	uint64_t v;
+
+	if (c >= end)
+		return -1;
+
+	v = *c & 0x7f;
+
+	while (*c++ & 0x80) {
+		if (c >= end || v >= ((uint64_t)1 << 56))
+			return -1;
+
+		v = ((v + 1) << 7) | (*c & 0x7f);
+	}
+
+	*out = v;
+	*p = c;
+	return 0;
+}
+
+static int key_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, min(a_len, b_len));
+
+	if (cmp)
+		return cmp;
+
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+/* The key of a reflog entry: the reference name, then the reversed index */
+static int log_key(git_buf *out, const char *refname, uint64_t update_index)
+{
+	git_buf_clear(out);
+	git_buf_puts(out, refname);
+	git_buf_putc(out, '\0');
+
+	return put_be(out, ~update_index, 8);
+}
+
+/*
+ * Reading
+ */
+
+static int reftable_parse(git_reftable *table)
+{
+	const unsigned char *header = table->data, *footer;
+	uint64_t obj;
+
+	if (table->size < GIT_REFTABLE_HEADER_SIZE + GIT_REFTABLE_FOOTER_SIZE ||
+	    memcmp(header, REFTABLE_MAGIC, 4) != 0)
+		return reftable_error_corrupt(table->path);
+
+	if (header[4] != GIT_REFTABLE_VERSION) {
+		git_error_set(GIT_ERROR_REFERENCE,
+			"unsupported reftable version %d in '%s'", header[4], table->path);
+		return -1;
+	}
+
+	table->footer_pos = table->size - GIT_REFTABLE_FOOTER_SIZE;
+	footer = header + table->footer_pos;
+
+	if (memcmp(footer, header, GIT_REFTABLE_HEADER_SIZE) != 0 ||
+	    crc32(0, footer, GIT_REFTABLE_FOOTER_SIZE - 4) != get_be32(footer + 64))
+		return reftable_error_corrupt(table->path);
+
+	table->block_size = get_be24(header + 5);
+	table->min_update_index = get_be64(header + 8);
+	table->max_update_index = get_be64(header + 16);
+
+	obj = get_be64(footer + 32);
+	table->ref_index_pos = get_be64(footer + 24);
+	table->obj_pos = obj >> 5;
+	table->obj_id_len = obj & 0x1f;
+	table->obj_index_pos = get_be64(footer + 40);
+	table->log_pos = get_be64(footer + 48);
+	table->log_index_pos = get_be64(footer + 56);
+
+	if (table->ref_index_pos >= table->footer_pos ||
+	    table->obj_pos >= table->footer_pos ||
+	    table->obj_index_pos >= table->footer_pos ||
+	    table->log_pos >= table->footer_pos ||
+	    table->log_index_pos >= table->footer_pos ||
+	    (table->obj_pos && !table->obj_id_len) ||
+	    table->obj_id_len > GIT_OID_RAWSZ)
+		return reftable_error_corrupt(table->path);
+
+	table->has_refs = table->footer_pos > GIT_REFTABLE_HEADER_SIZE &&
+		header[GIT_REFTABLE_HEADER_SIZE] == BLOCK_TYPE_REF;
+
+	return 0;
+}
+
+int git_reftable_open(git_reftable **out, const char *path)
+{
+	git_reftable *table;
+	struct stat st;
+	git_file fd;
+	int error;
+
+	*out = NULL;
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		git_error_set(GIT_ERROR_OS, "failed to stat '%s'", path);
+		return -1;
+	}
+
+	if (!git__is_sizet(st.st_size)) {
+		p_close(fd);
+		git_error_set(GIT_ERROR_REFERENCE, "reftable '%s' is too large", path);
+		return -1;
+	}
+
+	table = git__calloc(1, sizeof(git_reftable));
+	GIT_ERROR_CHECK_ALLOC(table);
+
+	git_atomic_set(&table->refcount, 1);
+	table->path = git__strdup(path);
+	table->size = (size_t)st.st_size;
+
+	if (!table->path)
+		error = -1;
+	else if (table->size < GIT_REFTABLE_HEADER_SIZE + GIT_REFTABLE_FOOTER_SIZE)
+		error = reftable_error_corrupt(path);
+	else if ((error = git_futils_mmap_ro(&table->map, fd, 0, table->size)) == 0) {
+		table->data = table->map.data;
+		error = reftable_parse(table);
+	}
+
+	p_close(fd);
+
+	if (error < 0) {
+		git_reftable_free(table);
+		return error;
+	}
+
+	*out = table;
+	return 0;
+}
+
+void git_reftable_incref(git_reftable *table)
+{
+	git_atomic_inc(&table->refcount);
+}
+
+void git_reftable_free(git_reftable *table)
+{
+	if (!table || git_atomic_dec(&table->refcount) > 0)
+		return;
+
+	if (table->data)
+		git_futils_mmap_free(&table->map);
+
+	git__free(table->path);
+	git__free(table);
+}
+
+const char *git_reftable_path(const git_reftable *table)
+{
+	return table->path;
+}
+
+size_t git_reftable_size(const git_reftable *table)
+{
+	return table->size;
+}
+
+uint64_t git_reftable_min_update_index(const git_reftable *table)
+{
+	return table->min_update_index;
+}
+
+uint64_t git_reftable_max_update_index(const git_reftable *table)
+{
+	return table->max_update_index;
+}
+
+/* The end of the section that starts at `start`: where the next one starts */
+static size_t section_end(const git_reftable *table, uint64_t start)
+{
+	uint64_t positions[5], end = table->footer_pos;
+	size_t i;
+
+	positions[0] = table->ref_index_pos;
+	positions[1] = table->obj_pos;
+	positions[2] = table->obj_index_pos;
+	positions[3] = table->log_pos;
+	positions[4] = table->log_index_pos;
+
+	for (i = 0; i < ARRAY_SIZE(positions); i++) {
+		if (positions[i] > start && positions[i] < end)
+			end = positions[i];
+	}
+
+	return (size_t)end;
+}
+
+static int iter_inflate(
+	git_reftable_iter *iter,
+	const unsigned char *header,
+	size_t header_len,
+	size_t block_len)
+{
+	git_reftable *table = iter->table;
+	const unsigned char *in = header + header_len;
+	z_stream zs;
+	int zerror;
+
+	git_buf_clear(&iter->inflated);
+
+	if (block_len < header_len ||
+	    git_buf_grow(&iter->inflated, block_len) < 0)
+		return -1;
+
+	memcpy(iter->inflated.ptr, header, header_len);
+
+	memset(&zs, 0, sizeof(zs));
+
+	if (inflateInit(&zs) != Z_OK) {
+		git_error_set(GIT_ERROR_ZLIB, "failed to initialize zlib");
+		return -1;
+	}
+
+	zs.next_in = (Bytef *)in;
+	zs.avail_in = (uInt)min((size_t)UINT_MAX, (size_t)(table->data + table->footer_pos - in));
+	zs.next_out = (Bytef *)iter->inflated.ptr + header_len;
+	zs.avail_out = (uInt)(block_len - header_len);
+
+	zerror = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (zerror != Z_STREAM_END || zs.avail_out != 0)
+		return reftable_error_corrupt(table->path);
+
+	iter->inflated.size = block_len;
+	iter->block = (const unsigned char *)iter->inflated.ptr;
+	iter->next_block = (in - table->data) + zs.total_in;
+
+	return 0;
+}
+
+/* Load the block at `pos`; the first block also holds the file header */
+static int iter_load_block(git_reftable_iter *iter, size_t pos)
+{
+	git_reftable *table = iter->table;
+	const unsigned char *header;
+	size_t header_pos, records_start, restarts_len, block_len;
+	uint32_t restart_count;
+
+	header_pos = pos ? pos : GIT_REFTABLE_HEADER_SIZE;
+
+	if (header_pos + BLOCK_HEADER_SIZE > table->footer_pos)
+		return reftable_error_corrupt(table->path);
+
+	header = table->data + header_pos;
+	block_len = get_be24(header + 1);
+	records_start = header_pos - pos + BLOCK_HEADER_SIZE;
+
+	if (block_len < records_start + 2)
+		return reftable_error_corrupt(table->path);
+
+	if (header[0] == BLOCK_TYPE_LOG) {
+		if (iter_inflate(iter, table->data + pos, records_start, block_len) < 0)
+			return -1;
+	} else {
+		if (pos + block_len > table->footer_pos)
+			return reftable_error_corrupt(table->path);
+
+		iter->block = table->data + pos;
+		iter->next_block = pos + block_len;
+
+		/* blocks may be padded to the block size */
+		if (table->block_size && iter->next_block < table->footer_pos &&
+		    table->data[iter->next_block] == 0)
+			iter->next_block += table->block_size -
+				(iter->next_block % table->block_size);
+	}
+
+	restart_count = get_be16(iter->block + block_len - 2);
+	restarts_len = 3 * (size_t)restart_count + 2;
+
+	if (!restart_count || block_len < records_start + restarts_len)
+		return reftable_error_corrupt(table->path);
+
+	iter->type = header[0];
+	iter->block_start = pos;
+	iter->block_len = block_len;
+	iter->pos = records_start;
+	iter->records_end = block_len - restarts_len;
+	git_buf_clear(&iter->key);
+
+	return 0;
+}
+
+/*
+ * Read the key of the record at `*p`, decompressing it against `prefix`,
+ * and the three bits that go with it.
+ */
+static int read_key(
+	git_buf *out,
+	uint8_t *extra,
+	const git_buf *prefix,
+	const unsigned char **p,
+	const unsigned char *end)
+{
+	uint64_t prefix_len, suffix_len;
+
+	if (get_varint(&prefix_len, p, end) < 0 ||
+	    get_varint(&suffix_len, p, end) < 0)
+		return -1;
+
+	*extra = suffix_len & 0x7;
+	suffix_len >>= 3;
+
+	if (prefix_len > prefix->size || suffix_len > (uint64_t)(end - *p))
+		return -1;
+
+	git_buf_clear(out);
+
+	if (git_buf_put(out, prefix->ptr, (size_t)prefix_len) < 0 ||
+	    git_buf_put(out, (const char *)*p, (size_t)suffix_len) < 0)
+		return -1;
+
+	*p += suffix_len;
+	return 0;
+}
+
+static int skip_bytes(const unsigned char **p, const unsigned char *end, uint64_t len)
+{
+	if (len > (uint64_t)(end - *p))
+		return -1;
+
+	*p += len;
+	return 0;
+}
+
+/* Skip the value of a record, which is of the type of the block */
+static int skip_value(
+	const unsigned char **p, const unsigned char *end, char type, uint8_t extra)
+{
+	uint64_t v, count;
+
+	switch (type) {
+	case BLOCK_TYPE_REF:
+		if (get_varint(&v, p, end) < 0)
+			return -1;
+
+		switch (extra) {
+		case GIT_REFTABLE_DELETION:
+			return 0;
+		case GIT_REFTABLE_VAL1:
+			return skip_bytes(p, end, GIT_OID_RAWSZ);
+		case GIT_REFTABLE_VAL2:
+			return skip_bytes(p, end, 2 * GIT_OID_RAWSZ);
+		case GIT_REFTABLE_SYMREF:
+			if (get_varint(&v, p, end) < 0)
+				return -1;
+			return skip_bytes(p, end, v);
+		}
+		return -1;
+
+	case BLOCK_TYPE_INDEX:
+		return get_varint(&v, p, end);
+
+	case BLOCK_TYPE_OBJ:
+		if ((count = extra) == 0 && get_varint(&count, p, end) < 0)
+			return -1;
+
+		while (count--) {
+			if (get_varint(&v, p, end) < 0)
+				return -1;
+		}
+		return 0;
+
+	case BLOCK_TYPE_LOG:
+		if (extra == 0)
+			return 0;
+
+		if (extra != 1 ||
+		    skip_bytes(p, end, 2 * GIT_OID_RAWSZ) < 0 ||
+		    get_varint(&v, p, end) < 0 || skip_bytes(p, end, v) < 0 ||
+		    get_varint(&v, p, end) < 0 || skip_bytes(p, end, v) < 0 ||
+		    get_varint(&v, p, end) < 0 || skip_bytes(p, end, 2) < 0 ||
+		    get_varint(&v, p, end) < 0 || skip_bytes(p, end, v) < 0)
+			return -1;
+		return 0;
+	}
+
+	return -1;
+}
+
+/* Compare the key of the restart point `i` of the block with `key` */
+static int restart_cmp(
+	int *cmp, git_reftable_iter *iter, uint32_t i, const char *key, size_t key_len)
+{
+	const unsigned char *p, *end = iter->block + iter->records_end;
+	size_t offset = get_be24(iter->block + iter->records_end + 3 * i);
+	uint8_t extra;
+
+	git_buf_clear(&iter->key);
+	p = iter->block + offset;
+
+	if (offset >= iter->records_end ||
+	    read_key(&iter->scratch, &extra, &iter->key, &p, end) < 0)
+		return reftable_error_corrupt(iter->table->path);
+
+	*cmp = key_cmp(iter->scratch.ptr, iter->scratch.size, key, key_len);
+	return 0;
+}
+
+/*
+ * Move the cursor to the first record of the block whose key is not before
+ * `key`: binary search the restart points, then walk the records.  The
+ * cursor is left at the end of the block when there is no such record.
+ */
+static int iter_seek_block(git_reftable_iter *iter, const char *key, size_t key_len)
+{
+	const unsigned char *p, *end = iter->block + iter->records_end;
+	uint32_t restart_count = get_be16(iter->block + iter->block_len - 2);
+	uint32_t lo = 0, hi = restart_count, mid;
+	uint8_t extra;
+	int cmp;
+
+	/* find the first restart point that is not before the key */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (restart_cmp(&cmp, iter, mid, key, key_len) < 0)
+			return -1;
+
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* and start with the one before it */
+	git_buf_clear(&iter->key);
+
+	if (lo > 0)
+		iter->pos = get_be24(iter->block + iter->records_end + 3 * (lo - 1));
+
+	while (iter->pos < iter->records_end) {
+		p = iter->block + iter->pos;
+
+		if (read_key(&iter->scratch, &extra, &iter->key, &p, end) < 0)
+			return reftable_error_corrupt(iter->table->path);
+
+		if (key_cmp(iter->scratch.ptr, iter->scratch.size, key, key_len) >= 0)
+			break;
+
+		if (skip_value(&p, end, iter->type, extra) < 0)
+			return reftable_error_corrupt(iter->table->path);
+
+		git_buf_swap(&iter->key, &iter->scratch);
+		iter->pos = p - iter->block;
+	}
+
+	return 0;
+}
+
+/* Move to the next block of the section, if the current one is done */
+static int iter_next_block(git_reftable_iter *iter)
+{
+	char type = iter->type;
+
+	while (iter->block && iter->pos >= iter->records_end) {
+		if (iter->next_block >= iter->section_end) {
+			iter->block = NULL;
+			break;
+		}
+
+		if (iter_load_block(iter, iter->next_block) < 0)
+			return -1;
+
+		if (iter->type != type) {
+			iter->block = NULL;
+			iter->type = type;
+		}
+	}
+
+	return iter->block ? 0 : GIT_ITEROVER;
+}
+
+static void iter_reset(git_reftable_iter *iter, git_reftable *table, char type)
+{
+	iter->table = table;
+	iter->type = type;
+	iter->block = NULL;
+	iter->block_start = iter->block_len = iter->next_block = 0;
+	iter->pos = iter->records_end = 0;
+	iter->section_end = 0;
+}
+
+/*
+ * Position the cursor on the first record of a section not before `key`,
+ * going through the index of the section when it has one.
+ */
+static int iter_seek(
+	git_reftable_iter *iter,
+	git_reftable *table,
+	char type,
+	uint64_t start,
+	uint64_t index_pos,
+	const char *key,
+	size_t key_len)
+{
+	const unsigned char *p, *end;
+	uint64_t pos = start;
+	uint8_t extra;
+
+	iter_reset(iter, table, type);
+	iter->section_end = section_end(table, start);
+
+	while (index_pos) {
+		if (iter_load_block(iter, (size_t)index_pos) < 0)
+			return -1;
+
+		if (iter->type != BLOCK_TYPE_INDEX)
+			break;
+
+		if (iter_seek_block(iter, key, key_len) < 0)
+			return -1;
+
+		/* every key of the section is before this one */
+		if (iter->pos >= iter->records_end) {
+			iter_reset(iter, table, type);
+			return 0;
+		}
+
+		p = iter->block + iter->pos;
+		end = iter->block + iter->records_end;
+
+		if (read_key(&iter->scratch, &extra, &iter->key, &p, end) < 0 ||
+		    get_varint(&pos, &p, end) < 0 ||
+		    pos < start || pos >= table->footer_pos)
+			return reftable_error_corrupt(table->path);
+
+		/* multi-level indexes point to further index blocks */
+		index_pos = pos;
+	}
+
+	if (iter_load_block(iter, (size_t)pos) < 0)
+		return -1;
+
+	if (iter->type != type)
+		return reftable_error_corrupt(table->path);
+
+	if (iter_seek_block(iter, key, key_len) < 0)
+		return -1;
+
+	/* the key may be after the last one of a block without an index */
+	while (iter->pos >= iter->records_end) {
+		int error;
+
+		if ((error = iter_next_block(iter)) < 0)
+			return error == GIT_ITEROVER ? 0 : error;
+
+		if (iter_seek_block(iter, key, key_len) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int git_reftable_seek_ref(
+	git_reftable_iter *iter, git_reftable *table, const char *name)
+{
+	if (!table->has_refs) {
+		iter_reset(iter, table, BLOCK_TYPE_REF);
+		return 0;
+	}
+
+	return iter_seek(iter, table, BLOCK_TYPE_REF, 0,
+		table->ref_index_pos, name, strlen(name));
+}
+
+int git_reftable_next_ref(git_reftable_ref *out, git_reftable_iter *iter)
+{
+	const unsigned char *p, *end;
+	uint64_t delta, len;
+	uint8_t extra;
+	int error;
+
+	if ((error = iter_next_block(iter)) < 0)
+		return error;
+
+	p = iter->block + iter->pos;
+	end = iter->block + iter->records_end;
+
+	if (read_key(&iter->scratch, &extra, &iter->key, &p, end) < 0 ||
+	    get_varint(&delta, &p, end) < 0)
+		goto corrupt;
+
+	memset(out, 0, sizeof(git_reftable_ref));
+	out->type = extra;
+	out->update_index = iter->table->min_update_index + delta;
+
+	switch (extra) {
+	case GIT_REFTABLE_DELETION:
+		break;
+	case GIT_REFTABLE_VAL2:
+		if (end - p < 2 * GIT_OID_RAWSZ)
+			goto corrupt;
+		git_oid_fromraw(&out->peel, p + GIT_OID_RAWSZ);
+		/* fall through */
+	case GIT_REFTABLE_VAL1:
+		if (end - p < GIT_OID_RAWSZ)
+			goto corrupt;
+		git_oid_fromraw(&out->oid, p);
+		p += (extra == GIT_REFTABLE_VAL2 ? 2 : 1) * GIT_OID_RAWSZ;
+		break;
+	case GIT_REFTABLE_SYMREF:
+		if (get_varint(&len, &p, end) < 0 || len > (uint64_t)(end - p) ||
+		    git_buf_set(&iter->value, p, (size_t)len) < 0)
+			goto corrupt;
+		out->target = iter->value.ptr;
+		p += len;
+		break;
+	default:
+		goto corrupt;
+	}
+
+	git_buf_swap(&iter->key, &iter->scratch);
+	iter->pos = p - iter->block;
+	out->name = iter->key.ptr;
+
+	return 0;
+
+corrupt:
+	return reftable_error_corrupt(iter->table->path);
+}
+
+int git_reftable_seek_log(
+	git_reftable_iter *iter,
+	git_reftable *table,
+	const char *refname,
+	uint64_t update_index)
+{
+	git_buf key = GIT_BUF_INIT;
+	int error;
+
+	if (!table->log_pos) {
+		iter_reset(iter, table, BLOCK_TYPE_LOG);
+		return 0;
+	}
+
+	if (*refname && (error = log_key(&key, refname, update_index)) < 0)
+		return error;
+
+	error = iter_seek(iter, table, BLOCK_TYPE_LOG, table->log_pos,
+		table->log_index_pos, key.ptr ? key.ptr : "", key.size);
+
+	git_buf_dispose(&key);
+	return error;
+}
+
+static int read_string(
+	size_t *out, git_buf *buf, const unsigned char **p, const unsigned char *end)
+{
+	uint64_t len;
+
+	if (get_varint(&len, p, end) < 0 || len > (uint64_t)(end - *p))
+		return -1;
+
+	*out = buf->size;
+
+	if (git_buf_put(buf, (const char *)*p, (size_t)len) < 0 ||
+	    git_buf_putc(buf, '\0') < 0)
+		return -1;
+
+	*p += len;
+	return 0;
+}
+
+int git_reftable_next_log(git_reftable_log *out, git_reftable_iter *iter)
+{
+	const unsigned char *p, *end;
+	size_t name, email, message;
+	uint8_t extra;
+	int error;
+
+	if ((error = iter_next_block(iter)) < 0)
+		return error;
+
+	p = iter->block + iter->pos;
+	end = iter->block + iter->records_end;
+
+	if (read_key(&iter->scratch, &extra, &iter->key, &p, end) < 0 ||
+	    iter->scratch.size < 9 ||
+	    iter->scratch.ptr[iter->scratch.size - 9] != '\0' ||
+	    extra > 1)
+		goto corrupt;
+
+	memset(out, 0, sizeof(git_reftable_log));
+	out->update_index = ~get_be64(
+		(const unsigned char *)iter->scratch.ptr + iter->scratch.size - 8);
+	out->deletion = (extra == 0);
+
+	if (!out->deletion) {
+		uint64_t time;
+
+		if (end - p < 2 * GIT_OID_RAWSZ)
+			goto corrupt;
+
+		git_oid_fromraw(&out->old_id, p);
+		git_oid_fromraw(&out->new_id, p + GIT_OID_RAWSZ);
+		p += 2 * GIT_OID_RAWSZ;
+
+		git_buf_clear(&iter->value);
+
+		if (read_string(&name, &iter->value, &p, end) < 0 ||
+		    read_string(&email, &iter->value, &p, end) < 0 ||
+		    get_varint(&time, &p, end) < 0 || end - p < 2)
+			goto corrupt;
+
+		out->time = time;
+		out->tz_offset = (int16_t)get_be16(p);
+		p += 2;
+
+		if (read_string(&message, &iter->value, &p, end) < 0)
+			goto corrupt;
+
+		out->name = iter->value.ptr + name;
+		out->email = iter->value.ptr + email;
+		out->message = iter->value.ptr + message;
+	}
+
+	git_buf_swap(&iter->key, &iter->scratch);
+	iter->pos = p - iter->block;
+	out->refname = iter->key.ptr;
+
+	return 0;
+
+corrupt:
+	return reftable_error_corrupt(iter->table->path);
+}
+
+void git_reftable_iter_dispose(git_reftable_iter *iter)
+{
+	git_buf_dispose(&iter->inflated);
+	git_buf_dispose(&iter->key);
+	git_buf_dispose(&iter->scratch);
+	git_buf_dispose(&iter->value);
+	iter_reset(iter, NULL, 0);
+}
+
+static bool ref_points_to(const git_reftable_ref *ref, const git_oid *id)
+{
+	return (ref->type == GIT_REFTABLE_VAL1 && git_oid_equal(&ref->oid, id)) ||
+		(ref->type == GIT_REFTABLE_VAL2 &&
+		 (git_oid_equal(&ref->oid, id) || git_oid_equal(&ref->peel, id)));
+}
+
+typedef git_array_t(uint64_t) block_positions;
+
+/* Read the positions of the blocks that the object index lists for `id` */
+static int obj_blocks(block_positions *out, git_reftable *table, const git_oid *id)
+{
+	git_reftable_iter iter = GIT_REFTABLE_ITER_INIT;
+	const unsigned char *p, *end;
+	uint64_t count, pos = 0, delta, *entry;
+	uint8_t extra;
+	int error;
+
+	if ((error = iter_seek(&iter, table, BLOCK_TYPE_OBJ, table->obj_pos,
+		table->obj_index_pos, (const char *)id->id, table->obj_id_len)) < 0 ||
+	    (error = iter_next_block(&iter)) < 0)
+		goto done;
+
+	p = iter.block + iter.pos;
+	end = iter.block + iter.records_end;
+
+	if (read_key(&iter.scratch, &extra, &iter.key, &p, end) < 0) {
+		error = reftable_error_corrupt(table->path);
+		goto done;
+	}
+
+	if (iter.scratch.size != table->obj_id_len ||
+	    memcmp(iter.scratch.ptr, id->id, table->obj_id_len) != 0) {
+		error = GIT_ITEROVER;
+		goto done;
+	}
+
+	if ((count = extra) == 0 && get_varint(&count, &p, end) < 0) {
+		error = reftable_error_corrupt(table->path);
+		goto done;
+	}
+
+	/* a long list of blocks may be left out; they then all have to be read */
+	if (!count) {
+		error = GIT_PASSTHROUGH;
+		goto done;
+	}
+
+	while (count--) {
+		if (get_varint(&delta, &p, end) < 0) {
+			error = reftable_error_corrupt(table->path);
+			goto done;
+		}
+
+		pos += delta;
+		entry = git_array_alloc(*out);
+		GIT_ERROR_CHECK_ALLOC(entry);
+		*entry = pos;
+	}
+
+done:
+	git_reftable_iter_dispose(&iter);
+	return error;
+}
+
+int git_reftable_refs_to(
+	git_reftable *table,
+	const git_oid *id,
+	git_reftable_ref_cb cb,
+	void *payload)
+{
+	git_reftable_iter iter = GIT_REFTABLE_ITER_INIT;
+	block_positions blocks = GIT_ARRAY_INIT;
+	git_reftable_ref ref;
+	size_t i;
+	int error = GIT_PASSTHROUGH;
+
+	if (table->obj_pos && (error = obj_blocks(&blocks, table, id)) == GIT_ITEROVER)
+		error = 0;
+
+	if (error == GIT_PASSTHROUGH) {
+		/* without an index, look at all of the references */
+		if ((error = git_reftable_seek_ref(&iter, table, "")) < 0)
+			goto done;
+
+		while ((error = git_reftable_next_ref(&ref, &iter)) == 0) {
+			if (ref_points_to(&ref, id) && (error = cb(&ref, payload)) != 0)
+				goto done;
+		}
+	} else if (error == 0) {
+		for (i = 0; i < git_array_size(blocks); i++) {
+			uint64_t pos = *git_array_get(blocks, i);
+
+			iter_reset(&iter, table, BLOCK_TYPE_REF);
+
+			if (pos >= table->footer_pos ||
+			    (error = iter_load_block(&iter, (size_t)pos)) < 0 ||
+			    iter.type != BLOCK_TYPE_REF) {
+				error = reftable_error_corrupt(table->path);
+				goto done;
+			}
+
+			/* stop at the end of the block */
+			iter.section_end = 0;
+
+			while ((error = git_reftable_next_ref(&ref, &iter)) == 0) {
+				if (ref_points_to(&ref, id) && (error = cb(&ref, payload)) != 0)
+					goto done;
+			}
+
+			if (error != GIT_ITEROVER)
+				goto done;
+		}
+	}
+
+done:
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+	git_array_clear(blocks);
+	git_reftable_iter_dispose(&iter);
+	return error;
+}
+
+/*
+ * Writing
+ */
+
+struct git_reftable_writer {
+	git_reftable_writer_options opts;
+	git_pool pool;
+	git_vector refs;
+	git_vector logs;
+};
+
+typedef struct {
+	git_reftable_log log;
+	git_buf key;
+} writer_log;
+
+typedef struct {
+	const char *key;
+	size_t key_len;
+	uint64_t pos;
+} index_entry;
+
+typedef struct {
+	git_oid id;
+	uint64_t pos;
+} obj_entry;
+
+typedef git_array_t(obj_entry) obj_entries;
+
+static int writer_ref_cmp(const void *a, const void *b)
+{
+	return strcmp(((const git_reftable_ref *)a)->name, ((const git_reftable_ref *)b)->name);
+}
+
+static int writer_log_cmp(const void *a, const void *b)
+{
+	const writer_log *la = a, *lb = b;
+	return key_cmp(la->key.ptr, la->key.size, lb->key.ptr, lb->key.size);
+}
+
+int git_reftable_writer_new(
+	git_reftable_writer **out, const git_reftable_writer_options *opts)
+{
+	git_reftable_writer *writer;
+
+	assert(out && opts);
+
+	if (opts->block_size < 256 || opts->block_size > MAX_BLOCK_LEN ||
+	    !opts->restart_interval ||
+	    opts->min_update_index > opts->max_update_index) {
+		git_error_set(GIT_ERROR_INVALID, "invalid reftable options");
+		return -1;
+	}
+
+	writer = git__calloc(1, sizeof(git_reftable_writer));
+	GIT_ERROR_CHECK_ALLOC(writer);
+
+	memcpy(&writer->opts, opts, sizeof(git_reftable_writer_options));
+	git_pool_init(&writer->pool, 1);
+
+	if (git_vector_init(&writer->refs, 16, writer_ref_cmp) < 0 ||
+	    git_vector_init(&writer->logs, 16, writer_log_cmp) < 0) {
+		git_reftable_writer_free(writer);
+		return -1;
+	}
+
+	*out = writer;
+	return 0;
+}
+
+static int writer_check_index(git_reftable_writer *writer, uint64_t update_index)
+{
+	if (update_index < writer->opts.min_update_index ||
+	    update_index > writer->opts.max_update_index) {
+		git_error_set(GIT_ERROR_REFERENCE,
+			"update index %"PRIu64" is outside of the table", update_index);
+		return -1;
+	}
+
+	return 0;
+}
+
+int git_reftable_writer_add_ref(
+	git_reftable_writer *writer, const git_reftable_ref *ref)
+{
+	git_reftable_ref *copy;
+
+	if (writer_check_index(writer, ref->update_index) < 0)
+		return -1;
+
+	copy = git_pool_malloc(&writer->pool, sizeof(git_reftable_ref));
+	GIT_ERROR_CHECK_ALLOC(copy);
+
+	memcpy(copy, ref, sizeof(git_reftable_ref));
+	copy->name = git_pool_strdup(&writer->pool, ref->name);
+	GIT_ERROR_CHECK_ALLOC(copy->name);
+
+	if (ref->type == GIT_REFTABLE_SYMREF) {
+		copy->target = git_pool_strdup(&writer->pool, ref->target);
+		GIT_ERROR_CHECK_ALLOC(copy->target);
+	} else {
+		copy->target = NULL;
+	}
+
+	return git_vector_insert(&writer->refs, copy);
+}
+
+static const char *pool_strdup_or_empty(git_pool *pool, const char *str)
+{
+	return git_pool_strdup(pool, str ? str : "");
+}
+
+int git_reftable_writer_add_log(
+	git_reftable_writer *writer, const git_reftable_log *log)
+{
+	writer_log *copy;
+
+	/* a deletion names the entry of an older table */
+	if (!log->deletion && writer_check_index(writer, log->update_index) < 0)
+		return -1;
+
+	copy = git_pool_mallocz(&writer->pool, sizeof(writer_log));
+	GIT_ERROR_CHECK_ALLOC(copy);
+
+	memcpy(&copy->log, log, sizeof(git_reftable_log));
+	git_buf_init(&copy->key, 0);
+
+	if ((copy->log.refname = git_pool_strdup(&writer->pool, log->refname)) == NULL ||
+	    (copy->log.name = pool_strdup_or_empty(&writer->pool, log->name)) == NULL ||
+	    (copy->log.email = pool_strdup_or_empty(&writer->pool, log->email)) == NULL ||
+	    (copy->log.message = pool_strdup_or_empty(&writer->pool, log->message)) == NULL ||
+	    log_key(&copy->key, log->refname, log->update_index) < 0 ||
+	    git_vector_insert(&writer->logs, copy) < 0) {
+		git_buf_dispose(&copy->key);
+		return -1;
+	}
+
+	return 0;
+}
+
+bool git_reftable_writer_empty(git_reftable_writer *writer)
+{
+	return !writer->refs.length && !writer->logs.length;
+}
+
+void git_reftable_writer_free(git_reftable_writer *writer)
+{
+	writer_log *log;
+	size_t i;
+
+	if (!writer)
+		return;
+
+	git_vector_foreach(&writer->logs, i, log)
+		git_buf_dispose(&log->key);
+
+	git_vector_free(&writer->refs);
+	git_vector_free(&writer->logs);
+	git_pool_clear(&writer->pool);
+	git__free(writer);
+}
+
+/* A block that is being written */
+typedef struct {
+	char type;
+	size_t start;
+	size_t header_len;
+	size_t limit;
+	uint16_t restart_interval;
+
+	git_buf records;
+	git_array_t(uint32_t) restarts;
+	git_buf last_key;
+	size_t entries;
+} block_writer;
+
+typedef struct {
+	git_reftable_writer *writer;
+	git_buf *out;
+	size_t padding;
+
+	block_writer block;
+	git_array_t(index_entry) index;
+	git_buf record;
+} table_writer;
+
+static void block_start(table_writer *tw, char type, size_t limit)
+{
+	block_writer *block = &tw->block;
+
+	block->type = type;
+	block->start = tw->out->size;
+	block->header_len = BLOCK_HEADER_SIZE;
+	block->limit = limit;
+	block->restart_interval = tw->writer->opts.restart_interval;
+	block->entries = 0;
+
+	/* the first block shares its space with the file header */
+	if (block->start == GIT_REFTABLE_HEADER_SIZE && type == BLOCK_TYPE_REF) {
+		block->start = 0;
+		block->header_len += GIT_REFTABLE_HEADER_SIZE;
+	}
+
+	git_buf_clear(&block->records);
+	git_buf_clear(&block->last_key);
+	git_array_clear(block->restarts);
+}
+
+/*
+ * Add a record with `key` to the block; its value is in `value`.  Returns
+ * GIT_EBUFS when the block is full, in which case it has to be written out
+ * and the record added to a new one.
+ */
+static int block_add(
+	table_writer *tw,
+	const char *key,
+	size_t key_len,
+	uint8_t extra,
+	const git_buf *value)
+{
+	block_writer *block = &tw->block;
+	git_buf *record = &tw->record;
+	bool restart = (block->entries % block->restart_interval) == 0;
+	size_t prefix = 0, restarts, len;
+	uint32_t *offset;
+
+	if (!restart) {
+		size_t max = min(key_len, block->last_key.size);
+
+		while (prefix < max && key[prefix] == block->last_key.ptr[prefix])
+			prefix++;
+	}
+
+	git_buf_clear(record);
+
+	if (put_varint(record, prefix) < 0 ||
+	    put_varint(record, ((uint64_t)(key_len - prefix) << 3) | extra) < 0 ||
+	    git_buf_put(record, key + prefix, key_len - prefix) < 0 ||
+	    git_buf_put(record, value->ptr, value->size) < 0)
+		return -1;
+
+	restarts = git_array_size(block->restarts) + (restart ? 1 : 0);
+	len = block->header_len + block->records.size + record->size + 3 * restarts + 2;
+
+	if ((block->limit && len > block->limit) ||
+	    len > MAX_BLOCK_LEN || restarts > MAX_RESTARTS) {
+		if (block->entries)
+			return GIT_EBUFS;
+
+		if (block->limit == tw->writer->opts.block_size && block->type == BLOCK_TYPE_REF) {
+			git_error_set(GIT_ERROR_REFERENCE,
+				"reference '%.*s' does not fit in a reftable block", (int)key_len, key);
+			return -1;
+		}
+
+		if (len > MAX_BLOCK_LEN) {
+			git_error_set(GIT_ERROR_REFERENCE, "reftable block is too large");
+			return -1;
+		}
+	}
+
+	if (restart) {
+		offset = git_array_alloc(block->restarts);
+		GIT_ERROR_CHECK_ALLOC(offset);
+		*offset = (uint32_t)(block->header_len + block->records.size);
+	}
+
+	block->entries++;
+
+	if (git_buf_put(&block->records, record->ptr, record->size) < 0 ||
+	    git_buf_set(&block->last_key, key, key_len) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int deflate_block(git_buf *out, const char *data, size_t len)
+{
+	z_stream zs;
+	unsigned char chunk[4096];
+	int zerror;
+
+	memset(&zs, 0, sizeof(zs));
+
+	if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		git_error_set(GIT_ERROR_ZLIB, "failed to initialize zlib");
+		return -1;
+	}
+
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = (uInt)len;
+
+	do {
+		zs.next_out = chunk;
+		zs.avail_out = sizeof(chunk);
+
+		zerror = deflate(&zs, Z_FINISH);
+
+		if ((zerror != Z_OK && zerror != Z_STREAM_END) ||
+		    git_buf_put(out, (const char *)chunk, sizeof(chunk) - zs.avail_out) < 0) {
+			deflateEnd(&zs);
+			git_error_set(GIT_ERROR_ZLIB, "failed to compress reftable block");
+			return -1;
+		}
+	} while (zerror != Z_STREAM_END);
+
+	deflateEnd(&zs);
+	return 0;
+}
+
+/* Write out the block, and remember its last key for the index */
+static int block_finish(table_writer *tw)
+{
+	block_writer *block = &tw->block;
+	git_buf *out = tw->out;
+	index_entry *entry;
+	size_t i, len, pos;
+	unsigned char header[BLOCK_HEADER_SIZE];
+
+	if (!block->entries)
+		return 0;
+
+	/* the padding of the previous block only goes in front of another */
+	if (tw->padding && git_buf_putcn(out, '\0', tw->padding) < 0)
+		return -1;
+
+	tw->padding = 0;
+
+	if (block->start != 0)
+		block->start = out->size;
+
+	len = block->header_len + block->records.size +
+		3 * git_array_size(block->restarts) + 2;
+
+	header[0] = block->type;
+	set_be24(header + 1, (uint32_t)len);
+
+	for (i = 0; i < git_array_size(block->restarts); i++)
+		put_be(&block->records, *git_array_get(block->restarts, i), 3);
+
+	put_be(&block->records, git_array_size(block->restarts), 2);
+
+	if (git_buf_oom(&block->records) ||
+	    git_buf_put(out, (const char *)header, BLOCK_HEADER_SIZE) < 0)
+		return -1;
+
+	if (block->type == BLOCK_TYPE_LOG) {
+		if (deflate_block(out, block->records.ptr, block->records.size) < 0)
+			return -1;
+	} else if (git_buf_put(out, block->records.ptr, block->records.size) < 0) {
+		return -1;
+	}
+
+	pos = block->start;
+
+	if ((block->type == BLOCK_TYPE_REF || block->type == BLOCK_TYPE_OBJ) &&
+	    out->size % tw->writer->opts.block_size)
+		tw->padding = tw->writer->opts.block_size -
+			out->size % tw->writer->opts.block_size;
+
+	entry = git_array_alloc(tw->index);
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	entry->key = git_pool_strndup(&tw->writer->pool, block->last_key.ptr, block->last_key.size);
+	entry->key_len = block->last_key.size;
+	entry->pos = pos;
+	GIT_ERROR_CHECK_ALLOC(entry->key);
+
+	block->entries = 0;
+	return 0;
+}
+
+/* Add a record, starting a new block if the current one is full */
+static int section_add(
+	table_writer *tw,
+	const char *key,
+	size_t key_len,
+	uint8_t extra,
+	const git_buf *value)
+{
+	int error;
+
+	if ((error = block_add(tw, key, key_len, extra, value)) != GIT_EBUFS)
+		return error;
+
+	if ((error = block_finish(tw)) < 0)
+		return error;
+
+	block_start(tw, tw->block.type, tw->block.limit);
+	return block_add(tw, key, key_len, extra, value);
+}
+
+/*
+ * Finish the last block of a section, and write an index for it when it
+ * has more than one block.  Returns the position of the first block and
+ * that of the index, or 0 for either when there is none.
+ */
+static int section_finish(uint64_t *section_pos, uint64_t *index_pos, table_writer *tw)
+{
+	git_buf value = GIT_BUF_INIT;
+	index_entry *entry;
+	size_t i;
+	int error;
+
+	*section_pos = *index_pos = 0;
+
+	if ((error = block_finish(tw)) < 0)
+		goto done;
+
+	if (git_array_size(tw->index) > 0)
+		*section_pos = git_array_get(tw->index, 0)->pos;
+
+	if (git_array_size(tw->index) > 1) {
+		block_start(tw, BLOCK_TYPE_INDEX, 0);
+
+		for (i = 0; i < git_array_size(tw->index); i++) {
+			entry = git_array_get(tw->index, i);
+			git_buf_clear(&value);
+
+			if ((error = put_varint(&value, entry->pos)) < 0 ||
+			    (error = block_add(tw, entry->key, entry->key_len, 0, &value)) < 0)
+				goto done;
+		}
+
+		if ((error = block_finish(tw)) < 0)
+			goto done;
+
+		*index_pos = tw->block.start;
+	}
+
+done:
+	git_array_clear(tw->index);
+	git_buf_dispose(&value);
+	return error;
+}
+
+static int write_ref_value(git_buf *value, git_reftable_writer *writer, const git_reftable_ref *ref)
+{
+	git_buf_clear(value);
+	put_varint(value, ref->update_index - writer->opts.min_update_index);
+
+	switch (ref->type) {
+	case GIT_REFTABLE_DELETION:
+		break;
+	case GIT_REFTABLE_VAL1:
+		git_buf_put(value, (const char *)ref->oid.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_VAL2:
+		git_buf_put(value, (const char *)ref->oid.id, GIT_OID_RAWSZ);
+		git_buf_put(value, (const char *)ref->peel.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_SYMREF:
+		put_varint(value, strlen(ref->target));
+		git_buf_puts(value, ref->target);
+		break;
+	default:
+		git_error_set(GIT_ERROR_INVALID, "invalid reftable record type");
+		return -1;
+	}
+
+	return git_buf_oom(value) ? -1 : 0;
+}
+
+static int obj_entry_cmp(const void *a, const void *b)
+{
+	const obj_entry *oa = a, *ob = b;
+	int cmp = git_oid_cmp(&oa->id, &ob->id);
+
+	if (cmp)
+		return cmp;
+
+	return (oa->pos > ob->pos) - (oa->pos < ob->pos);
+}
+
+static int add_obj_entry(obj_entries *objs, const git_oid *id, uint64_t pos)
+{
+	obj_entry *entry = git_array_alloc(*objs);
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->id, id);
+	entry->pos = pos;
+	return 0;
+}
+
+static int write_refs(
+	obj_entries *objs, uint64_t *index_pos, table_writer *tw)
+{
+	git_reftable_writer *writer = tw->writer;
+	git_buf value = GIT_BUF_INIT;
+	git_reftable_ref *ref, *prev = NULL;
+	uint64_t ref_pos;
+	size_t i;
+	int error = 0;
+
+	block_start(tw, BLOCK_TYPE_REF, writer->opts.block_size);
+
+	git_vector_foreach(&writer->refs, i, ref) {
+		if (prev && strcmp(prev->name, ref->name) == 0) {
+			git_error_set(GIT_ERROR_REFERENCE,
+				"duplicate reference '%s' in reftable", ref->name);
+			error = -1;
+			goto done;
+		}
+
+		if ((error = write_ref_value(&value, writer, ref)) < 0 ||
+		    (error = section_add(tw, ref->name, strlen(ref->name), ref->type, &value)) < 0)
+			goto done;
+
+		/* the block that the reference went into is only known now */
+		if (writer->opts.index_objects && ref->type != GIT_REFTABLE_DELETION &&
+		    ref->type != GIT_REFTABLE_SYMREF) {
+			uint64_t pos = tw->block.start ? tw->out->size + tw->padding : 0;
+
+			if ((error = add_obj_entry(objs, &ref->oid, pos)) < 0 ||
+			    (ref->type == GIT_REFTABLE_VAL2 &&
+			     (error = add_obj_entry(objs, &ref->peel, pos)) < 0))
+				goto done;
+		}
+
+		prev = ref;
+	}
+
+	error = section_finish(&ref_pos, index_pos, tw);
+
+done:
+	git_buf_dispose(&value);
+	return error;
+}
+
+/* The shortest prefix length that tells all of the objects apart */
+static uint8_t obj_id_len(obj_entries *objs)
+{
+	size_t i, len = 2, common;
+
+	for (i = 1; i < git_array_size(*objs); i++) {
+		const git_oid *a = &git_array_get(*objs, i - 1)->id;
+		const git_oid *b = &git_array_get(*objs, i)->id;
+
+		if (git_oid_equal(a, b))
+			continue;
+
+		for (common = 0; a->id[common] == b->id[common]; common++)
+			;
+
+		len = max(len, common + 1);
+	}
+
+	return (uint8_t)len;
+}
+
+static int write_objs(
+	uint64_t *obj_pos,
+	uint8_t *id_len,
+	uint64_t *index_pos,
+	obj_entries *objs,
+	table_writer *tw)
+{
+	git_buf value = GIT_BUF_INIT;
+	obj_entry *entry, *last;
+	size_t i, j, count;
+	int error = 0;
+
+	*obj_pos = *index_pos = 0;
+	*id_len = 0;
+
+	if (!git_array_size(*objs))
+		return 0;
+
+	qsort(objs->ptr, git_array_size(*objs), sizeof(obj_entry), obj_entry_cmp);
+
+	*id_len = obj_id_len(objs);
+
+	block_start(tw, BLOCK_TYPE_OBJ, tw->writer->opts.block_size);
+
+	for (i = 0; i < git_array_size(*objs); i = j) {
+		entry = git_array_get(*objs, i);
+
+		/* count the distinct blocks that the object is in */
+		for (j = i, count = 0, last = NULL; j < git_array_size(*objs); j++) {
+			obj_entry *e = git_array_get(*objs, j);
+
+			if (!git_oid_equal(&e->id, &entry->id))
+				break;
+			if (!last || last->pos != e->pos)
+				count++;
+			last = e;
+		}
+
+		git_buf_clear(&value);
+
+		if (count > 7)
+			put_varint(&value, count);
+
+		for (last = NULL; i < j; i++) {
+			obj_entry *e = git_array_get(*objs, i);
+
+			if (last && last->pos == e->pos)
+				continue;
+
+			put_varint(&value, last ? e->pos - last->pos : e->pos);
+			last = e;
+		}
+
+		if (git_buf_oom(&value) ||
+		    (error = section_add(tw, (const char *)entry->id.id, *id_len,
+			(uint8_t)(count > 7 ? 0 : count), &value)) < 0)
+			goto done;
+	}
+
+	error = section_finish(obj_pos, index_pos, tw);
+
+done:
+	git_buf_dispose(&value);
+	return error;
+}
+
+static int write_log_value(git_buf *value, const git_reftable_log *log)
+{
+	git_buf_clear(value);
+
+	if (log->deletion)
+		return 0;
+
+	git_buf_put(value, (const char *)log->old_id.id, GIT_OID_RAWSZ);
+	git_buf_put(value, (const char *)log->new_id.id, GIT_OID_RAWSZ);
+	put_varint(value, strlen(log->name));
+	git_buf_puts(value, log->name);
+	put_varint(value, strlen(log->email));
+	git_buf_puts(value, log->email);
+	put_varint(value, log->time);
+	put_be(value, (uint16_t)log->tz_offset, 2);
+	put_varint(value, strlen(log->message));
+	git_buf_puts(value, log->message);
+
+	return git_buf_oom(value) ? -1 : 0;
+}
+
+static int write_logs(uint64_t *log_pos, uint64_t *index_pos, table_writer *tw)
+{
+	git_reftable_writer *writer = tw->writer;
+	git_buf value = GIT_BUF_INIT;
+	writer_log *log, *prev = NULL;
+	size_t i;
+	int error = 0;
+
+	*log_pos = *index_pos = 0;
+
+	if (!writer->logs.length)
+		return 0;
+
+	block_start(tw, BLOCK_TYPE_LOG, writer->opts.block_size);
+
+	git_vector_foreach(&writer->logs, i, log) {
+		if (prev && writer_log_cmp(prev, log) == 0) {
+			git_error_set(GIT_ERROR_REFERENCE,
+				"duplicate reflog entry for '%s' in reftable", log->log.refname);
+			error = -1;
+			goto done;
+		}
+
+		if ((error = write_log_value(&value, &log->log)) < 0 ||
+		    (error = section_add(tw, log->key.ptr, log->key.size,
+			log->log.deletion ? 0 : 1, &value)) < 0)
+			goto done;
+
+		prev = log;
+	}
+
+	error = section_finish(log_pos, index_pos, tw);
+
+done:
+	git_buf_dispose(&value);
+	return error;
+}
+
+static int write_header(git_buf *out, git_reftable_writer *writer)
+{
+	git_buf_puts(out, REFTABLE_MAGIC);
+	git_buf_putc(out, GIT_REFTABLE_VERSION);
+	put_be(out, writer->opts.block_size, 3);
+	put_be(out, writer->opts.min_update_index, 8);
+	put_be(out, writer->opts.max_update_index, 8);
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+int git_reftable_writer_finish(git_buf *out, git_reftable_writer *writer)
+{
+	table_writer tw = { 0 };
+	obj_entries objs = GIT_ARRAY_INIT;
+	uint64_t ref_index_pos, obj_pos, obj_index_pos, log_pos, log_index_pos;
+	uint8_t id_len;
+	size_t footer;
+	int error;
+
+	tw.writer = writer;
+	tw.out = out;
+
+	git_vector_sort(&writer->refs);
+	git_vector_sort(&writer->logs);
+
+	git_buf_clear(out);
+
+	if ((error = write_header(out, writer)) < 0 ||
+	    (error = write_refs(&objs, &ref_index_pos, &tw)) < 0 ||
+	    (error = write_objs(&obj_pos, &id_len, &obj_index_pos, &objs, &tw)) < 0 ||
+	    (error = write_logs(&log_pos, &log_index_pos, &tw)) < 0)
+		goto done;
+
+	footer = out->size;
+
+	if ((error = write_header(out, writer)) < 0)
+		goto done;
+
+	put_be(out, ref_index_pos, 8);
+	put_be(out, (obj_pos << 5) | id_len, 8);
+	put_be(out, obj_index_pos, 8);
+	put_be(out, log_pos, 8);
+	put_be(out, log_index_pos, 8);
+
+	if (git_buf_oom(out)) {
+		error = -1;
+		goto done;
+	}
+
+	error = put_be(out, crc32(0, (const Bytef *)out->ptr + footer, (uInt)(out->size - footer)), 4);
+
+done:
+	git_array_clear(objs);
+	git_array_clear(tw.index);
+	git_array_clear(tw.block.restarts);
+	git_buf_dispose(&tw.block.records);
+	git_buf_dispose(&tw.block.last_key);
+	git_buf_dispose(&tw.record);
+	return error;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_reftable_h__
+#define INCLUDE_reftable_h__
+
+#include "common.h"
+
+#include "git2/oid.h"
+
+#include "buffer.h"
+#include "map.h"
+
+/*
+ * A reftable is an immutable file of references and reflog entries,
+ * sorted by name and grouped in blocks.  Within a block, the names are
+ * prefix compressed, and every few records a "restart point" holds a
+ * whole name, so that a block can be binary searched.  Index blocks
+ * point to the block that holds a name, so that a lookup reads a couple
+ * of blocks, however many references the table holds.  An optional
+ * object index maps object ids to the blocks of the references that
+ * point to them.
+ *
+ * This is the format that git documents in `reftable.txt`, version 1,
+ * for SHA-1 object ids.
+ */
+
+#define GIT_REFTABLE_VERSION 1
+#define GIT_REFTABLE_BLOCK_SIZE 4096
+#define GIT_REFTABLE_RESTART_INTERVAL 16
+
+#define GIT_REFTABLE_HEADER_SIZE 24
+#define GIT_REFTABLE_FOOTER_SIZE 68
+
+typedef enum {
+	GIT_REFTABLE_DELETION = 0,
+	GIT_REFTABLE_VAL1 = 1,
+	GIT_REFTABLE_VAL2 = 2,
+	GIT_REFTABLE_SYMREF = 3,
+} git_reftable_value_t;
+
+/* A reference record; a deletion hides the records of older tables */
+typedef struct {
+	const char *name;
+	uint64_t update_index;
+	git_reftable_value_t type;
+	git_oid oid; /* VAL1 and VAL2 */
+	git_oid peel; /* VAL2 */
+	const char *target; /* SYMREF */
+} git_reftable_ref;
+
+/* A reflog record; a deletion hides the entry of older tables */
+typedef struct {
+	const char *refname;
+	uint64_t update_index;
+	bool deletion;
+	git_oid old_id;
+	git_oid new_id;
+	const char *name;
+	const char *email;
+	uint64_t time;
+	int16_t tz_offset; /* in minutes */
+	const char *message;
+} git_reftable_log;
+
+typedef struct git_reftable git_reftable;
+
+/** Map the table at `path`. */
+extern int git_reftable_open(git_reftable **out, const char *path);
+
+extern void git_reftable_incref(git_reftable *table);
+extern void git_reftable_free(git_reftable *table);
+
+extern const char *git_reftable_path(const git_reftable *table);
+extern size_t git_reftable_size(const git_reftable *table);
+extern uint64_t git_reftable_min_update_index(const git_reftable *table);
+extern uint64_t git_reftable_max_update_index(const git_reftable *table);
+
+/*
+ * A cursor over the reference or the reflog records of a table.  The
+ * strings of the records that it returns are valid until it moves.
+ */
+typedef struct {
+	git_reftable *table;
+	char type;
+
+	const unsigned char *block;
+	size_t block_start;
+	size_t block_len;
+	size_t next_block;
+	size_t section_end;
+	git_buf inflated;
+
+	size_t pos;
+	size_t records_end;
+
+	git_buf key;
+	git_buf scratch;
+	git_buf value;
+} git_reftable_iter;
+
+#define GIT_REFTABLE_ITER_INIT \
+	{ NULL, 0, NULL, 0, 0, 0, 0, GIT_BUF_INIT, 0, 0, GIT_BUF_INIT, GIT_BUF_INIT, GIT_BUF_INIT }
+
+/**
+ * Position the cursor on the first reference whose name is not before
+ * `name`; an empty name starts with the first reference of the table.
+ */
+extern int git_reftable_seek_ref(
+	git_reftable_iter *iter, git_reftable *table, const char *name);
+
+/** Read the next reference, or return GIT_ITEROVER. */
+extern int git_reftable_next_ref(git_reftable_ref *out, git_reftable_iter *iter);
+
+/**
+ * Position the cursor on the newest reflog entry of `refname` whose update
+ * index is at most `update_index`; an empty name starts with the first
+ * entry of the table.
+ */
+extern int git_reftable_seek_log(
+	git_reftable_iter *iter,
+	git_reftable *table,
+	const char *refname,
+	uint64_t update_index);
+
+/** Read the next reflog entry, or return GIT_ITEROVER. */
+extern int git_reftable_next_log(git_reftable_log *out, git_reftable_iter *iter);
+
+extern void git_reftable_iter_dispose(git_reftable_iter *iter);
+
+typedef int (*git_reftable_ref_cb)(const git_reftable_ref *ref, void *payload);
+
+/**
+ * Call `cb` with the references of the table that point to `id`, or that
+ * peel to it, including the deletions of the references that used to.
+ * When the table has an object index, only the blocks that it lists for
+ * the object are read.
+ */
+extern int git_reftable_refs_to(
+	git_reftable *table,
+	const git_oid *id,
+	git_reftable_ref_cb cb,
+	void *payload);
+
+typedef struct {
+	uint32_t block_size;
+	uint16_t restart_interval;
+	bool index_objects;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+} git_reftable_writer_options;
+
+#define GIT_REFTABLE_WRITER_OPTIONS_INIT \
+	{ GIT_REFTABLE_BLOCK_SIZE, GIT_REFTABLE_RESTART_INTERVAL, true, 0, 0 }
+
+typedef struct git_reftable_writer git_reftable_writer;
+
+extern int git_reftable_writer_new(
+	git_reftable_writer **out, const git_reftable_writer_options *opts);
+
+/*
+ * Add a record to the table.  Records may be added in any order, but a
+ * reference may only be added once, as may a reflog entry.
+ */
+extern int git_reftable_writer_add_ref(
+	git_reftable_writer *writer, const git_reftable_ref *ref);
+extern int git_reftable_writer_add_log(
+	git_reftable_writer *writer, const git_reftable_log *log);
+
+/** Whether no record was added. */
+extern bool git_reftable_writer_empty(git_reftable_writer *writer);
+
+/** Write out the table. */
+extern int git_reftable_writer_finish(git_buf *out, git_reftable_writer *writer);
+
+extern void git_reftable_writer_free(git_reftable_writer *writer);
+
+#endif
@@ -165,6 +165,9 @@ void git_repository_free(git_repository *repo)
 	git_diff_driver_registry_free(repo->diff_drivers);
 	repo->diff_drivers = NULL;
 
+	git_sigcache_free(repo->sigcache);
+	repo->sigcache = NULL;
+
 	for (i = 0; i < repo->reserved_names.size; i++)
 		git_buf_dispose(git_array_get(repo->reserved_names, i));
 	git_array_clear(repo->reserved_names);
@@ -1212,6 +1215,45 @@ void git_repository_set_index(git_repository *repo, git_index *index)
 	set_index(repo, index);
 }
 
+void git_repository_set_fsmonitor(
+	git_repository *repo, git_fsmonitor_cb cb, void *payload)
+{
+	assert(repo);
+
+	repo->fsmonitor_cb = cb;
+	repo->fsmonitor_payload = payload;
+}
+
+int git_repository_set_sigcache(
+	git_repository *repo, size_t max_size, const char *path)
+{
+	git_sigcache *cache = NULL;
+	int error;
+
+	assert(repo);
+
+	if (max_size && (error = git_sigcache_new(&cache, max_size, path)) < 0)
+		return error;
+
+	git_sigcache_free(repo->sigcache);
+	repo->sigcache = cache;
+
+	return 0;
+}
+
+int git_repository_sigcache_write(git_repository *repo)
+{
+	assert(repo);
+
+	if (!repo->sigcache) {
+		git_error_set(GIT_ERROR_REPOSITORY,
+			"the repository has no similarity signature cache");
+		return -1;
+	}
+
+	return git_sigcache_write(repo->sigcache);
+}
+
 int git_repository_set_namespace(git_repository *repo, const char *namespace)
 {
 	git__free(repo->namespace);
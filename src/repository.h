@@ -15,6 +15,7 @@
 #include "git2/repository.h"
 #include "git2/object.h"
 #include "git2/config.h"
+#include "git2/sys/repository.h"
 
 #include "array.h"
 #include "cache.h"
@@ -24,6 +25,7 @@
 #include "attrcache.h"
 #include "submodule.h"
 #include "diff_driver.h"
+#include "sigcache.h"
 
 #define DOT_GIT ".git"
 #define GIT_DIR DOT_GIT "/"
@@ -51,6 +53,10 @@ typedef enum {
 	GIT_CVAR_PROTECTHFS,    /* core.protectHFS */
 	GIT_CVAR_PROTECTNTFS,   /* core.protectNTFS */
 	GIT_CVAR_FSYNCOBJECTFILES, /* core.fsyncObjectFiles */
+	GIT_CVAR_INDEXTHREADS,  /* index.threads */
+	GIT_CVAR_INDEXRECORDEOIE, /* index.recordEndOfIndexEntries */
+	GIT_CVAR_INDEXRECORDIEOT, /* index.recordOffsetTable */
+	GIT_CVAR_UNTRACKEDCACHE, /* core.untrackedCache */
 	GIT_CVAR_CACHE_MAX
 } git_cvar_cached;
 
@@ -116,6 +122,18 @@ typedef enum {
 	GIT_PROTECTNTFS_DEFAULT = GIT_CVAR_FALSE,
 	/* core.fsyncObjectFiles */
 	GIT_FSYNCOBJECTFILES_DEFAULT = GIT_CVAR_FALSE,
+	/* index.threads: false, true (one per CPU) or a number */
+	GIT_INDEXTHREADS_AUTO = 0,
+	GIT_INDEXTHREADS_UNSET = -2,
+	GIT_INDEXTHREADS_DEFAULT = GIT_INDEXTHREADS_UNSET,
+	/* index.recordEndOfIndexEntries, index.recordOffsetTable */
+	GIT_INDEXRECORD_UNSET = 2,
+	GIT_INDEXRECORD_DEFAULT = GIT_INDEXRECORD_UNSET,
+	/* core.untrackedCache: false, true, 'keep' */
+	GIT_UNTRACKEDCACHE_FALSE = 0,
+	GIT_UNTRACKEDCACHE_TRUE = 1,
+	GIT_UNTRACKEDCACHE_KEEP = 2,
+	GIT_UNTRACKEDCACHE_DEFAULT = GIT_UNTRACKEDCACHE_KEEP,
 } git_cvar_value;
 
 /* internal repository init flags */
@@ -156,6 +174,11 @@ struct git_repository {
 
 	git_cvar_value cvar_cache[GIT_CVAR_CACHE_MAX];
 	git_strmap *submodule_cache;
+
+	git_fsmonitor_cb fsmonitor_cb;
+	void *fsmonitor_payload;
+
+	git_sigcache *sigcache;
 };
 
 GIT_INLINE(git_attr_cache *) git_repository_attr_cache(git_repository *repo)
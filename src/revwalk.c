@@ -385,8 +385,28 @@ static int add_parents_to_list(git_revwalk *walk, git_commit_list_node *commit,
 /* How many unintersting commits we want to look at after we run out of interesting ones */
 #define SLOP 5
 
-static int still_interesting(git_commit_list *list, int64_t time, int slop)
+/*
+ * Whether the uninteresting commits left in `list` may still reach one of
+ * the interesting commits that we have already emitted; the oldest of
+ * those has a generation number of `generation`. A commit can only reach
+ * commits with a lower generation number than its own, and we can only
+ * tell that when every one of them has a generation number.
+ */
+static int may_reach_emitted(git_commit_list *list, uint32_t generation)
 {
+	for (; list; list = list->next) {
+		if (list->item->generation == GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY ||
+		    list->item->generation > generation)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int still_interesting(git_commit_list *list, int64_t time, uint32_t generation, int slop)
+{
+	git_commit_list *l;
+
 	/* The empty list is pretty boring */
 	if (!list)
 		return 0;
@@ -398,16 +418,23 @@ static int still_interesting(git_commit_list *list, int64_t time, int slop)
 	if (time <= list->item->time)
 		return SLOP;
 
-	for (; list; list = list->next) {
+	for (l = list; l; l = l->next) {
 		/*
 		 * If the destination list still contains interesting commits we
 		 * want to continue looking.
 		 */
-		if (!list->item->uninteresting || list->item->time > time)
+		if (!l->item->uninteresting || l->item->time > time)
 			return SLOP;
 	}
 
-	/* Everything's uninteresting, reduce the count */
+	/*
+	 * Everything's uninteresting. If the generation numbers tell us that
+	 * none of it can reach what we have emitted, we're done; otherwise
+	 * the dates may be skewed, so reduce the count.
+	 */
+	if (!may_reach_emitted(list, generation))
+		return 0;
+
 	return slop - 1;
 }
 
@@ -415,6 +442,7 @@ static int limit_list(git_commit_list **out, git_revwalk *walk, git_commit_list
 {
 	int error, slop = SLOP;
 	int64_t time = INT64_MAX;
+	uint32_t generation = GIT_COMMIT_GRAPH_GENERATION_NUMBER_INFINITY;
 	git_commit_list *list = commits;
 	git_commit_list *newlist = NULL;
 	git_commit_list **p = &newlist;
@@ -428,7 +456,7 @@ static int limit_list(git_commit_list **out, git_revwalk *walk, git_commit_list
 		if (commit->uninteresting) {
 			mark_parents_uninteresting(commit);
 
-			slop = still_interesting(list, time, slop);
+			slop = still_interesting(list, time, generation, slop);
 			if (slop)
 				continue;
 
@@ -439,6 +467,8 @@ static int limit_list(git_commit_list **out, git_revwalk *walk, git_commit_list
 			continue;
 
 		time = commit->time;
+		if (commit->generation < generation)
+			generation = commit->generation;
 		p = &git_commit_list_insert(commit, p)->next;
 	}
 
@@ -656,6 +686,7 @@ void git_revwalk_free(git_revwalk *walk)
 		return;
 
 	git_revwalk_reset(walk);
+	git_commit_graph_file_release(walk->cgraph_file);
 	git_odb_free(walk->odb);
 
 	git_oidmap_free(walk->commits);
@@ -25,6 +25,10 @@ struct git_revwalk {
 	git_oidmap *commits;
 	git_pool commit_pool;
 
+	/* the commit-graph that commits are parsed from, looked up once */
+	git_commit_graph_file *cgraph_file;
+	unsigned cgraph_checked:1;
+
 	git_commit_list *iterator_topo;
 	git_commit_list *iterator_rand;
 	git_commit_list *iterator_reverse;
@@ -22,7 +22,9 @@
 #include "global.h"
 #include "object.h"
 #include "odb.h"
+#include "pack-cache.h"
 #include "refs.h"
+#include "refdb_fs.h"
 #include "index.h"
 #include "transports/smart.h"
 #include "streams/openssl.h"
@@ -284,6 +286,65 @@ int git_libgit2_opts(int key, ...)
 		git_disable_pack_keep_file_checks = (va_arg(ap, int) != 0);
 		break;
 
+	case GIT_OPT_SET_CACHE_TYPE_MAX_SIZE:
+		{
+			git_object_t type = (git_object_t)va_arg(ap, int);
+			ssize_t size = va_arg(ap, ssize_t);
+			error = git_cache_set_max_type_storage(type, size);
+			break;
+		}
+
+	case GIT_OPT_GET_CACHED_TYPE_MEMORY:
+		{
+			git_object_t type = (git_object_t)va_arg(ap, int);
+			ssize_t *current = va_arg(ap, ssize_t *);
+			ssize_t *allowed = va_arg(ap, ssize_t *);
+			error = git_cache_get_type_storage(current, allowed, type);
+			break;
+		}
+
+	case GIT_OPT_GET_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+			git_cache_get_stats(hits, misses, evictions);
+			break;
+		}
+
+	case GIT_OPT_RESET_CACHE_STATS:
+		git_cache_reset_stats();
+		break;
+
+	case GIT_OPT_ENABLE_PACKED_REFS_MMAP:
+		git_refdb_fs__packed_refs_mmap = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE:
+		git_pack_cache__max_size = va_arg(ap, size_t);
+		break;
+
+	case GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY:
+		{
+			size_t *current = va_arg(ap, size_t *);
+			size_t *allowed = va_arg(ap, size_t *);
+			git_pack_cache_get_memory(current, allowed);
+			break;
+		}
+
+	case GIT_OPT_GET_DELTA_BASE_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *saved = va_arg(ap, size_t *);
+			git_pack_cache_get_stats(hits, misses, saved);
+			break;
+		}
+
+	case GIT_OPT_RESET_DELTA_BASE_CACHE_STATS:
+		git_pack_cache_reset_stats();
+		break;
+
 	default:
 		git_error_set(GIT_ERROR_INVALID, "invalid option key");
 		error = -1;
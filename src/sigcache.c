@@ -0,0 +1,470 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "sigcache.h"
+
+#include "filebuf.h"
+#include "fileops.h"
+#include "hash.h"
+#include "oidmap.h"
+
+/*
+ * The file starts with a signature, a version and the number of entries,
+ * from the least recently used one to the most recently used one, and
+ * ends with the SHA-1 of everything before.  The entries have the id of
+ * the blob, the options of the signature, the size of the blob and the
+ * length of the signature, and then the signature.  All numbers are in
+ * network byte order.
+ */
+#define SIGCACHE_SIGNATURE "SIGC"
+#define SIGCACHE_VERSION 1
+#define SIGCACHE_HEADER_SIZE 12
+#define SIGCACHE_ENTRY_HEADER_SIZE (GIT_OID_RAWSZ + 4 + 8 + 4)
+
+typedef struct sigcache_entry {
+	git_oid id;
+	uint32_t opts;
+	uint64_t blob_size;
+
+	/* the entry of the same blob with other options */
+	struct sigcache_entry *next;
+
+	/* the entries that were used right after and right before this one */
+	struct sigcache_entry *newer, *older;
+
+	size_t len;
+	unsigned char data[GIT_FLEX_ARRAY];
+} sigcache_entry;
+
+struct git_sigcache {
+	git_mutex lock;
+	git_oidmap *map;
+	sigcache_entry *newest, *oldest;
+	size_t used;
+	size_t max_size;
+	char *path;
+};
+
+GIT_INLINE(size_t) entry_size(sigcache_entry *entry)
+{
+	return sizeof(sigcache_entry) + entry->len;
+}
+
+static sigcache_entry *entry_new(
+	const git_oid *id,
+	uint32_t opts,
+	uint64_t blob_size,
+	const unsigned char *data,
+	size_t len)
+{
+	sigcache_entry *entry;
+	size_t alloclen;
+
+	if (GIT_ADD_SIZET_OVERFLOW(&alloclen, sizeof(sigcache_entry), len) ||
+		(entry = git__calloc(1, alloclen)) == NULL)
+		return NULL;
+
+	git_oid_cpy(&entry->id, id);
+	entry->opts = opts;
+	entry->blob_size = blob_size;
+	entry->len = len;
+	memcpy(entry->data, data, len);
+
+	return entry;
+}
+
+static sigcache_entry *entry_find(
+	git_sigcache *cache, const git_oid *id, uint32_t opts)
+{
+	sigcache_entry *entry = git_oidmap_get(cache->map, id);
+
+	while (entry && entry->opts != opts)
+		entry = entry->next;
+
+	return entry;
+}
+
+static void lru_unlink(git_sigcache *cache, sigcache_entry *entry)
+{
+	if (entry->newer)
+		entry->newer->older = entry->older;
+	else
+		cache->newest = entry->older;
+
+	if (entry->older)
+		entry->older->newer = entry->newer;
+	else
+		cache->oldest = entry->newer;
+
+	entry->newer = entry->older = NULL;
+}
+
+static void lru_push(git_sigcache *cache, sigcache_entry *entry)
+{
+	entry->older = cache->newest;
+	entry->newer = NULL;
+
+	if (cache->newest)
+		cache->newest->newer = entry;
+	else
+		cache->oldest = entry;
+
+	cache->newest = entry;
+}
+
+static void entry_remove(git_sigcache *cache, sigcache_entry *entry)
+{
+	sigcache_entry *head = git_oidmap_get(cache->map, &entry->id), *prev;
+
+	/* the map's key is the id of the first entry of the blob */
+	if (head == entry) {
+		if (entry->next)
+			git_oidmap_set(cache->map, &entry->next->id, entry->next);
+		else
+			git_oidmap_delete(cache->map, &entry->id);
+	} else {
+		for (prev = head; prev->next != entry; prev = prev->next)
+			/* find it */;
+		prev->next = entry->next;
+	}
+
+	lru_unlink(cache, entry);
+
+	cache->used -= entry_size(entry);
+	git__free(entry);
+}
+
+/* Add an entry as the most recently used one; the cache must be locked */
+static int entry_insert(git_sigcache *cache, sigcache_entry *entry)
+{
+	sigcache_entry *existing, *head;
+
+	if ((existing = entry_find(cache, &entry->id, entry->opts)) != NULL)
+		entry_remove(cache, existing);
+
+	if (entry_size(entry) > cache->max_size) {
+		git__free(entry);
+		return 0;
+	}
+
+	if ((head = git_oidmap_get(cache->map, &entry->id)) != NULL) {
+		entry->next = head->next;
+		head->next = entry;
+	} else if (git_oidmap_set(cache->map, &entry->id, entry) < 0) {
+		git__free(entry);
+		return -1;
+	}
+
+	lru_push(cache, entry);
+	cache->used += entry_size(entry);
+
+	while (cache->used > cache->max_size)
+		entry_remove(cache, cache->oldest);
+
+	return 0;
+}
+
+GIT_INLINE(uint32_t) get_uint32(const unsigned char *data)
+{
+	uint32_t v;
+	memcpy(&v, data, sizeof(v));
+	return ntohl(v);
+}
+
+GIT_INLINE(void) put_uint32(git_buf *out, uint32_t value)
+{
+	uint32_t v = htonl(value);
+	git_buf_put(out, (const char *)&v, sizeof(v));
+}
+
+static int sigcache_error(const char *message)
+{
+	git_error_set(GIT_ERROR_INVALID,
+		"corrupt similarity signature cache: %s", message);
+	return -1;
+}
+
+static int sigcache_read(git_sigcache *cache)
+{
+	git_buf buf = GIT_BUF_INIT;
+	const unsigned char *data, *end;
+	sigcache_entry *entry;
+	git_oid checksum, id;
+	uint32_t count, i, opts, len;
+	uint64_t blob_size;
+	int error;
+
+	if ((error = git_futils_readbuffer(&buf, cache->path)) < 0) {
+		/* there is nothing cached yet */
+		if (error == GIT_ENOTFOUND) {
+			git_error_clear();
+			error = 0;
+		}
+
+		return error;
+	}
+
+	data = (const unsigned char *)buf.ptr;
+
+	if (buf.size < SIGCACHE_HEADER_SIZE + GIT_OID_RAWSZ ||
+		memcmp(data, SIGCACHE_SIGNATURE, 4) != 0) {
+		error = sigcache_error("bad header");
+		goto done;
+	}
+
+	/* the signatures of other versions may not be comparable */
+	if (get_uint32(data + 4) != SIGCACHE_VERSION)
+		goto done;
+
+	end = data + buf.size - GIT_OID_RAWSZ;
+
+	if ((error = git_hash_buf(&checksum, data, end - data)) < 0)
+		goto done;
+
+	if (memcmp(checksum.id, end, GIT_OID_RAWSZ) != 0) {
+		error = sigcache_error("checksum mismatch");
+		goto done;
+	}
+
+	count = get_uint32(data + 8);
+	data += SIGCACHE_HEADER_SIZE;
+
+	for (i = 0; i < count; i++) {
+		if ((size_t)(end - data) < SIGCACHE_ENTRY_HEADER_SIZE) {
+			error = sigcache_error("truncated entry");
+			goto done;
+		}
+
+		git_oid_fromraw(&id, data);
+		data += GIT_OID_RAWSZ;
+		opts = get_uint32(data);
+		blob_size = ((uint64_t)get_uint32(data + 4) << 32) | get_uint32(data + 8);
+		len = get_uint32(data + 12);
+		data += 16;
+
+		if ((size_t)(end - data) < len) {
+			error = sigcache_error("truncated entry");
+			goto done;
+		}
+
+		if ((entry = entry_new(&id, opts, blob_size, data, len)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		data += len;
+
+		if ((error = entry_insert(cache, entry)) < 0)
+			goto done;
+	}
+
+	if (data != end)
+		error = sigcache_error("trailing data");
+
+done:
+	git_buf_dispose(&buf);
+	return error;
+}
+
+int git_sigcache_new(git_sigcache **out, size_t max_size, const char *path)
+{
+	git_sigcache *cache;
+	int error;
+
+	assert(out);
+
+	cache = git__calloc(1, sizeof(git_sigcache));
+	GIT_ERROR_CHECK_ALLOC(cache);
+
+	cache->max_size = max_size;
+
+	if (git_mutex_init(&cache->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize lock");
+		git__free(cache);
+		return -1;
+	}
+
+	if ((error = git_oidmap_new(&cache->map)) < 0)
+		goto on_error;
+
+	if (path) {
+		if ((cache->path = git__strdup(path)) == NULL ||
+			(error = sigcache_read(cache)) < 0) {
+			error = -1;
+			goto on_error;
+		}
+	}
+
+	*out = cache;
+	return 0;
+
+on_error:
+	git_sigcache_free(cache);
+	return error;
+}
+
+void git_sigcache_free(git_sigcache *cache)
+{
+	sigcache_entry *entry, *older;
+
+	if (!cache)
+		return;
+
+	for (entry = cache->newest; entry; entry = older) {
+		older = entry->older;
+		git__free(entry);
+	}
+
+	git_oidmap_free(cache->map);
+	git_mutex_free(&cache->lock);
+	git__free(cache->path);
+	git__free(cache);
+}
+
+int git_sigcache_get(
+	git_hashsig **out,
+	git_off_t *blob_size,
+	git_sigcache *cache,
+	const git_oid *id,
+	git_hashsig_option_t opts)
+{
+	sigcache_entry *entry;
+	int error;
+
+	assert(out && blob_size && cache && id);
+
+	if (git_mutex_lock(&cache->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "unable to lock similarity signature cache");
+		return -1;
+	}
+
+	if ((entry = entry_find(cache, id, (uint32_t)opts)) == NULL) {
+		git_mutex_unlock(&cache->lock);
+		return GIT_ENOTFOUND;
+	}
+
+	lru_unlink(cache, entry);
+	lru_push(cache, entry);
+
+	*blob_size = (git_off_t)entry->blob_size;
+	error = git_hashsig__read(out, entry->data, entry->len, opts);
+
+	git_mutex_unlock(&cache->lock);
+	return error;
+}
+
+int git_sigcache_put(
+	git_sigcache *cache,
+	const git_oid *id,
+	git_hashsig_option_t opts,
+	git_off_t blob_size,
+	const git_hashsig *sig)
+{
+	git_buf data = GIT_BUF_INIT;
+	sigcache_entry *entry = NULL;
+	int error;
+
+	assert(cache && id && sig);
+
+	if ((error = git_hashsig__write(&data, sig)) < 0)
+		goto done;
+
+	entry = entry_new(id, (uint32_t)opts, (uint64_t)blob_size,
+		(const unsigned char *)data.ptr, data.size);
+
+	if (!entry) {
+		error = -1;
+		goto done;
+	}
+
+	if (git_mutex_lock(&cache->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "unable to lock similarity signature cache");
+		git__free(entry);
+		error = -1;
+		goto done;
+	}
+
+	error = entry_insert(cache, entry);
+	git_mutex_unlock(&cache->lock);
+
+done:
+	git_buf_dispose(&data);
+	return error;
+}
+
+size_t git_sigcache_size(git_sigcache *cache)
+{
+	size_t used;
+
+	assert(cache);
+
+	git_mutex_lock(&cache->lock);
+	used = cache->used;
+	git_mutex_unlock(&cache->lock);
+
+	return used;
+}
+
+int git_sigcache_write(git_sigcache *cache)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf buf = GIT_BUF_INIT;
+	sigcache_entry *entry;
+	git_oid checksum;
+	uint32_t count = 0;
+	int error;
+
+	assert(cache);
+
+	if (!cache->path) {
+		git_error_set(GIT_ERROR_INVALID,
+			"the similarity signature cache has no file to write to");
+		return -1;
+	}
+
+	if (git_mutex_lock(&cache->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "unable to lock similarity signature cache");
+		return -1;
+	}
+
+	git_buf_put(&buf, SIGCACHE_SIGNATURE, 4);
+	put_uint32(&buf, SIGCACHE_VERSION);
+	put_uint32(&buf, 0);
+
+	for (entry = cache->oldest; entry; entry = entry->newer) {
+		git_buf_put(&buf, (const char *)entry->id.id, GIT_OID_RAWSZ);
+		put_uint32(&buf, entry->opts);
+		put_uint32(&buf, (uint32_t)(entry->blob_size >> 32));
+		put_uint32(&buf, (uint32_t)entry->blob_size);
+		put_uint32(&buf, (uint32_t)entry->len);
+		git_buf_put(&buf, (const char *)entry->data, entry->len);
+		count++;
+	}
+
+	git_mutex_unlock(&cache->lock);
+
+	if (git_buf_oom(&buf)) {
+		error = -1;
+		goto done;
+	}
+
+	count = htonl(count);
+	memcpy(buf.ptr + 8, &count, sizeof(count));
+
+	if ((error = git_hash_buf(&checksum, buf.ptr, buf.size)) < 0 ||
+		(error = git_buf_put(&buf, (const char *)checksum.id, GIT_OID_RAWSZ)) < 0)
+		goto done;
+
+	if ((error = git_filebuf_open(&file, cache->path, 0, GIT_SIGCACHE_FILE_MODE)) == 0 &&
+		(error = git_filebuf_write(&file, buf.ptr, buf.size)) == 0)
+		error = git_filebuf_commit(&file);
+
+done:
+	git_filebuf_cleanup(&file);
+	git_buf_dispose(&buf);
+	return error;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sigcache_h__
+#define INCLUDE_sigcache_h__
+
+#include "common.h"
+
+#include "hashsig.h"
+#include "git2/oid.h"
+
+/*
+ * The signature cache remembers the similarity signatures of blobs, by
+ * the id of the blob and the options that the signature was computed
+ * with, so that finding renames again does not read and hash the same
+ * blobs again.  It holds signatures up to a number of bytes, forgetting
+ * the ones that were used the longest ago, and it can be written to a
+ * file that a later process reads it back from.
+ */
+typedef struct git_sigcache git_sigcache;
+
+#define GIT_SIGCACHE_FILE_MODE 0644
+
+/*
+ * Create a cache of up to `max_size` bytes of signatures.  With a path,
+ * the signatures that a file there holds are read, and the cache can be
+ * written there with `git_sigcache_write`.
+ */
+extern int git_sigcache_new(
+	git_sigcache **out, size_t max_size, const char *path);
+
+extern void git_sigcache_free(git_sigcache *cache);
+
+/*
+ * Look up the signature of a blob, and the size of the blob; returns
+ * GIT_ENOTFOUND (without setting an error) when it is not cached.
+ */
+extern int git_sigcache_get(
+	git_hashsig **out,
+	git_off_t *blob_size,
+	git_sigcache *cache,
+	const git_oid *id,
+	git_hashsig_option_t opts);
+
+extern int git_sigcache_put(
+	git_sigcache *cache,
+	const git_oid *id,
+	git_hashsig_option_t opts,
+	git_off_t blob_size,
+	const git_hashsig *sig);
+
+/* The bytes of signatures that the cache holds */
+extern size_t git_sigcache_size(git_sigcache *cache);
+
+extern int git_sigcache_write(git_sigcache *cache);
+
+#endif
@@ -152,7 +152,8 @@ GIT_INLINE(int) git_mutex_lock(git_mutex *mutex) \
 
 /* Pthreads condition vars */
 #define git_cond unsigned int
-#define git_cond_init(c, a)	(void)0
+GIT_INLINE(int) git_cond_init(git_cond *cond) \
+	{ GIT_UNUSED(cond); return 0; }
 #define git_cond_free(c) (void)0
 #define git_cond_wait(c, l)	(void)0
 #define git_cond_signal(c) (void)0
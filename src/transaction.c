@@ -106,7 +106,7 @@ on_error:
 int git_transaction_lock_ref(git_transaction *tx, const char *refname)
 {
 	int error;
-	transaction_node *node;
+	transaction_node *node, *other;
 
 	assert(tx && refname);
 
@@ -116,6 +116,14 @@ int git_transaction_lock_ref(git_transaction *tx, const char *refname)
 	node->name = git_pool_strdup(&tx->pool, refname);
 	GIT_ERROR_CHECK_ALLOC(node->name);
 
+	/* let the backend know which lock of this transaction it may join */
+	git_strmap_foreach_value(tx->locks, other, {
+		if (!other->committed) {
+			node->payload = other->payload;
+			break;
+		}
+	});
+
 	if ((error = git_refdb_lock(&node->payload, tx->db, refname)) < 0)
 		return error;
 
@@ -340,6 +348,20 @@ int git_transaction_commit(git_transaction *tx)
 		}
 	});
 
+	/*
+	 * Release the references that were only locked, so that a backend
+	 * which writes the transaction as a whole does it now.
+	 */
+	git_strmap_foreach_value(tx->locks, node, {
+		if (node->committed)
+			continue;
+
+		node->committed = true;
+
+		if ((error = git_refdb_unlock(tx->db, node->payload, false, false, NULL, NULL, NULL)) < 0)
+			return error;
+	});
+
 	return 0;
 }
 
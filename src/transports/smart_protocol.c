@@ -1057,6 +1057,9 @@ int git_smart__push(git_transport *transport, git_push *push, const git_remote_c
 		(error = packbuilder_payload.stream->write(packbuilder_payload.stream, git_buf_cstr(&pktline), git_buf_len(&pktline))) < 0)
 		goto done;
 
+	/* Only send offset deltas to a server that asked for them */
+	push->pb->ofs_delta = t->caps.ofs_delta;
+
 	if (need_pack &&
 		(error = git_packbuilder_foreach(push->pb, &stream_thunk, &packbuilder_payload)) < 0)
 		goto done;
@@ -0,0 +1,763 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "untracked_cache.h"
+
+#include "ewah.h"
+#include "fileops.h"
+#include "odb.h"
+#include "varint.h"
+
+#ifndef GIT_WIN32
+# include <sys/utsname.h>
+#endif
+
+/* ctime, mtime, dev, ino, uid, gid and size, as 32 bit integers */
+#define UNTRACKED_STAT_SIZE (9 * sizeof(uint32_t))
+
+/* deeper directories cannot be iterated anyway */
+#define UNTRACKED_MAX_DEPTH 1024
+
+static int dir_cmp(const void *a, const void *b)
+{
+	const git_untracked_cache_dir *dir_a = a, *dir_b = b;
+	return strcmp(dir_a->name, dir_b->name);
+}
+
+static git_untracked_cache_dir *dir_new(const char *name, size_t name_len)
+{
+	git_untracked_cache_dir *dir = git__calloc(1, sizeof(git_untracked_cache_dir));
+
+	if (!dir)
+		return NULL;
+
+	if ((dir->name = git__strndup(name, name_len)) == NULL ||
+	    git_vector_init(&dir->untracked, 0, NULL) < 0 ||
+	    git_vector_init(&dir->dirs, 0, dir_cmp) < 0) {
+		git__free(dir->name);
+		git_vector_free(&dir->untracked);
+		git__free(dir);
+		return NULL;
+	}
+
+	return dir;
+}
+
+static void dir_free(git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	size_t i;
+
+	if (!dir)
+		return;
+
+	git_vector_foreach(&dir->dirs, i, child)
+		dir_free(child);
+
+	git_vector_free(&dir->dirs);
+	git_vector_free_deep(&dir->untracked);
+	git__free(dir->name);
+	git__free(dir);
+}
+
+static void dir_invalidate_one(git_untracked_cache_dir *dir)
+{
+	dir->valid = 0;
+	dir->check_only = 0;
+	git_vector_free_deep(&dir->untracked);
+}
+
+struct name_key {
+	const char *name;
+	size_t len;
+};
+
+static int find_child_cmp(const void *key, const void *element)
+{
+	const struct name_key *name = key;
+	const git_untracked_cache_dir *dir = element;
+	int cmp = strncmp(name->name, dir->name, name->len);
+
+	return cmp ? cmp : -(unsigned char)dir->name[name->len];
+}
+
+static git_untracked_cache_dir *find_child(
+	git_untracked_cache_dir *dir,
+	const char *name,
+	size_t name_len,
+	bool create)
+{
+	git_untracked_cache_dir *child;
+	struct name_key key;
+	size_t pos;
+
+	key.name = name;
+	key.len = name_len;
+
+	if (git_vector_bsearch2(&pos, &dir->dirs, find_child_cmp, &key) == 0)
+		return git_vector_get(&dir->dirs, pos);
+
+	if (!create || (child = dir_new(name, name_len)) == NULL)
+		return NULL;
+
+	if (git_vector_insert_sorted(&dir->dirs, child, NULL) < 0) {
+		dir_free(child);
+		return NULL;
+	}
+
+	return child;
+}
+
+static int untracked_ident(git_buf *out, const char *workdir)
+{
+	const char *system = "Windows";
+	size_t len = strlen(workdir);
+#ifndef GIT_WIN32
+	struct utsname uts;
+
+	if (uname(&uts) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to get the name of the system");
+		return -1;
+	}
+
+	system = uts.sysname;
+#endif
+
+	/* git names the working directory without a trailing slash */
+	if (len > 1 && workdir[len - 1] == '/')
+		len--;
+
+	git_buf_puts(out, "Location ");
+	git_buf_put(out, workdir, len);
+	git_buf_printf(out, ", system %s", system);
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+static git_untracked_cache *untracked_cache_alloc(void)
+{
+	git_untracked_cache *cache = git__calloc(1, sizeof(git_untracked_cache));
+
+	if (!cache)
+		return NULL;
+
+	if (git_mutex_init(&cache->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize lock");
+		git__free(cache);
+		return NULL;
+	}
+
+	GIT_REFCOUNT_INC(cache);
+	return cache;
+}
+
+int git_untracked_cache_new(git_untracked_cache **out, const char *workdir)
+{
+	git_untracked_cache *cache;
+
+	*out = NULL;
+
+	cache = untracked_cache_alloc();
+	GIT_ERROR_CHECK_ALLOC(cache);
+
+	/* the ident is NUL terminated, as older versions of git stored a list */
+	if (untracked_ident(&cache->ident, workdir) < 0 ||
+	    git_buf_putc(&cache->ident, '\0') < 0 ||
+	    (cache->exclude_per_dir = git__strdup(".gitignore")) == NULL ||
+	    (cache->root = dir_new("", 0)) == NULL) {
+		git_untracked_cache_free(cache);
+		return -1;
+	}
+
+	cache->dir_flags = GIT_UNTRACKED_CACHE_DIR_FLAGS;
+	cache->changed = true;
+
+	*out = cache;
+	return 0;
+}
+
+bool git_untracked_cache_is_for(git_untracked_cache *cache, const char *workdir)
+{
+	git_buf ident = GIT_BUF_INIT;
+	bool matches;
+
+	if (untracked_ident(&ident, workdir) < 0) {
+		git_error_clear();
+		return false;
+	}
+
+	/* only the first string of the ident is considered */
+	matches = cache->ident.size > 0 && strcmp(cache->ident.ptr, ident.ptr) == 0 &&
+		cache->dir_flags == GIT_UNTRACKED_CACHE_DIR_FLAGS &&
+		cache->exclude_per_dir && strcmp(cache->exclude_per_dir, ".gitignore") == 0;
+
+	git_buf_dispose(&ident);
+	return matches;
+}
+
+void git_untracked_stat_from_stat(git_untracked_stat *out, const struct stat *st)
+{
+	/* Like index entries, these are truncated to 32 bits */
+	out->ctime.seconds = (int32_t)st->st_ctime;
+	out->mtime.seconds = (int32_t)st->st_mtime;
+#if defined(GIT_USE_NSEC)
+	out->ctime.nanoseconds = st->st_ctime_nsec;
+	out->mtime.nanoseconds = st->st_mtime_nsec;
+#else
+	out->ctime.nanoseconds = 0;
+	out->mtime.nanoseconds = 0;
+#endif
+	out->dev = st->st_dev;
+	out->ino = st->st_ino;
+	out->uid = st->st_uid;
+	out->gid = st->st_gid;
+	out->size = (uint32_t)st->st_size;
+}
+
+bool git_untracked_stat_equal(
+	const git_untracked_stat *a, const git_untracked_stat *b)
+{
+	return a->ctime.seconds == b->ctime.seconds &&
+		a->mtime.seconds == b->mtime.seconds &&
+#if defined(GIT_USE_NSEC)
+		a->ctime.nanoseconds == b->ctime.nanoseconds &&
+		a->mtime.nanoseconds == b->mtime.nanoseconds &&
+#endif
+		a->dev == b->dev &&
+		a->ino == b->ino &&
+		a->uid == b->uid &&
+		a->gid == b->gid &&
+		a->size == b->size;
+}
+
+int git_untracked_cache_hash_ignore(git_oid *out, const char *path)
+{
+	git_buf contents = GIT_BUF_INIT;
+	int error;
+
+	memset(out, 0, sizeof(git_oid));
+
+	if (!git_path_isfile(path))
+		return 0;
+
+	if ((error = git_futils_readbuffer(&contents, path)) < 0)
+		return error;
+
+	/* git reads ignore files with a newline added, and hashes that */
+	if (contents.size && (error = git_buf_putc(&contents, '\n')) < 0)
+		goto done;
+
+	error = git_odb_hash(out, contents.ptr, contents.size, GIT_OBJECT_BLOB);
+
+done:
+	git_buf_dispose(&contents);
+	return error;
+}
+
+int git_untracked_file_update(git_untracked_file *file, const char *path)
+{
+	git_untracked_stat st;
+	struct stat statbuf;
+	git_oid id;
+	int changed;
+
+	memset(&st, 0, sizeof(st));
+	memset(&id, 0, sizeof(id));
+
+	if (path && p_stat(path, &statbuf) == 0) {
+		git_untracked_stat_from_stat(&st, &statbuf);
+
+		if (!git_oid_iszero(&file->id) && git_untracked_stat_equal(&st, &file->st))
+			return 0;
+
+		if (git_untracked_cache_hash_ignore(&id, path) < 0)
+			return -1;
+	}
+
+	changed = !git_oid_equal(&id, &file->id);
+
+	memcpy(&file->st, &st, sizeof(st));
+	git_oid_cpy(&file->id, &id);
+
+	return changed;
+}
+
+git_untracked_cache_dir *git_untracked_cache_lookup(
+	git_untracked_cache *cache, const char *path, bool create)
+{
+	git_untracked_cache_dir *dir;
+	const char *end;
+
+	if (!cache->root) {
+		if (!create || (cache->root = dir_new("", 0)) == NULL)
+			return NULL;
+	}
+
+	for (dir = cache->root; dir && *path; path = end) {
+		if ((end = strchr(path, '/')) == NULL)
+			end = path + strlen(path);
+
+		dir = find_child(dir, path, end - path, create);
+
+		if (*end == '/')
+			end++;
+	}
+
+	return dir;
+}
+
+void git_untracked_cache_dir_set(
+	git_untracked_cache_dir *dir, git_vector *untracked)
+{
+	git_vector_free_deep(&dir->untracked);
+	git_vector_swap(&dir->untracked, untracked);
+
+	dir->valid = 1;
+	dir->check_only = 0;
+}
+
+void git_untracked_cache_dir_invalidate(git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	size_t i;
+
+	dir_invalidate_one(dir);
+
+	git_vector_foreach(&dir->dirs, i, child)
+		git_untracked_cache_dir_invalidate(child);
+}
+
+void git_untracked_cache_invalidate_path(
+	git_untracked_cache *cache, const char *path)
+{
+	git_untracked_cache_dir *dir;
+	const char *end;
+
+	if (!cache || git_mutex_lock(&cache->lock) < 0)
+		return;
+
+	/*
+	 * The containing directories list the untracked directories that
+	 * lead to the path, so they are invalid as well.
+	 */
+	for (dir = cache->root; dir; path = end + 1) {
+		dir_invalidate_one(dir);
+
+		if ((end = strchr(path, '/')) == NULL)
+			break;
+
+		dir = find_child(dir, path, end - path, false);
+	}
+
+	cache->changed = true;
+	git_mutex_unlock(&cache->lock);
+}
+
+void git_untracked_cache_invalidate_all(git_untracked_cache *cache)
+{
+	if (!cache || git_mutex_lock(&cache->lock) < 0)
+		return;
+
+	if (cache->root)
+		git_untracked_cache_dir_invalidate(cache->root);
+
+	cache->changed = true;
+	git_mutex_unlock(&cache->lock);
+}
+
+static void stat_write(git_buf *out, const git_untracked_stat *st)
+{
+	uint32_t data[9];
+
+	data[0] = htonl((uint32_t)st->ctime.seconds);
+	data[1] = htonl(st->ctime.nanoseconds);
+	data[2] = htonl((uint32_t)st->mtime.seconds);
+	data[3] = htonl(st->mtime.nanoseconds);
+	data[4] = htonl(st->dev);
+	data[5] = htonl(st->ino);
+	data[6] = htonl(st->uid);
+	data[7] = htonl(st->gid);
+	data[8] = htonl(st->size);
+
+	git_buf_put(out, (const char *)data, sizeof(data));
+}
+
+static void stat_read(git_untracked_stat *st, const unsigned char *buffer)
+{
+	uint32_t data[9];
+
+	memcpy(data, buffer, sizeof(data));
+
+	st->ctime.seconds = (int32_t)ntohl(data[0]);
+	st->ctime.nanoseconds = ntohl(data[1]);
+	st->mtime.seconds = (int32_t)ntohl(data[2]);
+	st->mtime.nanoseconds = ntohl(data[3]);
+	st->dev = ntohl(data[4]);
+	st->ino = ntohl(data[5]);
+	st->uid = ntohl(data[6]);
+	st->gid = ntohl(data[7]);
+	st->size = ntohl(data[8]);
+}
+
+static void put_varint(git_buf *out, size_t value)
+{
+	unsigned char varint[16];
+	int len = git_encode_varint(varint, sizeof(varint), value);
+
+	git_buf_put(out, (const char *)varint, len);
+}
+
+struct write_data {
+	size_t nr_dirs;
+	git_bitmap valid;
+	git_bitmap check_only;
+	git_bitmap exclude_valid;
+	git_buf dirs;
+	git_buf stats;
+	git_buf exclude_ids;
+};
+
+static int write_one_dir(struct write_data *wd, git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	size_t pos = wd->nr_dirs++, i;
+	const char *untracked;
+
+	if (dir->valid) {
+		if (git_bitmap_set(&wd->valid, pos) < 0 ||
+		    (dir->check_only && git_bitmap_set(&wd->check_only, pos) < 0))
+			return -1;
+
+		stat_write(&wd->stats, &dir->st);
+	}
+
+	if (!git_oid_iszero(&dir->exclude_id)) {
+		if (git_bitmap_set(&wd->exclude_valid, pos) < 0)
+			return -1;
+
+		git_buf_put(&wd->exclude_ids, (const char *)dir->exclude_id.id, GIT_OID_RAWSZ);
+	}
+
+	/* the untracked entries of invalid directories are not recorded */
+	put_varint(&wd->dirs, dir->valid ? dir->untracked.length : 0);
+	put_varint(&wd->dirs, dir->dirs.length);
+	git_buf_put(&wd->dirs, dir->name, strlen(dir->name) + 1);
+
+	if (dir->valid) {
+		git_vector_foreach(&dir->untracked, i, untracked)
+			git_buf_put(&wd->dirs, untracked, strlen(untracked) + 1);
+	}
+
+	git_vector_foreach(&dir->dirs, i, child) {
+		if (write_one_dir(wd, child) < 0)
+			return -1;
+	}
+
+	return git_buf_oom(&wd->dirs) ? -1 : 0;
+}
+
+int git_untracked_cache_write(git_buf *out, git_untracked_cache *cache)
+{
+	struct write_data wd = { 0 };
+	uint32_t dir_flags = htonl(cache->dir_flags);
+	int error = -1;
+
+	if (git_mutex_lock(&cache->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock untracked cache");
+		return -1;
+	}
+
+	put_varint(out, cache->ident.size);
+	git_buf_put(out, cache->ident.ptr, cache->ident.size);
+
+	stat_write(out, &cache->info_exclude.st);
+	stat_write(out, &cache->excludes_file.st);
+	git_buf_put(out, (const char *)&dir_flags, sizeof(dir_flags));
+	git_buf_put(out, (const char *)cache->info_exclude.id.id, GIT_OID_RAWSZ);
+	git_buf_put(out, (const char *)cache->excludes_file.id.id, GIT_OID_RAWSZ);
+	git_buf_put(out, cache->exclude_per_dir, strlen(cache->exclude_per_dir) + 1);
+
+	if (!cache->root) {
+		put_varint(out, 0);
+		error = git_buf_oom(out) ? -1 : 0;
+		goto done;
+	}
+
+	if (write_one_dir(&wd, cache->root) < 0)
+		goto done;
+
+	put_varint(out, wd.nr_dirs);
+	git_buf_put(out, wd.dirs.ptr, wd.dirs.size);
+
+	if (git_ewah_write(out, &wd.valid, wd.nr_dirs) < 0 ||
+	    git_ewah_write(out, &wd.check_only, wd.nr_dirs) < 0 ||
+	    git_ewah_write(out, &wd.exclude_valid, wd.nr_dirs) < 0)
+		goto done;
+
+	git_buf_put(out, wd.stats.ptr, wd.stats.size);
+	git_buf_put(out, wd.exclude_ids.ptr, wd.exclude_ids.size);
+
+	/* guard for the strings of the last directory */
+	git_buf_putc(out, '\0');
+
+	error = git_buf_oom(out) ? -1 : 0;
+
+done:
+	if (!error)
+		cache->changed = false;
+
+	git_mutex_unlock(&cache->lock);
+	git_bitmap_dispose(&wd.valid);
+	git_bitmap_dispose(&wd.check_only);
+	git_bitmap_dispose(&wd.exclude_valid);
+	git_buf_dispose(&wd.dirs);
+	git_buf_dispose(&wd.stats);
+	git_buf_dispose(&wd.exclude_ids);
+	return error;
+}
+
+struct read_data {
+	const unsigned char *data;
+	const unsigned char *end;
+
+	/* the directories in the order of the bitmaps */
+	git_vector dirs;
+};
+
+static int read_varint(size_t *out, struct read_data *rd)
+{
+	uintmax_t value;
+	size_t len;
+
+	if (rd->data >= rd->end)
+		return -1;
+
+	/* the buffer ends in a NUL, which stops the decoding */
+	value = git_decode_varint(rd->data, &len);
+
+	if (!len || len > (size_t)(rd->end - rd->data) || value > SIZE_MAX)
+		return -1;
+
+	rd->data += len;
+	*out = (size_t)value;
+	return 0;
+}
+
+static int read_string(const char **out, size_t *out_len, struct read_data *rd)
+{
+	const unsigned char *end;
+
+	if (rd->data >= rd->end ||
+	    (end = memchr(rd->data, '\0', rd->end - rd->data)) == NULL)
+		return -1;
+
+	*out = (const char *)rd->data;
+	*out_len = end - rd->data;
+	rd->data = end + 1;
+	return 0;
+}
+
+static int read_one_dir(
+	git_untracked_cache_dir **out, struct read_data *rd, size_t depth)
+{
+	git_untracked_cache_dir *dir, *child;
+	size_t untracked_nr, dirs_nr, len, i;
+	const char *name;
+	char *untracked;
+
+	if (depth > UNTRACKED_MAX_DEPTH ||
+	    read_varint(&untracked_nr, rd) < 0 ||
+	    read_varint(&dirs_nr, rd) < 0 ||
+	    read_string(&name, &len, rd) < 0)
+		return -1;
+
+	/* every entry takes at least a byte */
+	if (untracked_nr > (size_t)(rd->end - rd->data) ||
+	    dirs_nr > (size_t)(rd->end - rd->data))
+		return -1;
+
+	if ((*out = dir = dir_new(name, len)) == NULL ||
+	    git_vector_insert(&rd->dirs, dir) < 0)
+		return -1;
+
+	for (i = 0; i < untracked_nr; i++) {
+		if (read_string(&name, &len, rd) < 0 ||
+		    (untracked = git__strndup(name, len)) == NULL)
+			return -1;
+
+		if (git_vector_insert(&dir->untracked, untracked) < 0) {
+			git__free(untracked);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < dirs_nr; i++) {
+		child = NULL;
+
+		if (read_one_dir(&child, rd, depth + 1) < 0) {
+			dir_free(child);
+			return -1;
+		}
+
+		if (git_vector_insert(&dir->dirs, child) < 0) {
+			dir_free(child);
+			return -1;
+		}
+	}
+
+	/* git does not keep the directories sorted */
+	git_vector_sort(&dir->dirs);
+	return 0;
+}
+
+static int read_bitmap(git_bitmap *out, struct read_data *rd)
+{
+	size_t consumed;
+
+	if (git_ewah_read(out, &consumed, rd->data, rd->end - rd->data) < 0)
+		return -1;
+
+	rd->data += consumed;
+	return 0;
+}
+
+int git_untracked_cache_read(
+	git_untracked_cache **out, const char *buffer, size_t buffer_size)
+{
+	git_untracked_cache *cache = NULL;
+	git_untracked_cache_dir *dir;
+	git_bitmap valid = GIT_BITMAP_INIT, check_only = GIT_BITMAP_INIT,
+		exclude_valid = GIT_BITMAP_INIT;
+	struct read_data rd = { 0 };
+	const char *exclude_per_dir;
+	size_t len, nr_dirs, i;
+	uint32_t dir_flags;
+
+	*out = NULL;
+
+	/* the data ends in a NUL, so strings and varints cannot overflow it */
+	if (buffer_size <= 1 || buffer[buffer_size - 1] != '\0')
+		return 0;
+
+	rd.data = (const unsigned char *)buffer;
+	rd.end = rd.data + buffer_size - 1;
+
+	if (read_varint(&len, &rd) < 0 || len > (size_t)(rd.end - rd.data))
+		return 0;
+
+	cache = untracked_cache_alloc();
+	GIT_ERROR_CHECK_ALLOC(cache);
+
+	if (git_buf_put(&cache->ident, (const char *)rd.data, len) < 0)
+		goto on_error;
+	rd.data += len;
+
+	if ((size_t)(rd.end - rd.data) < 2 * UNTRACKED_STAT_SIZE +
+	    sizeof(uint32_t) + 2 * GIT_OID_RAWSZ)
+		goto invalid;
+
+	stat_read(&cache->info_exclude.st, rd.data);
+	rd.data += UNTRACKED_STAT_SIZE;
+	stat_read(&cache->excludes_file.st, rd.data);
+	rd.data += UNTRACKED_STAT_SIZE;
+
+	memcpy(&dir_flags, rd.data, sizeof(uint32_t));
+	cache->dir_flags = ntohl(dir_flags);
+	rd.data += sizeof(uint32_t);
+
+	git_oid_fromraw(&cache->info_exclude.id, rd.data);
+	rd.data += GIT_OID_RAWSZ;
+	git_oid_fromraw(&cache->excludes_file.id, rd.data);
+	rd.data += GIT_OID_RAWSZ;
+
+	if (read_string(&exclude_per_dir, &len, &rd) < 0)
+		goto invalid;
+
+	if ((cache->exclude_per_dir = git__strndup(exclude_per_dir, len)) == NULL)
+		goto on_error;
+
+	/* there may be no directories at all */
+	if (rd.data >= rd.end || read_varint(&nr_dirs, &rd) < 0 || nr_dirs == 0)
+		goto done;
+
+	if (git_vector_init(&rd.dirs, min(nr_dirs, (size_t)(rd.end - rd.data)), NULL) < 0)
+		goto on_error;
+
+	if (read_one_dir(&cache->root, &rd, 0) < 0 || rd.dirs.length != nr_dirs ||
+	    read_bitmap(&valid, &rd) < 0 ||
+	    read_bitmap(&check_only, &rd) < 0 ||
+	    read_bitmap(&exclude_valid, &rd) < 0)
+		goto invalid;
+
+	git_vector_foreach(&rd.dirs, i, dir) {
+		if (git_bitmap_get(&check_only, i))
+			dir->check_only = 1;
+	}
+
+	git_vector_foreach(&rd.dirs, i, dir) {
+		if (!git_bitmap_get(&valid, i))
+			continue;
+
+		if ((size_t)(rd.end - rd.data) < UNTRACKED_STAT_SIZE)
+			goto invalid;
+
+		stat_read(&dir->st, rd.data);
+		rd.data += UNTRACKED_STAT_SIZE;
+		dir->valid = 1;
+	}
+
+	git_vector_foreach(&rd.dirs, i, dir) {
+		if (!git_bitmap_get(&exclude_valid, i))
+			continue;
+
+		if ((size_t)(rd.end - rd.data) < GIT_OID_RAWSZ)
+			goto invalid;
+
+		git_oid_fromraw(&dir->exclude_id, rd.data);
+		rd.data += GIT_OID_RAWSZ;
+	}
+
+done:
+	git_vector_free(&rd.dirs);
+	git_bitmap_dispose(&valid);
+	git_bitmap_dispose(&check_only);
+	git_bitmap_dispose(&exclude_valid);
+	*out = cache;
+	return 0;
+
+invalid:
+	/* like git, ignore a cache that cannot be read */
+	git_error_clear();
+	git_vector_free(&rd.dirs);
+	git_bitmap_dispose(&valid);
+	git_bitmap_dispose(&check_only);
+	git_bitmap_dispose(&exclude_valid);
+	git_untracked_cache_free(cache);
+	return 0;
+
+on_error:
+	git_vector_free(&rd.dirs);
+	git_untracked_cache_free(cache);
+	return -1;
+}
+
+static void untracked_cache_free(git_untracked_cache *cache)
+{
+	dir_free(cache->root);
+	git__free(cache->exclude_per_dir);
+	git_buf_dispose(&cache->ident);
+	git_mutex_free(&cache->lock);
+	git__free(cache);
+}
+
+void git_untracked_cache_free(git_untracked_cache *cache)
+{
+	if (!cache)
+		return;
+
+	GIT_REFCOUNT_DEC(cache, untracked_cache_free);
+}
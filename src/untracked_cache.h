@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_untracked_cache_h__
+#define INCLUDE_untracked_cache_h__
+
+#include "common.h"
+
+#include "buffer.h"
+#include "vector.h"
+#include "thread-utils.h"
+#include "git2/index.h"
+#include "git2/oid.h"
+
+/*
+ * The untracked cache (the `UNTR` index extension) remembers, for every
+ * directory of the working directory, the untracked files and
+ * directories in it that are not ignored, along with the stat data of
+ * the directory and the id of its `.gitignore` at the time.  As long as
+ * neither changes, the directory does not need to be read again to find
+ * its untracked files.
+ */
+
+/* `dir_flags` of git's `read_directory` that the cache is valid for */
+#define GIT_UNTRACKED_CACHE_SHOW_OTHER_DIRECTORIES (1u << 1)
+#define GIT_UNTRACKED_CACHE_HIDE_EMPTY_DIRECTORIES (1u << 2)
+
+#define GIT_UNTRACKED_CACHE_DIR_FLAGS \
+	(GIT_UNTRACKED_CACHE_SHOW_OTHER_DIRECTORIES | \
+	 GIT_UNTRACKED_CACHE_HIDE_EMPTY_DIRECTORIES)
+
+/* Stat data, as the index stores it */
+typedef struct {
+	git_index_time ctime;
+	git_index_time mtime;
+	uint32_t dev;
+	uint32_t ino;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t size;
+} git_untracked_stat;
+
+/* The stat data and contents of a global ignore file */
+typedef struct {
+	git_untracked_stat st;
+	git_oid id;
+} git_untracked_file;
+
+typedef struct git_untracked_cache_dir {
+	char *name;
+
+	/* the untracked entries that are not ignored; directories end in '/' */
+	git_vector untracked;
+	git_vector dirs;
+
+	git_untracked_stat st;
+
+	/* the id of the directory's `.gitignore`, zero if it has none */
+	git_oid exclude_id;
+
+	/* whether `untracked` is complete and `st` is that of the directory */
+	unsigned int valid:1,
+		/* whether git only looked for the first untracked entry */
+		check_only:1;
+} git_untracked_cache_dir;
+
+typedef struct {
+	git_refcount rc;
+	git_mutex lock;
+
+	/* the machine and location the cache was recorded at */
+	git_buf ident;
+
+	git_untracked_file info_exclude;
+	git_untracked_file excludes_file;
+	uint32_t dir_flags;
+	char *exclude_per_dir;
+
+	git_untracked_cache_dir *root;
+
+	/* whether the cache changed since it was read */
+	bool changed;
+} git_untracked_cache;
+
+/* Create an empty untracked cache for the working directory `workdir` */
+extern int git_untracked_cache_new(
+	git_untracked_cache **out, const char *workdir);
+
+/*
+ * Parse the data of an `UNTR` extension.  Sets `out` to NULL if the
+ * extension cannot be used.
+ */
+extern int git_untracked_cache_read(
+	git_untracked_cache **out, const char *buffer, size_t buffer_size);
+
+/* Serialize the cache as an `UNTR` extension and clear its `changed` flag */
+extern int git_untracked_cache_write(git_buf *out, git_untracked_cache *cache);
+
+/* Whether the cache was recorded for the working directory `workdir` */
+extern bool git_untracked_cache_is_for(
+	git_untracked_cache *cache, const char *workdir);
+
+/*
+ * Find the node of the directory `path` (relative to the working
+ * directory, with or without a trailing slash), creating it if it does
+ * not exist and `create` is set.  The cache must be locked.
+ */
+extern git_untracked_cache_dir *git_untracked_cache_lookup(
+	git_untracked_cache *cache, const char *path, bool create);
+
+/*
+ * Replace the untracked entries of `dir` and mark it valid.  The strings
+ * of `untracked` are taken over.  The cache must be locked.
+ */
+extern void git_untracked_cache_dir_set(
+	git_untracked_cache_dir *dir, git_vector *untracked);
+
+/*
+ * Invalidate the directory `dir` and all the directories in it, after
+ * its ignore rules changed.  The cache must be locked.
+ */
+extern void git_untracked_cache_dir_invalidate(git_untracked_cache_dir *dir);
+
+/*
+ * Invalidate the directories that contain `path`, after it was added to
+ * or removed from the index.
+ */
+extern void git_untracked_cache_invalidate_path(
+	git_untracked_cache *cache, const char *path);
+
+extern void git_untracked_cache_invalidate_all(git_untracked_cache *cache);
+
+extern void git_untracked_stat_from_stat(
+	git_untracked_stat *out, const struct stat *st);
+
+extern bool git_untracked_stat_equal(
+	const git_untracked_stat *a, const git_untracked_stat *b);
+
+/*
+ * Compute the id that git records for the ignore file at `path`, or a
+ * zero id if there is no such file.
+ */
+extern int git_untracked_cache_hash_ignore(git_oid *out, const char *path);
+
+/*
+ * Update `file` for the ignore file at `path`, rehashing it if its stat
+ * data changed.  Returns 1 if its contents changed, 0 if not.
+ */
+extern int git_untracked_file_update(
+	git_untracked_file *file, const char *path);
+
+extern void git_untracked_cache_free(git_untracked_cache *cache);
+
+#endif
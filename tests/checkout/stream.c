@@ -0,0 +1,130 @@
+#include "clar_libgit2.h"
+#include "checkout_helpers.h"
+
+#include "filter.h"
+
+static git_repository *g_repo;
+static size_t g_threshold;
+
+void test_checkout_stream__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo");
+
+	/* stream every blob that is checked out */
+	g_threshold = git_filter__stream_blob_threshold;
+	git_filter__stream_blob_threshold = 0;
+}
+
+void test_checkout_stream__cleanup(void)
+{
+	git_filter__stream_blob_threshold = g_threshold;
+	cl_git_sandbox_cleanup();
+}
+
+static int remove_file(const char *root, const git_tree_entry *entry, void *payload)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	GIT_UNUSED(payload);
+
+	/* not all of them are in the working directory of the fixture */
+	if (git_tree_entry_type(entry) == GIT_OBJECT_BLOB) {
+		cl_git_pass(git_buf_join3(&path, '/', "testrepo", root, git_tree_entry_name(entry)));
+		p_unlink(path.ptr);
+	}
+
+	git_buf_dispose(&path);
+	return 0;
+}
+
+static int check_file(const char *root, const git_tree_entry *entry, void *payload)
+{
+	git_buf path = GIT_BUF_INIT, expected = GIT_BUF_INIT;
+	git_blob *blob;
+
+	GIT_UNUSED(payload);
+
+	if (git_tree_entry_filemode(entry) != GIT_FILEMODE_BLOB &&
+	    git_tree_entry_filemode(entry) != GIT_FILEMODE_BLOB_EXECUTABLE)
+		return 0;
+
+	cl_git_pass(git_buf_join3(&path, '/', "testrepo", root, git_tree_entry_name(entry)));
+
+	cl_git_pass(git_blob_lookup(&blob, g_repo, git_tree_entry_id(entry)));
+	cl_git_pass(git_blob_filtered_content(&expected, blob, path.ptr + strlen("testrepo/"), 1));
+	check_file_contents(path.ptr, expected.ptr);
+
+	git_blob_free(blob);
+	git_buf_dispose(&expected);
+	git_buf_dispose(&path);
+	return 0;
+}
+
+/* Check out the files of HEAD again, and compare them to their blobs */
+static void checkout_and_check_files(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	git_object *head;
+	git_tree *tree;
+
+	cl_git_pass(git_revparse_single(&head, g_repo, "HEAD"));
+	cl_git_pass(git_commit_tree(&tree, (git_commit *)head));
+
+	cl_git_pass(git_tree_walk(tree, GIT_TREEWALK_PRE, remove_file, NULL));
+
+	opts.checkout_strategy = GIT_CHECKOUT_FORCE;
+	cl_git_pass(git_checkout_tree(g_repo, head, &opts));
+
+	cl_git_pass(git_tree_walk(tree, GIT_TREEWALK_PRE, check_file, NULL));
+
+	git_tree_free(tree);
+	git_object_free(head);
+}
+
+void test_checkout_stream__writes_streamed_blobs(void)
+{
+	checkout_and_check_files();
+}
+
+void test_checkout_stream__filters_streamed_blobs(void)
+{
+	cl_repo_set_bool(g_repo, "core.autocrlf", true);
+
+	checkout_and_check_files();
+}
+
+/* A blob whose contents don't match its id is found once it was written */
+void test_checkout_stream__removes_corrupt_blobs(void)
+{
+	const char *readme = "objects/a8/233120f6ad708f843d861ce2b7228ec4e3dec6",
+	      *corrupt = "objects/a8/233120f6ad708f843d861ce2b7228ec4e3dec7",
+	      *corrupt_id = "a8233120f6ad708f843d861ce2b7228ec4e3dec7";
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	git_buf oldpath = GIT_BUF_INIT, newpath = GIT_BUF_INIT;
+	char *paths[] = { "corrupt.txt" };
+	git_treebuilder *builder;
+	git_object *tree;
+	git_oid id;
+
+	cl_git_pass(git_buf_joinpath(&oldpath, git_repository_path(g_repo), readme));
+	cl_git_pass(git_buf_joinpath(&newpath, git_repository_path(g_repo), corrupt));
+	cl_git_pass(git_futils_cp(oldpath.ptr, newpath.ptr, 0644));
+
+	cl_git_pass(git_oid_fromstr(&id, corrupt_id));
+	cl_git_pass(git_treebuilder_new(&builder, g_repo, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "corrupt.txt", &id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&id, builder));
+	cl_git_pass(git_object_lookup(&tree, g_repo, &id, GIT_OBJECT_TREE));
+
+	opts.checkout_strategy = GIT_CHECKOUT_FORCE | GIT_CHECKOUT_DISABLE_PATHSPEC_MATCH;
+	opts.paths.strings = paths;
+	opts.paths.count = 1;
+
+	cl_git_fail_with(GIT_EMISMATCH, git_checkout_tree(g_repo, tree, &opts));
+	cl_assert(!git_path_exists("testrepo/corrupt.txt"));
+
+	git_object_free(tree);
+	git_treebuilder_free(builder);
+	git_buf_dispose(&oldpath);
+	git_buf_dispose(&newpath);
+}
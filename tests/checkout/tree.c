@@ -1636,3 +1636,76 @@ void test_checkout_tree__no_index_refresh(void)
 	modify_index_and_checkout_tree(&opts);
 	assert_status_entrycount(g_repo, 0);
 }
+
+static void record_progress(
+	const char *path, size_t cur, size_t tot, void *payload)
+{
+	GIT_UNUSED(tot);
+	git_buf_printf((git_buf *)payload, "%" PRIuZ " %s\n", cur, path ? path : "");
+}
+
+static void checkout_into(
+	git_buf *progress, git_buf *entries, const char *dir, unsigned int threads)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	git_index *index;
+	const git_index_entry *entry;
+	git_buf target = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_oid id;
+	char str[GIT_OID_HEXSZ + 1];
+	size_t i;
+
+	/* every file is written, and added to the index again */
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_clear(index));
+	cl_git_pass(git_index_write(index));
+
+	cl_git_pass(git_buf_joinpath(&target, clar_sandbox_path(), dir));
+
+	opts.checkout_strategy = GIT_CHECKOUT_FORCE;
+	opts.target_directory = target.ptr;
+	opts.progress_cb = record_progress;
+	opts.progress_payload = progress;
+	opts.threads = threads;
+
+	cl_git_pass(git_checkout_tree(g_repo, g_object, &opts));
+
+	for (i = 0; (entry = git_index_get_byindex(index, i)) != NULL; i++) {
+		cl_git_pass(git_buf_joinpath(&path, dir, entry->path));
+		cl_git_pass(git_odb_hashfile(&id, path.ptr, GIT_OBJECT_BLOB));
+		cl_assert_equal_oid(&entry->id, &id);
+
+		git_buf_printf(entries, "%s %o %s %u\n", entry->path, entry->mode,
+			git_oid_tostr(str, sizeof(str), &entry->id), entry->file_size);
+	}
+
+	cl_assert(!git_buf_oom(entries));
+
+	git_buf_dispose(&target);
+	git_buf_dispose(&path);
+	git_index_free(index);
+}
+
+void test_checkout_tree__can_write_files_on_several_threads(void)
+{
+	git_buf progress = GIT_BUF_INIT, entries = GIT_BUF_INIT;
+	git_buf threaded_progress = GIT_BUF_INIT, threaded_entries = GIT_BUF_INIT;
+
+	cl_git_pass(git_revparse_single(&g_object, g_repo, "subtrees"));
+
+	checkout_into(&progress, &entries, "alternative", 1);
+	checkout_into(&threaded_progress, &threaded_entries, "alternative4", 4);
+
+	cl_assert(entries.size > 0);
+	cl_assert_equal_s(entries.ptr, threaded_entries.ptr);
+
+	/* the progress is reported in the same order */
+	cl_assert_equal_s(progress.ptr, threaded_progress.ptr);
+
+	cl_git_pass(git_futils_rmdir_r("alternative4", NULL, GIT_RMDIR_REMOVE_FILES));
+
+	git_buf_dispose(&progress);
+	git_buf_dispose(&entries);
+	git_buf_dispose(&threaded_progress);
+	git_buf_dispose(&threaded_entries);
+}
@@ -19,3 +19,18 @@ void test_delta_apply__read_after_limit(void)
 
 	cl_git_fail(git_delta_apply(&out, &outlen, base, sizeof(base), delta, sizeof(delta)));
 }
+
+void test_delta_apply__into_given_buffer(void)
+{
+	unsigned char base[] = "0123456789abcdef", out[8];
+	/* copy 4 bytes at offset 10, then insert "xyz" */
+	unsigned char delta[] = { 0x10, 0x07, 0x91, 0x0a, 0x04, 0x03, 'x', 'y', 'z' };
+
+	memset(out, 0xff, sizeof(out));
+	cl_git_pass(git_delta_apply_to(out, 7, base, 16, delta, sizeof(delta)));
+	cl_assert_equal_s("abcdxyz", (char *)out);
+
+	/* the buffer must be the size that the delta announces */
+	cl_git_fail(git_delta_apply_to(out, 6, base, 16, delta, sizeof(delta)));
+	cl_git_fail(git_delta_apply_to(out, 7, base, 15, delta, sizeof(delta)));
+}
@@ -0,0 +1,201 @@
+#include "clar_libgit2.h"
+#include "diff_helpers.h"
+
+#include "git2/sys/hashsig.h"
+
+static git_repository *g_repo;
+static git_tree *g_old_tree, *g_new_tree;
+
+#define FILES 300
+
+void test_diff_manyrenames__initialize(void)
+{
+	git_index *index;
+	git_index_entry entry;
+	git_buf path = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	git_oid id;
+	size_t i, j, round;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	/*
+	 * Every file moves to another directory, and changes one of its
+	 * lines; all of them start with the same lines, which many more
+	 * files than the rename limit have.
+	 */
+	for (round = 0; round < 2; round++) {
+		cl_git_pass(git_index_clear(index));
+
+		for (i = 0; i < FILES; i++) {
+			git_buf_clear(&path);
+			git_buf_clear(&content);
+
+			cl_git_pass(git_buf_printf(&path, "%s/file%03" PRIuZ ".txt",
+				round ? "after" : "before", i));
+			cl_git_pass(git_buf_puts(&content, "/*\n * Copyright\n */\n\n"));
+
+			for (j = 0; j < 20; j++)
+				cl_git_pass(git_buf_printf(&content, "line %" PRIuZ " of file %" PRIuZ "%s\n",
+					j, i, (round && j == i % 20) ? " was changed" : ""));
+
+			memset(&entry, 0, sizeof(entry));
+			entry.path = path.ptr;
+			entry.mode = GIT_FILEMODE_BLOB;
+			cl_git_pass(git_index_add_frombuffer(index, &entry, content.ptr, content.size));
+		}
+
+		cl_git_pass(git_index_write_tree(&id, index));
+		cl_git_pass(git_tree_lookup(round ? &g_new_tree : &g_old_tree, g_repo, &id));
+	}
+
+	git_index_free(index);
+	git_buf_dispose(&path);
+	git_buf_dispose(&content);
+}
+
+void test_diff_manyrenames__cleanup(void)
+{
+	git_tree_free(g_old_tree);
+	git_tree_free(g_new_tree);
+	g_old_tree = g_new_tree = NULL;
+
+	cl_git_sandbox_cleanup();
+}
+
+static void assert_all_renamed(git_diff *diff)
+{
+	const git_diff_delta *delta;
+	size_t i;
+
+	cl_assert_equal_sz(FILES, git_diff_num_deltas(diff));
+
+	for (i = 0; i < FILES; i++) {
+		delta = git_diff_get_delta(diff, i);
+
+		cl_assert_equal_i(GIT_DELTA_RENAMED, delta->status);
+		cl_assert_equal_s(delta->old_file.path + strlen("before/"),
+			delta->new_file.path + strlen("after/"));
+		cl_assert(delta->similarity < 100);
+	}
+}
+
+static void assert_same_renames(git_diff *expected, git_diff *actual)
+{
+	const git_diff_delta *e, *a;
+	size_t i;
+
+	cl_assert_equal_sz(git_diff_num_deltas(expected), git_diff_num_deltas(actual));
+
+	for (i = 0; i < git_diff_num_deltas(expected); i++) {
+		e = git_diff_get_delta(expected, i);
+		a = git_diff_get_delta(actual, i);
+
+		cl_assert_equal_i(e->status, a->status);
+		cl_assert_equal_i(e->similarity, a->similarity);
+		cl_assert_equal_s(e->old_file.path, a->old_file.path);
+		cl_assert_equal_s(e->new_file.path, a->new_file.path);
+	}
+}
+
+static void find_renames(git_diff **out, git_diff_find_options *opts)
+{
+	cl_git_pass(git_diff_tree_to_tree(out, g_repo, g_old_tree, g_new_tree, NULL));
+	cl_assert_equal_sz(2 * FILES, git_diff_num_deltas(*out));
+
+	cl_git_pass(git_diff_find_similar(*out, opts));
+}
+
+/* The sources with the most in common are the ones within the limit */
+void test_diff_manyrenames__finds_renames_beyond_the_rename_limit(void)
+{
+	git_diff_find_options opts = GIT_DIFF_FIND_OPTIONS_INIT;
+	git_diff *diff;
+
+	opts.flags = GIT_DIFF_FIND_RENAMES;
+	opts.rename_limit = 50;
+
+	find_renames(&diff, &opts);
+	assert_all_renamed(diff);
+	git_diff_free(diff);
+}
+
+void test_diff_manyrenames__computes_signatures_on_threads(void)
+{
+	git_diff_find_options opts = GIT_DIFF_FIND_OPTIONS_INIT;
+	git_diff *serial, *threaded;
+
+	opts.flags = GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_COPIES;
+
+	find_renames(&serial, &opts);
+
+	opts.threads = 4;
+	find_renames(&threaded, &opts);
+
+	assert_all_renamed(threaded);
+	assert_same_renames(serial, threaded);
+
+	git_diff_free(serial);
+	git_diff_free(threaded);
+}
+
+/*
+ * The same metric as the internal one, which libgit2 does not recognize,
+ * and so measures every target against every source with.
+ */
+static int file_signature(
+	void **out, const git_diff_file *file, const char *fullpath, void *payload)
+{
+	GIT_UNUSED(file);
+	GIT_UNUSED(payload);
+
+	return git_hashsig_create_fromfile((git_hashsig **)out, fullpath,
+		GIT_HASHSIG_SMART_WHITESPACE | GIT_HASHSIG_ALLOW_SMALL_FILES);
+}
+
+static int buffer_signature(
+	void **out, const git_diff_file *file, const char *buf, size_t buflen, void *payload)
+{
+	GIT_UNUSED(file);
+	GIT_UNUSED(payload);
+
+	return git_hashsig_create((git_hashsig **)out, buf, buflen,
+		GIT_HASHSIG_SMART_WHITESPACE | GIT_HASHSIG_ALLOW_SMALL_FILES);
+}
+
+static void free_signature(void *sig, void *payload)
+{
+	GIT_UNUSED(payload);
+	git_hashsig_free(sig);
+}
+
+static int similarity(int *score, void *siga, void *sigb, void *payload)
+{
+	GIT_UNUSED(payload);
+
+	*score = git_hashsig_compare(siga, sigb);
+	return (*score < 0) ? *score : 0;
+}
+
+void test_diff_manyrenames__finds_what_measuring_every_pair_finds(void)
+{
+	git_diff_similarity_metric metric = {
+		file_signature, buffer_signature, free_signature, similarity, NULL
+	};
+	git_diff_find_options opts = GIT_DIFF_FIND_OPTIONS_INIT;
+	git_diff *expected, *actual;
+
+	opts.flags = GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_COPIES;
+	opts.rename_limit = 2 * FILES;
+
+	find_renames(&actual, &opts);
+
+	opts.metric = &metric;
+	find_renames(&expected, &opts);
+
+	assert_all_renamed(expected);
+	assert_same_renames(expected, actual);
+
+	git_diff_free(expected);
+	git_diff_free(actual);
+}
@@ -0,0 +1,273 @@
+#include "clar_libgit2.h"
+#include "diff_helpers.h"
+
+#include "git2/sys/repository.h"
+#include "repository.h"
+#include "sigcache.h"
+#include "../merge/merge_helpers.h"
+
+static git_repository *g_repo;
+static git_oid g_old_id, g_new_id;
+
+#define FILES 20
+#define CACHE_PATH "empty_standard_repo/.git/sigcache"
+
+void test_diff_sigcache__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* Every file moves to another directory, and changes one of its lines */
+static void write_trees(void)
+{
+	git_index *index;
+	git_index_entry entry;
+	git_buf path = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	size_t i, j, round;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	for (round = 0; round < 2; round++) {
+		cl_git_pass(git_index_clear(index));
+
+		for (i = 0; i < FILES; i++) {
+			git_buf_clear(&path);
+			git_buf_clear(&content);
+
+			cl_git_pass(git_buf_printf(&path, "%s/file%02" PRIuZ ".txt",
+				round ? "after" : "before", i));
+
+			for (j = 0; j < 20; j++)
+				cl_git_pass(git_buf_printf(&content, "line %" PRIuZ " of file %" PRIuZ "%s\n",
+					j, i, (round && j == i) ? " was changed" : ""));
+
+			memset(&entry, 0, sizeof(entry));
+			entry.path = path.ptr;
+			entry.mode = GIT_FILEMODE_BLOB;
+			cl_git_pass(git_index_add_frombuffer(index, &entry, content.ptr, content.size));
+		}
+
+		cl_git_pass(git_index_write_tree(round ? &g_new_id : &g_old_id, index));
+	}
+
+	git_index_free(index);
+	git_buf_dispose(&path);
+	git_buf_dispose(&content);
+}
+
+static int find_renames(git_diff **out)
+{
+	git_diff_find_options opts = GIT_DIFF_FIND_OPTIONS_INIT;
+	git_tree *old_tree, *new_tree;
+	int error;
+
+	cl_git_pass(git_tree_lookup(&old_tree, g_repo, &g_old_id));
+	cl_git_pass(git_tree_lookup(&new_tree, g_repo, &g_new_id));
+	cl_git_pass(git_diff_tree_to_tree(out, g_repo, old_tree, new_tree, NULL));
+
+	/* the signatures are computed, and cached, on several threads */
+	opts.flags = GIT_DIFF_FIND_RENAMES;
+	opts.threads = 4;
+
+	if ((error = git_diff_find_similar(*out, &opts)) < 0) {
+		git_diff_free(*out);
+		*out = NULL;
+	}
+
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+	return error;
+}
+
+static void assert_all_renamed(git_diff *diff)
+{
+	const git_diff_delta *delta;
+	size_t i;
+
+	cl_assert_equal_sz(FILES, git_diff_num_deltas(diff));
+
+	for (i = 0; i < FILES; i++) {
+		delta = git_diff_get_delta(diff, i);
+
+		cl_assert_equal_i(GIT_DELTA_RENAMED, delta->status);
+		cl_assert_equal_s(delta->old_file.path + strlen("before/"),
+			delta->new_file.path + strlen("after/"));
+		cl_assert(delta->similarity < 100);
+	}
+}
+
+static void remove_loose_object(const git_oid *id)
+{
+	git_buf path = GIT_BUF_INIT;
+	char loose[GIT_OID_HEXSZ + 2];
+
+	git_oid_pathfmt(loose, id);
+	loose[GIT_OID_HEXSZ + 1] = '\0';
+	cl_git_pass(git_buf_joinpath(&path, "empty_standard_repo/.git/objects", loose));
+	cl_must_pass(p_unlink(path.ptr));
+	git_buf_dispose(&path);
+}
+
+/*
+ * The signatures are written to the cache file; another process that
+ * reads them back does not need the blobs, which are taken out of the
+ * object database to be sure of it.
+ */
+void test_diff_sigcache__finds_renames_without_reading_blobs(void)
+{
+	git_diff *diff;
+	const git_diff_delta *delta;
+	git_oid ids[2 * FILES];
+	size_t i;
+
+	write_trees();
+	cl_git_pass(git_repository_set_sigcache(g_repo, 1024 * 1024, CACHE_PATH));
+
+	cl_git_pass(find_renames(&diff));
+	assert_all_renamed(diff);
+
+	for (i = 0; i < FILES; i++) {
+		delta = git_diff_get_delta(diff, i);
+		git_oid_cpy(&ids[2 * i], &delta->old_file.id);
+		git_oid_cpy(&ids[2 * i + 1], &delta->new_file.id);
+	}
+
+	git_diff_free(diff);
+
+	cl_assert(git_sigcache_size(g_repo->sigcache) > 0);
+	cl_git_pass(git_repository_sigcache_write(g_repo));
+
+	for (i = 0; i < 2 * FILES; i++)
+		remove_loose_object(&ids[i]);
+
+	g_repo = cl_git_sandbox_reopen();
+	cl_git_fail_with(GIT_ENOTFOUND, find_renames(&diff));
+
+	cl_git_pass(git_repository_set_sigcache(g_repo, 1024 * 1024, CACHE_PATH));
+	cl_git_pass(find_renames(&diff));
+	assert_all_renamed(diff);
+	git_diff_free(diff);
+
+	/* without the cache, the blobs are needed again */
+	cl_git_pass(git_repository_set_sigcache(g_repo, 0, NULL));
+	cl_git_fail_with(GIT_ENOTFOUND, find_renames(&diff));
+}
+
+void test_diff_sigcache__writing_needs_a_cache(void)
+{
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+	cl_git_fail(git_repository_sigcache_write(g_repo));
+
+	cl_git_pass(git_repository_set_sigcache(g_repo, 1024, NULL));
+	cl_git_fail(git_repository_sigcache_write(g_repo));
+}
+
+void test_diff_sigcache__rejects_a_corrupt_file(void)
+{
+	git_diff *diff;
+
+	write_trees();
+	cl_git_pass(git_repository_set_sigcache(g_repo, 1024 * 1024, CACHE_PATH));
+	cl_git_pass(find_renames(&diff));
+	git_diff_free(diff);
+	cl_git_pass(git_repository_sigcache_write(g_repo));
+
+	cl_git_append2file(CACHE_PATH, "garbage");
+	cl_git_fail(git_repository_set_sigcache(g_repo, 1024 * 1024, CACHE_PATH));
+
+	cl_git_rewritefile(CACHE_PATH, "SIGC");
+	cl_git_fail(git_repository_set_sigcache(g_repo, 1024 * 1024, CACHE_PATH));
+}
+
+static void put_signature(git_sigcache *cache, git_oid *id, size_t n)
+{
+	git_buf content = GIT_BUF_INIT;
+	git_hashsig *sig;
+	size_t i;
+
+	for (i = 0; i < 50; i++)
+		cl_git_pass(git_buf_printf(&content, "line %" PRIuZ " of blob %" PRIuZ "\n", i, n));
+
+	cl_git_pass(git_odb_hash(id, content.ptr, content.size, GIT_OBJECT_BLOB));
+	cl_git_pass(git_hashsig_create(&sig, content.ptr, content.size,
+		GIT_HASHSIG_SMART_WHITESPACE));
+	cl_git_pass(git_sigcache_put(cache, id,
+		GIT_HASHSIG_SMART_WHITESPACE, (git_off_t)content.size, sig));
+
+	git_hashsig_free(sig);
+	git_buf_dispose(&content);
+}
+
+static bool has_signature(git_sigcache *cache, const git_oid *id)
+{
+	git_hashsig *sig;
+	git_off_t size;
+	int error;
+
+	if ((error = git_sigcache_get(&sig, &size, cache, id,
+			GIT_HASHSIG_SMART_WHITESPACE)) == GIT_ENOTFOUND)
+		return false;
+
+	cl_git_pass(error);
+	git_hashsig_free(sig);
+	return true;
+}
+
+/* The signatures that were used the longest ago are forgotten first */
+void test_diff_sigcache__evicts_the_least_recently_used(void)
+{
+	git_sigcache *cache;
+	git_hashsig *sig;
+	git_oid ids[4];
+	git_off_t size;
+	size_t one;
+
+	cl_git_pass(git_sigcache_new(&cache, SIZE_MAX, NULL));
+	put_signature(cache, &ids[0], 0);
+	one = git_sigcache_size(cache);
+	git_sigcache_free(cache);
+
+	cl_git_pass(git_sigcache_new(&cache, 3 * one, NULL));
+	put_signature(cache, &ids[0], 0);
+	put_signature(cache, &ids[1], 1);
+	put_signature(cache, &ids[2], 2);
+	cl_assert_equal_sz(3 * one, git_sigcache_size(cache));
+
+	cl_assert(has_signature(cache, &ids[0]));
+	put_signature(cache, &ids[3], 3);
+
+	cl_assert(git_sigcache_size(cache) <= 3 * one);
+	cl_assert(has_signature(cache, &ids[0]));
+	cl_assert(!has_signature(cache, &ids[1]));
+	cl_assert(has_signature(cache, &ids[2]));
+	cl_assert(has_signature(cache, &ids[3]));
+
+	/* other options are another signature */
+	cl_assert_equal_i(GIT_ENOTFOUND, git_sigcache_get(&sig, &size, cache,
+		&ids[0], GIT_HASHSIG_IGNORE_WHITESPACE));
+
+	git_sigcache_free(cache);
+}
+
+void test_diff_sigcache__keeps_the_signatures_of_merges(void)
+{
+	git_merge_options opts = GIT_MERGE_OPTIONS_INIT;
+	git_index *index;
+	size_t size;
+
+	g_repo = cl_git_sandbox_init("merge-resolve");
+	cl_git_pass(git_repository_set_sigcache(g_repo, 1024 * 1024, NULL));
+
+	cl_git_pass(merge_trees_from_branches(&index, g_repo,
+		"rename_conflict_ours", "rename_conflict_theirs", &opts));
+	git_index_free(index);
+
+	cl_assert((size = git_sigcache_size(g_repo->sigcache)) > 0);
+
+	cl_git_pass(merge_trees_from_branches(&index, g_repo,
+		"rename_conflict_ours", "rename_conflict_theirs", &opts));
+	git_index_free(index);
+
+	cl_assert_equal_sz(size, git_sigcache_size(g_repo->sigcache));
+}
@@ -0,0 +1,180 @@
+#include "clar_libgit2.h"
+#include "diff_helpers.h"
+
+static git_repository *g_repo;
+
+void test_diff_subtrees__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static void add_file(git_index *index, const char *path, const char *content)
+{
+	git_index_entry entry;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.path = path;
+	entry.mode = GIT_FILEMODE_BLOB;
+
+	cl_git_pass(git_index_add_frombuffer(index, &entry, content, strlen(content)));
+}
+
+static void assert_only_modified(git_diff *diff, const char *path)
+{
+	const git_diff_delta *delta;
+
+	cl_assert_equal_sz(1, git_diff_num_deltas(diff));
+
+	delta = git_diff_get_delta(diff, 0);
+	cl_assert_equal_i(GIT_DELTA_MODIFIED, delta->status);
+	cl_assert_equal_s(path, delta->new_file.path);
+}
+
+/*
+ * The tree "a" is the same in both trees, and in the index, whose tree
+ * cache knows it; it is taken out of the object database, so that a
+ * diff that looks into it fails.
+ */
+void test_diff_subtrees__skips_identical_subtrees(void)
+{
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+	git_index *index;
+	git_tree *one, *two;
+	git_diff *diff;
+	git_oid one_id, two_id, subtree_id;
+	git_buf path = GIT_BUF_INIT;
+	char loose[GIT_OID_HEXSZ + 2];
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	add_file(index, "a/b/two.txt", "two\n");
+	add_file(index, "a/one.txt", "one\n");
+	add_file(index, "top.txt", "top\n");
+	cl_git_pass(git_index_write_tree(&one_id, index));
+
+	add_file(index, "top.txt", "changed\n");
+	cl_git_pass(git_index_write_tree(&two_id, index));
+	cl_git_pass(git_index_write(index));
+
+	cl_git_pass(git_tree_lookup(&one, g_repo, &one_id));
+	git_oid_cpy(&subtree_id, git_tree_entry_id(git_tree_entry_byname(one, "a")));
+	git_tree_free(one);
+
+	git_index_free(index);
+
+	git_oid_pathfmt(loose, &subtree_id);
+	loose[GIT_OID_HEXSZ + 1] = '\0';
+	cl_git_pass(git_buf_joinpath(&path, "empty_standard_repo/.git/objects", loose));
+	cl_must_pass(p_unlink(path.ptr));
+	git_buf_dispose(&path);
+
+	g_repo = cl_git_sandbox_reopen();
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_tree_lookup(&one, g_repo, &one_id));
+	cl_git_pass(git_tree_lookup(&two, g_repo, &two_id));
+
+	cl_git_pass(git_diff_tree_to_tree(&diff, g_repo, one, two, NULL));
+	assert_only_modified(diff, "top.txt");
+	git_diff_free(diff);
+
+	cl_git_pass(git_diff_tree_to_index(&diff, g_repo, one, index, NULL));
+	assert_only_modified(diff, "top.txt");
+	git_diff_free(diff);
+
+	/* listing the unmodified files needs to look into the tree */
+	opts.flags = GIT_DIFF_INCLUDE_UNMODIFIED;
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_diff_tree_to_tree(&diff, g_repo, one, two, &opts));
+
+	/* and so does a change below it in the index */
+	add_file(index, "a/b/two.txt", "changed\n");
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_diff_tree_to_index(&diff, g_repo, two, index, NULL));
+
+	git_tree_free(one);
+	git_tree_free(two);
+	git_index_free(index);
+}
+
+/* Check the changes against a diff that lists the unmodified files too */
+static void assert_same_changes(git_diff *everything, git_diff *actual)
+{
+	const git_diff_delta *e, *a;
+	size_t i, j = 0;
+
+	for (i = 0; i < git_diff_num_deltas(everything); i++) {
+		e = git_diff_get_delta(everything, i);
+
+		if (e->status == GIT_DELTA_UNMODIFIED)
+			continue;
+
+		cl_assert(j < git_diff_num_deltas(actual));
+		a = git_diff_get_delta(actual, j++);
+
+		cl_assert_equal_i(e->status, a->status);
+		cl_assert_equal_s(e->old_file.path, a->old_file.path);
+		cl_assert_equal_s(e->new_file.path, a->new_file.path);
+		cl_assert_equal_oid(&e->old_file.id, &a->old_file.id);
+		cl_assert_equal_oid(&e->new_file.id, &a->new_file.id);
+		cl_assert_equal_i(e->old_file.mode, a->old_file.mode);
+		cl_assert_equal_i(e->new_file.mode, a->new_file.mode);
+	}
+
+	cl_assert_equal_sz(j, git_diff_num_deltas(actual));
+}
+
+/*
+ * Diffing two trees, and a tree to an index that was read from the
+ * other, finds the same changes as looking into every one of the trees.
+ */
+static void assert_diffs_like_every_tree(
+	const char *old_commit, const char *new_commit, uint32_t flags)
+{
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+	git_index *index;
+	git_tree *old_tree, *new_tree;
+	git_diff *everything, *actual;
+
+	cl_assert((old_tree = resolve_commit_oid_to_tree(g_repo, old_commit)) != NULL);
+	cl_assert((new_tree = resolve_commit_oid_to_tree(g_repo, new_commit)) != NULL);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_read_tree(index, new_tree));
+
+	opts.flags = flags | GIT_DIFF_INCLUDE_UNMODIFIED;
+	cl_git_pass(git_diff_tree_to_tree(&everything, g_repo, old_tree, new_tree, &opts));
+
+	opts.flags = flags;
+
+	cl_git_pass(git_diff_tree_to_tree(&actual, g_repo, old_tree, new_tree, &opts));
+	assert_same_changes(everything, actual);
+	git_diff_free(actual);
+
+	cl_git_pass(git_diff_tree_to_index(&actual, g_repo, old_tree, index, &opts));
+	assert_same_changes(everything, actual);
+	git_diff_free(actual);
+
+	git_diff_free(everything);
+	git_index_free(index);
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+}
+
+void test_diff_subtrees__finds_the_same_changes(void)
+{
+	g_repo = cl_git_sandbox_init("attr");
+
+	assert_diffs_like_every_tree("605812a", "370fe9ec22", 0);
+	assert_diffs_like_every_tree("370fe9ec22", "605812a", 0);
+	assert_diffs_like_every_tree("f5b0af1fb4f5c", "370fe9ec22", 0);
+	assert_diffs_like_every_tree("605812a", "f5b0af1fb4f5c",
+		GIT_DIFF_INCLUDE_TYPECHANGE_TREES);
+
+	cl_git_sandbox_cleanup();
+	g_repo = cl_git_sandbox_init("testrepo");
+
+	assert_diffs_like_every_tree("5b5b025", "763d71a", 0);
+	assert_diffs_like_every_tree("763d71a", "5b5b025", 0);
+	assert_diffs_like_every_tree("a65fedf", "763d71a", 0);
+}
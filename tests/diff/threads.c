@@ -0,0 +1,163 @@
+#include "clar_libgit2.h"
+#include "diff_helpers.h"
+
+#include "diff.h"
+
+static git_repository *g_repo;
+
+void test_diff_threads__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* Print the diff on the calling thread, and on several threads */
+static void assert_threads_print_the_same(git_diff *diff)
+{
+	git_buf serial = GIT_BUF_INIT, threaded = GIT_BUF_INIT;
+
+	diff->opts.threads = 0;
+	cl_git_pass(git_diff_to_buf(&serial, diff, GIT_DIFF_FORMAT_PATCH));
+
+	diff->opts.threads = 4;
+	cl_git_pass(git_diff_to_buf(&threaded, diff, GIT_DIFF_FORMAT_PATCH));
+
+	cl_assert(serial.size > 0);
+	cl_assert_equal_s(serial.ptr, threaded.ptr);
+
+	git_buf_dispose(&serial);
+	git_buf_dispose(&threaded);
+}
+
+static void assert_trees_print_the_same(
+	const char *old_commit, const char *new_commit, uint32_t flags)
+{
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+	git_tree *old_tree, *new_tree;
+	git_diff *diff;
+
+	cl_assert((old_tree = resolve_commit_oid_to_tree(g_repo, old_commit)) != NULL);
+	cl_assert((new_tree = resolve_commit_oid_to_tree(g_repo, new_commit)) != NULL);
+
+	opts.flags = flags;
+	cl_git_pass(git_diff_tree_to_tree(&diff, g_repo, old_tree, new_tree, &opts));
+	assert_threads_print_the_same(diff);
+
+	git_diff_free(diff);
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+}
+
+void test_diff_threads__tree_to_tree(void)
+{
+	g_repo = cl_git_sandbox_init("attr");
+
+	assert_trees_print_the_same("605812a", "370fe9ec22", 0);
+	assert_trees_print_the_same("f5b0af1fb4f5c", "370fe9ec22", 0);
+	assert_trees_print_the_same("605812a", "f5b0af1fb4f5c",
+		GIT_DIFF_SHOW_BINARY | GIT_DIFF_INCLUDE_UNMODIFIED);
+}
+
+/* More files than the workers are given at a time */
+void test_diff_threads__many_files(void)
+{
+	git_index *index;
+	git_index_entry entry;
+	git_tree *old_tree, *new_tree;
+	git_diff *diff;
+	git_oid id;
+	git_buf path = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	size_t i, round;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	for (round = 0; round < 2; round++) {
+		for (i = 0; i < 300; i++) {
+			git_buf_clear(&path);
+			git_buf_clear(&content);
+
+			cl_git_pass(git_buf_printf(&path, "dir%" PRIuZ "/file%" PRIuZ ".txt", i % 7, i));
+			cl_git_pass(git_buf_printf(&content, "one\ntwo\nthree %" PRIuZ "\nfour\nfive\n", i));
+
+			/* change some of the files, and not the others */
+			if (round && i % 3)
+				cl_git_pass(git_buf_printf(&content, "six %" PRIuZ "\n", i));
+
+			memset(&entry, 0, sizeof(entry));
+			entry.path = path.ptr;
+			entry.mode = GIT_FILEMODE_BLOB;
+			cl_git_pass(git_index_add_frombuffer(index, &entry, content.ptr, content.size));
+		}
+
+		cl_git_pass(git_index_write_tree(&id, index));
+		cl_git_pass(git_tree_lookup(round ? &new_tree : &old_tree, g_repo, &id));
+	}
+
+	cl_git_pass(git_diff_tree_to_tree(&diff, g_repo, old_tree, new_tree, NULL));
+	cl_assert_equal_sz(200, git_diff_num_deltas(diff));
+	assert_threads_print_the_same(diff);
+
+	git_diff_free(diff);
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+	git_index_free(index);
+	git_buf_dispose(&path);
+	git_buf_dispose(&content);
+}
+
+void test_diff_threads__workdir(void)
+{
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+	git_tree *tree;
+	git_diff *diff;
+
+	g_repo = cl_git_sandbox_init("status");
+
+	opts.flags = GIT_DIFF_INCLUDE_UNTRACKED | GIT_DIFF_SHOW_UNTRACKED_CONTENT;
+
+	cl_git_pass(git_diff_index_to_workdir(&diff, g_repo, NULL, &opts));
+	assert_threads_print_the_same(diff);
+	git_diff_free(diff);
+
+	cl_assert((tree = resolve_commit_oid_to_tree(g_repo, "26a125ee1bf")) != NULL);
+	cl_git_pass(git_diff_tree_to_workdir_with_index(&diff, g_repo, tree, &opts));
+	assert_threads_print_the_same(diff);
+	git_diff_free(diff);
+	git_tree_free(tree);
+}
+
+static int stop_at_third_file(
+	const git_diff_delta *delta, float progress, void *payload)
+{
+	size_t *files = payload;
+
+	GIT_UNUSED(delta);
+	GIT_UNUSED(progress);
+
+	return (++*files == 3) ? -42 : 0;
+}
+
+void test_diff_threads__callbacks_can_stop(void)
+{
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+	git_tree *old_tree, *new_tree;
+	git_diff *diff;
+	size_t files = 0;
+
+	g_repo = cl_git_sandbox_init("attr");
+
+	cl_assert((old_tree = resolve_commit_oid_to_tree(g_repo, "605812a")) != NULL);
+	cl_assert((new_tree = resolve_commit_oid_to_tree(g_repo, "370fe9ec22")) != NULL);
+
+	opts.threads = 4;
+	cl_git_pass(git_diff_tree_to_tree(&diff, g_repo, old_tree, new_tree, &opts));
+	cl_assert(git_diff_num_deltas(diff) > 3);
+
+	cl_assert_equal_i(-42, git_diff_foreach(
+		diff, stop_at_third_file, NULL, NULL, NULL, &files));
+	cl_assert_equal_sz(3, files);
+
+	git_diff_free(diff);
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+}
@@ -0,0 +1,388 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/commit_graph.h>
+
+#include "commit_graph.h"
+#include "fileops.h"
+#include "odb.h"
+#include "oidarray.h"
+
+/*
+ * The commit-graphs that git wrote for some of the fixtures are kept apart
+ * from them, so that other tests do not read their commits from them.
+ */
+#define TESTREPO_GRAPH "commit-graph/testrepo.git/commit-graph"
+#define MERGE_RECURSIVE_CHAIN "commit-graph/merge-recursive"
+
+static void use_commit_graph_chain(git_repository *repo)
+{
+	git_buf chain_dir = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&chain_dir, git_repository_path(repo), "objects/info/commit-graphs"));
+	cl_git_pass(git_futils_mkdir(git_buf_cstr(&chain_dir), 0777, GIT_MKDIR_PATH));
+	cl_git_pass(git_futils_cp_r(cl_fixture(MERGE_RECURSIVE_CHAIN), git_buf_cstr(&chain_dir),
+		GIT_CPDIR_CREATE_EMPTY_DIRS, 0777));
+	git_buf_dispose(&chain_dir);
+}
+
+void test_graph_commitgraph__parse(void)
+{
+	git_commit_graph_file *file;
+	git_commit_graph_entry e, parent;
+	git_oid id;
+
+	cl_git_pass(git_commit_graph_file_open(&file, cl_fixture(TESTREPO_GRAPH)));
+	cl_assert_equal_i(file->num_commits, 15);
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id));
+	cl_assert_equal_oid(&e.sha1, &id);
+	cl_git_pass(git_oid_fromstr(&id, "418382dff1ffb8bdfba833f4d8bbcde58b1e7f47"));
+	cl_assert_equal_oid(&e.tree_oid, &id);
+	cl_assert_equal_i(e.generation, 1);
+	cl_assert_equal_i(e.commit_time, 1273610423);
+	cl_assert_equal_i(e.parent_count, 0);
+
+	cl_git_pass(git_oid_fromstr(&id, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id));
+	cl_assert_equal_oid(&e.sha1, &id);
+	cl_assert_equal_i(e.generation, 5);
+	cl_assert_equal_i(e.commit_time, 1274813907);
+	cl_assert_equal_i(e.parent_count, 2);
+
+	cl_git_pass(git_oid_fromstr(&id, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 0));
+	cl_assert_equal_oid(&parent.sha1, &id);
+	cl_assert_equal_i(parent.generation, 4);
+
+	cl_git_pass(git_oid_fromstr(&id, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 1));
+	cl_assert_equal_oid(&parent.sha1, &id);
+	cl_assert_equal_i(parent.generation, 3);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_commit_graph_entry_parent(&parent, file, &e, 2));
+
+	cl_git_pass(git_oid_fromstr(&id, "1810dff58d8a660512d4832e740f692884338ccd"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_commit_graph_entry_find(&e, file, &id));
+
+	git_commit_graph_file_free(file);
+}
+
+void test_graph_commitgraph__parse_split_chain(void)
+{
+	git_commit_graph_file *file;
+	git_commit_graph_entry e, parent;
+	git_oid id;
+
+	cl_git_pass(git_commit_graph_chain_open(&file, cl_fixture(MERGE_RECURSIVE_CHAIN)));
+	cl_assert(file->base != NULL);
+	cl_assert(file->base->base == NULL);
+	cl_assert_equal_i(file->num_base_commits, file->base->num_commits);
+
+	/* An octopus merge, whose parents are in the Extra Edge List */
+	cl_git_pass(git_oid_fromstr(&id, "d71c24b3b113fd1d1909998c5bfe33b86a65ee03"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id));
+	cl_assert_equal_oid(&e.sha1, &id);
+	cl_assert_equal_i(e.commit_time, 1447083009);
+	cl_assert_equal_i(e.parent_count, 3);
+
+	cl_git_pass(git_oid_fromstr(&id, "ad2ace9e15f66b3d1138922e6ffdc3ea3f967fa6"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 0));
+	cl_assert_equal_oid(&parent.sha1, &id);
+	cl_assert(parent.generation < e.generation);
+
+	cl_git_pass(git_oid_fromstr(&id, "483065df53c0f4a02cdc6b2910b05d388fc17ffb"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 1));
+	cl_assert_equal_oid(&parent.sha1, &id);
+
+	cl_git_pass(git_oid_fromstr(&id, "815b5a1c80ca749d705c7aa0cb294a00cbedd340"));
+	cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, 2));
+	cl_assert_equal_oid(&parent.sha1, &id);
+
+	git_commit_graph_file_free(file);
+}
+
+static void walk_all(git_array_oid_t *out, git_repository *repo)
+{
+	git_revwalk *walk;
+	git_oid id, *entry;
+	int error;
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_glob(walk, "*"));
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		entry = git_array_alloc(*out);
+		cl_assert(entry);
+		git_oid_cpy(entry, &id);
+	}
+	cl_git_fail_with(GIT_ITEROVER, error);
+
+	git_revwalk_free(walk);
+}
+
+void test_graph_commitgraph__revwalk_matches_object_parsing(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_commit_graph_file *file;
+	git_array_oid_t with_graph = GIT_ARRAY_INIT, without_graph = GIT_ARRAY_INIT;
+	size_t i;
+
+	repo = cl_git_sandbox_init("merge-recursive");
+	use_commit_graph_chain(repo);
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	cl_git_pass(git_odb__get_commit_graph_file(&file, odb));
+	git_commit_graph_file_release(file);
+	walk_all(&with_graph, repo);
+
+	cl_git_pass(git_futils_rmdir_r("merge-recursive/.git/objects/info/commit-graphs", NULL, GIT_RMDIR_REMOVE_FILES));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb__get_commit_graph_file(&file, odb));
+	walk_all(&without_graph, repo);
+
+	cl_assert(git_array_size(with_graph) > 0);
+	cl_assert_equal_i(git_array_size(with_graph), git_array_size(without_graph));
+	for (i = 0; i < git_array_size(with_graph); i++)
+		cl_assert_equal_oid(git_array_get(with_graph, i), git_array_get(without_graph, i));
+
+	git_array_clear(with_graph);
+	git_array_clear(without_graph);
+	git_odb_free(odb);
+	cl_git_sandbox_cleanup();
+}
+
+void test_graph_commitgraph__writer(void)
+{
+	git_repository *repo;
+	git_commit_graph_writer *w = NULL;
+	git_commit_graph_file ours, *expected;
+	git_commit_graph_entry ours_e, expected_e, ours_p, expected_p;
+	git_buf cgraph = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_oid quirky_commit;
+	size_t i, j;
+
+	memset(&ours, 0, sizeof(ours));
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+
+	cl_git_pass(git_commit_graph_writer_add_all_refs(w, repo));
+	cl_git_pass(git_commit_graph_writer_dump(&cgraph, w));
+	cl_git_pass(git_commit_graph_file_parse(&ours, (const unsigned char *)cgraph.ptr, cgraph.size));
+
+	/* The fixture was written by git with generation numbers of version 1 */
+	cl_git_pass(git_commit_graph_file_open(&expected, cl_fixture(TESTREPO_GRAPH)));
+	cl_assert_equal_i(git_buf_len(&cgraph), expected->graph_map.len);
+	cl_assert_equal_i(ours.num_commits, expected->num_commits);
+
+	/* git cannot parse the committer of this commit and records a time of 0 */
+	cl_git_pass(git_oid_fromstr(&quirky_commit, "258f0e2a959a364e40ed6603d5d44fbb24765b10"));
+
+	for (i = 0; i < ours.num_commits; i++) {
+		cl_assert_equal_oid(&ours.oid_lookup[i], &expected->oid_lookup[i]);
+		cl_git_pass(git_commit_graph_entry_find(&ours_e, &ours, &ours.oid_lookup[i]));
+		cl_git_pass(git_commit_graph_entry_find(&expected_e, expected, &ours.oid_lookup[i]));
+
+		cl_assert_equal_oid(&ours_e.tree_oid, &expected_e.tree_oid);
+		cl_assert_equal_i(ours_e.generation, expected_e.generation);
+		cl_assert_equal_i(ours_e.parent_count, expected_e.parent_count);
+		if (git_oid_cmp(&ours_e.sha1, &quirky_commit) != 0)
+			cl_assert_equal_i(ours_e.commit_time, expected_e.commit_time);
+
+		for (j = 0; j < ours_e.parent_count; j++) {
+			cl_git_pass(git_commit_graph_entry_parent(&ours_p, &ours, &ours_e, j));
+			cl_git_pass(git_commit_graph_entry_parent(&expected_p, expected, &expected_e, j));
+			cl_assert_equal_oid(&ours_p.sha1, &expected_p.sha1);
+		}
+	}
+
+	git_commit_graph_file_free(expected);
+	git_buf_dispose(&cgraph);
+	git_buf_dispose(&path);
+	git_commit_graph_writer_free(w);
+	git_repository_free(repo);
+}
+
+void test_graph_commitgraph__writer_adds_hidden_parents(void)
+{
+	git_repository *repo;
+	git_revwalk *walk;
+	git_commit_graph_writer *w = NULL;
+	git_commit_graph_file *file;
+	git_commit_graph_entry e;
+	git_odb *odb;
+	git_oid id;
+	git_buf path = GIT_BUF_INIT;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_revwalk_push(walk, &id));
+	cl_git_pass(git_oid_fromstr(&id, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+	cl_git_pass(git_revwalk_hide(walk, &id));
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	cl_git_pass(git_commit_graph_writer_commit(w));
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_pass(git_odb__get_commit_graph_file(&file, odb));
+
+	/* The whole history of the walked commit is present, down to the root */
+	cl_assert_equal_i(file->num_commits, 7);
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id));
+	cl_assert_equal_i(e.generation, 5);
+	cl_git_pass(git_oid_fromstr(&id, "8496071c1b46c854b31185ea97743be6a8774479"));
+	cl_git_pass(git_commit_graph_entry_find(&e, file, &id));
+	cl_assert_equal_i(e.generation, 1);
+
+	git_commit_graph_file_release(file);
+	git_odb_free(odb);
+	git_buf_dispose(&path);
+	git_commit_graph_writer_free(w);
+	git_revwalk_free(walk);
+	cl_git_sandbox_cleanup();
+}
+
+static void write_commit_graph(git_repository *repo)
+{
+	git_commit_graph_writer *w;
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+	cl_git_pass(git_commit_graph_writer_add_all_refs(w, repo));
+	cl_git_pass(git_commit_graph_writer_commit(w));
+
+	git_commit_graph_writer_free(w);
+	git_buf_dispose(&path);
+}
+
+void test_graph_commitgraph__refresh_leaves_the_old_file_to_its_users(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_commit_graph_file *old, *new;
+	git_commit_graph_entry e;
+	git_oid id;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	write_commit_graph(repo);
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_pass(git_odb__get_commit_graph_file(&old, odb));
+	cl_assert_equal_i(2, git_atomic_get(&old->rc.refcount));
+
+	/* the odb lets go of the file it replaces */
+	write_commit_graph(repo);
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_pass(git_odb__get_commit_graph_file(&new, odb));
+	cl_assert(old != new);
+	cl_assert_equal_i(1, git_atomic_get(&old->rc.refcount));
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_commit_graph_entry_find(&e, old, &id));
+
+	git_commit_graph_file_release(old);
+	git_commit_graph_file_release(new);
+	git_odb_free(odb);
+	cl_git_sandbox_cleanup();
+}
+
+struct pair_results {
+	int descendant_of;
+	size_t ahead, behind;
+	int has_merge_base;
+	git_oid merge_base;
+	size_t walk_count;
+};
+
+static void compute_pair_results(
+	struct pair_results *out, git_repository *repo, git_array_oid_t *commits)
+{
+	git_revwalk *walk;
+	git_oid *one, *two, id;
+	size_t i, j, n = git_array_size(*commits);
+	int error;
+
+	for (i = 0; i < n; i++) {
+		one = git_array_get(*commits, i);
+
+		for (j = 0; j < n; j++) {
+			struct pair_results *r = &out[i * n + j];
+			two = git_array_get(*commits, j);
+
+			r->descendant_of = git_graph_descendant_of(repo, one, two);
+			cl_assert(r->descendant_of >= 0);
+			cl_git_pass(git_graph_ahead_behind(&r->ahead, &r->behind, repo, one, two));
+
+			error = git_merge_base(&r->merge_base, repo, one, two);
+			cl_assert(error == 0 || error == GIT_ENOTFOUND);
+			r->has_merge_base = (error == 0);
+
+			cl_git_pass(git_revwalk_new(&walk, repo));
+			cl_git_pass(git_revwalk_push(walk, one));
+			cl_git_pass(git_revwalk_hide(walk, two));
+			while ((error = git_revwalk_next(&id, walk)) == 0)
+				r->walk_count++;
+			cl_git_fail_with(GIT_ITEROVER, error);
+			git_revwalk_free(walk);
+		}
+	}
+}
+
+void test_graph_commitgraph__generation_pruning_matches_object_parsing(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_commit_graph_file *file;
+	git_array_oid_t commits = GIT_ARRAY_INIT;
+	struct pair_results *with_graph, *without_graph;
+	size_t i, n;
+
+	repo = cl_git_sandbox_init("merge-recursive");
+	use_commit_graph_chain(repo);
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb__get_commit_graph_file(&file, odb));
+	git_commit_graph_file_release(file);
+
+	walk_all(&commits, repo);
+	n = git_array_size(commits);
+
+	with_graph = git__calloc(n * n, sizeof(struct pair_results));
+	without_graph = git__calloc(n * n, sizeof(struct pair_results));
+	cl_assert(with_graph && without_graph);
+
+	compute_pair_results(with_graph, repo, &commits);
+
+	cl_git_pass(git_futils_rmdir_r("merge-recursive/.git/objects/info/commit-graphs", NULL, GIT_RMDIR_REMOVE_FILES));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb__get_commit_graph_file(&file, odb));
+
+	compute_pair_results(without_graph, repo, &commits);
+
+	for (i = 0; i < n * n; i++) {
+		cl_assert_equal_i(with_graph[i].descendant_of, without_graph[i].descendant_of);
+		cl_assert_equal_i(with_graph[i].ahead, without_graph[i].ahead);
+		cl_assert_equal_i(with_graph[i].behind, without_graph[i].behind);
+		cl_assert_equal_i(with_graph[i].has_merge_base, without_graph[i].has_merge_base);
+		if (with_graph[i].has_merge_base)
+			cl_assert_equal_oid(&with_graph[i].merge_base, &without_graph[i].merge_base);
+		cl_assert_equal_i(with_graph[i].walk_count, without_graph[i].walk_count);
+	}
+
+	git__free(with_graph);
+	git__free(without_graph);
+	git_array_clear(commits);
+	git_odb_free(odb);
+	cl_git_sandbox_cleanup();
+}
@@ -0,0 +1,157 @@
+#include "clar_libgit2.h"
+#include "index.h"
+#include "hash.h"
+
+static git_repository *g_repo = NULL;
+
+#define ENTRIES 500
+
+void test_index_offsets__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo");
+}
+
+void test_index_offsets__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	g_repo = NULL;
+}
+
+static void add_entries(git_index *index)
+{
+	git_index_entry entry;
+	char path[64];
+	size_t i;
+
+	for (i = 0; i < ENTRIES; i++) {
+		memset(&entry, 0, sizeof(entry));
+		p_snprintf(path, sizeof(path), "dir%02d/subdir/file%03d.txt",
+			(int)(i % 20), (int)i);
+		entry.path = path;
+		entry.mode = GIT_FILEMODE_BLOB;
+		cl_git_pass(git_index_add_frombuffer(index, &entry, path, strlen(path)));
+	}
+}
+
+static bool has_extension(const git_buf *buf, const char *signature)
+{
+	return git__memmem(buf->ptr, buf->size, signature, 4) != NULL;
+}
+
+static void assert_same_entries(git_index *index, git_index *expected)
+{
+	const git_index_entry *a, *b;
+	size_t i;
+
+	cl_assert_equal_sz(git_index_entrycount(expected), git_index_entrycount(index));
+
+	for (i = 0; i < git_index_entrycount(expected); i++) {
+		cl_assert(a = git_index_get_byindex(index, i));
+		cl_assert(b = git_index_get_byindex(expected, i));
+		cl_assert_equal_s(b->path, a->path);
+		cl_assert_equal_oid(&b->id, &a->id);
+		cl_assert(git_index_get_bypath(index, b->path, 0) != NULL);
+	}
+}
+
+static void roundtrip(unsigned int version)
+{
+	git_index *index, *expected;
+	git_buf buf = GIT_BUF_INIT;
+	git_oid tree_id;
+
+	cl_repo_set_string(g_repo, "index.threads", "4");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_set_version(index, version));
+	add_entries(index);
+
+	/* the extensions are read alongside the entries */
+	cl_git_pass(git_index_write_tree(&tree_id, index));
+	cl_git_pass(git_index_write(index));
+
+	cl_git_pass(git_futils_readbuffer(&buf, git_index_path(index)));
+	cl_assert(has_extension(&buf, "EOIE"));
+	cl_assert(has_extension(&buf, "IEOT"));
+
+	/* the end of index entries extension is the last one */
+	cl_assert_equal_i(0, memcmp(buf.ptr + buf.size - GIT_OID_RAWSZ - 32, "EOIE", 4));
+
+	/* read it with threads, and without */
+	cl_git_pass(git_index_read(index, true));
+	cl_assert_equal_i(version, git_index_version(index));
+
+	/* an index without a repository is read on a single thread */
+	cl_git_pass(git_index_open(&expected, git_index_path(index)));
+	assert_same_entries(index, expected);
+	cl_assert(index->tree != NULL);
+	cl_assert_equal_oid(&tree_id, &index->tree->oid);
+	cl_assert_equal_oid(git_index_checksum(expected), git_index_checksum(index));
+
+	git_buf_dispose(&buf);
+	git_index_free(expected);
+	git_index_free(index);
+}
+
+void test_index_offsets__roundtrip_v2(void)
+{
+	roundtrip(2);
+}
+
+void test_index_offsets__roundtrip_v4(void)
+{
+	roundtrip(4);
+}
+
+void test_index_offsets__not_recorded_by_default(void)
+{
+	git_index *index;
+	git_buf buf = GIT_BUF_INIT;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_entries(index);
+	cl_git_pass(git_index_write(index));
+
+	cl_git_pass(git_futils_readbuffer(&buf, git_index_path(index)));
+	cl_assert(!has_extension(&buf, "EOIE"));
+	cl_assert(!has_extension(&buf, "IEOT"));
+
+	/* they can be requested without threads */
+	cl_repo_set_bool(g_repo, "index.recordEndOfIndexEntries", true);
+	cl_git_pass(git_index_write(index));
+
+	cl_git_pass(git_futils_readbuffer(&buf, git_index_path(index)));
+	cl_assert(has_extension(&buf, "EOIE"));
+	cl_assert(!has_extension(&buf, "IEOT"));
+
+	git_buf_dispose(&buf);
+	git_index_free(index);
+}
+
+void test_index_offsets__ignores_invalid_eoie(void)
+{
+	git_index *index, *expected;
+	git_buf buf = GIT_BUF_INIT;
+	git_oid checksum;
+
+	cl_repo_set_string(g_repo, "index.threads", "4");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_entries(index);
+	cl_git_pass(git_index_write(index));
+	cl_git_pass(git_index_open(&expected, git_index_path(index)));
+
+	/* damage the hash of the extension headers and fix up the checksum */
+	cl_git_pass(git_futils_readbuffer(&buf, git_index_path(index)));
+	buf.ptr[buf.size - GIT_OID_RAWSZ - 1] ^= 0xff;
+	cl_git_pass(git_hash_buf(&checksum, buf.ptr, buf.size - GIT_OID_RAWSZ));
+	memcpy(buf.ptr + buf.size - GIT_OID_RAWSZ, checksum.id, GIT_OID_RAWSZ);
+	cl_git_pass(git_futils_writebuffer(&buf, git_index_path(index), O_WRONLY | O_TRUNC, 0644));
+
+	cl_git_pass(git_index_read(index, true));
+	assert_same_entries(index, expected);
+
+	git_buf_dispose(&buf);
+	git_index_free(expected);
+	git_index_free(index);
+}
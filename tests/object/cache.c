@@ -1,5 +1,6 @@
 #include "clar_libgit2.h"
 #include "repository.h"
+#include "odb.h"
 
 static git_repository *g_repo;
 static size_t cache_limit;
@@ -41,6 +42,8 @@ void test_object_cache__cleanup(void)
 	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJECT_BLOB, (size_t)0);
 	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJECT_TREE, (size_t)4096);
 	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJECT_COMMIT, (size_t)4096);
+	git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, (int)GIT_OBJECT_BLOB, (ssize_t)(64 * 1024 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)(256 * 1024 * 1024));
 }
 
 static struct {
@@ -274,3 +277,145 @@ void test_object_cache__fast_thread_rush(void)
 		g_repo = NULL;
 	}
 }
+
+static git_odb_object *new_object(git_object_t type, const char *sha, size_t size)
+{
+	git_odb_object *obj = git__calloc(1, sizeof(git_odb_object));
+
+	cl_assert(obj);
+	cl_git_pass(git_oid_fromstr(&obj->cached.oid, sha));
+	obj->cached.type = type;
+	obj->cached.size = size;
+
+	return obj;
+}
+
+static void store(git_cache *cache, git_odb_object *obj)
+{
+	git_odb_object_free(git_cache_store_raw(cache, obj));
+}
+
+/* Look up by id: the objects that the cache evicts are freed */
+static bool cached(git_cache *cache, const char *sha)
+{
+	git_odb_object *found;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, sha));
+	found = git_cache_get_raw(cache, &id);
+
+	git_odb_object_free(found);
+	return found != NULL;
+}
+
+void test_object_cache__evicts_unreferenced_objects_first(void)
+{
+	git_cache cache;
+	const char *a_id = "f1425cef211cc08caa31e7b545ffb232acb098c3",
+		*b_id = "9a03079b8a8ee85a0bee58bf9be3da8b62414ed4",
+		*c_id = "b6361fc6a97178d8fc8639fdeed71c775ab52593",
+		*d_id = "3259a6bd5b57fb9c1281bb7ed3167b50f224cb54";
+	ssize_t current, allowed;
+	size_t hits, misses, evictions;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &current, &allowed));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, current + 300));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_RESET_CACHE_STATS));
+	cl_git_pass(git_cache_init(&cache));
+
+	store(&cache, new_object(GIT_OBJECT_TREE, a_id, 100));
+	store(&cache, new_object(GIT_OBJECT_TREE, b_id, 100));
+	store(&cache, new_object(GIT_OBJECT_TREE, c_id, 100));
+	cl_assert_equal_sz(3, git_cache_size(&cache));
+
+	/* `a` is the oldest entry, but it is used again */
+	cl_assert(cached(&cache, a_id));
+
+	store(&cache, new_object(GIT_OBJECT_TREE, d_id, 100));
+	cl_assert_equal_sz(3, git_cache_size(&cache));
+
+	cl_assert(cached(&cache, a_id));
+	cl_assert(!cached(&cache, b_id));
+	cl_assert(cached(&cache, c_id));
+	cl_assert(cached(&cache, d_id));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions));
+	cl_assert_equal_sz(4, hits);
+	cl_assert_equal_sz(1, misses);
+	cl_assert_equal_sz(1, evictions);
+
+	git_cache_dispose(&cache);
+}
+
+/* Storing an object that is already cached does not make room for it */
+void test_object_cache__storing_a_cached_object_evicts_nothing(void)
+{
+	git_cache cache;
+	const char *a_id = "f1425cef211cc08caa31e7b545ffb232acb098c3",
+		*b_id = "9a03079b8a8ee85a0bee58bf9be3da8b62414ed4",
+		*c_id = "b6361fc6a97178d8fc8639fdeed71c775ab52593";
+	ssize_t current, allowed;
+	size_t hits, misses, evictions;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &current, &allowed));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, current + 300));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_RESET_CACHE_STATS));
+	cl_git_pass(git_cache_init(&cache));
+
+	store(&cache, new_object(GIT_OBJECT_TREE, a_id, 100));
+	store(&cache, new_object(GIT_OBJECT_TREE, b_id, 100));
+	store(&cache, new_object(GIT_OBJECT_TREE, c_id, 100));
+
+	store(&cache, new_object(GIT_OBJECT_TREE, a_id, 100));
+	store(&cache, new_object(GIT_OBJECT_TREE, c_id, 100));
+	cl_assert_equal_sz(3, git_cache_size(&cache));
+
+	cl_assert(cached(&cache, a_id));
+	cl_assert(cached(&cache, b_id));
+	cl_assert(cached(&cache, c_id));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions));
+	cl_assert_equal_sz(0, evictions);
+
+	git_cache_dispose(&cache);
+}
+
+void test_object_cache__per_type_limits(void)
+{
+	git_cache cache;
+	const char *tree_id = "f1425cef211cc08caa31e7b545ffb232acb098c3",
+		*blob1_id = "a8233120f6ad708f843d861ce2b7228ec4e3dec6",
+		*blob2_id = "3697d64be941a53d4ae8f6a271e4e3fa56b022cc",
+		*blob3_id = "a71586c1dfe8a71c6cbf6c129f404c5642ff31bd",
+		*big_blob_id = "1385f264afb75a56a5bec74243be9b367ba4ca08";
+	ssize_t current, allowed;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJECT_BLOB, (size_t)4096));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, (int)GIT_OBJECT_BLOB, (ssize_t)250));
+	cl_git_pass(git_cache_init(&cache));
+
+	store(&cache, new_object(GIT_OBJECT_TREE, tree_id, 100));
+	store(&cache, new_object(GIT_OBJECT_BLOB, blob1_id, 100));
+	store(&cache, new_object(GIT_OBJECT_BLOB, blob2_id, 100));
+	store(&cache, new_object(GIT_OBJECT_BLOB, blob3_id, 100));
+
+	/* the blobs only evict each other */
+	cl_assert(cached(&cache, tree_id));
+	cl_assert(!cached(&cache, blob1_id));
+	cl_assert(cached(&cache, blob2_id));
+	cl_assert(cached(&cache, blob3_id));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_TYPE_MEMORY, (int)GIT_OBJECT_BLOB, &current, &allowed));
+	cl_assert_equal_i(200, current);
+	cl_assert_equal_i(250, allowed);
+
+	/* objects larger than the limit of their type are not cached */
+	store(&cache, new_object(GIT_OBJECT_BLOB, big_blob_id, 300));
+	cl_assert(!cached(&cache, big_blob_id));
+	cl_assert(cached(&cache, blob2_id));
+
+	git_cache_dispose(&cache);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_TYPE_MEMORY, (int)GIT_OBJECT_BLOB, &current, &allowed));
+	cl_assert_equal_i(0, current);
+}
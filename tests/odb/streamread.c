@@ -0,0 +1,145 @@
+#include "clar_libgit2.h"
+
+#include "array.h"
+
+static git_array_t(git_oid) g_ids;
+static size_t g_max_size;
+
+void test_odb_streamread__initialize(void)
+{
+	size_t current;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY, &current, &g_max_size));
+}
+
+void test_odb_streamread__cleanup(void)
+{
+	git_array_clear(g_ids);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, g_max_size));
+	cl_fixture_cleanup("streamread.git");
+}
+
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_oid *out = git_array_alloc(g_ids);
+
+	GIT_UNUSED(payload);
+
+	cl_assert(out);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+/* Stream the object `blocksize` bytes at a time, and compare it to a read */
+static void assert_streams_like_read(git_odb *odb, const git_oid *id, size_t blocksize)
+{
+	git_odb_stream *stream;
+	git_odb_object *obj;
+	git_object_t type;
+	git_buf content = GIT_BUF_INIT;
+	char *buf = git__malloc(blocksize);
+	size_t len;
+	int ret;
+
+	cl_assert(buf);
+	cl_git_pass(git_odb_open_rstream(&stream, &len, &type, odb, id));
+
+	while ((ret = git_odb_stream_read(stream, buf, blocksize)) > 0) {
+		cl_assert((size_t)ret <= blocksize);
+		cl_git_pass(git_buf_put(&content, buf, ret));
+	}
+	cl_assert_equal_i(0, ret);
+
+	cl_git_pass(git_odb_read(&obj, odb, id));
+	cl_assert_equal_i(git_odb_object_type(obj), type);
+	cl_assert_equal_sz(git_odb_object_size(obj), len);
+	cl_assert_equal_sz(len, content.size);
+	cl_assert(memcmp(git_odb_object_data(obj), content.ptr, len) == 0);
+
+	git_odb_object_free(obj);
+	git_odb_stream_free(stream);
+	git_buf_dispose(&content);
+	git__free(buf);
+}
+
+static void assert_all_stream_like_read(const char *objects_dir, size_t blocksize)
+{
+	git_odb *odb;
+	git_oid *id;
+	size_t i;
+
+	cl_git_pass(git_odb_open(&odb, objects_dir));
+
+	if (!git_array_size(g_ids))
+		cl_git_pass(git_odb_foreach(odb, collect_id, NULL));
+
+	git_array_foreach(g_ids, i, id)
+		assert_streams_like_read(odb, id, blocksize);
+
+	git_odb_free(odb);
+}
+
+void test_odb_streamread__packed_objects(void)
+{
+	assert_all_stream_like_read(cl_fixture("testrepo.git/objects"), 4096);
+	assert_all_stream_like_read(cl_fixture("testrepo.git/objects"), 7);
+}
+
+void test_odb_streamread__packed_objects_without_base_cache(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, (size_t)0));
+
+	assert_all_stream_like_read(cl_fixture("testrepo.git/objects"), 4096);
+	assert_all_stream_like_read(cl_fixture("testrepo.git/objects"), 1);
+}
+
+/*
+ * Revisions of a file that is larger than what the stream inflates of
+ * a base at a time, where parts of the file move around, so that the
+ * deltas also copy from before where the previous copy ended.
+ */
+void test_odb_streamread__large_delta_chains(void)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_buf content = GIT_BUF_INIT;
+	git_oid *id;
+	size_t i, half;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, (size_t)0));
+	cl_git_pass(git_repository_init(&repo, "streamread.git", 1));
+
+	for (i = 0; i < 64 * 1024; i++)
+		cl_git_pass(git_buf_printf(&content, "line %06" PRIuZ " as it was\n", i));
+
+	for (i = 0; i < 12; i++) {
+		memcpy(content.ptr + (i * 7919 % (64 * 1024)) * 22 + 12, "edited", 6);
+
+		/* every so often, swap the two halves */
+		if (i % 4 == 3) {
+			git_buf swapped = GIT_BUF_INIT;
+
+			half = (content.size / 2 / 22) * 22;
+			cl_git_pass(git_buf_put(&swapped, content.ptr + half, content.size - half));
+			cl_git_pass(git_buf_put(&swapped, content.ptr, half));
+			git_buf_swap(&swapped, &content);
+			git_buf_dispose(&swapped);
+		}
+
+		cl_assert(id = git_array_alloc(g_ids));
+		cl_git_pass(git_blob_create_frombuffer(id, repo, content.ptr, content.size));
+	}
+
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	git_array_foreach(g_ids, i, id)
+		cl_git_pass(git_packbuilder_insert(pb, id, NULL));
+	cl_git_pass(git_packbuilder_write(pb, "streamread.git/objects/pack", 0, NULL, NULL));
+
+	git_packbuilder_free(pb);
+	git_repository_free(repo);
+	git_buf_dispose(&content);
+
+	/* the packed objects are looked up before the loose ones */
+	assert_all_stream_like_read("streamread.git/objects", 64 * 1024);
+	assert_all_stream_like_read("streamread.git/objects", 1000);
+}
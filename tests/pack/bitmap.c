@@ -0,0 +1,264 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+
+#include "ewah.h"
+#include "fileops.h"
+#include "pack-bitmap.h"
+#include "pack-objects.h"
+
+static git_repository *_repo;
+
+void test_pack_bitmap__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	_repo = NULL;
+}
+
+void test_pack_bitmap__ewah_roundtrip(void)
+{
+	git_bitmap bitmap = GIT_BITMAP_INIT, read = GIT_BITMAP_INIT;
+	git_buf buf = GIT_BUF_INIT;
+	size_t i, consumed;
+
+	cl_git_pass(git_bitmap_set(&bitmap, 3));
+	for (i = 64; i < 64 * 5; i++)
+		cl_git_pass(git_bitmap_set(&bitmap, i));
+	cl_git_pass(git_bitmap_set(&bitmap, 1000));
+	cl_git_pass(git_bitmap_set(&bitmap, 1030));
+
+	/* bits after the size of the bitmap are not written */
+	cl_git_pass(git_bitmap_set(&bitmap, 1040));
+
+	cl_git_pass(git_ewah_write(&buf, &bitmap, 1035));
+	cl_git_pass(git_ewah_read(&read, &consumed, (const unsigned char *)buf.ptr, buf.size));
+	cl_assert_equal_sz(consumed, buf.size);
+
+	cl_assert_equal_sz(git_bitmap_popcount(&read), 1 + 64 * 4 + 2);
+	cl_assert(git_bitmap_get(&read, 3));
+	cl_assert(!git_bitmap_get(&read, 4));
+	cl_assert(git_bitmap_get(&read, 64 * 5 - 1));
+	cl_assert(!git_bitmap_get(&read, 64 * 5));
+	cl_assert(git_bitmap_get(&read, 1030));
+	cl_assert(!git_bitmap_get(&read, 1040));
+
+	/* truncated bitmaps are rejected */
+	cl_git_fail(git_ewah_read(&read, &consumed, (const unsigned char *)buf.ptr, buf.size - 1));
+
+	git_bitmap_dispose(&bitmap);
+	git_bitmap_dispose(&read);
+	git_buf_dispose(&buf);
+}
+
+struct check_types_data {
+	git_pack_bitmap_index *idx;
+	git_odb *odb;
+	size_t count;
+};
+
+static int check_object_type(size_t pos, void *payload)
+{
+	struct check_types_data *data = payload;
+	git_object_t type, expected_type;
+	uint32_t name_hash;
+	size_t size;
+	git_oid id;
+
+	cl_git_pass(git_pack_bitmap_object(&id, &type, &name_hash, data->idx, pos));
+	cl_git_pass(git_odb_read_header(&size, &expected_type, data->odb, &id));
+	cl_assert_equal_i(type, expected_type);
+
+	data->count++;
+	return 0;
+}
+
+void test_pack_bitmap__reachable(void)
+{
+	git_pack_bitmap_index *idx;
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	struct check_types_data data = {0};
+	git_oid id;
+
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo-bitmap.git")));
+	cl_git_pass(git_repository_odb(&data.odb, _repo));
+	cl_git_pass(git_pack_bitmap_index_load(&idx, _repo));
+	cl_assert_equal_sz(git_pack_bitmap_index_num_objects(idx), 55);
+
+	/* master is a tip of the pack, so it has a stored bitmap */
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_pack_bitmap_reachable(&bitmap, idx, &id, 1));
+	cl_assert_equal_sz(git_bitmap_popcount(&bitmap), 20);
+
+	data.idx = idx;
+	cl_git_pass(git_bitmap_foreach(&bitmap, check_object_type, &data));
+	cl_assert_equal_sz(data.count, 20);
+
+	/* a commit without a bitmap of its own */
+	git_bitmap_clear(&bitmap);
+	cl_git_pass(git_oid_fromstr(&id, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+	cl_git_pass(git_pack_bitmap_reachable(&bitmap, idx, &id, 1));
+	cl_assert_equal_sz(git_bitmap_popcount(&bitmap), 12);
+
+	git_bitmap_dispose(&bitmap);
+	git_pack_bitmap_index_free(idx);
+	git_odb_free(data.odb);
+	git_repository_free(_repo);
+	_repo = NULL;
+}
+
+static void build_pack(git_packbuilder **out, const char *want, const char *have, int use_bitmaps)
+{
+	git_config *config;
+	git_revwalk *walk;
+
+	cl_git_pass(git_repository_config(&config, _repo));
+	cl_git_pass(git_config_set_bool(config, "pack.useBitmaps", use_bitmaps));
+	git_config_free(config);
+
+	cl_git_pass(git_packbuilder_new(out, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_ref(walk, want));
+	if (have)
+		cl_git_pass(git_revwalk_hide_ref(walk, have));
+
+	cl_git_pass(git_packbuilder_insert_walk(*out, walk));
+	git_revwalk_free(walk);
+}
+
+static void assert_same_objects(git_packbuilder *a, git_packbuilder *b)
+{
+	size_t i;
+
+	cl_assert_equal_sz(git_packbuilder_object_count(a), git_packbuilder_object_count(b));
+
+	for (i = 0; i < a->nr_objects; i++)
+		cl_assert(git_oidmap_exists(b->object_ix, &a->object_list[i].id));
+}
+
+void test_pack_bitmap__insert_walk(void)
+{
+	git_packbuilder *with_bitmaps, *without_bitmaps;
+
+	_repo = cl_git_sandbox_init("testrepo-bitmap.git");
+
+	build_pack(&with_bitmaps, "refs/heads/master", NULL, 1);
+	build_pack(&without_bitmaps, "refs/heads/master", NULL, 0);
+	cl_assert_equal_sz(git_packbuilder_object_count(with_bitmaps), 20);
+	assert_same_objects(with_bitmaps, without_bitmaps);
+	git_packbuilder_free(with_bitmaps);
+	git_packbuilder_free(without_bitmaps);
+
+	/*
+	 * Everything reachable from the uninteresting commit is excluded,
+	 * not only the objects of its tree.
+	 */
+	build_pack(&with_bitmaps, "refs/heads/master", "refs/heads/br2", 1);
+	cl_assert_equal_sz(git_packbuilder_object_count(with_bitmaps), 4);
+	git_packbuilder_free(with_bitmaps);
+}
+
+void test_pack_bitmap__objects_outside_the_pack(void)
+{
+	git_packbuilder *with_bitmaps, *without_bitmaps;
+	git_signature *sig;
+	git_commit *parent;
+	git_tree *tree;
+	git_index *index;
+	git_oid tree_id, commit_id;
+
+	_repo = cl_git_sandbox_init("testrepo-bitmap.git");
+
+	/* create a loose commit and tree on top of master */
+	cl_git_pass(git_index_new(&index));
+	cl_git_pass(git_revparse_single((git_object **)&parent, _repo, "master"));
+	cl_git_pass(git_commit_tree(&tree, parent));
+	cl_git_pass(git_index_read_tree(index, tree));
+	cl_git_pass(git_index_remove_bypath(index, "README"));
+	cl_git_pass(git_index_write_tree_to(&tree_id, index, _repo));
+	git_tree_free(tree);
+
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+	cl_git_pass(git_signature_new(&sig, "me", "me@example.com", 1234567890, 0));
+	cl_git_pass(git_commit_create_v(&commit_id, _repo, "refs/heads/master",
+		sig, sig, NULL, "remove README", tree, 1, parent));
+
+	build_pack(&with_bitmaps, "refs/heads/master", NULL, 1);
+	build_pack(&without_bitmaps, "refs/heads/master", NULL, 0);
+	cl_assert_equal_sz(git_packbuilder_object_count(with_bitmaps), 22);
+	assert_same_objects(with_bitmaps, without_bitmaps);
+
+	git_packbuilder_free(with_bitmaps);
+	git_packbuilder_free(without_bitmaps);
+	git_signature_free(sig);
+	git_commit_free(parent);
+	git_tree_free(tree);
+	git_index_free(index);
+}
+
+void test_pack_bitmap__write(void)
+{
+	git_packbuilder *pb, *expected;
+	git_pack_bitmap_index *idx;
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	git_revwalk *walk;
+	git_buf path = GIT_BUF_INIT;
+	git_oid id;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/heads/*"));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	git_revwalk_free(walk);
+
+	git_packbuilder_set_write_bitmap(pb, 1);
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), "objects/pack"));
+	cl_git_pass(git_packbuilder_write(pb, path.ptr, 0, NULL, NULL));
+
+	cl_git_pass(git_buf_joinpath(&path, path.ptr, "pack-"));
+	cl_git_pass(git_buf_puts(&path, git_oid_tostr_s(git_packbuilder_hash(pb))));
+	cl_git_pass(git_buf_puts(&path, ".idx"));
+	cl_git_pass(git_pack_bitmap_index_open(&idx, _repo, path.ptr));
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_pack_bitmap_reachable(&bitmap, idx, &id, 1));
+
+	build_pack(&expected, "refs/heads/master", NULL, 0);
+	cl_assert_equal_sz(git_bitmap_popcount(&bitmap), git_packbuilder_object_count(expected));
+
+	git_packbuilder_free(expected);
+	git_bitmap_dispose(&bitmap);
+	git_pack_bitmap_index_free(idx);
+	git_packbuilder_free(pb);
+	git_buf_dispose(&path);
+}
+
+void test_pack_bitmap__write_skips_incomplete_packs(void)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_buf path = GIT_BUF_INIT;
+	struct stat st;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_ref(walk, "refs/heads/master"));
+	cl_git_pass(git_revwalk_hide_ref(walk, "refs/heads/br2"));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	git_revwalk_free(walk);
+
+	git_packbuilder_set_write_bitmap(pb, 1);
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), "objects/pack"));
+	cl_git_pass(git_packbuilder_write(pb, path.ptr, 0, NULL, NULL));
+
+	cl_git_pass(git_buf_joinpath(&path, path.ptr, "pack-"));
+	cl_git_pass(git_buf_puts(&path, git_oid_tostr_s(git_packbuilder_hash(pb))));
+	cl_git_pass(git_buf_puts(&path, ".bitmap"));
+	cl_git_fail(p_stat(path.ptr, &st));
+
+	git_packbuilder_free(pb);
+	git_buf_dispose(&path);
+}
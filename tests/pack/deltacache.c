@@ -0,0 +1,207 @@
+#include "clar_libgit2.h"
+
+#include "array.h"
+#include "pack-cache.h"
+
+static size_t g_max_size;
+static git_array_t(git_oid) g_ids;
+
+void test_pack_deltacache__initialize(void)
+{
+	size_t current;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY, &current, &g_max_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_RESET_DELTA_BASE_CACHE_STATS));
+}
+
+void test_pack_deltacache__cleanup(void)
+{
+	git_array_clear(g_ids);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, g_max_size));
+}
+
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_oid *out = git_array_alloc(g_ids);
+
+	GIT_UNUSED(payload);
+
+	cl_assert(out);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+/* Read every object of a freshly opened database, and check its id */
+static void read_all(void)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid *id, actual;
+	size_t i;
+
+	cl_git_pass(git_odb_open(&odb, cl_fixture("testrepo.git/objects")));
+
+	if (!git_array_size(g_ids))
+		cl_git_pass(git_odb_foreach(odb, collect_id, NULL));
+
+	git_array_foreach(g_ids, i, id) {
+		cl_git_pass(git_odb_read(&obj, odb, id));
+		cl_git_pass(git_odb_hash(&actual, git_odb_object_data(obj),
+			git_odb_object_size(obj), git_odb_object_type(obj)));
+		cl_assert_equal_oid(id, &actual);
+		git_odb_object_free(obj);
+	}
+
+	git_odb_free(odb);
+}
+
+void test_pack_deltacache__reuses_bases(void)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid *id;
+	size_t hits, misses, saved, current, allowed, i;
+
+	read_all();
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS, &hits, &misses, &saved));
+	cl_assert(hits > 0);
+	cl_assert(misses > 0);
+	cl_assert(saved > 0);
+
+	/* the bases are dropped along with their packfiles */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY, &current, &allowed));
+	cl_assert_equal_sz(0, current);
+	cl_assert_equal_sz(g_max_size, allowed);
+
+	cl_git_pass(git_odb_open(&odb, cl_fixture("testrepo.git/objects")));
+
+	git_array_foreach(g_ids, i, id) {
+		cl_git_pass(git_odb_read(&obj, odb, id));
+		git_odb_object_free(obj);
+	}
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY, &current, &allowed));
+	cl_assert(current > 0);
+
+	git_odb_free(odb);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_RESET_DELTA_BASE_CACHE_STATS));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS, &hits, &misses, &saved));
+	cl_assert_equal_sz(0, hits);
+	cl_assert_equal_sz(0, misses);
+	cl_assert_equal_sz(0, saved);
+}
+
+void test_pack_deltacache__can_be_disabled(void)
+{
+	size_t hits, misses, saved;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, (size_t)0));
+
+	read_all();
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS, &hits, &misses, &saved));
+	cl_assert_equal_sz(0, hits);
+	cl_assert(misses > 0);
+}
+
+void test_pack_deltacache__stays_within_its_budget(void)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid *id;
+	size_t current, allowed, i;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, (size_t)4096));
+
+	read_all();
+	cl_git_pass(git_odb_open(&odb, cl_fixture("testrepo.git/objects")));
+
+	git_array_foreach(g_ids, i, id) {
+		cl_git_pass(git_odb_read(&obj, odb, id));
+		git_odb_object_free(obj);
+
+		cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY, &current, &allowed));
+		cl_assert(current <= 4096);
+	}
+
+	git_odb_free(odb);
+}
+
+static const struct git_pack_file *g_pack = (const struct git_pack_file *)&g_ids;
+
+static void add_base(git_off_t offset)
+{
+	git_pack_cache_entry *entry;
+	git_rawobj base;
+
+	base.len = 100;
+	base.type = GIT_OBJECT_BLOB;
+	base.data = git__calloc(1, base.len);
+	cl_assert(base.data);
+
+	cl_git_pass(git_pack_cache_add(&entry, g_pack, offset, &base));
+	git_pack_cache_release(entry);
+}
+
+static bool has_base(git_off_t offset)
+{
+	git_pack_cache_entry *entry = git_pack_cache_get(g_pack, offset);
+
+	git_pack_cache_release(entry);
+	return entry != NULL;
+}
+
+/* The offsets of bases that go to the shard of the first, or to others */
+static void find_offsets(git_off_t *out, size_t n, git_off_t first, bool same_shard)
+{
+	size_t shard = git_pack_cache__shard(g_pack, first), i = 0;
+	git_off_t offset;
+
+	for (offset = first; i < n; offset += 16) {
+		if ((git_pack_cache__shard(g_pack, offset) == shard) == same_shard)
+			out[i++] = offset;
+	}
+}
+
+/*
+ * The least recently used bases are evicted whichever shard they are
+ * in, so a shard that holds the whole budget makes room for the others.
+ */
+void test_pack_deltacache__evicts_from_other_shards(void)
+{
+	git_off_t full[4], other[2];
+	size_t current, allowed;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, (size_t)400));
+
+	find_offsets(full, 4, 16, true);
+	find_offsets(other, 2, 16, false);
+
+	add_base(full[0]);
+	add_base(full[1]);
+	add_base(full[2]);
+	add_base(full[3]);
+
+	/* the first is used again, so the second is the oldest */
+	cl_assert(has_base(full[0]));
+
+	add_base(other[0]);
+	cl_assert(has_base(other[0]));
+	cl_assert(has_base(full[0]));
+	cl_assert(!has_base(full[1]));
+	cl_assert(has_base(full[2]));
+
+	add_base(other[1]);
+	cl_assert(has_base(other[1]));
+	cl_assert(!has_base(full[3]));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY, &current, &allowed));
+	cl_assert_equal_sz(400, current);
+
+	git_pack_cache_purge(g_pack);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY, &current, &allowed));
+	cl_assert_equal_sz(0, current);
+}
@@ -0,0 +1,93 @@
+#include "clar_libgit2.h"
+
+#define REVISIONS 120
+
+static git_repository *g_repo;
+static git_oid g_ids[REVISIONS];
+static size_t g_max_size;
+
+void test_pack_deltachain__initialize(void)
+{
+	git_buf content = GIT_BUF_INIT;
+	git_packbuilder *pb;
+	size_t current, i;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY, &current, &g_max_size));
+	cl_git_pass(git_repository_init(&g_repo, "deltachain.git", 1));
+
+	for (i = 0; i < 200; i++)
+		cl_git_pass(git_buf_printf(&content, "line %04" PRIuZ " as it was at first\n", i));
+
+	/*
+	 * Every revision edits the previous one, so they end up in long
+	 * chains of deltas, and adds a line to it every so often, so that
+	 * the results along a chain change in size.
+	 */
+	for (i = 0; i < REVISIONS; i++) {
+		memcpy(content.ptr + (i * 7 % 200) * 29 + 10, "edit", 4);
+		if (i % 3 == 0)
+			cl_git_pass(git_buf_printf(&content, "line added in revision %04" PRIuZ "\n", i));
+
+		cl_git_pass(git_blob_create_frombuffer(&g_ids[i], g_repo, content.ptr, content.size));
+	}
+
+	cl_git_pass(git_packbuilder_new(&pb, g_repo));
+	for (i = 0; i < REVISIONS; i++)
+		cl_git_pass(git_packbuilder_insert(pb, &g_ids[i], NULL));
+	cl_git_pass(git_packbuilder_write(pb, "deltachain.git/objects/pack", 0, NULL, NULL));
+
+	git_packbuilder_free(pb);
+	git_buf_dispose(&content);
+}
+
+void test_pack_deltachain__cleanup(void)
+{
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, g_max_size));
+	cl_fixture_cleanup("deltachain.git");
+}
+
+static void read_revisions(void)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid actual;
+	size_t i;
+
+	/* the packed objects are looked up before the loose ones */
+	cl_git_pass(git_odb_open(&odb, "deltachain.git/objects"));
+
+	for (i = 0; i < REVISIONS; i++) {
+		cl_git_pass(git_odb_read(&obj, odb, &g_ids[i]));
+		cl_assert_equal_i(GIT_OBJECT_BLOB, git_odb_object_type(obj));
+		cl_assert_equal_i('\0', ((const char *)git_odb_object_data(obj))[git_odb_object_size(obj)]);
+
+		cl_git_pass(git_odb_hash(&actual, git_odb_object_data(obj),
+			git_odb_object_size(obj), GIT_OBJECT_BLOB));
+		cl_assert_equal_oid(&g_ids[i], &actual);
+
+		git_odb_object_free(obj);
+	}
+
+	git_odb_free(odb);
+}
+
+void test_pack_deltachain__without_base_cache(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, (size_t)0));
+	read_revisions();
+}
+
+void test_pack_deltachain__with_base_cache(void)
+{
+	read_revisions();
+	read_revisions();
+}
+
+void test_pack_deltachain__with_small_base_cache(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, (size_t)8192));
+	read_revisions();
+}
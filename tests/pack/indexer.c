@@ -319,3 +319,74 @@ void test_pack_indexer__no_tmp_files(void)
 	cl_assert(git_buf_len(&first_tmp_file) == 0);
 	git_buf_dispose(&first_tmp_file);
 }
+
+#define TESTREPO_PACK "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695"
+
+struct progress_counts {
+	size_t calls;
+	unsigned int last_indexed_deltas;
+};
+
+static int count_progress(const git_indexer_progress *stats, void *payload)
+{
+	struct progress_counts *counts = payload;
+
+	cl_assert(stats->indexed_deltas >= counts->last_indexed_deltas);
+	counts->last_indexed_deltas = stats->indexed_deltas;
+	counts->calls++;
+
+	return 0;
+}
+
+static void index_pack_with_threads(unsigned int threads, unsigned char verify)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	struct progress_counts counts = { 0 };
+	git_indexer_progress stats = { 0 };
+	git_indexer *idx;
+	git_buf pack = GIT_BUF_INIT, expected_idx = GIT_BUF_INIT, actual_idx = GIT_BUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+
+	opts.threads = threads;
+	opts.verify = verify;
+	opts.progress_cb = count_progress;
+	opts.progress_cb_payload = &counts;
+
+	cl_git_pass(git_futils_readbuffer(&pack,
+		cl_fixture("testrepo.git/objects/pack/" TESTREPO_PACK ".pack")));
+	cl_git_pass(git_futils_readbuffer(&expected_idx,
+		cl_fixture("testrepo.git/objects/pack/" TESTREPO_PACK ".idx")));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, &opts));
+	cl_git_pass(git_indexer_append(idx, pack.ptr, pack.size, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert(stats.total_deltas > 0);
+	cl_assert_equal_i(stats.total_deltas, stats.indexed_deltas);
+	cl_assert_equal_i(stats.total_objects, stats.indexed_objects);
+	cl_assert_equal_i(stats.total_deltas, counts.last_indexed_deltas);
+
+	cl_git_pass(git_buf_printf(&path, "pack-%s.idx", git_oid_tostr_s(git_indexer_hash(idx))));
+	cl_git_pass(git_futils_readbuffer(&actual_idx, path.ptr));
+	cl_assert_equal_sz(expected_idx.size, actual_idx.size);
+	cl_assert(memcmp(expected_idx.ptr, actual_idx.ptr, actual_idx.size) == 0);
+
+	cl_git_pass(p_unlink(path.ptr));
+	git_buf_shorten(&path, strlen("idx"));
+	cl_git_pass(git_buf_puts(&path, "pack"));
+	cl_git_pass(p_unlink(path.ptr));
+
+	git_indexer_free(idx);
+	git_buf_dispose(&path);
+	git_buf_dispose(&pack);
+	git_buf_dispose(&expected_idx);
+	git_buf_dispose(&actual_idx);
+}
+
+void test_pack_indexer__resolves_deltas_in_parallel(void)
+{
+	index_pack_with_threads(0, 0);
+	index_pack_with_threads(1, 0);
+	index_pack_with_threads(4, 0);
+	index_pack_with_threads(4, 1);
+}
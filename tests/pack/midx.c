@@ -0,0 +1,228 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/midx.h>
+
+#include "fileops.h"
+#include "midx.h"
+
+/*
+ * The multi-pack-index that git wrote for the packs of testrepo.git is
+ * kept apart from it, so that other tests do not search the packs
+ * through it.
+ */
+#define TESTREPO_MIDX "multi-pack-index/testrepo.git/multi-pack-index"
+
+static void use_multi_pack_index(git_repository *repo)
+{
+	git_buf midx_path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&midx_path, git_repository_path(repo), "objects/pack/multi-pack-index"));
+	cl_git_pass(git_futils_cp(cl_fixture(TESTREPO_MIDX), git_buf_cstr(&midx_path), 0444));
+	git_buf_dispose(&midx_path);
+}
+
+void test_pack_midx__parse(void)
+{
+	struct git_midx_file *idx;
+	struct git_midx_entry e;
+	git_oid id;
+
+	cl_git_pass(git_midx_open(&idx, cl_fixture(TESTREPO_MIDX)));
+	cl_assert_equal_i(git_midx_needs_refresh(idx, cl_fixture(TESTREPO_MIDX)), 0);
+
+	cl_assert_equal_sz(git_vector_length(&idx->packfile_names), 3);
+	cl_assert_equal_s(git_vector_get(&idx->packfile_names, 0),
+		"pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx");
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_oid(&e.sha1, &id);
+	cl_assert_equal_s(
+			(const char *)git_vector_get(&idx->packfile_names, e.pack_index),
+			"pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx");
+
+	/* abbreviated ids are resolved, too */
+	cl_git_pass(git_oid_fromstrn(&id, "5001298e", 8));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, 8));
+	cl_assert_equal_s(git_oid_tostr_s(&e.sha1), "5001298e0c09ad9c34e4249bc5801c75e9754fa5");
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000001"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+
+	git_midx_free(idx);
+}
+
+void test_pack_midx__lookup(void)
+{
+	git_repository *repo;
+	git_commit *commit;
+	git_object *object;
+	git_oid id;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	use_multi_pack_index(repo);
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_commit_lookup_prefix(&commit, repo, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_s(git_commit_summary(commit), "packed commit one");
+	git_commit_free(commit);
+
+	cl_git_pass(git_revparse_single(&object, repo, "001d938d"));
+	cl_assert_equal_s(git_oid_tostr_s(git_object_id(object)), "001d938dbe69b6251f4a03cf374235c72fd0a0d2");
+	git_object_free(object);
+
+	cl_git_sandbox_cleanup();
+}
+
+void test_pack_midx__writer(void)
+{
+	git_repository *repo;
+	git_midx_writer *w = NULL;
+	git_buf midx = GIT_BUF_INIT, expected_midx = GIT_BUF_INIT, path = GIT_BUF_INIT;
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects/pack"));
+	cl_git_pass(git_midx_writer_new(&w, git_buf_cstr(&path)));
+
+	cl_git_pass(git_midx_writer_add(w, "pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+
+	/* packs outside of the pack directory cannot be indexed */
+	cl_git_fail(git_midx_writer_add(w, cl_fixture("testrepo/.gitted/objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx")));
+
+	cl_git_pass(git_midx_writer_dump(&midx, w));
+	cl_git_pass(git_futils_readbuffer(&expected_midx, cl_fixture(TESTREPO_MIDX)));
+
+	cl_assert_equal_i(git_buf_len(&midx), git_buf_len(&expected_midx));
+	cl_assert_equal_strn(git_buf_cstr(&midx), git_buf_cstr(&expected_midx), git_buf_len(&midx));
+
+	git_buf_dispose(&midx);
+	git_buf_dispose(&expected_midx);
+	git_buf_dispose(&path);
+	git_midx_writer_free(w);
+	git_repository_free(repo);
+}
+
+void test_pack_midx__odb_create(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_object *object;
+	git_buf midx = GIT_BUF_INIT, expected_midx = GIT_BUF_INIT, midx_path = GIT_BUF_INIT;
+	struct stat st;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_buf_joinpath(&midx_path, git_repository_path(repo), "objects/pack/multi-pack-index"));
+	cl_git_pass(git_futils_readbuffer(&expected_midx, cl_fixture(TESTREPO_MIDX)));
+	cl_git_fail(p_stat(git_buf_cstr(&midx_path), &st));
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_git_pass(git_odb_write_multi_pack_index(odb));
+
+	cl_git_pass(git_futils_readbuffer(&midx, git_buf_cstr(&midx_path)));
+	cl_assert_equal_i(git_buf_len(&midx), git_buf_len(&expected_midx));
+	cl_assert_equal_strn(git_buf_cstr(&midx), git_buf_cstr(&expected_midx), git_buf_len(&midx));
+
+	/* the freshly written index is used for lookups right away */
+	cl_git_pass(git_revparse_single(&object, repo, "5001298"));
+	cl_assert_equal_i(git_object_type(object), GIT_OBJECT_COMMIT);
+	git_object_free(object);
+
+	git_odb_free(odb);
+	git_buf_dispose(&midx);
+	git_buf_dispose(&expected_midx);
+	git_buf_dispose(&midx_path);
+	cl_git_sandbox_cleanup();
+}
+
+void test_pack_midx__missing_pack_falls_back(void)
+{
+	git_repository *repo;
+	git_object *object;
+	git_odb *odb;
+	git_buf idx_path = GIT_BUF_INIT;
+	git_oid id;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	use_multi_pack_index(repo);
+
+	/*
+	 * The multi-pack-index refers to a pack that no longer exists; it
+	 * must be ignored rather than hiding the objects of the other packs.
+	 */
+	cl_git_pass(git_buf_joinpath(&idx_path, git_repository_path(repo),
+		"objects/pack/pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx"));
+	cl_git_pass(p_unlink(git_buf_cstr(&idx_path)));
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_assert(git_odb_exists(odb, &id));
+
+	cl_git_pass(git_revparse_single(&object, repo, "001d938d"));
+	git_object_free(object);
+
+	git_odb_free(odb);
+	git_buf_dispose(&idx_path);
+	cl_git_sandbox_cleanup();
+}
+
+static int count_object(const git_oid *id, void *payload)
+{
+	GIT_UNUSED(id);
+
+	(*(size_t *)payload)++;
+	return 0;
+}
+
+static size_t count_objects(git_odb *odb)
+{
+	size_t count = 0;
+
+	cl_git_pass(git_odb_foreach(odb, count_object, &count));
+	return count;
+}
+
+void test_pack_midx__covered_packs_are_only_searched_through_it(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_buf midx_path = GIT_BUF_INIT;
+	git_oid id;
+	size_t count;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_buf_joinpath(&midx_path, git_repository_path(repo), "objects/pack/multi-pack-index"));
+
+	/* the packs are loaded before there is a multi-pack-index for them */
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+	count = count_objects(odb);
+
+	cl_git_pass(git_odb_write_multi_pack_index(odb));
+	cl_assert_equal_sz(count, count_objects(odb));
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_assert(git_odb_exists(odb, &id));
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000001"));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	/* without it, they are searched one by one again */
+	cl_git_pass(p_unlink(git_buf_cstr(&midx_path)));
+	cl_git_pass(git_odb_refresh(odb));
+	cl_assert_equal_sz(count, count_objects(odb));
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_assert(git_odb_exists(odb, &id));
+
+	git_odb_free(odb);
+	git_buf_dispose(&midx_path);
+	cl_git_sandbox_cleanup();
+}
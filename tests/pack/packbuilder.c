@@ -1,6 +1,7 @@
 #include "clar_libgit2.h"
 #include "fileops.h"
 #include "pack.h"
+#include "pack-objects.h"
 #include "hash.h"
 #include "iterator.h"
 #include "vector.h"
@@ -21,6 +22,9 @@ void test_pack_packbuilder__initialize(void)
 	_repo = cl_git_sandbox_init("testrepo.git");
 	cl_git_pass(p_chdir("testrepo.git"));
 	cl_git_pass(git_revwalk_new(&_revwalker, _repo));
+
+	/* the expected packs use REF_DELTA, like git does by default */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_OFS_DELTA, 0));
 	cl_git_pass(git_packbuilder_new(&_packbuilder, _repo));
 	cl_git_pass(git_vector_init(&_commits, 0, NULL));
 	_commits_is_initialized = 1;
@@ -34,6 +38,7 @@ void test_pack_packbuilder__cleanup(void)
 	unsigned int i;
 
 	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_FSYNC_GITDIR, 0));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_OFS_DELTA, 1));
 	cl_git_pass(git_libgit2_opts(GIT_OPT_DISABLE_PACK_KEEP_FILE_CHECKS, false));
 
 	if (_commits_is_initialized) {
@@ -270,3 +275,175 @@ void test_pack_packbuilder__keep_file_check(void)
 	cl_git_pass(git_libgit2_opts(GIT_OPT_DISABLE_PACK_KEEP_FILE_CHECKS, true));
 	assert(git_disable_pack_keep_file_checks);
 }
+
+#define DELTA_PACK "objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695"
+
+static int insert_object_cb(const git_oid *id, void *payload)
+{
+	GIT_UNUSED(payload);
+	return git_packbuilder_insert(_packbuilder, id, NULL);
+}
+
+static void build_pack_of_everything(size_t *reused, size_t *reused_deltas)
+{
+	git_indexer_progress stats;
+	git_odb *odb;
+	git_pobject *po;
+	size_t i;
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb_foreach(odb, insert_object_cb, NULL));
+
+	/* the indexer makes sure that every object can be read back */
+	cl_git_pass(git_indexer_new(&_indexer, ".", 0, NULL, NULL));
+	cl_git_pass(git_packbuilder_foreach(_packbuilder, feed_indexer, &stats));
+	cl_git_pass(git_indexer_commit(_indexer, &stats));
+	cl_assert_equal_i(git_packbuilder_object_count(_packbuilder), stats.total_objects);
+
+	*reused = *reused_deltas = 0;
+
+	for (i = 0; i < _packbuilder->nr_objects; i++) {
+		po = _packbuilder->object_list + i;
+
+		if (po->reuse_pack)
+			(*reused)++;
+		if (po->reuse_delta)
+			(*reused_deltas)++;
+	}
+}
+
+void test_pack_packbuilder__reuses_packed_objects(void)
+{
+	size_t reused, reused_deltas;
+
+	build_pack_of_everything(&reused, &reused_deltas);
+
+	/* the objects of the pack are deltified against each other */
+	cl_assert(reused_deltas > 1000);
+	cl_assert(reused > reused_deltas);
+}
+
+void test_pack_packbuilder__can_disable_reuse(void)
+{
+	size_t reused, reused_deltas;
+
+	git_packbuilder_set_reuse(_packbuilder, 0);
+	build_pack_of_everything(&reused, &reused_deltas);
+
+	cl_assert_equal_i(0, reused);
+	cl_assert_equal_i(0, reused_deltas);
+}
+
+void test_pack_packbuilder__does_not_reuse_corrupt_objects(void)
+{
+	git_buf idx = GIT_BUF_INIT;
+	unsigned char *crc;
+	uint32_t nr;
+	size_t reused, reused_deltas;
+
+	/* break the CRC32 of every object in the pack index */
+	cl_git_pass(git_futils_readbuffer(&idx, DELTA_PACK ".idx"));
+	nr = ntohl(*(uint32_t *)(idx.ptr + 8 + 4 * 255));
+	crc = (unsigned char *)idx.ptr + 8 + 4 * 256 + GIT_OID_RAWSZ * nr;
+	memset(crc, 0, 4 * nr);
+
+	cl_must_pass(p_chmod(DELTA_PACK ".idx", 0644));
+	cl_git_pass(git_futils_writebuffer(&idx, DELTA_PACK ".idx", O_WRONLY | O_TRUNC, 0644));
+
+	build_pack_of_everything(&reused, &reused_deltas);
+	cl_assert_equal_i(0, reused_deltas);
+
+	git_buf_dispose(&idx);
+}
+
+static size_t index_pack(git_buf *pack)
+{
+	git_indexer_progress stats;
+
+	git_indexer_free(_indexer);
+	cl_git_pass(git_indexer_new(&_indexer, ".", 0, NULL, NULL));
+	cl_git_pass(git_indexer_append(_indexer, pack->ptr, pack->size, &stats));
+	cl_git_pass(git_indexer_commit(_indexer, &stats));
+
+	return stats.indexed_deltas;
+}
+
+void test_pack_packbuilder__writes_offset_deltas(void)
+{
+	git_buf ref_pack = GIT_BUF_INIT, ofs_pack = GIT_BUF_INIT;
+	size_t deltas;
+
+	seed_packbuilder();
+	cl_git_pass(git_packbuilder_write_buf(&ref_pack, _packbuilder));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_OFS_DELTA, 1));
+	git_packbuilder_free(_packbuilder);
+	cl_git_pass(git_packbuilder_new(&_packbuilder, _repo));
+	seed_packbuilder();
+	cl_git_pass(git_packbuilder_write_buf(&ofs_pack, _packbuilder));
+
+	deltas = index_pack(&ref_pack);
+	cl_assert(deltas > 0);
+	cl_assert_equal_i(deltas, index_pack(&ofs_pack));
+
+	/* each delta names its base in a byte or two instead of 20 */
+	cl_assert(ofs_pack.size <= ref_pack.size - deltas * 18);
+
+	git_buf_dispose(&ref_pack);
+	git_buf_dispose(&ofs_pack);
+}
+
+static int cancel_cb(void *buf, size_t len, void *payload)
+{
+	GIT_UNUSED(buf);
+	GIT_UNUSED(len);
+	GIT_UNUSED(payload);
+	return -1111;
+}
+
+static void insert_everything(void)
+{
+	git_odb *odb;
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb_foreach(odb, insert_object_cb, NULL));
+}
+
+static void assert_compresses_in_parallel(void (*insert)(void), int reuse)
+{
+	git_buf serial = GIT_BUF_INIT, parallel = GIT_BUF_INIT;
+
+	git_packbuilder_set_reuse(_packbuilder, reuse);
+	insert();
+	cl_git_pass(git_packbuilder_write_buf(&serial, _packbuilder));
+
+	/*
+	 * Find the deltas on one thread, as the deltas that are found
+	 * depend on the number of threads, then write on several.
+	 */
+	git_packbuilder_free(_packbuilder);
+	cl_git_pass(git_packbuilder_new(&_packbuilder, _repo));
+	git_packbuilder_set_reuse(_packbuilder, reuse);
+	insert();
+	cl_git_fail_with(-1111, git_packbuilder_foreach(_packbuilder, cancel_cb, NULL));
+
+	cl_assert_equal_i(4, git_packbuilder_set_threads(_packbuilder, 4));
+	cl_git_pass(git_packbuilder_write_buf(&parallel, _packbuilder));
+
+	cl_assert_equal_i(serial.size, parallel.size);
+	cl_assert(memcmp(serial.ptr, parallel.ptr, serial.size) == 0);
+
+	git_buf_dispose(&serial);
+	git_buf_dispose(&parallel);
+}
+
+void test_pack_packbuilder__compresses_in_parallel(void)
+{
+	assert_compresses_in_parallel(seed_packbuilder, 1);
+}
+
+void test_pack_packbuilder__compresses_everything_in_parallel(void)
+{
+	/* without copying the objects from the packs they are in */
+	assert_compresses_in_parallel(insert_everything, 0);
+}
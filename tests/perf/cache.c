@@ -0,0 +1,113 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+
+#include "array.h"
+
+/*
+ * Look up the same objects of a shared repository on more and more
+ * threads, to see how lookups through the object cache scale.
+ */
+#define LOOKUPS 1000000
+#define MAX_THREADS 16
+
+static git_repository *g_repo;
+static git_array_t(git_oid) g_ids;
+
+struct lookup_thread {
+	git_thread thread;
+	int id;
+	int error;
+};
+
+/* Collect the objects that are cached by default: all but the blobs. */
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_odb *odb = payload;
+	git_object_t type;
+	git_oid *out;
+	size_t size;
+
+	cl_git_pass(git_odb_read_header(&size, &type, odb, id));
+	if (type == GIT_OBJECT_BLOB)
+		return 0;
+
+	out = git_array_alloc(g_ids);
+	cl_assert(out);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+void test_perf_cache__cleanup(void)
+{
+	git_array_clear(g_ids);
+	git_repository_free(g_repo);
+	g_repo = NULL;
+}
+
+#ifdef GIT_THREADS
+static void *lookup_objects(void *arg)
+{
+	struct lookup_thread *t = arg;
+	git_object *obj;
+	size_t i;
+
+	for (i = 0; i < LOOKUPS; i++) {
+		git_oid *id = git_array_get(g_ids, (i * 7 + t->id) % git_array_size(g_ids));
+
+		if ((t->error = git_object_lookup(&obj, g_repo, id, GIT_OBJECT_ANY)) < 0)
+			break;
+
+		git_object_free(obj);
+	}
+
+	return arg;
+}
+
+static void perf__lookups(int threads)
+{
+	struct lookup_thread t[MAX_THREADS];
+	perf_timer t_lookup = PERF_TIMER_INIT;
+	int i;
+
+	memset(t, 0, sizeof(t));
+
+	perf__timer__start(&t_lookup);
+
+	for (i = 0; i < threads; i++) {
+		t[i].id = i;
+		cl_git_pass(git_thread_create(&t[i].thread, lookup_objects, &t[i]));
+	}
+
+	for (i = 0; i < threads; i++)
+		cl_git_pass(git_thread_join(&t[i].thread, NULL));
+
+	perf__timer__stop(&t_lookup);
+
+	for (i = 0; i < threads; i++)
+		cl_git_pass(t[i].error);
+
+	perf__timer__report(&t_lookup, "%d lookups on each of %d threads",
+		LOOKUPS, threads);
+}
+#endif
+
+void test_perf_cache__lookups(void)
+{
+#ifndef GIT_THREADS
+	clar__skip();
+#else
+	git_odb *odb;
+	int threads;
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+	cl_git_pass(git_odb_foreach(odb, collect_id, odb));
+	git_odb_free(odb);
+
+	/* warm up the cache */
+	perf__lookups(1);
+
+	for (threads = 1; threads <= MAX_THREADS; threads *= 2)
+		perf__lookups(threads);
+#endif
+}
@@ -0,0 +1,104 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+
+/*
+ * Read every revision of a file that was edited many times, out of a
+ * pack where they are stored as long delta chains, with the delta base
+ * cache turned off so that every read applies its whole chain.
+ */
+#define REVISIONS 200
+#define READS 5
+
+static size_t g_max_size;
+
+void test_perf_deltachain__initialize(void)
+{
+	size_t current;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHED_MEMORY, &current, &g_max_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, (size_t)0));
+}
+
+void test_perf_deltachain__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, g_max_size));
+	cl_fixture_cleanup("deltachain.git");
+}
+
+/* Each revision changes one of the lines of the previous one */
+static void write_revisions(git_oid *ids, git_repository *repo, size_t lines)
+{
+	git_buf content = GIT_BUF_INIT;
+	size_t i, line_len;
+
+	for (i = 0; i < lines; i++)
+		cl_git_pass(git_buf_printf(&content, "line %08" PRIuZ " of the file, at first\n", i));
+
+	line_len = content.size / lines;
+
+	for (i = 0; i < REVISIONS; i++) {
+		char *line = content.ptr + ((i * 7919) % lines) * line_len;
+		char stamp[16];
+
+		cl_assert(p_snprintf(stamp, sizeof(stamp), "edit %04" PRIuZ, i) > 0);
+		memcpy(line + 14, stamp, strlen(stamp));
+
+		cl_git_pass(git_blob_create_frombuffer(&ids[i], repo, content.ptr, content.size));
+	}
+
+	git_buf_dispose(&content);
+}
+
+static void perf__read_chains(const char *test_name, size_t lines)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid ids[REVISIONS];
+	perf_timer t_read = PERF_TIMER_INIT;
+	size_t i, j, total = 0;
+
+	cl_git_pass(git_repository_init(&repo, "deltachain.git", 1));
+	write_revisions(ids, repo, lines);
+
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	for (i = 0; i < REVISIONS; i++)
+		cl_git_pass(git_packbuilder_insert(pb, &ids[i], NULL));
+	cl_git_pass(git_packbuilder_write(pb, "deltachain.git/objects/pack", 0, NULL, NULL));
+	git_packbuilder_free(pb);
+
+	git_repository_free(repo);
+
+	/* the packed objects are looked up before the loose ones */
+	cl_git_pass(git_odb_open(&odb, "deltachain.git/objects"));
+
+	perf__timer__start(&t_read);
+	for (j = 0; j < READS; j++) {
+		for (i = 0; i < REVISIONS; i++) {
+			cl_git_pass(git_odb_read(&obj, odb, &ids[i]));
+			total += git_odb_object_size(obj);
+			git_odb_object_free(obj);
+		}
+
+		/* drop the objects that were read from the object cache */
+		git_odb_free(odb);
+		cl_git_pass(git_odb_open(&odb, "deltachain.git/objects"));
+	}
+	perf__timer__stop(&t_read);
+
+	printf("%10" PRIuZ ": %s: bytes read\n", total, test_name);
+	perf__timer__report(&t_read, "%s: read %d revisions %d times", test_name, REVISIONS, READS);
+
+	git_odb_free(odb);
+}
+
+void test_perf_deltachain__small_objects(void)
+{
+	perf__read_chains("small", 512);
+}
+
+void test_perf_deltachain__large_objects(void)
+{
+	perf__read_chains("large", 32 * 1024);
+}
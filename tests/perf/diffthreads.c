@@ -0,0 +1,93 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+
+#include "diff.h"
+
+/*
+ * Print the diff between two trees that change every one of many
+ * files, on the calling thread and on several threads.
+ */
+#define FILES 2000
+#define LINES 400
+
+static git_repository *g_repo;
+
+void test_perf_diffthreads__cleanup(void)
+{
+	git_repository_free(g_repo);
+	g_repo = NULL;
+	cl_fixture_cleanup("diffthreads");
+}
+
+static void write_tree(git_tree **out, git_index *index, size_t round)
+{
+	git_index_entry entry;
+	git_buf path = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	git_oid id;
+	size_t i, j;
+
+	for (i = 0; i < FILES; i++) {
+		git_buf_clear(&path);
+		git_buf_clear(&content);
+
+		cl_git_pass(git_buf_printf(&path, "dir%02" PRIuZ "/file%04" PRIuZ ".txt", i % 50, i));
+
+		for (j = 0; j < LINES; j++)
+			cl_git_pass(git_buf_printf(&content, "line %04" PRIuZ " of file %04" PRIuZ "%s\n",
+				j, i, (round && (j * 7 + i) % 23 == 0) ? ", changed" : ""));
+
+		memset(&entry, 0, sizeof(entry));
+		entry.path = path.ptr;
+		entry.mode = GIT_FILEMODE_BLOB;
+		cl_git_pass(git_index_add_frombuffer(index, &entry, content.ptr, content.size));
+	}
+
+	cl_git_pass(git_index_write_tree(&id, index));
+	cl_git_pass(git_tree_lookup(out, g_repo, &id));
+
+	git_buf_dispose(&path);
+	git_buf_dispose(&content);
+}
+
+static void perf__print(git_diff *diff, unsigned int threads)
+{
+	perf_timer t_print = PERF_TIMER_INIT;
+	git_buf out = GIT_BUF_INIT;
+
+	diff->opts.threads = threads;
+
+	perf__timer__start(&t_print);
+	cl_git_pass(git_diff_to_buf(&out, diff, GIT_DIFF_FORMAT_PATCH));
+	perf__timer__stop(&t_print);
+
+	perf__timer__report(&t_print, "print %d files on %u threads: %" PRIuZ " bytes",
+		FILES, threads, out.size);
+
+	git_buf_dispose(&out);
+}
+
+void test_perf_diffthreads__print(void)
+{
+	git_index *index;
+	git_tree *old_tree, *new_tree;
+	git_diff *diff;
+
+	cl_git_pass(git_repository_init(&g_repo, "diffthreads", 0));
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	write_tree(&old_tree, index, 0);
+	write_tree(&new_tree, index, 1);
+
+	cl_git_pass(git_diff_tree_to_tree(&diff, g_repo, old_tree, new_tree, NULL));
+	cl_assert_equal_sz(FILES, git_diff_num_deltas(diff));
+
+	perf__print(diff, 1);
+	perf__print(diff, 2);
+	perf__print(diff, 4);
+	perf__print(diff, 8);
+
+	git_diff_free(diff);
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+	git_index_free(index);
+}
@@ -0,0 +1,86 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+
+#include "git2/sys/hashsig.h"
+
+/*
+ * Compute the signatures of large text blobs, which look like source
+ * code, in each of the whitespace modes, and compare many of them.
+ */
+#define BLOBS 16
+#define LINES 40000
+#define COMPARES 200000
+
+static git_buf g_blobs[BLOBS];
+
+void test_perf_hashsig__cleanup(void)
+{
+	size_t i;
+
+	for (i = 0; i < BLOBS; i++)
+		git_buf_dispose(&g_blobs[i]);
+}
+
+static void make_blobs(void)
+{
+	size_t i, j;
+
+	for (i = 0; i < BLOBS; i++) {
+		for (j = 0; j < LINES; j++) {
+			cl_git_pass(git_buf_printf(&g_blobs[i],
+				"%.*sif (value_%04" PRIuZ " != expected[%" PRIuZ "])%s\n",
+				(int)(j % 4), "\t\t\t\t", (j * 7 + i) % 4999, j % 100,
+				(j % 3) ? " {" : "\r"));
+
+			if (j % 10 == 0)
+				cl_git_pass(git_buf_puts(&g_blobs[i], "\n"));
+		}
+	}
+}
+
+static void perf__create(git_hashsig *sigs[BLOBS], git_hashsig_option_t opt, const char *name)
+{
+	perf_timer t_create = PERF_TIMER_INIT;
+	size_t i, bytes = 0;
+
+	perf__timer__start(&t_create);
+	for (i = 0; i < BLOBS; i++) {
+		cl_git_pass(git_hashsig_create(&sigs[i], g_blobs[i].ptr, g_blobs[i].size, opt));
+		bytes += g_blobs[i].size;
+	}
+	perf__timer__stop(&t_create);
+
+	perf__timer__report(&t_create, "create %d signatures (%" PRIuZ " bytes), %s whitespace",
+		BLOBS, bytes, name);
+}
+
+void test_perf_hashsig__create_and_compare(void)
+{
+	git_hashsig *sigs[BLOBS];
+	perf_timer t_compare = PERF_TIMER_INIT;
+	size_t i;
+	int total = 0;
+
+	make_blobs();
+
+	perf__create(sigs, GIT_HASHSIG_NORMAL, "normal");
+	for (i = 0; i < BLOBS; i++)
+		git_hashsig_free(sigs[i]);
+
+	perf__create(sigs, GIT_HASHSIG_IGNORE_WHITESPACE, "ignoring");
+	for (i = 0; i < BLOBS; i++)
+		git_hashsig_free(sigs[i]);
+
+	perf__create(sigs, GIT_HASHSIG_SMART_WHITESPACE, "smart");
+
+	perf__timer__start(&t_compare);
+	for (i = 0; i < COMPARES; i++)
+		total += git_hashsig_compare(sigs[i % BLOBS], sigs[(i / BLOBS) % BLOBS]);
+	perf__timer__stop(&t_compare);
+
+	cl_assert(total > 0);
+	perf__timer__report(&t_compare, "compare %d pairs of signatures", COMPARES);
+
+	for (i = 0; i < BLOBS; i++)
+		git_hashsig_free(sigs[i]);
+}
@@ -0,0 +1,67 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+
+/*
+ * Compare the packs written with REF_DELTA and with OFS_DELTA: their
+ * size, and how long it takes to write them and to index them.
+ *
+ * Like the merge test, this uses the libgit2 repository itself, as it
+ * is already here and of a fair size.
+ */
+#define SRC_REPO (cl_fixture("../.."))
+
+static void perf__pack_and_index(const char *test_name, int ofs_delta)
+{
+	git_repository *repo;
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_indexer *idx;
+	git_indexer_progress stats;
+	git_buf pack = GIT_BUF_INIT;
+	perf_timer t_write = PERF_TIMER_INIT;
+	perf_timer t_index = PERF_TIMER_INIT;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_OFS_DELTA, ofs_delta));
+
+	cl_git_pass(git_repository_open(&repo, SRC_REPO));
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_head(walk));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+
+	perf__timer__start(&t_write);
+	cl_git_pass(git_packbuilder_write_buf(&pack, pb));
+	perf__timer__stop(&t_write);
+
+	cl_must_pass(p_mkdir(test_name, 0777));
+	cl_git_pass(git_indexer_new(&idx, test_name, 0, NULL, NULL));
+
+	perf__timer__start(&t_index);
+	cl_git_pass(git_indexer_append(idx, pack.ptr, pack.size, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+	perf__timer__stop(&t_index);
+
+	printf("%10" PRIuZ ": %s: pack size (%u objects, %u deltas)\n",
+		pack.size, test_name, stats.total_objects, stats.indexed_deltas);
+	perf__timer__report(&t_write, "%s: write", test_name);
+	perf__timer__report(&t_index, "%s: index", test_name);
+
+	git_indexer_free(idx);
+	git_buf_dispose(&pack);
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+	git_repository_free(repo);
+
+	cl_fixture_cleanup(test_name);
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_OFS_DELTA, 1));
+}
+
+void test_perf_pack__ref_delta(void)
+{
+	perf__pack_and_index("ref_delta", 0);
+}
+
+void test_perf_pack__ofs_delta(void)
+{
+	perf__pack_and_index("ofs_delta", 1);
+}
@@ -0,0 +1,93 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+
+/*
+ * Find the renames between two trees that move every one of many files
+ * and change one of its lines, on the calling thread and on several.
+ */
+#define FILES 3000
+#define LINES 100
+
+static git_repository *g_repo;
+static git_tree *g_old_tree, *g_new_tree;
+
+void test_perf_renames__cleanup(void)
+{
+	git_tree_free(g_old_tree);
+	git_tree_free(g_new_tree);
+	git_repository_free(g_repo);
+	g_repo = NULL;
+	cl_fixture_cleanup("renames");
+}
+
+static void write_tree(git_tree **out, git_index *index, size_t round)
+{
+	git_index_entry entry;
+	git_buf path = GIT_BUF_INIT, content = GIT_BUF_INIT;
+	git_oid id;
+	size_t i, j;
+
+	cl_git_pass(git_index_clear(index));
+
+	for (i = 0; i < FILES; i++) {
+		git_buf_clear(&path);
+		git_buf_clear(&content);
+
+		cl_git_pass(git_buf_printf(&path, "%s%02" PRIuZ "/file%04" PRIuZ ".txt",
+			round ? "new" : "old", i % 50, i));
+
+		for (j = 0; j < LINES; j++)
+			cl_git_pass(git_buf_printf(&content, "line %03" PRIuZ " of file %04" PRIuZ "%s\n",
+				j, i, (round && j == i % LINES) ? ", changed" : ""));
+
+		memset(&entry, 0, sizeof(entry));
+		entry.path = path.ptr;
+		entry.mode = GIT_FILEMODE_BLOB;
+		cl_git_pass(git_index_add_frombuffer(index, &entry, content.ptr, content.size));
+	}
+
+	cl_git_pass(git_index_write_tree(&id, index));
+	cl_git_pass(git_tree_lookup(out, g_repo, &id));
+
+	git_buf_dispose(&path);
+	git_buf_dispose(&content);
+}
+
+static void perf__find_renames(unsigned int threads)
+{
+	git_diff_find_options opts = GIT_DIFF_FIND_OPTIONS_INIT;
+	perf_timer t_find = PERF_TIMER_INIT;
+	git_diff *diff;
+
+	cl_git_pass(git_diff_tree_to_tree(&diff, g_repo, g_old_tree, g_new_tree, NULL));
+
+	opts.flags = GIT_DIFF_FIND_RENAMES;
+	opts.threads = threads;
+
+	perf__timer__start(&t_find);
+	cl_git_pass(git_diff_find_similar(diff, &opts));
+	perf__timer__stop(&t_find);
+
+	cl_assert_equal_sz(FILES, git_diff_num_deltas(diff));
+
+	perf__timer__report(&t_find, "find renames of %d files on %u threads",
+		FILES, threads);
+
+	git_diff_free(diff);
+}
+
+void test_perf_renames__find(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_repository_init(&g_repo, "renames", 0));
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	write_tree(&g_old_tree, index, 0);
+	write_tree(&g_new_tree, index, 1);
+
+	perf__find_renames(1);
+	perf__find_renames(4);
+
+	git_index_free(index);
+}
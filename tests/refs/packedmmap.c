@@ -0,0 +1,263 @@
+#include "clar_libgit2.h"
+
+#include "fileops.h"
+#include "git2/refdb.h"
+#include "refdb.h"
+#include "refs.h"
+
+static git_repository *g_repo;
+
+void test_refs_packedmmap__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 1));
+	g_repo = cl_git_sandbox_init("testrepo");
+}
+
+void test_refs_packedmmap__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 0));
+	cl_git_sandbox_cleanup();
+}
+
+static void packall(void)
+{
+	git_refdb *refdb;
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+}
+
+/* List the references matching `glob`, with their targets */
+static void list_refs(git_buf *out, git_repository *repo, const char *glob)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	char oid[GIT_OID_HEXSZ + 1];
+	int error;
+
+	git_buf_clear(out);
+
+	if (glob)
+		cl_git_pass(git_reference_iterator_glob_new(&iter, repo, glob));
+	else
+		cl_git_pass(git_reference_iterator_new(&iter, repo));
+
+	while ((error = git_reference_next(&ref, iter)) == 0) {
+		if (git_reference_type(ref) == GIT_REFERENCE_DIRECT)
+			git_oid_tostr(oid, sizeof(oid), git_reference_target(ref));
+		else
+			strcpy(oid, git_reference_symbolic_target(ref));
+
+		git_buf_printf(out, "%s %s\n", git_reference_name(ref), oid);
+		git_reference_free(ref);
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	cl_assert(!git_buf_oom(out));
+	git_reference_iterator_free(iter);
+}
+
+/* List the names of the references matching `glob`, in order */
+static void list_names(git_buf *out, git_repository *repo, const char *glob)
+{
+	git_reference_iterator *iter;
+	git_vector names = GIT_VECTOR_INIT;
+	const char *name;
+	char *dup;
+	size_t i;
+	int error;
+
+	git_buf_clear(out);
+	git_vector_set_cmp(&names, git__strcmp_cb);
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, repo, glob));
+
+	while ((error = git_reference_next_name(&name, iter)) == 0) {
+		cl_assert(dup = git__strdup(name));
+		cl_git_pass(git_vector_insert(&names, dup));
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_reference_iterator_free(iter);
+
+	git_vector_sort(&names);
+	git_vector_foreach(&names, i, dup) {
+		git_buf_printf(out, "%s\n", dup);
+		git__free(dup);
+	}
+
+	cl_assert(!git_buf_oom(out));
+	git_vector_free(&names);
+}
+
+static void assert_same_as_parsed(const char *glob)
+{
+	git_repository *parsed;
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 0));
+	cl_git_pass(git_repository_open(&parsed, "testrepo"));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACKED_REFS_MMAP, 1));
+
+	list_refs(&expected, parsed, glob);
+	list_refs(&actual, g_repo, glob);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	if (glob) {
+		list_names(&expected, parsed, glob);
+		list_names(&actual, g_repo, glob);
+		cl_assert_equal_s(expected.ptr, actual.ptr);
+	}
+
+	git_repository_free(parsed);
+	git_buf_dispose(&expected);
+	git_buf_dispose(&actual);
+}
+
+static void assert_ref(const char *name, const char *oid, const char *peel)
+{
+	git_reference *ref;
+	git_oid expected;
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+	cl_assert_equal_s(name, git_reference_name(ref));
+
+	cl_git_pass(git_oid_fromstr(&expected, oid));
+	cl_assert_equal_oid(&expected, git_reference_target(ref));
+
+	if (peel) {
+		cl_git_pass(git_oid_fromstr(&expected, peel));
+		cl_assert_equal_oid(&expected, git_reference_target_peel(ref));
+	} else {
+		cl_assert_equal_p(NULL, git_reference_target_peel(ref));
+	}
+
+	git_reference_free(ref);
+}
+
+static void assert_no_ref(const char *name)
+{
+	git_reference *ref;
+	int exists;
+	git_refdb *refdb;
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, name));
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_exists(&exists, refdb, name));
+	cl_assert_equal_i(0, exists);
+	git_refdb_free(refdb);
+}
+
+void test_refs_packedmmap__looks_up_packed_refs(void)
+{
+	cl_git_mkfile("testrepo/.git/packed-refs",
+		"# pack-refs with: peeled fully-peeled sorted \n"
+		"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9 refs/heads/packed\n"
+		"5b5b025afb0b4c913b4c338a42934a3863bf3644 refs/heads/packed-two\n"
+		"b25fa35b38051e4ae45d4222e795f9df2e43f1d1 refs/tags/packed-tag\n"
+		"^e90810b8df3e80c413d903f631643c716887138d\n"
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/tags/packed-z\r\n");
+
+	assert_ref("refs/heads/packed",
+		"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9", NULL);
+	assert_ref("refs/heads/packed-two",
+		"5b5b025afb0b4c913b4c338a42934a3863bf3644", NULL);
+	assert_ref("refs/tags/packed-tag",
+		"b25fa35b38051e4ae45d4222e795f9df2e43f1d1",
+		"e90810b8df3e80c413d903f631643c716887138d");
+	assert_ref("refs/tags/packed-z",
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750", NULL);
+
+	assert_no_ref("refs/heads/pack");
+	assert_no_ref("refs/heads/packed-");
+	assert_no_ref("refs/heads/packed-testing");
+	assert_no_ref("refs/tags/packed");
+	assert_no_ref("refs/zzz");
+	assert_no_ref("refs/a");
+
+	assert_same_as_parsed(NULL);
+	assert_same_as_parsed("refs/tags/packed*");
+}
+
+void test_refs_packedmmap__iterates_like_parsed_refs(void)
+{
+	packall();
+
+	assert_same_as_parsed(NULL);
+	assert_same_as_parsed("refs/heads/*");
+	assert_same_as_parsed("refs/tags/*");
+	assert_same_as_parsed("refs/*/t*");
+	assert_same_as_parsed("refs/heads/packed");
+	assert_same_as_parsed("refs/heads/br[0-9]");
+	assert_same_as_parsed("refs/nothing/*");
+	assert_same_as_parsed("*");
+}
+
+void test_refs_packedmmap__loose_refs_shadow_packed_refs(void)
+{
+	git_reference *ref;
+	git_oid oid;
+
+	packall();
+
+	cl_git_pass(git_oid_fromstr(&oid, "e90810b8df3e80c413d903f631643c716887138d"));
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master", &oid, 1, NULL));
+	git_reference_free(ref);
+
+	assert_ref("refs/heads/master", "e90810b8df3e80c413d903f631643c716887138d", NULL);
+	assert_same_as_parsed("refs/heads/*");
+	assert_same_as_parsed(NULL);
+}
+
+void test_refs_packedmmap__falls_back_for_unsorted_file(void)
+{
+	/* the packed-refs of testrepo does not say that it is sorted */
+	cl_git_rewritefile("testrepo/.git/packed-refs",
+		"# pack-refs with: peeled \n"
+		"5b5b025afb0b4c913b4c338a42934a3863bf3644 refs/heads/packed-test\n"
+		"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9 refs/heads/packed\n");
+
+	assert_ref("refs/heads/packed",
+		"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9", NULL);
+	assert_no_ref("refs/heads/packed-");
+	assert_same_as_parsed("refs/heads/*");
+}
+
+void test_refs_packedmmap__sees_rewritten_file(void)
+{
+	packall();
+	assert_ref("refs/heads/packed",
+		"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9", NULL);
+
+	cl_git_rewritefile("testrepo/.git/packed-refs",
+		"# pack-refs with: peeled fully-peeled sorted \n"
+		"5b5b025afb0b4c913b4c338a42934a3863bf3644 refs/heads/packed\n"
+		"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9 refs/heads/packed-again\n");
+
+	assert_ref("refs/heads/packed",
+		"5b5b025afb0b4c913b4c338a42934a3863bf3644", NULL);
+	assert_ref("refs/heads/packed-again",
+		"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9", NULL);
+	assert_no_ref("refs/heads/packed-test");
+	assert_same_as_parsed(NULL);
+
+	cl_must_pass(p_unlink("testrepo/.git/packed-refs"));
+
+	assert_no_ref("refs/heads/packed");
+	assert_same_as_parsed(NULL);
+}
+
+void test_refs_packedmmap__reports_corrupted_file(void)
+{
+	git_reference *ref;
+
+	cl_git_rewritefile("testrepo/.git/packed-refs",
+		"# pack-refs with: peeled fully-peeled sorted \n"
+		"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9 refs/heads/packed\n"
+		"zzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzz refs/heads/packed-z\n");
+
+	cl_git_fail(git_reference_lookup(&ref, g_repo, "refs/heads/packed-z"));
+	cl_assert(git_error_last()->klass == GIT_ERROR_REFERENCE);
+}
@@ -0,0 +1,718 @@
+#include "clar_libgit2.h"
+
+#include "fileops.h"
+#include "git2/refdb.h"
+#include "git2/sys/refdb_backend.h"
+#include "refdb.h"
+#include "refdb_reftable.h"
+#include "reftable.h"
+#include "refs.h"
+
+static git_repository *g_repo;
+static git_refdb *g_refdb;
+
+static const char *g_master = "099fabac3a9ea935598528c27f866e34089c2eff";
+static const char *g_other = "e90810b8df3e80c413d903f631643c716887138d";
+
+static void use_reftable(void)
+{
+	git_refdb_backend *backend;
+
+	cl_git_pass(git_refdb_backend_reftable(&backend, g_repo));
+	cl_git_pass(git_refdb_set_backend(g_refdb, backend));
+}
+
+void test_refs_reftable__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo");
+	cl_git_pass(git_repository_refdb(&g_refdb, g_repo));
+	use_reftable();
+}
+
+void test_refs_reftable__cleanup(void)
+{
+	git_refdb_free(g_refdb);
+	cl_git_sandbox_cleanup();
+}
+
+/* Start over with an empty stack, and the given table options */
+static void reset_reftable(int block_size, int restart_interval)
+{
+	git_config *cfg;
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_int32(cfg, "reftable.blocksize", block_size));
+	cl_git_pass(git_config_set_int32(cfg, "reftable.restartinterval", restart_interval));
+	git_config_free(cfg);
+
+	cl_git_pass(git_futils_rmdir_r("testrepo/.git/reftable", NULL, GIT_RMDIR_REMOVE_FILES));
+	use_reftable();
+}
+
+/* The update index of the newest table in the stack */
+static uint64_t max_update_index(void)
+{
+	git_buf list = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_reftable *table;
+	uint64_t max;
+	char *last;
+
+	cl_git_pass(git_futils_readbuffer(&list, "testrepo/.git/reftable/tables.list"));
+	git_buf_rtrim(&list);
+	last = strrchr(list.ptr, '\n');
+
+	cl_git_pass(git_buf_joinpath(&path, "testrepo/.git/reftable", last ? last + 1 : list.ptr));
+	cl_git_pass(git_reftable_open(&table, path.ptr));
+	max = git_reftable_max_update_index(table);
+
+	git_reftable_free(table);
+	git_buf_dispose(&list);
+	git_buf_dispose(&path);
+	return max;
+}
+
+static size_t table_count(void)
+{
+	size_t count;
+
+	cl_git_pass(git_refdb_reftable__table_count(&count, g_refdb->backend));
+	return count;
+}
+
+/* List the references in order; the files backend lists packed ones last */
+static void list_refs(git_buf *out, git_repository *repo, const char *glob)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	git_vector lines = GIT_VECTOR_INIT;
+	char oid[GIT_OID_HEXSZ + 1];
+	char *line;
+	size_t i;
+	int error;
+
+	lines._cmp = git__strcmp_cb;
+
+	if (glob)
+		cl_git_pass(git_reference_iterator_glob_new(&iter, repo, glob));
+	else
+		cl_git_pass(git_reference_iterator_new(&iter, repo));
+
+	while ((error = git_reference_next(&ref, iter)) == 0) {
+		if (git_reference_type(ref) == GIT_REFERENCE_DIRECT)
+			git_oid_tostr(oid, sizeof(oid), git_reference_target(ref));
+		else
+			strcpy(oid, git_reference_symbolic_target(ref));
+
+		line = git__malloc(strlen(git_reference_name(ref)) + strlen(oid) + 2);
+		cl_assert(line);
+		sprintf(line, "%s %s", git_reference_name(ref), oid);
+		cl_git_pass(git_vector_insert(&lines, line));
+
+		git_reference_free(ref);
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_reference_iterator_free(iter);
+
+	git_buf_clear(out);
+	git_vector_sort(&lines);
+
+	git_vector_foreach(&lines, i, line)
+		git_buf_printf(out, "%s\n", line);
+
+	cl_assert(!git_buf_oom(out));
+	git_vector_free_deep(&lines);
+}
+
+static void assert_ref(const char *name, const char *target)
+{
+	git_reference *ref;
+	git_oid expected;
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+
+	if (git_reference_type(ref) == GIT_REFERENCE_SYMBOLIC) {
+		cl_assert_equal_s(target, git_reference_symbolic_target(ref));
+	} else {
+		cl_git_pass(git_oid_fromstr(&expected, target));
+		cl_assert_equal_oid(&expected, git_reference_target(ref));
+	}
+
+	git_reference_free(ref);
+}
+
+static void assert_no_ref(const char *name)
+{
+	git_reference *ref;
+	int exists;
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, name));
+	cl_git_pass(git_refdb_exists(&exists, g_refdb, name));
+	cl_assert_equal_i(0, exists);
+}
+
+static void create_ref(const char *name, const char *target, int force)
+{
+	git_reference *ref;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, target));
+	cl_git_pass(git_reference_create(&ref, g_repo, name, &oid, force, NULL));
+	git_reference_free(ref);
+}
+
+void test_refs_reftable__imports_the_references(void)
+{
+	git_repository *files;
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+
+	cl_assert(git_path_isfile("testrepo/.git/reftable/tables.list"));
+	cl_assert_equal_sz(1, table_count());
+
+	cl_git_pass(git_repository_open(&files, "testrepo"));
+
+	list_refs(&expected, files, NULL);
+	list_refs(&actual, g_repo, NULL);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	list_refs(&expected, files, "refs/tags/*");
+	list_refs(&actual, g_repo, "refs/tags/*");
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	assert_ref("HEAD", "refs/heads/master");
+	assert_ref("refs/heads/master", g_master);
+	assert_ref("refs/heads/packed-test", "4a202b346bb0fb0db7eff3cffeb3c70babbd2045");
+
+	git_repository_free(files);
+	git_buf_dispose(&expected);
+	git_buf_dispose(&actual);
+}
+
+void test_refs_reftable__creates_updates_and_deletes(void)
+{
+	git_reference *ref;
+	git_oid oid;
+
+	create_ref("refs/heads/new", g_master, 0);
+	assert_ref("refs/heads/new", g_master);
+
+	cl_git_pass(git_oid_fromstr(&oid, g_other));
+	cl_git_fail_with(GIT_EEXISTS,
+		git_reference_create(&ref, g_repo, "refs/heads/new", &oid, 0, NULL));
+
+	create_ref("refs/heads/new", g_other, 1);
+	assert_ref("refs/heads/new", g_other);
+
+	cl_git_pass(git_reference_symbolic_create(&ref, g_repo,
+		"refs/heads/sym", "refs/heads/new", 0, NULL));
+	git_reference_free(ref);
+	assert_ref("refs/heads/sym", "refs/heads/new");
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/new"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	assert_no_ref("refs/heads/new");
+	assert_ref("refs/heads/master", g_master);
+}
+
+void test_refs_reftable__checks_the_old_value(void)
+{
+	git_reference *ref;
+	git_oid old, new;
+
+	cl_git_pass(git_oid_fromstr(&old, g_other));
+	cl_git_pass(git_oid_fromstr(&new, g_other));
+
+	cl_git_fail_with(GIT_EMODIFIED, git_reference_create_matching(&ref, g_repo,
+		"refs/heads/master", &new, 1, &old, NULL));
+	assert_ref("refs/heads/master", g_master);
+
+	cl_git_pass(git_oid_fromstr(&old, g_master));
+	cl_git_pass(git_reference_create_matching(&ref, g_repo,
+		"refs/heads/master", &new, 1, &old, NULL));
+	git_reference_free(ref);
+	assert_ref("refs/heads/master", g_other);
+}
+
+void test_refs_reftable__rejects_clashing_names(void)
+{
+	git_reference *ref;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, g_master));
+
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads/master/sub", &oid, 1, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads", &oid, 1, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/tags/foo", &oid, 1, NULL));
+
+	/* a directory is fine once the reference that it replaces is gone */
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/foo/bar"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/foo/foo/bar"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	create_ref("refs/tags/foo", g_master, 0);
+	assert_ref("refs/tags/foo", g_master);
+}
+
+void test_refs_reftable__renames(void)
+{
+	git_reference *ref, *renamed;
+	git_reflog *reflog;
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+	cl_git_pass(git_reference_rename(&renamed, ref, "refs/heads/br2/renamed", 0, "rename it"));
+	git_reference_free(ref);
+
+	cl_assert_equal_s("refs/heads/br2/renamed", git_reference_name(renamed));
+	git_reference_free(renamed);
+
+	assert_no_ref("refs/heads/br2");
+	assert_ref("refs/heads/br2/renamed", "a4a7dce85cf63874e984719f4fdd239f5145052f");
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/br2/renamed"));
+	cl_assert_equal_sz(1, git_reflog_entrycount(reflog));
+	cl_assert_equal_s("rename it", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	git_reflog_free(reflog);
+}
+
+void test_refs_reftable__spans_many_blocks(void)
+{
+	git_transaction *tx;
+	git_reference_iterator *iter;
+	git_buf name = GIT_BUF_INIT;
+	const char *next;
+	git_oid oid;
+	size_t i, count = 0;
+	int error;
+
+	reset_reftable(256, 4);
+
+	cl_git_pass(git_oid_fromstr(&oid, g_master));
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+
+	for (i = 0; i < 600; i++) {
+		git_buf_clear(&name);
+		git_buf_printf(&name, "refs/heads/many/%04d", (int)i);
+
+		cl_git_pass(git_transaction_lock_ref(tx, name.ptr));
+		cl_git_pass(git_transaction_set_target(tx, name.ptr, &oid, NULL, NULL));
+	}
+
+	cl_git_pass(git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	for (i = 0; i < 600; i += 7) {
+		git_buf_clear(&name);
+		git_buf_printf(&name, "refs/heads/many/%04d", (int)i);
+		assert_ref(name.ptr, g_master);
+	}
+
+	assert_no_ref("refs/heads/many/0000a");
+	assert_no_ref("refs/heads/many/9999");
+	assert_no_ref("refs/heads/lots");
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, "refs/heads/many/0[1-3]*"));
+
+	while ((error = git_reference_next_name(&next, iter)) == 0) {
+		cl_assert(!git__prefixcmp(next, "refs/heads/many/0"));
+		count++;
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	cl_assert_equal_sz(300, count);
+
+	git_reference_iterator_free(iter);
+	git_buf_dispose(&name);
+}
+
+void test_refs_reftable__finds_refs_by_object(void)
+{
+	git_vector names = GIT_VECTOR_INIT;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, g_master));
+	cl_git_pass(git_refdb_reftable__refs_to(&names, g_refdb->backend, &oid));
+
+	cl_assert_equal_sz(2, names.length);
+	cl_assert_equal_s("refs/heads/master", git_vector_get(&names, 0));
+	cl_assert_equal_s("refs/heads/testrepo-worktree", git_vector_get(&names, 1));
+	git_vector_free_deep(&names);
+
+	/* a reference that moves away no longer points to it */
+	create_ref("refs/heads/master", g_other, 1);
+
+	cl_git_pass(git_refdb_reftable__refs_to(&names, g_refdb->backend, &oid));
+	cl_assert_equal_sz(1, names.length);
+	cl_assert_equal_s("refs/heads/testrepo-worktree", git_vector_get(&names, 0));
+	git_vector_free_deep(&names);
+
+	cl_git_pass(git_oid_fromstr(&oid, g_other));
+	cl_git_pass(git_refdb_reftable__refs_to(&names, g_refdb->backend, &oid));
+	cl_assert_equal_sz(2, names.length);
+	cl_assert_equal_s("refs/heads/master", git_vector_get(&names, 0));
+	cl_assert_equal_s("refs/heads/test", git_vector_get(&names, 1));
+	git_vector_free_deep(&names);
+}
+
+void test_refs_reftable__keeps_reflogs(void)
+{
+	git_reference *ref;
+	git_reflog *reflog;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, g_master));
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/logged", &oid, 0, "first"));
+	git_reference_free(ref);
+
+	cl_git_pass(git_oid_fromstr(&oid, g_other));
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/logged", &oid, 1, "second"));
+	git_reference_free(ref);
+
+	cl_assert_equal_i(1, git_reference_has_log(g_repo, "refs/heads/logged"));
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/logged"));
+	cl_assert_equal_sz(2, git_reflog_entrycount(reflog));
+	cl_assert_equal_s("second", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	cl_assert_equal_s("first", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 1)));
+	cl_assert_equal_oid(&oid, git_reflog_entry_id_new(git_reflog_entry_byindex(reflog, 0)));
+
+	cl_git_pass(git_reflog_drop(reflog, 0, 1));
+	cl_git_pass(git_reflog_write(reflog));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/logged"));
+	cl_assert_equal_sz(1, git_reflog_entrycount(reflog));
+	cl_assert_equal_s("first", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_rename(g_repo, "refs/heads/logged", "refs/heads/moved"));
+	cl_assert_equal_i(0, git_reference_has_log(g_repo, "refs/heads/logged"));
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/moved"));
+	cl_assert_equal_sz(1, git_reflog_entrycount(reflog));
+	git_reflog_free(reflog);
+
+	cl_git_pass(git_reflog_delete(g_repo, "refs/heads/moved"));
+	cl_assert_equal_i(0, git_reference_has_log(g_repo, "refs/heads/moved"));
+
+	cl_git_pass(git_reference_ensure_log(g_repo, "refs/tags/unlogged"));
+	cl_assert_equal_i(1, git_reference_has_log(g_repo, "refs/tags/unlogged"));
+}
+
+void test_refs_reftable__writes_a_transaction_as_one_update(void)
+{
+	git_transaction *tx;
+	git_oid oid;
+
+	cl_assert_equal_i(1, max_update_index());
+	cl_git_pass(git_oid_fromstr(&oid, g_other));
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/one"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/br2"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/tags/e90810b"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/master", &oid, NULL, "tx"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/one", &oid, NULL, "tx"));
+	cl_git_pass(git_transaction_remove(tx, "refs/heads/br2"));
+	cl_git_pass(git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	cl_assert_equal_i(2, max_update_index());
+	assert_ref("refs/heads/master", g_other);
+	assert_ref("refs/heads/one", g_other);
+	assert_no_ref("refs/heads/br2");
+}
+
+void test_refs_reftable__failed_transaction_writes_nothing(void)
+{
+	git_transaction *tx;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, g_other));
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/missing"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/master", &oid, NULL, NULL));
+	cl_git_pass(git_transaction_remove(tx, "refs/heads/missing"));
+	cl_git_fail(git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	cl_assert_equal_i(1, max_update_index());
+	assert_ref("refs/heads/master", g_master);
+}
+
+/* Only the locked references are held back by a transaction */
+void test_refs_reftable__writes_other_refs_during_a_transaction(void)
+{
+	git_transaction *tx;
+	git_reference *ref;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, g_other));
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/master", &oid, NULL, NULL));
+
+	cl_git_fail_with(GIT_ELOCKED,
+		git_reference_create(&ref, g_repo, "refs/heads/master", &oid, 1, NULL));
+	cl_git_fail_with(GIT_ELOCKED,
+		git_reference_remove(g_repo, "refs/heads/master"));
+	create_ref("refs/heads/other", g_other, 0);
+
+	/* the write is not part of the transaction, which is never committed */
+	git_transaction_free(tx);
+
+	assert_ref("refs/heads/other", g_other);
+	assert_ref("refs/heads/master", g_master);
+
+	create_ref("refs/heads/master", g_other, 1);
+	assert_ref("refs/heads/master", g_other);
+}
+
+void test_refs_reftable__keeps_transactions_apart(void)
+{
+	git_transaction *one, *two;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, g_other));
+
+	cl_git_pass(git_transaction_new(&one, g_repo));
+	cl_git_pass(git_transaction_new(&two, g_repo));
+	cl_git_pass(git_transaction_lock_ref(one, "refs/heads/master"));
+	cl_git_pass(git_transaction_lock_ref(two, "refs/heads/one"));
+	cl_git_pass(git_transaction_lock_ref(two, "refs/heads/two"));
+	cl_git_fail_with(GIT_ELOCKED, git_transaction_lock_ref(two, "refs/heads/master"));
+
+	cl_git_pass(git_transaction_set_target(one, "refs/heads/master", &oid, NULL, NULL));
+	cl_git_pass(git_transaction_set_target(two, "refs/heads/one", &oid, NULL, NULL));
+	cl_git_pass(git_transaction_set_target(two, "refs/heads/two", &oid, NULL, NULL));
+
+	cl_git_pass(git_transaction_commit(two));
+	git_transaction_free(two);
+
+	assert_ref("refs/heads/one", g_other);
+	assert_ref("refs/heads/two", g_other);
+	assert_ref("refs/heads/master", g_master);
+
+	git_transaction_free(one);
+	assert_ref("refs/heads/master", g_master);
+}
+
+/*
+ * Another process does not see the locks of a transaction, so a reference
+ * that it changes in the meantime makes the transaction fail.
+ */
+void test_refs_reftable__transaction_fails_on_concurrent_changes(void)
+{
+	git_repository *other;
+	git_refdb *other_refdb;
+	git_refdb_backend *backend;
+	git_transaction *tx;
+	git_reference *ref;
+	git_oid oid, other_oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, g_other));
+	cl_git_pass(git_oid_fromstr(&other_oid, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+
+	cl_git_pass(git_repository_open(&other, "testrepo"));
+	cl_git_pass(git_repository_refdb(&other_refdb, other));
+	cl_git_pass(git_refdb_backend_reftable(&backend, other));
+	cl_git_pass(git_refdb_set_backend(other_refdb, backend));
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/created"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/master", &oid, NULL, NULL));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/created", &oid, NULL, NULL));
+
+	cl_git_pass(git_reference_create(&ref, other, "refs/heads/master", &other_oid, 1, NULL));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_EMODIFIED, git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	assert_ref("refs/heads/master", "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+	assert_no_ref("refs/heads/created");
+
+	/* a reference that did not exist when it was locked must not appear */
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/created"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/created", &oid, NULL, NULL));
+
+	cl_git_pass(git_reference_create(&ref, other, "refs/heads/created", &other_oid, 0, NULL));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_EMODIFIED, git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	assert_ref("refs/heads/created", "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	git_refdb_free(other_refdb);
+	git_repository_free(other);
+}
+
+void test_refs_reftable__compacts_the_stack(void)
+{
+	git_buf name = GIT_BUF_INIT;
+	size_t i;
+
+	for (i = 0; i < 64; i++) {
+		git_buf_clear(&name);
+		git_buf_printf(&name, "refs/heads/compact-%d", (int)i);
+		create_ref(name.ptr, i % 2 ? g_master : g_other, 0);
+		cl_assert(table_count() <= 8);
+	}
+
+	cl_git_pass(git_refdb_compress(g_refdb));
+	cl_assert_equal_sz(1, table_count());
+
+	for (i = 0; i < 64; i++) {
+		git_buf_clear(&name);
+		git_buf_printf(&name, "refs/heads/compact-%d", (int)i);
+		assert_ref(name.ptr, i % 2 ? g_master : g_other);
+	}
+
+	git_buf_dispose(&name);
+}
+
+void test_refs_reftable__persists(void)
+{
+	create_ref("refs/heads/kept", g_other, 0);
+
+	git_refdb_free(g_refdb);
+	g_repo = cl_git_sandbox_reopen();
+	cl_git_pass(git_repository_refdb(&g_refdb, g_repo));
+	use_reftable();
+
+	assert_ref("refs/heads/kept", g_other);
+	assert_ref("HEAD", "refs/heads/master");
+	cl_assert_equal_i(2, max_update_index());
+}
+
+void test_refs_reftable__round_trips_records(void)
+{
+	git_reftable_writer_options opts = GIT_REFTABLE_WRITER_OPTIONS_INIT;
+	git_reftable_iter iter = GIT_REFTABLE_ITER_INIT;
+	git_reftable_writer *writer;
+	git_reftable *table;
+	git_reftable_ref ref;
+	git_reftable_log log;
+	git_buf data = GIT_BUF_INIT, name = GIT_BUF_INIT;
+	git_oid oid;
+	size_t i;
+
+	opts.block_size = 256;
+	opts.restart_interval = 3;
+	opts.min_update_index = 5;
+	opts.max_update_index = 9;
+
+	cl_git_pass(git_oid_fromstr(&oid, g_master));
+	cl_git_pass(git_reftable_writer_new(&writer, &opts));
+
+	for (i = 0; i < 200; i++) {
+		git_buf_clear(&name);
+		git_buf_printf(&name, "refs/tags/v%03d", (int)(199 - i));
+
+		memset(&ref, 0, sizeof(ref));
+		ref.name = name.ptr;
+		ref.update_index = 5 + i % 5;
+		ref.type = GIT_REFTABLE_VAL1;
+		git_oid_cpy(&ref.oid, &oid);
+		cl_git_pass(git_reftable_writer_add_ref(writer, &ref));
+
+		memset(&log, 0, sizeof(log));
+		log.refname = name.ptr;
+		log.update_index = 5 + i % 5;
+		git_oid_cpy(&log.new_id, &oid);
+		log.name = "Somebody";
+		log.email = "somebody@example.com";
+		log.time = 1234567890;
+		log.tz_offset = -120;
+		log.message = "created\n";
+		cl_git_pass(git_reftable_writer_add_log(writer, &log));
+	}
+
+	cl_git_pass(git_reftable_writer_finish(&data, writer));
+	git_reftable_writer_free(writer);
+
+	cl_assert_equal_i(0, memcmp(data.ptr, "REFT\001", 5));
+	cl_assert_equal_i(0, memcmp(data.ptr, data.ptr + data.size - GIT_REFTABLE_FOOTER_SIZE,
+		GIT_REFTABLE_HEADER_SIZE));
+
+	cl_git_pass(git_futils_writebuffer(&data, "round-trip.ref", 0, 0666));
+	cl_git_pass(git_reftable_open(&table, "round-trip.ref"));
+
+	cl_assert_equal_i(5, git_reftable_min_update_index(table));
+	cl_assert_equal_i(9, git_reftable_max_update_index(table));
+
+	/* every reference can be found, and they all come in order */
+	cl_git_pass(git_reftable_seek_ref(&iter, table, "refs/tags/v100"));
+	cl_git_pass(git_reftable_next_ref(&ref, &iter));
+	cl_assert_equal_s("refs/tags/v100", ref.name);
+	cl_assert_equal_oid(&oid, &ref.oid);
+
+	cl_git_pass(git_reftable_seek_ref(&iter, table, ""));
+	for (i = 0; i < 200; i++) {
+		git_buf_clear(&name);
+		git_buf_printf(&name, "refs/tags/v%03d", (int)i);
+
+		cl_git_pass(git_reftable_next_ref(&ref, &iter));
+		cl_assert_equal_s(name.ptr, ref.name);
+		cl_assert_equal_i(GIT_REFTABLE_VAL1, ref.type);
+	}
+	cl_git_fail_with(GIT_ITEROVER, git_reftable_next_ref(&ref, &iter));
+
+	cl_git_pass(git_reftable_seek_ref(&iter, table, "refs/tags/v1000"));
+	cl_git_pass(git_reftable_next_ref(&ref, &iter));
+	cl_assert_equal_s("refs/tags/v101", ref.name);
+
+	cl_git_pass(git_reftable_seek_ref(&iter, table, "refs/tags/w"));
+	cl_git_fail_with(GIT_ITEROVER, git_reftable_next_ref(&ref, &iter));
+
+	/* as can the reflog entries */
+	cl_git_pass(git_reftable_seek_log(&iter, table, "refs/tags/v150", UINT64_MAX));
+	cl_git_pass(git_reftable_next_log(&log, &iter));
+	cl_assert_equal_s("refs/tags/v150", log.refname);
+	cl_assert_equal_s("Somebody", log.name);
+	cl_assert_equal_s("somebody@example.com", log.email);
+	cl_assert_equal_s("created\n", log.message);
+	cl_assert_equal_i(-120, log.tz_offset);
+	cl_assert(log.time == 1234567890);
+	cl_assert_equal_oid(&oid, &log.new_id);
+
+	git_reftable_iter_dispose(&iter);
+	git_reftable_free(table);
+	git_buf_dispose(&data);
+	git_buf_dispose(&name);
+	cl_must_pass(p_unlink("round-trip.ref"));
+}
+
+void test_refs_reftable__rejects_a_corrupted_table(void)
+{
+	git_reftable_writer_options opts = GIT_REFTABLE_WRITER_OPTIONS_INIT;
+	git_reftable_writer *writer;
+	git_reftable *table;
+	git_buf data = GIT_BUF_INIT;
+
+	opts.min_update_index = opts.max_update_index = 1;
+
+	cl_git_pass(git_reftable_writer_new(&writer, &opts));
+	cl_git_pass(git_reftable_writer_finish(&data, writer));
+	git_reftable_writer_free(writer);
+
+	data.ptr[data.size - 10] ^= 0xff;
+
+	cl_git_pass(git_futils_writebuffer(&data, "corrupt.ref", 0, 0666));
+	cl_git_fail(git_reftable_open(&table, "corrupt.ref"));
+	cl_assert(git_error_last()->klass == GIT_ERROR_REFERENCE);
+
+	git_buf_dispose(&data);
+	cl_must_pass(p_unlink("corrupt.ref"));
+}
@@ -1,4 +1,5 @@
 #include "clar_libgit2.h"
+#include "git2/sys/commit_graph.h"
 
 /*
 	*   a4a7dce [0] Merge branch 'master' into br2
@@ -625,3 +626,92 @@ void test_revwalk_basic__newer_hidden_commit_hides_old_commits(void)
 
 	cl_git_fail_with(GIT_ITEROVER, git_revwalk_next(&oid, _walk));
 }
+
+static void commit_at(git_oid *out, git_time_t time, const git_oid *parent_id)
+{
+	git_treebuilder *builder;
+	git_tree *tree;
+	git_commit *parent = NULL;
+	git_signature *sig;
+	git_oid tree_id;
+
+	cl_git_pass(git_treebuilder_new(&builder, _repo, NULL));
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+	cl_git_pass(git_signature_new(&sig, "Joe", "joe@example.com", time, 0));
+
+	if (parent_id)
+		cl_git_pass(git_commit_lookup(&parent, _repo, parent_id));
+
+	cl_git_pass(git_commit_create(out, _repo, NULL, sig, sig, NULL, "skewed",
+		tree, parent ? 1 : 0, (const git_commit **)&parent));
+
+	git_commit_free(parent);
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_treebuilder_free(builder);
+}
+
+static void assert_only_interesting(const git_oid *interesting, const git_oid *hidden)
+{
+	git_oid oid;
+
+	git_revwalk_free(_walk);
+	cl_git_pass(git_revwalk_new(&_walk, _repo));
+	cl_git_pass(git_revwalk_push(_walk, interesting));
+	cl_git_pass(git_revwalk_hide(_walk, hidden));
+
+	cl_git_pass(git_revwalk_next(&oid, _walk));
+	cl_assert_equal_oid(interesting, &oid);
+	cl_git_fail_with(GIT_ITEROVER, git_revwalk_next(&oid, _walk));
+}
+
+/*
+ * Ensure that a hidden commit hides its ancestors when it only reaches
+ * them through commits that are dated before them.
+ *
+ *   * I (300)
+ *   | * H (400)
+ *   | * S1 (150)
+ *   | * S2 (140)
+ *   | * S3 (130)
+ *   |/
+ *   * B (200)
+ *
+ * % git rev-list I ^H
+ * I
+ */
+void test_revwalk_basic__hidden_commit_behind_clock_skew(void)
+{
+	git_commit_graph_writer *w;
+	git_odb *odb;
+	git_buf path = GIT_BUF_INIT;
+	git_oid b, s, i, h;
+
+	revwalk_basic_setup_walk("empty_standard_repo");
+
+	commit_at(&b, 200, NULL);
+	commit_at(&i, 300, &b);
+	commit_at(&s, 130, &b);
+	commit_at(&s, 140, &s);
+	commit_at(&s, 150, &s);
+	commit_at(&h, 400, &s);
+
+	assert_only_interesting(&i, &h);
+
+	/* the generation numbers of a commit-graph must not change that */
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+	cl_git_pass(git_revwalk_push(_walk, &i));
+	cl_git_pass(git_revwalk_push(_walk, &h));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, _walk));
+	cl_git_pass(git_commit_graph_writer_commit(w));
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	assert_only_interesting(&i, &h);
+
+	git_odb_free(odb);
+	git_commit_graph_writer_free(w);
+	git_buf_dispose(&path);
+}
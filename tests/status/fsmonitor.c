@@ -0,0 +1,291 @@
+#include "clar_libgit2.h"
+#include "posix.h"
+#include "index.h"
+#include "repository.h"
+#include "git2/sys/diff.h"
+#include "git2/sys/repository.h"
+
+static git_repository *g_repo = NULL;
+
+struct monitor {
+	const char *answer;
+	size_t answer_len;
+	int error;
+	int calls;
+	git_buf token;
+};
+
+static struct monitor g_monitor;
+
+#define set_answer(str) do { \
+		g_monitor.answer = str; \
+		g_monitor.answer_len = sizeof(str) - 1; \
+	} while (0)
+
+static int monitor_cb(git_buf *out, const char *token, void *payload)
+{
+	struct monitor *monitor = payload;
+
+	monitor->calls++;
+	cl_git_pass(git_buf_sets(&monitor->token, token));
+
+	if (monitor->error)
+		return monitor->error;
+
+	return git_buf_put(out, monitor->answer, monitor->answer_len);
+}
+
+void test_status_fsmonitor__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("status");
+
+	memset(&g_monitor, 0, sizeof(g_monitor));
+	set_answer("token\0");
+	git_repository_set_fsmonitor(g_repo, monitor_cb, &g_monitor);
+}
+
+void test_status_fsmonitor__cleanup(void)
+{
+	git_buf_dispose(&g_monitor.token);
+	cl_git_sandbox_cleanup();
+	g_repo = NULL;
+}
+
+static size_t status(git_buf *out)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *list;
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	const git_status_entry *entry;
+	size_t i;
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED | GIT_STATUS_OPT_UPDATE_INDEX;
+
+	cl_git_pass(git_status_list_new(&list, g_repo, &opts));
+	cl_git_pass(git_status_list_get_perfdata(&perf, list));
+
+	git_buf_clear(out);
+
+	for (i = 0; i < git_status_list_entrycount(list); i++) {
+		entry = git_status_byindex(list, i);
+		git_buf_printf(out, "%s %x\n", entry->index_to_workdir ?
+			entry->index_to_workdir->new_file.path :
+			entry->head_to_index->new_file.path, entry->status);
+	}
+
+	cl_assert(!git_buf_oom(out));
+	git_status_list_free(list);
+
+	return perf.stat_calls;
+}
+
+static bool has_line(git_buf *buf, const char *line)
+{
+	size_t len = strlen(line);
+	const char *c;
+
+	for (c = buf->ptr; c && *c; c = strchr(c, '\n'), c = c ? c + 1 : NULL) {
+		if (strncmp(c, line, len) == 0 && c[len] == '\n')
+			return true;
+	}
+
+	return false;
+}
+
+static git_index *reload_index(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_git_pass(git_index_read(index, true));
+
+	return index;
+}
+
+static bool is_valid(git_index *index, const char *path)
+{
+	const git_index_entry *entry;
+
+	cl_assert(entry = git_index_get_bypath(index, path, 0));
+	return (entry->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID) != 0;
+}
+
+void test_status_fsmonitor__records_token(void)
+{
+	git_buf actual = GIT_BUF_INIT, token = GIT_BUF_INIT;
+	git_index *index;
+	const char *c;
+
+	/* there is no token to ask the monitor about yet */
+	status(&actual);
+	cl_assert_equal_i(0, g_monitor.calls);
+
+	index = reload_index();
+	cl_assert(index->fsmonitor_token);
+
+	for (c = index->fsmonitor_token; *c; c++)
+		cl_assert(git__isdigit(*c));
+
+	cl_assert(is_valid(index, "current_file"));
+	cl_assert(is_valid(index, "subdir/current_file"));
+	cl_assert(!is_valid(index, "modified_file"));
+	cl_assert(!is_valid(index, "staged_changes_modified_file"));
+
+	/* the next status asks the monitor */
+	cl_git_pass(git_buf_sets(&token, index->fsmonitor_token));
+	status(&actual);
+	cl_assert_equal_i(1, g_monitor.calls);
+	cl_assert_equal_s(token.ptr, g_monitor.token.ptr);
+
+	index = reload_index();
+	cl_assert_equal_s("token", index->fsmonitor_token);
+	cl_assert(is_valid(index, "current_file"));
+
+	git_buf_dispose(&actual);
+	git_buf_dispose(&token);
+}
+
+void test_status_fsmonitor__skips_unchanged_files(void)
+{
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+	size_t stat_calls;
+
+	stat_calls = status(&expected);
+
+	status(&actual);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+	cl_assert(status(&actual) < stat_calls);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	/* a change that the monitor does not report goes unnoticed */
+	cl_git_rewritefile("status/current_file", "changed\n");
+	status(&actual);
+	cl_assert(!has_line(&actual, "current_file 100"));
+
+	set_answer("token2\0current_file\0");
+	status(&actual);
+	cl_assert(has_line(&actual, "current_file 100"));
+
+	git_buf_dispose(&expected);
+	git_buf_dispose(&actual);
+}
+
+void test_status_fsmonitor__reports_directories(void)
+{
+	git_buf actual = GIT_BUF_INIT;
+	git_index *index;
+
+	status(&actual);
+	status(&actual);
+
+	cl_git_rewritefile("status/subdir/current_file", "changed\n");
+	set_answer("token2\0subdir/\0");
+	status(&actual);
+	cl_assert(has_line(&actual, "subdir/current_file 100"));
+
+	index = reload_index();
+	cl_assert(!is_valid(index, "subdir/current_file"));
+	cl_assert(is_valid(index, "current_file"));
+
+	/* "/" stands for everything */
+	cl_git_rewritefile("status/current_file", "changed\n");
+	set_answer("token3\0/\0");
+	status(&actual);
+	cl_assert(has_line(&actual, "current_file 100"));
+
+	git_buf_dispose(&actual);
+}
+
+void test_status_fsmonitor__passthrough_examines_everything(void)
+{
+	git_buf actual = GIT_BUF_INIT;
+	git_index *index;
+
+	status(&actual);
+	status(&actual);
+
+	cl_git_rewritefile("status/current_file", "changed\n");
+	g_monitor.error = GIT_PASSTHROUGH;
+	status(&actual);
+	cl_assert(has_line(&actual, "current_file 100"));
+
+	/* the next query is made with the time of this one */
+	index = reload_index();
+	cl_assert(git__isdigit(index->fsmonitor_token[0]));
+
+	git_buf_dispose(&actual);
+}
+
+void test_status_fsmonitor__propagates_errors(void)
+{
+	git_status_list *list;
+	git_buf actual = GIT_BUF_INIT;
+
+	status(&actual);
+
+	g_monitor.error = -42;
+	cl_git_fail_with(-42, git_status_list_new(&list, g_repo, NULL));
+
+	git_buf_dispose(&actual);
+}
+
+void test_status_fsmonitor__token_is_dropped_without_monitor(void)
+{
+	git_buf actual = GIT_BUF_INIT, buf = GIT_BUF_INIT;
+	git_index *index;
+
+	status(&actual);
+	cl_git_pass(git_futils_readbuffer(&buf, "status/.git/index"));
+	cl_assert(git__memmem(buf.ptr, buf.size, "FSMN", 4) != NULL);
+
+	git_repository_set_fsmonitor(g_repo, NULL, NULL);
+	status(&actual);
+
+	index = reload_index();
+	cl_assert_equal_p(NULL, index->fsmonitor_token);
+	cl_assert(!is_valid(index, "current_file"));
+
+	cl_git_pass(git_futils_readbuffer(&buf, "status/.git/index"));
+	cl_assert(git__memmem(buf.ptr, buf.size, "FSMN", 4) == NULL);
+
+	git_buf_dispose(&actual);
+	git_buf_dispose(&buf);
+}
+
+void test_status_fsmonitor__runs_hook(void)
+{
+#ifdef GIT_WIN32
+	cl_skip();
+#else
+	git_buf actual = GIT_BUF_INIT, args = GIT_BUF_INIT, expected = GIT_BUF_INIT;
+	git_index *index;
+
+	git_repository_set_fsmonitor(g_repo, NULL, NULL);
+
+	cl_git_mkfile("status/.git/fsmonitor-hook",
+		"#!/bin/sh\n"
+		"echo \"$@\" > .git/fsmonitor-args\n"
+		"printf 'hook-token\\0current_file\\0'\n");
+	cl_must_pass(p_chmod("status/.git/fsmonitor-hook", 0755));
+	cl_repo_set_string(g_repo, "core.fsmonitor", ".git/fsmonitor-hook");
+
+	status(&actual);
+	index = reload_index();
+	cl_assert(index->fsmonitor_token);
+	cl_git_pass(git_buf_printf(&expected, "2 %s\n", index->fsmonitor_token));
+
+	cl_git_rewritefile("status/current_file", "changed\n");
+	status(&actual);
+	cl_assert(has_line(&actual, "current_file 100"));
+
+	cl_git_pass(git_futils_readbuffer(&args, "status/.git/fsmonitor-args"));
+	cl_assert_equal_s(expected.ptr, args.ptr);
+
+	index = reload_index();
+	cl_assert_equal_s("hook-token", index->fsmonitor_token);
+
+	git_buf_dispose(&actual);
+	git_buf_dispose(&args);
+	git_buf_dispose(&expected);
+#endif
+}
@@ -0,0 +1,260 @@
+#include "clar_libgit2.h"
+#include "posix.h"
+#include "index.h"
+#include "repository.h"
+
+static git_repository *g_repo = NULL;
+
+void test_status_untracked_cache__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("status");
+
+	cl_git_pass(p_mkdir("status/untracked_dir", 0777));
+	cl_git_pass(p_mkdir("status/untracked_dir/nested", 0777));
+	cl_git_mkfile("status/untracked_dir/nested/file", "file\n");
+	cl_git_pass(p_mkdir("status/only_ignored", 0777));
+	cl_git_mkfile("status/only_ignored/ignored_file", "ignored\n");
+	cl_git_pass(p_mkdir("status/empty_dir", 0777));
+	cl_git_mkfile("status/subdir/.gitignore", "*.log\n");
+	cl_git_mkfile("status/subdir/debug.log", "log\n");
+}
+
+void test_status_untracked_cache__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	g_repo = NULL;
+}
+
+static int backdate_dir(void *payload, git_buf *path)
+{
+	struct p_timeval times[2];
+
+	GIT_UNUSED(payload);
+
+	if (!git_path_isdir(path->ptr) || git__suffixcmp(path->ptr, "/.git") == 0)
+		return 0;
+
+	/* directories modified in the current second are not recorded */
+	times[0].tv_sec = times[1].tv_sec = 1234567890;
+	times[0].tv_usec = times[1].tv_usec = 0;
+	cl_must_pass(p_utimes(path->ptr, times));
+
+	return git_path_direach(path, 0, backdate_dir, NULL);
+}
+
+static void backdate_workdir(void)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_sets(&path, "status"));
+	cl_git_pass(backdate_dir(NULL, &path));
+	git_buf_dispose(&path);
+}
+
+static void status(git_buf *out, unsigned int flags)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *list;
+	const git_status_entry *entry;
+	size_t i;
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED | GIT_STATUS_OPT_UPDATE_INDEX | flags;
+
+	cl_git_pass(git_status_list_new(&list, g_repo, &opts));
+
+	git_buf_clear(out);
+
+	for (i = 0; i < git_status_list_entrycount(list); i++) {
+		entry = git_status_byindex(list, i);
+		git_buf_printf(out, "%s %x\n", entry->index_to_workdir ?
+			entry->index_to_workdir->new_file.path :
+			entry->head_to_index->new_file.path, entry->status);
+	}
+
+	cl_assert(!git_buf_oom(out));
+	git_status_list_free(list);
+}
+
+static git_untracked_cache *reload_cache(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_git_pass(git_index_read(index, true));
+
+	return index->untracked;
+}
+
+static void assert_status_with_cache(unsigned int flags)
+{
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+	git_untracked_cache *cache;
+
+	backdate_workdir();
+	status(&expected, flags);
+	cl_assert_equal_p(NULL, reload_cache());
+
+	/* the first status records the cache, and the second uses it */
+	cl_repo_set_bool(g_repo, "core.untrackedCache", true);
+
+	status(&actual, flags);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	cl_assert(cache = reload_cache());
+	cl_assert(cache->root && cache->root->valid);
+
+	status(&actual, flags);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	git_buf_dispose(&expected);
+	git_buf_dispose(&actual);
+}
+
+void test_status_untracked_cache__same_status(void)
+{
+	assert_status_with_cache(0);
+}
+
+void test_status_untracked_cache__same_status_recursing(void)
+{
+	assert_status_with_cache(GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+}
+
+void test_status_untracked_cache__records_untracked_files(void)
+{
+	git_untracked_cache *cache;
+	git_untracked_cache_dir *dir;
+	git_buf untracked = GIT_BUF_INIT;
+	const char *name;
+	size_t i;
+
+	assert_status_with_cache(GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(cache = reload_cache());
+
+	cl_assert(dir = git_untracked_cache_lookup(cache, "", false));
+	git_vector_foreach(&dir->untracked, i, name)
+		git_buf_printf(&untracked, "%s,", name);
+
+	/* ignored files and empty directories are left out */
+	cl_assert_equal_s("new_file,staged_delete_modified_file,untracked_dir/,这,", untracked.ptr);
+
+	cl_assert(dir = git_untracked_cache_lookup(cache, "subdir/", false));
+	cl_assert(dir->valid);
+	cl_assert_equal_sz(2, dir->untracked.length);
+	cl_assert_equal_s(".gitignore", git_vector_get(&dir->untracked, 0));
+	cl_assert_equal_s("new_file", git_vector_get(&dir->untracked, 1));
+	cl_assert(!git_oid_iszero(&dir->exclude_id));
+
+	cl_assert(dir = git_untracked_cache_lookup(cache, "untracked_dir/nested", false));
+	cl_assert(dir->valid);
+	cl_assert_equal_sz(1, dir->untracked.length);
+
+	git_buf_dispose(&untracked);
+}
+
+void test_status_untracked_cache__uses_cached_listing(void)
+{
+	git_buf actual = GIT_BUF_INIT;
+	git_untracked_cache *cache;
+	git_untracked_cache_dir *dir;
+
+	assert_status_with_cache(0);
+	cl_assert(cache = reload_cache());
+
+	/* the directory is not read again while it is unchanged */
+	cl_assert(dir = git_untracked_cache_lookup(cache, "subdir", false));
+	cl_assert_equal_sz(2, dir->untracked.length);
+	git__free(git_vector_get(&dir->untracked, 1));
+	cl_git_pass(git_vector_remove(&dir->untracked, 1));
+
+	status(&actual, 0);
+	cl_assert(strstr(actual.ptr, "subdir/new_file") == NULL);
+	cl_assert(strstr(actual.ptr, "subdir/.gitignore") != NULL);
+	cl_assert(strstr(actual.ptr, "subdir/modified_file") != NULL);
+
+	git_buf_dispose(&actual);
+}
+
+void test_status_untracked_cache__notices_changes(void)
+{
+	git_buf actual = GIT_BUF_INIT;
+	git_index *index;
+
+	assert_status_with_cache(GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+
+	/* a new file changes the directory */
+	cl_git_mkfile("status/subdir/another_file", "another\n");
+	status(&actual, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(strstr(actual.ptr, "subdir/another_file 80\n") != NULL);
+
+	/* a file in an empty directory makes it untracked */
+	cl_git_mkfile("status/empty_dir/file", "file\n");
+	status(&actual, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(strstr(actual.ptr, "empty_dir/file 80\n") != NULL);
+
+	/* so does a new ignore rule, which may not change the directory */
+	cl_git_append2file("status/subdir/.gitignore", "new_file\n");
+	status(&actual, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(strstr(actual.ptr, "subdir/new_file") == NULL);
+
+	cl_git_append2file("status/.git/info/exclude", "untracked_dir/\n");
+	status(&actual, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(strstr(actual.ptr, "untracked_dir") == NULL);
+
+	/* and adding a file to the index */
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "new_file"));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	status(&actual, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(strstr(actual.ptr, "new_file 1\n") != NULL);
+
+	git_buf_dispose(&actual);
+}
+
+void test_status_untracked_cache__not_used_for_ignored_files(void)
+{
+	git_buf actual = GIT_BUF_INIT;
+
+	assert_status_with_cache(0);
+
+	status(&actual, GIT_STATUS_OPT_INCLUDE_IGNORED);
+	cl_assert(strstr(actual.ptr, "ignored_file 4000\n") != NULL);
+	cl_assert(strstr(actual.ptr, "only_ignored/ 4000\n") != NULL);
+
+	git_buf_dispose(&actual);
+}
+
+void test_status_untracked_cache__can_be_disabled(void)
+{
+	git_buf actual = GIT_BUF_INIT, buf = GIT_BUF_INIT;
+	git_index *index;
+
+	assert_status_with_cache(0);
+
+	cl_repo_set_bool(g_repo, "core.untrackedCache", false);
+	status(&actual, 0);
+
+	/* the cache is dropped the next time the index is written */
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_git_pass(git_index_write(index));
+	cl_assert_equal_p(NULL, reload_cache());
+
+	cl_git_pass(git_futils_readbuffer(&buf, "status/.git/index"));
+	cl_assert(git__memmem(buf.ptr, buf.size, "UNTR", 4) == NULL);
+
+	git_buf_dispose(&actual);
+	git_buf_dispose(&buf);
+}
+
+void test_status_untracked_cache__ignores_invalid_extension(void)
+{
+	git_untracked_cache *cache;
+
+	cl_git_pass(git_untracked_cache_read(&cache, "\x05zzz", 4));
+	cl_assert_equal_p(NULL, cache);
+
+	cl_git_pass(git_untracked_cache_read(&cache, "\x40" "abc\0", 5));
+	cl_assert_equal_p(NULL, cache);
+}
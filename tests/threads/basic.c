@@ -49,6 +49,23 @@ void test_threads_basic__set_error(void)
 	run_in_parallel(1, 4, set_error, NULL, NULL);
 }
 
+static void *capture_error(void *dummy)
+{
+	git_error_state state;
+
+	git_error_set(GIT_ERROR_INVALID, "oh no, something happened!\n");
+	git_error_state_capture(&state, -1);
+	git_error_state_free(&state);
+
+	return dummy;
+}
+
+/* A worker hands its error back to the caller before it exits */
+void test_threads_basic__capture_error(void)
+{
+	run_in_parallel(1, 4, capture_error, NULL, NULL);
+}
+
 #ifdef GIT_THREADS
 static void *return_normally(void *param)
 {
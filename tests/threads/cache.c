@@ -0,0 +1,97 @@
+#include "clar_libgit2.h"
+
+#include "thread_helpers.h"
+#include "cache.h"
+#include "repository.h"
+
+#define LOOKUPS 20000
+#define THREADS 8
+
+static git_repository *g_repo;
+static git_array_t(git_oid) g_ids;
+
+/* What each thread saw; only the main thread can fail the test */
+static struct lookup_result {
+	int error;
+	size_t mismatches;
+} g_results[THREADS];
+
+/* Collect the objects that are cached by default: all but the blobs. */
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_odb *odb = payload;
+	git_object_t type;
+	git_oid *out;
+	size_t size;
+
+	cl_git_pass(git_odb_read_header(&size, &type, odb, id));
+	if (type == GIT_OBJECT_BLOB)
+		return 0;
+
+	out = git_array_alloc(g_ids);
+	cl_assert(out);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+void test_threads_cache__initialize(void)
+{
+	git_odb *odb;
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+	cl_git_pass(git_odb_foreach(odb, collect_id, odb));
+	git_odb_free(odb);
+}
+
+void test_threads_cache__cleanup(void)
+{
+	git_array_clear(g_ids);
+	git_repository_free(g_repo);
+	g_repo = NULL;
+}
+
+static void *lookup_objects(void *arg)
+{
+	int thread = *(int *)arg;
+	struct lookup_result *result = &g_results[thread];
+	git_object *obj;
+	git_oid *id;
+	size_t i;
+
+	for (i = 0; i < LOOKUPS; i++) {
+		id = git_array_get(g_ids, (i * 7 + thread) % git_array_size(g_ids));
+
+		if ((result->error = git_object_lookup(&obj, g_repo, id, GIT_OBJECT_ANY)) < 0)
+			break;
+
+		if (!git_oid_equal(id, git_object_id(obj)))
+			result->mismatches++;
+
+		git_object_free(obj);
+	}
+
+	return arg;
+}
+
+static void clear_results(void)
+{
+	memset(g_results, 0, sizeof(g_results));
+}
+
+static void check_results(void)
+{
+	size_t i;
+
+	for (i = 0; i < THREADS; i++) {
+		cl_git_pass(g_results[i].error);
+		cl_assert_equal_sz(0, g_results[i].mismatches);
+	}
+}
+
+void test_threads_cache__parallel_lookups(void)
+{
+	run_in_parallel(5, THREADS, lookup_objects, clear_results, check_results);
+
+	cl_assert_equal_sz(git_array_size(g_ids), git_cache_size(&g_repo->objects));
+}
@@ -0,0 +1,77 @@
+#include "clar_libgit2.h"
+
+#include "thread_helpers.h"
+#include "array.h"
+#include "odb.h"
+
+#define READS 2000
+
+static git_odb *g_odb;
+static git_array_t(git_oid) g_ids;
+static size_t g_window_size, g_mapped_limit;
+
+static int collect_id(const git_oid *id, void *payload)
+{
+	git_oid *out = git_array_alloc(g_ids);
+
+	GIT_UNUSED(payload);
+
+	cl_assert(out);
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+void test_threads_packread__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_SIZE, &g_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &g_mapped_limit));
+
+	/* small windows, and few of them, so that they get closed and reopened */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, (size_t)8192));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, (size_t)16384));
+
+	cl_git_pass(git_odb_open(&g_odb, cl_fixture("testrepo.git/objects")));
+	cl_git_pass(git_odb_foreach(g_odb, collect_id, NULL));
+}
+
+void test_threads_packread__cleanup(void)
+{
+	git_array_clear(g_ids);
+	git_odb_free(g_odb);
+	g_odb = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, g_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, g_mapped_limit));
+}
+
+static void *read_objects(void *arg)
+{
+	int thread = *(int *)arg;
+	git_odb_object *obj;
+	git_object_t type;
+	git_oid *id, actual;
+	size_t i, size;
+
+	for (i = 0; i < READS; i++) {
+		id = git_array_get(g_ids, (i * 13 + thread) % git_array_size(g_ids));
+
+		cl_git_pass(git_odb_read_header(&size, &type, g_odb, id));
+
+		cl_git_pass(git_odb_read(&obj, g_odb, id));
+		cl_assert_equal_sz(size, git_odb_object_size(obj));
+		cl_assert_equal_i(type, git_odb_object_type(obj));
+
+		cl_git_pass(git_odb_hash(&actual, git_odb_object_data(obj),
+			git_odb_object_size(obj), git_odb_object_type(obj)));
+		cl_assert_equal_oid(id, &actual);
+
+		git_odb_object_free(obj);
+	}
+
+	return arg;
+}
+
+void test_threads_packread__parallel_reads_through_small_windows(void)
+{
+	run_in_parallel(3, 8, read_objects, NULL, NULL);
+}